@@ -186,6 +186,200 @@ AddData(PFILE_RECORD_HEADER FileRecord,
     return STATUS_SUCCESS;
 }
 
+/**
+* @name AddNamedData
+* @implemented
+*
+* Adds a named, resident $DATA attribute to a given FileRecord.
+*
+* @param Vcb
+* Pointer to an NTFS_VCB for the destination volume.
+*
+* @param FileRecord
+* Pointer to a complete file record to add the attribute to.
+*
+* @param AttributeAddress
+* Pointer to the region of memory that will receive the $DATA attribute.
+* This address must reside within FileRecord. Must be aligned to an 8-byte boundary (relative to FileRecord).
+*
+* @param Name
+* Pointer to a string of 16-bit Unicode characters naming the stream.
+*
+* @param NameLength
+* The number of wide-characters in the name.
+*
+* @param Value
+* Pointer to the initial data of the stream.
+*
+* @param ValueLength
+* Size of the initial data, in bytes.
+*
+* @return
+* STATUS_SUCCESS on success. STATUS_NOT_IMPLEMENTED if target address isn't at the end
+* of the given file record, or if the file record isn't large enough for the attribute.
+*
+* @remarks
+* Only adding the attribute to the end of the file record is supported; AttributeAddress must
+* be of type AttributeEnd. Attributes must be added in the order of their types and names.
+*/
+NTSTATUS
+AddNamedData(PNTFS_VCB Vcb,
+             PFILE_RECORD_HEADER FileRecord,
+             PNTFS_ATTR_RECORD AttributeAddress,
+             PCWSTR Name,
+             USHORT NameLength,
+             PVOID Value,
+             ULONG ValueLength)
+{
+    ULONG ResidentHeaderLength = FIELD_OFFSET(NTFS_ATTR_RECORD, Resident.Reserved) + sizeof(UCHAR);
+    ULONG FileRecordEnd = AttributeAddress->Length;
+    ULONG AttributeLength;
+    ULONG NameOffset;
+    ULONG ValueOffset;
+    ULONG BytesAvailable;
+
+    if (AttributeAddress->Type != AttributeEnd)
+    {
+        DPRINT1("FIXME: Can only add $DATA attribute to the end of a file record.\n");
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    NameOffset = ResidentHeaderLength;
+
+    // Calculate ValueOffset, which will be aligned to a 4-byte boundary
+    ValueOffset = ALIGN_UP_BY(NameOffset + (sizeof(WCHAR) * NameLength), VALUE_OFFSET_ALIGNMENT);
+
+    // Calculate length of attribute
+    AttributeLength = ValueOffset + ValueLength;
+    AttributeLength = ALIGN_UP_BY(AttributeLength, ATTR_RECORD_ALIGNMENT);
+
+    // Make sure the file record is large enough for the new attribute
+    BytesAvailable = Vcb->NtfsInfo.BytesPerFileRecord - FileRecord->BytesInUse;
+    if (BytesAvailable < AttributeLength)
+    {
+        DPRINT1("FIXME: Not enough room in file record for data attribute!\n");
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    // Set Attribute fields
+    RtlZeroMemory(AttributeAddress, AttributeLength);
+
+    AttributeAddress->Type = AttributeData;
+    AttributeAddress->Length = AttributeLength;
+    AttributeAddress->NameLength = NameLength;
+    AttributeAddress->NameOffset = NameOffset;
+    AttributeAddress->Instance = FileRecord->NextAttributeNumber++;
+
+    AttributeAddress->Resident.ValueLength = ValueLength;
+    AttributeAddress->Resident.ValueOffset = ValueOffset;
+
+    // Set the name and the data
+    RtlCopyMemory((PCHAR)((ULONG_PTR)AttributeAddress + NameOffset), Name, NameLength * sizeof(WCHAR));
+    RtlCopyMemory((PCHAR)((ULONG_PTR)AttributeAddress + ValueOffset), Value, ValueLength);
+
+    // move the attribute-end and file-record-end markers to the end of the file record
+    AttributeAddress = (PNTFS_ATTR_RECORD)((ULONG_PTR)AttributeAddress + AttributeAddress->Length);
+    SetFileRecordEnd(FileRecord, AttributeAddress, FileRecordEnd);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+* @name AddNonResidentData
+* @implemented
+*
+* Adds an empty, non-resident $DATA attribute to a given FileRecord.
+*
+* @param Vcb
+* Pointer to an NTFS_VCB for the destination volume.
+*
+* @param FileRecord
+* Pointer to a complete file record to add the attribute to.
+*
+* @param AttributeAddress
+* Pointer to the region of memory that will receive the $DATA attribute.
+* This address must reside within FileRecord. Must be aligned to an 8-byte boundary (relative to FileRecord).
+*
+* @param Name
+* Pointer to a string of 16-bit Unicode characters naming the stream, or NULL for the unnamed stream.
+*
+* @param NameLength
+* The number of wide-characters in the name.
+*
+* @return
+* STATUS_SUCCESS on success. STATUS_NOT_IMPLEMENTED if target address isn't at the end
+* of the given file record, or if the file record isn't large enough for the attribute.
+*
+* @remarks
+* Only adding the attribute to the end of the file record is supported; AttributeAddress must
+* be of type AttributeEnd. Unlike a resident attribute, it can grow without being converted,
+* so attributes may follow it.
+*/
+NTSTATUS
+AddNonResidentData(PNTFS_VCB Vcb,
+                   PFILE_RECORD_HEADER FileRecord,
+                   PNTFS_ATTR_RECORD AttributeAddress,
+                   PCWSTR Name,
+                   USHORT NameLength)
+{
+    ULONG RecordLength;
+    ULONG FileRecordEnd;
+    ULONG NameOffset;
+    ULONG DataRunOffset;
+    ULONG BytesAvailable;
+
+    if (AttributeAddress->Type != AttributeEnd)
+    {
+        DPRINT1("FIXME: Can only add $DATA attribute to the end of a file record.\n");
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    // Calculate the name offset
+    NameOffset = FIELD_OFFSET(NTFS_ATTR_RECORD, NonResident.CompressedSize);
+
+    // Calculate the offset to the first data run, aligned to a 4-byte boundary
+    DataRunOffset = (sizeof(WCHAR) * NameLength) + NameOffset;
+    DataRunOffset = ALIGN_UP_BY(DataRunOffset, DATA_RUN_ALIGNMENT);
+
+    // Calculate the length of the new attribute; the empty data run will consist of a single byte
+    RecordLength = DataRunOffset + 1;
+    RecordLength = ALIGN_UP_BY(RecordLength, ATTR_RECORD_ALIGNMENT);
+
+    // Back up the last 4-bytes of the file record (even though this value doesn't matter)
+    FileRecordEnd = AttributeAddress->Length;
+
+    // Make sure the file record can contain the new attribute
+    BytesAvailable = Vcb->NtfsInfo.BytesPerFileRecord - FileRecord->BytesInUse;
+    if (BytesAvailable < RecordLength)
+    {
+        DPRINT1("FIXME: Not enough room in file record for data attribute!\n");
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    // Set fields of attribute header
+    RtlZeroMemory(AttributeAddress, RecordLength);
+
+    AttributeAddress->Type = AttributeData;
+    AttributeAddress->Length = RecordLength;
+    AttributeAddress->IsNonResident = TRUE;
+    AttributeAddress->NameLength = NameLength;
+    AttributeAddress->NameOffset = NameOffset;
+    AttributeAddress->Instance = FileRecord->NextAttributeNumber++;
+
+    AttributeAddress->NonResident.MappingPairsOffset = DataRunOffset;
+    AttributeAddress->NonResident.HighestVCN = (LONGLONG)-1;
+
+    // Set the name
+    if (NameLength != 0)
+        RtlCopyMemory((PCHAR)((ULONG_PTR)AttributeAddress + NameOffset), Name, NameLength * sizeof(WCHAR));
+
+    // move the attribute-end and file-record-end markers to the end of the file record
+    AttributeAddress = (PNTFS_ATTR_RECORD)((ULONG_PTR)AttributeAddress + AttributeAddress->Length);
+    SetFileRecordEnd(FileRecord, AttributeAddress, FileRecordEnd);
+
+    return STATUS_SUCCESS;
+}
+
 /**
 * @name AddFileName
 * @implemented
@@ -604,14 +798,8 @@ AddRun(PNTFS_VCB Vcb,
        ULONG RunLength)
 {
     NTSTATUS Status;
-    int DataRunMaxLength;
-    PNTFS_ATTR_RECORD DestinationAttribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)FileRecord + AttrOffset);
-    ULONG NextAttributeOffset = AttrOffset + AttrContext->pRecord->Length;
     ULONGLONG NextVBN = 0;
 
-    PUCHAR RunBuffer;
-    ULONG RunBufferSize;
-
     if (!AttrContext->pRecord->IsNonResident)
         return STATUS_INVALID_PARAMETER;
 
@@ -636,104 +824,18 @@ AddRun(PNTFS_VCB Vcb,
     }
     _SEH2_END;
 
-    RunBuffer = ExAllocatePoolWithTag(NonPagedPool, Vcb->NtfsInfo.BytesPerFileRecord, TAG_NTFS);
-    if (!RunBuffer)
-    {
-        DPRINT1("ERROR: Couldn't allocate memory for data runs!\n");
-        return STATUS_INSUFFICIENT_RESOURCES;
-    }
-
-    // Convert the map control block back to encoded data runs
-    ConvertLargeMCBToDataRuns(&AttrContext->DataRunsMCB, RunBuffer, Vcb->NtfsInfo.BytesPerCluster, &RunBufferSize);
-
-    // Get the amount of free space between the start of the of the first data run and the attribute end
-    DataRunMaxLength = AttrContext->pRecord->Length - AttrContext->pRecord->NonResident.MappingPairsOffset;
-
-    // Do we need to extend the attribute (or convert to attribute list)?
-    if (DataRunMaxLength < RunBufferSize)
-    {
-        PNTFS_ATTR_RECORD NextAttribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)FileRecord + NextAttributeOffset);
-        PNTFS_ATTR_RECORD NewRecord;
-
-        // Add free space at the end of the file record to DataRunMaxLength
-        DataRunMaxLength += Vcb->NtfsInfo.BytesPerFileRecord - FileRecord->BytesInUse;
-
-        // Can we resize the attribute?
-        if (DataRunMaxLength < RunBufferSize)
-        {
-            DPRINT1("FIXME: Need to create attribute list! Max Data Run Length available: %d, RunBufferSize: %d\n", DataRunMaxLength, RunBufferSize);
-            ExFreePoolWithTag(RunBuffer, TAG_NTFS);
-            return STATUS_NOT_IMPLEMENTED;
-        }
-
-        // Are there more attributes after the one we're resizing?
-        if (NextAttribute->Type != AttributeEnd)
-        {
-            PNTFS_ATTR_RECORD FinalAttribute;
-
-            // Calculate where to move the trailing attributes
-            ULONG_PTR MoveTo = (ULONG_PTR)DestinationAttribute + AttrContext->pRecord->NonResident.MappingPairsOffset + RunBufferSize;
-            MoveTo = ALIGN_UP_BY(MoveTo, ATTR_RECORD_ALIGNMENT);
-
-            DPRINT1("Moving attribute(s) after this one starting with type 0x%lx\n", NextAttribute->Type);
-
-            // Move the trailing attributes; FinalAttribute will point to the end marker
-            FinalAttribute = MoveAttributes(Vcb, NextAttribute, NextAttributeOffset, MoveTo);
-
-            // set the file record end
-            SetFileRecordEnd(FileRecord, FinalAttribute, FILE_RECORD_END);
-        }
-
-        // calculate position of end markers
-        NextAttributeOffset = AttrOffset + AttrContext->pRecord->NonResident.MappingPairsOffset + RunBufferSize;
-        NextAttributeOffset = ALIGN_UP_BY(NextAttributeOffset, ATTR_RECORD_ALIGNMENT);
-
-        // Update the length of the destination attribute
-        DestinationAttribute->Length = NextAttributeOffset - AttrOffset;
-
-        // Create a new copy of the attribute record
-        NewRecord = ExAllocatePoolWithTag(NonPagedPool, DestinationAttribute->Length, TAG_NTFS);
-        RtlCopyMemory(NewRecord, AttrContext->pRecord, AttrContext->pRecord->Length);
-        NewRecord->Length = DestinationAttribute->Length;
-
-        // Free the old copy of the attribute record, which won't be large enough
-        ExFreePoolWithTag(AttrContext->pRecord, TAG_NTFS);
-
-        // Set the attribute context's record to the new copy
-        AttrContext->pRecord = NewRecord;
-
-        // if NextAttribute is the AttributeEnd marker
-        if (NextAttribute->Type == AttributeEnd)
-        {
-            // End the file record
-            NextAttribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)FileRecord + NextAttributeOffset);
-            SetFileRecordEnd(FileRecord, NextAttribute, FILE_RECORD_END);
-        }
-    }
+    AttrContext->CachedRunLength = 0;
 
     // Update HighestVCN
-    DestinationAttribute->NonResident.HighestVCN =
-    AttrContext->pRecord->NonResident.HighestVCN = max(NextVBN - 1 + RunLength,
-                                                     AttrContext->pRecord->NonResident.HighestVCN);
-
-    // Write data runs to destination attribute
-    RtlCopyMemory((PVOID)((ULONG_PTR)DestinationAttribute + DestinationAttribute->NonResident.MappingPairsOffset),
-                  RunBuffer,
-                  RunBufferSize);
+    AttrContext->pRecord->NonResident.HighestVCN = NextVBN + RunLength - 1;
 
-    // Update the attribute record in the attribute context
-    RtlCopyMemory((PVOID)((ULONG_PTR)AttrContext->pRecord + AttrContext->pRecord->NonResident.MappingPairsOffset),
-                  RunBuffer,
-                  RunBufferSize);
+    // Convert the map control block back to encoded data runs
+    Status = StoreDataRuns(Vcb, AttrContext, AttrOffset, FileRecord);
+    if (!NT_SUCCESS(Status))
+        return Status;
 
     // Update the file record
-    Status = UpdateFileRecord(Vcb, AttrContext->FileMFTIndex, FileRecord);
-
-    ExFreePoolWithTag(RunBuffer, TAG_NTFS);
-
-    NtfsDumpDataRuns((PUCHAR)((ULONG_PTR)DestinationAttribute + DestinationAttribute->NonResident.MappingPairsOffset), 0);
-
-    return Status;
+    return UpdateFileRecord(Vcb, AttrContext->FileMFTIndex, FileRecord);
 }
 
 /**
@@ -878,6 +980,10 @@ ConvertDataRunsToLargeMCB(PUCHAR DataRun,
 * @param DataRunsMCB
 * Pointer to a LARGE_MCB structure describing the data runs.
 *
+* @param ClusterCount
+* Number of clusters the data runs must describe (HighestVCN + 1). Holes in DataRunsMCB, and
+* clusters past its last mapping, are stored as sparse runs.
+*
 * @param RunBuffer
 * Pointer to the buffer that will receive the encoded data runs.
 *
@@ -894,6 +1000,7 @@ ConvertDataRunsToLargeMCB(PUCHAR DataRun,
 */
 NTSTATUS
 ConvertLargeMCBToDataRuns(PLARGE_MCB DataRunsMCB,
+                          ULONGLONG ClusterCount,
                           PUCHAR RunBuffer,
                           ULONG MaxBufferSize,
                           PULONG UsedBufferSize)
@@ -902,30 +1009,46 @@ ConvertLargeMCBToDataRuns(PLARGE_MCB DataRunsMCB,
     ULONG RunBufferOffset = 0;
     LONGLONG  DataRunOffset;
     ULONGLONG LastLCN = 0;
+    ULONGLONG NextVBN = 0;
     LONGLONG Vbn, Lbn, Count;
     ULONG i;
 
 
     DPRINT("\t[Vbn, Lbn, Count]\n");
 
-    // convert each mcb entry to a data run
-    for (i = 0; FsRtlGetNextLargeMcbEntry(DataRunsMCB, i, &Vbn, &Lbn, &Count); i++)
+    // convert each mcb entry to a data run, then describe the clusters past the last one as a hole
+    for (i = 0; ; i++)
     {
         UCHAR DataRunOffsetSize = 0;
         UCHAR DataRunLengthSize = 0;
         UCHAR ControlByte = 0;
 
+        if (!FsRtlGetNextLargeMcbEntry(DataRunsMCB, i, &Vbn, &Lbn, &Count))
+        {
+            if (NextVBN >= ClusterCount)
+                break;
+
+            Vbn = NextVBN;
+            Lbn = -1;
+            Count = ClusterCount - NextVBN;
+        }
+
         // [vbn, lbn, count]
         DPRINT("\t[%I64d, %I64d,%I64d]\n", Vbn, Lbn, Count);
 
-        // TODO: check for holes and convert to sparse runs
-        DataRunOffset = Lbn - LastLCN;
-        LastLCN = Lbn;
+        NextVBN = Vbn + Count;
 
-        // now we need to determine how to represent DataRunOffset with the minimum number of bytes
-        DPRINT("Determining how many bytes needed to represent %I64x\n", DataRunOffset);
-        DataRunOffsetSize = GetPackedByteCount(DataRunOffset, TRUE);
-        DPRINT("%d bytes needed.\n", DataRunOffsetSize);
+        // a sparse run has no offset, and doesn't change the LCN the next offset is relative to
+        if (Lbn != -1)
+        {
+            DataRunOffset = Lbn - LastLCN;
+            LastLCN = Lbn;
+
+            // now we need to determine how to represent DataRunOffset with the minimum number of bytes
+            DPRINT("Determining how many bytes needed to represent %I64x\n", DataRunOffset);
+            DataRunOffsetSize = GetPackedByteCount(DataRunOffset, TRUE);
+            DPRINT("%d bytes needed.\n", DataRunOffsetSize);
+        }
 
         // determine how to represent DataRunLengthSize with the minimum number of bytes
         DPRINT("Determining how many bytes needed to represent %I64x\n", Count);
@@ -1020,6 +1143,78 @@ FindRun(PNTFS_ATTR_RECORD NresAttr,
     return TRUE;
 }
 
+/**
+* @name NtfsLookupAttributeRun
+* @implemented
+*
+* Translates a VCN of a non-resident attribute into an LCN, using the attribute's map control block.
+*
+* @param AttrContext
+* Pointer to an NTFS_ATTR_CONTEXT describing a non-resident attribute.
+*
+* @param Vcn
+* Virtual cluster number to translate.
+*
+* @param Lcn
+* Pointer to a LONGLONG that receives the logical cluster number Vcn is stored at, or -1 if
+* Vcn is in a sparse run.
+*
+* @param ClusterCount
+* Pointer to a ULONGLONG that receives the number of clusters from Vcn to the end of its run.
+*
+* @return
+* TRUE if Vcn is mapped or in a hole, FALSE if it's beyond HighestVCN of the attribute.
+*
+* @remarks
+* The run that was found last is remembered in AttrContext, so that sequential accesses don't
+* query the MCB again. Whoever modifies DataRunsMCB must reset AttrContext->CachedRunLength.
+*/
+BOOLEAN
+NtfsLookupAttributeRun(PNTFS_ATTR_CONTEXT AttrContext,
+                       ULONGLONG Vcn,
+                       PLONGLONG Lcn,
+                       PULONGLONG ClusterCount)
+{
+    LONGLONG CountFromLcn, StartingLcn, CountFromStartingLcn;
+    LONGLONG Delta;
+
+    if (AttrContext->CachedRunLength == 0 ||
+        (LONGLONG)Vcn < AttrContext->CachedRunVcn ||
+        (LONGLONG)Vcn >= AttrContext->CachedRunVcn + AttrContext->CachedRunLength)
+    {
+        if (!FsRtlLookupLargeMcbEntry(&AttrContext->DataRunsMCB,
+                                      Vcn,
+                                      Lcn,
+                                      &CountFromLcn,
+                                      &StartingLcn,
+                                      &CountFromStartingLcn,
+                                      NULL))
+        {
+            // The clusters after the last mapping of a sparse attribute are a hole
+            if (!AttrContext->pRecord->IsNonResident ||
+                Vcn > AttrContext->pRecord->NonResident.HighestVCN ||
+                AttrContext->pRecord->NonResident.HighestVCN == (ULONGLONG)-1)
+            {
+                return FALSE;
+            }
+
+            *Lcn = -1;
+            *ClusterCount = AttrContext->pRecord->NonResident.HighestVCN + 1 - Vcn;
+            return TRUE;
+        }
+
+        AttrContext->CachedRunVcn = Vcn - (CountFromStartingLcn - CountFromLcn);
+        AttrContext->CachedRunLcn = StartingLcn;
+        AttrContext->CachedRunLength = CountFromStartingLcn;
+    }
+
+    Delta = Vcn - AttrContext->CachedRunVcn;
+    *Lcn = (AttrContext->CachedRunLcn == -1) ? -1 : AttrContext->CachedRunLcn + Delta;
+    *ClusterCount = AttrContext->CachedRunLength - Delta;
+
+    return TRUE;
+}
+
 /**
 * @name FreeClusters
 * @implemented
@@ -1063,108 +1258,214 @@ FreeClusters(PNTFS_VCB Vcb,
     NTSTATUS Status = STATUS_SUCCESS;
     ULONG ClustersLeftToFree = ClustersToFree;
 
-    PNTFS_ATTR_RECORD DestinationAttribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)FileRecord + AttrOffset);
-    ULONG NextAttributeOffset = AttrOffset + AttrContext->pRecord->Length;
-    PNTFS_ATTR_RECORD NextAttribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)FileRecord + NextAttributeOffset);
-
-    PUCHAR RunBuffer;
-    ULONG RunBufferSize = 0;
-
-    PFILE_RECORD_HEADER BitmapRecord;
-    PNTFS_ATTR_CONTEXT DataContext;
-    ULONGLONG BitmapDataSize;
-    PUCHAR BitmapData;
-    RTL_BITMAP Bitmap;
-    ULONG LengthWritten;
+    ULONGLONG RunStart = 0;
+    ULONG RunLength = 0;
 
     if (!AttrContext->pRecord->IsNonResident)
     {
         return STATUS_INVALID_PARAMETER;
     }
 
-    // Read the $Bitmap file
-    BitmapRecord = ExAllocateFromNPagedLookasideList(&Vcb->FileRecLookasideList);
-    if (BitmapRecord == NULL)
+    if (ClustersToFree > AttrContext->pRecord->NonResident.AllocatedSize / Vcb->NtfsInfo.BytesPerCluster)
     {
-        DPRINT1("Error: Unable to allocate memory for bitmap file record!\n");
-        return STATUS_NO_MEMORY;
+        DPRINT1("DRIVER ERROR: FreeClusters called to free %lu clusters, which is more clusters than are assigned to attribute!",
+                ClustersToFree);
+        return STATUS_INVALID_PARAMETER;
     }
 
-    Status = ReadFileRecord(Vcb, NTFS_FILE_BITMAP, BitmapRecord);
-    if (!NT_SUCCESS(Status))
+    // Clusters are released from the end of the stream, so a run grows backwards
+    while (ClustersLeftToFree > 0)
     {
-        DPRINT1("Error: Unable to read file record for bitmap!\n");
-        ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, BitmapRecord);
-        return 0;
+        LONGLONG LargeVbn, LargeLbn;
+
+        // Only a cluster that is mapped has to be released; holes at the end of a sparse stream are just dropped
+        if (FsRtlLookupLastLargeMcbEntry(&AttrContext->DataRunsMCB, &LargeVbn, &LargeLbn) &&
+            LargeVbn == (LONGLONG)AttrContext->pRecord->NonResident.HighestVCN &&
+            LargeLbn != -1)
+        {
+            if (RunLength != 0 && (ULONGLONG)LargeLbn + 1 == RunStart)
+            {
+                RunStart--;
+                RunLength++;
+            }
+            else
+            {
+                // deallocate the previous run in $BITMAP
+                Status = NtfsDeallocateClusters(Vcb, RunStart, RunLength);
+                if (!NT_SUCCESS(Status))
+                    return Status;
+
+                RunStart = LargeLbn;
+                RunLength = 1;
+            }
+
+            FsRtlTruncateLargeMcb(&AttrContext->DataRunsMCB, AttrContext->pRecord->NonResident.HighestVCN);
+            AttrContext->CachedRunLength = 0;
+        }
+
+        // decrement HighestVCN, but don't let it go below 0
+        AttrContext->pRecord->NonResident.HighestVCN = min(AttrContext->pRecord->NonResident.HighestVCN, AttrContext->pRecord->NonResident.HighestVCN - 1);
+        ClustersLeftToFree--;
     }
 
-    Status = FindAttribute(Vcb, BitmapRecord, AttributeData, L"", 0, &DataContext, NULL);
+    Status = NtfsDeallocateClusters(Vcb, RunStart, RunLength);
     if (!NT_SUCCESS(Status))
-    {
-        DPRINT1("Error: Unable to find data attribute for bitmap file!\n");
-        ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, BitmapRecord);
-        return 0;
-    }
+        return Status;
 
-    BitmapDataSize = AttributeDataLength(DataContext->pRecord);
-    BitmapDataSize = min(BitmapDataSize, ULONG_MAX);
-    ASSERT((BitmapDataSize * 8) >= Vcb->NtfsInfo.ClusterCount);
-    BitmapData = ExAllocatePoolWithTag(NonPagedPool, ROUND_UP(BitmapDataSize, Vcb->NtfsInfo.BytesPerSector), TAG_NTFS);
-    if (BitmapData == NULL)
-    {
-        DPRINT1("Error: Unable to allocate memory for bitmap file data!\n");
-        ReleaseAttributeContext(DataContext);
-        ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, BitmapRecord);
-        return 0;
-    }
+    // Save updated data runs to file record
+    Status = StoreDataRuns(Vcb, AttrContext, AttrOffset, FileRecord);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    // Update the file record
+    return UpdateFileRecord(Vcb, AttrContext->FileMFTIndex, FileRecord);
+}
+
+/**
+* @name NtfsMakeAttributeSparse
+* @implemented
+*
+* Marks a non-resident attribute as sparse. Doesn't update the file record.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @param AttrContext
+* Pointer to an NTFS_ATTR_CONTEXT describing the attribute.
+*
+* @param AttrOffset
+* Byte offset of the attribute relative to its file record.
+*
+* @param FileRecord
+* Pointer to a complete copy of the file record containing the attribute.
+*
+* @return
+* STATUS_SUCCESS on success. STATUS_NOT_IMPLEMENTED if the file record has no room for
+* the larger attribute header (it would need an attribute list).
+*
+* @remarks
+* The header of a sparse attribute also holds CompressedSize, so the name and data runs
+* are moved 8 bytes further when the attribute doesn't have room for it yet.
+*/
+NTSTATUS
+NtfsMakeAttributeSparse(PDEVICE_EXTENSION Vcb,
+                        PNTFS_ATTR_CONTEXT AttrContext,
+                        ULONG AttrOffset,
+                        PFILE_RECORD_HEADER FileRecord)
+{
+    PNTFS_ATTR_RECORD Attribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)FileRecord + AttrOffset);
+    PNTFS_ATTR_RECORD NextAttribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)Attribute + Attribute->Length);
+    ULONG HeaderLength = FIELD_OFFSET(NTFS_ATTR_RECORD, NonResident.CompressedSize) + sizeof(LONGLONG);
+    ULONG HeaderEnd = Attribute->NonResident.MappingPairsOffset;
 
-    ReadAttribute(Vcb, DataContext, 0, (PCHAR)BitmapData, (ULONG)BitmapDataSize);
+    ASSERT(AttrContext->pRecord->IsNonResident);
 
-    RtlInitializeBitMap(&Bitmap, (PULONG)BitmapData, Vcb->NtfsInfo.ClusterCount);
+    if (Attribute->NameLength != 0)
+        HeaderEnd = min(HeaderEnd, Attribute->NameOffset);
 
-    // free clusters in $BITMAP file
-    while (ClustersLeftToFree > 0)
+    if (HeaderEnd < HeaderLength)
     {
-        LONGLONG LargeVbn, LargeLbn;
+        ULONG Shift = ALIGN_UP_BY(HeaderLength - HeaderEnd, ATTR_RECORD_ALIGNMENT);
+        PNTFS_ATTR_RECORD NewRecord;
 
-        if (!FsRtlLookupLastLargeMcbEntry(&AttrContext->DataRunsMCB, &LargeVbn, &LargeLbn))
+        if (Vcb->NtfsInfo.BytesPerFileRecord - FileRecord->BytesInUse < Shift)
         {
-            Status = STATUS_INVALID_PARAMETER;
-            DPRINT1("DRIVER ERROR: FreeClusters called to free %lu clusters, which is %lu more clusters than are assigned to attribute!",
-                    ClustersToFree,
-                    ClustersLeftToFree);
-            break;
+            DPRINT1("FIXME: Need to create attribute list!\n");
+            return STATUS_NOT_IMPLEMENTED;
         }
 
-        if (LargeLbn != -1)
+        NewRecord = ExAllocatePoolWithTag(NonPagedPool, Attribute->Length + Shift, TAG_NTFS);
+        if (NewRecord == NULL)
         {
-            // deallocate this cluster
-            RtlClearBits(&Bitmap, LargeLbn, 1);
+            DPRINT1("ERROR: Couldn't allocate memory for attribute record!\n");
+            return STATUS_INSUFFICIENT_RESOURCES;
         }
-        FsRtlTruncateLargeMcb(&AttrContext->DataRunsMCB, AttrContext->pRecord->NonResident.HighestVCN);
 
-        // decrement HighestVCN, but don't let it go below 0
-        AttrContext->pRecord->NonResident.HighestVCN = min(AttrContext->pRecord->NonResident.HighestVCN, AttrContext->pRecord->NonResident.HighestVCN - 1);
-        ClustersLeftToFree--;
-    }
+        // Make room behind the attribute
+        if (NextAttribute->Type != AttributeEnd)
+        {
+            PNTFS_ATTR_RECORD FinalAttribute;
 
-    // update $BITMAP file on disk
-    Status = WriteAttribute(Vcb, DataContext, 0, BitmapData, (ULONG)BitmapDataSize, &LengthWritten, FileRecord);
-    if (!NT_SUCCESS(Status))
-    {
-        ReleaseAttributeContext(DataContext);
-        ExFreePoolWithTag(BitmapData, TAG_NTFS);
-        ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, BitmapRecord);
-        return Status;
+            FinalAttribute = MoveAttributes(Vcb,
+                                            NextAttribute,
+                                            AttrOffset + Attribute->Length,
+                                            (ULONG_PTR)NextAttribute + Shift);
+            SetFileRecordEnd(FileRecord, FinalAttribute, FILE_RECORD_END);
+        }
+        else
+        {
+            SetFileRecordEnd(FileRecord, (PNTFS_ATTR_RECORD)((ULONG_PTR)NextAttribute + Shift), FILE_RECORD_END);
+        }
+
+        // Move the name and the data runs behind the larger header
+        RtlMoveMemory((PUCHAR)Attribute + HeaderEnd + Shift,
+                      (PUCHAR)Attribute + HeaderEnd,
+                      Attribute->Length - HeaderEnd);
+        RtlZeroMemory((PUCHAR)Attribute + HeaderEnd, Shift);
+
+        if (Attribute->NameOffset >= HeaderEnd)
+            Attribute->NameOffset += Shift;
+        Attribute->NonResident.MappingPairsOffset += Shift;
+        Attribute->Length += Shift;
+
+        // Replace the copy in the attribute context
+        RtlCopyMemory(NewRecord, Attribute, Attribute->Length);
+        ExFreePoolWithTag(AttrContext->pRecord, TAG_NTFS);
+        AttrContext->pRecord = NewRecord;
     }
 
-    ReleaseAttributeContext(DataContext);
-    ExFreePoolWithTag(BitmapData, TAG_NTFS);
-    ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, BitmapRecord);
+    Attribute->Flags |= ATTR_FLAG_SPARSE;
+    AttrContext->pRecord->Flags |= ATTR_FLAG_SPARSE;
 
-    // Save updated data runs to file record
+    // Sets CompressedSize
+    return StoreDataRuns(Vcb, AttrContext, AttrOffset, FileRecord);
+}
+
+/**
+* @name StoreDataRuns
+* @implemented
+*
+* Encodes the map control block of a non-resident attribute back into the data runs of its
+* file record, growing the attribute when the runs no longer fit. Doesn't update the file record.
+*
+* @param Vcb
+* Pointer to an NTFS_VCB for the destination volume.
+*
+* @param AttrContext
+* Pointer to an NTFS_ATTR_CONTEXT describing the attribute. Its HighestVCN must already describe
+* the new size of the attribute; clusters that aren't mapped by DataRunsMCB are stored as holes.
+*
+* @param AttrOffset
+* Byte offset of the destination attribute relative to its file record.
+*
+* @param FileRecord
+* Pointer to a complete copy of the file record containing the attribute. Must be at least
+* Vcb->NtfsInfo.BytesPerFileRecord bytes long.
+*
+* @return
+* STATUS_SUCCESS on success. STATUS_INSUFFICIENT_RESOURCES if allocating a buffer fails.
+* STATUS_BUFFER_TOO_SMALL if ConvertLargeMCBToDataRuns() fails.
+* STATUS_NOT_IMPLEMENTED if we need to migrate the attribute to an attribute list (TODO).
+*
+* @remarks
+* The attribute record in AttrContext may be reallocated. For a sparse attribute, the
+* CompressedSize field is set to the number of bytes which are actually allocated.
+*/
+NTSTATUS
+StoreDataRuns(PNTFS_VCB Vcb,
+              PNTFS_ATTR_CONTEXT AttrContext,
+              ULONG AttrOffset,
+              PFILE_RECORD_HEADER FileRecord)
+{
+    NTSTATUS Status;
+    ULONG DataRunMaxLength;
+    PNTFS_ATTR_RECORD DestinationAttribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)FileRecord + AttrOffset);
+    ULONG NextAttributeOffset = AttrOffset + AttrContext->pRecord->Length;
+    PNTFS_ATTR_RECORD NextAttribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)FileRecord + NextAttributeOffset);
+
+    PUCHAR RunBuffer;
+    ULONG RunBufferSize;
 
-    // Allocate some memory for a new RunBuffer
     RunBuffer = ExAllocatePoolWithTag(NonPagedPool, Vcb->NtfsInfo.BytesPerFileRecord, TAG_NTFS);
     if (!RunBuffer)
     {
@@ -1173,25 +1474,87 @@ FreeClusters(PNTFS_VCB Vcb,
     }
 
     // Convert the map control block back to encoded data runs
-    ConvertLargeMCBToDataRuns(&AttrContext->DataRunsMCB, RunBuffer, Vcb->NtfsInfo.BytesPerCluster, &RunBufferSize);
-
-    // Update HighestVCN
-    DestinationAttribute->NonResident.HighestVCN = AttrContext->pRecord->NonResident.HighestVCN;
+    Status = ConvertLargeMCBToDataRuns(&AttrContext->DataRunsMCB,
+                                       AttrContext->pRecord->NonResident.HighestVCN + 1,
+                                       RunBuffer,
+                                       Vcb->NtfsInfo.BytesPerFileRecord,
+                                       &RunBufferSize);
+    if (!NT_SUCCESS(Status))
+    {
+        ExFreePoolWithTag(RunBuffer, TAG_NTFS);
+        return Status;
+    }
 
-    // Write data runs to destination attribute
-    RtlCopyMemory((PVOID)((ULONG_PTR)DestinationAttribute + DestinationAttribute->NonResident.MappingPairsOffset),
-                  RunBuffer,
-                  RunBufferSize);
+    // Get the amount of free space between the start of the of the first data run and the attribute end
+    DataRunMaxLength = AttrContext->pRecord->Length - AttrContext->pRecord->NonResident.MappingPairsOffset;
 
-    // Is DestinationAttribute the last attribute in the file record?
-    if (NextAttribute->Type == AttributeEnd)
+    // Do we need to extend the attribute (or convert to attribute list)?
+    if (DataRunMaxLength < RunBufferSize)
     {
-        // update attribute length
-        DestinationAttribute->Length = ALIGN_UP_BY(AttrContext->pRecord->NonResident.MappingPairsOffset + RunBufferSize,
-                                                 ATTR_RECORD_ALIGNMENT);
+        PNTFS_ATTR_RECORD NewRecord;
+        ULONG NewAttributeEnd;
 
-        ASSERT(DestinationAttribute->Length <= AttrContext->pRecord->Length);
+        // Add free space at the end of the file record to DataRunMaxLength
+        DataRunMaxLength += Vcb->NtfsInfo.BytesPerFileRecord - FileRecord->BytesInUse;
 
+        // Can we resize the attribute?
+        if (DataRunMaxLength < RunBufferSize)
+        {
+            DPRINT1("FIXME: Need to create attribute list! Max Data Run Length available: %d, RunBufferSize: %d\n", DataRunMaxLength, RunBufferSize);
+            ExFreePoolWithTag(RunBuffer, TAG_NTFS);
+            return STATUS_NOT_IMPLEMENTED;
+        }
+
+        // Create a new copy of the attribute record, large enough for the new runs
+        NewRecord = ExAllocatePoolWithTag(NonPagedPool,
+                                          ALIGN_UP_BY(AttrContext->pRecord->NonResident.MappingPairsOffset + RunBufferSize,
+                                                      ATTR_RECORD_ALIGNMENT),
+                                          TAG_NTFS);
+        if (!NewRecord)
+        {
+            DPRINT1("ERROR: Couldn't allocate memory for attribute record!\n");
+            ExFreePoolWithTag(RunBuffer, TAG_NTFS);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        // calculate position of end markers
+        NewAttributeEnd = AttrOffset + AttrContext->pRecord->NonResident.MappingPairsOffset + RunBufferSize;
+        NewAttributeEnd = ALIGN_UP_BY(NewAttributeEnd, ATTR_RECORD_ALIGNMENT);
+
+        // Are there more attributes after the one we're resizing?
+        if (NextAttribute->Type != AttributeEnd)
+        {
+            PNTFS_ATTR_RECORD FinalAttribute;
+
+            DPRINT1("Moving attribute(s) after this one starting with type 0x%lx\n", NextAttribute->Type);
+
+            // Move the trailing attributes; FinalAttribute will point to the end marker
+            FinalAttribute = MoveAttributes(Vcb, NextAttribute, NextAttributeOffset, (ULONG_PTR)FileRecord + NewAttributeEnd);
+
+            // set the file record end
+            SetFileRecordEnd(FileRecord, FinalAttribute, FILE_RECORD_END);
+        }
+        else
+        {
+            // End the file record
+            NextAttribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)FileRecord + NewAttributeEnd);
+            SetFileRecordEnd(FileRecord, NextAttribute, FILE_RECORD_END);
+        }
+
+        // Update the length of the destination attribute
+        DestinationAttribute->Length = NewAttributeEnd - AttrOffset;
+
+        // Replace the attribute context's record, which won't be large enough
+        RtlCopyMemory(NewRecord, AttrContext->pRecord, AttrContext->pRecord->Length);
+        NewRecord->Length = DestinationAttribute->Length;
+        ExFreePoolWithTag(AttrContext->pRecord, TAG_NTFS);
+        AttrContext->pRecord = NewRecord;
+    }
+    else if (NextAttribute->Type == AttributeEnd)
+    {
+        // DestinationAttribute is the last attribute in the file record, give back the space it doesn't need
+        DestinationAttribute->Length = ALIGN_UP_BY(AttrContext->pRecord->NonResident.MappingPairsOffset + RunBufferSize,
+                                                   ATTR_RECORD_ALIGNMENT);
         AttrContext->pRecord->Length = DestinationAttribute->Length;
 
         // write end markers
@@ -1199,14 +1562,41 @@ FreeClusters(PNTFS_VCB Vcb,
         SetFileRecordEnd(FileRecord, NextAttribute, FILE_RECORD_END);
     }
 
-    // Update the file record
-    Status = UpdateFileRecord(Vcb, AttrContext->FileMFTIndex, FileRecord);
+    // Update HighestVCN
+    DestinationAttribute->NonResident.HighestVCN = AttrContext->pRecord->NonResident.HighestVCN;
+
+    // A sparse attribute also records how much of it is really allocated
+    if (AttrContext->pRecord->Flags & ATTR_FLAG_SPARSE)
+    {
+        LONGLONG Vbn, Lbn, Count;
+        ULONGLONG AllocatedClusters = 0;
+        ULONG i;
+
+        for (i = 0; FsRtlGetNextLargeMcbEntry(&AttrContext->DataRunsMCB, i, &Vbn, &Lbn, &Count); i++)
+        {
+            if (Lbn != -1)
+                AllocatedClusters += Count;
+        }
+
+        DestinationAttribute->NonResident.CompressedSize =
+        AttrContext->pRecord->NonResident.CompressedSize = AllocatedClusters * Vcb->NtfsInfo.BytesPerCluster;
+    }
+
+    // Write data runs to destination attribute
+    RtlCopyMemory((PVOID)((ULONG_PTR)DestinationAttribute + DestinationAttribute->NonResident.MappingPairsOffset),
+                  RunBuffer,
+                  RunBufferSize);
+
+    // Update the attribute record in the attribute context
+    RtlCopyMemory((PVOID)((ULONG_PTR)AttrContext->pRecord + AttrContext->pRecord->NonResident.MappingPairsOffset),
+                  RunBuffer,
+                  RunBufferSize);
 
     ExFreePoolWithTag(RunBuffer, TAG_NTFS);
 
     NtfsDumpDataRuns((PUCHAR)((ULONG_PTR)DestinationAttribute + DestinationAttribute->NonResident.MappingPairsOffset), 0);
 
-    return Status;
+    return STATUS_SUCCESS;
 }
 
 static
@@ -33,13 +33,15 @@
 
 /* FUNCTIONS ****************************************************************/
 
+/* Transfers whole sectors between the device and Buffer, without any copy */
+static
 NTSTATUS
-NtfsReadDisk(IN PDEVICE_OBJECT DeviceObject,
-             IN LONGLONG StartingOffset,
-             IN ULONG Length,
-             IN ULONG SectorSize,
-             IN OUT PUCHAR Buffer,
-             IN BOOLEAN Override)
+NtfsTransferSectors(IN PDEVICE_OBJECT DeviceObject,
+                    IN UCHAR MajorFunction,
+                    IN LONGLONG StartingOffset,
+                    IN ULONG Length,
+                    IN OUT PUCHAR Buffer,
+                    IN BOOLEAN Override)
 {
     PIO_STACK_LOCATION Stack;
     IO_STATUS_BLOCK IoStatus;
@@ -47,53 +49,24 @@ NtfsReadDisk(IN PDEVICE_OBJECT DeviceObject,
     KEVENT Event;
     PIRP Irp;
     NTSTATUS Status;
-    ULONGLONG RealReadOffset;
-    ULONG RealLength;
-    BOOLEAN AllocatedBuffer = FALSE;
-    PUCHAR ReadBuffer = Buffer;
-
-    DPRINT("NtfsReadDisk(%p, %I64x, %lu, %lu, %p, %d)\n", DeviceObject, StartingOffset, Length, SectorSize, Buffer, Override);
 
     KeInitializeEvent(&Event,
                       NotificationEvent,
                       FALSE);
 
-    RealReadOffset = (ULONGLONG)StartingOffset;
-    RealLength = Length;
-
-    if ((RealReadOffset % SectorSize) != 0 || (RealLength % SectorSize) != 0)
-    {
-        RealReadOffset = ROUND_DOWN(StartingOffset, SectorSize);
-        RealLength = ROUND_UP(Length, SectorSize);
-
-        ReadBuffer = ExAllocatePoolWithTag(NonPagedPool, RealLength + SectorSize, TAG_NTFS);
-        if (ReadBuffer == NULL)
-        {
-            DPRINT1("Not enough memory!\n");
-            return STATUS_INSUFFICIENT_RESOURCES;
-        }
-        AllocatedBuffer = TRUE;
-    }
-
-    Offset.QuadPart = RealReadOffset;
+    Offset.QuadPart = StartingOffset;
 
     DPRINT("Building synchronous FSD Request...\n");
-    Irp = IoBuildSynchronousFsdRequest(IRP_MJ_READ,
+    Irp = IoBuildSynchronousFsdRequest(MajorFunction,
                                        DeviceObject,
-                                       ReadBuffer,
-                                       RealLength,
+                                       Buffer,
+                                       Length,
                                        &Offset,
                                        &Event,
                                        &IoStatus);
     if (Irp == NULL)
     {
-        DPRINT("IoBuildSynchronousFsdRequest failed\n");
-
-        if (AllocatedBuffer)
-        {
-            ExFreePoolWithTag(ReadBuffer, TAG_NTFS);
-        }
-
+        DPRINT1("IoBuildSynchronousFsdRequest failed\n");
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
@@ -115,16 +88,135 @@ NtfsReadDisk(IN PDEVICE_OBJECT DeviceObject,
         Status = IoStatus.Status;
     }
 
-    if (AllocatedBuffer)
+    return Status;
+}
+
+/* The device may not accept every buffer address, see FILE_xxx_ALIGNMENT */
+#define NtfsIsBufferAligned(DeviceObject, Buffer) \
+    (((ULONG_PTR)(Buffer) & (DeviceObject)->AlignmentRequirement) == 0)
+
+/**
+* @name NtfsReadDisk
+* @implemented
+*
+* Reads data from the given DeviceObject into the given buffer.
+*
+* @param DeviceObject
+* Device to read from
+*
+* @param StartingOffset
+* Offset, in bytes, from the start of the device object where the data will be read
+*
+* @param Length
+* How much data will be read, in bytes
+*
+* @param SectorSize
+* Size of the sector on the disk that the read must be aligned to
+*
+* @param Buffer
+* Buffer that receives the data
+*
+* @param Override
+* TRUE to set SL_OVERRIDE_VERIFY_VOLUME on the request
+*
+* @return
+* STATUS_SUCCESS in case of success, STATUS_INSUFFICIENT_RESOURCES if a memory allocation failed,
+* or whatever status IoCallDriver() sets.
+*
+* @remarks
+* An unaligned request is split in three: the partial head and tail sectors go through a
+* one-sector bounce buffer, the whole sectors in between are read straight into Buffer.
+*/
+NTSTATUS
+NtfsReadDisk(IN PDEVICE_OBJECT DeviceObject,
+             IN LONGLONG StartingOffset,
+             IN ULONG Length,
+             IN ULONG SectorSize,
+             IN OUT PUCHAR Buffer,
+             IN BOOLEAN Override)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG SectorOffset;
+    ULONG PartLength;
+    PUCHAR Bounce = NULL;
+
+    DPRINT("NtfsReadDisk(%p, %I64x, %lu, %lu, %p, %d)\n", DeviceObject, StartingOffset, Length, SectorSize, Buffer, Override);
+
+    if ((StartingOffset % SectorSize) == 0 && (Length % SectorSize) == 0 &&
+        NtfsIsBufferAligned(DeviceObject, Buffer))
     {
-        if (NT_SUCCESS(Status))
+        return NtfsTransferSectors(DeviceObject, IRP_MJ_READ, StartingOffset, Length, Buffer, Override);
+    }
+
+    Bounce = ExAllocatePoolWithTag(NonPagedPool, SectorSize, TAG_NTFS);
+    if (Bounce == NULL)
+    {
+        DPRINT1("Not enough memory!\n");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    // Partial head sector
+    SectorOffset = (ULONG)(StartingOffset % SectorSize);
+    if (SectorOffset != 0)
+    {
+        PartLength = min(SectorSize - SectorOffset, Length);
+
+        Status = NtfsTransferSectors(DeviceObject, IRP_MJ_READ, StartingOffset - SectorOffset, SectorSize, Bounce, Override);
+        if (!NT_SUCCESS(Status))
+            goto Cleanup;
+
+        RtlCopyMemory(Buffer, Bounce + SectorOffset, PartLength);
+        StartingOffset += PartLength;
+        Buffer += PartLength;
+        Length -= PartLength;
+    }
+
+    // Whole sectors
+    PartLength = ROUND_DOWN(Length, SectorSize);
+    if (PartLength != 0)
+    {
+        if (NtfsIsBufferAligned(DeviceObject, Buffer))
         {
-            RtlCopyMemory(Buffer, ReadBuffer + (StartingOffset - RealReadOffset), Length);
+            Status = NtfsTransferSectors(DeviceObject, IRP_MJ_READ, StartingOffset, PartLength, Buffer, Override);
         }
+        else
+        {
+            PUCHAR MiddleBounce;
+
+            MiddleBounce = ExAllocatePoolWithTag(NonPagedPool, PartLength, TAG_NTFS);
+            if (MiddleBounce == NULL)
+            {
+                DPRINT1("Not enough memory!\n");
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                goto Cleanup;
+            }
+
+            Status = NtfsTransferSectors(DeviceObject, IRP_MJ_READ, StartingOffset, PartLength, MiddleBounce, Override);
+            if (NT_SUCCESS(Status))
+                RtlCopyMemory(Buffer, MiddleBounce, PartLength);
 
-        ExFreePoolWithTag(ReadBuffer, TAG_NTFS);
+            ExFreePoolWithTag(MiddleBounce, TAG_NTFS);
+        }
+
+        if (!NT_SUCCESS(Status))
+            goto Cleanup;
+
+        StartingOffset += PartLength;
+        Buffer += PartLength;
+        Length -= PartLength;
+    }
+
+    // Partial tail sector
+    if (Length != 0)
+    {
+        Status = NtfsTransferSectors(DeviceObject, IRP_MJ_READ, StartingOffset, SectorSize, Bounce, Override);
+        if (NT_SUCCESS(Status))
+            RtlCopyMemory(Buffer, Bounce, Length);
     }
 
+Cleanup:
+    ExFreePoolWithTag(Bounce, TAG_NTFS);
+
     DPRINT("NtfsReadDisk() done (Status %x)\n", Status);
 
     return Status;
@@ -155,8 +247,9 @@ NtfsReadDisk(IN PDEVICE_OBJECT DeviceObject,
 * STATUS_SUCCESS in case of success, STATUS_INSUFFICIENT_RESOURCES if a memory allocation failed,
 * or whatever status IoCallDriver() sets.
 *
-* @remarks Called by NtfsWriteFile(). May perform a read-modify-write operation if the
-* requested write is not sector-aligned.
+* @remarks Called by NtfsWriteFile(). Performs a read-modify-write of the partial head and
+* tail sectors if the requested write is not sector-aligned; whole sectors are written
+* straight from Buffer.
 *
 */
 NTSTATUS
@@ -166,140 +259,371 @@ NtfsWriteDisk(IN PDEVICE_OBJECT DeviceObject,
               IN ULONG SectorSize,
               IN const PUCHAR Buffer)
 {
-    IO_STATUS_BLOCK IoStatus;
-    LARGE_INTEGER Offset;
-    KEVENT Event;
-    PIRP Irp;
-    NTSTATUS Status;
-    ULONGLONG RealWriteOffset;
-    ULONG RealLength;
-    BOOLEAN AllocatedBuffer = FALSE;
-    PUCHAR TempBuffer = NULL;
+    NTSTATUS Status = STATUS_SUCCESS;
+    PUCHAR Source = Buffer;
+    ULONG SectorOffset;
+    ULONG PartLength;
+    PUCHAR Bounce = NULL;
 
     DPRINT("NtfsWriteDisk(%p, %I64x, %lu, %lu, %p)\n", DeviceObject, StartingOffset, Length, SectorSize, Buffer);
 
     if (Length == 0)
         return STATUS_SUCCESS;
 
-    RealWriteOffset = (ULONGLONG)StartingOffset;
-    RealLength = Length;
+    if ((StartingOffset % SectorSize) == 0 && (Length % SectorSize) == 0 &&
+        NtfsIsBufferAligned(DeviceObject, Source))
+    {
+        return NtfsTransferSectors(DeviceObject, IRP_MJ_WRITE, StartingOffset, Length, Source, FALSE);
+    }
 
-    // Does the write need to be adjusted to be sector-aligned?
-    if ((RealWriteOffset % SectorSize) != 0 || (RealLength % SectorSize) != 0)
+    // Only the partial sectors at both ends need a read-modify-write
+    Bounce = ExAllocatePoolWithTag(NonPagedPool, SectorSize, TAG_NTFS);
+    if (Bounce == NULL)
     {
-        ULONGLONG relativeOffset;
+        DPRINT1("Not enough memory!\n");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
 
-        // We need to do a read-modify-write. We'll start be copying the entire
-        // contents of every sector that will be overwritten.
-        // TODO: Optimize (read no more than necessary)
+    // Partial head sector
+    SectorOffset = (ULONG)(StartingOffset % SectorSize);
+    if (SectorOffset != 0)
+    {
+        PartLength = min(SectorSize - SectorOffset, Length);
 
-        RealWriteOffset = ROUND_DOWN(StartingOffset, SectorSize);
-        RealLength = ROUND_UP(Length, SectorSize);
+        Status = NtfsTransferSectors(DeviceObject, IRP_MJ_READ, StartingOffset - SectorOffset, SectorSize, Bounce, FALSE);
+        if (!NT_SUCCESS(Status))
+            goto Cleanup;
 
-        // Would the end of our sector-aligned write fall short of the requested write?
-        if (RealWriteOffset + RealLength < StartingOffset + Length)
-        {
-            RealLength += SectorSize;
-        }
+        RtlCopyMemory(Bounce + SectorOffset, Source, PartLength);
 
-        // Did we underestimate the memory required somehow?
-        if (RealLength + RealWriteOffset < StartingOffset + Length)
-        {
-            DPRINT1("\a\t\t\t\t\tFIXME: calculated less memory than needed!\n");
-            DPRINT1("StartingOffset: %lu\tLength: %lu\tRealWriteOffset: %lu\tRealLength: %lu\n",
-                    StartingOffset, Length, RealWriteOffset, RealLength);
+        Status = NtfsTransferSectors(DeviceObject, IRP_MJ_WRITE, StartingOffset - SectorOffset, SectorSize, Bounce, FALSE);
+        if (!NT_SUCCESS(Status))
+            goto Cleanup;
+
+        StartingOffset += PartLength;
+        Source += PartLength;
+        Length -= PartLength;
+    }
 
-            RealLength += SectorSize;
+    // Whole sectors
+    PartLength = ROUND_DOWN(Length, SectorSize);
+    if (PartLength != 0)
+    {
+        if (NtfsIsBufferAligned(DeviceObject, Source))
+        {
+            Status = NtfsTransferSectors(DeviceObject, IRP_MJ_WRITE, StartingOffset, PartLength, Source, FALSE);
         }
+        else
+        {
+            PUCHAR MiddleBounce;
 
-        // Allocate a buffer to copy the existing data to
-        TempBuffer = ExAllocatePoolWithTag(NonPagedPool, RealLength, TAG_NTFS);
+            MiddleBounce = ExAllocatePoolWithTag(NonPagedPool, PartLength, TAG_NTFS);
+            if (MiddleBounce == NULL)
+            {
+                DPRINT1("Not enough memory!\n");
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                goto Cleanup;
+            }
 
-        // Did we fail to allocate it?
-        if (TempBuffer == NULL)
-        {
-            DPRINT1("Not enough memory!\n");
+            RtlCopyMemory(MiddleBounce, Source, PartLength);
+            Status = NtfsTransferSectors(DeviceObject, IRP_MJ_WRITE, StartingOffset, PartLength, MiddleBounce, FALSE);
 
-            return STATUS_INSUFFICIENT_RESOURCES;
+            RtlSecureZeroMemory(MiddleBounce, PartLength);
+            ExFreePoolWithTag(MiddleBounce, TAG_NTFS);
         }
 
-        // Read the sectors we'll be overwriting into TempBuffer
-        Status = NtfsReadDisk(DeviceObject, RealWriteOffset, RealLength, SectorSize, TempBuffer, FALSE);
+        if (!NT_SUCCESS(Status))
+            goto Cleanup;
+
+        StartingOffset += PartLength;
+        Source += PartLength;
+        Length -= PartLength;
+    }
 
-        // Did we fail the read?
+    // Partial tail sector
+    if (Length != 0)
+    {
+        Status = NtfsTransferSectors(DeviceObject, IRP_MJ_READ, StartingOffset, SectorSize, Bounce, FALSE);
         if (!NT_SUCCESS(Status))
+            goto Cleanup;
+
+        RtlCopyMemory(Bounce, Source, Length);
+
+        Status = NtfsTransferSectors(DeviceObject, IRP_MJ_WRITE, StartingOffset, SectorSize, Bounce, FALSE);
+    }
+
+Cleanup:
+    // zero the buffer before freeing it, so private user data can't be snooped
+    RtlSecureZeroMemory(Bounce, SectorSize);
+    ExFreePoolWithTag(Bounce, TAG_NTFS);
+
+    DPRINT("NtfsWriteDisk() done (Status %x)\n", Status);
+
+    return Status;
+}
+
+typedef struct _NTFS_IO_BATCH
+{
+    KEVENT Event;
+    LONG Status;                        /* First failure of an associated IRP */
+} NTFS_IO_BATCH, *PNTFS_IO_BATCH;
+
+static IO_COMPLETION_ROUTINE NtfsRunCompletion;
+static IO_COMPLETION_ROUTINE NtfsBatchCompletion;
+
+/* Completion of the IRP of one run, the I/O manager then frees it and its partial MDL */
+static
+NTSTATUS
+NTAPI
+NtfsRunCompletion(IN PDEVICE_OBJECT DeviceObject,
+                  IN PIRP Irp,
+                  IN PVOID Context)
+{
+    PNTFS_IO_BATCH Batch = Context;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+
+    if (!NT_SUCCESS(Irp->IoStatus.Status))
+    {
+        InterlockedCompareExchange(&Batch->Status, Irp->IoStatus.Status, STATUS_SUCCESS);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/* Completion of the master IRP, once every associated IRP is done */
+static
+NTSTATUS
+NTAPI
+NtfsBatchCompletion(IN PDEVICE_OBJECT DeviceObject,
+                    IN PIRP Irp,
+                    IN PVOID Context)
+{
+    PNTFS_IO_BATCH Batch = Context;
+
+    UNREFERENCED_PARAMETER(DeviceObject);
+    UNREFERENCED_PARAMETER(Irp);
+
+    KeSetEvent(&Batch->Event, IO_NO_INCREMENT, FALSE);
+
+    return STATUS_MORE_PROCESSING_REQUIRED;
+}
+
+/**
+* @name NtfsReadWriteRuns
+* @implemented
+*
+* Transfers several discontiguous pieces of the volume to or from one buffer. The pieces
+* are sent to the device at the same time, as associated IRPs of a single master IRP, each
+* with a partial MDL of the buffer, so that the storage stack can queue all of them.
+*
+* @param DeviceObject
+* Device to transfer to or from
+*
+* @param MajorFunction
+* IRP_MJ_READ or IRP_MJ_WRITE
+*
+* @param Runs
+* Array of RunCount pieces; each one gives where on the volume and where in Buffer it goes
+*
+* @param RunCount
+* Number of entries in Runs
+*
+* @param SectorSize
+* Size of the sector on the disk that the transfers must be aligned to
+*
+* @param Buffer
+* Buffer the Runs are relative to
+*
+* @return
+* STATUS_SUCCESS if every run was transferred, otherwise the status of one of the runs
+* that failed.
+*
+* @remarks
+* Runs that aren't made of whole sectors go through NtfsReadDisk() or NtfsWriteDisk(). So
+* does everything if the buffer can't be locked or the IRPs can't be allocated. The function
+* returns once all the runs are done.
+*/
+NTSTATUS
+NtfsReadWriteRuns(IN PDEVICE_OBJECT DeviceObject,
+                  IN UCHAR MajorFunction,
+                  IN PNTFS_IO_RUN Runs,
+                  IN ULONG RunCount,
+                  IN ULONG SectorSize,
+                  IN OUT PUCHAR Buffer)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    NTFS_IO_BATCH Batch;
+    PIO_STACK_LOCATION Stack;
+    PIRP MasterIrp = NULL;
+    PIRP *RunIrps = NULL;
+    PMDL BufferMdl = NULL;
+    ULONG BufferLength = 0;
+    ULONG BatchCount = 0;
+    ULONG i;
+
+    DPRINT("NtfsReadWriteRuns(%p, %x, %p, %lu, %lu, %p)\n", DeviceObject, MajorFunction, Runs, RunCount, SectorSize, Buffer);
+
+    for (i = 0; i < RunCount; i++)
+    {
+        BufferLength = max(BufferLength, Runs[i].BufferOffset + Runs[i].Length);
+
+        if ((Runs[i].DiskOffset % SectorSize) == 0 && (Runs[i].Length % SectorSize) == 0 &&
+            NtfsIsBufferAligned(DeviceObject, Buffer + Runs[i].BufferOffset))
         {
-            RtlSecureZeroMemory(TempBuffer, RealLength);
-            ExFreePoolWithTag(TempBuffer, TAG_NTFS);
-            return Status;
+            BatchCount++;
         }
+    }
 
-        // Calculate where the new data should be written to, relative to the start of TempBuffer
-        relativeOffset = StartingOffset - RealWriteOffset;
+    // Not worth a master IRP
+    if (BatchCount < 2)
+        goto Synchronous;
 
-        // Modify the tempbuffer with the data being read
-        RtlCopyMemory(TempBuffer + relativeOffset, Buffer, Length);
+    BufferMdl = IoAllocateMdl(Buffer, BufferLength, FALSE, FALSE, NULL);
+    if (BufferMdl == NULL)
+        goto Synchronous;
 
-        AllocatedBuffer = TRUE;
+    _SEH2_TRY
+    {
+        MmProbeAndLockPages(BufferMdl, KernelMode, (MajorFunction == IRP_MJ_READ) ? IoWriteAccess : IoReadAccess);
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        IoFreeMdl(BufferMdl);
+        BufferMdl = NULL;
     }
+    _SEH2_END;
 
-    // set the destination offset
-    Offset.QuadPart = RealWriteOffset;
+    if (BufferMdl == NULL)
+        goto Synchronous;
 
-    // setup the notification event for the write
-    KeInitializeEvent(&Event,
-                      NotificationEvent,
-                      FALSE);
+    RunIrps = ExAllocatePoolWithTag(NonPagedPool, BatchCount * sizeof(PIRP), TAG_NTFS);
+    MasterIrp = IoAllocateIrp(1, FALSE);
+    if (RunIrps == NULL || MasterIrp == NULL)
+        goto Synchronous;
 
-    DPRINT("Building synchronous FSD Request...\n");
+    MasterIrp->Tail.Overlay.Thread = PsGetCurrentThread();
+    MasterIrp->IoStatus.Status = STATUS_SUCCESS;
+    IoSetCompletionRoutine(MasterIrp, NtfsBatchCompletion, &Batch, TRUE, TRUE, TRUE);
+    IoSetNextIrpStackLocation(MasterIrp);
 
-    // Build an IRP requesting the lower-level [disk] driver to perform the write
-    // TODO: Forward the existing IRP instead
-    Irp = IoBuildSynchronousFsdRequest(IRP_MJ_WRITE,
-                                       DeviceObject,
-                                       // if we allocated a temp buffer, use that instead of the Buffer parameter
-                                       ((AllocatedBuffer) ? TempBuffer : Buffer),
-                                       RealLength,
-                                       &Offset,
-                                       &Event,
-                                       &IoStatus);
-    // Did we fail to build the IRP?
-    if (Irp == NULL)
+    KeInitializeEvent(&Batch.Event, NotificationEvent, FALSE);
+    Batch.Status = STATUS_SUCCESS;
+
+    // Build every IRP first, so that an allocation failure leaves nothing in flight
+    for (i = 0, BatchCount = 0; i < RunCount; i++)
     {
-        DPRINT1("IoBuildSynchronousFsdRequest failed\n");
+        PUCHAR RunBuffer = Buffer + Runs[i].BufferOffset;
+        PIRP Irp;
 
-        if (AllocatedBuffer)
+        if ((Runs[i].DiskOffset % SectorSize) != 0 || (Runs[i].Length % SectorSize) != 0 ||
+            !NtfsIsBufferAligned(DeviceObject, RunBuffer))
         {
-            RtlSecureZeroMemory(TempBuffer, RealLength);
-            ExFreePoolWithTag(TempBuffer, TAG_NTFS);
+            continue;
         }
 
-        return STATUS_INSUFFICIENT_RESOURCES;
+        Irp = IoMakeAssociatedIrp(MasterIrp, DeviceObject->StackSize);
+        if (Irp == NULL)
+            break;
+
+        RunIrps[BatchCount++] = Irp;
+
+        if (IoAllocateMdl(RunBuffer, Runs[i].Length, FALSE, FALSE, Irp) == NULL)
+            break;
+
+        IoBuildPartialMdl(BufferMdl, Irp->MdlAddress, RunBuffer, Runs[i].Length);
+
+        Stack = IoGetNextIrpStackLocation(Irp);
+        Stack->MajorFunction = MajorFunction;
+        Stack->DeviceObject = DeviceObject;
+        if (MajorFunction == IRP_MJ_READ)
+        {
+            Stack->Parameters.Read.Length = Runs[i].Length;
+            Stack->Parameters.Read.ByteOffset.QuadPart = Runs[i].DiskOffset;
+        }
+        else
+        {
+            Stack->Parameters.Write.Length = Runs[i].Length;
+            Stack->Parameters.Write.ByteOffset.QuadPart = Runs[i].DiskOffset;
+        }
+
+        IoSetCompletionRoutine(Irp, NtfsRunCompletion, &Batch, TRUE, TRUE, TRUE);
     }
 
-    // Call the next-lower driver to perform the write
-    DPRINT("Calling IO Driver with irp %p\n", Irp);
-    Status = IoCallDriver(DeviceObject, Irp);
+    if (i < RunCount)
+    {
+        DPRINT1("Not enough memory for the IRPs of %lu runs\n", RunCount);
 
-    // Wait until the next-lower driver has completed the IRP
-    DPRINT("Waiting for IO Operation for %p\n", Irp);
-    if (Status == STATUS_PENDING)
+        while (BatchCount != 0)
+        {
+            PIRP Irp = RunIrps[--BatchCount];
+
+            if (Irp->MdlAddress != NULL)
+                IoFreeMdl(Irp->MdlAddress);
+            IoFreeIrp(Irp);
+        }
+
+        goto Synchronous;
+    }
+
+    MasterIrp->AssociatedIrp.IrpCount = BatchCount;
+    for (i = 0; i < BatchCount; i++)
     {
-        DPRINT("Operation pending\n");
-        KeWaitForSingleObject(&Event, Suspended, KernelMode, FALSE, NULL);
-        DPRINT("Getting IO Status... for %p\n", Irp);
-        Status = IoStatus.Status;
+        IoCallDriver(DeviceObject, RunIrps[i]);
     }
 
-    if (AllocatedBuffer)
+    // Meanwhile, the runs the device can't take as they are
+    for (i = 0; i < RunCount; i++)
     {
-        // zero the buffer before freeing it, so private user data can't be snooped
-        RtlSecureZeroMemory(TempBuffer, RealLength);
+        if ((Runs[i].DiskOffset % SectorSize) == 0 && (Runs[i].Length % SectorSize) == 0 &&
+            NtfsIsBufferAligned(DeviceObject, Buffer + Runs[i].BufferOffset))
+        {
+            continue;
+        }
+
+        if (MajorFunction == IRP_MJ_READ)
+            Status = NtfsReadDisk(DeviceObject, Runs[i].DiskOffset, Runs[i].Length, SectorSize, Buffer + Runs[i].BufferOffset, FALSE);
+        else
+            Status = NtfsWriteDisk(DeviceObject, Runs[i].DiskOffset, Runs[i].Length, SectorSize, Buffer + Runs[i].BufferOffset);
 
-        ExFreePoolWithTag(TempBuffer, TAG_NTFS);
+        if (!NT_SUCCESS(Status))
+            break;
     }
 
-    DPRINT("NtfsWriteDisk() done (Status %x)\n", Status);
+    KeWaitForSingleObject(&Batch.Event, Executive, KernelMode, FALSE, NULL);
+    IoFreeIrp(MasterIrp);
+    MmUnlockPages(BufferMdl);
+    IoFreeMdl(BufferMdl);
+    ExFreePoolWithTag(RunIrps, TAG_NTFS);
+
+    if (NT_SUCCESS(Status))
+        Status = Batch.Status;
+
+    DPRINT("NtfsReadWriteRuns() done (Status %x)\n", Status);
+
+    return Status;
+
+Synchronous:
+    if (MasterIrp != NULL)
+        IoFreeIrp(MasterIrp);
+    if (RunIrps != NULL)
+        ExFreePoolWithTag(RunIrps, TAG_NTFS);
+    if (BufferMdl != NULL)
+    {
+        MmUnlockPages(BufferMdl);
+        IoFreeMdl(BufferMdl);
+    }
+
+    for (i = 0; i < RunCount; i++)
+    {
+        if (MajorFunction == IRP_MJ_READ)
+            Status = NtfsReadDisk(DeviceObject, Runs[i].DiskOffset, Runs[i].Length, SectorSize, Buffer + Runs[i].BufferOffset, FALSE);
+        else
+            Status = NtfsWriteDisk(DeviceObject, Runs[i].DiskOffset, Runs[i].Length, SectorSize, Buffer + Runs[i].BufferOffset);
+
+        if (!NT_SUCCESS(Status))
+            break;
+    }
 
     return Status;
 }
@@ -262,8 +262,11 @@ AllocateIndexNode(PDEVICE_EXTENSION DeviceExt,
         DPRINT1("ERROR: Unable to write to $I30 bitmap attribute!\n");
     }
 
-    // Calculate VCN of new node number
-    *NewVCN = NextNodeNumber * (IndexBufferSize / DeviceExt->NtfsInfo.BytesPerCluster);
+    // Calculate VCN of new node number, index buffers smaller than a cluster are addressed in sectors
+    if (IndexBufferSize < DeviceExt->NtfsInfo.BytesPerCluster)
+        *NewVCN = NextNodeNumber * (IndexBufferSize / DeviceExt->NtfsInfo.BytesPerSector);
+    else
+        *NewVCN = NextNodeNumber * (IndexBufferSize / DeviceExt->NtfsInfo.BytesPerCluster);
 
     DPRINT("New VCN: %I64u\n", *NewVCN);
 
@@ -395,6 +398,9 @@ CreateEmptyBTree(PB_TREE *NewTree)
 *
 * Compare two B_TREE_KEY's to determine their order in the tree.
 *
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume holding the index, whose $UpCase table is used.
+*
 * @param Key1
 * Pointer to a B_TREE_KEY that will be compared.
 *
@@ -412,13 +418,11 @@ CreateEmptyBTree(PB_TREE *NewTree)
 *
 * @remarks
 * Any other key is always less than the final (dummy) key in a node. Key1 must not be the dummy node.
+* Keys are ordered like NtfsCollateFileNames() orders names.
 */
 LONG
-CompareTreeKeys(PB_TREE_KEY Key1, PB_TREE_KEY Key2, BOOLEAN CaseSensitive)
+CompareTreeKeys(PDEVICE_EXTENSION Vcb, PB_TREE_KEY Key1, PB_TREE_KEY Key2, BOOLEAN CaseSensitive)
 {
-    UNICODE_STRING Key1Name, Key2Name;
-    LONG Comparison;
-
     // Key1 must not be the final key (AKA the dummy key)
     ASSERT(!(Key1->IndexEntry->Flags & NTFS_INDEX_ENTRY_END));
 
@@ -426,46 +430,12 @@ CompareTreeKeys(PB_TREE_KEY Key1, PB_TREE_KEY Key2, BOOLEAN CaseSensitive)
     if (Key2->NextKey == NULL)
         return -1;
 
-    Key1Name.Buffer = Key1->IndexEntry->FileName.Name;
-    Key1Name.Length = Key1Name.MaximumLength
-        = Key1->IndexEntry->FileName.NameLength * sizeof(WCHAR);
-
-    Key2Name.Buffer = Key2->IndexEntry->FileName.Name;
-    Key2Name.Length = Key2Name.MaximumLength
-        = Key2->IndexEntry->FileName.NameLength * sizeof(WCHAR);
-
-    // Are the two keys the same length?
-    if (Key1Name.Length == Key2Name.Length)
-        return RtlCompareUnicodeString(&Key1Name, &Key2Name, !CaseSensitive);
-
-    // Is Key1 shorter?
-    if (Key1Name.Length < Key2Name.Length)
-    {
-        // Truncate KeyName2 to be the same length as KeyName1
-        Key2Name.Length = Key1Name.Length;
-
-        // Compare the names of the same length
-        Comparison = RtlCompareUnicodeString(&Key1Name, &Key2Name, !CaseSensitive);
-
-        // If the truncated names are the same length, the shorter one comes first
-        if (Comparison == 0)
-            return -1;
-    }
-    else
-    {
-        // Key2 is shorter
-        // Truncate KeyName1 to be the same length as KeyName2
-        Key1Name.Length = Key2Name.Length;
-
-        // Compare the names of the same length
-        Comparison = RtlCompareUnicodeString(&Key1Name, &Key2Name, !CaseSensitive);
-
-        // If the truncated names are the same length, the shorter one comes first
-        if (Comparison == 0)
-            return 1;
-    }
-
-    return Comparison;
+    return NtfsCollateFileNames(Vcb,
+                                Key1->IndexEntry->FileName.Name,
+                                Key1->IndexEntry->FileName.NameLength,
+                                Key2->IndexEntry->FileName.Name,
+                                Key2->IndexEntry->FileName.NameLength,
+                                CaseSensitive);
 }
 
 /**
@@ -564,7 +534,15 @@ CreateBTreeNodeFromIndexNode(PDEVICE_EXTENSION Vcb,
                               (PCHAR)NodeBuffer,
                               IndexBufferSize);
 
-    ASSERT(BytesRead == IndexBufferSize);
+    if (BytesRead != IndexBufferSize)
+    {
+        DPRINT1("ERROR: Couldn't read index node with VCN %I64u!\n", *VCN);
+        ExFreePoolWithTag(NodeBuffer, TAG_NTFS);
+        ExFreePoolWithTag(CurrentKey, TAG_NTFS);
+        ExFreePoolWithTag(NewNode, TAG_NTFS);
+        return NULL;
+    }
+
     NT_ASSERT(NodeBuffer->Ntfs.Type == NRH_INDX_TYPE);
     NT_ASSERT(NodeBuffer->VCN == *VCN);
 
@@ -614,18 +592,9 @@ CreateBTreeNodeFromIndexNode(PDEVICE_EXTENSION Vcb,
             // Add NextKey to the end of the list
             CurrentKey->NextKey = NextKey;
 
-            // Copy the current entry to its key
+            // Copy the current entry to its key. Sub-nodes are loaded by LoadBTreeChildNode() when needed.
             RtlCopyMemory(CurrentKey->IndexEntry, CurrentNodeEntry, CurrentNodeEntry->Length);
 
-            // See if the current key has a sub-node
-            if (CurrentKey->IndexEntry->Flags & NTFS_INDEX_ENTRY_NODE)
-            {
-                CurrentKey->LesserChild = CreateBTreeNodeFromIndexNode(Vcb,
-                                                                       IndexRoot,
-                                                                       IndexAllocationAttributeCtx,
-                                                                       CurrentKey->IndexEntry);
-            }
-
             CurrentKey = NextKey;
         }
         else
@@ -634,15 +603,6 @@ CreateBTreeNodeFromIndexNode(PDEVICE_EXTENSION Vcb,
             RtlCopyMemory(CurrentKey->IndexEntry, CurrentNodeEntry, CurrentNodeEntry->Length);
             CurrentKey->NextKey = NULL;
 
-            // See if the current key has a sub-node
-            if (CurrentKey->IndexEntry->Flags & NTFS_INDEX_ENTRY_NODE)
-            {
-                CurrentKey->LesserChild = CreateBTreeNodeFromIndexNode(Vcb,
-                                                                       IndexRoot,
-                                                                       IndexAllocationAttributeCtx,
-                                                                       CurrentKey->IndexEntry);
-            }
-
             break;
         }
 
@@ -659,6 +619,53 @@ CreateBTreeNodeFromIndexNode(PDEVICE_EXTENSION Vcb,
     return NewNode;
 }
 
+/**
+* @name LoadBTreeChildNode
+* @implemented
+*
+* Reads the sub-node of a key from the index allocation, if it hasn't been read already.
+*
+* @param Tree
+* Pointer to the B_TREE containing Key. The tree must have been created with CreateBTreeFromIndex().
+*
+* @param Key
+* Pointer to the B_TREE_KEY whose LesserChild will be loaded.
+*
+* @returns
+* STATUS_SUCCESS on success, or if the key has no sub-node or it was already loaded.
+* STATUS_FILE_CORRUPT_ERROR if the key refers to a sub-node but the index has no allocation.
+* STATUS_INSUFFICIENT_RESOURCES if the node couldn't be read.
+*
+* @remarks
+* Only the nodes on the path an operation takes through the tree get read, so inserting a key
+* costs one index record read per level rather than a read of the whole index.
+*/
+NTSTATUS
+LoadBTreeChildNode(PB_TREE Tree,
+                   PB_TREE_KEY Key)
+{
+    if (Key->LesserChild || !BooleanFlagOn(Key->IndexEntry->Flags, NTFS_INDEX_ENTRY_NODE))
+        return STATUS_SUCCESS;
+
+    if (!Tree->IndexAllocationContext)
+    {
+        DPRINT1("ERROR: Index entry refers to a sub-node, but there's no index allocation!\n");
+        return STATUS_FILE_CORRUPT_ERROR;
+    }
+
+    Key->LesserChild = CreateBTreeNodeFromIndexNode(Tree->Vcb,
+                                                    NULL,
+                                                    Tree->IndexAllocationContext,
+                                                    Key->IndexEntry);
+    if (!Key->LesserChild)
+    {
+        DPRINT1("ERROR: Couldn't load sub-node with VCN %I64u!\n", GetIndexEntryVCN(Key->IndexEntry));
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    return STATUS_SUCCESS;
+}
+
 /**
 * @name CreateBTreeFromIndex
 * @implemented
@@ -676,7 +683,9 @@ CreateBTreeNodeFromIndexNode(PDEVICE_EXTENSION Vcb,
 * STATUS_INSUFFICIENT_RESOURCES if an allocation fails.
 *
 * @remarks
-* Allocates memory for the entire tree. Caller is responsible for destroying the tree with DestroyBTree().
+* Only the root node is read; sub-nodes are read from the index allocation by LoadBTreeChildNode() as
+* they're needed. The tree keeps a reference to the index allocation until it's destroyed, so the caller
+* is responsible for destroying the tree with DestroyBTree().
 */
 NTSTATUS
 CreateBTreeFromIndex(PDEVICE_EXTENSION Vcb,
@@ -723,17 +732,18 @@ CreateBTreeFromIndex(PDEVICE_EXTENSION Vcb,
     if (!NT_SUCCESS(Status))
         IndexAllocationContext = NULL;
 
-    // Setup the Tree
+    // Setup the Tree. It holds on to the index allocation so sub-nodes can be loaded later.
     RootNode->FirstKey = CurrentKey;
     Tree->RootNode = RootNode;
+    Tree->Vcb = Vcb;
+    Tree->IndexAllocationContext = IndexAllocationContext;
 
     // Make sure we won't try reading past the attribute-end
     if (FIELD_OFFSET(INDEX_ROOT_ATTRIBUTE, Header) + IndexRoot->Header.TotalSizeOfEntries > IndexRootContext->pRecord->Resident.ValueLength)
     {
         DPRINT1("Filesystem corruption detected!\n");
         DestroyBTree(Tree);
-        Status = STATUS_FILE_CORRUPT_ERROR;
-        goto Cleanup;
+        return STATUS_FILE_CORRUPT_ERROR;
     }
 
     // Start at the first node entry
@@ -750,8 +760,7 @@ CreateBTreeFromIndex(PDEVICE_EXTENSION Vcb,
         {
             DPRINT1("ERROR: Couldn't allocate memory for next key!\n");
             DestroyBTree(Tree);
-            Status = STATUS_INSUFFICIENT_RESOURCES;
-            goto Cleanup;
+            return STATUS_INSUFFICIENT_RESOURCES;
         }
 
         RootNode->KeyCount++;
@@ -765,8 +774,7 @@ CreateBTreeFromIndex(PDEVICE_EXTENSION Vcb,
             {
                 DPRINT1("ERROR: Couldn't allocate memory for next key!\n");
                 DestroyBTree(Tree);
-                Status = STATUS_INSUFFICIENT_RESOURCES;
-                goto Cleanup;
+                return STATUS_INSUFFICIENT_RESOURCES;
             }
 
             RtlZeroMemory(NextKey, sizeof(B_TREE_KEY));
@@ -777,23 +785,6 @@ CreateBTreeFromIndex(PDEVICE_EXTENSION Vcb,
             // Copy the current entry to its key
             RtlCopyMemory(CurrentKey->IndexEntry, CurrentNodeEntry, CurrentNodeEntry->Length);
 
-            // Does this key have a sub-node?
-            if (CurrentKey->IndexEntry->Flags & NTFS_INDEX_ENTRY_NODE)
-            {
-                // Create the child node
-                CurrentKey->LesserChild = CreateBTreeNodeFromIndexNode(Vcb,
-                                                                       IndexRoot,
-                                                                       IndexAllocationContext,
-                                                                       CurrentKey->IndexEntry);
-                if (!CurrentKey->LesserChild)
-                {
-                    DPRINT1("ERROR: Couldn't create child node!\n");
-                    DestroyBTree(Tree);
-                    Status = STATUS_NOT_IMPLEMENTED;
-                    goto Cleanup;
-                }
-            }
-
             // Advance to the next entry
             CurrentOffset += CurrentNodeEntry->Length;
             CurrentNodeEntry = (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)CurrentNodeEntry + CurrentNodeEntry->Length);
@@ -805,35 +796,13 @@ CreateBTreeFromIndex(PDEVICE_EXTENSION Vcb,
             RtlCopyMemory(CurrentKey->IndexEntry, CurrentNodeEntry, CurrentNodeEntry->Length);
             CurrentKey->NextKey = NULL;
 
-            // Does this key have a sub-node?
-            if (CurrentKey->IndexEntry->Flags & NTFS_INDEX_ENTRY_NODE)
-            {
-                // Create the child node
-                CurrentKey->LesserChild = CreateBTreeNodeFromIndexNode(Vcb,
-                                                                       IndexRoot,
-                                                                       IndexAllocationContext,
-                                                                       CurrentKey->IndexEntry);
-                if (!CurrentKey->LesserChild)
-                {
-                    DPRINT1("ERROR: Couldn't create child node!\n");
-                    DestroyBTree(Tree);
-                    Status = STATUS_NOT_IMPLEMENTED;
-                    goto Cleanup;
-                }
-            }
-
             break;
         }
     }
 
     *NewTree = Tree;
-    Status = STATUS_SUCCESS;
-
-Cleanup:
-    if (IndexAllocationContext)
-        ReleaseAttributeContext(IndexAllocationContext);
 
-    return Status;
+    return STATUS_SUCCESS;
 }
 
 /**
@@ -976,8 +945,8 @@ CreateIndexRootFromBTree(PDEVICE_EXTENSION DeviceExt,
                 CurrentNodeEntry->KeyLength,
                 CurrentNodeEntry->Length);
 
-        // Does the current key have any sub-nodes?
-        if (CurrentKey->LesserChild)
+        // Does the current key have any sub-nodes? (They may not have been loaded)
+        if (CurrentKey->LesserChild || BooleanFlagOn(CurrentKey->IndexEntry->Flags, NTFS_INDEX_ENTRY_NODE))
             NewIndexRoot->Header.Flags = INDEX_ROOT_LARGE;
 
         // Add Length of Current Entry to Total Size of Entries
@@ -1141,7 +1110,8 @@ DemoteBTreeRoot(PB_TREE Tree)
     NewIndexRoot->KeyCount = 1;
     NewIndexRoot->DiskNeedsUpdating = TRUE;
 
-    // Make the new node the Tree's root node
+    // Make the new node the Tree's root node. Its keys now belong to NewSubNode
+    ExFreePoolWithTag(Tree->RootNode, TAG_NTFS);
     Tree->RootNode = NewIndexRoot;
 
 #ifndef NDEBUG
@@ -1343,7 +1313,11 @@ UpdateIndexNode(PDEVICE_EXTENSION DeviceExt,
     {
         ASSERT(CurrentKey);
 
-        // If there's a child node
+        // Children which were never loaded haven't changed, but they still make this a large node
+        if (BooleanFlagOn(CurrentKey->IndexEntry->Flags, NTFS_INDEX_ENTRY_NODE))
+            HasChildren = TRUE;
+
+        // If there's a child node in memory
         if (CurrentKey->LesserChild)
         {
             HasChildren = TRUE;
@@ -1491,6 +1465,7 @@ CreateBTreeKeyFromFilename(ULONGLONG FileReference, PFILENAME_ATTRIBUTE FileName
     }
     NewKey->IndexEntry = NewEntry;
     NewKey->NextKey = NULL;
+    NewKey->LesserChild = NULL;
 
     return NewKey;
 }
@@ -1536,12 +1511,14 @@ DestroyBTreeNode(PB_TREE_FILENAME_NODE Node)
 * Pointer to the B_TREE which will be destroyed.
 *
 * @remarks
-* Destroys every bit of data stored in the tree.
+* Destroys every bit of data stored in the tree, and releases the tree's reference to the index allocation.
 */
 VOID
 DestroyBTree(PB_TREE Tree)
 {
     DestroyBTreeNode(Tree->RootNode);
+    if (Tree->IndexAllocationContext)
+        ReleaseAttributeContext(Tree->IndexAllocationContext);
     ExFreePoolWithTag(Tree, TAG_NTFS);
 }
 
@@ -1573,8 +1550,9 @@ DumpBTreeKey(PB_TREE Tree, PB_TREE_KEY Key, ULONG Number, ULONG Depth)
             DumpBTreeNode(Tree, Key->LesserChild, Number, Depth + 1);
         else
         {
-            // This will be an assert once nodes with arbitrary depth are debugged
-            DPRINT1("DRIVER ERROR: No Key->LesserChild despite Key->IndexEntry->Flags indicating this is a node!\n");
+            for (i = 0; i < Depth + 1; i++)
+                DbgPrint(" ");
+            DbgPrint("Node VCN %I64u (not loaded)\n", GetIndexEntryVCN(Key->IndexEntry));
         }
     }
 }
@@ -1719,6 +1697,9 @@ NtfsInsertKey(PB_TREE Tree,
            MedianKey,
            NewRightHandSibling);
 
+    // Keys are collated with the volume's $UpCase, only trees read from an index know it
+    ASSERT(Tree->Vcb != NULL);
+
     // Create the key for the filename attribute
     NewKey = CreateBTreeKeyFromFilename(FileReference, FileNameAttribute);
     if (!NewKey)
@@ -1730,7 +1711,7 @@ NtfsInsertKey(PB_TREE Tree,
     for (i = 0; i < Node->KeyCount; i++)
     {
         // Should the New Key go before the current key?
-        LONG Comparison = CompareTreeKeys(NewKey, CurrentKey, CaseSensitive);
+        LONG Comparison = CompareTreeKeys(Tree->Vcb, NewKey, CurrentKey, CaseSensitive);
 
         if (Comparison == 0)
         {
@@ -1742,6 +1723,14 @@ NtfsInsertKey(PB_TREE Tree,
         // Is NewKey < CurrentKey?
         if (Comparison < 0)
         {
+            // Read CurrentKey's sub-node if it has one; nodes off this path are never read
+            Status = LoadBTreeChildNode(Tree, CurrentKey);
+            if (!NT_SUCCESS(Status))
+            {
+                DestroyBTreeKey(NewKey);
+                return Status;
+            }
+
             // Does CurrentKey have a sub-node?
             if (CurrentKey->LesserChild)
             {
@@ -1761,10 +1750,13 @@ NtfsInsertKey(PB_TREE Tree,
                 if (!NT_SUCCESS(Status))
                 {
                     DPRINT1("ERROR: Failed to insert key.\n");
-                    ExFreePoolWithTag(NewKey, TAG_NTFS);
+                    DestroyBTreeKey(NewKey);
                     return Status;
                 }
 
+                // The child made its own copy of the key
+                DestroyBTreeKey(NewKey);
+
                 // Did the child node get split?
                 if (NewLeftKey)
                 {
@@ -42,6 +42,7 @@ NtfsCleanupFile(PDEVICE_EXTENSION DeviceExt,
                 BOOLEAN CanWait)
 {
     PNTFS_FCB Fcb;
+    LONG OpenHandleCount;
 
     DPRINT("NtfsCleanupFile(DeviceExt %p, FileObject %p, CanWait %u)\n",
            DeviceExt,
@@ -54,9 +55,9 @@ NtfsCleanupFile(PDEVICE_EXTENSION DeviceExt,
 
     if (Fcb->Flags & FCB_IS_VOLUME)
     {
-        Fcb->OpenHandleCount--;
+        OpenHandleCount = InterlockedDecrement(&Fcb->OpenHandleCount);
 
-        if (Fcb->OpenHandleCount != 0)
+        if (OpenHandleCount != 0)
         {
             // Remove share access when handled
         }
@@ -68,14 +69,19 @@ NtfsCleanupFile(PDEVICE_EXTENSION DeviceExt,
             return STATUS_PENDING;
         }
 
-        Fcb->OpenHandleCount--;
+        /* Only the last cleanup sees the count drop to zero, even without MainResource */
+        OpenHandleCount = InterlockedDecrement(&Fcb->OpenHandleCount);
 
         CcUninitializeCacheMap(FileObject, &Fcb->RFCB.FileSize, NULL);
 
-        if (Fcb->OpenHandleCount != 0)
+        if (OpenHandleCount != 0)
         {
             // Remove share access when handled
         }
+        else
+        {
+            NtfsUsnPostClose(DeviceExt, Fcb);
+        }
 
         FileObject->Flags |= FO_CLEANUP_COMPLETE;
 
@@ -106,16 +112,8 @@ NtfsCleanup(PNTFS_IRP_CONTEXT IrpContext)
     FileObject = IrpContext->FileObject;
     DeviceExtension = DeviceObject->DeviceExtension;
 
-    if (!ExAcquireResourceExclusiveLite(&DeviceExtension->DirResource,
-                                        BooleanFlagOn(IrpContext->Flags, IRPCONTEXT_CANWAIT)))
-    {
-        return NtfsMarkIrpContextForQueue(IrpContext);
-    }
-
     Status = NtfsCleanupFile(DeviceExtension, FileObject, BooleanFlagOn(IrpContext->Flags, IRPCONTEXT_CANWAIT));
 
-    ExReleaseResourceLite(&DeviceExtension->DirResource);
-
     if (Status == STATUS_PENDING)
     {
         return NtfsMarkIrpContextForQueue(IrpContext);
@@ -59,7 +59,7 @@ NtfsCloseFile(PDEVICE_EXTENSION DeviceExt,
     FileObject->FsContext2 = NULL;
     FileObject->FsContext = NULL;
     FileObject->SectionObjectPointer = NULL;
-    DeviceExt->OpenHandleCount--;
+    InterlockedDecrement(&DeviceExt->OpenHandleCount);
 
     if (FileObject->FileName.Buffer)
     {
@@ -74,6 +74,17 @@ NtfsCloseFile(PDEVICE_EXTENSION DeviceExt,
         ExFreePool(Ccb->DirectorySearchPattern);
     }
 
+    if (Ccb->IndexCursor)
+    {
+        NtfsReleaseIndexCursor(Ccb->IndexCursor);
+        ExFreePoolWithTag(Ccb->IndexCursor, TAG_CCB);
+    }
+
+    if (Ccb->LinkPathName)
+    {
+        ExFreePoolWithTag(Ccb->LinkPathName, TAG_CCB);
+    }
+
     ExFreePool(Ccb);
 
     return STATUS_SUCCESS;
@@ -101,16 +112,8 @@ NtfsClose(PNTFS_IRP_CONTEXT IrpContext)
     FileObject = IrpContext->FileObject;
     DeviceExtension = DeviceObject->DeviceExtension;
 
-    if (!ExAcquireResourceExclusiveLite(&DeviceExtension->DirResource,
-                                        BooleanFlagOn(IrpContext->Flags, IRPCONTEXT_CANWAIT)))
-    {
-        return NtfsMarkIrpContextForQueue(IrpContext);
-    }
-
     Status = NtfsCloseFile(DeviceExtension, FileObject);
 
-    ExReleaseResourceLite(&DeviceExtension->DirResource);
-
     if (Status == STATUS_PENDING)
     {
         return NtfsMarkIrpContextForQueue(IrpContext);
@@ -236,6 +236,8 @@ NtfsOpenFileById(PDEVICE_EXTENSION DeviceExt,
 
 /*
  * FUNCTION: Opens a file
+ * If the file doesn't exist and MissingParentFCB is given, it receives the
+ * referenced FCB of the directory that was searched for it, if any
  */
 static
 NTSTATUS
@@ -243,21 +245,27 @@ NtfsOpenFile(PDEVICE_EXTENSION DeviceExt,
              PFILE_OBJECT FileObject,
              PWSTR FileName,
              BOOLEAN CaseSensitive,
-             PNTFS_FCB * FoundFCB)
+             PNTFS_FCB * FoundFCB,
+             PNTFS_FCB * MissingParentFCB)
 {
     PNTFS_FCB ParentFcb;
     PNTFS_FCB Fcb;
     NTSTATUS Status;
     PWSTR AbsFileName = NULL;
 
-    DPRINT("NtfsOpenFile(%p, %p, %S, %s, %p)\n",
+    DPRINT("NtfsOpenFile(%p, %p, %S, %s, %p, %p)\n",
             DeviceExt,
             FileObject,
             FileName,
             CaseSensitive ? "TRUE" : "FALSE",
-            FoundFCB);
+            FoundFCB,
+            MissingParentFCB);
 
     *FoundFCB = NULL;
+    if (MissingParentFCB != NULL)
+    {
+        *MissingParentFCB = NULL;
+    }
 
     if (FileObject->RelatedFileObject)
     {
@@ -289,7 +297,11 @@ NtfsOpenFile(PDEVICE_EXTENSION DeviceExt,
                                    &Fcb,
                                    FileName,
                                    CaseSensitive);
-        if (ParentFcb != NULL)
+        if (Status == STATUS_OBJECT_NAME_NOT_FOUND && MissingParentFCB != NULL)
+        {
+            *MissingParentFCB = ParentFcb;
+        }
+        else if (ParentFcb != NULL)
         {
             NtfsReleaseFCB(DeviceExt,
                            ParentFcb);
@@ -311,6 +323,26 @@ NtfsOpenFile(PDEVICE_EXTENSION DeviceExt,
                                        Fcb,
                                        FileObject);
 
+    /*
+     * The hard links of a file share its FCB, which is named after the first link
+     * that was opened. Keep the name of the link this handle was opened by.
+     */
+    if (NT_SUCCESS(Status) && Fcb->LinkCount > 1 && !NtfsFCBPathNamesEqual(FileName, Fcb->PathName))
+    {
+        PNTFS_CCB Ccb = FileObject->FsContext2;
+        SIZE_T Size = (wcslen(FileName) + 1) * sizeof(WCHAR);
+
+        Ccb->LinkPathName = ExAllocatePoolWithTag(NonPagedPool, Size, TAG_CCB);
+        if (Ccb->LinkPathName != NULL)
+        {
+            RtlCopyMemory(Ccb->LinkPathName, FileName, Size);
+        }
+        else
+        {
+            DPRINT1("Can't keep the link name %S, the handle will be named %S\n", FileName, Fcb->PathName);
+        }
+    }
+
     if (AbsFileName)
         ExFreePool(AbsFileName);
 
@@ -334,6 +366,7 @@ NtfsCreateFile(PDEVICE_OBJECT DeviceObject,
     ULONG RequestedDisposition;
     ULONG RequestedOptions;
     PNTFS_FCB Fcb = NULL;
+    PNTFS_FCB ParentFcb = NULL;
 //    PWSTR FileName;
     NTSTATUS Status;
     UNICODE_STRING FullPath;
@@ -377,7 +410,20 @@ NtfsCreateFile(PDEVICE_OBJECT DeviceObject,
         }
         else
         {
-            Status = NtfsMoonWalkID(DeviceExt, MFTId, &FullPath);
+            /* No need to walk back to a path if the file is already open */
+            Fcb = NtfsGrabFCBFromTableByIndex(DeviceExt, MFTId, NULL);
+            if (Fcb != NULL)
+            {
+                Status = NtfsAttachFCBToFileObject(DeviceExt, Fcb, FileObject);
+                if (!NT_SUCCESS(Status))
+                {
+                    NtfsReleaseFCB(DeviceExt, Fcb);
+                }
+            }
+            else
+            {
+                Status = NtfsMoonWalkID(DeviceExt, MFTId, &FullPath);
+            }
         }
 
         if (!NT_SUCCESS(Status))
@@ -385,7 +431,7 @@ NtfsCreateFile(PDEVICE_OBJECT DeviceObject,
             return Status;
         }
 
-        DPRINT1("Open by ID: %I64x -> %wZ\n", (*(PULONGLONG)FileObject->FileName.Buffer) & NTFS_MFT_MASK, &FullPath);
+        DPRINT1("Open by ID: %I64x -> %S\n", MFTId, (Fcb != NULL) ? Fcb->PathName : FullPath.Buffer);
     }
 
     /* This a open operation for the volume itself */
@@ -404,7 +450,7 @@ NtfsCreateFile(PDEVICE_OBJECT DeviceObject,
         }
 
         NtfsAttachFCBToFileObject(DeviceExt, DeviceExt->VolumeFcb, FileObject);
-        DeviceExt->VolumeFcb->RefCount++;
+        NtfsGrabFCB(DeviceExt, DeviceExt->VolumeFcb);
 
         Irp->IoStatus.Information = FILE_OPENED;
         return STATUS_SUCCESS;
@@ -416,7 +462,8 @@ NtfsCreateFile(PDEVICE_OBJECT DeviceObject,
                               FileObject,
                               ((RequestedOptions & FILE_OPEN_BY_FILE_ID) ? FullPath.Buffer : FileObject->FileName.Buffer),
                               BooleanFlagOn(Stack->Flags, SL_CASE_SENSITIVE),
-                              &Fcb);
+                              &Fcb,
+                              &ParentFcb);
 
         if (RequestedOptions & FILE_OPEN_BY_FILE_ID)
         {
@@ -546,23 +593,59 @@ NtfsCreateFile(PDEVICE_OBJECT DeviceObject,
             {
                 Irp->IoStatus.Information = FILE_OVERWRITTEN;
             }
+
+            NtfsUsnPostChange(DeviceExt, Fcb, USN_REASON_DATA_TRUNCATION);
         }
     }
     else
     {
         /* HUGLY HACK: Can't create new files yet... */
-        if (RequestedDisposition == FILE_CREATE ||
-            RequestedDisposition == FILE_OPEN_IF ||
-            RequestedDisposition == FILE_OVERWRITE_IF ||
-            RequestedDisposition == FILE_SUPERSEDE)
+        if (ParentFcb != NULL &&
+            !(RequestedOptions & FILE_OPEN_BY_FILE_ID) &&
+            (RequestedDisposition == FILE_CREATE ||
+             RequestedDisposition == FILE_OPEN_IF ||
+             RequestedDisposition == FILE_OVERWRITE_IF ||
+             RequestedDisposition == FILE_SUPERSEDE))
         {
             if (!NtfsGlobalData->EnableWriteSupport)
             {
                 DPRINT1("NTFS write-support is EXPERIMENTAL and is disabled by default!\n");
+                NtfsReleaseFCB(DeviceExt, ParentFcb);
                 NtfsCloseFile(DeviceExt, FileObject);
                 return STATUS_ACCESS_DENIED;
             }
 
+            // Our lookup only held the parent directory shared, so another create may have
+            // added the same name since. Look again now that we hold it exclusively.
+            ExAcquireResourceExclusiveLite(&ParentFcb->MainResource, TRUE);
+
+            Status = NtfsOpenFile(DeviceExt,
+                                  FileObject,
+                                  FileObject->FileName.Buffer,
+                                  BooleanFlagOn(Stack->Flags, SL_CASE_SENSITIVE),
+                                  &Fcb,
+                                  NULL);
+            if (Status != STATUS_OBJECT_NAME_NOT_FOUND)
+            {
+                ExReleaseResourceLite(&ParentFcb->MainResource);
+                NtfsReleaseFCB(DeviceExt, ParentFcb);
+
+                if (!NT_SUCCESS(Status))
+                {
+                    return Status;
+                }
+
+                // Start over, as the open of an existing file. This open wasn't counted in the
+                // handle counts yet, so only undo what NtfsOpenFile() attached to the file object
+                ExFreePoolWithTag(FileObject->FsContext2, TAG_CCB);
+                FileObject->FsContext2 = NULL;
+                FileObject->FsContext = NULL;
+                FileObject->SectionObjectPointer = NULL;
+                NtfsReleaseFCB(DeviceExt, Fcb);
+
+                return NtfsCreateFile(DeviceObject, IrpContext);
+            }
+
             // Was the user trying to create a directory?
             if (RequestedOptions & FILE_DIRECTORY_FILE)
             {
@@ -581,6 +664,9 @@ NtfsCreateFile(PDEVICE_OBJECT DeviceObject,
                                               BooleanFlagOn(IrpContext->Flags, IRPCONTEXT_CANWAIT));
             }
 
+            ExReleaseResourceLite(&ParentFcb->MainResource);
+            NtfsReleaseFCB(DeviceExt, ParentFcb);
+
             if (!NT_SUCCESS(Status))
             {
                 DPRINT1("ERROR: Couldn't create file record!\n");
@@ -597,15 +683,22 @@ NtfsCreateFile(PDEVICE_OBJECT DeviceObject,
             {
                 // We need to change Irp->IoStatus.Information to reflect creation
                 Irp->IoStatus.Information = FILE_CREATED;
+
+                NtfsUsnPostChange(DeviceExt, FileObject->FsContext, USN_REASON_FILE_CREATE);
             }
             return Status;
         }
     }
 
+    if (ParentFcb != NULL)
+    {
+        NtfsReleaseFCB(DeviceExt, ParentFcb);
+    }
+
     if (NT_SUCCESS(Status))
     {
-        Fcb->OpenHandleCount++;
-        DeviceExt->OpenHandleCount++;
+        InterlockedIncrement(&Fcb->OpenHandleCount);
+        InterlockedIncrement(&DeviceExt->OpenHandleCount);
     }
 
     /*
@@ -621,7 +714,6 @@ NtfsCreateFile(PDEVICE_OBJECT DeviceObject,
 NTSTATUS
 NtfsCreate(PNTFS_IRP_CONTEXT IrpContext)
 {
-    PDEVICE_EXTENSION DeviceExt;
     NTSTATUS Status;
     PDEVICE_OBJECT DeviceObject;
 
@@ -634,18 +726,14 @@ NtfsCreate(PNTFS_IRP_CONTEXT IrpContext)
         return STATUS_SUCCESS;
     }
 
-    DeviceExt = DeviceObject->DeviceExtension;
-
     if (!(IrpContext->Flags & IRPCONTEXT_CANWAIT))
     {
         return NtfsMarkIrpContextForQueue(IrpContext);
     }
 
-    ExAcquireResourceExclusiveLite(&DeviceExt->DirResource,
-                                   TRUE);
+    /* Directories along the path are locked as they are walked, see NtfsGetFCBForFile() */
     Status = NtfsCreateFile(DeviceObject,
                             IrpContext);
-    ExReleaseResourceLite(&DeviceExt->DirResource);
 
     return Status;
 }
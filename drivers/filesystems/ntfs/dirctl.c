@@ -65,7 +65,7 @@ NtfsGetFileSize(PDEVICE_EXTENSION DeviceExt,
 
 static NTSTATUS
 NtfsGetNamesInformation(PDEVICE_EXTENSION DeviceExt,
-                        PFILE_RECORD_HEADER FileRecord,
+                        PFILENAME_ATTRIBUTE FileName,
                         ULONGLONG MFTIndex,
                         PFILE_NAMES_INFORMATION Info,
                         ULONG BufferLength,
@@ -75,7 +75,6 @@ NtfsGetNamesInformation(PDEVICE_EXTENSION DeviceExt,
     ULONG Length;
     NTSTATUS Status;
     ULONG BytesToCopy = 0;
-    PFILENAME_ATTRIBUTE FileName;
 
     DPRINT("NtfsGetNamesInformation() called\n");
 
@@ -86,14 +85,6 @@ NtfsGetNamesInformation(PDEVICE_EXTENSION DeviceExt,
         return Status;
     }
 
-    FileName = GetBestFileNameFromRecord(DeviceExt, FileRecord);
-    if (FileName == NULL)
-    {
-        DPRINT1("No name information for file ID: %#I64x\n", MFTIndex);
-        NtfsDumpFileAttributes(DeviceExt, FileRecord);
-        return STATUS_OBJECT_NAME_NOT_FOUND;
-    }
-
     Length = FileName->NameLength * sizeof (WCHAR);
     if (First || (BufferLength >= FIELD_OFFSET(FILE_NAMES_INFORMATION, FileName) + Length))
     {
@@ -122,7 +113,7 @@ NtfsGetNamesInformation(PDEVICE_EXTENSION DeviceExt,
 
 static NTSTATUS
 NtfsGetDirectoryInformation(PDEVICE_EXTENSION DeviceExt,
-                            PFILE_RECORD_HEADER FileRecord,
+                            PFILENAME_ATTRIBUTE FileName,
                             ULONGLONG MFTIndex,
                             PFILE_DIRECTORY_INFORMATION Info,
                             ULONG BufferLength,
@@ -132,8 +123,6 @@ NtfsGetDirectoryInformation(PDEVICE_EXTENSION DeviceExt,
     ULONG Length;
     NTSTATUS Status;
     ULONG BytesToCopy = 0;
-    PFILENAME_ATTRIBUTE FileName;
-    PSTANDARD_INFORMATION StdInfo;
 
     DPRINT("NtfsGetDirectoryInformation() called\n");
 
@@ -144,17 +133,6 @@ NtfsGetDirectoryInformation(PDEVICE_EXTENSION DeviceExt,
         return Status;
     }
 
-    FileName = GetBestFileNameFromRecord(DeviceExt, FileRecord);
-    if (FileName == NULL)
-    {
-        DPRINT1("No name information for file ID: %#I64x\n", MFTIndex);
-        NtfsDumpFileAttributes(DeviceExt, FileRecord);
-        return STATUS_OBJECT_NAME_NOT_FOUND;
-    }
-
-    StdInfo = GetStandardInformationFromRecord(DeviceExt, FileRecord);
-    ASSERT(StdInfo != NULL);
-
     Length = FileName->NameLength * sizeof (WCHAR);
     if (First || (BufferLength >= FIELD_OFFSET(FILE_DIRECTORY_INFORMATION, FileName) + Length))
     {
@@ -182,9 +160,10 @@ NtfsGetDirectoryInformation(PDEVICE_EXTENSION DeviceExt,
         Info->ChangeTime.QuadPart = FileName->ChangeTime;
 
         /* Convert file flags */
-        NtfsFileFlagsToAttributes(FileName->FileAttributes | StdInfo->FileAttribute, &Info->FileAttributes);
+        NtfsFileFlagsToAttributes(FileName->FileAttributes, &Info->FileAttributes);
 
-        Info->EndOfFile.QuadPart = NtfsGetFileSize(DeviceExt, FileRecord, L"", 0, (PULONGLONG)&Info->AllocationSize.QuadPart);
+        Info->EndOfFile.QuadPart = FileName->DataSize;
+        Info->AllocationSize.QuadPart = FileName->AllocatedSize;
 
         Info->FileIndex = MFTIndex;
     }
@@ -195,7 +174,7 @@ NtfsGetDirectoryInformation(PDEVICE_EXTENSION DeviceExt,
 
 static NTSTATUS
 NtfsGetFullDirectoryInformation(PDEVICE_EXTENSION DeviceExt,
-                                PFILE_RECORD_HEADER FileRecord,
+                                PFILENAME_ATTRIBUTE FileName,
                                 ULONGLONG MFTIndex,
                                 PFILE_FULL_DIRECTORY_INFORMATION Info,
                                 ULONG BufferLength,
@@ -205,8 +184,6 @@ NtfsGetFullDirectoryInformation(PDEVICE_EXTENSION DeviceExt,
     ULONG Length;
     NTSTATUS Status;
     ULONG BytesToCopy = 0;
-    PFILENAME_ATTRIBUTE FileName;
-    PSTANDARD_INFORMATION StdInfo;
 
     DPRINT("NtfsGetFullDirectoryInformation() called\n");
 
@@ -217,17 +194,6 @@ NtfsGetFullDirectoryInformation(PDEVICE_EXTENSION DeviceExt,
         return Status;
     }
 
-    FileName = GetBestFileNameFromRecord(DeviceExt, FileRecord);
-    if (FileName == NULL)
-    {
-        DPRINT1("No name information for file ID: %#I64x\n", MFTIndex);
-        NtfsDumpFileAttributes(DeviceExt, FileRecord);
-        return STATUS_OBJECT_NAME_NOT_FOUND;
-    }
-
-    StdInfo = GetStandardInformationFromRecord(DeviceExt, FileRecord);
-    ASSERT(StdInfo != NULL);
-
     Length = FileName->NameLength * sizeof (WCHAR);
     if (First || (BufferLength >= FIELD_OFFSET(FILE_FULL_DIR_INFORMATION, FileName) + Length))
     {
@@ -255,9 +221,10 @@ NtfsGetFullDirectoryInformation(PDEVICE_EXTENSION DeviceExt,
         Info->ChangeTime.QuadPart = FileName->ChangeTime;
 
         /* Convert file flags */
-        NtfsFileFlagsToAttributes(FileName->FileAttributes | StdInfo->FileAttribute, &Info->FileAttributes);
+        NtfsFileFlagsToAttributes(FileName->FileAttributes, &Info->FileAttributes);
 
-        Info->EndOfFile.QuadPart = NtfsGetFileSize(DeviceExt, FileRecord, L"", 0, (PULONGLONG)&Info->AllocationSize.QuadPart);
+        Info->EndOfFile.QuadPart = FileName->DataSize;
+        Info->AllocationSize.QuadPart = FileName->AllocatedSize;
 
         Info->FileIndex = MFTIndex;
         Info->EaSize = 0;
@@ -269,7 +236,7 @@ NtfsGetFullDirectoryInformation(PDEVICE_EXTENSION DeviceExt,
 
 static NTSTATUS
 NtfsGetBothDirectoryInformation(PDEVICE_EXTENSION DeviceExt,
-                                PFILE_RECORD_HEADER FileRecord,
+                                PFILENAME_ATTRIBUTE FileName,
                                 ULONGLONG MFTIndex,
                                 PFILE_BOTH_DIR_INFORMATION Info,
                                 ULONG BufferLength,
@@ -279,8 +246,8 @@ NtfsGetBothDirectoryInformation(PDEVICE_EXTENSION DeviceExt,
     ULONG Length;
     NTSTATUS Status;
     ULONG BytesToCopy = 0;
-    PFILENAME_ATTRIBUTE FileName, ShortFileName;
-    PSTANDARD_INFORMATION StdInfo;
+    PFILENAME_ATTRIBUTE ShortFileName = NULL;
+    PFILE_RECORD_HEADER FileRecord = NULL;
 
     DPRINT("NtfsGetBothDirectoryInformation() called\n");
 
@@ -291,17 +258,24 @@ NtfsGetBothDirectoryInformation(PDEVICE_EXTENSION DeviceExt,
         return Status;
     }
 
-    FileName = GetBestFileNameFromRecord(DeviceExt, FileRecord);
-    if (FileName == NULL)
+    if (FileName->NameType == NTFS_FILE_NAME_WIN32_AND_DOS)
     {
-        DPRINT1("No name information for file ID: %#I64x\n", MFTIndex);
-        NtfsDumpFileAttributes(DeviceExt, FileRecord);
-        return STATUS_OBJECT_NAME_NOT_FOUND;
+        ShortFileName = FileName;
     }
-    ShortFileName = GetFileNameFromRecord(DeviceExt, FileRecord, NTFS_FILE_NAME_DOS);
+    else if (FileName->NameType == NTFS_FILE_NAME_WIN32)
+    {
+        /* The short name has an index entry of its own, somewhere else in the index */
+        FileRecord = ExAllocateFromNPagedLookasideList(&DeviceExt->FileRecLookasideList);
+        if (FileRecord == NULL)
+        {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
 
-    StdInfo = GetStandardInformationFromRecord(DeviceExt, FileRecord);
-    ASSERT(StdInfo != NULL);
+        if (NT_SUCCESS(ReadFileRecord(DeviceExt, MFTIndex, FileRecord)))
+        {
+            ShortFileName = GetFileNameFromRecord(DeviceExt, FileRecord, NTFS_FILE_NAME_DOS);
+        }
+    }
 
     Length = FileName->NameLength * sizeof (WCHAR);
     if (First || (BufferLength >= FIELD_OFFSET(FILE_BOTH_DIR_INFORMATION, FileName) + Length))
@@ -343,14 +317,20 @@ NtfsGetBothDirectoryInformation(PDEVICE_EXTENSION DeviceExt,
         Info->ChangeTime.QuadPart = FileName->ChangeTime;
 
         /* Convert file flags */
-        NtfsFileFlagsToAttributes(FileName->FileAttributes | StdInfo->FileAttribute, &Info->FileAttributes);
+        NtfsFileFlagsToAttributes(FileName->FileAttributes, &Info->FileAttributes);
 
-        Info->EndOfFile.QuadPart = NtfsGetFileSize(DeviceExt, FileRecord, L"", 0, (PULONGLONG)&Info->AllocationSize.QuadPart);
+        Info->EndOfFile.QuadPart = FileName->DataSize;
+        Info->AllocationSize.QuadPart = FileName->AllocatedSize;
 
         Info->FileIndex = MFTIndex;
         Info->EaSize = 0;
     }
 
+    if (FileRecord != NULL)
+    {
+        ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, FileRecord);
+    }
+
     return Status;
 }
 
@@ -373,10 +353,11 @@ NtfsQueryDirectory(PNTFS_IRP_CONTEXT IrpContext)
     PIO_STACK_LOCATION Stack;
     PFILE_OBJECT FileObject;
     NTSTATUS Status = STATUS_SUCCESS;
-    PFILE_RECORD_HEADER FileRecord;
+    PINDEX_ENTRY_ATTRIBUTE IndexEntry;
     ULONGLONG MFTRecord, OldMFTRecord = 0;
     UNICODE_STRING Pattern;
     ULONG Written;
+    LARGE_INTEGER NoWait;
 
     DPRINT("NtfsQueryDirectory() called\n");
 
@@ -397,16 +378,24 @@ NtfsQueryDirectory(PNTFS_IRP_CONTEXT IrpContext)
     FileInformationClass = Stack->Parameters.QueryDirectory.FileInformationClass;
     FileIndex = Stack->Parameters.QueryDirectory.FileIndex;
 
-    if (NtfsFCBIsCompressed(Fcb))
+    /*
+     * The directory is only locked shared, but the pattern and the cursor belong to the
+     * handle: the queries on the same handle must not run at the same time.
+     */
+    NoWait.QuadPart = 0;
+    if (KeWaitForSingleObject(&Ccb->QueryEvent,
+                              Executive,
+                              KernelMode,
+                              FALSE,
+                              BooleanFlagOn(IrpContext->Flags, IRPCONTEXT_CANWAIT) ? NULL : &NoWait) != STATUS_SUCCESS)
     {
-        DPRINT1("Compressed directory!\n");
-        UNIMPLEMENTED;
-        return STATUS_NOT_IMPLEMENTED;
+        return STATUS_PENDING;
     }
 
     if (!ExAcquireResourceSharedLite(&Fcb->MainResource,
                                      BooleanFlagOn(IrpContext->Flags, IRPCONTEXT_CANWAIT)))
     {
+        KeSetEvent(&Ccb->QueryEvent, IO_NO_INCREMENT, FALSE);
         return STATUS_PENDING;
     }
 
@@ -422,6 +411,7 @@ NtfsQueryDirectory(PNTFS_IRP_CONTEXT IrpContext)
             if (!Ccb->DirectorySearchPattern)
             {
                 ExReleaseResourceLite(&Fcb->MainResource);
+                KeSetEvent(&Ccb->QueryEvent, IO_NO_INCREMENT, FALSE);
                 return STATUS_INSUFFICIENT_RESOURCES;
             }
 
@@ -436,6 +426,7 @@ NtfsQueryDirectory(PNTFS_IRP_CONTEXT IrpContext)
         if (!Ccb->DirectorySearchPattern)
         {
             ExReleaseResourceLite(&Fcb->MainResource);
+            KeSetEvent(&Ccb->QueryEvent, IO_NO_INCREMENT, FALSE);
             return STATUS_INSUFFICIENT_RESOURCES;
         }
 
@@ -457,31 +448,43 @@ NtfsQueryDirectory(PNTFS_IRP_CONTEXT IrpContext)
         Ccb->Entry = 0;
     }
 
+    if (Ccb->IndexCursor == NULL)
+    {
+        Ccb->IndexCursor = ExAllocatePoolWithTag(NonPagedPool, sizeof(NTFS_INDEX_CURSOR), TAG_CCB);
+        if (Ccb->IndexCursor == NULL)
+        {
+            ExReleaseResourceLite(&Fcb->MainResource);
+            KeSetEvent(&Ccb->QueryEvent, IO_NO_INCREMENT, FALSE);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlZeroMemory(Ccb->IndexCursor, sizeof(NTFS_INDEX_CURSOR));
+    }
+
+    // Only this class needs the file record of the entries, for their DOS name
+    Ccb->IndexCursor->PrefetchFileRecords = (FileInformationClass == FileBothDirectoryInformation);
+
     /* Get Buffer for result */
     Buffer = NtfsGetUserBuffer(Irp, FALSE);
 
     DPRINT("Buffer=%p tofind=%S\n", Buffer, Ccb->DirectorySearchPattern);
 
-    if (!ExAcquireResourceExclusiveLite(&DeviceExtension->DirResource,
-                                        BooleanFlagOn(IrpContext->Flags, IRPCONTEXT_CANWAIT)))
-    {
-        ExReleaseResourceLite(&Fcb->MainResource);
-        return STATUS_PENDING;
-    }
-
     Written = 0;
     while (Status == STATUS_SUCCESS && BufferLength > 0)
     {
-        Status = NtfsFindFileAt(DeviceExtension,
-                                &Pattern,
-                                &Ccb->Entry,
-                                &FileRecord,
-                                &MFTRecord,
-                                Fcb->MFTIndex,
-                                BooleanFlagOn(Stack->Flags, SL_CASE_SENSITIVE));
+        Status = NtfsFindNextIndexEntry(DeviceExtension,
+                                        Ccb->IndexCursor,
+                                        Fcb->MFTIndex,
+                                        Fcb->IndexGeneration,
+                                        &Pattern,
+                                        &Ccb->Entry,
+                                        BooleanFlagOn(Stack->Flags, SL_CASE_SENSITIVE),
+                                        &IndexEntry);
 
         if (NT_SUCCESS(Status))
         {
+            MFTRecord = IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK;
+
             /* HACK: files with both a short name and a long name are present twice in the index.
              * Ignore the second entry, if it is immediately following the first one.
              */
@@ -489,7 +492,6 @@ NtfsQueryDirectory(PNTFS_IRP_CONTEXT IrpContext)
             {
                 DPRINT1("Ignoring duplicate MFT entry 0x%x\n", MFTRecord);
                 Ccb->Entry++;
-                ExFreeToNPagedLookasideList(&DeviceExtension->FileRecLookasideList, FileRecord);
                 continue;
             }
             OldMFTRecord = MFTRecord;
@@ -498,7 +500,7 @@ NtfsQueryDirectory(PNTFS_IRP_CONTEXT IrpContext)
             {
                 case FileNamesInformation:
                     Status = NtfsGetNamesInformation(DeviceExtension,
-                                                     FileRecord,
+                                                     &IndexEntry->FileName,
                                                      MFTRecord,
                                                      (PFILE_NAMES_INFORMATION)Buffer,
                                                      BufferLength,
@@ -508,7 +510,7 @@ NtfsQueryDirectory(PNTFS_IRP_CONTEXT IrpContext)
 
                 case FileDirectoryInformation:
                     Status = NtfsGetDirectoryInformation(DeviceExtension,
-                                                         FileRecord,
+                                                         &IndexEntry->FileName,
                                                          MFTRecord,
                                                          (PFILE_DIRECTORY_INFORMATION)Buffer,
                                                          BufferLength,
@@ -518,7 +520,7 @@ NtfsQueryDirectory(PNTFS_IRP_CONTEXT IrpContext)
 
                 case FileFullDirectoryInformation:
                     Status = NtfsGetFullDirectoryInformation(DeviceExtension,
-                                                             FileRecord,
+                                                             &IndexEntry->FileName,
                                                              MFTRecord,
                                                              (PFILE_FULL_DIRECTORY_INFORMATION)Buffer,
                                                              BufferLength,
@@ -528,7 +530,7 @@ NtfsQueryDirectory(PNTFS_IRP_CONTEXT IrpContext)
 
                 case FileBothDirectoryInformation:
                     Status = NtfsGetBothDirectoryInformation(DeviceExtension,
-                                                             FileRecord,
+                                                             &IndexEntry->FileName,
                                                              MFTRecord,
                                                              (PFILE_BOTH_DIR_INFORMATION)Buffer,
                                                              BufferLength,
@@ -556,8 +558,6 @@ NtfsQueryDirectory(PNTFS_IRP_CONTEXT IrpContext)
         Ccb->Entry++;
         BufferLength -= Buffer0->NextEntryOffset;
 
-        ExFreeToNPagedLookasideList(&DeviceExtension->FileRecLookasideList, FileRecord);
-
         if (Stack->Flags & SL_RETURN_SINGLE_ENTRY)
         {
             break;
@@ -579,9 +579,10 @@ NtfsQueryDirectory(PNTFS_IRP_CONTEXT IrpContext)
         IrpContext->Irp->IoStatus.Information = Written;
     }
 
-    ExReleaseResourceLite(&DeviceExtension->DirResource);
     ExReleaseResourceLite(&Fcb->MainResource);
 
+    KeSetEvent(&Ccb->QueryEvent, IO_NO_INCREMENT, FALSE);
+
     return Status;
 }
 
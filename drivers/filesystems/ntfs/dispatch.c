@@ -67,6 +67,13 @@ NtfsDispatch(PNTFS_IRP_CONTEXT IrpContext)
 
     NtfsIsIrpTopLevel(Irp);
 
+    /* Log records only hold whole requests. Paging I/O and closes may be awaited by requests in progress. */
+    if (IrpContext->DeviceObject != NtfsGlobalData->DeviceObject)
+    {
+        NtfsLogBeginOperation(IrpContext->DeviceObject->DeviceExtension,
+                              BooleanFlagOn(Irp->Flags, IRP_PAGING_IO) || IrpContext->MajorFunction == IRP_MJ_CLOSE);
+    }
+
     switch (IrpContext->MajorFunction)
     {
         case IRP_MJ_QUERY_VOLUME_INFORMATION:
@@ -132,6 +139,27 @@ NtfsDispatch(PNTFS_IRP_CONTEXT IrpContext)
         case IRP_MJ_FILE_SYSTEM_CONTROL:
             Status = NtfsFileSystemControl(IrpContext);
             break;
+
+        case IRP_MJ_SHUTDOWN:
+            Status = NtfsShutdown(IrpContext);
+            break;
+    }
+
+    /* Write back the change journal records, file records and $Bitmap pages the request modified */
+    if (IrpContext->DeviceObject != NtfsGlobalData->DeviceObject)
+    {
+        PDEVICE_EXTENSION Vcb = IrpContext->DeviceObject->DeviceExtension;
+
+        if (Vcb->UsnJournal.NextUsn != Vcb->UsnJournal.WrittenUsn)
+            NtfsFlushUsnJournal(Vcb);
+
+        if (Vcb->VolumeBitmap.DirtyCount != 0)
+            NtfsFlushVolumeBitmap(Vcb);
+
+        if (Vcb->MftCache.DirtyCount != 0)
+            NtfsFlushMftCache(Vcb);
+
+        NtfsLogEndOperation(Vcb);
     }
 
     ASSERT((!(IrpContext->Flags & IRPCONTEXT_COMPLETE) && !(IrpContext->Flags & IRPCONTEXT_QUEUE)) ||
@@ -39,10 +39,12 @@ NTAPI
 NtfsAcqLazyWrite(PVOID Context,
                  BOOLEAN Wait)
 {
-    UNREFERENCED_PARAMETER(Context);
-    UNREFERENCED_PARAMETER(Wait);
-    UNIMPLEMENTED;
-    return FALSE;
+    PNTFS_FCB Fcb = (PNTFS_FCB)Context;
+
+    ASSERT(Fcb);
+    DPRINT("NtfsAcqLazyWrite(%p, %u)\n", Fcb, Wait);
+
+    return ExAcquireResourceExclusiveLite(&Fcb->MainResource, Wait);
 }
 
 
@@ -50,8 +52,12 @@ VOID
 NTAPI
 NtfsRelLazyWrite(PVOID Context)
 {
-    UNREFERENCED_PARAMETER(Context);
-    UNIMPLEMENTED;
+    PNTFS_FCB Fcb = (PNTFS_FCB)Context;
+
+    ASSERT(Fcb);
+    DPRINT("NtfsRelLazyWrite(%p)\n", Fcb);
+
+    ExReleaseResourceLite(&Fcb->MainResource);
 }
 
 
@@ -60,10 +66,12 @@ NTAPI
 NtfsAcqReadAhead(PVOID Context,
                  BOOLEAN Wait)
 {
-    UNREFERENCED_PARAMETER(Context);
-    UNREFERENCED_PARAMETER(Wait);
-    UNIMPLEMENTED;
-    return FALSE;
+    PNTFS_FCB Fcb = (PNTFS_FCB)Context;
+
+    ASSERT(Fcb);
+    DPRINT("NtfsAcqReadAhead(%p, %u)\n", Fcb, Wait);
+
+    return ExAcquireResourceSharedLite(&Fcb->MainResource, Wait);
 }
 
 
@@ -71,10 +79,18 @@ VOID
 NTAPI
 NtfsRelReadAhead(PVOID Context)
 {
-    UNREFERENCED_PARAMETER(Context);
-    UNIMPLEMENTED;
+    PNTFS_FCB Fcb = (PNTFS_FCB)Context;
+
+    ASSERT(Fcb);
+    DPRINT("NtfsRelReadAhead(%p)\n", Fcb);
+
+    ExReleaseResourceLite(&Fcb->MainResource);
 }
 
+/*
+ * Every FCB is FastIoIsQuestionable, so FsRtlCopyRead() and FsRtlCopyWrite()
+ * call this before serving a request from the cache.
+ */
 BOOLEAN
 NTAPI
 NtfsFastIoCheckIfPossible(
@@ -87,16 +103,50 @@ NtfsFastIoCheckIfPossible(
     _Out_ PIO_STATUS_BLOCK IoStatus,
     _In_ PDEVICE_OBJECT DeviceObject)
 {
-    /* Deny FastIo */
-    UNREFERENCED_PARAMETER(FileObject);
-    UNREFERENCED_PARAMETER(FileOffset);
-    UNREFERENCED_PARAMETER(Length);
+    PNTFS_FCB Fcb;
+
     UNREFERENCED_PARAMETER(Wait);
     UNREFERENCED_PARAMETER(LockKey);
-    UNREFERENCED_PARAMETER(CheckForReadOperation);
     UNREFERENCED_PARAMETER(IoStatus);
     UNREFERENCED_PARAMETER(DeviceObject);
-    return FALSE;
+
+    Fcb = (PNTFS_FCB)FileObject->FsContext;
+    if (Fcb == NULL || FileObject->PrivateCacheMap == NULL)
+    {
+        return FALSE;
+    }
+
+    if ((Fcb->Flags & FCB_IS_VOLUME) || NtfsFCBIsDirectory(Fcb) || NtfsFCBIsEncrypted(Fcb))
+    {
+        return FALSE;
+    }
+
+    if (CheckForReadOperation)
+    {
+        // FsRtlCopyRead() serves the read from the cache right after this
+        NtfsReadAheadIfSequential(FileObject, FileOffset, Length);
+        return TRUE;
+    }
+
+    if (!NtfsGlobalData->EnableWriteSupport || NtfsFCBIsCompressed(Fcb))
+    {
+        return FALSE;
+    }
+
+    /* Growing the stream (or appending, offset -1) needs NtfsWrite() to update the file record */
+    if (FileOffset->QuadPart < 0 ||
+        FileOffset->QuadPart + Length > Fcb->RFCB.FileSize.QuadPart)
+    {
+        return FALSE;
+    }
+
+    /* The change journal is written at the end of a request, which a fast write isn't */
+    if (!NtfsUsnIsChangePosted(Fcb->Vcb, Fcb, USN_REASON_DATA_OVERWRITE))
+    {
+        return FALSE;
+    }
+
+    return TRUE;
 }
 
 BOOLEAN
@@ -111,15 +161,9 @@ NtfsFastIoRead(
     _Out_ PIO_STATUS_BLOCK IoStatus,
     _In_ PDEVICE_OBJECT DeviceObject)
 {
-    DBG_UNREFERENCED_PARAMETER(FileObject);
-    DBG_UNREFERENCED_PARAMETER(FileOffset);
-    DBG_UNREFERENCED_PARAMETER(Length);
-    DBG_UNREFERENCED_PARAMETER(Wait);
-    DBG_UNREFERENCED_PARAMETER(LockKey);
-    DBG_UNREFERENCED_PARAMETER(Buffer);
-    DBG_UNREFERENCED_PARAMETER(IoStatus);
-    DBG_UNREFERENCED_PARAMETER(DeviceObject);
-    return FALSE;
+    DPRINT("NtfsFastIoRead(%p, %I64d, %lu)\n", FileObject, FileOffset->QuadPart, Length);
+
+    return FsRtlCopyRead(FileObject, FileOffset, Length, Wait, LockKey, Buffer, IoStatus, DeviceObject);
 }
 
 BOOLEAN
@@ -134,15 +178,15 @@ NtfsFastIoWrite(
     _Out_ PIO_STATUS_BLOCK IoStatus,
     _In_ PDEVICE_OBJECT DeviceObject)
 {
-    DBG_UNREFERENCED_PARAMETER(FileObject);
-    DBG_UNREFERENCED_PARAMETER(FileOffset);
-    DBG_UNREFERENCED_PARAMETER(Length);
-    DBG_UNREFERENCED_PARAMETER(Wait);
-    DBG_UNREFERENCED_PARAMETER(LockKey);
-    DBG_UNREFERENCED_PARAMETER(Buffer);
-    DBG_UNREFERENCED_PARAMETER(IoStatus);
-    DBG_UNREFERENCED_PARAMETER(DeviceObject);
-    return FALSE;
+    DPRINT("NtfsFastIoWrite(%p, %I64d, %lu)\n", FileObject, FileOffset->QuadPart, Length);
+
+    /* Let NtfsDispatch() refuse the write when write support is off */
+    if (!NtfsGlobalData->EnableWriteSupport)
+    {
+        return FALSE;
+    }
+
+    return FsRtlCopyWrite(FileObject, FileOffset, Length, Wait, LockKey, Buffer, IoStatus, DeviceObject);
 }
 
 /* EOF */
@@ -109,8 +109,11 @@ NtfsCreateFCB(PCWSTR FileName,
     }
 
     ExInitializeResourceLite(&Fcb->MainResource);
+    ExInitializeResourceLite(&Fcb->PagingIoResource);
 
     Fcb->RFCB.Resource = &(Fcb->MainResource);
+    Fcb->RFCB.PagingIoResource = &(Fcb->PagingIoResource);
+    Fcb->RFCB.IsFastIoPossible = FastIoIsQuestionable;
 
     return Fcb;
 }
@@ -123,6 +126,7 @@ NtfsDestroyFCB(PNTFS_FCB Fcb)
     ASSERT(Fcb->Identifier.Type == NTFS_TYPE_FCB);
 
     ExDeleteResourceLite(&Fcb->MainResource);
+    ExDeleteResourceLite(&Fcb->PagingIoResource);
 
     ExFreeToNPagedLookasideList(&NtfsGlobalData->FcbLookasideList, Fcb);
 }
@@ -161,6 +165,75 @@ NtfsFCBIsRoot(PNTFS_FCB Fcb)
 }
 
 
+/*
+ * FNV-1a over the upcased name, so that the hash of a path doesn't depend
+ * on the case it was opened with. Computed before taking FcbListLock.
+ */
+static
+ULONG
+NtfsHashFCBPathName(PCWSTR PathName)
+{
+    ULONG Hash = 2166136261;
+
+    while (*PathName != UNICODE_NULL)
+    {
+        Hash ^= RtlUpcaseUnicodeChar(*PathName);
+        Hash *= 16777619;
+        PathName++;
+    }
+
+    return Hash;
+}
+
+
+/*
+ * Compares two paths case-insensitively, upcasing them like NtfsHashFCBPathName(),
+ * so that paths which compare equal always have the same hash
+ */
+BOOLEAN
+NtfsFCBPathNamesEqual(PCWSTR PathName1,
+                      PCWSTR PathName2)
+{
+    while (*PathName1 != UNICODE_NULL &&
+           RtlUpcaseUnicodeChar(*PathName1) == RtlUpcaseUnicodeChar(*PathName2))
+    {
+        PathName1++;
+        PathName2++;
+    }
+
+    return RtlUpcaseUnicodeChar(*PathName1) == RtlUpcaseUnicodeChar(*PathName2);
+}
+
+
+static
+ULONG
+NtfsHashFCBIndex(ULONGLONG MFTIndex)
+{
+    return (ULONG)(MFTIndex ^ (MFTIndex >> 32));
+}
+
+
+VOID
+NtfsInitializeFCBTable(PNTFS_VCB Vcb)
+{
+    ULONG i;
+
+    KeInitializeSpinLock(&Vcb->FcbListLock);
+    InitializeListHead(&Vcb->FcbListHead);
+
+    for (i = 0; i < NTFS_FCB_HASH_BUCKETS; i++)
+    {
+        InitializeListHead(&Vcb->FcbTable.PathBuckets[i]);
+        InitializeListHead(&Vcb->FcbTable.IndexBuckets[i]);
+    }
+
+    Vcb->FcbTable.FcbCount = 0;
+    Vcb->FcbTable.Lookups = 0;
+    Vcb->FcbTable.Hits = 0;
+    Vcb->FcbTable.Compares = 0;
+}
+
+
 VOID
 NtfsGrabFCB(PNTFS_VCB Vcb,
             PNTFS_FCB Fcb)
@@ -194,6 +267,9 @@ NtfsReleaseFCB(PNTFS_VCB Vcb,
     if (Fcb->RefCount <= 0 && !NtfsFCBIsDirectory(Fcb))
     {
         RemoveEntryList(&Fcb->FcbListEntry);
+        RemoveEntryList(&Fcb->PathHashEntry);
+        RemoveEntryList(&Fcb->IndexHashEntry);
+        Vcb->FcbTable.FcbCount--;
         KeReleaseSpinLock(&Vcb->FcbListLock, oldIrql);
         CcUninitializeCacheMap(Fcb->FileObject, NULL, NULL);
         NtfsDestroyFCB(Fcb);
@@ -205,16 +281,95 @@ NtfsReleaseFCB(PNTFS_VCB Vcb,
 }
 
 
-VOID
+static
+PNTFS_FCB
+NtfsLookupFCBByIndex(PNTFS_VCB Vcb,
+                     ULONGLONG MFTIndex,
+                     PCWSTR Stream)
+{
+    PNTFS_FCB Fcb;
+    PLIST_ENTRY ListHead, current_entry;
+
+    /* Caller holds FcbListLock */
+    Vcb->FcbTable.Lookups++;
+    ListHead = &Vcb->FcbTable.IndexBuckets[NtfsHashFCBIndex(MFTIndex) & (NTFS_FCB_HASH_BUCKETS - 1)];
+    current_entry = ListHead->Flink;
+    while (current_entry != ListHead)
+    {
+        Fcb = CONTAINING_RECORD(current_entry, NTFS_FCB, IndexHashEntry);
+        current_entry = current_entry->Flink;
+
+        if (Fcb->MFTIndex != MFTIndex)
+        {
+            continue;
+        }
+
+        Vcb->FcbTable.Compares++;
+        if (_wcsicmp(Stream, Fcb->Stream) == 0)
+        {
+            Vcb->FcbTable.Hits++;
+            return Fcb;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+* @name NtfsAddFCBToTable
+* @implemented
+*
+* Inserts a new FCB in the FCB table. Lookups in a directory only hold it shared,
+* so two of them may build an FCB for the same file at the same time: only the
+* first one to get here is inserted.
+*
+* @param Vcb
+* Pointer to the VCB of the volume.
+*
+* @param Fcb
+* The new FCB, with its MFTIndex and Stream set.
+*
+* @return
+* Fcb if it was inserted. Otherwise the FCB which was already in the table for
+* this stream of the file, referenced, and the caller must uninitialize the cache
+* map of Fcb and free it with NtfsDestroyFCB().
+*
+* @remarks
+* Fcb must be fully set up, its cache included, as other threads can use it as soon
+* as it's in the table.
+*/
+PNTFS_FCB
 NtfsAddFCBToTable(PNTFS_VCB Vcb,
                   PNTFS_FCB Fcb)
 {
     KIRQL oldIrql;
+    ULONG IndexHash;
+    PNTFS_FCB ExistingFcb;
+
+    Fcb->PathHash = NtfsHashFCBPathName(Fcb->PathName);
+    IndexHash = NtfsHashFCBIndex(Fcb->MFTIndex);
 
     KeAcquireSpinLock(&Vcb->FcbListLock, &oldIrql);
+
+    ExistingFcb = NtfsLookupFCBByIndex(Vcb, Fcb->MFTIndex, Fcb->Stream);
+    if (ExistingFcb != NULL)
+    {
+        ExistingFcb->RefCount++;
+        KeReleaseSpinLock(&Vcb->FcbListLock, oldIrql);
+        return ExistingFcb;
+    }
+
     Fcb->Vcb = Vcb;
     InsertTailList(&Vcb->FcbListHead, &Fcb->FcbListEntry);
+    InsertHeadList(&Vcb->FcbTable.PathBuckets[Fcb->PathHash & (NTFS_FCB_HASH_BUCKETS - 1)],
+                   &Fcb->PathHashEntry);
+    InsertHeadList(&Vcb->FcbTable.IndexBuckets[IndexHash & (NTFS_FCB_HASH_BUCKETS - 1)],
+                   &Fcb->IndexHashEntry);
+    Vcb->FcbTable.FcbCount++;
     KeReleaseSpinLock(&Vcb->FcbListLock, oldIrql);
+
+    return Fcb;
 }
 
 
@@ -224,12 +379,12 @@ NtfsGrabFCBFromTable(PNTFS_VCB Vcb,
 {
     KIRQL oldIrql;
     PNTFS_FCB Fcb;
-    PLIST_ENTRY current_entry;
-
-    KeAcquireSpinLock(&Vcb->FcbListLock, &oldIrql);
+    PLIST_ENTRY ListHead, current_entry;
+    ULONG Hash;
 
     if (FileName == NULL || *FileName == 0)
     {
+        KeAcquireSpinLock(&Vcb->FcbListLock, &oldIrql);
         DPRINT("Return FCB for stream file object\n");
         Fcb = Vcb->StreamFileObject->FsContext;
         Fcb->RefCount++;
@@ -237,22 +392,34 @@ NtfsGrabFCBFromTable(PNTFS_VCB Vcb,
         return Fcb;
     }
 
-    current_entry = Vcb->FcbListHead.Flink;
-    while (current_entry != &Vcb->FcbListHead)
+    Hash = NtfsHashFCBPathName(FileName);
+
+    KeAcquireSpinLock(&Vcb->FcbListLock, &oldIrql);
+
+    Vcb->FcbTable.Lookups++;
+    ListHead = &Vcb->FcbTable.PathBuckets[Hash & (NTFS_FCB_HASH_BUCKETS - 1)];
+    current_entry = ListHead->Flink;
+    while (current_entry != ListHead)
     {
-        Fcb = CONTAINING_RECORD(current_entry, NTFS_FCB, FcbListEntry);
+        Fcb = CONTAINING_RECORD(current_entry, NTFS_FCB, PathHashEntry);
+        current_entry = current_entry->Flink;
+
+        if (Fcb->PathHash != Hash)
+        {
+            continue;
+        }
 
         DPRINT("Comparing '%S' and '%S'\n", FileName, Fcb->PathName);
-        if (_wcsicmp(FileName, Fcb->PathName) == 0)
+        Vcb->FcbTable.Compares++;
+        if (NtfsFCBPathNamesEqual(FileName, Fcb->PathName))
         {
+            Vcb->FcbTable.Hits++;
             Fcb->RefCount++;
             KeReleaseSpinLock(&Vcb->FcbListLock, oldIrql);
             return Fcb;
         }
 
         //FIXME: need to compare against short name in FCB here
-
-        current_entry = current_entry->Flink;
     }
 
     KeReleaseSpinLock(&Vcb->FcbListLock, oldIrql);
@@ -261,6 +428,88 @@ NtfsGrabFCBFromTable(PNTFS_VCB Vcb,
 }
 
 
+/**
+* @name NtfsGrabFCBFromTableByIndex
+* @implemented
+*
+* Looks up an FCB by the file record it was built from, so that every hard
+* link of a file, and opens by file ID, share the same FCB.
+*
+* @param Vcb
+* Pointer to the VCB of the volume.
+*
+* @param MFTIndex
+* Index of the file record of the file.
+*
+* @param Stream
+* Name of the data stream, NULL or an empty string for the unnamed one.
+*
+* @return
+* The referenced FCB, or NULL if none is open for this stream of the file.
+*/
+PNTFS_FCB
+NtfsGrabFCBFromTableByIndex(PNTFS_VCB Vcb,
+                            ULONGLONG MFTIndex,
+                            PCWSTR Stream)
+{
+    KIRQL oldIrql;
+    PNTFS_FCB Fcb;
+
+    if (Stream == NULL)
+    {
+        Stream = L"";
+    }
+
+    KeAcquireSpinLock(&Vcb->FcbListLock, &oldIrql);
+
+    Fcb = NtfsLookupFCBByIndex(Vcb, MFTIndex, Stream);
+    if (Fcb != NULL)
+    {
+        Fcb->RefCount++;
+    }
+
+    KeReleaseSpinLock(&Vcb->FcbListLock, oldIrql);
+
+    return Fcb;
+}
+
+
+/**
+* @name NtfsIncrementIndexGeneration
+* @implemented
+*
+* Tells the directory cursors of a directory that its index was modified, see
+* NtfsFindNextIndexEntry().
+*
+* @param Vcb
+* Pointer to the VCB of the volume.
+*
+* @param DirectoryMftIndex
+* Index of the file record of the directory.
+*
+* @remarks
+* Cursors only live in the CCBs of the handles open on the directory, so there's
+* nothing to do when no FCB exists for it.
+*/
+VOID
+NtfsIncrementIndexGeneration(PNTFS_VCB Vcb,
+                             ULONGLONG DirectoryMftIndex)
+{
+    KIRQL oldIrql;
+    PNTFS_FCB Fcb;
+
+    KeAcquireSpinLock(&Vcb->FcbListLock, &oldIrql);
+
+    Fcb = NtfsLookupFCBByIndex(Vcb, DirectoryMftIndex, L"");
+    if (Fcb != NULL)
+    {
+        InterlockedIncrement(&Fcb->IndexGeneration);
+    }
+
+    KeReleaseSpinLock(&Vcb->FcbListLock, oldIrql);
+}
+
+
 NTSTATUS
 NtfsFCBInitializeCache(PNTFS_VCB Vcb,
                        PNTFS_FCB Fcb)
@@ -274,6 +523,7 @@ NtfsFCBInitializeCache(PNTFS_VCB Vcb,
     newCCB = ExAllocatePoolWithTag(NonPagedPool, sizeof(NTFS_CCB), TAG_CCB);
     if (newCCB == NULL)
     {
+        ObDereferenceObject(FileObject);
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
@@ -281,6 +531,7 @@ NtfsFCBInitializeCache(PNTFS_VCB Vcb,
 
     newCCB->Identifier.Type = NTFS_TYPE_CCB;
     newCCB->Identifier.Size = sizeof(NTFS_TYPE_CCB);
+    KeInitializeEvent(&newCCB->QueryEvent, SynchronizationEvent, TRUE);
 
     FileObject->SectionObjectPointer = &Fcb->SectionObjectPointers;
     FileObject->FsContext = Fcb;
@@ -318,7 +569,7 @@ NtfsFCBInitializeCache(PNTFS_VCB Vcb,
 PNTFS_FCB
 NtfsMakeRootFCB(PNTFS_VCB Vcb)
 {
-    PNTFS_FCB Fcb;
+    PNTFS_FCB Fcb, TableFcb;
     PFILE_RECORD_HEADER MftRecord;
     PFILENAME_ATTRIBUTE FileName;
 
@@ -360,9 +611,25 @@ NtfsMakeRootFCB(PNTFS_VCB Vcb)
     Fcb->MFTIndex = NTFS_FILE_ROOT;
     Fcb->LinkCount = MftRecord->LinkCount;
 
-    NtfsFCBInitializeCache(Vcb, Fcb);
-    NtfsAddFCBToTable(Vcb, Fcb);
-    NtfsGrabFCB(Vcb, Fcb);
+    /* The FCB must be ready for use before it can be found in the table */
+    if (!NT_SUCCESS(NtfsFCBInitializeCache(Vcb, Fcb)))
+    {
+        NtfsDestroyFCB(Fcb);
+        ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, MftRecord);
+        return NULL;
+    }
+
+    TableFcb = NtfsAddFCBToTable(Vcb, Fcb);
+    if (TableFcb != Fcb)
+    {
+        CcUninitializeCacheMap(Fcb->FileObject, NULL, NULL);
+        NtfsDestroyFCB(Fcb);
+        Fcb = TableFcb;
+    }
+    else
+    {
+        NtfsGrabFCB(Vcb, Fcb);
+    }
 
     ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, MftRecord);
 
@@ -397,11 +664,20 @@ NtfsMakeFCBFromDirEntry(PNTFS_VCB Vcb,
     WCHAR pathName[MAX_PATH];
     PFILENAME_ATTRIBUTE FileName;
     PSTANDARD_INFORMATION StdInfo;
-    PNTFS_FCB rcFCB;
+    PNTFS_FCB rcFCB, TableFCB;
     ULONGLONG Size, AllocatedSize;
+    NTSTATUS Status;
 
     DPRINT("NtfsMakeFCBFromDirEntry(%p, %p, %wZ, %p, %p, %p)\n", Vcb, DirectoryFCB, Name, Stream, Record, fileFCB);
 
+    /* Another link to this file may already be open */
+    rcFCB = NtfsGrabFCBFromTableByIndex(Vcb, MFTIndex, Stream);
+    if (rcFCB != NULL)
+    {
+        *fileFCB = rcFCB;
+        return STATUS_SUCCESS;
+    }
+
     FileName = GetBestFileNameFromRecord(Vcb, Record);
     if (!FileName)
     {
@@ -449,11 +725,27 @@ NtfsMakeFCBFromDirEntry(PNTFS_VCB Vcb,
         rcFCB->Entry.FileAttributes |= StdInfo->FileAttribute;
     }
 
-    NtfsFCBInitializeCache(Vcb, rcFCB);
     rcFCB->RefCount = 1;
     rcFCB->MFTIndex = MFTIndex;
     rcFCB->LinkCount = Record->LinkCount;
-    NtfsAddFCBToTable(Vcb, rcFCB);
+
+    /* As in NtfsMakeRootFCB(), the FCB is only published once its cache is set up */
+    Status = NtfsFCBInitializeCache(Vcb, rcFCB);
+    if (!NT_SUCCESS(Status))
+    {
+        NtfsDestroyFCB(rcFCB);
+        return Status;
+    }
+
+    TableFCB = NtfsAddFCBToTable(Vcb, rcFCB);
+    if (TableFCB != rcFCB)
+    {
+        DPRINT("Lost the race for %S to FCB %p\n", pathName, TableFCB);
+        CcUninitializeCacheMap(rcFCB->FileObject, NULL, NULL);
+        NtfsDestroyFCB(rcFCB);
+        rcFCB = TableFCB;
+    }
+
     *fileFCB = rcFCB;
 
     return STATUS_SUCCESS;
@@ -477,6 +769,7 @@ NtfsAttachFCBToFileObject(PNTFS_VCB Vcb,
 
     newCCB->Identifier.Type = NTFS_TYPE_CCB;
     newCCB->Identifier.Size = sizeof(NTFS_TYPE_CCB);
+    KeInitializeEvent(&newCCB->QueryEvent, SynchronizationEvent, TRUE);
 
     FileObject->SectionObjectPointer = &Fcb->SectionObjectPointers;
     FileObject->FsContext = Fcb;
@@ -695,7 +988,11 @@ NtfsGetFCBForFile(PNTFS_VCB Vcb,
                            NtfsGetNextPathElement(currentElement) - currentElement);
             DPRINT("  elementName:%S\n", elementName);
 
+            /* Lookups share the directory, only changes to its index are exclusive */
+            ExAcquireResourceSharedLite(&parentFCB->MainResource, TRUE);
             Status = NtfsDirFindFile(Vcb, parentFCB, elementName, CaseSensitive, &FCB);
+            ExReleaseResourceLite(&parentFCB->MainResource);
+
             if (Status == STATUS_OBJECT_NAME_NOT_FOUND)
             {
                 *pParentFCB = parentFCB;
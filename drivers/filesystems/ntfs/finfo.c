@@ -134,8 +134,9 @@ NtfsGetNameInformation(PFILE_OBJECT FileObject,
                        PULONG BufferLength)
 {
     ULONG BytesToCopy;
+    PNTFS_CCB Ccb;
+    PCWSTR PathName;
 
-    UNREFERENCED_PARAMETER(FileObject);
     UNREFERENCED_PARAMETER(DeviceObject);
 
     DPRINT("NtfsGetNameInformation(%p, %p, %p, %p, %p)\n", FileObject, Fcb, DeviceObject, NameInfo, BufferLength);
@@ -147,15 +148,19 @@ NtfsGetNameInformation(PFILE_OBJECT FileObject,
     if (*BufferLength < (ULONG)FIELD_OFFSET(FILE_NAME_INFORMATION, FileName[0]))
         return STATUS_BUFFER_TOO_SMALL;
 
+    /* A handle opened by another hard link than the FCB's is named after its own link */
+    Ccb = FileObject->FsContext2;
+    PathName = (Ccb != NULL && Ccb->LinkPathName != NULL) ? Ccb->LinkPathName : Fcb->PathName;
+
     /* Save file name length, and as much file len, as buffer length allows */
-    NameInfo->FileNameLength = wcslen(Fcb->PathName) * sizeof(WCHAR);
+    NameInfo->FileNameLength = wcslen(PathName) * sizeof(WCHAR);
 
     /* Calculate amount of bytes to copy not to overflow the buffer */
     BytesToCopy = min(NameInfo->FileNameLength,
                       *BufferLength - FIELD_OFFSET(FILE_NAME_INFORMATION, FileName[0]));
 
     /* Fill in the bytes */
-    RtlCopyMemory(NameInfo->FileName, Fcb->PathName, BytesToCopy);
+    RtlCopyMemory(NameInfo->FileName, PathName, BytesToCopy);
 
     /* Check if we could write more but are not able to */
     if (*BufferLength < NameInfo->FileNameLength + (ULONG)FIELD_OFFSET(FILE_NAME_INFORMATION, FileName[0]))
@@ -688,6 +693,13 @@ NtfsSetEndOfFile(PNTFS_FCB Fcb,
     ReleaseAttributeContext(DataContext);
     ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, FileRecord);
 
+    if (NT_SUCCESS(Status) && NewFileSize->QuadPart != CurrentFileSize.QuadPart)
+    {
+        NtfsUsnPostChange(DeviceExt,
+                          Fcb,
+                          (NewFileSize->QuadPart > CurrentFileSize.QuadPart) ? USN_REASON_DATA_EXTEND : USN_REASON_DATA_TRUNCATION);
+    }
+
     return Status;
 }
 
@@ -34,6 +34,11 @@
 #define NDEBUG
 #include <debug.h>
 
+/* GLOBALS *****************************************************************/
+
+/* Largest reply of FSCTL_QUERY_FILE_LAYOUT */
+#define NTFS_FILE_LAYOUT_OUTPUT_MAX     0x10000
+
 /* FUNCTIONS ****************************************************************/
 
 /*
@@ -313,17 +318,27 @@ NtfsGetVolumeData(PDEVICE_OBJECT DeviceObject,
         return Status;
     }
 
+    NtfsInitializeMftCache(DeviceExt);
+    NtfsInitializeCompressionCache(DeviceExt);
+    NtfsInitializeVolumeBitmap(DeviceExt);
+
     VolumeRecord = ExAllocateFromNPagedLookasideList(&DeviceExt->FileRecLookasideList);
     if (VolumeRecord == NULL)
     {
         DPRINT1("Allocation failed for volume record\n");
         ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, DeviceExt->MasterFileTable);
+        NtfsUninitializeVolumeBitmap(DeviceExt);
+        NtfsUninitializeCompressionCache(DeviceExt);
+        NtfsUninitializeMftCache(DeviceExt);
         ExDeleteNPagedLookasideList(&DeviceExt->FileRecLookasideList);
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    /* Read Volume File (MFT index 3) */
+    /* Apply what the metadata journal holds before reading anything else */
     DeviceExt->StorageDevice = DeviceObject;
+    NtfsInitializeLog(DeviceExt);
+
+    /* Read Volume File (MFT index 3) */
     Status = ReadFileRecord(DeviceExt,
                             NTFS_FILE_VOLUME,
                             VolumeRecord);
@@ -332,6 +347,10 @@ NtfsGetVolumeData(PDEVICE_OBJECT DeviceObject,
         DPRINT1("Failed reading volume file\n");
         ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, VolumeRecord);
         ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, DeviceExt->MasterFileTable);
+        NtfsUninitializeVolumeBitmap(DeviceExt);
+        NtfsUninitializeCompressionCache(DeviceExt);
+        NtfsUninitializeMftCache(DeviceExt);
+        NtfsUninitializeLog(DeviceExt);
         ExDeleteNPagedLookasideList(&DeviceExt->FileRecLookasideList);
         return Status;
     }
@@ -373,6 +392,10 @@ NtfsGetVolumeData(PDEVICE_OBJECT DeviceObject,
         DPRINT1("Failed allocating volume FCB\n");
         ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, VolumeRecord);
         ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, DeviceExt->MasterFileTable);
+        NtfsUninitializeVolumeBitmap(DeviceExt);
+        NtfsUninitializeCompressionCache(DeviceExt);
+        NtfsUninitializeMftCache(DeviceExt);
+        NtfsUninitializeLog(DeviceExt);
         ExDeleteNPagedLookasideList(&DeviceExt->FileRecLookasideList);
         return STATUS_INSUFFICIENT_RESOURCES;
     }
@@ -405,6 +428,9 @@ NtfsGetVolumeData(PDEVICE_OBJECT DeviceObject,
 
     ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, VolumeRecord);
 
+    NtfsInitializeUpcaseTable(DeviceExt);
+    NtfsInitializeUsnJournal(DeviceExt);
+
     NtfsInfo->MftZoneReservation = NtfsQueryMftZoneReservation();
 
     return Status;
@@ -478,7 +504,7 @@ NtfsMountVolume(PDEVICE_OBJECT DeviceObject,
     Vcb->StreamFileObject = IoCreateStreamFileObject(NULL,
                                                      Vcb->StorageDevice);
 
-    InitializeListHead(&Vcb->FcbListHead);
+    NtfsInitializeFCBTable(Vcb);
 
     Fcb = NtfsCreateFCB(NULL, NULL, Vcb);
     if (Fcb == NULL)
@@ -500,6 +526,7 @@ NtfsMountVolume(PDEVICE_OBJECT DeviceObject,
 
     Ccb->Identifier.Type = NTFS_TYPE_CCB;
     Ccb->Identifier.Size = sizeof(NTFS_TYPE_CCB);
+    KeInitializeEvent(&Ccb->QueryEvent, SynchronizationEvent, TRUE);
 
     Vcb->StreamFileObject->FsContext = Fcb;
     Vcb->StreamFileObject->FsContext2 = Ccb;
@@ -536,8 +563,6 @@ NtfsMountVolume(PDEVICE_OBJECT DeviceObject,
 
     ExInitializeResourceLite(&Vcb->DirResource);
 
-    KeInitializeSpinLock(&Vcb->FcbListLock);
-
     /* Get serial number */
     NewDeviceObject->Vpb->SerialNumber = Vcb->NtfsInfo.SerialNumber;
 
@@ -547,6 +572,10 @@ NtfsMountVolume(PDEVICE_OBJECT DeviceObject,
                   Vcb->NtfsInfo.VolumeLabel,
                   Vcb->NtfsInfo.VolumeLabelLength);
 
+    ExAcquireResourceExclusiveLite(&NtfsGlobalData->Resource, TRUE);
+    InsertTailList(&NtfsGlobalData->VolumeListHead, &Vcb->VolumeListEntry);
+    ExReleaseResourceLite(&NtfsGlobalData->Resource);
+
     FsRtlNotifyVolumeEvent(Vcb->StreamFileObject, FSRTL_VOLUME_MOUNT);
 
     Status = STATUS_SUCCESS;
@@ -565,7 +594,15 @@ ByeBye:
             ExFreePool(Ccb);
 
         if (Lookaside)
+        {
+            NtfsUninitializeUsnJournal(Vcb);
+            NtfsUninitializeUpcaseTable(Vcb);
+            NtfsUninitializeVolumeBitmap(Vcb);
+            NtfsUninitializeCompressionCache(Vcb);
+            NtfsUninitializeMftCache(Vcb);
+            NtfsUninitializeLog(Vcb);
             ExDeleteNPagedLookasideList(&Vcb->FileRecLookasideList);
+        }
 
         if (NewDeviceObject)
             IoDeleteDevice(NewDeviceObject);
@@ -621,8 +658,8 @@ GetNfsVolumeData(PDEVICE_EXTENSION DeviceExt,
     DataBuffer->ClustersPerFileRecordSegment = DeviceExt->NtfsInfo.BytesPerFileRecord / DeviceExt->NtfsInfo.BytesPerCluster;
     DataBuffer->MftStartLcn.QuadPart = DeviceExt->NtfsInfo.MftStart.QuadPart;
     DataBuffer->Mft2StartLcn.QuadPart = DeviceExt->NtfsInfo.MftMirrStart.QuadPart;
-    DataBuffer->MftZoneStart.QuadPart = 0; // FIXME
-    DataBuffer->MftZoneEnd.QuadPart = 0; // FIXME
+    DataBuffer->MftZoneStart.QuadPart = DeviceExt->VolumeBitmap.MftZoneStart;
+    DataBuffer->MftZoneEnd.QuadPart = DeviceExt->VolumeBitmap.MftZoneEnd;
 
     Status = FindFirstAttribute(&Context, DeviceExt, DeviceExt->MasterFileTable, FALSE, &Attribute);
     while (NT_SUCCESS(Status))
@@ -722,6 +759,356 @@ GetNtfsFileRecord(PDEVICE_EXTENSION DeviceExt,
 }
 
 
+/* Writes the STREAM_LAYOUT_ENTRY of a $DATA attribute, returns its length or 0 if it doesn't fit */
+static
+ULONG
+NtfsFillStreamLayoutEntry(PNTFS_ATTR_RECORD Attribute,
+                          PUCHAR Buffer,
+                          ULONG Length)
+{
+    PSTREAM_LAYOUT_ENTRY StreamEntry = (PSTREAM_LAYOUT_ENTRY)Buffer;
+    ULONG NameLength = (Attribute->NameLength + wcslen(L"::$DATA")) * sizeof(WCHAR);
+    ULONG EntryLength = ALIGN_UP_BY(FIELD_OFFSET(STREAM_LAYOUT_ENTRY, StreamIdentifier) + NameLength, sizeof(ULONGLONG));
+
+    if (EntryLength > Length)
+        return 0;
+
+    RtlZeroMemory(StreamEntry, EntryLength);
+    StreamEntry->Version = STREAM_LAYOUT_ENTRY_VERSION;
+    StreamEntry->EndOfFile.QuadPart = AttributeDataLength(Attribute);
+    StreamEntry->AttributeFlags = Attribute->Flags;
+
+    // What the stream takes on the disk, the holes and the compressed parts aren't counted
+    if (!Attribute->IsNonResident)
+        StreamEntry->Flags = STREAM_LAYOUT_ENTRY_RESIDENT | STREAM_LAYOUT_ENTRY_NO_CLUSTERS_ALLOCATED;
+    else if (Attribute->Flags & (ATTR_FLAG_SPARSE | ATTR_FLAG_COMPRESSED))
+        StreamEntry->AllocationSize.QuadPart = Attribute->NonResident.CompressedSize;
+    else
+        StreamEntry->AllocationSize.QuadPart = Attribute->NonResident.AllocatedSize;
+
+    if (Attribute->IsNonResident && StreamEntry->AllocationSize.QuadPart == 0)
+        StreamEntry->Flags = STREAM_LAYOUT_ENTRY_NO_CLUSTERS_ALLOCATED;
+
+    // Named the way FileStreamInformation names it
+    StreamEntry->StreamIdentifierLength = NameLength;
+    StreamEntry->StreamIdentifier[0] = L':';
+    RtlCopyMemory(&StreamEntry->StreamIdentifier[1],
+                  (PWCHAR)((ULONG_PTR)Attribute + Attribute->NameOffset),
+                  Attribute->NameLength * sizeof(WCHAR));
+    RtlCopyMemory(&StreamEntry->StreamIdentifier[Attribute->NameLength + 1],
+                  L":$DATA",
+                  sizeof(L":$DATA") - sizeof(UNICODE_NULL));
+
+    return EntryLength;
+}
+
+/* Writes the FILE_LAYOUT_ENTRY of a base file record, returns its length or 0 if it doesn't fit */
+static
+ULONG
+NtfsFillFileLayoutEntry(PDEVICE_EXTENSION DeviceExt,
+                        PFILE_RECORD_HEADER FileRecord,
+                        ULONGLONG MftIndex,
+                        ULONG Flags,
+                        PUCHAR Buffer,
+                        ULONG Length)
+{
+    PFILE_LAYOUT_ENTRY Entry = (PFILE_LAYOUT_ENTRY)Buffer;
+    PFILE_LAYOUT_NAME_ENTRY NameEntry, LastName = NULL;
+    PFILE_LAYOUT_INFO_ENTRY InfoEntry;
+    PSTREAM_LAYOUT_ENTRY LastStream = NULL;
+    PNTFS_STANDARD_INFORMATION_V3 StdInfo = NULL;
+    ULONG StdInfoLength = 0;
+    PFILENAME_ATTRIBUTE FileName;
+    FIND_ATTR_CONTXT Context;
+    PNTFS_ATTR_RECORD Attribute;
+    PNTFS_ATTR_CONTEXT DataContext;
+    BOOLEAN HasAttributeList = FALSE;
+    BOOLEAN HasUnnamedData = FALSE;
+    BOOLEAN Fits = TRUE;
+    ULONG Used = sizeof(FILE_LAYOUT_ENTRY);
+    ULONG EntryLength;
+    NTSTATUS Status;
+
+    if (Used > Length)
+        return 0;
+
+    RtlZeroMemory(Entry, sizeof(FILE_LAYOUT_ENTRY));
+    Entry->Version = FILE_LAYOUT_ENTRY_VERSION;
+    Entry->FileReferenceNumber = MftIndex | ((ULONGLONG)FileRecord->SequenceNumber << 48);
+
+    Status = FindFirstAttribute(&Context, DeviceExt, FileRecord, FALSE, &Attribute);
+    while (NT_SUCCESS(Status) && Fits)
+    {
+        if (Attribute->Type == AttributeAttributeList)
+        {
+            HasAttributeList = TRUE;
+        }
+        else if (Attribute->Type == AttributeStandardInformation && !Attribute->IsNonResident)
+        {
+            StdInfo = (PNTFS_STANDARD_INFORMATION_V3)((ULONG_PTR)Attribute + Attribute->Resident.ValueOffset);
+            StdInfoLength = Attribute->Resident.ValueLength;
+        }
+        else if (Attribute->Type == AttributeFileName && !Attribute->IsNonResident &&
+                 (Flags & QUERY_FILE_LAYOUT_INCLUDE_NAMES))
+        {
+            FileName = (PFILENAME_ATTRIBUTE)((ULONG_PTR)Attribute + Attribute->Resident.ValueOffset);
+            EntryLength = ALIGN_UP_BY(FIELD_OFFSET(FILE_LAYOUT_NAME_ENTRY, FileName) + FileName->NameLength * sizeof(WCHAR),
+                                      sizeof(ULONGLONG));
+            if (Used + EntryLength > Length)
+            {
+                Fits = FALSE;
+                break;
+            }
+
+            NameEntry = (PFILE_LAYOUT_NAME_ENTRY)(Buffer + Used);
+            RtlZeroMemory(NameEntry, EntryLength);
+            if (FileName->NameType != NTFS_FILE_NAME_DOS)
+                NameEntry->Flags |= FILE_LAYOUT_NAME_ENTRY_PRIMARY;
+            if (FileName->NameType == NTFS_FILE_NAME_DOS || FileName->NameType == NTFS_FILE_NAME_WIN32_AND_DOS)
+                NameEntry->Flags |= FILE_LAYOUT_NAME_ENTRY_DOS;
+            NameEntry->ParentFileReferenceNumber = FileName->DirectoryFileReferenceNumber;
+            NameEntry->FileNameLength = FileName->NameLength * sizeof(WCHAR);
+            RtlCopyMemory(NameEntry->FileName, FileName->Name, NameEntry->FileNameLength);
+
+            if (LastName == NULL)
+                Entry->FirstNameOffset = Used;
+            else
+                LastName->NextNameOffset = (ULONG)((ULONG_PTR)NameEntry - (ULONG_PTR)LastName);
+            LastName = NameEntry;
+            Used += EntryLength;
+        }
+        else if (Attribute->Type == AttributeData &&
+                 (!Attribute->IsNonResident || Attribute->NonResident.LowestVCN == 0) &&
+                 (Flags & QUERY_FILE_LAYOUT_INCLUDE_STREAMS))
+        {
+            if (Attribute->NameLength == 0)
+                HasUnnamedData = TRUE;
+
+            EntryLength = NtfsFillStreamLayoutEntry(Attribute, Buffer + Used, Length - Used);
+            if (EntryLength == 0)
+            {
+                Fits = FALSE;
+                break;
+            }
+
+            if ((((PSTREAM_LAYOUT_ENTRY)(Buffer + Used))->Flags & STREAM_LAYOUT_ENTRY_NO_CLUSTERS_ALLOCATED) &&
+                !(Flags & QUERY_FILE_LAYOUT_INCLUDE_STREAMS_WITH_NO_CLUSTERS_ALLOCATED))
+            {
+                // Left out, as Windows does
+            }
+            else
+            {
+                if (LastStream == NULL)
+                    Entry->FirstStreamOffset = Used;
+                else
+                    LastStream->NextStreamOffset = (ULONG)((ULONG_PTR)Buffer + Used - (ULONG_PTR)LastStream);
+                LastStream = (PSTREAM_LAYOUT_ENTRY)(Buffer + Used);
+                Used += EntryLength;
+            }
+        }
+
+        Status = FindNextAttribute(&Context, &Attribute);
+    }
+    FindCloseAttribute(&Context);
+
+    if (!Fits)
+        return 0;
+
+    // The unnamed stream of a file with an attribute list can be in another file record
+    if ((Flags & QUERY_FILE_LAYOUT_INCLUDE_STREAMS) &&
+        HasAttributeList &&
+        !HasUnnamedData &&
+        !(FileRecord->Flags & FRH_DIRECTORY) &&
+        NT_SUCCESS(FindAttribute(DeviceExt, FileRecord, AttributeData, L"", 0, &DataContext, NULL)))
+    {
+        EntryLength = NtfsFillStreamLayoutEntry(DataContext->pRecord, Buffer + Used, Length - Used);
+        ReleaseAttributeContext(DataContext);
+
+        if (EntryLength == 0)
+            return 0;
+
+        if (!(((PSTREAM_LAYOUT_ENTRY)(Buffer + Used))->Flags & STREAM_LAYOUT_ENTRY_NO_CLUSTERS_ALLOCATED) ||
+            (Flags & QUERY_FILE_LAYOUT_INCLUDE_STREAMS_WITH_NO_CLUSTERS_ALLOCATED))
+        {
+            if (LastStream == NULL)
+                Entry->FirstStreamOffset = Used;
+            else
+                LastStream->NextStreamOffset = (ULONG)((ULONG_PTR)Buffer + Used - (ULONG_PTR)LastStream);
+            Used += EntryLength;
+        }
+    }
+
+    if (StdInfo != NULL)
+    {
+        NtfsFileFlagsToAttributes(StdInfo->Base.FileAttribute, &Entry->FileAttributes);
+        if (FileRecord->Flags & FRH_DIRECTORY)
+            Entry->FileAttributes |= FILE_ATTRIBUTE_DIRECTORY;
+    }
+
+    if ((Flags & QUERY_FILE_LAYOUT_INCLUDE_EXTRA_INFO) && StdInfo != NULL)
+    {
+        if (Used + sizeof(FILE_LAYOUT_INFO_ENTRY) > Length)
+            return 0;
+
+        InfoEntry = (PFILE_LAYOUT_INFO_ENTRY)(Buffer + Used);
+        RtlZeroMemory(InfoEntry, sizeof(FILE_LAYOUT_INFO_ENTRY));
+        InfoEntry->BasicInformation.CreationTime.QuadPart = StdInfo->Base.CreationTime;
+        InfoEntry->BasicInformation.LastAccessTime.QuadPart = StdInfo->Base.LastAccessTime;
+        InfoEntry->BasicInformation.LastWriteTime.QuadPart = StdInfo->Base.LastWriteTime;
+        InfoEntry->BasicInformation.ChangeTime.QuadPart = StdInfo->Base.ChangeTime;
+        InfoEntry->BasicInformation.FileAttributes = Entry->FileAttributes;
+
+        // NTFS 1.2 volumes have the short $STANDARD_INFORMATION
+        if (StdInfoLength >= sizeof(NTFS_STANDARD_INFORMATION_V3))
+        {
+            InfoEntry->OwnerId = StdInfo->OwnerId;
+            InfoEntry->SecurityId = StdInfo->SecurityId;
+            InfoEntry->Usn = StdInfo->Usn;
+        }
+
+        Entry->ExtraInfoOffset = Used;
+        Used += sizeof(FILE_LAYOUT_INFO_ENTRY);
+    }
+
+    return Used;
+}
+
+/**
+* @name NtfsQueryFileLayout
+* @implemented
+*
+* Handles FSCTL_QUERY_FILE_LAYOUT: returns the names, times, attributes and stream sizes of
+* the files of the volume, in the order of the MFT. Each call continues where the previous
+* one on the same handle stopped.
+*
+* @param DeviceExt
+* Points to the DEVICE_EXTENSION of the volume.
+*
+* @param Irp
+* Request on a volume handle, holding a QUERY_FILE_LAYOUT_INPUT. Receives a
+* QUERY_FILE_LAYOUT_OUTPUT followed by a FILE_LAYOUT_ENTRY for each file.
+*
+* @return
+* STATUS_SUCCESS, STATUS_END_OF_FILE once every file was returned, STATUS_BUFFER_TOO_SMALL
+* if the next file doesn't fit, STATUS_INVALID_PARAMETER for a handle that isn't a volume's,
+* or STATUS_NOT_IMPLEMENTED for the filters and the extents.
+*
+* @remarks
+* $MFT is read with NtfsReadNextMftRecord(), like for FSCTL_ENUM_USN_DATA. The names and the
+* named streams are the ones of the base file record; hard links moved to other file records
+* aren't returned.
+*/
+static
+NTSTATUS
+NtfsQueryFileLayout(PDEVICE_EXTENSION DeviceExt,
+                    PIRP Irp)
+{
+    PIO_STACK_LOCATION Stack = IoGetCurrentIrpStackLocation(Irp);
+    PNTFS_FCB Fcb = Stack->FileObject->FsContext;
+    PNTFS_CCB Ccb = Stack->FileObject->FsContext2;
+    QUERY_FILE_LAYOUT_INPUT Input;
+    PQUERY_FILE_LAYOUT_OUTPUT Header;
+    PFILE_LAYOUT_ENTRY LastEntry = NULL;
+    PVOID OutputBuffer;
+    PUCHAR Output;
+    ULONG OutputLength;
+    ULONG OutputUsed;
+    ULONG EntryLength;
+    NTFS_MFT_SCAN Scan;
+    PFILE_RECORD_HEADER FileRecord;
+    ULONGLONG MftIndex;
+    ULONGLONG RecordCount;
+    ULONGLONG NextIndex;
+    NTSTATUS Status;
+
+    Status = NtfsCaptureFsctlBuffers(Irp,
+                                     &Input,
+                                     FIELD_OFFSET(QUERY_FILE_LAYOUT_INPUT, Filter),
+                                     &OutputBuffer,
+                                     sizeof(QUERY_FILE_LAYOUT_OUTPUT));
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    if (!(Fcb->Flags & FCB_IS_VOLUME) || Ccb == NULL)
+        return STATUS_INVALID_PARAMETER;
+
+    if (Input.FilterType != QUERY_FILE_LAYOUT_FILTER_TYPE_NONE ||
+        (Input.Flags & QUERY_FILE_LAYOUT_INCLUDE_EXTENTS))
+    {
+        DPRINT1("FIXME: File layout filters and extents are not supported yet!\n");
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    if (Input.Flags & QUERY_FILE_LAYOUT_RESTART)
+        Ccb->FileLayoutIndex = 0;
+
+    OutputLength = min(Stack->Parameters.FileSystemControl.OutputBufferLength, NTFS_FILE_LAYOUT_OUTPUT_MAX);
+
+    Output = ExAllocatePoolWithTag(PagedPool, OutputLength, TAG_NTFS);
+    if (Output == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    Status = NtfsStartMftScan(DeviceExt, Ccb->FileLayoutIndex, &Scan);
+    if (!NT_SUCCESS(Status))
+    {
+        ExFreePoolWithTag(Output, TAG_NTFS);
+        return Status;
+    }
+
+    Header = (PQUERY_FILE_LAYOUT_OUTPUT)Output;
+    RtlZeroMemory(Header, sizeof(QUERY_FILE_LAYOUT_OUTPUT));
+    OutputUsed = sizeof(QUERY_FILE_LAYOUT_OUTPUT);
+    RecordCount = Scan.RecordCount;
+    NextIndex = RecordCount;
+    while ((Status = NtfsReadNextMftRecord(DeviceExt, &Scan, &MftIndex, &FileRecord)) == STATUS_SUCCESS)
+    {
+        if (FileRecord->BaseFileRecord != 0)
+            continue;
+
+        EntryLength = NtfsFillFileLayoutEntry(DeviceExt,
+                                              FileRecord,
+                                              MftIndex,
+                                              Input.Flags,
+                                              Output + OutputUsed,
+                                              OutputLength - OutputUsed);
+        if (EntryLength == 0)
+        {
+            // The next call starts with this file
+            NextIndex = MftIndex;
+            break;
+        }
+
+        if (LastEntry == NULL)
+            Header->FirstFileOffset = OutputUsed;
+        else
+            LastEntry->NextFileOffset = (ULONG)((ULONG_PTR)Output + OutputUsed - (ULONG_PTR)LastEntry);
+        LastEntry = (PFILE_LAYOUT_ENTRY)(Output + OutputUsed);
+        Header->FileEntryCount++;
+        OutputUsed += EntryLength;
+    }
+
+    NtfsEndMftScan(&Scan);
+
+    if (Status != STATUS_SUCCESS && Status != STATUS_END_OF_FILE)
+    {
+        DPRINT1("Enumerating the MFT failed with status %lx\n", Status);
+    }
+    else if (Header->FileEntryCount == 0)
+    {
+        Status = (NextIndex == RecordCount) ? STATUS_END_OF_FILE : STATUS_BUFFER_TOO_SMALL;
+    }
+    else
+    {
+        Ccb->FileLayoutIndex = NextIndex;
+        Status = NtfsReturnFsctlOutput(Irp, OutputBuffer, Output, OutputUsed);
+    }
+
+    ExFreePoolWithTag(Output, TAG_NTFS);
+
+    return Status;
+}
+
+
 static
 NTSTATUS
 GetVolumeBitmap(PDEVICE_EXTENSION DeviceExt,
@@ -846,6 +1233,84 @@ GetVolumeBitmap(PDEVICE_EXTENSION DeviceExt,
 }
 
 
+/* Captures the input buffer of a METHOD_NEITHER request, and probes its output buffer */
+NTSTATUS
+NtfsCaptureFsctlBuffers(PIRP Irp,
+                        PVOID Input,
+                        ULONG InputLength,
+                        PVOID *OutputBuffer,
+                        ULONG MinimumOutputLength)
+{
+    PIO_STACK_LOCATION Stack = IoGetCurrentIrpStackLocation(Irp);
+    PVOID UserInput = Stack->Parameters.FileSystemControl.Type3InputBuffer;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    if (Stack->Parameters.FileSystemControl.InputBufferLength < InputLength)
+    {
+        DPRINT1("Invalid input! %lu\n", Stack->Parameters.FileSystemControl.InputBufferLength);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (OutputBuffer != NULL)
+    {
+        if (Stack->Parameters.FileSystemControl.OutputBufferLength < MinimumOutputLength)
+        {
+            DPRINT1("Invalid output! %lu\n", Stack->Parameters.FileSystemControl.OutputBufferLength);
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+
+        *OutputBuffer = NtfsGetUserBuffer(Irp, FALSE);
+        if (*OutputBuffer == NULL)
+            return STATUS_INVALID_PARAMETER;
+    }
+
+    if (UserInput == NULL)
+        return STATUS_INVALID_PARAMETER;
+
+    _SEH2_TRY
+    {
+        if (Irp->RequestorMode == UserMode)
+        {
+            ProbeForRead(UserInput, InputLength, sizeof(UCHAR));
+            if (OutputBuffer != NULL)
+                ProbeForWrite(*OutputBuffer, Stack->Parameters.FileSystemControl.OutputBufferLength, sizeof(UCHAR));
+        }
+
+        RtlCopyMemory(Input, UserInput, InputLength);
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    return Status;
+}
+
+/* Copies a reply built in pool to the output buffer of a METHOD_NEITHER request */
+NTSTATUS
+NtfsReturnFsctlOutput(PIRP Irp,
+                      PVOID OutputBuffer,
+                      PVOID Output,
+                      ULONG Length)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    _SEH2_TRY
+    {
+        RtlCopyMemory(OutputBuffer, Output, Length);
+        Irp->IoStatus.Information = Length;
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    return Status;
+}
+
+
 static
 NTSTATUS
 LockOrUnlockVolume(PDEVICE_EXTENSION DeviceExt,
@@ -855,6 +1320,7 @@ LockOrUnlockVolume(PDEVICE_EXTENSION DeviceExt,
     PFILE_OBJECT FileObject;
     PNTFS_FCB Fcb;
     PIO_STACK_LOCATION Stack;
+    NTSTATUS Status;
 
     DPRINT("LockOrUnlockVolume(%p, %p, %d)\n", DeviceExt, Irp, Lock);
 
@@ -881,6 +1347,16 @@ LockOrUnlockVolume(PDEVICE_EXTENSION DeviceExt,
         return STATUS_ACCESS_DENIED;
     }
 
+    /* Whoever locks the volume reads it as a whole: empty the log first */
+    if (Lock)
+    {
+        Status = NtfsLogCheckpoint(DeviceExt);
+        if (!NT_SUCCESS(Status))
+        {
+            return Status;
+        }
+    }
+
     /* Finally, proceed */
     if (Lock)
     {
@@ -895,6 +1371,97 @@ LockOrUnlockVolume(PDEVICE_EXTENSION DeviceExt,
 }
 
 
+static
+NTSTATUS
+NtfsDismountVolume(PDEVICE_EXTENSION DeviceExt,
+                   PIRP Irp)
+{
+    PFILE_OBJECT FileObject;
+    NTSTATUS Status;
+
+    DPRINT("NtfsDismountVolume(%p, %p)\n", DeviceExt, Irp);
+
+    FileObject = IoGetCurrentIrpStackLocation(Irp)->FileObject;
+
+    /* Like LockOrUnlockVolume(), only through the volume, which must be locked */
+    if (!(((PNTFS_FCB)FileObject->FsContext)->Flags & FCB_IS_VOLUME) ||
+        !(DeviceExt->Flags & VCB_VOLUME_LOCKED))
+    {
+        return STATUS_ACCESS_DENIED;
+    }
+
+    if (DeviceExt->Flags & VCB_DISMOUNT_PENDING)
+    {
+        return STATUS_VOLUME_DISMOUNTED;
+    }
+
+    /* Leave nothing in the log: the next mount may be by Windows */
+    Status = NtfsLogCheckpoint(DeviceExt);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    FsRtlNotifyVolumeEvent(FileObject, FSRTL_VOLUME_DISMOUNT);
+
+    /* The next open mounts the volume again */
+    DeviceExt->Flags |= VCB_DISMOUNT_PENDING;
+    DeviceExt->StorageDevice->Vpb->Flags &= ~VPB_MOUNTED;
+
+    return STATUS_SUCCESS;
+}
+
+
+/**
+* @name NtfsShutdown
+* @implemented
+*
+* Handles IRP_MJ_SHUTDOWN, sent to the file system device: empties the metadata journal of
+* every mounted volume, so that they're consistent without it when the system stops.
+*
+* @param IrpContext
+* IRP context of the request.
+*
+* @return
+* STATUS_SUCCESS, or the error of the first volume that couldn't be written.
+*/
+NTSTATUS
+NtfsShutdown(PNTFS_IRP_CONTEXT IrpContext)
+{
+    PLIST_ENTRY ListEntry;
+    PDEVICE_EXTENSION DeviceExt;
+    NTSTATUS Status, ReturnStatus = STATUS_SUCCESS;
+
+    DPRINT("NtfsShutdown(%p)\n", IrpContext);
+
+    if (IrpContext->DeviceObject != NtfsGlobalData->DeviceObject)
+    {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    ExAcquireResourceSharedLite(&NtfsGlobalData->Resource, TRUE);
+
+    for (ListEntry = NtfsGlobalData->VolumeListHead.Flink;
+         ListEntry != &NtfsGlobalData->VolumeListHead;
+         ListEntry = ListEntry->Flink)
+    {
+        DeviceExt = CONTAINING_RECORD(ListEntry, DEVICE_EXTENSION, VolumeListEntry);
+
+        Status = NtfsLogCheckpoint(DeviceExt);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Can't write back the journal of volume %p (Status %lx)\n", DeviceExt, Status);
+            if (NT_SUCCESS(ReturnStatus))
+                ReturnStatus = Status;
+        }
+    }
+
+    ExReleaseResourceLite(&NtfsGlobalData->Resource);
+
+    return ReturnStatus;
+}
+
+
 static
 NTSTATUS
 NtfsUserFsRequest(PDEVICE_OBJECT DeviceObject,
@@ -910,18 +1477,14 @@ NtfsUserFsRequest(PDEVICE_OBJECT DeviceObject,
     DeviceExt = DeviceObject->DeviceExtension;
     switch (Stack->Parameters.FileSystemControl.FsControlCode)
     {
-        case FSCTL_CREATE_USN_JOURNAL:
         case FSCTL_DELETE_USN_JOURNAL:
-        case FSCTL_ENUM_USN_DATA:
         case FSCTL_EXTEND_VOLUME:
         //case FSCTL_GET_RETRIEVAL_POINTER_BASE:
         case FSCTL_GET_RETRIEVAL_POINTERS:
         //case FSCTL_LOOKUP_STREAM_FROM_CLUSTER:
         case FSCTL_MARK_HANDLE:
         case FSCTL_MOVE_FILE:
-        case FSCTL_QUERY_USN_JOURNAL:
         case FSCTL_READ_FILE_USN_DATA:
-        case FSCTL_READ_USN_JOURNAL:
         //case FSCTL_SHRINK_VOLUME:
         case FSCTL_WRITE_USN_CLOSE_RECORD:
             UNIMPLEMENTED;
@@ -937,6 +1500,10 @@ NtfsUserFsRequest(PDEVICE_OBJECT DeviceObject,
             Status = LockOrUnlockVolume(DeviceExt, Irp, FALSE);
             break;
 
+        case FSCTL_DISMOUNT_VOLUME:
+            Status = NtfsDismountVolume(DeviceExt, Irp);
+            break;
+
         case FSCTL_GET_NTFS_VOLUME_DATA:
             Status = GetNfsVolumeData(DeviceExt, Irp);
             break;
@@ -949,6 +1516,38 @@ NtfsUserFsRequest(PDEVICE_OBJECT DeviceObject,
             Status = GetVolumeBitmap(DeviceExt, Irp);
             break;
 
+        case FSCTL_CREATE_USN_JOURNAL:
+            Status = NtfsCreateUsnJournal(DeviceExt, Irp);
+            break;
+
+        case FSCTL_QUERY_USN_JOURNAL:
+            Status = NtfsQueryUsnJournal(DeviceExt, Irp);
+            break;
+
+        case FSCTL_READ_USN_JOURNAL:
+            Status = NtfsReadUsnJournal(DeviceExt, Irp);
+            break;
+
+        case FSCTL_ENUM_USN_DATA:
+            Status = NtfsEnumUsnData(DeviceExt, Irp);
+            break;
+
+        case FSCTL_QUERY_FILE_LAYOUT:
+            Status = NtfsQueryFileLayout(DeviceExt, Irp);
+            break;
+
+        case FSCTL_SET_SPARSE:
+            Status = NtfsSetSparse(DeviceExt, Irp);
+            break;
+
+        case FSCTL_SET_ZERO_DATA:
+            Status = NtfsSetZeroData(DeviceExt, Irp);
+            break;
+
+        case FSCTL_QUERY_ALLOCATED_RANGES:
+            Status = NtfsQueryAllocatedRanges(DeviceExt, Irp);
+            break;
+
         default:
             DPRINT("Invalid user request: %x\n", Stack->Parameters.FileSystemControl.FsControlCode);
             Status = STATUS_INVALID_DEVICE_REQUEST;
@@ -0,0 +1,1535 @@
+/*
+ * PROJECT:     ReactOS NTFS driver
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Metadata journal kept in $LogFile
+ * COPYRIGHT:   Copyright 2026 ReactOS Team
+ */
+
+/*
+ * Writes to the metadata of the volume (the system files, and the index allocations and
+ * bitmaps of directories) aren't sent to the disk. The modified sectors are kept in memory
+ * and reads of the metadata see them. Once enough of them are pending, or once the volume
+ * has been idle for a while, all of them are written to $LogFile at once as a single log
+ * record (group commit). The sectors that are in the log are written in place later, by a
+ * checkpoint, which then moves the restart area past their records.
+ *
+ * A request only modifies the cached sectors while it holds OperationResource shared, and
+ * commits take it exclusive, so every log record holds the changes of whole requests. After
+ * a crash, the records that follow the restart area are applied again when mounting.
+ *
+ * The log only holds sector images (redo records); nothing is written in place before
+ * it's in the log, so no undo is needed. The format is our own: Windows only finds 0xFF
+ * in its restart pages, and starts a new log of its own when it mounts the volume. So that
+ * neither Windows nor chkdsk take the volume for consistent while the log isn't empty,
+ * VOLUME_IS_DIRTY is set in $Volume before the first record is written, and cleared by the
+ * checkpoint that empties the log. The log is emptied once the volume is idle, and before
+ * it's locked, dismounted or shut down.
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include "ntfs.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* GLOBALS *****************************************************************/
+
+/* Layout of $LogFile: the two restart pages of Windows are left filled with 0xFF */
+#define NTFS_LOG_RESTART_OFFSET         0x4000
+#define NTFS_LOG_AREA_OFFSET            0x5000
+#define NTFS_LOG_MIN_AREA               0x40000
+#define NTFS_LOG_MAX_AREA               0x800000
+
+/* Group commit: pending sectors are committed once there are this many bytes of them... */
+#define NTFS_LOG_COMMIT_BYTES           0x10000
+/* ...or once the volume is idle and the last commit is older than 1 second */
+#define NTFS_LOG_COMMIT_INTERVAL        (1000LL * 10000LL)
+
+/* Sectors kept in memory before a checkpoint writes them in place */
+#define NTFS_LOG_CHECKPOINT_SECTORS     8192
+
+/* Size of the transfers of a checkpoint */
+#define NTFS_LOG_WRITE_BACK_BATCH       0x10000
+
+#define NTFS_LOG_RESTART_SIGNATURE      0x5453524E  /* "NRST" */
+#define NTFS_LOG_RECORD_SIGNATURE       0x4443524E  /* "NRCD" */
+#define NTFS_LOG_VERSION                1
+
+/* Flags of the restart area */
+#define NTFS_LOG_CLEAR_VOLUME_DIRTY     0x0001  /* VOLUME_IS_DIRTY was set for the log */
+
+/* Restart pages of the Windows log */
+#define LFS_RESTART_SIGNATURE           0x52545352  /* "RSTR" */
+#define LFS_NO_CLIENT                   0xFFFF
+#define LFS_RESTART_VOLUME_IS_CLEAN     0x0002
+
+typedef struct
+{
+    ULONG Signature;
+    ULONG Version;
+    ULONGLONG NextSequence;             /* Of the record at AreaStart */
+    ULONGLONG AreaStart;
+    ULONGLONG AreaEnd;
+    ULONG Checksum;
+    ULONG Flags;
+} NTFS_LOG_RESTART_AREA, *PNTFS_LOG_RESTART_AREA;
+
+typedef struct
+{
+    ULONG Signature;
+    ULONG Checksum;                     /* Of the whole record */
+    ULONGLONG Sequence;
+    ULONG Length;                       /* Of the whole record, in bytes */
+    ULONG HeaderSectors;                /* The header, then SectorCount sector images */
+    ULONG SectorCount;
+    ULONG Reserved;
+    LONGLONG DiskOffsets[1];            /* Where each image goes on the volume */
+} NTFS_LOG_RECORD_HEADER, *PNTFS_LOG_RECORD_HEADER;
+
+static KDEFERRED_ROUTINE NtfsLogCommitDpc;
+static WORKER_THREAD_ROUTINE NtfsLogCommitWorker;
+
+/* FUNCTIONS ****************************************************************/
+
+static
+ULONG
+NtfsLogChecksum(PUCHAR Buffer,
+                ULONG Length)
+{
+    PULONG Data = (PULONG)Buffer;
+    ULONG Checksum = 0;
+    ULONG i;
+
+    for (i = 0; i < Length / sizeof(ULONG); i++)
+    {
+        Checksum = ((Checksum << 1) | (Checksum >> 31)) + Data[i];
+    }
+
+    return Checksum;
+}
+
+/* The system files and the indexes of directories are journaled, $LogFile and file data aren't */
+static
+BOOLEAN
+NtfsLogIsMetadata(PNTFS_ATTR_CONTEXT Context)
+{
+    if (Context->FileMFTIndex < NTFS_FILE_FIRST_USER_FILE)
+        return Context->FileMFTIndex != NTFS_FILE_LOGFILE;
+
+    return Context->pRecord->Type == AttributeIndexAllocation ||
+           Context->pRecord->Type == AttributeBitmap;
+}
+
+/* Must be called with the log resource held */
+static
+PNTFS_LOG_SECTOR
+NtfsLogLookupSector(PDEVICE_EXTENSION Vcb,
+                    LONGLONG DiskOffset)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+    PLIST_ENTRY Bucket, ListEntry;
+    PNTFS_LOG_SECTOR Sector;
+
+    Bucket = &Log->HashBuckets[(DiskOffset / Vcb->NtfsInfo.BytesPerSector) % NTFS_LOG_BUCKETS];
+    for (ListEntry = Bucket->Flink; ListEntry != Bucket; ListEntry = ListEntry->Flink)
+    {
+        Sector = CONTAINING_RECORD(ListEntry, NTFS_LOG_SECTOR, HashListEntry);
+        if (Sector->DiskOffset == DiskOffset)
+            return Sector;
+    }
+
+    return NULL;
+}
+
+/* Must be called with the log resource held exclusively. The data of the sector is left uninitialized. */
+static
+PNTFS_LOG_SECTOR
+NtfsLogAllocateSector(PDEVICE_EXTENSION Vcb,
+                      LONGLONG DiskOffset,
+                      BOOLEAN Logged)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+    PNTFS_LOG_SECTOR Sector;
+
+    Sector = ExAllocateFromNPagedLookasideList(&Log->SectorLookasideList);
+    if (Sector == NULL)
+        return NULL;
+
+    Sector->DiskOffset = DiskOffset;
+    Sector->Logged = Logged;
+    InsertHeadList(&Log->HashBuckets[(DiskOffset / Vcb->NtfsInfo.BytesPerSector) % NTFS_LOG_BUCKETS],
+                   &Sector->HashListEntry);
+    if (Logged)
+    {
+        InsertTailList(&Log->LoggedListHead, &Sector->ListEntry);
+        Log->LoggedCount++;
+    }
+    else
+    {
+        InsertTailList(&Log->UnloggedListHead, &Sector->ListEntry);
+        Log->UnloggedCount++;
+    }
+
+    return Sector;
+}
+
+static
+VOID
+NtfsLogFreeSector(PNTFS_LOG Log,
+                  PNTFS_LOG_SECTOR Sector)
+{
+    RemoveEntryList(&Sector->HashListEntry);
+    RemoveEntryList(&Sector->ListEntry);
+    if (Sector->Logged)
+        Log->LoggedCount--;
+    else
+        Log->UnloggedCount--;
+
+    ExFreeToNPagedLookasideList(&Log->SectorLookasideList, Sector);
+}
+
+/* Copies the modified sectors which overlap a transfer from the disk into its buffer */
+static
+VOID
+NtfsLogOverlaySectors(PDEVICE_EXTENSION Vcb,
+                      LONGLONG DiskOffset,
+                      ULONG Length,
+                      PUCHAR Buffer)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+    ULONG BytesPerSector = Vcb->NtfsInfo.BytesPerSector;
+    PLIST_ENTRY ListHeads[2] = { &Log->UnloggedListHead, &Log->LoggedListHead };
+    PLIST_ENTRY ListEntry;
+    PNTFS_LOG_SECTOR Sector;
+    LONGLONG SectorOffset, Start, End;
+    ULONG i;
+
+    ExAcquireResourceSharedLite(&Log->Resource, TRUE);
+
+    if (Log->UnloggedCount + Log->LoggedCount < Length / BytesPerSector)
+    {
+        // Fewer sectors are cached than the transfer covers: check each of them
+        for (i = 0; i < 2; i++)
+        {
+            for (ListEntry = ListHeads[i]->Flink; ListEntry != ListHeads[i]; ListEntry = ListEntry->Flink)
+            {
+                Sector = CONTAINING_RECORD(ListEntry, NTFS_LOG_SECTOR, ListEntry);
+                Start = max(Sector->DiskOffset, DiskOffset);
+                End = min(Sector->DiskOffset + BytesPerSector, DiskOffset + Length);
+                if (Start < End)
+                {
+                    RtlCopyMemory(Buffer + (Start - DiskOffset),
+                                  LOG_SECTOR_DATA(Sector) + (Start - Sector->DiskOffset),
+                                  (ULONG)(End - Start));
+                }
+            }
+        }
+    }
+    else
+    {
+        for (SectorOffset = ROUND_DOWN(DiskOffset, BytesPerSector);
+             SectorOffset < DiskOffset + Length;
+             SectorOffset += BytesPerSector)
+        {
+            Sector = NtfsLogLookupSector(Vcb, SectorOffset);
+            if (Sector == NULL)
+                continue;
+
+            Start = max(SectorOffset, DiskOffset);
+            End = min(SectorOffset + BytesPerSector, DiskOffset + Length);
+            RtlCopyMemory(Buffer + (Start - DiskOffset),
+                          LOG_SECTOR_DATA(Sector) + (Start - SectorOffset),
+                          (ULONG)(End - Start));
+        }
+    }
+
+    ExReleaseResourceLite(&Log->Resource);
+}
+
+/* Modifies the cached copies of the sectors a write covers, reading the ones it only partly covers */
+static
+NTSTATUS
+NtfsLogWriteSectors(PDEVICE_EXTENSION Vcb,
+                    LONGLONG DiskOffset,
+                    ULONG Length,
+                    PUCHAR Buffer)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+    ULONG BytesPerSector = Vcb->NtfsInfo.BytesPerSector;
+    PNTFS_LOG_SECTOR Sector;
+    LONGLONG SectorOffset;
+    ULONG SectorPart, CopyLength;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    ExAcquireResourceExclusiveLite(&Log->Resource, TRUE);
+
+    while (Length > 0)
+    {
+        SectorOffset = ROUND_DOWN(DiskOffset, BytesPerSector);
+        SectorPart = (ULONG)(DiskOffset - SectorOffset);
+        CopyLength = min(BytesPerSector - SectorPart, Length);
+
+        Sector = NtfsLogLookupSector(Vcb, SectorOffset);
+        if (Sector == NULL)
+        {
+            Sector = NtfsLogAllocateSector(Vcb, SectorOffset, FALSE);
+            if (Sector == NULL)
+            {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                break;
+            }
+
+            if (CopyLength != BytesPerSector)
+            {
+                Status = NtfsReadDisk(Vcb->StorageDevice,
+                                      SectorOffset,
+                                      BytesPerSector,
+                                      BytesPerSector,
+                                      LOG_SECTOR_DATA(Sector),
+                                      FALSE);
+                if (!NT_SUCCESS(Status))
+                {
+                    NtfsLogFreeSector(Log, Sector);
+                    break;
+                }
+            }
+        }
+        else if (Sector->Logged)
+        {
+            // The log has an older copy, the next commit must write this one
+            RemoveEntryList(&Sector->ListEntry);
+            InsertTailList(&Log->UnloggedListHead, &Sector->ListEntry);
+            Sector->Logged = FALSE;
+            Log->LoggedCount--;
+            Log->UnloggedCount++;
+        }
+
+        RtlCopyMemory(LOG_SECTOR_DATA(Sector) + SectorPart, Buffer, CopyLength);
+
+        DiskOffset += CopyLength;
+        Buffer += CopyLength;
+        Length -= CopyLength;
+    }
+
+    ExReleaseResourceLite(&Log->Resource);
+
+    return Status;
+}
+
+static
+NTSTATUS
+NtfsLogWriteRestartArea(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+    ULONG BytesPerSector = Vcb->NtfsInfo.BytesPerSector;
+    PNTFS_LOG_RESTART_AREA RestartArea;
+    ULONG LengthWritten;
+    NTSTATUS Status;
+
+    RestartArea = ExAllocatePoolWithTag(PagedPool, BytesPerSector, TAG_LOG);
+    if (RestartArea == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    RtlZeroMemory(RestartArea, BytesPerSector);
+    RestartArea->Signature = NTFS_LOG_RESTART_SIGNATURE;
+    RestartArea->Version = NTFS_LOG_VERSION;
+    RestartArea->NextSequence = Log->NextSequence;
+    RestartArea->AreaStart = Log->AreaStart;
+    RestartArea->AreaEnd = Log->AreaEnd;
+    RestartArea->Flags = Log->ClearVolumeDirty ? NTFS_LOG_CLEAR_VOLUME_DIRTY : 0;
+    RestartArea->Checksum = NtfsLogChecksum((PUCHAR)RestartArea, sizeof(NTFS_LOG_RESTART_AREA));
+
+    Status = WriteAttribute(Vcb, Log->DataContext, NTFS_LOG_RESTART_OFFSET, (PUCHAR)RestartArea, BytesPerSector, &LengthWritten, NULL);
+
+    ExFreePoolWithTag(RestartArea, TAG_LOG);
+
+    return Status;
+}
+
+/*
+ * Sets or clears VOLUME_IS_DIRTY in $Volume, so that chkdsk and Windows don't take the volume
+ * for consistent while its metadata is only so with the log applied. The file record is written
+ * in place in $MFT and in $MFTMirr, along with the changes of it the journal holds, if any; the
+ * MFT cache isn't updated, the driver never writes $Volume once mounted.
+ * Must be called with the log resource held exclusively.
+ */
+static
+NTSTATUS
+NtfsLogSetVolumeDirty(PDEVICE_EXTENSION Vcb,
+                      BOOLEAN Dirty)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+    ULONG BytesPerSector = Vcb->NtfsInfo.BytesPerSector;
+    ULONG BytesPerFileRecord = Vcb->NtfsInfo.BytesPerFileRecord;
+    LONGLONG DiskOffsets[2];
+    PFILE_RECORD_HEADER FileRecord;
+    FIND_ATTR_CONTXT Context;
+    PNTFS_ATTR_RECORD Attribute;
+    PVOLINFO_ATTRIBUTE VolumeInfo;
+    PNTFS_LOG_SECTOR Sector;
+    ULONG Offset, i;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    DiskOffsets[0] = Vcb->NtfsInfo.MftStart.QuadPart * Vcb->NtfsInfo.BytesPerCluster + NTFS_FILE_VOLUME * BytesPerFileRecord;
+    DiskOffsets[1] = Vcb->NtfsInfo.MftMirrStart.QuadPart * Vcb->NtfsInfo.BytesPerCluster + NTFS_FILE_VOLUME * BytesPerFileRecord;
+
+    FileRecord = ExAllocateFromNPagedLookasideList(&Vcb->FileRecLookasideList);
+    if (FileRecord == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    for (i = 0; i < 2; i++)
+    {
+        Status = NtfsReadDisk(Vcb->StorageDevice, DiskOffsets[i], BytesPerFileRecord, BytesPerSector, (PUCHAR)FileRecord, FALSE);
+        if (!NT_SUCCESS(Status))
+            break;
+
+        NtfsLogOverlaySectors(Vcb, DiskOffsets[i], BytesPerFileRecord, (PUCHAR)FileRecord);
+
+        Status = FixupUpdateSequenceArray(Vcb, &FileRecord->Ntfs);
+        if (!NT_SUCCESS(Status))
+            break;
+
+        VolumeInfo = NULL;
+        Status = FindFirstAttribute(&Context, Vcb, FileRecord, TRUE, &Attribute);
+        while (NT_SUCCESS(Status))
+        {
+            if (Attribute->Type == AttributeVolumeInformation &&
+                Attribute->Resident.ValueLength >= FIELD_OFFSET(VOLINFO_ATTRIBUTE, Unknown2))
+            {
+                VolumeInfo = (PVOLINFO_ATTRIBUTE)((ULONG_PTR)Attribute + Attribute->Resident.ValueOffset);
+                break;
+            }
+
+            Status = FindNextAttribute(&Context, &Attribute);
+        }
+        FindCloseAttribute(&Context);
+
+        if (VolumeInfo == NULL)
+        {
+            DPRINT1("$Volume has no volume information\n");
+            Status = STATUS_FILE_CORRUPT_ERROR;
+            break;
+        }
+
+        if (i == 0 && Dirty)
+        {
+            // Already dirty: chkdsk is due anyway, and it's left to clear the flag
+            if (VolumeInfo->Flags & VOLUME_IS_DIRTY)
+            {
+                Status = STATUS_SUCCESS;
+                break;
+            }
+
+            // Recorded first, so that a crash before the log is empty lets the next mount clear the flag
+            Log->ClearVolumeDirty = TRUE;
+            Status = NtfsLogWriteRestartArea(Vcb);
+            if (!NT_SUCCESS(Status))
+            {
+                Log->ClearVolumeDirty = FALSE;
+                break;
+            }
+        }
+
+        if (Dirty)
+            VolumeInfo->Flags |= VOLUME_IS_DIRTY;
+        else
+            VolumeInfo->Flags &= ~VOLUME_IS_DIRTY;
+
+        AddFixupArray(Vcb, &FileRecord->Ntfs);
+
+        Status = NtfsWriteDisk(Vcb->StorageDevice, DiskOffsets[i], BytesPerFileRecord, BytesPerSector, (PUCHAR)FileRecord);
+        if (!NT_SUCCESS(Status))
+            break;
+
+        // A checkpoint mustn't write the flag back as it was
+        for (Offset = 0; Offset < BytesPerFileRecord; Offset += BytesPerSector)
+        {
+            Sector = NtfsLogLookupSector(Vcb, DiskOffsets[i] + Offset);
+            if (Sector != NULL)
+                RtlCopyMemory(LOG_SECTOR_DATA(Sector), (PUCHAR)FileRecord + Offset, BytesPerSector);
+        }
+    }
+
+    ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Can't %s VOLUME_IS_DIRTY (Status %lx)\n", Dirty ? "set" : "clear", Status);
+        return Status;
+    }
+
+    Log->VolumeDirty = Dirty;
+
+    if (!Dirty)
+    {
+        Log->ClearVolumeDirty = FALSE;
+        Status = NtfsLogWriteRestartArea(Vcb);
+    }
+
+    return Status;
+}
+
+/* Heap sort, so that a checkpoint writes the sectors in the order of the disk */
+static
+VOID
+NtfsLogSortSectors(PNTFS_LOG_SECTOR *Sectors,
+                   ULONG Count)
+{
+    PNTFS_LOG_SECTOR Sector;
+    ULONG Start, End, Parent, Child;
+
+    if (Count < 2)
+        return;
+
+    for (Start = Count / 2, End = Count; End > 1; )
+    {
+        if (Start > 0)
+        {
+            // Building the heap
+            Start--;
+        }
+        else
+        {
+            // Moving the largest sector to the end
+            End--;
+            Sector = Sectors[End];
+            Sectors[End] = Sectors[0];
+            Sectors[0] = Sector;
+        }
+
+        for (Parent = Start; (Child = 2 * Parent + 1) < End; Parent = Child)
+        {
+            if (Child + 1 < End && Sectors[Child + 1]->DiskOffset > Sectors[Child]->DiskOffset)
+                Child++;
+
+            if (Sectors[Parent]->DiskOffset >= Sectors[Child]->DiskOffset)
+                break;
+
+            Sector = Sectors[Parent];
+            Sectors[Parent] = Sectors[Child];
+            Sectors[Child] = Sector;
+        }
+    }
+}
+
+/*
+ * Writes the logged sectors (and the unlogged ones if IncludeUnlogged is TRUE) in place,
+ * then moves the restart area past the records that hold them and frees them.
+ * Must be called with the log resource held exclusively, and with the operation resource
+ * held exclusively too if IncludeUnlogged is TRUE.
+ */
+static
+NTSTATUS
+NtfsLogWriteBack(PDEVICE_EXTENSION Vcb,
+                 BOOLEAN IncludeUnlogged)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+    ULONG BytesPerSector = Vcb->NtfsInfo.BytesPerSector;
+    PNTFS_LOG_SECTOR *Sectors;
+    PLIST_ENTRY ListEntry;
+    NTFS_IO_RUN Runs[NTFS_MAX_IO_RUNS];
+    ULONG RunCount, BatchLength;
+    PUCHAR Batch;
+    ULONG Count, i;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    Count = Log->LoggedCount + (IncludeUnlogged ? Log->UnloggedCount : 0);
+    if (Count == 0)
+    {
+        if (Log->ClearVolumeDirty && Log->UnloggedCount == 0)
+            return NtfsLogSetVolumeDirty(Vcb, FALSE);
+
+        return STATUS_SUCCESS;
+    }
+
+    Sectors = ExAllocatePoolWithTag(PagedPool, Count * sizeof(PNTFS_LOG_SECTOR), TAG_LOG);
+    if (Sectors == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    Batch = ExAllocatePoolWithTag(PagedPool, NTFS_LOG_WRITE_BACK_BATCH, TAG_LOG);
+    if (Batch == NULL)
+    {
+        ExFreePoolWithTag(Sectors, TAG_LOG);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    i = 0;
+    for (ListEntry = Log->LoggedListHead.Flink; ListEntry != &Log->LoggedListHead; ListEntry = ListEntry->Flink)
+        Sectors[i++] = CONTAINING_RECORD(ListEntry, NTFS_LOG_SECTOR, ListEntry);
+    if (IncludeUnlogged)
+    {
+        for (ListEntry = Log->UnloggedListHead.Flink; ListEntry != &Log->UnloggedListHead; ListEntry = ListEntry->Flink)
+            Sectors[i++] = CONTAINING_RECORD(ListEntry, NTFS_LOG_SECTOR, ListEntry);
+    }
+    ASSERT(i == Count);
+
+    NtfsLogSortSectors(Sectors, Count);
+
+    // Adjacent sectors are merged into runs, which are sent to the disk NTFS_MAX_IO_RUNS at a time
+    RunCount = 0;
+    BatchLength = 0;
+    for (i = 0; i < Count; i++)
+    {
+        if (RunCount != 0 &&
+            Runs[RunCount - 1].DiskOffset + Runs[RunCount - 1].Length == Sectors[i]->DiskOffset &&
+            BatchLength + BytesPerSector <= NTFS_LOG_WRITE_BACK_BATCH)
+        {
+            Runs[RunCount - 1].Length += BytesPerSector;
+        }
+        else
+        {
+            if (RunCount == NTFS_MAX_IO_RUNS || BatchLength + BytesPerSector > NTFS_LOG_WRITE_BACK_BATCH)
+            {
+                Status = NtfsReadWriteRuns(Vcb->StorageDevice, IRP_MJ_WRITE, Runs, RunCount, BytesPerSector, Batch);
+                if (!NT_SUCCESS(Status))
+                    break;
+
+                RunCount = 0;
+                BatchLength = 0;
+            }
+
+            Runs[RunCount].DiskOffset = Sectors[i]->DiskOffset;
+            Runs[RunCount].BufferOffset = BatchLength;
+            Runs[RunCount].Length = BytesPerSector;
+            RunCount++;
+        }
+
+        RtlCopyMemory(Batch + BatchLength, LOG_SECTOR_DATA(Sectors[i]), BytesPerSector);
+        BatchLength += BytesPerSector;
+    }
+
+    if (NT_SUCCESS(Status) && RunCount != 0)
+        Status = NtfsReadWriteRuns(Vcb->StorageDevice, IRP_MJ_WRITE, Runs, RunCount, BytesPerSector, Batch);
+
+    // Only forget the records once their sectors are on the disk
+    if (NT_SUCCESS(Status))
+        Status = NtfsLogWriteRestartArea(Vcb);
+
+    if (NT_SUCCESS(Status))
+    {
+        for (i = 0; i < Count; i++)
+            NtfsLogFreeSector(Log, Sectors[i]);
+
+        Log->WriteOffset = Log->AreaStart;
+        Log->Checkpoints++;
+
+        // The metadata on the disk is consistent by itself again
+        if (Log->ClearVolumeDirty && Log->UnloggedCount == 0)
+            Status = NtfsLogSetVolumeDirty(Vcb, FALSE);
+    }
+    else
+    {
+        DPRINT1("Writing back %lu journaled sectors failed (Status %lx)\n", Count, Status);
+    }
+
+    ExFreePoolWithTag(Batch, TAG_LOG);
+    ExFreePoolWithTag(Sectors, TAG_LOG);
+
+    return Status;
+}
+
+/*
+ * Forgets the cached sectors that a write of file data is about to replace, for clusters that
+ * held metadata and were freed since. Logged sectors are written in place first, so that
+ * neither a checkpoint nor a replay writes them over the new data later.
+ */
+static
+NTSTATUS
+NtfsLogForgetSectors(PDEVICE_EXTENSION Vcb,
+                     LONGLONG DiskOffset,
+                     ULONG Length)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+    ULONG BytesPerSector = Vcb->NtfsInfo.BytesPerSector;
+    PNTFS_LOG_SECTOR Sector;
+    LONGLONG SectorOffset;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    ExAcquireResourceExclusiveLite(&Log->Resource, TRUE);
+
+    for (SectorOffset = ROUND_DOWN(DiskOffset, BytesPerSector);
+         SectorOffset < DiskOffset + Length;
+         SectorOffset += BytesPerSector)
+    {
+        Sector = NtfsLogLookupSector(Vcb, SectorOffset);
+        if (Sector == NULL)
+            continue;
+
+        if (Sector->Logged)
+        {
+            // Only whole records are logged, writing them in place is always safe
+            Status = NtfsLogWriteBack(Vcb, FALSE);
+            if (!NT_SUCCESS(Status))
+                break;
+        }
+        else
+        {
+            NtfsLogFreeSector(Log, Sector);
+        }
+    }
+
+    ExReleaseResourceLite(&Log->Resource);
+
+    return Status;
+}
+
+/**
+* @name NtfsLogReadWriteRuns
+* @implemented
+*
+* Transfers pieces of an attribute to or from the volume, like NtfsReadWriteRuns(), going
+* through the journal if the attribute is metadata.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @param Context
+* Attribute the runs belong to.
+*
+* @param MajorFunction
+* IRP_MJ_READ or IRP_MJ_WRITE
+*
+* @param Runs
+* @param RunCount
+* @param Buffer
+* Same as for NtfsReadWriteRuns().
+*
+* @return
+* STATUS_SUCCESS if every run was transferred, an error code otherwise.
+*
+* @remarks
+* Writes to the metadata only modify the copies of the sectors kept by the journal, and
+* reads of the metadata see these copies.
+*/
+NTSTATUS
+NtfsLogReadWriteRuns(PDEVICE_EXTENSION Vcb,
+                     PNTFS_ATTR_CONTEXT Context,
+                     UCHAR MajorFunction,
+                     PNTFS_IO_RUN Runs,
+                     ULONG RunCount,
+                     PUCHAR Buffer)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+    NTSTATUS Status;
+    ULONG i;
+
+    if (!NtfsLogIsMetadata(Context) ||
+        (MajorFunction == IRP_MJ_WRITE && !Log->Enabled))
+    {
+        if (MajorFunction == IRP_MJ_WRITE && Log->UnloggedCount + Log->LoggedCount != 0)
+        {
+            for (i = 0; i < RunCount; i++)
+            {
+                Status = NtfsLogForgetSectors(Vcb, Runs[i].DiskOffset, Runs[i].Length);
+                if (!NT_SUCCESS(Status))
+                    return Status;
+            }
+        }
+
+        return NtfsReadWriteRuns(Vcb->StorageDevice, MajorFunction, Runs, RunCount, Vcb->NtfsInfo.BytesPerSector, Buffer);
+    }
+
+    if (MajorFunction == IRP_MJ_READ)
+    {
+        Status = NtfsReadWriteRuns(Vcb->StorageDevice, IRP_MJ_READ, Runs, RunCount, Vcb->NtfsInfo.BytesPerSector, Buffer);
+        if (!NT_SUCCESS(Status) || Log->UnloggedCount + Log->LoggedCount == 0)
+            return Status;
+
+        for (i = 0; i < RunCount; i++)
+        {
+            NtfsLogOverlaySectors(Vcb, Runs[i].DiskOffset, Runs[i].Length, Buffer + Runs[i].BufferOffset);
+        }
+
+        return STATUS_SUCCESS;
+    }
+
+    for (i = 0; i < RunCount; i++)
+    {
+        Status = NtfsLogWriteSectors(Vcb, Runs[i].DiskOffset, Runs[i].Length, Buffer + Runs[i].BufferOffset);
+        if (!NT_SUCCESS(Status))
+            return Status;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+* @name NtfsLogReadWriteVolume
+* @implemented
+*
+* Transfers sectors of the volume itself, for the I/O on volume handles.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @param MajorFunction
+* IRP_MJ_READ or IRP_MJ_WRITE
+*
+* @param DiskOffset
+* Offset of the transfer on the volume, aligned on a sector.
+*
+* @param Length
+* Length of the transfer, a multiple of the sector size.
+*
+* @param Buffer
+* Data of the transfer.
+*
+* @return
+* STATUS_SUCCESS if the transfer was done, an error code otherwise.
+*
+* @remarks
+* Reads see the metadata that the journal holds and that isn't written in place yet. Writes
+* replace it, like writes of file data do.
+*/
+NTSTATUS
+NtfsLogReadWriteVolume(PDEVICE_EXTENSION Vcb,
+                       UCHAR MajorFunction,
+                       LONGLONG DiskOffset,
+                       ULONG Length,
+                       PUCHAR Buffer)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+    NTFS_IO_RUN Run;
+    NTSTATUS Status;
+
+    Run.DiskOffset = DiskOffset;
+    Run.BufferOffset = 0;
+    Run.Length = Length;
+
+    if (MajorFunction == IRP_MJ_WRITE && Log->UnloggedCount + Log->LoggedCount != 0)
+    {
+        Status = NtfsLogForgetSectors(Vcb, DiskOffset, Length);
+        if (!NT_SUCCESS(Status))
+            return Status;
+    }
+
+    Status = NtfsReadWriteRuns(Vcb->StorageDevice, MajorFunction, &Run, 1, Vcb->NtfsInfo.BytesPerSector, Buffer);
+
+    if (NT_SUCCESS(Status) && MajorFunction == IRP_MJ_READ && Log->UnloggedCount + Log->LoggedCount != 0)
+        NtfsLogOverlaySectors(Vcb, DiskOffset, Length, Buffer);
+
+    return Status;
+}
+
+/*
+ * Writes the unlogged sectors to the log as a single record.
+ * Must be called with the operation resource and the log resource held exclusively.
+ */
+static
+NTSTATUS
+NtfsLogCommit(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+    ULONG BytesPerSector = Vcb->NtfsInfo.BytesPerSector;
+    PNTFS_LOG_RECORD_HEADER Record;
+    PNTFS_LOG_SECTOR Sector;
+    PLIST_ENTRY ListEntry;
+    ULONG HeaderSectors, Length, LengthWritten, i;
+    NTSTATUS Status;
+
+    if (Log->UnloggedCount == 0)
+        return STATUS_SUCCESS;
+
+    // From now on, the metadata on the disk is only consistent with the log applied
+    if (!Log->VolumeDirty)
+    {
+        Status = NtfsLogSetVolumeDirty(Vcb, TRUE);
+        if (!NT_SUCCESS(Status))
+            return Status;
+    }
+
+    HeaderSectors = ROUND_UP(FIELD_OFFSET(NTFS_LOG_RECORD_HEADER, DiskOffsets) + Log->UnloggedCount * sizeof(LONGLONG),
+                             BytesPerSector) / BytesPerSector;
+    Length = (HeaderSectors + Log->UnloggedCount) * BytesPerSector;
+
+    if (Log->WriteOffset + Length > Log->AreaEnd)
+    {
+        if (Log->AreaStart + Length > Log->AreaEnd)
+        {
+            // Can't be made atomic, write everything like if there were no journal
+            DPRINT1("%lu modified sectors don't fit in $LogFile, writing them in place\n", Log->UnloggedCount);
+            return NtfsLogWriteBack(Vcb, TRUE);
+        }
+
+        Status = NtfsLogWriteBack(Vcb, FALSE);
+        if (!NT_SUCCESS(Status))
+            return Status;
+    }
+
+    Record = ExAllocatePoolWithTag(PagedPool, Length, TAG_LOG);
+    if (Record == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    RtlZeroMemory(Record, HeaderSectors * BytesPerSector);
+    Record->Signature = NTFS_LOG_RECORD_SIGNATURE;
+    Record->Sequence = Log->NextSequence;
+    Record->Length = Length;
+    Record->HeaderSectors = HeaderSectors;
+    Record->SectorCount = Log->UnloggedCount;
+
+    i = 0;
+    for (ListEntry = Log->UnloggedListHead.Flink; ListEntry != &Log->UnloggedListHead; ListEntry = ListEntry->Flink)
+    {
+        Sector = CONTAINING_RECORD(ListEntry, NTFS_LOG_SECTOR, ListEntry);
+        Record->DiskOffsets[i] = Sector->DiskOffset;
+        RtlCopyMemory((PUCHAR)Record + (HeaderSectors + i) * BytesPerSector, LOG_SECTOR_DATA(Sector), BytesPerSector);
+        i++;
+    }
+
+    Record->Checksum = NtfsLogChecksum((PUCHAR)Record, Length);
+
+    Status = WriteAttribute(Vcb, Log->DataContext, Log->WriteOffset, (PUCHAR)Record, Length, &LengthWritten, NULL);
+
+    ExFreePoolWithTag(Record, TAG_LOG);
+
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Writing log record %I64u failed (Status %lx)\n", Log->NextSequence, Status);
+        return Status;
+    }
+
+    Log->Commits++;
+    Log->CommittedSectors += Log->UnloggedCount;
+
+    while (!IsListEmpty(&Log->UnloggedListHead))
+    {
+        Sector = CONTAINING_RECORD(RemoveHeadList(&Log->UnloggedListHead), NTFS_LOG_SECTOR, ListEntry);
+        Sector->Logged = TRUE;
+        InsertTailList(&Log->LoggedListHead, &Sector->ListEntry);
+    }
+    Log->LoggedCount += Log->UnloggedCount;
+    Log->UnloggedCount = 0;
+
+    Log->WriteOffset += Length;
+    Log->NextSequence++;
+    KeQuerySystemTime(&Log->LastCommitTime);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+* @name NtfsLogFlush
+* @implemented
+*
+* Writes the metadata modified by the requests that are done to the log.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @param Checkpoint
+* If TRUE, the logged sectors are then written in place, so that the log is empty.
+*
+* @return
+* STATUS_SUCCESS, or the error of the write that failed. The sectors stay in memory
+* and the next flush retries them.
+*
+* @remarks
+* Waits for the requests in progress on the volume to be done, so it must not be called
+* by one of them. A checkpoint also happens when the log is half full, or when too many
+* sectors are kept in memory.
+*/
+NTSTATUS
+NtfsLogFlush(PDEVICE_EXTENSION Vcb,
+             BOOLEAN Checkpoint)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+    NTSTATUS Status;
+
+    if (!Log->Enabled)
+        return STATUS_SUCCESS;
+
+    ExAcquireResourceExclusiveLite(&Log->OperationResource, TRUE);
+    ExAcquireResourceExclusiveLite(&Log->Resource, TRUE);
+
+    Status = NtfsLogCommit(Vcb);
+    if (NT_SUCCESS(Status) &&
+        (Checkpoint ||
+         Log->WriteOffset - Log->AreaStart > (Log->AreaEnd - Log->AreaStart) / 2 ||
+         Log->LoggedCount >= NTFS_LOG_CHECKPOINT_SECTORS))
+    {
+        Status = NtfsLogWriteBack(Vcb, FALSE);
+    }
+
+    ExReleaseResourceLite(&Log->Resource);
+    ExReleaseResourceLite(&Log->OperationResource);
+
+    return Status;
+}
+
+static
+VOID
+NTAPI
+NtfsLogCommitDpc(PKDPC Dpc,
+                 PVOID DeferredContext,
+                 PVOID SystemArgument1,
+                 PVOID SystemArgument2)
+{
+    PDEVICE_EXTENSION Vcb = DeferredContext;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    ExQueueWorkItem(&Vcb->Log.CommitWorkItem, DelayedWorkQueue);
+}
+
+/* Makes NtfsLogCommitWorker() run in NTFS_LOG_COMMIT_INTERVAL, unless it's already due to */
+static
+VOID
+NtfsLogArmCommitTimer(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+    LARGE_INTEGER DueTime;
+
+    if (InterlockedCompareExchange(&Log->CommitPending, 1, 0) == 0)
+    {
+        DueTime.QuadPart = -NTFS_LOG_COMMIT_INTERVAL;
+        KeSetTimer(&Log->CommitTimer, DueTime, &Log->CommitDpc);
+    }
+}
+
+static
+VOID
+NTAPI
+NtfsLogCommitWorker(PVOID Parameter)
+{
+    PDEVICE_EXTENSION Vcb = Parameter;
+    PNTFS_LOG Log = &Vcb->Log;
+    LARGE_INTEGER CurrentTime;
+    BOOLEAN Idle;
+
+    // Changes made from now on arm the timer again
+    InterlockedExchange(&Log->CommitPending, 0);
+
+    // Once nothing happened on the volume for a whole interval, the log is emptied, so that the
+    // volume is consistent by itself if it's removed or if Windows gets it without a clean dismount
+    KeQuerySystemTime(&CurrentTime);
+    Idle = (Log->ActiveOperations == 0 &&
+            CurrentTime.QuadPart - Log->LastOperationTime.QuadPart >= NTFS_LOG_COMMIT_INTERVAL);
+
+    FsRtlEnterFileSystem();
+    NtfsLogFlush(Vcb, Idle);
+    FsRtlExitFileSystem();
+
+    if (Log->UnloggedCount + Log->LoggedCount != 0 || Log->ClearVolumeDirty)
+        NtfsLogArmCommitTimer(Vcb);
+}
+
+/**
+* @name NtfsLogBeginOperation
+* @implemented
+*
+* Called before a request modifies the volume. Waits while the log is being written.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @param CanStarveFlush
+* TRUE for the requests that must not wait for a flush, such as paging I/O: a request in
+* progress may be waiting for them. They only wait while a flush is writing.
+*/
+VOID
+NtfsLogBeginOperation(PDEVICE_EXTENSION Vcb,
+                      BOOLEAN CanStarveFlush)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+
+    if (!Log->Enabled)
+        return;
+
+    if (CanStarveFlush)
+        ExAcquireSharedStarveExclusive(&Log->OperationResource, TRUE);
+    else
+        ExAcquireResourceSharedLite(&Log->OperationResource, TRUE);
+
+    InterlockedIncrement(&Log->ActiveOperations);
+}
+
+/**
+* @name NtfsLogEndOperation
+* @implemented
+*
+* Called once a request is done modifying the volume, after NtfsLogBeginOperation().
+* This is where group commit happens.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @remarks
+* The log is written once NTFS_LOG_COMMIT_BYTES of modified sectors are pending, so
+* concurrent requests share a single log write. Smaller changes are written by the last
+* request to leave the volume if the previous commit is old enough, and otherwise by a
+* timer once the volume has been idle for NTFS_LOG_COMMIT_INTERVAL. The same timer then
+* checkpoints the log if no request came meanwhile.
+*/
+VOID
+NtfsLogEndOperation(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+    LARGE_INTEGER CurrentTime;
+    LONG ActiveOperations;
+
+    if (!Log->Enabled)
+        return;
+
+    KeQuerySystemTime(&CurrentTime);
+    Log->LastOperationTime = CurrentTime;
+
+    ActiveOperations = InterlockedDecrement(&Log->ActiveOperations);
+    ExReleaseResourceLite(&Log->OperationResource);
+
+    // A request nested in another one leaves the commit to the outer one
+    if (ExIsResourceAcquiredSharedLite(&Log->OperationResource) != 0)
+        return;
+
+    if (Log->UnloggedCount == 0)
+    {
+        // What's logged is written in place once the volume is idle
+        if (Log->LoggedCount != 0)
+            NtfsLogArmCommitTimer(Vcb);
+        return;
+    }
+
+    if (Log->UnloggedCount * Vcb->NtfsInfo.BytesPerSector >= NTFS_LOG_COMMIT_BYTES ||
+        Log->UnloggedCount + Log->LoggedCount >= NTFS_LOG_CHECKPOINT_SECTORS ||
+        (ActiveOperations == 0 && CurrentTime.QuadPart - Log->LastCommitTime.QuadPart >= NTFS_LOG_COMMIT_INTERVAL))
+    {
+        NtfsLogFlush(Vcb, FALSE);
+    }
+
+    NtfsLogArmCommitTimer(Vcb);
+}
+
+/**
+* @name NtfsLogCheckpoint
+* @implemented
+*
+* Writes the metadata modified by the requests that are done in place, so that the volume
+* is consistent without the log. Called before the volume is locked or dismounted, and at
+* shutdown.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @return
+* STATUS_SUCCESS, or the error of the write that failed.
+*
+* @remarks
+* Unlike NtfsLogFlush(), it may be called by a request, as long as it didn't modify the
+* volume yet: the request leaves the volume while the checkpoint waits for the others.
+*/
+NTSTATUS
+NtfsLogCheckpoint(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+    BOOLEAN InOperation;
+    NTSTATUS Status;
+
+    if (!Log->Enabled)
+        return STATUS_SUCCESS;
+
+    InOperation = (ExIsResourceAcquiredSharedLite(&Log->OperationResource) != 0);
+    if (InOperation)
+    {
+        ASSERT(ExIsResourceAcquiredSharedLite(&Log->OperationResource) == 1);
+        InterlockedDecrement(&Log->ActiveOperations);
+        ExReleaseResourceLite(&Log->OperationResource);
+    }
+
+    Status = NtfsLogFlush(Vcb, TRUE);
+
+    if (InOperation)
+    {
+        ExAcquireResourceSharedLite(&Log->OperationResource, TRUE);
+        InterlockedIncrement(&Log->ActiveOperations);
+    }
+
+    return Status;
+}
+
+/* Loads the sectors of the records that follow the restart area, returns how many records there were */
+static
+ULONG
+NtfsLogReplay(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+    ULONG BytesPerSector = Vcb->NtfsInfo.BytesPerSector;
+    ULONGLONG VolumeSize = Vcb->NtfsInfo.SectorCount * BytesPerSector;
+    PNTFS_LOG_RECORD_HEADER Header, Record;
+    PNTFS_LOG_SECTOR Sector;
+    ULONG Checksum, RecordCount, i;
+
+    Header = ExAllocatePoolWithTag(PagedPool, BytesPerSector, TAG_LOG);
+    if (Header == NULL)
+        return 0;
+
+    for (RecordCount = 0; Log->WriteOffset + BytesPerSector <= Log->AreaEnd; RecordCount++)
+    {
+        if (ReadAttribute(Vcb, Log->DataContext, Log->WriteOffset, (PCHAR)Header, BytesPerSector) != BytesPerSector)
+            break;
+
+        // Older records, that a checkpoint already wrote, end the log
+        if (Header->Signature != NTFS_LOG_RECORD_SIGNATURE ||
+            Header->Sequence != Log->NextSequence ||
+            Header->HeaderSectors == 0 ||
+            Header->SectorCount == 0 ||
+            FIELD_OFFSET(NTFS_LOG_RECORD_HEADER, DiskOffsets) + (ULONGLONG)Header->SectorCount * sizeof(LONGLONG) > (ULONGLONG)Header->HeaderSectors * BytesPerSector ||
+            (ULONGLONG)Header->Length != ((ULONGLONG)Header->HeaderSectors + Header->SectorCount) * BytesPerSector ||
+            Log->WriteOffset + Header->Length > Log->AreaEnd)
+        {
+            break;
+        }
+
+        Record = ExAllocatePoolWithTag(PagedPool, Header->Length, TAG_LOG);
+        if (Record == NULL)
+            break;
+
+        if (ReadAttribute(Vcb, Log->DataContext, Log->WriteOffset, (PCHAR)Record, Header->Length) != Header->Length)
+        {
+            ExFreePoolWithTag(Record, TAG_LOG);
+            break;
+        }
+
+        // A record that was only partly written when the system stopped isn't applied
+        Checksum = Record->Checksum;
+        Record->Checksum = 0;
+        if (NtfsLogChecksum((PUCHAR)Record, Record->Length) != Checksum)
+        {
+            DPRINT1("Log record %I64u is incomplete, ignoring it\n", Record->Sequence);
+            ExFreePoolWithTag(Record, TAG_LOG);
+            break;
+        }
+
+        for (i = 0; i < Record->SectorCount; i++)
+        {
+            if (Record->DiskOffsets[i] < 0 ||
+                Record->DiskOffsets[i] % BytesPerSector != 0 ||
+                (ULONGLONG)Record->DiskOffsets[i] >= VolumeSize)
+            {
+                DPRINT1("Log record %I64u has an invalid sector %I64x\n", Record->Sequence, Record->DiskOffsets[i]);
+                continue;
+            }
+
+            Sector = NtfsLogLookupSector(Vcb, Record->DiskOffsets[i]);
+            if (Sector == NULL)
+            {
+                Sector = NtfsLogAllocateSector(Vcb, Record->DiskOffsets[i], TRUE);
+                if (Sector == NULL)
+                    break;
+            }
+
+            RtlCopyMemory(LOG_SECTOR_DATA(Sector),
+                          (PUCHAR)Record + (Record->HeaderSectors + i) * BytesPerSector,
+                          BytesPerSector);
+        }
+
+        ExFreePoolWithTag(Record, TAG_LOG);
+
+        if (i != Header->SectorCount)
+        {
+            // Half of a record would leave the metadata inconsistent, keep none of them
+            DPRINT1("Not enough memory to apply the log\n");
+            while (!IsListEmpty(&Log->LoggedListHead))
+                NtfsLogFreeSector(Log, CONTAINING_RECORD(Log->LoggedListHead.Flink, NTFS_LOG_SECTOR, ListEntry));
+            RecordCount = 0;
+            break;
+        }
+
+        Log->WriteOffset += Header->Length;
+        Log->NextSequence++;
+    }
+
+    ExFreePoolWithTag(Header, TAG_LOG);
+
+    return RecordCount;
+}
+
+/* Reads the file record of $MFT again, and forgets the file records read before the log was replayed */
+static
+VOID
+NtfsLogReloadMasterFileTable(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_ATTR_CONTEXT MftContext;
+    NTSTATUS Status;
+
+    NtfsUninitializeMftCache(Vcb);
+    NtfsInitializeMftCache(Vcb);
+
+    if (ReadAttribute(Vcb, Vcb->MFTContext, 0, (PCHAR)Vcb->MasterFileTable, Vcb->NtfsInfo.BytesPerFileRecord) != Vcb->NtfsInfo.BytesPerFileRecord)
+    {
+        DPRINT1("Failed reading MFT.\n");
+        return;
+    }
+
+    Status = FixupUpdateSequenceArray(Vcb, &Vcb->MasterFileTable->Ntfs);
+    if (NT_SUCCESS(Status))
+        Status = FindAttribute(Vcb, Vcb->MasterFileTable, AttributeData, L"", 0, &MftContext, &Vcb->MftDataOffset);
+
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Can't find data attribute for Master File Table (Status %lx).\n", Status);
+        return;
+    }
+
+    ReleaseAttributeContext(Vcb->MFTContext);
+    Vcb->MFTContext = MftContext;
+}
+
+/* Reads the restart page of the Windows log, returns FALSE if it holds changes that weren't written in place */
+static
+BOOLEAN
+NtfsLogIsWindowsLogClean(PUCHAR RestartPage,
+                         ULONG Length)
+{
+    USHORT RestartAreaOffset = *(PUSHORT)(RestartPage + 0x18);
+    USHORT ClientInUseList, Flags;
+
+    if (RestartAreaOffset + 0x10 > Length)
+        return FALSE;
+
+    ClientInUseList = *(PUSHORT)(RestartPage + RestartAreaOffset + 0x0C);
+    Flags = *(PUSHORT)(RestartPage + RestartAreaOffset + 0x0E);
+
+    return ClientInUseList == LFS_NO_CLIENT || (Flags & LFS_RESTART_VOLUME_IS_CLEAN);
+}
+
+/* Starts an empty log, after Windows used $LogFile or on a new volume */
+static
+NTSTATUS
+NtfsLogReset(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+    ULONG BytesPerSector = Vcb->NtfsInfo.BytesPerSector;
+    ULONG LengthWritten;
+    PUCHAR Buffer;
+    NTSTATUS Status;
+
+    Buffer = ExAllocatePoolWithTag(PagedPool, NTFS_LOG_RESTART_OFFSET, TAG_LOG);
+    if (Buffer == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    // Windows starts a new log when its restart pages are filled with 0xFF, like after a format
+    RtlFillMemory(Buffer, NTFS_LOG_RESTART_OFFSET, 0xFF);
+    Status = WriteAttribute(Vcb, Log->DataContext, 0, Buffer, NTFS_LOG_RESTART_OFFSET, &LengthWritten, NULL);
+
+    // Records of an older log mustn't follow the new restart area
+    if (NT_SUCCESS(Status))
+    {
+        RtlZeroMemory(Buffer, BytesPerSector);
+        Status = WriteAttribute(Vcb, Log->DataContext, Log->AreaStart, Buffer, BytesPerSector, &LengthWritten, NULL);
+    }
+
+    ExFreePoolWithTag(Buffer, TAG_LOG);
+
+    Log->WriteOffset = Log->AreaStart;
+
+    if (NT_SUCCESS(Status))
+        Status = NtfsLogWriteRestartArea(Vcb);
+
+    return Status;
+}
+
+/**
+* @name NtfsInitializeLog
+* @implemented
+*
+* Opens the journal of a volume being mounted, and applies the records that a crash
+* prevented from being written in place.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume. Its MFT cache must be initialized.
+*
+* @remarks
+* Never fails the mount: if $LogFile can't be used, the metadata is written in place
+* right away, like it was before the journal. This is the case when write support is
+* disabled, and when $LogFile holds changes that Windows didn't write in place yet, which
+* only Windows can apply.
+*/
+VOID
+NtfsInitializeLog(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+    ULONG BytesPerSector = Vcb->NtfsInfo.BytesPerSector;
+    PFILE_RECORD_HEADER LogFileRecord;
+    PNTFS_LOG_RESTART_AREA RestartArea;
+    PUCHAR Buffer = NULL;
+    ULONGLONG LogSize;
+    BOOLEAN Owned, Valid;
+    ULONG RecordCount = 0;
+    ULONG i;
+    NTSTATUS Status;
+
+    RtlZeroMemory(Log, sizeof(NTFS_LOG));
+    ExInitializeResourceLite(&Log->OperationResource);
+    ExInitializeResourceLite(&Log->Resource);
+    ExInitializeNPagedLookasideList(&Log->SectorLookasideList,
+                                    NULL,
+                                    NULL,
+                                    0,
+                                    sizeof(NTFS_LOG_SECTOR) + BytesPerSector,
+                                    TAG_LOG,
+                                    0);
+    for (i = 0; i < NTFS_LOG_BUCKETS; i++)
+        InitializeListHead(&Log->HashBuckets[i]);
+    InitializeListHead(&Log->UnloggedListHead);
+    InitializeListHead(&Log->LoggedListHead);
+    KeInitializeTimer(&Log->CommitTimer);
+    KeInitializeDpc(&Log->CommitDpc, NtfsLogCommitDpc, Vcb);
+    ExInitializeWorkItem(&Log->CommitWorkItem, NtfsLogCommitWorker, Vcb);
+
+    LogFileRecord = ExAllocateFromNPagedLookasideList(&Vcb->FileRecLookasideList);
+    if (LogFileRecord == NULL)
+        return;
+
+    Status = ReadFileRecord(Vcb, NTFS_FILE_LOGFILE, LogFileRecord);
+    if (NT_SUCCESS(Status))
+        Status = FindAttribute(Vcb, LogFileRecord, AttributeData, L"", 0, &Log->DataContext, NULL);
+
+    ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, LogFileRecord);
+
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Can't open $LogFile (Status %lx), metadata won't be journaled\n", Status);
+        Log->DataContext = NULL;
+        return;
+    }
+
+    LogSize = AttributeDataLength(Log->DataContext->pRecord);
+    if (!Log->DataContext->pRecord->IsNonResident || LogSize < NTFS_LOG_AREA_OFFSET + NTFS_LOG_MIN_AREA)
+    {
+        DPRINT1("$LogFile is too small (%I64u bytes), metadata won't be journaled\n", LogSize);
+        return;
+    }
+
+    Log->AreaStart = NTFS_LOG_AREA_OFFSET;
+    Log->AreaEnd = ROUND_DOWN(min(LogSize, NTFS_LOG_AREA_OFFSET + NTFS_LOG_MAX_AREA), BytesPerSector);
+    Log->WriteOffset = Log->AreaStart;
+
+    Buffer = ExAllocatePoolWithTag(PagedPool, BytesPerSector, TAG_LOG);
+    if (Buffer == NULL)
+        return;
+
+    if (ReadAttribute(Vcb, Log->DataContext, 0, (PCHAR)Buffer, BytesPerSector) != BytesPerSector)
+    {
+        DPRINT1("Can't read $LogFile, metadata won't be journaled\n");
+        goto Cleanup;
+    }
+
+    // 0xFF is what we leave there. Anything else is the log of Windows, which had the volume since.
+    if (*(PULONG)Buffer == 0xFFFFFFFF)
+    {
+        Owned = TRUE;
+    }
+    else if (*(PULONG)Buffer == LFS_RESTART_SIGNATURE && NtfsLogIsWindowsLogClean(Buffer, BytesPerSector))
+    {
+        Owned = FALSE;
+    }
+    else
+    {
+        DPRINT1("$LogFile holds changes that Windows must apply first, metadata won't be journaled\n");
+        goto Cleanup;
+    }
+
+    if (ReadAttribute(Vcb, Log->DataContext, NTFS_LOG_RESTART_OFFSET, (PCHAR)Buffer, BytesPerSector) != BytesPerSector)
+    {
+        DPRINT1("Can't read $LogFile, metadata won't be journaled\n");
+        goto Cleanup;
+    }
+
+    RestartArea = (PNTFS_LOG_RESTART_AREA)Buffer;
+    i = RestartArea->Checksum;
+    RestartArea->Checksum = 0;
+    Valid = (RestartArea->Signature == NTFS_LOG_RESTART_SIGNATURE &&
+             RestartArea->Version == NTFS_LOG_VERSION &&
+             RestartArea->AreaStart == Log->AreaStart &&
+             RestartArea->AreaEnd == Log->AreaEnd &&
+             NtfsLogChecksum(Buffer, sizeof(NTFS_LOG_RESTART_AREA)) == i);
+
+    if (Owned && Valid)
+    {
+        Log->NextSequence = RestartArea->NextSequence;
+        Log->VolumeDirty = Log->ClearVolumeDirty = BooleanFlagOn(RestartArea->Flags, NTFS_LOG_CLEAR_VOLUME_DIRTY);
+        RecordCount = NtfsLogReplay(Vcb);
+        if (RecordCount != 0)
+        {
+            DPRINT1("Applying %lu log records (%lu sectors)\n", RecordCount, Log->LoggedCount);
+            NtfsLogReloadMasterFileTable(Vcb);
+        }
+    }
+    else if (NtfsGlobalData->EnableWriteSupport)
+    {
+        Log->NextSequence = Valid ? RestartArea->NextSequence + 1 : 1;
+        Status = NtfsLogReset(Vcb);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Can't initialize $LogFile (Status %lx), metadata won't be journaled\n", Status);
+            goto Cleanup;
+        }
+    }
+
+    // Without write support, the replayed sectors stay in memory for the reads
+    if (!NtfsGlobalData->EnableWriteSupport)
+        goto Cleanup;
+
+    Log->Enabled = TRUE;
+    KeQuerySystemTime(&Log->LastCommitTime);
+
+    if (RecordCount != 0 || Log->ClearVolumeDirty)
+    {
+        Status = NtfsLogFlush(Vcb, TRUE);
+        if (!NT_SUCCESS(Status))
+            DPRINT1("Writing back the log records failed (Status %lx)\n", Status);
+    }
+
+Cleanup:
+    ExFreePoolWithTag(Buffer, TAG_LOG);
+}
+
+/**
+* @name NtfsUninitializeLog
+* @implemented
+*
+* Writes the pending metadata to the log and in place, then frees the journal of a volume.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume. No request may be in progress on it.
+*
+* @remarks
+* Must be called after NtfsUninitializeMftCache(), so that the file records it writes back
+* are in the journal.
+*/
+VOID
+NtfsUninitializeLog(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_LOG Log = &Vcb->Log;
+
+    if (Log->Enabled)
+    {
+        KeCancelTimer(&Log->CommitTimer);
+        NtfsLogFlush(Vcb, TRUE);
+        Log->Enabled = FALSE;
+
+        DPRINT("Log: %I64u commits of %I64u sectors, %I64u checkpoints\n", Log->Commits, Log->CommittedSectors, Log->Checkpoints);
+    }
+
+    if (Log->UnloggedCount + Log->LoggedCount != 0)
+        DPRINT1("Dropping %lu journaled sectors\n", Log->UnloggedCount + Log->LoggedCount);
+
+    while (!IsListEmpty(&Log->UnloggedListHead))
+        NtfsLogFreeSector(Log, CONTAINING_RECORD(Log->UnloggedListHead.Flink, NTFS_LOG_SECTOR, ListEntry));
+    while (!IsListEmpty(&Log->LoggedListHead))
+        NtfsLogFreeSector(Log, CONTAINING_RECORD(Log->LoggedListHead.Flink, NTFS_LOG_SECTOR, ListEntry));
+
+    if (Log->DataContext != NULL)
+    {
+        ReleaseAttributeContext(Log->DataContext);
+        Log->DataContext = NULL;
+    }
+
+    ExDeleteNPagedLookasideList(&Log->SectorLookasideList);
+    ExDeleteResourceLite(&Log->Resource);
+    ExDeleteResourceLite(&Log->OperationResource);
+}
+
+/* EOF */
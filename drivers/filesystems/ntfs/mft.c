@@ -61,31 +61,14 @@ PrepareAttributeContext(PNTFS_ATTR_RECORD AttrRecord)
     // Copy the attribute
     RtlCopyMemory(Context->pRecord, AttrRecord, AttrRecord->Length);
 
+    // Nothing looked up yet
+    Context->CachedRunLength = 0;
+
     if (AttrRecord->IsNonResident)
     {
-        LONGLONG DataRunOffset;
-        ULONGLONG DataRunLength;
         ULONGLONG NextVBN = 0;
         PUCHAR DataRun = (PUCHAR)((ULONG_PTR)Context->pRecord + Context->pRecord->NonResident.MappingPairsOffset);
 
-        Context->CacheRun = DataRun;
-        Context->CacheRunOffset = 0;
-        Context->CacheRun = DecodeRun(Context->CacheRun, &DataRunOffset, &DataRunLength);
-        Context->CacheRunLength = DataRunLength;
-        if (DataRunOffset != -1)
-        {
-            /* Normal run. */
-            Context->CacheRunStartLCN =
-            Context->CacheRunLastLCN = DataRunOffset;
-        }
-        else
-        {
-            /* Sparse run. */
-            Context->CacheRunStartLCN = -1;
-            Context->CacheRunLastLCN = 0;
-        }
-        Context->CacheRunCurrentOffset = 0;
-
         // Convert the data runs to a map control block
         if (!NT_SUCCESS(ConvertDataRunsToLargeMCB(DataRun, &Context->DataRunsMCB, &NextVBN)))
         {
@@ -639,6 +622,10 @@ SetAttributeDataLength(PFILE_OBJECT FileObject,
         }
     }
 
+    // cached compression units past the new end would be stale
+    if (AttrContext->pRecord->Flags & ATTR_FLAG_COMPRESSED)
+        NtfsInvalidateCompressionCache(Fcb->Vcb, AttrContext->FileMFTIndex);
+
     if (AttrContext->pRecord->IsNonResident)
     {
         Status = SetNonResidentAttributeDataLength(Fcb->Vcb,
@@ -767,17 +754,32 @@ SetNonResidentAttributeDataLength(PDEVICE_EXTENSION Vcb,
 
     ASSERT(AttrContext->pRecord->IsNonResident);
 
+    // a sparse attribute grows by a hole, clusters are only allocated when they're written to
+    if ((AttrContext->pRecord->Flags & ATTR_FLAG_SPARSE) &&
+        AttrContext->pRecord->NonResident.AllocatedSize < AllocationSize)
+    {
+        AttrContext->pRecord->NonResident.HighestVCN = (AllocationSize / BytesPerCluster) - 1;
+        AttrContext->CachedRunLength = 0;
+
+        Status = StoreDataRuns(Vcb, AttrContext, AttrOffset, FileRecord);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Error: Unable to store data runs!\n");
+            return Status;
+        }
+    }
     // do we need to increase the allocation size?
-    if (AttrContext->pRecord->NonResident.AllocatedSize < AllocationSize)
+    else if (AttrContext->pRecord->NonResident.AllocatedSize < AllocationSize)
     {
         ULONG ClustersNeeded = (AllocationSize / BytesPerCluster) - ExistingClusters;
         LARGE_INTEGER LastClusterInDataRun;
-        ULONG NextAssignedCluster;
+        ULONGLONG NextAssignedCluster;
         ULONG AssignedClusters;
 
         if (ExistingClusters == 0)
         {
-            LastClusterInDataRun.QuadPart = 0;
+            // No preference, the next cluster is 0
+            LastClusterInDataRun.QuadPart = -1;
         }
         else
         {
@@ -803,8 +805,9 @@ SetNonResidentAttributeDataLength(PDEVICE_EXTENSION Vcb,
         while (ClustersNeeded > 0)
         {
             Status = NtfsAllocateClusters(Vcb,
-                                          LastClusterInDataRun.LowPart + 1,
+                                          LastClusterInDataRun.QuadPart + 1,
                                           ClustersNeeded,
+                                          AttrContext->FileMFTIndex == NTFS_FILE_MFT,
                                           &NextAssignedCluster,
                                           &AssignedClusters);
 
@@ -823,7 +826,7 @@ SetNonResidentAttributeDataLength(PDEVICE_EXTENSION Vcb,
             }
 
             ClustersNeeded -= AssignedClusters;
-            LastClusterInDataRun.LowPart = NextAssignedCluster + AssignedClusters - 1;
+            LastClusterInDataRun.QuadPart = NextAssignedCluster + AssignedClusters - 1;
         }
     }
     else if (AttrContext->pRecord->NonResident.AllocatedSize > AllocationSize)
@@ -833,7 +836,7 @@ SetNonResidentAttributeDataLength(PDEVICE_EXTENSION Vcb,
         Status = FreeClusters(Vcb, AttrContext, AttrOffset, FileRecord, ClustersToFree);
     }
 
-    // TODO: is the file compressed, encrypted, or sparse?
+    // TODO: is the file compressed or encrypted?
 
     AttrContext->pRecord->NonResident.AllocatedSize = AllocationSize;
     AttrContext->pRecord->NonResident.DataSize = DataSize->QuadPart;
@@ -844,7 +847,7 @@ SetNonResidentAttributeDataLength(PDEVICE_EXTENSION Vcb,
     DestinationAttribute->NonResident.InitializedSize = DataSize->QuadPart;
 
     // HighestVCN seems to be set incorrectly somewhere. Apply a hack-fix to reset it.
-    // HACKHACK FIXME: Fix for sparse files; this math won't work in that case.
+    // Holes are included in AllocatedSize, so this math holds for sparse files as well.
     AttrContext->pRecord->NonResident.HighestVCN = ((ULONGLONG)AllocationSize / Vcb->NtfsInfo.BytesPerCluster) - 1;
     DestinationAttribute->NonResident.HighestVCN = AttrContext->pRecord->NonResident.HighestVCN;
 
@@ -998,6 +1001,7 @@ SetResidentAttributeDataLength(PDEVICE_EXTENSION Vcb,
                 _SEH2_TRY
                 {
                     FsRtlInitializeLargeMcb(&AttrContext->DataRunsMCB, NonPagedPool);
+                    AttrContext->CachedRunLength = 0;
                 }
                 _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
                 {
@@ -1050,6 +1054,19 @@ SetResidentAttributeDataLength(PDEVICE_EXTENSION Vcb,
 
                     ExFreePoolWithTag(AttribData, TAG_NTFS);
                 }
+
+                // The stream of a sparse file becomes sparse once it's out of the file record
+                if (AttrContext->pRecord->Type == AttributeData)
+                {
+                    PSTANDARD_INFORMATION StandardInfo = GetStandardInformationFromRecord(Vcb, FileRecord);
+
+                    if (StandardInfo != NULL && (StandardInfo->FileAttribute & NTFS_FILE_TYPE_SPARSE))
+                    {
+                        Status = NtfsMakeAttributeSparse(Vcb, AttrContext, AttrOffset, FileRecord);
+                        if (!NT_SUCCESS(Status))
+                            return Status;
+                    }
+                }
             }
         }
     }
@@ -1061,315 +1078,561 @@ SetResidentAttributeDataLength(PDEVICE_EXTENSION Vcb,
     return STATUS_SUCCESS;
 }
 
-ULONG
-ReadAttribute(PDEVICE_EXTENSION Vcb,
-              PNTFS_ATTR_CONTEXT Context,
-              ULONGLONG Offset,
-              PCHAR Buffer,
-              ULONG Length)
+/**
+* @name NtfsInitializeCompressionCache
+* @implemented
+*
+* Initializes the cache of decoded compression units of a volume.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @remarks
+* The cache holds at most NTFS_COMPRESSION_CACHE_MAX_ENTRIES units and evicts the least recently
+* used one, so that sequential readers of a compressed stream decode every unit only once.
+*/
+VOID
+NtfsInitializeCompressionCache(PDEVICE_EXTENSION Vcb)
 {
-    ULONGLONG LastLCN;
-    PUCHAR DataRun;
-    LONGLONG DataRunOffset;
-    ULONGLONG DataRunLength;
-    LONGLONG DataRunStartLCN;
-    ULONGLONG CurrentOffset;
-    ULONG ReadLength;
-    ULONG AlreadyRead;
-    NTSTATUS Status;
+    PNTFS_COMPRESSION_CACHE Cache = &Vcb->CompressionCache;
 
-    //TEMPTEMP
-    PUCHAR TempBuffer;
+    ExInitializeResourceLite(&Cache->Resource);
+    InitializeListHead(&Cache->LruListHead);
+    Cache->EntryCount = 0;
+    Cache->Hits = 0;
+    Cache->Misses = 0;
+}
 
-    if (!Context->pRecord->IsNonResident)
-    {
-        // We need to truncate Offset to a ULONG for pointer arithmetic
-        // The check below should ensure that Offset is well within the range of 32 bits
-        ULONG LittleOffset = (ULONG)Offset;
+/**
+* @name NtfsUninitializeCompressionCache
+* @implemented
+*
+* Frees all the entries of the cache of decoded compression units.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*/
+VOID
+NtfsUninitializeCompressionCache(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_COMPRESSION_CACHE Cache = &Vcb->CompressionCache;
+    PNTFS_COMPRESSION_CACHE_ENTRY Entry;
 
-        // Ensure that offset isn't beyond the end of the attribute
-        if (Offset > Context->pRecord->Resident.ValueLength)
-            return 0;
-        if (Offset + Length > Context->pRecord->Resident.ValueLength)
-            Length = (ULONG)(Context->pRecord->Resident.ValueLength - Offset);
+    DPRINT("Compression cache: %I64u hits, %I64u misses\n", Cache->Hits, Cache->Misses);
 
-        RtlCopyMemory(Buffer, (PVOID)((ULONG_PTR)Context->pRecord + Context->pRecord->Resident.ValueOffset + LittleOffset), Length);
-        return Length;
+    while (!IsListEmpty(&Cache->LruListHead))
+    {
+        Entry = CONTAINING_RECORD(RemoveHeadList(&Cache->LruListHead), NTFS_COMPRESSION_CACHE_ENTRY, LruListEntry);
+        ExFreePoolWithTag(Entry, TAG_COMPRESSION);
     }
+    Cache->EntryCount = 0;
 
-    /*
-     * Non-resident attribute
-     */
+    ExDeleteResourceLite(&Cache->Resource);
+}
 
-    /*
-     * I. Find the corresponding start data run.
-     */
+/**
+* @name NtfsInvalidateCompressionCache
+* @implemented
+*
+* Drops the decoded compression units of every stream of a file record.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @param MftIndex
+* Index of the file record whose streams are changing.
+*/
+VOID
+NtfsInvalidateCompressionCache(PDEVICE_EXTENSION Vcb,
+                               ULONGLONG MftIndex)
+{
+    PNTFS_COMPRESSION_CACHE Cache = &Vcb->CompressionCache;
+    PNTFS_COMPRESSION_CACHE_ENTRY Entry;
+    PLIST_ENTRY ListEntry;
 
-    AlreadyRead = 0;
+    ExAcquireResourceExclusiveLite(&Cache->Resource, TRUE);
 
-    // FIXME: Cache seems to be non-working. Disable it for now
-    //if(Context->CacheRunOffset <= Offset && Offset < Context->CacheRunOffset + Context->CacheRunLength * Volume->ClusterSize)
-    if (0)
-    {
-        DataRun = Context->CacheRun;
-        LastLCN = Context->CacheRunLastLCN;
-        DataRunStartLCN = Context->CacheRunStartLCN;
-        DataRunLength = Context->CacheRunLength;
-        CurrentOffset = Context->CacheRunCurrentOffset;
-    }
-    else
+    ListEntry = Cache->LruListHead.Flink;
+    while (ListEntry != &Cache->LruListHead)
     {
-        //TEMPTEMP
-        ULONG UsedBufferSize;
-        TempBuffer = ExAllocatePoolWithTag(NonPagedPool, Vcb->NtfsInfo.BytesPerFileRecord, TAG_NTFS);
-        if (TempBuffer == NULL)
-        {
-            return STATUS_INSUFFICIENT_RESOURCES;
-        }
+        Entry = CONTAINING_RECORD(ListEntry, NTFS_COMPRESSION_CACHE_ENTRY, LruListEntry);
+        ListEntry = ListEntry->Flink;
 
-        LastLCN = 0;
-        CurrentOffset = 0;
-
-        // This will be rewritten in the next iteration to just use the DataRuns MCB directly
-        ConvertLargeMCBToDataRuns(&Context->DataRunsMCB,
-                                  TempBuffer,
-                                  Vcb->NtfsInfo.BytesPerFileRecord,
-                                  &UsedBufferSize);
-
-        DataRun = TempBuffer;
-
-        while (1)
+        if (Entry->MftIndex == MftIndex)
         {
-            DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
-            if (DataRunOffset != -1)
-            {
-                /* Normal data run. */
-                DataRunStartLCN = LastLCN + DataRunOffset;
-                LastLCN = DataRunStartLCN;
-            }
-            else
-            {
-                /* Sparse data run. */
-                DataRunStartLCN = -1;
-            }
-
-            if (Offset >= CurrentOffset &&
-                Offset < CurrentOffset + (DataRunLength * Vcb->NtfsInfo.BytesPerCluster))
-            {
-                break;
-            }
-
-            if (*DataRun == 0)
-            {
-                ExFreePoolWithTag(TempBuffer, TAG_NTFS);
-                return AlreadyRead;
-            }
-
-            CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
+            RemoveEntryList(&Entry->LruListEntry);
+            ExFreePoolWithTag(Entry, TAG_COMPRESSION);
+            Cache->EntryCount--;
         }
     }
 
-    /*
-     * II. Go through the run list and read the data
-     */
+    ExReleaseResourceLite(&Cache->Resource);
+}
 
-    ReadLength = (ULONG)min(DataRunLength * Vcb->NtfsInfo.BytesPerCluster - (Offset - CurrentOffset), Length);
-    if (DataRunStartLCN == -1)
-    {
-        RtlZeroMemory(Buffer, ReadLength);
-        Status = STATUS_SUCCESS;
-    }
-    else
-    {
-        Status = NtfsReadDisk(Vcb->StorageDevice,
-                              DataRunStartLCN * Vcb->NtfsInfo.BytesPerCluster + Offset - CurrentOffset,
-                              ReadLength,
-                              Vcb->NtfsInfo.BytesPerSector,
-                              (PVOID)Buffer,
-                              FALSE);
-    }
-    if (NT_SUCCESS(Status))
-    {
-        Length -= ReadLength;
-        Buffer += ReadLength;
-        AlreadyRead += ReadLength;
+/* Must be called with the cache resource held. On a hit, the entry becomes the most recently used one. */
+static
+PNTFS_COMPRESSION_CACHE_ENTRY
+NtfsLookupCompressionCacheEntry(PNTFS_COMPRESSION_CACHE Cache,
+                                PNTFS_ATTR_CONTEXT Context,
+                                ULONGLONG UnitVcn)
+{
+    PNTFS_COMPRESSION_CACHE_ENTRY Entry;
+    PLIST_ENTRY ListEntry;
 
-        if (ReadLength == DataRunLength * Vcb->NtfsInfo.BytesPerCluster - (Offset - CurrentOffset))
+    for (ListEntry = Cache->LruListHead.Flink; ListEntry != &Cache->LruListHead; ListEntry = ListEntry->Flink)
+    {
+        Entry = CONTAINING_RECORD(ListEntry, NTFS_COMPRESSION_CACHE_ENTRY, LruListEntry);
+        if (Entry->MftIndex == Context->FileMFTIndex &&
+            Entry->Instance == Context->pRecord->Instance &&
+            Entry->UnitVcn == UnitVcn)
         {
-            CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
-            DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
-            if (DataRunOffset != (ULONGLONG)-1)
-            {
-                DataRunStartLCN = LastLCN + DataRunOffset;
-                LastLCN = DataRunStartLCN;
-            }
-            else
-                DataRunStartLCN = -1;
+            RemoveEntryList(&Entry->LruListEntry);
+            InsertHeadList(&Cache->LruListHead, &Entry->LruListEntry);
+            return Entry;
         }
+    }
 
-        while (Length > 0)
-        {
-            ReadLength = (ULONG)min(DataRunLength * Vcb->NtfsInfo.BytesPerCluster, Length);
-            if (DataRunStartLCN == -1)
-                RtlZeroMemory(Buffer, ReadLength);
-            else
-            {
-                Status = NtfsReadDisk(Vcb->StorageDevice,
-                                      DataRunStartLCN * Vcb->NtfsInfo.BytesPerCluster,
-                                      ReadLength,
-                                      Vcb->NtfsInfo.BytesPerSector,
-                                      (PVOID)Buffer,
-                                      FALSE);
-                if (!NT_SUCCESS(Status))
-                    break;
-            }
-
-            Length -= ReadLength;
-            Buffer += ReadLength;
-            AlreadyRead += ReadLength;
-
-            /* We finished this request, but there still data in this data run. */
-            if (Length == 0 && ReadLength != DataRunLength * Vcb->NtfsInfo.BytesPerCluster)
-                break;
+    return NULL;
+}
 
-            /*
-             * Go to next run in the list.
-             */
+/* Must be called with the cache resource held exclusively. Recycles the least recently used entry when the cache is full. */
+static
+PNTFS_COMPRESSION_CACHE_ENTRY
+NtfsAllocateCompressionCacheEntry(PNTFS_COMPRESSION_CACHE Cache,
+                                  ULONG UnitSize)
+{
+    PNTFS_COMPRESSION_CACHE_ENTRY Entry;
 
-            if (*DataRun == 0)
-                break;
-            CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
-            DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
-            if (DataRunOffset != -1)
-            {
-                /* Normal data run. */
-                DataRunStartLCN = LastLCN + DataRunOffset;
-                LastLCN = DataRunStartLCN;
-            }
-            else
-            {
-                /* Sparse data run. */
-                DataRunStartLCN = -1;
-            }
-        } /* while */
+    if (Cache->EntryCount >= NTFS_COMPRESSION_CACHE_MAX_ENTRIES)
+    {
+        Entry = CONTAINING_RECORD(RemoveTailList(&Cache->LruListHead), NTFS_COMPRESSION_CACHE_ENTRY, LruListEntry);
+        Cache->EntryCount--;
 
-    } /* if Disk */
+        if (Entry->BufferSize >= UnitSize)
+            return Entry;
 
-    // TEMPTEMP
-    if (Context->pRecord->IsNonResident)
-        ExFreePoolWithTag(TempBuffer, TAG_NTFS);
+        ExFreePoolWithTag(Entry, TAG_COMPRESSION);
+    }
 
-    Context->CacheRun = DataRun;
-    Context->CacheRunOffset = Offset + AlreadyRead;
-    Context->CacheRunStartLCN = DataRunStartLCN;
-    Context->CacheRunLength = DataRunLength;
-    Context->CacheRunLastLCN = LastLCN;
-    Context->CacheRunCurrentOffset = CurrentOffset;
+    Entry = ExAllocatePoolWithTag(PagedPool, sizeof(NTFS_COMPRESSION_CACHE_ENTRY) + UnitSize, TAG_COMPRESSION);
+    if (Entry == NULL)
+        return NULL;
 
-    return AlreadyRead;
+    Entry->BufferSize = UnitSize;
+    return Entry;
 }
 
-
 /**
-* @name WriteAttribute
+* @name NtfsReadCompressionUnit
 * @implemented
 *
-* Writes an NTFS attribute to the disk. It presently borrows a lot of code from ReadAttribute(),
-* and it still needs more documentation / cleaning up.
+* Reads and decodes one compression unit of a compressed, non-resident attribute.
 *
 * @param Vcb
-* Volume Control Block indicating which volume to write the attribute to
+* Volume Control Block of the volume the attribute is on.
 *
 * @param Context
-* Pointer to an NTFS_ATTR_CONTEXT that has information about the attribute
-*
-* @param Offset
-* Offset, in bytes, from the beginning of the attribute indicating where to start
-* writing data
+* Pointer to an NTFS_ATTR_CONTEXT of the compressed attribute.
 *
-* @param Buffer
-* The data that's being written to the device
+* @param UnitVcn
+* First VCN of the unit, a multiple of the number of clusters per unit.
 *
-* @param Length
-* How much data will be written, in bytes
+* @param UnitClusters
+* Number of clusters per compression unit.
 *
-* @param RealLengthWritten
-* Pointer to a ULONG which will receive how much data was written, in bytes
+* @param UnitBuffer
+* Buffer of UnitClusters clusters that receives the decoded unit.
 *
-* @param FileRecord
-* Optional pointer to a FILE_RECORD_HEADER that contains a copy of the file record
-* being written to. Can be NULL, in which case the file record will be read from disk.
-* If not-null, WriteAttribute() will skip reading from disk, and FileRecord
-* will be updated with the newly-written attribute before the function returns.
+* @param CompressedBuffer
+* Scratch buffer of UnitClusters clusters used for the compressed data.
 *
 * @return
-* STATUS_SUCCESS if successful, an error code otherwise. STATUS_NOT_IMPLEMENTED if
-* writing to a sparse file.
-*
-* @remarks Note that in this context the word "attribute" isn't referring read-only, hidden,
-* etc. - the file's data is actually stored in an attribute in NTFS parlance.
+* STATUS_SUCCESS on success, the error of NtfsReadDisk() or RtlDecompressBuffer() otherwise.
 *
+* @remarks
+* A unit whose clusters are all allocated is stored uncompressed, a unit without any allocated
+* cluster is sparse. Otherwise the allocated clusters at the beginning of the unit hold the LZNT1
+* data, and the sparse tail only tells how much space compression saved.
 */
-
+static
 NTSTATUS
-WriteAttribute(PDEVICE_EXTENSION Vcb,
-               PNTFS_ATTR_CONTEXT Context,
-               ULONGLONG Offset,
-               const PUCHAR Buffer,
-               ULONG Length,
-               PULONG RealLengthWritten,
-               PFILE_RECORD_HEADER FileRecord)
+NtfsReadCompressionUnit(PDEVICE_EXTENSION Vcb,
+                        PNTFS_ATTR_CONTEXT Context,
+                        ULONGLONG UnitVcn,
+                        ULONG UnitClusters,
+                        PUCHAR UnitBuffer,
+                        PUCHAR CompressedBuffer)
 {
-    ULONGLONG LastLCN;
-    PUCHAR DataRun;
-    LONGLONG DataRunOffset;
-    ULONGLONG DataRunLength;
-    LONGLONG DataRunStartLCN;
-    ULONGLONG CurrentOffset;
-    ULONG WriteLength;
+    ULONG BytesPerCluster = Vcb->NtfsInfo.BytesPerCluster;
+    ULONG UnitSize = UnitClusters * BytesPerCluster;
+    ULONG Allocated, Cluster, RunClusters, FinalSize;
+    LONGLONG Lcn;
+    ULONGLONG RunLength;
+    PUCHAR Target;
     NTSTATUS Status;
-    PUCHAR SourceBuffer = Buffer;
-    LONGLONG StartingOffset;
-    BOOLEAN FileRecordAllocated = FALSE;
 
-    //TEMPTEMP
-    PUCHAR TempBuffer;
+    // Count the allocated clusters of the unit
+    Allocated = 0;
+    for (Cluster = 0; Cluster < UnitClusters; Cluster += RunClusters)
+    {
+        if (!NtfsLookupAttributeRun(Context, UnitVcn + Cluster, &Lcn, &RunLength))
+            break;
 
+        RunClusters = (ULONG)min(RunLength, UnitClusters - Cluster);
+        if (Lcn != -1)
+            Allocated += RunClusters;
+    }
 
-    DPRINT("WriteAttribute(%p, %p, %I64u, %p, %lu, %p, %p)\n", Vcb, Context, Offset, Buffer, Length, RealLengthWritten, FileRecord);
+    if (Allocated == 0)
+    {
+        RtlZeroMemory(UnitBuffer, UnitSize);
+        return STATUS_SUCCESS;
+    }
 
-    *RealLengthWritten = 0;
+    // An uncompressed unit is read in place
+    Target = (Allocated == UnitClusters) ? UnitBuffer : CompressedBuffer;
 
-    // is this a resident attribute?
-    if (!Context->pRecord->IsNonResident)
+    Allocated = 0;
+    for (Cluster = 0; Cluster < UnitClusters; Cluster += RunClusters)
     {
-        ULONG AttributeOffset;
-        PNTFS_ATTR_CONTEXT FoundContext;
-        PNTFS_ATTR_RECORD Destination;
+        if (!NtfsLookupAttributeRun(Context, UnitVcn + Cluster, &Lcn, &RunLength))
+            break;
 
-        // Ensure requested data is within the bounds of the attribute
-        ASSERT(Offset + Length <= Context->pRecord->Resident.ValueLength);
+        RunClusters = (ULONG)min(RunLength, UnitClusters - Cluster);
+        if (Lcn == -1)
+            continue;
 
-        if (Offset + Length > Context->pRecord->Resident.ValueLength)
+        Status = NtfsReadDisk(Vcb->StorageDevice,
+                              Lcn * BytesPerCluster,
+                              RunClusters * BytesPerCluster,
+                              Vcb->NtfsInfo.BytesPerSector,
+                              Target + Allocated * BytesPerCluster,
+                              FALSE);
+        if (!NT_SUCCESS(Status))
+            return Status;
+
+        Allocated += RunClusters;
+    }
+
+    if (Target == UnitBuffer)
+        return STATUS_SUCCESS;
+
+    Status = RtlDecompressBuffer(COMPRESSION_FORMAT_LZNT1,
+                                 UnitBuffer,
+                                 UnitSize,
+                                 CompressedBuffer,
+                                 Allocated * BytesPerCluster,
+                                 &FinalSize);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Corrupted compression unit at VCN 0x%I64x of file 0x%I64x (0x%08lx)\n", UnitVcn, Context->FileMFTIndex, Status);
+        return Status;
+    }
+
+    // What the LZNT1 stream doesn't cover is zero
+    if (FinalSize < UnitSize)
+        RtlZeroMemory(UnitBuffer + FinalSize, UnitSize - FinalSize);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+* @name ReadCompressedAttribute
+* @implemented
+*
+* ReadAttribute() counterpart for compressed, non-resident attributes. Units are decoded through
+* the volume's compression cache.
+*
+* @return
+* The number of bytes read, which is 0 on failure.
+*/
+static
+ULONG
+ReadCompressedAttribute(PDEVICE_EXTENSION Vcb,
+                        PNTFS_ATTR_CONTEXT Context,
+                        ULONGLONG Offset,
+                        PCHAR Buffer,
+                        ULONG Length)
+{
+    PNTFS_COMPRESSION_CACHE Cache = &Vcb->CompressionCache;
+    PNTFS_COMPRESSION_CACHE_ENTRY Entry;
+    ULONG UnitClusters, UnitSize, UnitOffset, CopyLength;
+    ULONG AlreadyRead = 0;
+    ULONGLONG UnitVcn, AllocatedSize;
+    PUCHAR CompressedBuffer = NULL;
+    NTSTATUS Status;
+
+    UnitClusters = 1 << Context->pRecord->NonResident.CompressionUnit;
+    UnitSize = UnitClusters * Vcb->NtfsInfo.BytesPerCluster;
+
+    // Allocated size of a compressed stream is a multiple of the unit size
+    AllocatedSize = Context->pRecord->NonResident.AllocatedSize;
+    if (Offset >= AllocatedSize)
+        return 0;
+    if (Offset + Length > AllocatedSize)
+        Length = (ULONG)(AllocatedSize - Offset);
+
+    ExAcquireResourceExclusiveLite(&Cache->Resource, TRUE);
+
+    while (Length > 0)
+    {
+        UnitVcn = (Offset / UnitSize) * UnitClusters;
+        UnitOffset = (ULONG)(Offset % UnitSize);
+        CopyLength = min(UnitSize - UnitOffset, Length);
+
+        Entry = NtfsLookupCompressionCacheEntry(Cache, Context, UnitVcn);
+        if (Entry != NULL)
         {
-            DPRINT1("DRIVER ERROR: Attribute is too small!\n");
-            return STATUS_INVALID_PARAMETER;
+            Cache->Hits++;
         }
-
-        // Do we need to read the file record?
-        if (FileRecord == NULL)
+        else
         {
-            FileRecord = ExAllocateFromNPagedLookasideList(&Vcb->FileRecLookasideList);
-            if (!FileRecord)
+            Cache->Misses++;
+
+            if (CompressedBuffer == NULL)
             {
-                DPRINT1("Error: Couldn't allocate file record!\n");
-                return STATUS_NO_MEMORY;
+                CompressedBuffer = ExAllocatePoolWithTag(PagedPool, UnitSize, TAG_COMPRESSION);
+                if (CompressedBuffer == NULL)
+                    break;
             }
 
-            FileRecordAllocated = TRUE;
+            Entry = NtfsAllocateCompressionCacheEntry(Cache, UnitSize);
+            if (Entry == NULL)
+                break;
 
-            // read the file record
-            ReadFileRecord(Vcb, Context->FileMFTIndex, FileRecord);
+            Status = NtfsReadCompressionUnit(Vcb,
+                                             Context,
+                                             UnitVcn,
+                                             UnitClusters,
+                                             COMPRESSION_CACHE_ENTRY_DATA(Entry),
+                                             CompressedBuffer);
+            if (!NT_SUCCESS(Status))
+            {
+                ExFreePoolWithTag(Entry, TAG_COMPRESSION);
+                break;
+            }
+
+            Entry->MftIndex = Context->FileMFTIndex;
+            Entry->Instance = Context->pRecord->Instance;
+            Entry->UnitVcn = UnitVcn;
+            Entry->UnitSize = UnitSize;
+            InsertHeadList(&Cache->LruListHead, &Entry->LruListEntry);
+            Cache->EntryCount++;
+        }
+
+        RtlCopyMemory(Buffer, COMPRESSION_CACHE_ENTRY_DATA(Entry) + UnitOffset, CopyLength);
+
+        Offset += CopyLength;
+        Buffer += CopyLength;
+        Length -= CopyLength;
+        AlreadyRead += CopyLength;
+    }
+
+    ExReleaseResourceLite(&Cache->Resource);
+
+    if (CompressedBuffer != NULL)
+        ExFreePoolWithTag(CompressedBuffer, TAG_COMPRESSION);
+
+    return AlreadyRead;
+}
+
+ULONG
+ReadAttribute(PDEVICE_EXTENSION Vcb,
+              PNTFS_ATTR_CONTEXT Context,
+              ULONGLONG Offset,
+              PCHAR Buffer,
+              ULONG Length)
+{
+    ULONG BytesPerCluster = Vcb->NtfsInfo.BytesPerCluster;
+    ULONG ClusterOffset;
+    LONGLONG Lcn;
+    ULONGLONG RunClusters;
+    ULONG ReadLength;
+    ULONG AlreadyRead;
+    NTFS_IO_RUN Runs[NTFS_MAX_IO_RUNS];
+    ULONG RunCount;
+    PCHAR BatchBuffer;
+    ULONG BatchLength;
+    NTSTATUS Status;
+
+    if (!Context->pRecord->IsNonResident)
+    {
+        // We need to truncate Offset to a ULONG for pointer arithmetic
+        // The check below should ensure that Offset is well within the range of 32 bits
+        ULONG LittleOffset = (ULONG)Offset;
+
+        // Ensure that offset isn't beyond the end of the attribute
+        if (Offset > Context->pRecord->Resident.ValueLength)
+            return 0;
+        if (Offset + Length > Context->pRecord->Resident.ValueLength)
+            Length = (ULONG)(Context->pRecord->Resident.ValueLength - Offset);
+
+        RtlCopyMemory(Buffer, (PVOID)((ULONG_PTR)Context->pRecord + Context->pRecord->Resident.ValueOffset + LittleOffset), Length);
+        return Length;
+    }
+
+    /*
+     * Non-resident attribute
+     */
+
+    if ((Context->pRecord->Flags & ATTR_FLAG_COMPRESSED) && Context->pRecord->NonResident.CompressionUnit != 0)
+        return ReadCompressedAttribute(Vcb, Context, Offset, Buffer, Length);
+
+    // The runs are gathered in batches that are read all at once
+    AlreadyRead = 0;
+    RunCount = 0;
+    BatchBuffer = Buffer;
+    BatchLength = 0;
+    while (Length > 0)
+    {
+        // Find the run holding the current offset
+        ClusterOffset = (ULONG)(Offset % BytesPerCluster);
+        if (!NtfsLookupAttributeRun(Context, Offset / BytesPerCluster, &Lcn, &RunClusters))
+            break;
+
+        ReadLength = (ULONG)min(RunClusters * BytesPerCluster - ClusterOffset, Length);
+        if (Lcn == -1)
+        {
+            /* Sparse data run. */
+            RtlZeroMemory(Buffer, ReadLength);
+        }
+        else
+        {
+            Runs[RunCount].DiskOffset = Lcn * BytesPerCluster + ClusterOffset;
+            Runs[RunCount].BufferOffset = (ULONG)(Buffer - BatchBuffer);
+            Runs[RunCount].Length = ReadLength;
+            RunCount++;
+        }
+
+        Offset += ReadLength;
+        Buffer += ReadLength;
+        Length -= ReadLength;
+        BatchLength += ReadLength;
+
+        if (RunCount == NTFS_MAX_IO_RUNS)
+        {
+            Status = NtfsLogReadWriteRuns(Vcb, Context, IRP_MJ_READ, Runs, RunCount, (PUCHAR)BatchBuffer);
+            if (!NT_SUCCESS(Status))
+                return AlreadyRead;
+
+            AlreadyRead += BatchLength;
+            RunCount = 0;
+            BatchBuffer = Buffer;
+            BatchLength = 0;
+        }
+    }
+
+    if (RunCount != 0)
+    {
+        Status = NtfsLogReadWriteRuns(Vcb, Context, IRP_MJ_READ, Runs, RunCount, (PUCHAR)BatchBuffer);
+        if (!NT_SUCCESS(Status))
+            return AlreadyRead;
+    }
+
+    return AlreadyRead + BatchLength;
+}
+
+
+/**
+* @name WriteAttribute
+* @implemented
+*
+* Writes an NTFS attribute to the disk. It presently borrows a lot of code from ReadAttribute(),
+* and it still needs more documentation / cleaning up.
+*
+* @param Vcb
+* Volume Control Block indicating which volume to write the attribute to
+*
+* @param Context
+* Pointer to an NTFS_ATTR_CONTEXT that has information about the attribute
+*
+* @param Offset
+* Offset, in bytes, from the beginning of the attribute indicating where to start
+* writing data
+*
+* @param Buffer
+* The data that's being written to the device
+*
+* @param Length
+* How much data will be written, in bytes
+*
+* @param RealLengthWritten
+* Pointer to a ULONG which will receive how much data was written, in bytes
+*
+* @param FileRecord
+* Optional pointer to a FILE_RECORD_HEADER that contains a copy of the file record
+* being written to. Can be NULL, in which case the file record will be read from disk.
+* If not-null, WriteAttribute() will skip reading from disk, and FileRecord
+* will be updated with the newly-written attribute before the function returns.
+*
+* @return
+* STATUS_SUCCESS if successful, an error code otherwise. STATUS_NOT_IMPLEMENTED if
+* writing to a hole of a sparse attribute, which NtfsAllocateAttributeRange() must fill first.
+*
+* @remarks Note that in this context the word "attribute" isn't referring read-only, hidden,
+* etc. - the file's data is actually stored in an attribute in NTFS parlance.
+*
+*/
+
+NTSTATUS
+WriteAttribute(PDEVICE_EXTENSION Vcb,
+               PNTFS_ATTR_CONTEXT Context,
+               ULONGLONG Offset,
+               const PUCHAR Buffer,
+               ULONG Length,
+               PULONG RealLengthWritten,
+               PFILE_RECORD_HEADER FileRecord)
+{
+    ULONG BytesPerCluster = Vcb->NtfsInfo.BytesPerCluster;
+    ULONG ClusterOffset;
+    LONGLONG Lcn;
+    ULONGLONG RunClusters;
+    ULONG WriteLength;
+    NTSTATUS Status;
+    PUCHAR SourceBuffer = Buffer;
+    BOOLEAN FileRecordAllocated = FALSE;
+    NTFS_IO_RUN Runs[NTFS_MAX_IO_RUNS];
+    ULONG RunCount;
+    PUCHAR BatchBuffer;
+    ULONG BatchLength;
+
+    DPRINT("WriteAttribute(%p, %p, %I64u, %p, %lu, %p, %p)\n", Vcb, Context, Offset, Buffer, Length, RealLengthWritten, FileRecord);
+
+    *RealLengthWritten = 0;
+
+    if (Context->pRecord->Flags & ATTR_FLAG_COMPRESSED)
+        NtfsInvalidateCompressionCache(Vcb, Context->FileMFTIndex);
+
+    // is this a resident attribute?
+    if (!Context->pRecord->IsNonResident)
+    {
+        ULONG AttributeOffset;
+        PNTFS_ATTR_CONTEXT FoundContext;
+        PNTFS_ATTR_RECORD Destination;
+
+        // Ensure requested data is within the bounds of the attribute
+        ASSERT(Offset + Length <= Context->pRecord->Resident.ValueLength);
+
+        if (Offset + Length > Context->pRecord->Resident.ValueLength)
+        {
+            DPRINT1("DRIVER ERROR: Attribute is too small!\n");
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        // Do we need to read the file record?
+        if (FileRecord == NULL)
+        {
+            FileRecord = ExAllocateFromNPagedLookasideList(&Vcb->FileRecLookasideList);
+            if (!FileRecord)
+            {
+                DPRINT1("Error: Couldn't allocate file record!\n");
+                return STATUS_NO_MEMORY;
+            }
+
+            FileRecordAllocated = TRUE;
+
+            // read the file record
+            ReadFileRecord(Vcb, Context->FileMFTIndex, FileRecord);
         }
 
         // find where to write the attribute data to
@@ -1422,230 +1685,718 @@ WriteAttribute(PDEVICE_EXTENSION Vcb,
     }
 
     // This is a non-resident attribute.
+    // The runs are gathered in batches that are written all at once
 
-    // I. Find the corresponding start data run.
-
-    // FIXME: Cache seems to be non-working. Disable it for now
-    //if(Context->CacheRunOffset <= Offset && Offset < Context->CacheRunOffset + Context->CacheRunLength * Volume->ClusterSize)
-    /*if (0)
-    {
-    DataRun = Context->CacheRun;
-    LastLCN = Context->CacheRunLastLCN;
-    DataRunStartLCN = Context->CacheRunStartLCN;
-    DataRunLength = Context->CacheRunLength;
-    CurrentOffset = Context->CacheRunCurrentOffset;
-    }
-    else*/
+    Status = STATUS_SUCCESS;
+    RunCount = 0;
+    BatchBuffer = SourceBuffer;
+    BatchLength = 0;
+    while (Length > 0)
     {
-        ULONG UsedBufferSize;
-        LastLCN = 0;
-        CurrentOffset = 0;
+        // Find the run holding the current offset
+        ClusterOffset = (ULONG)(Offset % BytesPerCluster);
+        if (!NtfsLookupAttributeRun(Context, Offset / BytesPerCluster, &Lcn, &RunClusters))
+        {
+            // We reached the last assigned cluster
+            // TODO: assign new clusters to the end of the file.
+            // (Presently, this code will rarely be reached, the write will usually have already failed by now)
+            // [We can reach here by creating a new file record when the MFT isn't large enough]
+            DPRINT1("Encountered EOF before expected! Offset: %I64u\n", Offset);
+            Status = STATUS_END_OF_FILE;
+            break;
+        }
 
-        // This will be rewritten in the next iteration to just use the DataRuns MCB directly
-        TempBuffer = ExAllocatePoolWithTag(NonPagedPool, Vcb->NtfsInfo.BytesPerFileRecord, TAG_NTFS);
-        if (TempBuffer == NULL)
+        // Holes are given clusters by NtfsAllocateAttributeRange(), which needs the file record
+        if (Lcn == -1)
         {
-            return STATUS_INSUFFICIENT_RESOURCES;
+            DPRINT1("FIXME: Writing to a hole that wasn't allocated is not supported!\n");
+            Status = STATUS_NOT_IMPLEMENTED;
+            break;
         }
 
-        ConvertLargeMCBToDataRuns(&Context->DataRunsMCB,
-                                  TempBuffer,
-                                  Vcb->NtfsInfo.BytesPerFileRecord,
-                                  &UsedBufferSize);
+        // Make sure we don't write past the end of the current data run
+        WriteLength = (ULONG)min(RunClusters * BytesPerCluster - ClusterOffset, Length);
+
+        Runs[RunCount].DiskOffset = Lcn * BytesPerCluster + ClusterOffset;
+        Runs[RunCount].BufferOffset = (ULONG)(SourceBuffer - BatchBuffer);
+        Runs[RunCount].Length = WriteLength;
+        RunCount++;
 
-        DataRun = TempBuffer;
+        Offset += WriteLength;
+        SourceBuffer += WriteLength;
+        Length -= WriteLength;
+        BatchLength += WriteLength;
 
-        while (1)
+        if (RunCount == NTFS_MAX_IO_RUNS)
         {
-            DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
-            if (DataRunOffset != -1)
-            {
-                // Normal data run.
-                // DPRINT1("Writing to normal data run, LastLCN %I64u DataRunOffset %I64d\n", LastLCN, DataRunOffset);
-                DataRunStartLCN = LastLCN + DataRunOffset;
-                LastLCN = DataRunStartLCN;
-            }
-            else
-            {
-                // Sparse data run. We can't support writing to sparse files yet
-                // (it may require increasing the allocation size).
-                DataRunStartLCN = -1;
-                DPRINT1("FIXME: Writing to sparse files is not supported yet!\n");
-                Status = STATUS_NOT_IMPLEMENTED;
-                goto Cleanup;
-            }
+            Status = NtfsLogReadWriteRuns(Vcb, Context, IRP_MJ_WRITE, Runs, RunCount, BatchBuffer);
+            if (!NT_SUCCESS(Status))
+                return Status;
 
-            // Have we reached the data run we're trying to write to?
-            if (Offset >= CurrentOffset &&
-                Offset < CurrentOffset + (DataRunLength * Vcb->NtfsInfo.BytesPerCluster))
-            {
-                break;
-            }
+            *RealLengthWritten += BatchLength;
+            RunCount = 0;
+            BatchBuffer = SourceBuffer;
+            BatchLength = 0;
+        }
+    }
 
-            if (*DataRun == 0)
-            {
-                // We reached the last assigned cluster
-                // TODO: assign new clusters to the end of the file.
-                // (Presently, this code will rarely be reached, the write will usually have already failed by now)
-                // [We can reach here by creating a new file record when the MFT isn't large enough]
-                DPRINT1("FIXME: Master File Table needs to be enlarged.\n");
-                Status = STATUS_END_OF_FILE;
-                goto Cleanup;
-            }
+    // Write what was gathered, even if the rest of the request can't be
+    if (RunCount != 0)
+    {
+        NTSTATUS WriteStatus;
 
-            CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
-        }
+        WriteStatus = NtfsLogReadWriteRuns(Vcb, Context, IRP_MJ_WRITE, Runs, RunCount, BatchBuffer);
+        if (!NT_SUCCESS(WriteStatus))
+            return WriteStatus;
+
+        *RealLengthWritten += BatchLength;
     }
 
-    // II. Go through the run list and write the data
+    return Status;
+}
 
-    /* REVIEWME -- As adapted from NtfsReadAttribute():
-    We seem to be making a special case for the first applicable data run, but I'm not sure why.
-    Does it have something to do with (not) caching? Is this strategy equally applicable to writing? */
+/**
+* @name NtfsInitializeMftCache
+* @implemented
+*
+* Initializes the cache of fixed-up file records of a volume.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume. Its NtfsInfo must already be filled in.
+*
+* @remarks
+* The cache holds at most NTFS_MFT_CACHE_MAX_ENTRIES records and evicts the least recently used one,
+* approximately: lookups only hold the cache resource shared, so a hit merely marks its entry referenced.
+* Records written with UpdateFileRecord() are kept dirty in the cache until they're evicted or until
+* NtfsFlushMftCache() is called, which NtfsDispatch() does at the end of every request.
+*/
+VOID
+NtfsInitializeMftCache(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_MFT_CACHE Cache = &Vcb->MftCache;
+    ULONG i;
+
+    ExInitializeResourceLite(&Cache->Resource);
+    ExInitializeNPagedLookasideList(&Cache->EntryLookasideList,
+                                    NULL,
+                                    NULL,
+                                    0,
+                                    sizeof(NTFS_MFT_CACHE_ENTRY) + Vcb->NtfsInfo.BytesPerFileRecord,
+                                    TAG_MFT_CACHE,
+                                    0);
+
+    for (i = 0; i < NTFS_MFT_CACHE_BUCKETS; i++)
+        InitializeListHead(&Cache->HashBuckets[i]);
+    InitializeListHead(&Cache->LruListHead);
+
+    Cache->EntryCount = 0;
+    Cache->DirtyCount = 0;
+    Cache->WriteGeneration = 0;
+    Cache->Hits = 0;
+    Cache->Misses = 0;
+    Cache->WriteBacks = 0;
+    Cache->Prefetches = 0;
+}
 
-    WriteLength = (ULONG)min(DataRunLength * Vcb->NtfsInfo.BytesPerCluster - (Offset - CurrentOffset), Length);
+/**
+* @name NtfsUninitializeMftCache
+* @implemented
+*
+* Writes back the dirty records of the cache, then frees all of its entries.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*/
+VOID
+NtfsUninitializeMftCache(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_MFT_CACHE Cache = &Vcb->MftCache;
+    PNTFS_MFT_CACHE_ENTRY Entry;
 
-    StartingOffset = DataRunStartLCN * Vcb->NtfsInfo.BytesPerCluster + Offset - CurrentOffset;
+    NtfsFlushMftCache(Vcb);
 
-    // Write the data to the disk
-    Status = NtfsWriteDisk(Vcb->StorageDevice,
-                           StartingOffset,
-                           WriteLength,
-                           Vcb->NtfsInfo.BytesPerSector,
-                           (PVOID)SourceBuffer);
+    DPRINT("MFT cache: %I64u hits, %I64u misses, %I64u write-backs, %I64u prefetches\n", Cache->Hits, Cache->Misses, Cache->WriteBacks, Cache->Prefetches);
 
-    // Did the write fail?
-    if (!NT_SUCCESS(Status))
+    while (!IsListEmpty(&Cache->LruListHead))
     {
-        Context->CacheRun = DataRun;
-        Context->CacheRunOffset = Offset;
-        Context->CacheRunStartLCN = DataRunStartLCN;
-        Context->CacheRunLength = DataRunLength;
-        Context->CacheRunLastLCN = LastLCN;
-        Context->CacheRunCurrentOffset = CurrentOffset;
+        Entry = CONTAINING_RECORD(RemoveHeadList(&Cache->LruListHead), NTFS_MFT_CACHE_ENTRY, LruListEntry);
+        ExFreeToNPagedLookasideList(&Cache->EntryLookasideList, Entry);
+    }
+    Cache->EntryCount = 0;
+
+    ExDeleteNPagedLookasideList(&Cache->EntryLookasideList);
+    ExDeleteResourceLite(&Cache->Resource);
+}
+
+/*
+ * Must be called with the cache resource held, shared or exclusively. The LRU list isn't touched,
+ * a hit only marks the entry referenced for NtfsAllocateMftCacheEntry().
+ */
+static
+PNTFS_MFT_CACHE_ENTRY
+NtfsLookupMftCacheEntry(PNTFS_MFT_CACHE Cache,
+                        ULONGLONG MftIndex)
+{
+    PLIST_ENTRY Bucket, ListEntry;
+    PNTFS_MFT_CACHE_ENTRY Entry;
 
-        goto Cleanup;
+    Bucket = &Cache->HashBuckets[MftIndex % NTFS_MFT_CACHE_BUCKETS];
+    for (ListEntry = Bucket->Flink; ListEntry != Bucket; ListEntry = ListEntry->Flink)
+    {
+        Entry = CONTAINING_RECORD(ListEntry, NTFS_MFT_CACHE_ENTRY, HashListEntry);
+        if (Entry->MftIndex == MftIndex)
+        {
+            Entry->Referenced = TRUE;
+            return Entry;
+        }
     }
 
-    Length -= WriteLength;
-    SourceBuffer += WriteLength;
-    *RealLengthWritten += WriteLength;
+    return NULL;
+}
+
+/* Must be called with the cache resource held exclusively */
+static
+NTSTATUS
+NtfsWriteMftCacheEntry(PDEVICE_EXTENSION Vcb,
+                       PNTFS_MFT_CACHE_ENTRY Entry)
+{
+    PFILE_RECORD_HEADER FileRecord = MFT_CACHE_ENTRY_RECORD(Entry);
+    ULONG BytesWritten;
+    NTSTATUS Status;
+
+    ASSERT(Entry->Dirty);
 
-    // Did we write to the end of the data run?
-    if (WriteLength == DataRunLength * Vcb->NtfsInfo.BytesPerCluster - (Offset - CurrentOffset))
+    // Add the fixup array to prepare the data for writing to disk
+    AddFixupArray(Vcb, &FileRecord->Ntfs);
+
+    // write the file record to the master file table
+    Status = WriteAttribute(Vcb,
+                            Vcb->MFTContext,
+                            Entry->MftIndex * Vcb->NtfsInfo.BytesPerFileRecord,
+                            (const PUCHAR)FileRecord,
+                            Vcb->NtfsInfo.BytesPerFileRecord,
+                            &BytesWritten,
+                            FileRecord);
+    Vcb->MftCache.WriteGeneration++;
+
+    // remove the fixup array, the cached record stays usable
+    FixupUpdateSequenceArray(Vcb, &FileRecord->Ntfs);
+
+    if (!NT_SUCCESS(Status))
     {
-        // Advance to the next data run
-        CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
-        DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
+        DPRINT1("Writing back file record 0x%I64x failed: %lu written, %lu expected\n", Entry->MftIndex, BytesWritten, Vcb->NtfsInfo.BytesPerFileRecord);
+        return Status;
+    }
 
-        if (DataRunOffset != (ULONGLONG)-1)
+    Entry->Dirty = FALSE;
+    Vcb->MftCache.DirtyCount--;
+    Vcb->MftCache.WriteBacks++;
+
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Must be called with the cache resource held exclusively. Returns a new entry for MftIndex,
+ * possibly by recycling the least recently used one, or NULL if none could be found.
+ * The record of the returned entry isn't initialized.
+ */
+static
+PNTFS_MFT_CACHE_ENTRY
+NtfsAllocateMftCacheEntry(PDEVICE_EXTENSION Vcb,
+                          ULONGLONG MftIndex)
+{
+    PNTFS_MFT_CACHE Cache = &Vcb->MftCache;
+    PNTFS_MFT_CACHE_ENTRY Entry;
+    ULONG i;
+
+    if (Cache->EntryCount < NTFS_MFT_CACHE_MAX_ENTRIES)
+    {
+        Entry = ExAllocateFromNPagedLookasideList(&Cache->EntryLookasideList);
+        if (Entry != NULL)
+            Cache->EntryCount++;
+    }
+    else
+    {
+        // Second chance: the entries hit since they were last passed over go back to the head.
+        // After a full turn, none is referenced anymore and the tail is the same entry again.
+        for (i = 0; i < Cache->EntryCount; i++)
         {
-            DataRunStartLCN = LastLCN + DataRunOffset;
-            LastLCN = DataRunStartLCN;
+            Entry = CONTAINING_RECORD(Cache->LruListHead.Blink, NTFS_MFT_CACHE_ENTRY, LruListEntry);
+            if (!Entry->Referenced)
+                break;
+
+            Entry->Referenced = FALSE;
+            RemoveEntryList(&Entry->LruListEntry);
+            InsertHeadList(&Cache->LruListHead, &Entry->LruListEntry);
         }
-        else
-            DataRunStartLCN = -1;
+
+        Entry = CONTAINING_RECORD(Cache->LruListHead.Blink, NTFS_MFT_CACHE_ENTRY, LruListEntry);
+
+        // Never drop a record that couldn't be written back
+        if (Entry->Dirty && !NT_SUCCESS(NtfsWriteMftCacheEntry(Vcb, Entry)))
+            return NULL;
+
+        RemoveEntryList(&Entry->HashListEntry);
+        RemoveEntryList(&Entry->LruListEntry);
     }
 
-    // Do we have more data to write?
-    while (Length > 0)
+    if (Entry == NULL)
+        return NULL;
+
+    Entry->MftIndex = MftIndex;
+    Entry->Dirty = FALSE;
+    Entry->Referenced = FALSE;
+    InsertHeadList(&Cache->HashBuckets[MftIndex % NTFS_MFT_CACHE_BUCKETS], &Entry->HashListEntry);
+    InsertHeadList(&Cache->LruListHead, &Entry->LruListEntry);
+
+    return Entry;
+}
+
+/**
+* @name NtfsFlushMftCache
+* @implemented
+*
+* Writes back to the master file table all the records that were modified in the cache.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @return
+* STATUS_SUCCESS on success, or the status of the first write that failed. Records that couldn't
+* be written stay dirty.
+*/
+NTSTATUS
+NtfsFlushMftCache(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_MFT_CACHE Cache = &Vcb->MftCache;
+    PLIST_ENTRY ListEntry;
+    PNTFS_MFT_CACHE_ENTRY Entry;
+    NTSTATUS Status, ReturnStatus = STATUS_SUCCESS;
+
+    ExAcquireResourceExclusiveLite(&Cache->Resource, TRUE);
+
+    for (ListEntry = Cache->LruListHead.Flink;
+         ListEntry != &Cache->LruListHead && Cache->DirtyCount != 0;
+         ListEntry = ListEntry->Flink)
     {
-        // Make sure we don't write past the end of the current data run
-        WriteLength = (ULONG)min(DataRunLength * Vcb->NtfsInfo.BytesPerCluster, Length);
+        Entry = CONTAINING_RECORD(ListEntry, NTFS_MFT_CACHE_ENTRY, LruListEntry);
+        if (!Entry->Dirty)
+            continue;
 
-        // Are we dealing with a sparse data run?
-        if (DataRunStartLCN == -1)
+        Status = NtfsWriteMftCacheEntry(Vcb, Entry);
+        if (!NT_SUCCESS(Status) && NT_SUCCESS(ReturnStatus))
+            ReturnStatus = Status;
+    }
+
+    ExReleaseResourceLite(&Cache->Resource);
+
+    return ReturnStatus;
+}
+
+NTSTATUS
+ReadFileRecord(PDEVICE_EXTENSION Vcb,
+               ULONGLONG index,
+               PFILE_RECORD_HEADER file)
+{
+    PNTFS_MFT_CACHE Cache = &Vcb->MftCache;
+    PNTFS_MFT_CACHE_ENTRY Entry;
+    ULONGLONG BytesRead;
+    ULONG WriteGeneration;
+    NTSTATUS Status;
+
+    DPRINT("ReadFileRecord(%p, %I64x, %p)\n", Vcb, index, file);
+
+    for (;;)
+    {
+        ExAcquireResourceSharedLite(&Cache->Resource, TRUE);
+
+        Entry = NtfsLookupMftCacheEntry(Cache, index);
+        if (Entry != NULL)
         {
-            DPRINT1("FIXME: Don't know how to write to sparse files yet! (DataRunStartLCN == -1)\n");
-            Status = STATUS_NOT_IMPLEMENTED;
-            goto Cleanup;
+            InterlockedIncrement64(&Cache->Hits);
+            RtlCopyMemory(file, MFT_CACHE_ENTRY_RECORD(Entry), Vcb->NtfsInfo.BytesPerFileRecord);
+            ExReleaseResourceLite(&Cache->Resource);
+            return STATUS_SUCCESS;
         }
-        else
+
+        WriteGeneration = Cache->WriteGeneration;
+        ExReleaseResourceLite(&Cache->Resource);
+
+        InterlockedIncrement64(&Cache->Misses);
+
+        // Read without the lock, so that the lookups of other threads don't wait for the disk
+        BytesRead = ReadAttribute(Vcb, Vcb->MFTContext, index * Vcb->NtfsInfo.BytesPerFileRecord, (PCHAR)file, Vcb->NtfsInfo.BytesPerFileRecord);
+        if (BytesRead != Vcb->NtfsInfo.BytesPerFileRecord)
         {
-            // write the data to the disk
-            Status = NtfsWriteDisk(Vcb->StorageDevice,
-                                   DataRunStartLCN * Vcb->NtfsInfo.BytesPerCluster,
-                                   WriteLength,
-                                   Vcb->NtfsInfo.BytesPerSector,
-                                   (PVOID)SourceBuffer);
-            if (!NT_SUCCESS(Status))
-                break;
+            DPRINT1("ReadFileRecord failed: %I64u read, %lu expected\n", BytesRead, Vcb->NtfsInfo.BytesPerFileRecord);
+            return STATUS_PARTIAL_COPY;
         }
 
-        Length -= WriteLength;
-        SourceBuffer += WriteLength;
-        *RealLengthWritten += WriteLength;
+        /* Apply update sequence array fixups. */
+        DPRINT("Sequence number: %u\n", file->SequenceNumber);
+        Status = FixupUpdateSequenceArray(Vcb, &file->Ntfs);
+
+        ExAcquireResourceExclusiveLite(&Cache->Resource, TRUE);
+
+        // Another thread may have cached the record meanwhile, its copy is the latest one
+        Entry = NtfsLookupMftCacheEntry(Cache, index);
+        if (Entry != NULL)
+        {
+            RtlCopyMemory(file, MFT_CACHE_ENTRY_RECORD(Entry), Vcb->NtfsInfo.BytesPerFileRecord);
+            ExReleaseResourceLite(&Cache->Resource);
+            return STATUS_SUCCESS;
+        }
 
-        // We finished this request, but there's still data in this data run.
-        if (Length == 0 && WriteLength != DataRunLength * Vcb->NtfsInfo.BytesPerCluster)
+        // Nothing was written to $MFT during the read, so what was read is current
+        if (Cache->WriteGeneration == WriteGeneration)
             break;
 
-        // Go to next run in the list.
+        ExReleaseResourceLite(&Cache->Resource);
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        Entry = NtfsAllocateMftCacheEntry(Vcb, index);
+        if (Entry != NULL)
+            RtlCopyMemory(MFT_CACHE_ENTRY_RECORD(Entry), file, Vcb->NtfsInfo.BytesPerFileRecord);
+    }
+
+    ExReleaseResourceLite(&Cache->Resource);
 
-        if (*DataRun == 0)
+    return Status;
+}
+
+/**
+* @name NtfsPrefetchFileRecords
+* @implemented
+*
+* Reads file records into the MFT cache ahead of their use, so that a caller about to read
+* them one at a time doesn't wait for the disk on each of them.
+*
+* @param Vcb
+* Points to the DEVICE_EXTENSION of the volume.
+*
+* @param MftIndexes
+* MFT indexes of the records, in any order. At most NTFS_PREFETCH_MAX_RECORDS are read.
+*
+* @param Count
+* Number of entries in MftIndexes.
+*
+* @remarks
+* Records already cached are skipped. Records close enough to each other in $MFT are read
+* with a single read of up to NTFS_PREFETCH_SPAN bytes, the records between them included.
+* Failures are ignored: ReadFileRecord() reads whatever couldn't be prefetched.
+*/
+VOID
+NtfsPrefetchFileRecords(PDEVICE_EXTENSION Vcb,
+                        PULONGLONG MftIndexes,
+                        ULONG Count)
+{
+    PNTFS_MFT_CACHE Cache = &Vcb->MftCache;
+    ULONG BytesPerFileRecord = Vcb->NtfsInfo.BytesPerFileRecord;
+    ULONGLONG Sorted[NTFS_PREFETCH_MAX_RECORDS];
+    ULONGLONG MftIndex, First;
+    PNTFS_MFT_CACHE_ENTRY Entry;
+    PFILE_RECORD_HEADER FileRecord;
+    PUCHAR Buffer;
+    ULONG SpanRecords;
+    ULONG Wanted, i, j, Next;
+    ULONG BytesRead;
+    ULONG WriteGeneration;
+
+    SpanRecords = NTFS_PREFETCH_SPAN / BytesPerFileRecord;
+    if (Count == 0 || SpanRecords == 0)
+        return;
+
+    Buffer = ExAllocatePoolWithTag(PagedPool, SpanRecords * BytesPerFileRecord, TAG_NTFS);
+    if (Buffer == NULL)
+        return;
+
+    ExAcquireResourceSharedLite(&Cache->Resource, TRUE);
+
+    // Sort the indexes that aren't cached yet, without duplicates
+    for (i = 0, Wanted = 0; i < Count && Wanted < NTFS_PREFETCH_MAX_RECORDS; i++)
+    {
+        MftIndex = MftIndexes[i];
+        if (NtfsLookupMftCacheEntry(Cache, MftIndex) != NULL)
+            continue;
+
+        for (j = 0; j < Wanted && Sorted[j] < MftIndex; j++);
+        if (j < Wanted && Sorted[j] == MftIndex)
+            continue;
+
+        RtlMoveMemory(&Sorted[j + 1], &Sorted[j], (Wanted - j) * sizeof(ULONGLONG));
+        Sorted[j] = MftIndex;
+        Wanted++;
+    }
+
+    WriteGeneration = Cache->WriteGeneration;
+    ExReleaseResourceLite(&Cache->Resource);
+
+    for (i = 0; i < Wanted; i = Next)
+    {
+        First = Sorted[i];
+        for (Next = i + 1; Next < Wanted && Sorted[Next] - First < SpanRecords; Next++);
+
+        BytesRead = ReadAttribute(Vcb,
+                                  Vcb->MFTContext,
+                                  First * BytesPerFileRecord,
+                                  (PCHAR)Buffer,
+                                  (ULONG)(Sorted[Next - 1] - First + 1) * BytesPerFileRecord);
+
+        ExAcquireResourceExclusiveLite(&Cache->Resource, TRUE);
+
+        for (j = i; j < Next; j++)
         {
-            // that was the last run
-            if (Length > 0)
+            // A record written to $MFT since the read, evictions here included, is stale in the buffer
+            if (Cache->WriteGeneration != WriteGeneration)
             {
-                // Failed sanity check.
-                DPRINT1("Encountered EOF before expected!\n");
-                Status = STATUS_END_OF_FILE;
-                goto Cleanup;
+                Next = Wanted;
+                break;
             }
 
-            break;
+            if ((Sorted[j] - First + 1) * BytesPerFileRecord > BytesRead)
+                break;
+
+            // Cached by another thread meanwhile
+            if (NtfsLookupMftCacheEntry(Cache, Sorted[j]) != NULL)
+                continue;
+
+            FileRecord = (PFILE_RECORD_HEADER)(Buffer + (ULONG)(Sorted[j] - First) * BytesPerFileRecord);
+            if (FileRecord->Ntfs.Type != NRH_FILE_TYPE ||
+                !NT_SUCCESS(FixupUpdateSequenceArray(Vcb, &FileRecord->Ntfs)))
+            {
+                continue;
+            }
+
+            // Nothing left to recycle, stop there
+            Entry = NtfsAllocateMftCacheEntry(Vcb, Sorted[j]);
+            if (Entry == NULL)
+            {
+                Next = Wanted;
+                break;
+            }
+
+            RtlCopyMemory(MFT_CACHE_ENTRY_RECORD(Entry), FileRecord, BytesPerFileRecord);
+            Cache->Prefetches++;
         }
 
-        // Advance to the next data run
-        CurrentOffset += DataRunLength * Vcb->NtfsInfo.BytesPerCluster;
-        DataRun = DecodeRun(DataRun, &DataRunOffset, &DataRunLength);
-        if (DataRunOffset != -1)
-        {
-            // Normal data run.
-            DataRunStartLCN = LastLCN + DataRunOffset;
-            LastLCN = DataRunStartLCN;
-        }
-        else
+        ExReleaseResourceLite(&Cache->Resource);
+    }
+
+    ExFreePoolWithTag(Buffer, TAG_NTFS);
+}
+
+#define MFT_SCAN_BIT(Scan, i) ((Scan)->Bitmap[(i) >> 3] & (1 << ((i) & 7)))
+
+/**
+* @name NtfsStartMftScan
+* @implemented
+*
+* Prepares the sequential reading of the file records in use, see NtfsReadNextMftRecord().
+*
+* @param Vcb
+* Points to the DEVICE_EXTENSION of the volume.
+*
+* @param StartIndex
+* MFT index of the first record to look at.
+*
+* @param Scan
+* Receives the state of the scan, to be released with NtfsEndMftScan().
+*
+* @return
+* STATUS_SUCCESS, STATUS_INSUFFICIENT_RESOURCES, or the error from finding $MFT:$BITMAP.
+*/
+NTSTATUS
+NtfsStartMftScan(PDEVICE_EXTENSION Vcb,
+                 ULONGLONG StartIndex,
+                 PNTFS_MFT_SCAN Scan)
+{
+    NTSTATUS Status;
+
+    RtlZeroMemory(Scan, sizeof(NTFS_MFT_SCAN));
+
+    Status = FindAttribute(Vcb, Vcb->MasterFileTable, AttributeBitmap, L"", 0, &Scan->BitmapContext, NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("ERROR: Couldn't find $Bitmap attribute of master file table!\n");
+        return Status;
+    }
+
+    // A multiple of 8 records, so that a chunk starts on a byte of the bitmap
+    Scan->ChunkRecords = ROUND_DOWN(NTFS_MFT_SCAN_CHUNK_SIZE / Vcb->NtfsInfo.BytesPerFileRecord, 8);
+    Scan->RecordCount = AttributeDataLength(Vcb->MFTContext->pRecord) / Vcb->NtfsInfo.BytesPerFileRecord;
+    Scan->NextIndex = StartIndex;
+
+    Scan->Records = ExAllocatePoolWithTag(PagedPool, Scan->ChunkRecords * Vcb->NtfsInfo.BytesPerFileRecord, TAG_NTFS);
+    Scan->Bitmap = ExAllocatePoolWithTag(PagedPool, Scan->ChunkRecords / 8, TAG_NTFS);
+    if (Scan->Records == NULL || Scan->Bitmap == NULL)
+    {
+        NtfsEndMftScan(Scan);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+NtfsEndMftScan(PNTFS_MFT_SCAN Scan)
+{
+    if (Scan->Records != NULL)
+        ExFreePoolWithTag(Scan->Records, TAG_NTFS);
+    if (Scan->Bitmap != NULL)
+        ExFreePoolWithTag(Scan->Bitmap, TAG_NTFS);
+    if (Scan->BitmapContext != NULL)
+        ReleaseAttributeContext(Scan->BitmapContext);
+
+    RtlZeroMemory(Scan, sizeof(NTFS_MFT_SCAN));
+}
+
+/* Reads the chunk holding NextIndex: only the span between its first and last records in use is read */
+static
+NTSTATUS
+NtfsLoadMftScanChunk(PDEVICE_EXTENSION Vcb,
+                     PNTFS_MFT_SCAN Scan)
+{
+    PNTFS_MFT_CACHE Cache = &Vcb->MftCache;
+    ULONG BytesPerFileRecord = Vcb->NtfsInfo.BytesPerFileRecord;
+    PNTFS_MFT_CACHE_ENTRY Entry;
+    PFILE_RECORD_HEADER FileRecord;
+    ULONGLONG ChunkStart;
+    ULONG Count, First, Last, i;
+    ULONG Length;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    ChunkStart = ROUND_DOWN(Scan->NextIndex, 8);
+    Count = (ULONG)min(Scan->ChunkRecords, Scan->RecordCount - ChunkStart);
+
+    // The bitmap can be shorter than $MFT, the records past its end aren't in use
+    RtlZeroMemory(Scan->Bitmap, Scan->ChunkRecords / 8);
+    ReadAttribute(Vcb, Scan->BitmapContext, ChunkStart / 8, (PCHAR)Scan->Bitmap, (Count + 7) / 8);
+
+    First = (ULONG)(Scan->NextIndex - ChunkStart);
+    for (i = 0; i < First; i++)
+        Scan->Bitmap[i >> 3] &= ~(1 << (i & 7));
+
+    while (First < Count && !MFT_SCAN_BIT(Scan, First))
+        First++;
+
+    Scan->ChunkStart = ChunkStart;
+    Scan->ChunkValid = Count;
+    if (First == Count)
+    {
+        // Nothing in use, the chunk isn't read at all
+        return STATUS_SUCCESS;
+    }
+
+    Last = Count - 1;
+    while (!MFT_SCAN_BIT(Scan, Last))
+        Last--;
+
+    // Under the cache lock, so that no record is written back between the read and the lookups below
+    ExAcquireResourceSharedLite(&Cache->Resource, TRUE);
+
+    Length = (Last - First + 1) * BytesPerFileRecord;
+    if (ReadAttribute(Vcb,
+                      Vcb->MFTContext,
+                      (ChunkStart + First) * BytesPerFileRecord,
+                      (PCHAR)Scan->Records + First * BytesPerFileRecord,
+                      Length) != Length)
+    {
+        DPRINT1("Reading file records %I64u to %I64u failed\n", ChunkStart + First, ChunkStart + Last);
+        Scan->ChunkValid = 0;
+        Status = STATUS_PARTIAL_COPY;
+    }
+    else
+    {
+        for (i = First; i <= Last; i++)
+        {
+            if (!MFT_SCAN_BIT(Scan, i))
+                continue;
+
+            FileRecord = (PFILE_RECORD_HEADER)(Scan->Records + i * BytesPerFileRecord);
+
+            // The cache holds the latest version of a record, with its fixups already applied
+            Entry = NtfsLookupMftCacheEntry(Cache, ChunkStart + i);
+            if (Entry != NULL)
+            {
+                RtlCopyMemory(FileRecord, MFT_CACHE_ENTRY_RECORD(Entry), BytesPerFileRecord);
+            }
+            else if (FileRecord->Ntfs.Type != NRH_FILE_TYPE ||
+                     !NT_SUCCESS(FixupUpdateSequenceArray(Vcb, &FileRecord->Ntfs)))
+            {
+                Scan->Bitmap[i >> 3] &= ~(1 << (i & 7));
+            }
+        }
+    }
+
+    ExReleaseResourceLite(&Cache->Resource);
+
+    return Status;
+}
+
+/**
+* @name NtfsReadNextMftRecord
+* @implemented
+*
+* Returns the next file record in use, in the order of the MFT.
+*
+* @param Vcb
+* Points to the DEVICE_EXTENSION of the volume.
+*
+* @param Scan
+* State of the scan, from NtfsStartMftScan().
+*
+* @param MftIndex
+* Receives the MFT index of the record.
+*
+* @param FileRecord
+* Receives a pointer to the record, valid until the next call.
+*
+* @return
+* STATUS_SUCCESS, STATUS_END_OF_FILE once every record was returned, or the error from
+* reading $MFT.
+*
+* @remarks
+* Instead of one read per record, $MFT is read in chunks of NTFS_MFT_SCAN_CHUNK_SIZE bytes,
+* skipping the records $MFT:$BITMAP shows unused. Extension records are returned too.
+*/
+NTSTATUS
+NtfsReadNextMftRecord(PDEVICE_EXTENSION Vcb,
+                      PNTFS_MFT_SCAN Scan,
+                      PULONGLONG MftIndex,
+                      PFILE_RECORD_HEADER *FileRecord)
+{
+    PFILE_RECORD_HEADER Record;
+    ULONG i;
+    NTSTATUS Status;
+
+    while (Scan->NextIndex < Scan->RecordCount)
+    {
+        if (Scan->NextIndex < Scan->ChunkStart ||
+            Scan->NextIndex >= Scan->ChunkStart + Scan->ChunkValid)
         {
-            // Sparse data run.
-            DataRunStartLCN = -1;
+            Status = NtfsLoadMftScanChunk(Vcb, Scan);
+            if (!NT_SUCCESS(Status))
+                return Status;
         }
-    } // end while (Length > 0) [more data to write]
-
-    Context->CacheRun = DataRun;
-    Context->CacheRunOffset = Offset + *RealLengthWritten;
-    Context->CacheRunStartLCN = DataRunStartLCN;
-    Context->CacheRunLength = DataRunLength;
-    Context->CacheRunLastLCN = LastLCN;
-    Context->CacheRunCurrentOffset = CurrentOffset;
-
-Cleanup:
-    // TEMPTEMP
-    if (Context->pRecord->IsNonResident)
-        ExFreePoolWithTag(TempBuffer, TAG_NTFS);
-
-    return Status;
-}
 
-NTSTATUS
-ReadFileRecord(PDEVICE_EXTENSION Vcb,
-               ULONGLONG index,
-               PFILE_RECORD_HEADER file)
-{
-    ULONGLONG BytesRead;
+        i = (ULONG)(Scan->NextIndex - Scan->ChunkStart);
+        Scan->NextIndex++;
 
-    DPRINT("ReadFileRecord(%p, %I64x, %p)\n", Vcb, index, file);
+        if (!MFT_SCAN_BIT(Scan, i))
+            continue;
 
-    BytesRead = ReadAttribute(Vcb, Vcb->MFTContext, index * Vcb->NtfsInfo.BytesPerFileRecord, (PCHAR)file, Vcb->NtfsInfo.BytesPerFileRecord);
-    if (BytesRead != Vcb->NtfsInfo.BytesPerFileRecord)
-    {
-        DPRINT1("ReadFileRecord failed: %I64u read, %lu expected\n", BytesRead, Vcb->NtfsInfo.BytesPerFileRecord);
-        return STATUS_PARTIAL_COPY;
+        Record = (PFILE_RECORD_HEADER)(Scan->Records + i * Vcb->NtfsInfo.BytesPerFileRecord);
+        if (Record->Flags & FRH_IN_USE)
+        {
+            *MftIndex = Scan->ChunkStart + i;
+            *FileRecord = Record;
+            return STATUS_SUCCESS;
+        }
     }
 
-    /* Apply update sequence array fixups. */
-    DPRINT("Sequence number: %u\n", file->SequenceNumber);
-    return FixupUpdateSequenceArray(Vcb, &file->Ntfs);
+    return STATUS_END_OF_FILE;
 }
 
 
@@ -1682,6 +2433,9 @@ UpdateFileNameRecord(PDEVICE_EXTENSION Vcb,
            NewAllocationSize,
            CaseSensitive ? "TRUE" : "FALSE");
 
+    // The sizes returned by the cursors of the directory are about to change
+    NtfsIncrementIndexGeneration(Vcb, ParentMFTIndex);
+
     MftRecord = ExAllocateFromNPagedLookasideList(&Vcb->FileRecLookasideList);
     if (MftRecord == NULL)
     {
@@ -1811,7 +2565,7 @@ UpdateIndexEntryFileNameSize(PDEVICE_EXTENSION Vcb,
         if ((IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK) > NTFS_FILE_FIRST_USER_FILE &&
             *CurrentEntry >= *StartEntry &&
             IndexEntry->FileName.NameType != NTFS_FILE_NAME_DOS &&
-            CompareFileName(FileName, IndexEntry, DirSearch, CaseSensitive))
+            CompareFileName(Vcb, FileName, IndexEntry, DirSearch, CaseSensitive))
         {
             *StartEntry = *CurrentEntry;
             IndexEntry->FileName.DataSize = NewDataSize;
@@ -1862,7 +2616,7 @@ UpdateIndexEntryFileNameSize(PDEVICE_EXTENSION Vcb,
         LastEntry = (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)&IndexBuffer->Header + IndexBuffer->Header.TotalSizeOfEntries);
         ASSERT(LastEntry <= (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)IndexBuffer + IndexBlockSize));
 
-        Status = UpdateIndexEntryFileNameSize(NULL,
+        Status = UpdateIndexEntryFileNameSize(Vcb,
                                               NULL,
                                               NULL,
                                               0,
@@ -1926,17 +2680,66 @@ UpdateIndexEntryFileNameSize(PDEVICE_EXTENSION Vcb,
 * @return
 * STATUS_SUCCESSFUL on success. An error passed from WriteAttribute() otherwise.
 *
+* @remarks
+* The record is normally only copied into the MFT cache and marked dirty; it reaches the disk
+* when it's evicted or when NtfsFlushMftCache() is called. It's written through only if the
+* cache has no room for it. FileRecord isn't modified either way.
 */
 NTSTATUS
 UpdateFileRecord(PDEVICE_EXTENSION Vcb,
                  ULONGLONG MftIndex,
                  PFILE_RECORD_HEADER FileRecord)
 {
+    PNTFS_MFT_CACHE Cache = &Vcb->MftCache;
+    PNTFS_MFT_CACHE_ENTRY Entry;
+    PFILE_RECORD_HEADER CachedRecord;
+    PFIXUP_ARRAY FixupArray;
+    USHORT USN = 0;
+    BOOLEAN WasCached;
     ULONG BytesWritten;
     NTSTATUS Status = STATUS_SUCCESS;
 
     DPRINT("UpdateFileRecord(%p, 0x%I64x, %p)\n", Vcb, MftIndex, FileRecord);
 
+    ExAcquireResourceExclusiveLite(&Cache->Resource, TRUE);
+
+    Entry = NtfsLookupMftCacheEntry(Cache, MftIndex);
+    WasCached = (Entry != NULL);
+    if (!WasCached)
+        Entry = NtfsAllocateMftCacheEntry(Vcb, MftIndex);
+
+    if (Entry != NULL)
+    {
+        // Keep the record dirty in the cache, it will be written back with a fixup array later
+        CachedRecord = MFT_CACHE_ENTRY_RECORD(Entry);
+        if (WasCached)
+        {
+            // Don't let the caller's copy roll back the update sequence number
+            FixupArray = (PFIXUP_ARRAY)((ULONG_PTR)CachedRecord + CachedRecord->Ntfs.UsaOffset);
+            USN = FixupArray->USN;
+        }
+
+        if (CachedRecord != FileRecord)
+            RtlCopyMemory(CachedRecord, FileRecord, Vcb->NtfsInfo.BytesPerFileRecord);
+
+        if (WasCached)
+        {
+            FixupArray = (PFIXUP_ARRAY)((ULONG_PTR)CachedRecord + CachedRecord->Ntfs.UsaOffset);
+            FixupArray->USN = USN;
+        }
+
+        if (!Entry->Dirty)
+        {
+            Entry->Dirty = TRUE;
+            Cache->DirtyCount++;
+        }
+
+        ExReleaseResourceLite(&Cache->Resource);
+        return STATUS_SUCCESS;
+    }
+
+    // No room in the cache, write the record through
+
     // Add the fixup array to prepare the data for writing to disk
     AddFixupArray(Vcb, &FileRecord->Ntfs);
 
@@ -1953,10 +2756,13 @@ UpdateFileRecord(PDEVICE_EXTENSION Vcb,
     {
         DPRINT1("UpdateFileRecord failed: %lu written, %lu expected\n", BytesWritten, Vcb->NtfsInfo.BytesPerFileRecord);
     }
+    Cache->WriteGeneration++;
 
     // remove the fixup array (so the file record pointer can still be used)
     FixupUpdateSequenceArray(Vcb, &FileRecord->Ntfs);
 
+    ExReleaseResourceLite(&Cache->Resource);
+
     return Status;
 }
 
@@ -1992,37 +2798,15 @@ FixupUpdateSequenceArray(PDEVICE_EXTENSION Vcb,
     return STATUS_SUCCESS;
 }
 
-/**
-* @name AddNewMftEntry
-* @implemented
-*
-* Adds a file record to the master file table of a given device.
-*
-* @param FileRecord
-* Pointer to a complete file record which will be saved to disk.
-*
-* @param DeviceExt
-* Pointer to the DEVICE_EXTENSION of the target drive.
-*
-* @param DestinationIndex
-* Pointer to a ULONGLONG which will receive the MFT index where the file record was stored.
-*
-* @param CanWait
-* Boolean indicating if the function is allowed to wait for exclusive access to the master file table.
-* This will only be relevant if the MFT doesn't have any free file records and needs to be enlarged.
-*
-* @return
-* STATUS_SUCCESS on success.
-* STATUS_OBJECT_NAME_NOT_FOUND if we can't find the MFT's $Bitmap or if we weren't able
-* to read the attribute.
-* STATUS_INSUFFICIENT_RESOURCES if we can't allocate enough memory for a copy of $Bitmap.
-* STATUS_CANT_WAIT if CanWait was FALSE and the function could not get immediate, exclusive access to the MFT.
-*/
+/*
+ * Body of AddNewMftEntry(), with DirResource held exclusively
+ */
+static
 NTSTATUS
-AddNewMftEntry(PFILE_RECORD_HEADER FileRecord,
-               PDEVICE_EXTENSION DeviceExt,
-               PULONGLONG DestinationIndex,
-               BOOLEAN CanWait)
+NtfsAllocateMftEntry(PFILE_RECORD_HEADER FileRecord,
+                     PDEVICE_EXTENSION DeviceExt,
+                     PULONGLONG DestinationIndex,
+                     BOOLEAN CanWait)
 {
     NTSTATUS Status = STATUS_SUCCESS;
     ULONGLONG MftIndex;
@@ -2036,7 +2820,7 @@ AddNewMftEntry(PFILE_RECORD_HEADER FileRecord,
     LARGE_INTEGER BitmapBits;
     UCHAR SystemReservedBits;
 
-    DPRINT1("AddNewMftEntry(%p, %p, %p, %s)\n", FileRecord, DeviceExt, DestinationIndex, CanWait ? "TRUE" : "FALSE");
+    DPRINT1("NtfsAllocateMftEntry(%p, %p, %p, %s)\n", FileRecord, DeviceExt, DestinationIndex, CanWait ? "TRUE" : "FALSE");
 
     // First, we have to read the mft's $Bitmap attribute
 
@@ -2112,7 +2896,7 @@ AddNewMftEntry(PFILE_RECORD_HEADER FileRecord,
             return Status;
         }
 
-        return AddNewMftEntry(FileRecord, DeviceExt, DestinationIndex, CanWait);
+        return NtfsAllocateMftEntry(FileRecord, DeviceExt, DestinationIndex, CanWait);
     }
 
     DPRINT1("Creating file record at MFT index: %I64u\n", MftIndex);
@@ -2154,6 +2938,53 @@ AddNewMftEntry(PFILE_RECORD_HEADER FileRecord,
     return Status;
 }
 
+/**
+* @name AddNewMftEntry
+* @implemented
+*
+* Adds a file record to the master file table of a given device.
+*
+* @param FileRecord
+* Pointer to a complete file record which will be saved to disk.
+*
+* @param DeviceExt
+* Pointer to the DEVICE_EXTENSION of the target drive.
+*
+* @param DestinationIndex
+* Pointer to a ULONGLONG which will receive the MFT index where the file record was stored.
+*
+* @param CanWait
+* Boolean indicating if the function is allowed to wait for exclusive access to the master file table.
+* This will only be relevant if the MFT doesn't have any free file records and needs to be enlarged.
+*
+* @return
+* STATUS_SUCCESS on success.
+* STATUS_OBJECT_NAME_NOT_FOUND if we can't find the MFT's $Bitmap or if we weren't able
+* to read the attribute.
+* STATUS_INSUFFICIENT_RESOURCES if we can't allocate enough memory for a copy of $Bitmap.
+* STATUS_CANT_WAIT if CanWait was FALSE and the function could not get immediate, exclusive access to the MFT.
+*/
+NTSTATUS
+AddNewMftEntry(PFILE_RECORD_HEADER FileRecord,
+               PDEVICE_EXTENSION DeviceExt,
+               PULONGLONG DestinationIndex,
+               BOOLEAN CanWait)
+{
+    NTSTATUS Status;
+
+    // Creates in different directories run concurrently, but they all allocate from the MFT's $Bitmap
+    if (!ExAcquireResourceExclusiveLite(&DeviceExt->DirResource, CanWait))
+    {
+        return STATUS_CANT_WAIT;
+    }
+
+    Status = NtfsAllocateMftEntry(FileRecord, DeviceExt, DestinationIndex, CanWait);
+
+    ExReleaseResourceLite(&DeviceExt->DirResource);
+
+    return Status;
+}
+
 /**
 * @name NtfsAddFilenameToDirectory
 * @implemented
@@ -2187,6 +3018,8 @@ AddNewMftEntry(PFILE_RECORD_HEADER FileRecord,
 * One FILENAME_ATTRIBUTE is added to the directory's index for each link to that file. So, each
 * file which contains one FILENAME_ATTRIBUTE for a long name and another for the 8.3 name, will
 * get both attributes added to its parent directory.
+* Only the index records on the path from the root to the leaf receiving the new entry are read,
+* and only the records that changed (plus any created by a split) are written back.
 */
 NTSTATUS
 NtfsAddFilenameToDirectory(PDEVICE_EXTENSION DeviceExt,
@@ -2214,6 +3047,9 @@ NtfsAddFilenameToDirectory(PDEVICE_EXTENSION DeviceExt,
     ULONG NewMaxIndexRootSize;
     ULONG NodeSize;
 
+    // The cursors of the directory can't trust their index buffers anymore
+    NtfsIncrementIndexGeneration(DeviceExt, DirectoryMftIndex);
+
     // Allocate memory for the parent directory
     ParentFileRecord = ExAllocateFromNPagedLookasideList(&DeviceExt->FileRecLookasideList);
     if (!ParentFileRecord)
@@ -2646,13 +3482,17 @@ ReadLCN(PDEVICE_EXTENSION Vcb,
 }
 
 
+/* Longest search expression upcased without allocating memory */
+#define NTFS_EXPRESSION_STACK_CHARS 64
+
 BOOLEAN
-CompareFileName(PUNICODE_STRING FileName,
+CompareFileName(PDEVICE_EXTENSION Vcb,
+                PUNICODE_STRING FileName,
                 PINDEX_ENTRY_ATTRIBUTE IndexEntry,
                 BOOLEAN DirSearch,
                 BOOLEAN CaseSensitive)
 {
-    BOOLEAN Ret, Alloc = FALSE;
+    BOOLEAN Ret;
     UNICODE_STRING EntryName;
 
     EntryName.Buffer = IndexEntry->FileName.Name;
@@ -2662,28 +3502,54 @@ CompareFileName(PUNICODE_STRING FileName,
     if (DirSearch)
     {
         UNICODE_STRING IntFileName;
+        WCHAR StackBuffer[NTFS_EXPRESSION_STACK_CHARS];
+
         if (!CaseSensitive)
         {
-            NT_VERIFY(NT_SUCCESS(RtlUpcaseUnicodeString(&IntFileName, FileName, TRUE)));
-            Alloc = TRUE;
+            // FsRtlIsNameInExpression() wants an upcased expression, upcased like the names with $UpCase
+            IntFileName.Length =
+            IntFileName.MaximumLength = FileName->Length;
+            if (FileName->Length <= sizeof(StackBuffer))
+            {
+                IntFileName.Buffer = StackBuffer;
+            }
+            else
+            {
+                IntFileName.Buffer = ExAllocatePoolWithTag(NonPagedPool, FileName->Length, TAG_NTFS);
+                if (IntFileName.Buffer == NULL)
+                    return FALSE;
+            }
+
+            NtfsUpcaseName(Vcb, IntFileName.Buffer, FileName->Buffer, FileName->Length / sizeof(WCHAR));
         }
         else
         {
             IntFileName = *FileName;
         }
 
-        Ret = FsRtlIsNameInExpression(&IntFileName, &EntryName, !CaseSensitive, NULL);
+        Ret = FsRtlIsNameInExpression(&IntFileName, &EntryName, !CaseSensitive, CaseSensitive ? NULL : Vcb->UpcaseTable);
 
-        if (Alloc)
+        if (IntFileName.Buffer != StackBuffer && IntFileName.Buffer != FileName->Buffer)
         {
-            RtlFreeUnicodeString(&IntFileName);
+            ExFreePoolWithTag(IntFileName.Buffer, TAG_NTFS);
         }
 
         return Ret;
     }
     else
     {
-        return (RtlCompareUnicodeString(FileName, &EntryName, !CaseSensitive) == 0);
+        if (FileName->Length != EntryName.Length)
+            return FALSE;
+
+        if (CaseSensitive)
+            return RtlEqualMemory(FileName->Buffer, EntryName.Buffer, EntryName.Length);
+
+        return NtfsCollateFileNames(Vcb,
+                                    FileName->Buffer,
+                                    FileName->Length / sizeof(WCHAR),
+                                    EntryName.Buffer,
+                                    IndexEntry->FileName.NameLength,
+                                    FALSE) == 0;
     }
 }
 
@@ -2722,6 +3588,14 @@ UpdateMftMirror(PNTFS_VCB Vcb)
     ULONG BytesRead;
     ULONG LengthWritten;
 
+    // The mirror is copied straight from the disk, so it must see the records modified in the cache
+    Status = NtfsFlushMftCache(Vcb);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("ERROR: Failed to write back the MFT cache!\n");
+        return Status;
+    }
+
     // Allocate memory for the Mft mirror file record
     MirrorFileRecord = ExAllocateFromNPagedLookasideList(&Vcb->FileRecLookasideList);
     if (!MirrorFileRecord)
@@ -2873,8 +3747,11 @@ BrowseSubNodeIndexEntries(PNTFS_VCB Vcb,
            CaseSensitive ? "TRUE" : "FALSE",
            OutMFTIndex);
 
-    // Calculate node number as VCN / Clusters per index record
-    NodeNumber = VCN / (Vcb->NtfsInfo.BytesPerIndexRecord / Vcb->NtfsInfo.BytesPerCluster);
+    // Calculate offset of index record
+    Offset = GetAllocationOffsetFromVCN(Vcb, IndexBlockSize, VCN);
+
+    // Calculate node number from the offset, index buffers smaller than a cluster aren't addressed in clusters
+    NodeNumber = (ULONG)(Offset / IndexBlockSize);
 
     // Is the bit for this node clear in the bitmap?
     if (!RtlCheckBit(Bitmap, NodeNumber))
@@ -2891,9 +3768,6 @@ BrowseSubNodeIndexEntries(PNTFS_VCB Vcb,
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    // Calculate offset of index record
-    Offset = VCN * Vcb->NtfsInfo.BytesPerCluster;
-
     // Read the index record
     BytesRead = ReadAttribute(Vcb, IndexAllocationContext, Offset, (PCHAR)IndexRecord, IndexBlockSize);
     if (BytesRead != IndexBlockSize)
@@ -2958,10 +3832,11 @@ BrowseSubNodeIndexEntries(PNTFS_VCB Vcb,
             break;
 
         // If we've found a file whose index is greater than or equal to StartEntry that matches the search criteria
+        // Short names are only skipped when listing, an exact name may be one
         if ((IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK) >= NTFS_FILE_FIRST_USER_FILE &&
             *CurrentEntry >= *StartEntry &&
-            IndexEntry->FileName.NameType != NTFS_FILE_NAME_DOS &&
-            CompareFileName(FileName, IndexEntry, DirSearch, CaseSensitive))
+            (IndexEntry->FileName.NameType != NTFS_FILE_NAME_DOS || !DirSearch) &&
+            CompareFileName(Vcb, FileName, IndexEntry, DirSearch, CaseSensitive))
         {
             *StartEntry = *CurrentEntry;
             *OutMFTIndex = (IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK);
@@ -3110,10 +3985,11 @@ BrowseIndexEntries(PDEVICE_EXTENSION Vcb,
             break;
 
         // If we've found a file whose index is greater than or equal to StartEntry that matches the search criteria
+        // Short names are only skipped when listing, an exact name may be one
         if ((IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK) >= NTFS_FILE_FIRST_USER_FILE &&
             *CurrentEntry >= *StartEntry &&
-            IndexEntry->FileName.NameType != NTFS_FILE_NAME_DOS &&
-            CompareFileName(FileName, IndexEntry, DirSearch, CaseSensitive))
+            (IndexEntry->FileName.NameType != NTFS_FILE_NAME_DOS || !DirSearch) &&
+            CompareFileName(Vcb, FileName, IndexEntry, DirSearch, CaseSensitive))
         {
             *StartEntry = *CurrentEntry;
             *OutMFTIndex = (IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK);
@@ -3142,6 +4018,246 @@ BrowseIndexEntries(PDEVICE_EXTENSION Vcb,
     return STATUS_OBJECT_PATH_NOT_FOUND;
 }
 
+/* Compares a name to the key of an index entry in $I30 collation order; the end entry comes after every name */
+static
+LONG
+NtfsCollateIndexEntry(PDEVICE_EXTENSION Vcb,
+                      PUNICODE_STRING FileName,
+                      PINDEX_ENTRY_ATTRIBUTE IndexEntry)
+{
+    if (IndexEntry->Flags & NTFS_INDEX_ENTRY_END)
+        return -1;
+
+    return NtfsCollateFileNames(Vcb,
+                                FileName->Buffer,
+                                FileName->Length / sizeof(WCHAR),
+                                IndexEntry->FileName.Name,
+                                IndexEntry->FileName.NameLength,
+                                FALSE);
+}
+
+/*
+ * Binary searches an index node for the first entry whose key isn't lower than FileName.
+ * Entries is a scratch array able to hold MaxEntries pointers.
+ */
+static
+NTSTATUS
+NtfsSearchIndexNode(PDEVICE_EXTENSION Vcb,
+                    PINDEX_HEADER_ATTRIBUTE Header,
+                    ULONG NodeSize,
+                    PUNICODE_STRING FileName,
+                    PINDEX_ENTRY_ATTRIBUTE *Entries,
+                    ULONG MaxEntries,
+                    PINDEX_ENTRY_ATTRIBUTE *Found,
+                    PLONG Comparison)
+{
+    PINDEX_ENTRY_ATTRIBUTE IndexEntry;
+    ULONG Offset, Count, Low, High, Middle;
+
+    if (Header->TotalSizeOfEntries > NodeSize)
+    {
+        DPRINT1("Filesystem corruption detected!\n");
+        return STATUS_DATA_ERROR;
+    }
+
+    // Entries have variable lengths, so locate them all first, without comparing anything
+    Count = 0;
+    Offset = Header->FirstEntryOffset;
+    for (;;)
+    {
+        if (Count == MaxEntries ||
+            Offset + FIELD_OFFSET(INDEX_ENTRY_ATTRIBUTE, FileName) > Header->TotalSizeOfEntries)
+        {
+            DPRINT1("Filesystem corruption detected!\n");
+            return STATUS_DATA_ERROR;
+        }
+
+        IndexEntry = (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)Header + Offset);
+        Entries[Count++] = IndexEntry;
+
+        if (IndexEntry->Flags & NTFS_INDEX_ENTRY_END)
+            break;
+
+        if (IndexEntry->Length < sizeof(INDEX_ENTRY_ATTRIBUTE) ||
+            Offset + IndexEntry->Length > Header->TotalSizeOfEntries)
+        {
+            DPRINT1("Filesystem corruption detected!\n");
+            return STATUS_DATA_ERROR;
+        }
+
+        Offset += IndexEntry->Length;
+    }
+
+    // The end entry is always the upper bound
+    Low = 0;
+    High = Count - 1;
+    while (Low < High)
+    {
+        Middle = Low + (High - Low) / 2;
+        if (NtfsCollateIndexEntry(Vcb, FileName, Entries[Middle]) > 0)
+            Low = Middle + 1;
+        else
+            High = Middle;
+    }
+
+    *Found = Entries[Low];
+    *Comparison = NtfsCollateIndexEntry(Vcb, FileName, Entries[Low]);
+
+    return STATUS_SUCCESS;
+}
+
+/**
+* @name NtfsFindIndexEntryByName
+* @implemented
+*
+* Looks up a file name in the $I30 index of a directory by descending the B-tree, reading
+* a single index buffer per level.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @param MftRecord
+* Pointer to the file record of the directory.
+*
+* @param IndexRoot
+* Pointer to a copy of the $INDEX_ROOT value of the directory, Vcb->NtfsInfo.BytesPerIndexRecord long.
+*
+* @param FileName
+* Name of the file to look up. It may not contain wildcards.
+*
+* @param CaseSensitive
+* TRUE if the name must match case-sensitively.
+*
+* @param OutMFTIndex
+* Receives the MFT index of the file found.
+*
+* @return
+* STATUS_SUCCESS if the file was found, STATUS_OBJECT_PATH_NOT_FOUND if it wasn't,
+* STATUS_MORE_PROCESSING_REQUIRED if an entry collates equal to FileName but can't be returned,
+* or an error status.
+*
+* @remarks
+* Names collate case-insensitively, so POSIX names differing only by case share a position
+* in the index. The caller must browse the index when STATUS_MORE_PROCESSING_REQUIRED is
+* returned. Short names have their own entries, collated among the long ones, so they're
+* found by the same descent.
+*/
+static
+NTSTATUS
+NtfsFindIndexEntryByName(PDEVICE_EXTENSION Vcb,
+                         PFILE_RECORD_HEADER MftRecord,
+                         PINDEX_ROOT_ATTRIBUTE IndexRoot,
+                         PUNICODE_STRING FileName,
+                         BOOLEAN CaseSensitive,
+                         ULONGLONG *OutMFTIndex)
+{
+    PNTFS_ATTR_CONTEXT IndexAllocationContext = NULL;
+    PINDEX_BUFFER IndexBuffer = NULL;
+    PINDEX_ENTRY_ATTRIBUTE *Entries;
+    PINDEX_HEADER_ATTRIBUTE Header;
+    PINDEX_ENTRY_ATTRIBUTE IndexEntry;
+    ULONG IndexBlockSize, NodeSize, MaxEntries, Depth;
+    ULONGLONG VCN;
+    LONG Comparison;
+    NTSTATUS Status;
+
+    IndexBlockSize = IndexRoot->SizeOfEntry;
+    MaxEntries = max(IndexBlockSize, Vcb->NtfsInfo.BytesPerIndexRecord) / sizeof(INDEX_ENTRY_ATTRIBUTE) + 1;
+
+    Entries = ExAllocatePoolWithTag(NonPagedPool, MaxEntries * sizeof(PINDEX_ENTRY_ATTRIBUTE), TAG_NTFS);
+    if (Entries == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    Header = &IndexRoot->Header;
+    NodeSize = Vcb->NtfsInfo.BytesPerIndexRecord - FIELD_OFFSET(INDEX_ROOT_ATTRIBUTE, Header);
+
+    for (Depth = 0; ; Depth++)
+    {
+        Status = NtfsSearchIndexNode(Vcb, Header, NodeSize, FileName, Entries, MaxEntries, &IndexEntry, &Comparison);
+        if (!NT_SUCCESS(Status))
+            break;
+
+        if (Comparison == 0)
+        {
+            // A short name names its file like the long one does
+            if ((IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK) < NTFS_FILE_FIRST_USER_FILE ||
+                (CaseSensitive && !CompareFileName(Vcb, FileName, IndexEntry, FALSE, TRUE)))
+            {
+                Status = STATUS_MORE_PROCESSING_REQUIRED;
+                break;
+            }
+
+            *OutMFTIndex = IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK;
+            Status = STATUS_SUCCESS;
+            break;
+        }
+
+        // Every key of the sub-node is lower than the entry pointing to it
+        if (!(IndexEntry->Flags & NTFS_INDEX_ENTRY_NODE))
+        {
+            Status = STATUS_OBJECT_PATH_NOT_FOUND;
+            break;
+        }
+
+        if (Depth == NTFS_INDEX_CURSOR_MAX_DEPTH)
+        {
+            DPRINT1("Filesystem corruption detected!\n");
+            Status = STATUS_DATA_ERROR;
+            break;
+        }
+
+        if (IndexAllocationContext == NULL)
+        {
+            Status = FindAttribute(Vcb, MftRecord, AttributeIndexAllocation, L"$I30", 4, &IndexAllocationContext, NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                DPRINT1("Filesystem corruption detected!\n");
+                IndexAllocationContext = NULL;
+                Status = STATUS_DATA_ERROR;
+                break;
+            }
+
+            IndexBuffer = ExAllocatePoolWithTag(NonPagedPool, IndexBlockSize, TAG_NTFS);
+            if (IndexBuffer == NULL)
+            {
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+                break;
+            }
+        }
+
+        VCN = GetIndexEntryVCN(IndexEntry);
+        if (ReadAttribute(Vcb,
+                          IndexAllocationContext,
+                          GetAllocationOffsetFromVCN(Vcb, IndexBlockSize, VCN),
+                          (PCHAR)IndexBuffer,
+                          IndexBlockSize) != IndexBlockSize ||
+            IndexBuffer->Ntfs.Type != NRH_INDX_TYPE)
+        {
+            DPRINT1("Unable to read index record at VCN %I64u!\n", VCN);
+            Status = STATUS_DATA_ERROR;
+            break;
+        }
+
+        Status = FixupUpdateSequenceArray(Vcb, &IndexBuffer->Ntfs);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Failed to apply fixup array!\n");
+            break;
+        }
+
+        Header = &IndexBuffer->Header;
+        NodeSize = IndexBlockSize - FIELD_OFFSET(INDEX_BUFFER, Header);
+    }
+
+    if (IndexBuffer != NULL)
+        ExFreePoolWithTag(IndexBuffer, TAG_NTFS);
+    if (IndexAllocationContext != NULL)
+        ReleaseAttributeContext(IndexAllocationContext);
+    ExFreePoolWithTag(Entries, TAG_NTFS);
+
+    return Status;
+}
+
 NTSTATUS
 NtfsFindMftRecord(PDEVICE_EXTENSION Vcb,
                   ULONGLONG MFTIndex,
@@ -3206,6 +4322,18 @@ NtfsFindMftRecord(PDEVICE_EXTENSION Vcb,
 
     DPRINT("IndexRecordSize: %x IndexBlockSize: %x\n", Vcb->NtfsInfo.BytesPerIndexRecord, IndexRoot->SizeOfEntry);
 
+    // Exact names don't need the whole index to be browsed
+    if (!DirSearch)
+    {
+        Status = NtfsFindIndexEntryByName(Vcb, MftRecord, IndexRoot, FileName, CaseSensitive, OutMFTIndex);
+        if (Status != STATUS_MORE_PROCESSING_REQUIRED)
+        {
+            ExFreePoolWithTag(IndexRecord, TAG_NTFS);
+            ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, MftRecord);
+            return Status;
+        }
+    }
+
     Status = BrowseIndexEntries(Vcb,
                                 MftRecord,
                                 (PINDEX_ROOT_ATTRIBUTE)IndexRecord,
@@ -3260,7 +4388,7 @@ NtfsLookupFileAt(PDEVICE_EXTENSION Vcb,
         if (Remaining.Length == 0)
             break;
 
-        FsRtlDissectName(Current, &Current, &Remaining);
+        FsRtlDissectName(Remaining, &Current, &Remaining);
     }
 
     *FileRecord = ExAllocateFromNPagedLookasideList(&Vcb->FileRecLookasideList);
@@ -3398,4 +4526,517 @@ NtfsFindFileAt(PDEVICE_EXTENSION Vcb,
     return STATUS_SUCCESS;
 }
 
+/**
+* @name NtfsReleaseIndexCursor
+* @implemented
+*
+* Frees everything a directory index cursor holds. The cursor itself isn't freed and
+* can be used again.
+*
+* @param Cursor
+* Pointer to the NTFS_INDEX_CURSOR to release.
+*/
+VOID
+NtfsReleaseIndexCursor(PNTFS_INDEX_CURSOR Cursor)
+{
+    ULONG i;
+
+    for (i = 0; i < NTFS_INDEX_CURSOR_MAX_DEPTH; i++)
+    {
+        if (Cursor->Levels[i].IndexBuffer != NULL)
+            ExFreePoolWithTag(Cursor->Levels[i].IndexBuffer, TAG_NTFS);
+    }
+
+    if (Cursor->IndexRoot != NULL)
+        ExFreePoolWithTag(Cursor->IndexRoot, TAG_NTFS);
+
+    if (Cursor->IndexAllocationContext != NULL)
+        ReleaseAttributeContext(Cursor->IndexAllocationContext);
+
+    if (Cursor->ReadAheadBuffer != NULL)
+        ExFreePoolWithTag(Cursor->ReadAheadBuffer, TAG_NTFS);
+
+    RtlZeroMemory(Cursor, sizeof(NTFS_INDEX_CURSOR));
+}
+
+/* Positions the cursor before the first entry of the index of a directory */
+static
+NTSTATUS
+NtfsRewindIndexCursor(PDEVICE_EXTENSION Vcb,
+                      PNTFS_INDEX_CURSOR Cursor,
+                      ULONGLONG DirectoryMftIndex)
+{
+    PFILE_RECORD_HEADER MftRecord;
+    PNTFS_ATTR_CONTEXT IndexRootCtx;
+    ULONG IndexRootLength;
+    BOOLEAN PrefetchFileRecords = Cursor->PrefetchFileRecords;
+    NTSTATUS Status;
+
+    NtfsReleaseIndexCursor(Cursor);
+    Cursor->PrefetchFileRecords = PrefetchFileRecords;
+
+    MftRecord = ExAllocateFromNPagedLookasideList(&Vcb->FileRecLookasideList);
+    if (MftRecord == NULL)
+    {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Status = ReadFileRecord(Vcb, DirectoryMftIndex, MftRecord);
+    if (!NT_SUCCESS(Status))
+    {
+        ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, MftRecord);
+        return Status;
+    }
+
+    Status = FindAttribute(Vcb, MftRecord, AttributeIndexRoot, L"$I30", 4, &IndexRootCtx, NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, MftRecord);
+        return Status;
+    }
+
+    /* Index root is always resident. */
+    IndexRootLength = (ULONG)AttributeDataLength(IndexRootCtx->pRecord);
+    Cursor->IndexRoot = ExAllocatePoolWithTag(NonPagedPool, IndexRootLength, TAG_NTFS);
+    if (Cursor->IndexRoot == NULL)
+    {
+        ReleaseAttributeContext(IndexRootCtx);
+        ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, MftRecord);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (ReadAttribute(Vcb, IndexRootCtx, 0, (PCHAR)Cursor->IndexRoot, IndexRootLength) != IndexRootLength ||
+        IndexRootLength < FIELD_OFFSET(INDEX_ROOT_ATTRIBUTE, Header) + Cursor->IndexRoot->Header.TotalSizeOfEntries)
+    {
+        DPRINT1("Invalid $INDEX_ROOT for directory 0x%I64x\n", DirectoryMftIndex);
+        ReleaseAttributeContext(IndexRootCtx);
+        ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, MftRecord);
+        NtfsReleaseIndexCursor(Cursor);
+        return STATUS_DATA_ERROR;
+    }
+    ReleaseAttributeContext(IndexRootCtx);
+
+    // The index allocation is only there for large indexes
+    Status = FindAttribute(Vcb, MftRecord, AttributeIndexAllocation, L"$I30", 4, &Cursor->IndexAllocationContext, NULL);
+    if (!NT_SUCCESS(Status))
+        Cursor->IndexAllocationContext = NULL;
+
+    ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, MftRecord);
+
+    Cursor->DirectoryMftIndex = DirectoryMftIndex;
+    Cursor->IndexBlockSize = Cursor->IndexRoot->SizeOfEntry;
+    Cursor->Depth = 1;
+    Cursor->Levels[0].VCN = 0;
+    Cursor->Levels[0].Header = &Cursor->IndexRoot->Header;
+    Cursor->Levels[0].EntryOffset = Cursor->IndexRoot->Header.FirstEntryOffset;
+    Cursor->Levels[0].SubNodeBrowsed = FALSE;
+    Cursor->Levels[0].PrefetchedOffset = 0;
+
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Returns how many index buffers, from the one at Offset in $INDEX_ALLOCATION, are the sub-nodes
+ * of the current entry of the deepest level and of the entries following it, in that order.
+ * Those are the next buffers the cursor descends into.
+ */
+static
+ULONG
+NtfsCountIndexReadAheadBlocks(PDEVICE_EXTENSION Vcb,
+                              PNTFS_INDEX_CURSOR Cursor,
+                              ULONGLONG Offset)
+{
+    PNTFS_INDEX_CURSOR_LEVEL Parent = &Cursor->Levels[Cursor->Depth - 1];
+    PINDEX_ENTRY_ATTRIBUTE IndexEntry;
+    ULONG EntryOffset = Parent->EntryOffset;
+    ULONG Blocks;
+
+    IndexEntry = (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)Parent->Header + EntryOffset);
+    for (Blocks = 1; Blocks < NTFS_INDEX_READ_AHEAD_BLOCKS; Blocks++)
+    {
+        if ((IndexEntry->Flags & NTFS_INDEX_ENTRY_END) || IndexEntry->Length < sizeof(INDEX_ENTRY_ATTRIBUTE))
+            break;
+
+        EntryOffset += IndexEntry->Length;
+        if (EntryOffset + FIELD_OFFSET(INDEX_ENTRY_ATTRIBUTE, FileName) > Parent->Header->TotalSizeOfEntries)
+            break;
+
+        IndexEntry = (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)Parent->Header + EntryOffset);
+        if (!(IndexEntry->Flags & NTFS_INDEX_ENTRY_NODE) ||
+            IndexEntry->Length < sizeof(INDEX_ENTRY_ATTRIBUTE) + sizeof(ULONGLONG) ||
+            EntryOffset + IndexEntry->Length > Parent->Header->TotalSizeOfEntries ||
+            GetAllocationOffsetFromVCN(Vcb, Cursor->IndexBlockSize, GetIndexEntryVCN(IndexEntry)) != Offset + (ULONGLONG)Blocks * Cursor->IndexBlockSize)
+        {
+            break;
+        }
+    }
+
+    return Blocks;
+}
+
+/*
+ * Reads the index buffer at Offset in $INDEX_ALLOCATION. When the buffers the cursor descends into
+ * next follow it, they're read along with it and kept in the read-ahead buffer of the cursor.
+ */
+static
+ULONG
+NtfsReadIndexBuffer(PDEVICE_EXTENSION Vcb,
+                    PNTFS_INDEX_CURSOR Cursor,
+                    ULONGLONG Offset,
+                    PINDEX_BUFFER IndexBuffer)
+{
+    ULONG Blocks;
+    ULONG BytesRead;
+
+    if (Cursor->ReadAheadBuffer != NULL &&
+        Offset >= Cursor->ReadAheadOffset &&
+        Offset + Cursor->IndexBlockSize <= Cursor->ReadAheadOffset + Cursor->ReadAheadLength)
+    {
+        RtlCopyMemory(IndexBuffer,
+                      Cursor->ReadAheadBuffer + (ULONG)(Offset - Cursor->ReadAheadOffset),
+                      Cursor->IndexBlockSize);
+        return Cursor->IndexBlockSize;
+    }
+
+    Blocks = NtfsCountIndexReadAheadBlocks(Vcb, Cursor, Offset);
+    if (Blocks > 1 && Cursor->ReadAheadBuffer == NULL)
+    {
+        Cursor->ReadAheadBuffer = ExAllocatePoolWithTag(NonPagedPool,
+                                                        NTFS_INDEX_READ_AHEAD_BLOCKS * Cursor->IndexBlockSize,
+                                                        TAG_NTFS);
+    }
+
+    if (Blocks == 1 || Cursor->ReadAheadBuffer == NULL)
+    {
+        return ReadAttribute(Vcb, Cursor->IndexAllocationContext, Offset, (PCHAR)IndexBuffer, Cursor->IndexBlockSize);
+    }
+
+    BytesRead = ReadAttribute(Vcb,
+                              Cursor->IndexAllocationContext,
+                              Offset,
+                              (PCHAR)Cursor->ReadAheadBuffer,
+                              Blocks * Cursor->IndexBlockSize);
+
+    Cursor->ReadAheadOffset = Offset;
+    Cursor->ReadAheadLength = ROUND_DOWN(BytesRead, Cursor->IndexBlockSize);
+    if (Cursor->ReadAheadLength == 0)
+        return 0;
+
+    RtlCopyMemory(IndexBuffer, Cursor->ReadAheadBuffer, Cursor->IndexBlockSize);
+
+    return Cursor->IndexBlockSize;
+}
+
+/* Makes the index buffer at VCN the new deepest level of the cursor */
+static
+NTSTATUS
+NtfsPushIndexCursorLevel(PDEVICE_EXTENSION Vcb,
+                         PNTFS_INDEX_CURSOR Cursor,
+                         ULONGLONG VCN)
+{
+    PNTFS_INDEX_CURSOR_LEVEL Level;
+    ULONG BytesRead;
+    NTSTATUS Status;
+
+    if (Cursor->IndexAllocationContext == NULL || Cursor->Depth == NTFS_INDEX_CURSOR_MAX_DEPTH)
+    {
+        DPRINT1("Filesystem corruption detected!\n");
+        return STATUS_DATA_ERROR;
+    }
+
+    Level = &Cursor->Levels[Cursor->Depth];
+
+    // Buffers are kept from one descent to the next
+    if (Level->IndexBuffer == NULL)
+    {
+        Level->IndexBuffer = ExAllocatePoolWithTag(NonPagedPool, Cursor->IndexBlockSize, TAG_NTFS);
+        if (Level->IndexBuffer == NULL)
+            return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    BytesRead = NtfsReadIndexBuffer(Vcb,
+                                    Cursor,
+                                    GetAllocationOffsetFromVCN(Vcb, Cursor->IndexBlockSize, VCN),
+                                    Level->IndexBuffer);
+    if (BytesRead != Cursor->IndexBlockSize || Level->IndexBuffer->Ntfs.Type != NRH_INDX_TYPE)
+    {
+        DPRINT1("Unable to read index record at VCN %I64u!\n", VCN);
+        return STATUS_DATA_ERROR;
+    }
+
+    Status = FixupUpdateSequenceArray(Vcb, &Level->IndexBuffer->Ntfs);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    Level->VCN = VCN;
+    Level->Header = &Level->IndexBuffer->Header;
+    Level->EntryOffset = Level->Header->FirstEntryOffset;
+    Level->SubNodeBrowsed = FALSE;
+    Level->PrefetchedOffset = 0;
+
+    if (FIELD_OFFSET(INDEX_BUFFER, Header) + Level->Header->TotalSizeOfEntries > Cursor->IndexBlockSize)
+    {
+        DPRINT1("Filesystem corruption detected!\n");
+        return STATUS_DATA_ERROR;
+    }
+
+    Cursor->Depth++;
+
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Returns the next entry of the index in collation order, or NULL with *Status set
+ * when there's none left. Sub-nodes come before the entry that points to them.
+ */
+static
+PINDEX_ENTRY_ATTRIBUTE
+NtfsAdvanceIndexCursor(PDEVICE_EXTENSION Vcb,
+                       PNTFS_INDEX_CURSOR Cursor,
+                       PNTSTATUS Status)
+{
+    PNTFS_INDEX_CURSOR_LEVEL Level;
+    PINDEX_ENTRY_ATTRIBUTE IndexEntry;
+
+    while (Cursor->Depth > 0)
+    {
+        Level = &Cursor->Levels[Cursor->Depth - 1];
+
+        if (Level->EntryOffset + FIELD_OFFSET(INDEX_ENTRY_ATTRIBUTE, FileName) > Level->Header->TotalSizeOfEntries)
+        {
+            DPRINT1("Filesystem corruption detected!\n");
+            *Status = STATUS_DATA_ERROR;
+            return NULL;
+        }
+
+        IndexEntry = (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)Level->Header + Level->EntryOffset);
+
+        // Browse the sub-node first
+        if ((IndexEntry->Flags & NTFS_INDEX_ENTRY_NODE) && !Level->SubNodeBrowsed)
+        {
+            Level->SubNodeBrowsed = TRUE;
+            *Status = NtfsPushIndexCursorLevel(Vcb, Cursor, GetIndexEntryVCN(IndexEntry));
+            if (!NT_SUCCESS(*Status))
+                return NULL;
+            continue;
+        }
+
+        // Done with this node, go back to the entry of the parent that pointed to it
+        if (IndexEntry->Flags & NTFS_INDEX_ENTRY_END)
+        {
+            Cursor->Depth--;
+            continue;
+        }
+
+        if (IndexEntry->Length < sizeof(INDEX_ENTRY_ATTRIBUTE))
+        {
+            DPRINT1("Filesystem corruption detected!\n");
+            *Status = STATUS_DATA_ERROR;
+            return NULL;
+        }
+
+        Level->EntryOffset += IndexEntry->Length;
+        Level->SubNodeBrowsed = FALSE;
+        Cursor->Position++;
+
+        return IndexEntry;
+    }
+
+    Cursor->AtEnd = TRUE;
+    *Status = STATUS_NO_MORE_ENTRIES;
+    return NULL;
+}
+
+static
+BOOLEAN
+NtfsIndexEntryMatches(PDEVICE_EXTENSION Vcb,
+                      PINDEX_ENTRY_ATTRIBUTE IndexEntry,
+                      PUNICODE_STRING SearchPattern,
+                      BOOLEAN CaseSensitive)
+{
+    return (IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK) >= NTFS_FILE_FIRST_USER_FILE &&
+           IndexEntry->FileName.NameType != NTFS_FILE_NAME_DOS &&
+           CompareFileName(Vcb, SearchPattern, IndexEntry, TRUE, CaseSensitive);
+}
+
+/*
+ * Prefetches the file records of IndexEntry and of the entries following it in the same node
+ * which the caller will be handed, see NtfsPrefetchFileRecords(). Only the entries with a Win32
+ * name are concerned: callers read the record of those to find the DOS name.
+ */
+static
+VOID
+NtfsPrefetchIndexEntryRecords(PDEVICE_EXTENSION Vcb,
+                              PNTFS_INDEX_CURSOR_LEVEL Level,
+                              PINDEX_ENTRY_ATTRIBUTE IndexEntry,
+                              PUNICODE_STRING SearchPattern,
+                              BOOLEAN CaseSensitive)
+{
+    ULONGLONG MftIndexes[NTFS_PREFETCH_MAX_RECORDS];
+    ULONG EntryOffset = (ULONG)((ULONG_PTR)IndexEntry - (ULONG_PTR)Level->Header);
+    ULONG Count = 0;
+
+    while (Count < NTFS_PREFETCH_MAX_RECORDS &&
+           EntryOffset + FIELD_OFFSET(INDEX_ENTRY_ATTRIBUTE, FileName) <= Level->Header->TotalSizeOfEntries)
+    {
+        IndexEntry = (PINDEX_ENTRY_ATTRIBUTE)((ULONG_PTR)Level->Header + EntryOffset);
+        if ((IndexEntry->Flags & NTFS_INDEX_ENTRY_END) || IndexEntry->Length < sizeof(INDEX_ENTRY_ATTRIBUTE))
+            break;
+
+        if (IndexEntry->FileName.NameType == NTFS_FILE_NAME_WIN32 &&
+            NtfsIndexEntryMatches(Vcb, IndexEntry, SearchPattern, CaseSensitive))
+        {
+            MftIndexes[Count++] = IndexEntry->Data.Directory.IndexedFile & NTFS_MFT_MASK;
+        }
+
+        EntryOffset += IndexEntry->Length;
+    }
+
+    Level->PrefetchedOffset = EntryOffset;
+
+    // Not worth it for a single record, ReadFileRecord() would read it the same way
+    if (Count > 1)
+        NtfsPrefetchFileRecords(Vcb, MftIndexes, Count);
+}
+
+/**
+* @name NtfsFindNextIndexEntry
+* @implemented
+*
+* Finds the next entry of a directory index matching a search pattern, the way
+* NtfsFindFileAt() does, but without reading the file record of the entry and
+* without browsing the index from its start on every call.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @param Cursor
+* Pointer to the cursor kept between calls. It must be zeroed before its first use,
+* and released with NtfsReleaseIndexCursor().
+*
+* @param DirectoryMftIndex
+* MFT index of the directory to browse.
+*
+* @param IndexGeneration
+* Current IndexGeneration of the FCB of the directory.
+*
+* @param SearchPattern
+* Pattern the file names are matched against.
+*
+* @param Entry
+* On input, position in the index of the first entry to consider. On output, position of
+* the entry found. Positions are counted like NtfsFindFileAt() does.
+*
+* @param CaseSensitive
+* TRUE if the pattern must be matched case-sensitively.
+*
+* @param IndexEntry
+* Receives a pointer to the index entry found, which holds the $FILE_NAME of the file.
+* It remains valid until the next call using the same cursor.
+*
+* @return
+* STATUS_SUCCESS if an entry was found, STATUS_NO_MORE_ENTRIES if there's none left,
+* or an error status.
+*
+* @remarks
+* The cursor keeps the path of VCNs from $INDEX_ROOT to the current index buffer, with every
+* buffer of the path read once, so browsing a whole directory reads each index buffer once.
+* Consecutive index buffers the cursor will descend into are read with a single read, and if
+* the caller set PrefetchFileRecords, the file records of the entries of a node are prefetched
+* into the MFT cache, NTFS_PREFETCH_MAX_RECORDS at a time.
+* The cursor is rewound and the index browsed from its start when Entry is before the position
+* the cursor stopped at, or when the index of the directory was modified since.
+*/
+NTSTATUS
+NtfsFindNextIndexEntry(PDEVICE_EXTENSION Vcb,
+                       PNTFS_INDEX_CURSOR Cursor,
+                       ULONGLONG DirectoryMftIndex,
+                       LONG IndexGeneration,
+                       PUNICODE_STRING SearchPattern,
+                       PULONG Entry,
+                       BOOLEAN CaseSensitive,
+                       PINDEX_ENTRY_ATTRIBUTE *IndexEntry)
+{
+    PNTFS_INDEX_CURSOR_LEVEL Level;
+    PINDEX_ENTRY_ATTRIBUTE Current;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    DPRINT("NtfsFindNextIndexEntry(%p, %p, %I64x, %wZ, %lu, %s, %p)\n",
+           Vcb,
+           Cursor,
+           DirectoryMftIndex,
+           SearchPattern,
+           *Entry,
+           CaseSensitive ? "TRUE" : "FALSE",
+           IndexEntry);
+
+    if (Cursor->Generation != IndexGeneration ||
+        Cursor->DirectoryMftIndex != DirectoryMftIndex ||
+        (Cursor->Depth == 0 && !Cursor->AtEnd))
+    {
+        Cursor->Depth = 0;
+        Cursor->AtEnd = FALSE;
+    }
+    else if (Cursor->LastEntry != NULL && *Entry == Cursor->LastPosition)
+    {
+        // The caller couldn't consume the last entry, hand it out again
+        if (NtfsIndexEntryMatches(Vcb, Cursor->LastEntry, SearchPattern, CaseSensitive))
+        {
+            *IndexEntry = Cursor->LastEntry;
+            return STATUS_SUCCESS;
+        }
+    }
+
+    if (Cursor->Position > *Entry)
+    {
+        Cursor->Depth = 0;
+        Cursor->AtEnd = FALSE;
+    }
+
+    if (Cursor->Depth == 0 && !Cursor->AtEnd)
+    {
+        Status = NtfsRewindIndexCursor(Vcb, Cursor, DirectoryMftIndex);
+        if (!NT_SUCCESS(Status))
+            return Status;
+
+        Cursor->Generation = IndexGeneration;
+    }
+
+    Cursor->LastEntry = NULL;
+
+    for (;;)
+    {
+        if (Cursor->AtEnd)
+            return STATUS_NO_MORE_ENTRIES;
+
+        Current = NtfsAdvanceIndexCursor(Vcb, Cursor, &Status);
+        if (Current == NULL)
+        {
+            // Don't leave a half-browsed path behind
+            if (Status != STATUS_NO_MORE_ENTRIES)
+                Cursor->Depth = 0;
+            return Status;
+        }
+
+        if (Cursor->Position - 1 < *Entry)
+            continue;
+
+        if (NtfsIndexEntryMatches(Vcb, Current, SearchPattern, CaseSensitive))
+        {
+            Level = &Cursor->Levels[Cursor->Depth - 1];
+            if (Cursor->PrefetchFileRecords &&
+                (ULONG_PTR)Current - (ULONG_PTR)Level->Header >= Level->PrefetchedOffset)
+            {
+                NtfsPrefetchIndexEntryRecords(Vcb, Level, Current, SearchPattern, CaseSensitive);
+            }
+
+            *Entry = Cursor->Position - 1;
+            Cursor->LastEntry = Current;
+            Cursor->LastPosition = *Entry;
+            *IndexEntry = Current;
+            return STATUS_SUCCESS;
+        }
+    }
+}
+
 /* EOF */
@@ -80,6 +80,7 @@ DriverEntry(PDRIVER_OBJECT DriverObject,
     NtfsGlobalData->Identifier.Size = sizeof(NTFS_GLOBAL_DATA);
 
     ExInitializeResourceLite(&NtfsGlobalData->Resource);
+    InitializeListHead(&NtfsGlobalData->VolumeListHead);
 
     NtfsGlobalData->EnableWriteSupport = FALSE;
 
@@ -181,6 +182,7 @@ NtfsInitializeFunctionPointers(PDRIVER_OBJECT DriverObject)
     DriverObject->MajorFunction[IRP_MJ_DIRECTORY_CONTROL]        = NtfsFsdDispatch;
     DriverObject->MajorFunction[IRP_MJ_FILE_SYSTEM_CONTROL]      = NtfsFsdDispatch;
     DriverObject->MajorFunction[IRP_MJ_DEVICE_CONTROL]           = NtfsFsdDispatch;
+    DriverObject->MajorFunction[IRP_MJ_SHUTDOWN]                 = NtfsFsdDispatch;
 
     return;
 }
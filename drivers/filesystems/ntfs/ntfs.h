@@ -1,9 +1,13 @@
 #ifndef NTFS_H
 #define NTFS_H
 
+#ifdef NTFS_HOST
+#include <ntfshost.h>
+#else
 #include <ntifs.h>
 #include <pseh/pseh2.h>
 #include <section_attribs.h>
+#endif
 
 #define CACHEPAGESIZE(pDeviceExt) \
 	((pDeviceExt)->NtfsInfo.UCHARsPerCluster > PAGE_SIZE ? \
@@ -15,6 +19,12 @@
 #define TAG_IRP_CTXT 'iftN'
 #define TAG_ATT_CTXT 'aftN'
 #define TAG_FILE_REC 'rftN'
+#define TAG_MFT_CACHE 'MftN'
+#define TAG_BITMAP 'BftN'
+#define TAG_COMPRESSION 'UftN'
+#define TAG_UPCASE 'uftN'
+#define TAG_LOG 'LftN'
+#define TAG_USN 'JftN'
 
 #define ROUND_UP(N, S) ((((N) + (S) - 1) / (S)) * (S))
 #define ROUND_DOWN(N, S) ((N) - ((N) % (S)))
@@ -96,15 +106,331 @@ typedef struct
     ULONG Size;
 } NTFSIDENTIFIER, *PNTFSIDENTIFIER;
 
+#define NTFS_MFT_CACHE_BUCKETS      64
+#define NTFS_MFT_CACHE_MAX_ENTRIES  256
+
+typedef struct _NTFS_MFT_CACHE_ENTRY
+{
+    LIST_ENTRY HashListEntry;
+    LIST_ENTRY LruListEntry;
+    ULONGLONG MftIndex;
+    BOOLEAN Dirty;
+    BOOLEAN Referenced;                 /* Set by lookups, spares the entry once from eviction */
+    /* The fixed-up file record follows */
+} NTFS_MFT_CACHE_ENTRY, *PNTFS_MFT_CACHE_ENTRY;
+
+#define MFT_CACHE_ENTRY_RECORD(Entry) ((struct _FILE_RECORD_HEADER*)((PNTFS_MFT_CACHE_ENTRY)(Entry) + 1))
+
+typedef struct
+{
+    ERESOURCE Resource;
+    NPAGED_LOOKASIDE_LIST EntryLookasideList;
+    LIST_ENTRY HashBuckets[NTFS_MFT_CACHE_BUCKETS];
+    LIST_ENTRY LruListHead;
+    ULONG EntryCount;
+    ULONG DirtyCount;
+    ULONG WriteGeneration;              /* Incremented on every write to $MFT done by the cache */
+    LONGLONG Hits;                      /* Signed for InterlockedIncrement64(), counted under a shared lock */
+    LONGLONG Misses;
+    ULONGLONG WriteBacks;
+    ULONGLONG Prefetches;               /* Records read by NtfsPrefetchFileRecords() */
+} NTFS_MFT_CACHE, *PNTFS_MFT_CACHE;
+
+/* Limits of NtfsPrefetchFileRecords(), well below NTFS_MFT_CACHE_MAX_ENTRIES */
+#define NTFS_PREFETCH_MAX_RECORDS   32
+#define NTFS_PREFETCH_SPAN          0x10000
+
+/* Bytes of $MFT read at once by NtfsReadNextMftRecord() */
+#define NTFS_MFT_SCAN_CHUNK_SIZE    0x40000
+
+typedef struct
+{
+    struct _NTFS_ATTR_CONTEXT* BitmapContext;  /* $MFT:$BITMAP */
+    ULONGLONG RecordCount;
+    ULONGLONG NextIndex;                /* Of the next record to look at */
+    ULONGLONG ChunkStart;               /* Index of the first record of the chunk in Records */
+    ULONG ChunkRecords;
+    ULONG ChunkValid;                   /* Records of the chunk that were looked at */
+    PUCHAR Records;
+    PUCHAR Bitmap;                      /* Records of the chunk in use and read */
+} NTFS_MFT_SCAN, *PNTFS_MFT_SCAN;
+
+/* FSCTL_QUERY_FILE_LAYOUT came with Windows 8, the headers don't have it for the NT 5.2 target */
+#ifndef FSCTL_QUERY_FILE_LAYOUT
+#define FSCTL_QUERY_FILE_LAYOUT CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 157, METHOD_NEITHER, FILE_ANY_ACCESS)
+#endif
+
+#define QUERY_FILE_LAYOUT_RESTART                                       0x00000001
+#define QUERY_FILE_LAYOUT_INCLUDE_NAMES                                 0x00000002
+#define QUERY_FILE_LAYOUT_INCLUDE_STREAMS                               0x00000004
+#define QUERY_FILE_LAYOUT_INCLUDE_EXTENTS                               0x00000008
+#define QUERY_FILE_LAYOUT_INCLUDE_EXTRA_INFO                            0x00000010
+#define QUERY_FILE_LAYOUT_INCLUDE_STREAMS_WITH_NO_CLUSTERS_ALLOCATED    0x00000020
+
+typedef enum _QUERY_FILE_LAYOUT_FILTER_TYPE
+{
+    QUERY_FILE_LAYOUT_FILTER_TYPE_NONE = 0,
+    QUERY_FILE_LAYOUT_FILTER_TYPE_CLUSTERS = 1,
+    QUERY_FILE_LAYOUT_FILTER_TYPE_FILEID = 2,
+    QUERY_FILE_LAYOUT_NUM_FILTER_TYPES = 3
+} QUERY_FILE_LAYOUT_FILTER_TYPE;
+
+typedef struct _CLUSTER_RANGE
+{
+    LARGE_INTEGER StartingCluster;
+    LARGE_INTEGER ClusterCount;
+} CLUSTER_RANGE, *PCLUSTER_RANGE;
+
+typedef struct _FILE_REFERENCE_RANGE
+{
+    ULONGLONG StartingFileReferenceNumber;
+    ULONGLONG EndingFileReferenceNumber;
+} FILE_REFERENCE_RANGE, *PFILE_REFERENCE_RANGE;
+
+typedef struct _QUERY_FILE_LAYOUT_INPUT
+{
+    ULONG NumberOfPairs;
+    ULONG Flags;
+    QUERY_FILE_LAYOUT_FILTER_TYPE FilterType;
+    ULONG Reserved;
+    union
+    {
+        CLUSTER_RANGE ClusterRanges[1];
+        FILE_REFERENCE_RANGE FileReferenceRanges[1];
+    } Filter;
+} QUERY_FILE_LAYOUT_INPUT, *PQUERY_FILE_LAYOUT_INPUT;
+
+typedef struct _QUERY_FILE_LAYOUT_OUTPUT
+{
+    ULONG FileEntryCount;
+    ULONG FirstFileOffset;
+    ULONG Flags;
+    ULONG Reserved;
+} QUERY_FILE_LAYOUT_OUTPUT, *PQUERY_FILE_LAYOUT_OUTPUT;
+
+#define FILE_LAYOUT_ENTRY_VERSION       0x1
+#define STREAM_LAYOUT_ENTRY_VERSION     0x1
+
+typedef struct _FILE_LAYOUT_ENTRY
+{
+    ULONG Version;
+    ULONG NextFileOffset;
+    ULONG Flags;
+    ULONG FileAttributes;
+    ULONGLONG FileReferenceNumber;
+    ULONG FirstNameOffset;
+    ULONG FirstStreamOffset;
+    ULONG ExtraInfoOffset;
+    ULONG Reserved;
+} FILE_LAYOUT_ENTRY, *PFILE_LAYOUT_ENTRY;
+
+#define FILE_LAYOUT_NAME_ENTRY_PRIMARY  0x00000001
+#define FILE_LAYOUT_NAME_ENTRY_DOS      0x00000002
+
+typedef struct _FILE_LAYOUT_NAME_ENTRY
+{
+    ULONG NextNameOffset;
+    ULONG Flags;
+    ULONGLONG ParentFileReferenceNumber;
+    ULONG FileNameLength;
+    ULONG Reserved;
+    WCHAR FileName[1];
+} FILE_LAYOUT_NAME_ENTRY, *PFILE_LAYOUT_NAME_ENTRY;
+
+typedef struct _FILE_LAYOUT_INFO_ENTRY
+{
+    struct
+    {
+        LARGE_INTEGER CreationTime;
+        LARGE_INTEGER LastAccessTime;
+        LARGE_INTEGER LastWriteTime;
+        LARGE_INTEGER ChangeTime;
+        ULONG FileAttributes;
+    } BasicInformation;
+    ULONG OwnerId;
+    ULONG SecurityId;
+    USN Usn;
+} FILE_LAYOUT_INFO_ENTRY, *PFILE_LAYOUT_INFO_ENTRY;
+
+#define STREAM_LAYOUT_ENTRY_IMMOVABLE               0x00000001
+#define STREAM_LAYOUT_ENTRY_PINNED                  0x00000002
+#define STREAM_LAYOUT_ENTRY_RESIDENT                0x00000004
+#define STREAM_LAYOUT_ENTRY_NO_CLUSTERS_ALLOCATED   0x00000008
+
+typedef struct _STREAM_LAYOUT_ENTRY
+{
+    ULONG Version;
+    ULONG NextStreamOffset;
+    ULONG Flags;
+    ULONG ExtentInformationOffset;
+    LARGE_INTEGER AllocationSize;
+    LARGE_INTEGER EndOfFile;
+    ULONG Reserved;
+    ULONG AttributeFlags;
+    ULONG StreamIdentifierLength;
+    WCHAR StreamIdentifier[1];
+} STREAM_LAYOUT_ENTRY, *PSTREAM_LAYOUT_ENTRY;
+
+/* Granularity of the $Bitmap write-back */
+#define NTFS_BITMAP_PAGE_SIZE       0x1000
+
+/* Free extents are bucketed by the log2 of their length */
+#define NTFS_FREE_EXTENT_BUCKETS    32
+#define NTFS_FREE_EXTENT_BUCKET_MAX 256
+
+typedef struct _NTFS_FREE_EXTENT
+{
+    LIST_ENTRY ListEntry;
+    ULONGLONG Start;
+    ULONGLONG Length;
+} NTFS_FREE_EXTENT, *PNTFS_FREE_EXTENT;
+
+typedef struct
+{
+    ERESOURCE Resource;
+    BOOLEAN Loaded;
+    struct _NTFS_ATTR_CONTEXT* DataContext;
+    PULONG Buffer;
+    ULONG BufferSize;
+    RTL_BITMAP Bitmap;                  /* One bit per cluster */
+    PULONG DirtyBuffer;
+    RTL_BITMAP DirtyPages;              /* One bit per NTFS_BITMAP_PAGE_SIZE bytes of Buffer */
+    ULONG DirtyCount;
+    ULONG LowestDirtyPage;
+    ULONG HighestDirtyPage;
+    ULONGLONG FreeClusters;
+
+    /* Clusters kept for the growth of $MFT while the volume isn't full */
+    ULONGLONG MftZoneStart;
+    ULONGLONG MftZoneEnd;
+
+    /* Hints of free extents outside of the MFT zone, checked against Bitmap when used */
+    NPAGED_LOOKASIDE_LIST ExtentLookasideList;
+    LIST_ENTRY ExtentBuckets[NTFS_FREE_EXTENT_BUCKETS];
+    ULONG ExtentCount[NTFS_FREE_EXTENT_BUCKETS];
+    BOOLEAN ExtentIndexComplete;        /* Every free extent outside of the zone is indexed */
+} NTFS_VOLUME_BITMAP, *PNTFS_VOLUME_BITMAP;
+
+#define NTFS_COMPRESSION_CACHE_MAX_ENTRIES  16
+
+typedef struct _NTFS_COMPRESSION_CACHE_ENTRY
+{
+    LIST_ENTRY LruListEntry;
+    ULONGLONG MftIndex;
+    USHORT Instance;                    /* Of the attribute record in the file record */
+    ULONGLONG UnitVcn;
+    ULONG UnitSize;
+    ULONG BufferSize;
+    /* The decoded compression unit follows */
+} NTFS_COMPRESSION_CACHE_ENTRY, *PNTFS_COMPRESSION_CACHE_ENTRY;
+
+#define COMPRESSION_CACHE_ENTRY_DATA(Entry) ((PUCHAR)((PNTFS_COMPRESSION_CACHE_ENTRY)(Entry) + 1))
+
+typedef struct
+{
+    ERESOURCE Resource;
+    LIST_ENTRY LruListHead;
+    ULONG EntryCount;
+    ULONGLONG Hits;
+    ULONGLONG Misses;
+} NTFS_COMPRESSION_CACHE, *PNTFS_COMPRESSION_CACHE;
+
+/* Metadata journal kept in $LogFile, see logfile.c */
+#define NTFS_LOG_BUCKETS                256
+
+typedef struct _NTFS_LOG_SECTOR
+{
+    LIST_ENTRY HashListEntry;
+    LIST_ENTRY ListEntry;               /* In UnloggedListHead or LoggedListHead */
+    LONGLONG DiskOffset;
+    BOOLEAN Logged;
+    /* The BytesPerSector bytes of the sector follow */
+} NTFS_LOG_SECTOR, *PNTFS_LOG_SECTOR;
+
+#define LOG_SECTOR_DATA(Sector) ((PUCHAR)((PNTFS_LOG_SECTOR)(Sector) + 1))
+
+typedef struct
+{
+    BOOLEAN Enabled;
+    struct _NTFS_ATTR_CONTEXT* DataContext;
+    ULONGLONG AreaStart;                /* Offsets of the log records in $LogFile */
+    ULONGLONG AreaEnd;
+    ULONGLONG WriteOffset;              /* Where the next record goes */
+    ULONGLONG NextSequence;             /* Sequence number of the next record */
+    LARGE_INTEGER LastCommitTime;
+    LARGE_INTEGER LastOperationTime;
+    BOOLEAN VolumeDirty;                /* VOLUME_IS_DIRTY is set in $Volume */
+    BOOLEAN ClearVolumeDirty;           /* ...by the log, which clears it once empty */
+
+    /* Requests hold it shared, commits and checkpoints exclusive, see NtfsLogBeginOperation() */
+    ERESOURCE OperationResource;
+    LONG ActiveOperations;
+
+    /* Sectors of metadata modified since the last checkpoint, not yet written in place */
+    ERESOURCE Resource;
+    NPAGED_LOOKASIDE_LIST SectorLookasideList;
+    LIST_ENTRY HashBuckets[NTFS_LOG_BUCKETS];
+    LIST_ENTRY UnloggedListHead;        /* Not in a log record yet */
+    LIST_ENTRY LoggedListHead;
+    ULONG UnloggedCount;
+    ULONG LoggedCount;
+
+    /* Commits what's left, then checkpoints, once the volume is idle */
+    KTIMER CommitTimer;
+    KDPC CommitDpc;
+    WORK_QUEUE_ITEM CommitWorkItem;
+    LONG CommitPending;
+
+    ULONGLONG Commits;
+    ULONGLONG CommittedSectors;
+    ULONGLONG Checkpoints;
+} NTFS_LOG, *PNTFS_LOG;
+
+/* Change journal kept in $Extend\$UsnJrnl, see usnjrnl.c */
+typedef struct
+{
+    ERESOURCE Resource;
+    BOOLEAN Active;
+    ULONGLONG MftIndex;                 /* Of $UsnJrnl */
+    ULONGLONG UsnJournalID;
+    USN LowestValidUsn;
+    ULONGLONG MaximumSize;
+    ULONGLONG AllocationDelta;
+
+    /* Records of [WrittenUsn, NextUsn) are in Buffer, not in $J yet */
+    USN NextUsn;
+    USN WrittenUsn;
+    PUCHAR Buffer;
+
+    ULONGLONG Records;
+    ULONGLONG Flushes;
+} NTFS_USN_JOURNAL, *PNTFS_USN_JOURNAL;
+
+#define NTFS_FCB_HASH_BUCKETS   1024    /* Must be a power of two */
+
+typedef struct
+{
+    LIST_ENTRY PathBuckets[NTFS_FCB_HASH_BUCKETS];     /* By hash of the upcased path */
+    LIST_ENTRY IndexBuckets[NTFS_FCB_HASH_BUCKETS];    /* By MFT index, for hard links and open by ID */
+    ULONG FcbCount;
+    ULONGLONG Lookups;
+    ULONGLONG Hits;
+    ULONGLONG Compares;                 /* Names compared after a hash match */
+} NTFS_FCB_TABLE, *PNTFS_FCB_TABLE;
+
 typedef struct
 {
     NTFSIDENTIFIER Identifier;
 
+    /* Volume-wide, only for structural changes such as MFT growth. Directories are
+     * locked through the MainResource of their FCB: shared by lookups and
+     * enumerations, exclusive by changes to their index. */
     ERESOURCE DirResource;
 //    ERESOURCE FatResource;
 
     KSPIN_LOCK FcbListLock;
     LIST_ENTRY FcbListHead;
+    NTFS_FCB_TABLE FcbTable;            /* Protected by FcbListLock */
 
     PVPB Vpb;
     PDEVICE_OBJECT StorageDevice;
@@ -117,14 +443,32 @@ typedef struct
     NTFS_INFO NtfsInfo;
 
     NPAGED_LOOKASIDE_LIST FileRecLookasideList;
+    NTFS_MFT_CACHE MftCache;
+    NTFS_VOLUME_BITMAP VolumeBitmap;
+    NTFS_COMPRESSION_CACHE CompressionCache;
+    NTFS_LOG Log;
+    NTFS_USN_JOURNAL UsnJournal;
 
     ULONG MftDataOffset;
     ULONG Flags;
-    ULONG OpenHandleCount;
+    LONG OpenHandleCount;
+
+    /* $UpCase, used by every case-insensitive name comparison, see NtfsCollateFileNames() */
+    PWCHAR UpcaseTable;
+    BOOLEAN UpcaseAsciiIsStandard;      /* 'a' to 'z' map to 'A' to 'Z', and nothing else below U+0080 changes */
+
+    LIST_ENTRY VolumeListEntry;         /* In NtfsGlobalData->VolumeListHead */
 
 } DEVICE_EXTENSION, *PDEVICE_EXTENSION, NTFS_VCB, *PNTFS_VCB;
 
 #define VCB_VOLUME_LOCKED       0x0001
+#define VCB_DISMOUNT_PENDING    0x0002
+
+#define NTFS_UPCASE_TABLE_CHARS 0x10000
+
+/* Reads in a row at the end of the previous one before the cache manager is asked to read ahead */
+#define NTFS_READ_AHEAD_THRESHOLD   2
+#define NTFS_READ_AHEAD_GRANULARITY 0x10000
 
 typedef struct
 {
@@ -136,8 +480,19 @@ typedef struct
     ULONG Entry;
     /* for DirectoryControl */
     PWCHAR DirectorySearchPattern;
+    /* for DirectoryControl */
+    struct _NTFS_INDEX_CURSOR *IndexCursor;
+    /* for DirectoryControl, signaled while no query moves the cursor */
+    KEVENT QueryEvent;
     ULONG LastCluster;
     ULONG LastOffset;
+    /* for read-ahead, see NtfsReadAheadIfSequential() */
+    LARGE_INTEGER NextReadOffset;
+    ULONG SequentialReads;
+    /* Path the handle was opened by, if it's another hard link than the one its FCB is named after */
+    PWCHAR LinkPathName;
+    /* for FSCTL_QUERY_FILE_LAYOUT, the MFT index to continue from */
+    ULONGLONG FileLayoutIndex;
 } NTFS_CCB, *PNTFS_CCB;
 
 typedef struct
@@ -153,6 +508,7 @@ typedef struct
     NPAGED_LOOKASIDE_LIST FcbLookasideList;
     NPAGED_LOOKASIDE_LIST AttrCtxtLookasideList;
     BOOLEAN EnableWriteSupport;
+    LIST_ENTRY VolumeListHead;          /* Mounted volumes, protected by Resource */
 } NTFS_GLOBAL_DATA, *PNTFS_GLOBAL_DATA;
 
 
@@ -315,6 +671,11 @@ typedef struct
     USHORT Instance;
 } NTFS_ATTRIBUTE_LIST_ITEM, *PNTFS_ATTRIBUTE_LIST_ITEM;
 
+/* NTFS_ATTR_RECORD.Flags */
+#define ATTR_FLAG_COMPRESSED    0x0001
+#define ATTR_FLAG_ENCRYPTED     0x4000
+#define ATTR_FLAG_SPARSE        0x8000
+
 // The beginning and length of an attribute record are always aligned to an 8-byte boundary,
 // relative to the beginning of the file record.
 #define ATTR_RECORD_ALIGNMENT 8
@@ -341,6 +702,16 @@ typedef struct
 #endif
 } STANDARD_INFORMATION, *PSTANDARD_INFORMATION;
 
+/* $STANDARD_INFORMATION of NTFS 3 volumes, see the fields after STANDARD_INFORMATION */
+typedef struct
+{
+    STANDARD_INFORMATION Base;
+    ULONG OwnerId;
+    ULONG SecurityId;
+    ULONGLONG QuotaCharged;
+    USN Usn;
+} NTFS_STANDARD_INFORMATION_V3, *PNTFS_STANDARD_INFORMATION_V3;
+
 
 typedef struct
 {
@@ -427,6 +798,41 @@ typedef struct
     FILENAME_ATTRIBUTE    FileName;
 } INDEX_ENTRY_ATTRIBUTE, *PINDEX_ENTRY_ATTRIBUTE;
 
+#define NTFS_INDEX_CURSOR_MAX_DEPTH 16
+
+typedef struct
+{
+    ULONGLONG VCN;
+    PINDEX_BUFFER IndexBuffer;          /* NULL for the $INDEX_ROOT level */
+    PINDEX_HEADER_ATTRIBUTE Header;
+    ULONG EntryOffset;                  /* Offset of the current entry from Header */
+    BOOLEAN SubNodeBrowsed;             /* The sub-node of the current entry has been browsed */
+    ULONG PrefetchedOffset;             /* The file records of the entries before it were prefetched */
+} NTFS_INDEX_CURSOR_LEVEL, *PNTFS_INDEX_CURSOR_LEVEL;
+
+/* Index buffers read at once, when the sub-nodes of consecutive entries follow each other */
+#define NTFS_INDEX_READ_AHEAD_BLOCKS 8
+
+// Position in a directory index, kept across NtfsFindNextIndexEntry() calls
+typedef struct _NTFS_INDEX_CURSOR
+{
+    ULONGLONG DirectoryMftIndex;
+    LONG Generation;
+    ULONG Depth;                        /* 0 if the cursor must be rewound */
+    ULONG Position;                     /* Number of entries already browsed */
+    BOOLEAN AtEnd;
+    PINDEX_ENTRY_ATTRIBUTE LastEntry;   /* Last entry returned, at LastPosition */
+    ULONG LastPosition;
+    ULONG IndexBlockSize;
+    PINDEX_ROOT_ATTRIBUTE IndexRoot;
+    struct _NTFS_ATTR_CONTEXT *IndexAllocationContext;
+    BOOLEAN PrefetchFileRecords;        /* Set by callers which read the file record of the entries */
+    PUCHAR ReadAheadBuffer;             /* Index buffers read ahead, not fixed up */
+    ULONGLONG ReadAheadOffset;
+    ULONG ReadAheadLength;
+    NTFS_INDEX_CURSOR_LEVEL Levels[NTFS_INDEX_CURSOR_MAX_DEPTH];
+} NTFS_INDEX_CURSOR, *PNTFS_INDEX_CURSOR;
+
 struct _B_TREE_FILENAME_NODE;
 typedef struct _B_TREE_FILENAME_NODE B_TREE_FILENAME_NODE;
 
@@ -450,9 +856,14 @@ typedef struct _B_TREE_FILENAME_NODE
     PB_TREE_KEY FirstKey;
 } B_TREE_FILENAME_NODE, *PB_TREE_FILENAME_NODE;
 
+// Child nodes are only read from the index allocation when an operation needs to descend into them.
+// A key whose index entry has NTFS_INDEX_ENTRY_NODE set but whose LesserChild is NULL has a child
+// which hasn't been loaded yet.
 typedef struct
 {
     PB_TREE_FILENAME_NODE RootNode;
+    PDEVICE_EXTENSION Vcb;
+    struct _NTFS_ATTR_CONTEXT *IndexAllocationContext;  // NULL if the index has no allocation
 } B_TREE, *PB_TREE;
 
 typedef struct
@@ -493,12 +904,10 @@ typedef struct
 
 typedef struct _NTFS_ATTR_CONTEXT
 {
-    PUCHAR            CacheRun;
-    ULONGLONG            CacheRunOffset;
-    LONGLONG            CacheRunStartLCN;
-    ULONGLONG            CacheRunLength;
-    LONGLONG            CacheRunLastLCN;
-    ULONGLONG            CacheRunCurrentOffset;
+    /* Last run found in DataRunsMCB by NtfsLookupAttributeRun(), empty if CachedRunLength is 0 */
+    LONGLONG            CachedRunVcn;
+    LONGLONG            CachedRunLcn;
+    LONGLONG            CachedRunLength;
     LARGE_MCB           DataRunsMCB;
     ULONGLONG           FileMFTIndex;
     ULONGLONG           FileOwnerMFTIndex; /* If attribute list attribute, reference the original file */
@@ -528,17 +937,26 @@ typedef struct _FCB
     ERESOURCE MainResource;
 
     LIST_ENTRY FcbListEntry;
+    LIST_ENTRY PathHashEntry;
+    LIST_ENTRY IndexHashEntry;
+    ULONG PathHash;
     struct _FCB* ParentFcb;
 
     ULONG DirIndex;
 
     LONG RefCount;
     ULONG Flags;
-    ULONG OpenHandleCount;
+    LONG OpenHandleCount;
 
     ULONGLONG MFTIndex;
     USHORT LinkCount;
 
+    /* Incremented whenever the index of the directory is modified, see NtfsFindNextIndexEntry() */
+    LONG IndexGeneration;
+
+    /* USN_REASON_* recorded in the change journal since the file was opened, see NtfsUsnPostChange() */
+    ULONG UsnReasons;
+
     FILENAME_ATTRIBUTE Entry;
 
 } NTFS_FCB, *PNTFS_FCB;
@@ -592,6 +1010,22 @@ NTSTATUS
 AddData(PFILE_RECORD_HEADER FileRecord,
         PNTFS_ATTR_RECORD AttributeAddress);
 
+NTSTATUS
+AddNamedData(PNTFS_VCB Vcb,
+             PFILE_RECORD_HEADER FileRecord,
+             PNTFS_ATTR_RECORD AttributeAddress,
+             PCWSTR Name,
+             USHORT NameLength,
+             PVOID Value,
+             ULONG ValueLength);
+
+NTSTATUS
+AddNonResidentData(PNTFS_VCB Vcb,
+                   PFILE_RECORD_HEADER FileRecord,
+                   PNTFS_ATTR_RECORD AttributeAddress,
+                   PCWSTR Name,
+                   USHORT NameLength);
+
 NTSTATUS
 AddRun(PNTFS_VCB Vcb,
        PNTFS_ATTR_CONTEXT AttrContext,
@@ -635,6 +1069,7 @@ ConvertDataRunsToLargeMCB(PUCHAR DataRun,
 
 NTSTATUS
 ConvertLargeMCBToDataRuns(PLARGE_MCB DataRunsMCB,
+                          ULONGLONG ClusterCount,
                           PUCHAR RunBuffer,
                           ULONG MaxBufferSize,
                           PULONG UsedBufferSize);
@@ -644,6 +1079,12 @@ DecodeRun(PUCHAR DataRun,
           LONGLONG *DataRunOffset,
           ULONGLONG *DataRunLength);
 
+BOOLEAN
+NtfsLookupAttributeRun(PNTFS_ATTR_CONTEXT AttrContext,
+                       ULONGLONG Vcn,
+                       PLONGLONG Lcn,
+                       PULONGLONG ClusterCount);
+
 ULONG GetFileNameAttributeLength(PFILENAME_ATTRIBUTE FileNameAttribute);
 
 VOID
@@ -705,8 +1146,30 @@ FreeClusters(PNTFS_VCB Vcb,
              PFILE_RECORD_HEADER FileRecord,
              ULONG ClustersToFree);
 
+NTSTATUS
+NtfsMakeAttributeSparse(PDEVICE_EXTENSION Vcb,
+                        PNTFS_ATTR_CONTEXT AttrContext,
+                        ULONG AttrOffset,
+                        PFILE_RECORD_HEADER FileRecord);
+
+NTSTATUS
+StoreDataRuns(PNTFS_VCB Vcb,
+              PNTFS_ATTR_CONTEXT AttrContext,
+              ULONG AttrOffset,
+              PFILE_RECORD_HEADER FileRecord);
+
 /* blockdev.c */
 
+/* One contiguous piece of a transfer, see NtfsReadWriteRuns() */
+typedef struct _NTFS_IO_RUN
+{
+    LONGLONG DiskOffset;                /* In bytes, from the start of the volume */
+    ULONG BufferOffset;
+    ULONG Length;
+} NTFS_IO_RUN, *PNTFS_IO_RUN;
+
+#define NTFS_MAX_IO_RUNS    16          /* Runs ReadAttribute() and WriteAttribute() issue at once */
+
 NTSTATUS
 NtfsReadDisk(IN PDEVICE_OBJECT DeviceObject,
              IN LONGLONG StartingOffset,
@@ -722,6 +1185,14 @@ NtfsWriteDisk(IN PDEVICE_OBJECT DeviceObject,
               IN ULONG SectorSize,
               IN const PUCHAR Buffer);
 
+NTSTATUS
+NtfsReadWriteRuns(IN PDEVICE_OBJECT DeviceObject,
+                  IN UCHAR MajorFunction,
+                  IN PNTFS_IO_RUN Runs,
+                  IN ULONG RunCount,
+                  IN ULONG SectorSize,
+                  IN OUT PUCHAR Buffer);
+
 NTSTATUS
 NtfsReadSectors(IN PDEVICE_OBJECT DeviceObject,
                 IN ULONG DiskSector,
@@ -743,7 +1214,8 @@ NtfsDeviceIoControl(IN PDEVICE_OBJECT DeviceObject,
 /* btree.c */
 
 LONG
-CompareTreeKeys(PB_TREE_KEY Key1,
+CompareTreeKeys(PDEVICE_EXTENSION Vcb,
+                PB_TREE_KEY Key1,
                 PB_TREE_KEY Key2,
                 BOOLEAN CaseSensitive);
 
@@ -800,6 +1272,10 @@ GetIndexEntryVCN(PINDEX_ENTRY_ATTRIBUTE IndexEntry);
 ULONG
 GetSizeOfIndexEntries(PB_TREE_FILENAME_NODE Node);
 
+NTSTATUS
+LoadBTreeChildNode(PB_TREE Tree,
+                   PB_TREE_KEY Key);
+
 NTSTATUS
 NtfsInsertKey(PB_TREE Tree,
               ULONGLONG FileReference,
@@ -941,6 +1417,10 @@ NtfsFCBIsEncrypted(PNTFS_FCB Fcb);
 BOOLEAN
 NtfsFCBIsRoot(PNTFS_FCB Fcb);
 
+BOOLEAN
+NtfsFCBPathNamesEqual(PCWSTR PathName1,
+                      PCWSTR PathName2);
+
 VOID
 NtfsGrabFCB(PNTFS_VCB Vcb,
             PNTFS_FCB Fcb);
@@ -949,7 +1429,7 @@ VOID
 NtfsReleaseFCB(PNTFS_VCB Vcb,
                PNTFS_FCB Fcb);
 
-VOID
+PNTFS_FCB
 NtfsAddFCBToTable(PNTFS_VCB Vcb,
                   PNTFS_FCB Fcb);
 
@@ -957,6 +1437,18 @@ PNTFS_FCB
 NtfsGrabFCBFromTable(PNTFS_VCB Vcb,
                      PCWSTR FileName);
 
+PNTFS_FCB
+NtfsGrabFCBFromTableByIndex(PNTFS_VCB Vcb,
+                            ULONGLONG MFTIndex,
+                            PCWSTR Stream);
+
+VOID
+NtfsIncrementIndexGeneration(PNTFS_VCB Vcb,
+                             ULONGLONG DirectoryMftIndex);
+
+VOID
+NtfsInitializeFCBTable(PNTFS_VCB Vcb);
+
 NTSTATUS
 NtfsFCBInitializeCache(PNTFS_VCB Vcb,
                        PNTFS_FCB Fcb);
@@ -1018,6 +1510,60 @@ NtfsSetInformation(PNTFS_IRP_CONTEXT IrpContext);
 NTSTATUS
 NtfsFileSystemControl(PNTFS_IRP_CONTEXT IrpContext);
 
+NTSTATUS
+NtfsShutdown(PNTFS_IRP_CONTEXT IrpContext);
+
+NTSTATUS
+NtfsCaptureFsctlBuffers(PIRP Irp,
+                        PVOID Input,
+                        ULONG InputLength,
+                        PVOID *OutputBuffer,
+                        ULONG MinimumOutputLength);
+
+NTSTATUS
+NtfsReturnFsctlOutput(PIRP Irp,
+                      PVOID OutputBuffer,
+                      PVOID Output,
+                      ULONG Length);
+
+
+/* logfile.c */
+
+VOID
+NtfsInitializeLog(PDEVICE_EXTENSION Vcb);
+
+VOID
+NtfsUninitializeLog(PDEVICE_EXTENSION Vcb);
+
+VOID
+NtfsLogBeginOperation(PDEVICE_EXTENSION Vcb,
+                      BOOLEAN PagingIo);
+
+VOID
+NtfsLogEndOperation(PDEVICE_EXTENSION Vcb);
+
+NTSTATUS
+NtfsLogFlush(PDEVICE_EXTENSION Vcb,
+             BOOLEAN Checkpoint);
+
+NTSTATUS
+NtfsLogCheckpoint(PDEVICE_EXTENSION Vcb);
+
+NTSTATUS
+NtfsLogReadWriteRuns(PDEVICE_EXTENSION Vcb,
+                     struct _NTFS_ATTR_CONTEXT* Context,
+                     UCHAR MajorFunction,
+                     PNTFS_IO_RUN Runs,
+                     ULONG RunCount,
+                     PUCHAR Buffer);
+
+NTSTATUS
+NtfsLogReadWriteVolume(PDEVICE_EXTENSION Vcb,
+                       UCHAR MajorFunction,
+                       LONGLONG DiskOffset,
+                       ULONG Length,
+                       PUCHAR Buffer);
+
 
 /* mft.c */
 NTSTATUS
@@ -1105,7 +1651,8 @@ ULONGLONG
 AttributeAllocatedLength(PNTFS_ATTR_RECORD AttrRecord);
 
 BOOLEAN
-CompareFileName(PUNICODE_STRING FileName,
+CompareFileName(PDEVICE_EXTENSION Vcb,
+                PUNICODE_STRING FileName,
                 PINDEX_ENTRY_ATTRIBUTE IndexEntry,
                 BOOLEAN DirSearch,
                 BOOLEAN CaseSensitive);
@@ -1113,11 +1660,49 @@ CompareFileName(PUNICODE_STRING FileName,
 NTSTATUS
 UpdateMftMirror(PNTFS_VCB Vcb);
 
+VOID
+NtfsInitializeMftCache(PDEVICE_EXTENSION Vcb);
+
+VOID
+NtfsUninitializeMftCache(PDEVICE_EXTENSION Vcb);
+
+NTSTATUS
+NtfsFlushMftCache(PDEVICE_EXTENSION Vcb);
+
+VOID
+NtfsInitializeCompressionCache(PDEVICE_EXTENSION Vcb);
+
+VOID
+NtfsUninitializeCompressionCache(PDEVICE_EXTENSION Vcb);
+
+VOID
+NtfsInvalidateCompressionCache(PDEVICE_EXTENSION Vcb,
+                               ULONGLONG MftIndex);
+
 NTSTATUS
 ReadFileRecord(PDEVICE_EXTENSION Vcb,
                ULONGLONG index,
                PFILE_RECORD_HEADER file);
 
+NTSTATUS
+NtfsStartMftScan(PDEVICE_EXTENSION Vcb,
+                 ULONGLONG StartIndex,
+                 PNTFS_MFT_SCAN Scan);
+
+NTSTATUS
+NtfsReadNextMftRecord(PDEVICE_EXTENSION Vcb,
+                      PNTFS_MFT_SCAN Scan,
+                      PULONGLONG MftIndex,
+                      PFILE_RECORD_HEADER *FileRecord);
+
+VOID
+NtfsEndMftScan(PNTFS_MFT_SCAN Scan);
+
+VOID
+NtfsPrefetchFileRecords(PDEVICE_EXTENSION Vcb,
+                        PULONGLONG MftIndexes,
+                        ULONG Count);
+
 NTSTATUS
 UpdateIndexEntryFileNameSize(PDEVICE_EXTENSION Vcb,
                              PFILE_RECORD_HEADER MftRecord,
@@ -1211,6 +1796,19 @@ NtfsFindFileAt(PDEVICE_EXTENSION Vcb,
                ULONGLONG CurrentMFTIndex,
                BOOLEAN CaseSensitive);
 
+VOID
+NtfsReleaseIndexCursor(PNTFS_INDEX_CURSOR Cursor);
+
+NTSTATUS
+NtfsFindNextIndexEntry(PDEVICE_EXTENSION Vcb,
+                       PNTFS_INDEX_CURSOR Cursor,
+                       ULONGLONG DirectoryMftIndex,
+                       LONG IndexGeneration,
+                       PUNICODE_STRING SearchPattern,
+                       PULONG Entry,
+                       BOOLEAN CaseSensitive,
+                       PINDEX_ENTRY_ATTRIBUTE *IndexEntry);
+
 NTSTATUS
 NtfsFindMftRecord(PDEVICE_EXTENSION Vcb,
                   ULONGLONG MFTIndex,
@@ -1261,16 +1859,131 @@ NtfsRead(PNTFS_IRP_CONTEXT IrpContext);
 NTSTATUS
 NtfsWrite(PNTFS_IRP_CONTEXT IrpContext);
 
+VOID
+NtfsReadAheadIfSequential(PFILE_OBJECT FileObject,
+                          PLARGE_INTEGER FileOffset,
+                          ULONG Length);
+
+
+/* sparse.c */
+
+NTSTATUS
+NtfsAllocateAttributeRange(PDEVICE_EXTENSION Vcb,
+                           PNTFS_ATTR_CONTEXT AttrContext,
+                           ULONG AttrOffset,
+                           PFILE_RECORD_HEADER FileRecord,
+                           ULONGLONG Offset,
+                           ULONG Length);
+
+NTSTATUS
+NtfsDeallocateAttributeRange(PDEVICE_EXTENSION Vcb,
+                             PNTFS_ATTR_CONTEXT AttrContext,
+                             ULONG AttrOffset,
+                             PFILE_RECORD_HEADER FileRecord,
+                             ULONGLONG FirstVcn,
+                             ULONGLONG ClusterCount);
+
+NTSTATUS
+NtfsSetSparse(PDEVICE_EXTENSION Vcb,
+              PIRP Irp);
+
+NTSTATUS
+NtfsSetZeroData(PDEVICE_EXTENSION Vcb,
+                PIRP Irp);
+
+NTSTATUS
+NtfsQueryAllocatedRanges(PDEVICE_EXTENSION Vcb,
+                         PIRP Irp);
+
+
+/* upcase.c */
+
+VOID
+NtfsInitializeUpcaseTable(PDEVICE_EXTENSION DeviceExt);
+
+VOID
+NtfsUninitializeUpcaseTable(PDEVICE_EXTENSION DeviceExt);
+
+VOID
+NtfsUpcaseName(PDEVICE_EXTENSION Vcb,
+               PWCHAR Destination,
+               PCWSTR Source,
+               ULONG Length);
+
+LONG
+NtfsCollateFileNames(PDEVICE_EXTENSION Vcb,
+                     PCWSTR Name1,
+                     ULONG Length1,
+                     PCWSTR Name2,
+                     ULONG Length2,
+                     BOOLEAN CaseSensitive);
+
+
+/* usnjrnl.c */
+
+VOID
+NtfsInitializeUsnJournal(PDEVICE_EXTENSION Vcb);
+
+VOID
+NtfsUninitializeUsnJournal(PDEVICE_EXTENSION Vcb);
+
+NTSTATUS
+NtfsFlushUsnJournal(PDEVICE_EXTENSION Vcb);
+
+VOID
+NtfsUsnPostChange(PDEVICE_EXTENSION Vcb,
+                  PNTFS_FCB Fcb,
+                  ULONG Reason);
+
+VOID
+NtfsUsnPostClose(PDEVICE_EXTENSION Vcb,
+                 PNTFS_FCB Fcb);
+
+BOOLEAN
+NtfsUsnIsChangePosted(PDEVICE_EXTENSION Vcb,
+                      PNTFS_FCB Fcb,
+                      ULONG Reason);
+
+NTSTATUS
+NtfsCreateUsnJournal(PDEVICE_EXTENSION Vcb,
+                     PIRP Irp);
+
+NTSTATUS
+NtfsQueryUsnJournal(PDEVICE_EXTENSION Vcb,
+                    PIRP Irp);
+
+NTSTATUS
+NtfsReadUsnJournal(PDEVICE_EXTENSION Vcb,
+                   PIRP Irp);
+
+NTSTATUS
+NtfsEnumUsnData(PDEVICE_EXTENSION Vcb,
+                PIRP Irp);
 
 /* volinfo.c */
 
+VOID
+NtfsInitializeVolumeBitmap(PDEVICE_EXTENSION DeviceExt);
+
+VOID
+NtfsUninitializeVolumeBitmap(PDEVICE_EXTENSION DeviceExt);
+
+NTSTATUS
+NtfsFlushVolumeBitmap(PDEVICE_EXTENSION DeviceExt);
+
 NTSTATUS
 NtfsAllocateClusters(PDEVICE_EXTENSION DeviceExt,
-                     ULONG FirstDesiredCluster,
+                     ULONGLONG FirstDesiredCluster,
                      ULONG DesiredClusters,
-                     PULONG FirstAssignedCluster,
+                     BOOLEAN UseMftZone,
+                     PULONGLONG FirstAssignedCluster,
                      PULONG AssignedClusters);
 
+NTSTATUS
+NtfsDeallocateClusters(PDEVICE_EXTENSION DeviceExt,
+                       ULONGLONG FirstCluster,
+                       ULONG ClusterCount);
+
 ULONGLONG
 NtfsGetFreeClusters(PDEVICE_EXTENSION DeviceExt);
 
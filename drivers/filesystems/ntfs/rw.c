@@ -44,7 +44,7 @@ NtfsReadFile(PDEVICE_EXTENSION DeviceExt,
              PFILE_OBJECT FileObject,
              PUCHAR Buffer,
              ULONG Length,
-             ULONG ReadOffset,
+             ULONGLONG ReadOffset,
              ULONG IrpFlags,
              PULONG LengthRead)
 {
@@ -52,15 +52,11 @@ NtfsReadFile(PDEVICE_EXTENSION DeviceExt,
     PNTFS_FCB Fcb;
     PFILE_RECORD_HEADER FileRecord;
     PNTFS_ATTR_CONTEXT DataContext;
-    ULONG RealLength;
-    ULONG RealReadOffset;
     ULONG RealLengthRead;
     ULONG ToRead;
-    BOOLEAN AllocatedBuffer = FALSE;
-    PCHAR ReadBuffer = (PCHAR)Buffer;
     ULONGLONG StreamSize;
 
-    DPRINT("NtfsReadFile(%p, %p, %p, %lu, %lu, %lx, %p)\n", DeviceExt, FileObject, Buffer, Length, ReadOffset, IrpFlags, LengthRead);
+    DPRINT("NtfsReadFile(%p, %p, %p, %lu, %I64u, %lx, %p)\n", DeviceExt, FileObject, Buffer, Length, ReadOffset, IrpFlags, LengthRead);
 
     *LengthRead = 0;
 
@@ -72,13 +68,6 @@ NtfsReadFile(PDEVICE_EXTENSION DeviceExt,
 
     Fcb = (PNTFS_FCB)FileObject->FsContext;
 
-    if (NtfsFCBIsCompressed(Fcb))
-    {
-        DPRINT1("Compressed file!\n");
-        UNIMPLEMENTED;
-        return STATUS_NOT_IMPLEMENTED;
-    }
-
     if (NtfsFCBIsEncrypted(Fcb))
     {
         DPRINT1("Encrypted file!\n");
@@ -144,45 +133,16 @@ NtfsReadFile(PDEVICE_EXTENSION DeviceExt,
 
     ToRead = Length;
     if (ReadOffset + Length > StreamSize)
-        ToRead = StreamSize - ReadOffset;
-
-    RealReadOffset = ReadOffset;
-    RealLength = ToRead;
-
-    if ((ReadOffset % DeviceExt->NtfsInfo.BytesPerSector) != 0 || (ToRead % DeviceExt->NtfsInfo.BytesPerSector) != 0)
-    {
-        RealReadOffset = ROUND_DOWN(ReadOffset, DeviceExt->NtfsInfo.BytesPerSector);
-        RealLength = ROUND_UP(ToRead, DeviceExt->NtfsInfo.BytesPerSector);
-        /* do we need to extend RealLength by one sector? */
-        if (RealLength + RealReadOffset < ReadOffset + Length)
-        {
-            if (RealReadOffset + RealLength + DeviceExt->NtfsInfo.BytesPerSector <= AttributeAllocatedLength(DataContext->pRecord))
-                RealLength += DeviceExt->NtfsInfo.BytesPerSector;
-        }
-
-
-        ReadBuffer = ExAllocatePoolWithTag(NonPagedPool, RealLength, TAG_NTFS);
-        if (ReadBuffer == NULL)
-        {
-            DPRINT1("Not enough memory!\n");
-            ReleaseAttributeContext(DataContext);
-            ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, FileRecord);
-            return STATUS_INSUFFICIENT_RESOURCES;
-        }
-        AllocatedBuffer = TRUE;
-    }
+        ToRead = (ULONG)(StreamSize - ReadOffset);
 
-    DPRINT("Effective read: %lu at %lu for stream '%S'\n", RealLength, RealReadOffset, Fcb->Stream);
-    RealLengthRead = ReadAttribute(DeviceExt, DataContext, RealReadOffset, (PCHAR)ReadBuffer, RealLength);
+    // Unaligned requests are handled by NtfsReadDisk(), which only bounces the partial sectors
+    DPRINT("Effective read: %lu at %I64u for stream '%S'\n", ToRead, ReadOffset, Fcb->Stream);
+    RealLengthRead = ReadAttribute(DeviceExt, DataContext, ReadOffset, (PCHAR)Buffer, ToRead);
     if (RealLengthRead == 0)
     {
         DPRINT1("Read failure!\n");
         ReleaseAttributeContext(DataContext);
         ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, FileRecord);
-        if (AllocatedBuffer)
-        {
-            ExFreePoolWithTag(ReadBuffer, TAG_NTFS);
-        }
         return Status;
     }
 
@@ -193,22 +153,170 @@ NtfsReadFile(PDEVICE_EXTENSION DeviceExt,
 
     DPRINT("%lu got read\n", *LengthRead);
 
-    if (AllocatedBuffer)
+    if (ToRead != Length)
     {
-        RtlCopyMemory(Buffer, ReadBuffer + (ReadOffset - RealReadOffset), ToRead);
+        RtlZeroMemory(Buffer + ToRead, Length - ToRead);
     }
 
-    if (ToRead != Length)
+    return STATUS_SUCCESS;
+}
+
+
+/*
+ * FUNCTION: Reads or writes the sectors of the volume, for a volume handle.
+ * The metadata is seen as the journal holds it, see NtfsLogReadWriteVolume().
+ */
+static
+NTSTATUS
+NtfsReadWriteVolume(PDEVICE_EXTENSION DeviceExt,
+                    UCHAR MajorFunction,
+                    PUCHAR Buffer,
+                    ULONG Length,
+                    ULONGLONG Offset,
+                    PULONG LengthTransferred)
+{
+    ULONG BytesPerSector = DeviceExt->NtfsInfo.BytesPerSector;
+    ULONGLONG VolumeSize = DeviceExt->NtfsInfo.SectorCount * BytesPerSector;
+    NTSTATUS Status;
+
+    *LengthTransferred = 0;
+
+    if (Offset % BytesPerSector != 0 || Length % BytesPerSector != 0)
+        return STATUS_INVALID_PARAMETER;
+
+    if (Offset >= VolumeSize)
+        return MajorFunction == IRP_MJ_READ ? STATUS_END_OF_FILE : STATUS_DISK_FULL;
+
+    if (Length > VolumeSize - Offset)
+        Length = (ULONG)(VolumeSize - Offset);
+
+    Status = NtfsLogReadWriteVolume(DeviceExt, MajorFunction, Offset, Length, Buffer);
+    if (NT_SUCCESS(Status))
+        *LengthTransferred = Length;
+
+    return Status;
+}
+
+
+/**
+* @name NtfsReadAheadIfSequential
+* @implemented
+*
+* Tracks the cached reads of a handle, and has the cache manager read ahead of them once
+* they look sequential.
+*
+* @param FileObject
+* Handle the read is made through.
+*
+* @param FileOffset
+* @param Length
+* Range being read.
+*
+* @remarks
+* A read is sequential when it starts where the previous read of the same handle ended.
+* Read-ahead starts after NTFS_READ_AHEAD_THRESHOLD of them in a row, or at once for handles
+* opened with FILE_SEQUENTIAL_ONLY, and never for handles opened with FILE_RANDOM_ACCESS.
+* The counters are only a hint, reads made at the same time through the same handle may
+* update them in any order.
+*/
+VOID
+NtfsReadAheadIfSequential(PFILE_OBJECT FileObject,
+                          PLARGE_INTEGER FileOffset,
+                          ULONG Length)
+{
+    PNTFS_CCB Ccb = (PNTFS_CCB)FileObject->FsContext2;
+
+    if (Ccb == NULL || Length == 0 || BooleanFlagOn(FileObject->Flags, FO_RANDOM_ACCESS))
+        return;
+
+    if (FileOffset->QuadPart == Ccb->NextReadOffset.QuadPart)
     {
-        RtlZeroMemory(Buffer + ToRead, Length - ToRead);
+        if (Ccb->SequentialReads < NTFS_READ_AHEAD_THRESHOLD)
+            Ccb->SequentialReads++;
     }
+    else
+    {
+        Ccb->SequentialReads = 0;
+    }
+
+    Ccb->NextReadOffset.QuadPart = FileOffset->QuadPart + Length;
 
-    if (AllocatedBuffer)
+    if (Ccb->SequentialReads >= NTFS_READ_AHEAD_THRESHOLD ||
+        BooleanFlagOn(FileObject->Flags, FO_SEQUENTIAL_ONLY))
     {
-        ExFreePoolWithTag(ReadBuffer, TAG_NTFS);
+        CcScheduleReadAhead(FileObject, FileOffset, Length);
     }
+}
 
-    return STATUS_SUCCESS;
+
+/*
+ * FUNCTION: Reads a file through the cache manager. The paging reads the
+ * cache manager issues to fill its views come back to NtfsRead() and end
+ * up in NtfsReadFile().
+ */
+static
+NTSTATUS
+NtfsCachedRead(PNTFS_IRP_CONTEXT IrpContext,
+               PNTFS_FCB Fcb,
+               PVOID Buffer,
+               ULONG Length,
+               LARGE_INTEGER ReadOffset,
+               PULONG LengthRead)
+{
+    PFILE_OBJECT FileObject = IrpContext->FileObject;
+    PIRP Irp = IrpContext->Irp;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    *LengthRead = 0;
+
+    if (ReadOffset.QuadPart >= Fcb->RFCB.FileSize.QuadPart)
+    {
+        return STATUS_END_OF_FILE;
+    }
+
+    if (ReadOffset.QuadPart + Length > Fcb->RFCB.FileSize.QuadPart)
+    {
+        Length = (ULONG)(Fcb->RFCB.FileSize.QuadPart - ReadOffset.QuadPart);
+    }
+
+    _SEH2_TRY
+    {
+        if (FileObject->PrivateCacheMap == NULL)
+        {
+            CcInitializeCacheMap(FileObject,
+                                 (PCC_FILE_SIZES)(&Fcb->RFCB.AllocationSize),
+                                 FALSE,
+                                 &(NtfsGlobalData->CacheMgrCallbacks),
+                                 Fcb);
+            CcSetReadAheadGranularity(FileObject, NTFS_READ_AHEAD_GRANULARITY);
+        }
+
+        if (!CcCopyRead(FileObject,
+                        &ReadOffset,
+                        Length,
+                        BooleanFlagOn(IrpContext->Flags, IRPCONTEXT_CANWAIT),
+                        Buffer,
+                        &Irp->IoStatus))
+        {
+            ASSERT(!(IrpContext->Flags & IRPCONTEXT_CANWAIT));
+            Status = STATUS_PENDING;
+        }
+        else
+        {
+            Status = Irp->IoStatus.Status;
+            *LengthRead = (ULONG)Irp->IoStatus.Information;
+
+            if (NT_SUCCESS(Status))
+                NtfsReadAheadIfSequential(FileObject, &ReadOffset, *LengthRead);
+        }
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    return Status;
 }
 
 
@@ -218,6 +326,8 @@ NtfsRead(PNTFS_IRP_CONTEXT IrpContext)
     PDEVICE_EXTENSION DeviceExt;
     PIO_STACK_LOCATION Stack;
     PFILE_OBJECT FileObject;
+    PNTFS_FCB Fcb;
+    PERESOURCE Resource;
     PVOID Buffer;
     ULONG ReadLength;
     LARGE_INTEGER ReadOffset;
@@ -225,6 +335,7 @@ NtfsRead(PNTFS_IRP_CONTEXT IrpContext)
     NTSTATUS Status = STATUS_SUCCESS;
     PIRP Irp;
     PDEVICE_OBJECT DeviceObject;
+    BOOLEAN PagingIo, Cached;
 
     DPRINT("NtfsRead(IrpContext %p)\n", IrpContext);
 
@@ -233,21 +344,92 @@ NtfsRead(PNTFS_IRP_CONTEXT IrpContext)
     Stack = IrpContext->Stack;
     FileObject = IrpContext->FileObject;
 
+    if (DeviceObject == NtfsGlobalData->DeviceObject)
+    {
+        Irp->IoStatus.Information = 0;
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
     DeviceExt = DeviceObject->DeviceExtension;
+    Fcb = (PNTFS_FCB)FileObject->FsContext;
     ReadLength = Stack->Parameters.Read.Length;
     ReadOffset = Stack->Parameters.Read.ByteOffset;
-    Buffer = NtfsGetUserBuffer(Irp, BooleanFlagOn(Irp->Flags, IRP_PAGING_IO));
+    PagingIo = BooleanFlagOn(Irp->Flags, IRP_PAGING_IO);
+
+    if (ReadLength == 0)
+    {
+        Irp->IoStatus.Information = 0;
+        return STATUS_SUCCESS;
+    }
+
+    // Regular reads of files go through the cache, the paging I/O it generates does the disk transfer
+    Cached = !PagingIo &&
+             !(Irp->Flags & IRP_NOCACHE) &&
+             !(Fcb->Flags & FCB_IS_VOLUME) &&
+             !NtfsFCBIsDirectory(Fcb);
+
+    if (Fcb->Flags & FCB_IS_VOLUME)
+    {
+        Resource = &DeviceExt->DirResource;
+    }
+    else if (PagingIo)
+    {
+        Resource = &Fcb->PagingIoResource;
+    }
+    else
+    {
+        Resource = &Fcb->MainResource;
+    }
+
+    if (!ExAcquireResourceSharedLite(Resource, BooleanFlagOn(IrpContext->Flags, IRPCONTEXT_CANWAIT)))
+    {
+        Status = STATUS_PENDING;
+        goto ByeBye;
+    }
+
+    Buffer = NtfsGetUserBuffer(Irp, PagingIo);
+
+    if (Cached)
+    {
+        Status = NtfsCachedRead(IrpContext, Fcb, Buffer, ReadLength, ReadOffset, &ReturnedReadLength);
+    }
+    else if (Fcb->Flags & FCB_IS_VOLUME)
+    {
+        Status = NtfsReadWriteVolume(DeviceExt, IRP_MJ_READ, Buffer, ReadLength, ReadOffset.QuadPart, &ReturnedReadLength);
+    }
+    else
+    {
+        // Write back what the cache holds for the range so that the disk is up to date
+        if (!PagingIo && Fcb->SectionObjectPointers.DataSectionObject != NULL)
+        {
+            CcFlushCache(&Fcb->SectionObjectPointers, &ReadOffset, ReadLength, &Irp->IoStatus);
+        }
+
+        Status = NtfsReadFile(DeviceExt,
+                              FileObject,
+                              Buffer,
+                              ReadLength,
+                              ReadOffset.QuadPart,
+                              Irp->Flags,
+                              &ReturnedReadLength);
+    }
+
+    ExReleaseResourceLite(Resource);
+
+ByeBye:
+    if (Status == STATUS_PENDING)
+    {
+        // The request is retried from a worker thread, which can't reach the user buffer
+        Status = NtfsLockUserBuffer(Irp, ReadLength, IoWriteAccess);
+        if (NT_SUCCESS(Status))
+        {
+            return NtfsMarkIrpContextForQueue(IrpContext);
+        }
+    }
 
-    Status = NtfsReadFile(DeviceExt,
-                          FileObject,
-                          Buffer,
-                          ReadLength,
-                          ReadOffset.u.LowPart,
-                          Irp->Flags,
-                          &ReturnedReadLength);
     if (NT_SUCCESS(Status))
     {
-        if (FileObject->Flags & FO_SYNCHRONOUS_IO)
+        if ((FileObject->Flags & FO_SYNCHRONOUS_IO) && !PagingIo)
         {
             FileObject->CurrentByteOffset.QuadPart =
                 ReadOffset.QuadPart + ReturnedReadLength;
@@ -263,13 +445,70 @@ NtfsRead(PNTFS_IRP_CONTEXT IrpContext)
     return Status;
 }
 
+/*
+ * FUNCTION: Copies data into the cache of a file whose stream already covers
+ * the range; the lazy writer sends it to the disk through NtfsWrite().
+ */
+static
+NTSTATUS
+NtfsCachedWrite(PFILE_OBJECT FileObject,
+                PNTFS_FCB Fcb,
+                PVOID Buffer,
+                ULONG Length,
+                ULONGLONG WriteOffset,
+                ULONGLONG OldFileSize,
+                BOOLEAN Sparse)
+{
+    LARGE_INTEGER Offset, OldSize, ZeroEnd;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    Offset.QuadPart = WriteOffset;
+    OldSize.QuadPart = OldFileSize;
+
+    // In a sparse stream, only the last cluster of the old data can hold stale data, the rest is a hole
+    ZeroEnd.QuadPart = WriteOffset;
+    if (Sparse)
+        ZeroEnd.QuadPart = min(WriteOffset, ROUND_UP(OldFileSize, Fcb->Vcb->NtfsInfo.BytesPerCluster));
+
+    _SEH2_TRY
+    {
+        if (FileObject->PrivateCacheMap == NULL)
+        {
+            CcInitializeCacheMap(FileObject,
+                                 (PCC_FILE_SIZES)(&Fcb->RFCB.AllocationSize),
+                                 FALSE,
+                                 &(NtfsGlobalData->CacheMgrCallbacks),
+                                 Fcb);
+            CcSetReadAheadGranularity(FileObject, NTFS_READ_AHEAD_GRANULARITY);
+        }
+
+        // Don't let the clusters between the old end of the file and the write expose stale data
+        if (ZeroEnd.QuadPart > OldSize.QuadPart)
+        {
+            CcZeroData(FileObject, &OldSize, &ZeroEnd, TRUE);
+        }
+
+        if (!CcCopyWrite(FileObject, &Offset, Length, TRUE, Buffer))
+        {
+            Status = STATUS_UNSUCCESSFUL;
+        }
+    }
+    _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+    {
+        Status = _SEH2_GetExceptionCode();
+    }
+    _SEH2_END;
+
+    return Status;
+}
+
 /**
 * @name NtfsWriteFile
 * @implemented
 *
-* Writes a file to the disk. It presently borrows a lot of code from NtfsReadFile() and
+* Writes a file. It presently borrows a lot of code from NtfsReadFile() and
 * VFatWriteFileData(). It needs some more work before it will be complete; it won't handle
-* page files, asnyc io, cached writes, etc.
+* page files, asnyc io, etc.
 *
 * @param DeviceExt
 * Points to the target disk's DEVICE_EXTENSION
@@ -288,7 +527,9 @@ NtfsRead(PNTFS_IRP_CONTEXT IrpContext)
 * writing data.
 *
 * @param IrpFlags
-* TODO: flags are presently ignored in code.
+* Flags of the IRP. Unless IRP_PAGING_IO or IRP_NOCACHE is set, the data is copied to the
+* cache of the file instead of being written to the disk. Paging writes past the end of
+* the stream are truncated to it.
 *
 * @param CaseSensitive
 * Boolean indicating if the function should operate in case-sensitive mode. This will be TRUE
@@ -312,7 +553,7 @@ NTSTATUS NtfsWriteFile(PDEVICE_EXTENSION DeviceExt,
                        PFILE_OBJECT FileObject,
                        const PUCHAR Buffer,
                        ULONG Length,
-                       ULONG WriteOffset,
+                       ULONGLONG WriteOffset,
                        ULONG IrpFlags,
                        BOOLEAN CaseSensitive,
                        PULONG LengthWritten)
@@ -323,8 +564,9 @@ NTSTATUS NtfsWriteFile(PDEVICE_EXTENSION DeviceExt,
     PNTFS_ATTR_CONTEXT DataContext;
     ULONG AttributeOffset;
     ULONGLONG StreamSize;
+    ULONG ToWrite = Length;
 
-    DPRINT("NtfsWriteFile(%p, %p, %p, %lu, %lu, %x, %s, %p)\n",
+    DPRINT("NtfsWriteFile(%p, %p, %p, %lu, %I64u, %x, %s, %p)\n",
            DeviceExt,
            FileObject,
            Buffer,
@@ -422,14 +664,26 @@ NTSTATUS NtfsWriteFile(PDEVICE_EXTENSION DeviceExt,
     // Get the size of the stream on disk
     StreamSize = AttributeDataLength(DataContext->pRecord);
 
-    DPRINT("WriteOffset: %lu\tStreamSize: %I64u\n", WriteOffset, StreamSize);
+    DPRINT("WriteOffset: %I64u\tStreamSize: %I64u\n", WriteOffset, StreamSize);
 
     // Are we trying to write beyond the end of the stream?
     if (WriteOffset + Length > StreamSize)
     {
         // is increasing the stream size allowed?
-        if (!(Fcb->Flags & FCB_IS_VOLUME) &&
-            !(IrpFlags & IRP_PAGING_IO))
+        if (IrpFlags & IRP_PAGING_IO)
+        {
+            // The cache manager writes whole pages, the part past the end of the stream is dropped
+            if (WriteOffset >= StreamSize)
+            {
+                ReleaseAttributeContext(DataContext);
+                ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, FileRecord);
+                *LengthWritten = Length;
+                return STATUS_SUCCESS;
+            }
+
+            ToWrite = (ULONG)(StreamSize - WriteOffset);
+        }
+        else if (!(Fcb->Flags & FCB_IS_VOLUME))
         {
             LARGE_INTEGER DataSize;
             ULONGLONG AllocationSize;
@@ -482,10 +736,36 @@ NTSTATUS NtfsWriteFile(PDEVICE_EXTENSION DeviceExt,
         }
     }
 
-    DPRINT("Length: %lu\tWriteOffset: %lu\tStreamSize: %I64u\n", Length, WriteOffset, StreamSize);
+    DPRINT("Length: %lu\tWriteOffset: %I64u\tStreamSize: %I64u\n", Length, WriteOffset, StreamSize);
+
+    if (!(IrpFlags & (IRP_PAGING_IO | IRP_NOCACHE)) && !(Fcb->Flags & FCB_IS_VOLUME))
+    {
+        // Cached write, the stream is now large enough for it
+        Status = NtfsCachedWrite(FileObject,
+                                 Fcb,
+                                 Buffer,
+                                 Length,
+                                 WriteOffset,
+                                 StreamSize,
+                                 BooleanFlagOn(DataContext->pRecord->Flags, ATTR_FLAG_SPARSE));
+        if (NT_SUCCESS(Status))
+        {
+            *LengthWritten = Length;
+        }
+    }
+    else
+    {
+        // The holes of a sparse stream get their clusters when they're written to
+        Status = NtfsAllocateAttributeRange(DeviceExt, DataContext, AttributeOffset, FileRecord, WriteOffset, ToWrite);
 
-    // Write the data to the attribute
-    Status = WriteAttribute(DeviceExt, DataContext, WriteOffset, Buffer, Length, LengthWritten, FileRecord);
+        // Write the data to the attribute
+        if (NT_SUCCESS(Status))
+            Status = WriteAttribute(DeviceExt, DataContext, WriteOffset, Buffer, ToWrite, LengthWritten, FileRecord);
+        if (NT_SUCCESS(Status) && *LengthWritten == ToWrite)
+        {
+            *LengthWritten = Length;
+        }
+    }
 
     // Did the write fail?
     if (!NT_SUCCESS(Status))
@@ -530,7 +810,7 @@ NTSTATUS NtfsWriteFile(PDEVICE_EXTENSION DeviceExt,
 * STATUS_PARTIAL_COPY, STATUS_UNSUCCESSFUL, or STATUS_OBJECT_NAME_NOT_FOUND if NtfsWriteFile() fails.
 *
 * @remarks Called by NtfsDispatch() in response to an IRP_MJ_WRITE request. Page files are not implemented.
-* Support for large files (>4gb) is not implemented. Cached writes, file locks, transactions, etc - not implemented.
+* File locks, transactions, etc - not implemented.
 *
 */
 NTSTATUS
@@ -548,6 +828,7 @@ NtfsWrite(PNTFS_IRP_CONTEXT IrpContext)
     PFILE_OBJECT FileObject = NULL;
     PIRP Irp = NULL;
     ULONG BytesPerSector;
+    LONGLONG OldFileSize;
 
     DPRINT("NtfsWrite(IrpContext %p)\n", IrpContext);
     ASSERT(IrpContext);
@@ -589,19 +870,12 @@ NtfsWrite(PNTFS_IRP_CONTEXT IrpContext)
     DPRINT("ByteOffset: %I64u\tLength: %lu\tBytes per sector: %lu\n", ByteOffset.QuadPart,
         Length, BytesPerSector);
 
-    if (ByteOffset.u.HighPart && !(Fcb->Flags & FCB_IS_VOLUME))
-    {
-        // TODO: Support large files
-        DPRINT1("FIXME: Writing to large files is not yet supported at this time.\n");
-        return STATUS_INVALID_PARAMETER;
-    }
-
     // Is this a non-cached write? A non-buffered write?
     if (IrpContext->Irp->Flags & (IRP_PAGING_IO | IRP_NOCACHE) || (Fcb->Flags & FCB_IS_VOLUME) ||
         IrpContext->FileObject->Flags & FILE_NO_INTERMEDIATE_BUFFERING)
     {
         // non-cached and non-buffered writes must be sector aligned
-        if (ByteOffset.u.LowPart % BytesPerSector != 0 || Length % BytesPerSector != 0)
+        if (ByteOffset.QuadPart % BytesPerSector != 0 || Length % BytesPerSector != 0)
         {
             DPRINT1("Non-cached writes and non-buffered writes must be sector aligned!\n");
             return STATUS_INVALID_PARAMETER;
@@ -680,20 +954,35 @@ NtfsWrite(PNTFS_IRP_CONTEXT IrpContext)
         return Status;
     }
 
+    // A non-cached write must not be overwritten later by stale cached data
+    if ((Irp->Flags & (IRP_PAGING_IO | IRP_NOCACHE)) == IRP_NOCACHE &&
+        Fcb->SectionObjectPointers.DataSectionObject != NULL)
+    {
+        CcFlushCache(&Fcb->SectionObjectPointers, &ByteOffset, Length, &Irp->IoStatus);
+        CcPurgeCacheSection(&Fcb->SectionObjectPointers, &ByteOffset, Length, FALSE);
+    }
+
     DPRINT("Existing File Size(Fcb->RFCB.FileSize.QuadPart): %I64u\n", Fcb->RFCB.FileSize.QuadPart);
     DPRINT("About to write the data. Length: %lu\n", Length);
 
-    // TODO: handle HighPart of ByteOffset (large files)
+    OldFileSize = Fcb->RFCB.FileSize.QuadPart;
 
     // write the file
-    Status = NtfsWriteFile(DeviceExt,
-                           FileObject,
-                           Buffer,
-                           Length,
-                           ByteOffset.LowPart,
-                           Irp->Flags,
-                           BooleanFlagOn(IrpContext->Stack->Flags, SL_CASE_SENSITIVE),
-                           &ReturnedWriteLength);
+    if (Fcb->Flags & FCB_IS_VOLUME)
+    {
+        Status = NtfsReadWriteVolume(DeviceExt, IRP_MJ_WRITE, Buffer, Length, ByteOffset.QuadPart, &ReturnedWriteLength);
+    }
+    else
+    {
+        Status = NtfsWriteFile(DeviceExt,
+                               FileObject,
+                               Buffer,
+                               Length,
+                               ByteOffset.QuadPart,
+                               Irp->Flags,
+                               BooleanFlagOn(IrpContext->Stack->Flags, SL_CASE_SENSITIVE),
+                               &ReturnedWriteLength);
+    }
 
     IrpContext->Irp->IoStatus.Status = Status;
 
@@ -702,12 +991,25 @@ NtfsWrite(PNTFS_IRP_CONTEXT IrpContext)
     {
         // TODO: Update timestamps
 
-        if (FileObject->Flags & FO_SYNCHRONOUS_IO)
+        if ((FileObject->Flags & FO_SYNCHRONOUS_IO) && !(Irp->Flags & IRP_PAGING_IO))
         {
             // advance the file pointer
             FileObject->CurrentByteOffset.QuadPart = ByteOffset.QuadPart + ReturnedWriteLength;
         }
 
+        // Paging writes only carry data whose change was recorded by the write that cached it
+        if (!(Irp->Flags & IRP_PAGING_IO) && ReturnedWriteLength != 0)
+        {
+            ULONG Reason = 0;
+
+            if (ByteOffset.QuadPart < OldFileSize)
+                Reason |= USN_REASON_DATA_OVERWRITE;
+            if (ByteOffset.QuadPart + ReturnedWriteLength > OldFileSize)
+                Reason |= USN_REASON_DATA_EXTEND;
+
+            NtfsUsnPostChange(DeviceExt, Fcb, Reason);
+        }
+
         IrpContext->PriorityBoost = IO_DISK_INCREMENT;
     }
     else
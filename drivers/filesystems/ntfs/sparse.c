@@ -0,0 +1,775 @@
+/*
+ * PROJECT:     ReactOS NTFS driver
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Sparse streams, zeroed ranges and allocated range queries
+ * COPYRIGHT:   Copyright 2026 ReactOS Team
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include "ntfs.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* GLOBALS *****************************************************************/
+
+/* Largest reply of FSCTL_QUERY_ALLOCATED_RANGES */
+#define NTFS_ALLOCATED_RANGES_OUTPUT_MAX    0x10000
+
+/* FUNCTIONS ****************************************************************/
+
+/* Reads the file record of an FCB and finds the attribute of its stream */
+static
+NTSTATUS
+NtfsSparseFindStream(PDEVICE_EXTENSION Vcb,
+                     PNTFS_FCB Fcb,
+                     PFILE_RECORD_HEADER *FileRecord,
+                     PNTFS_ATTR_CONTEXT *DataContext,
+                     PULONG AttrOffset)
+{
+    NTSTATUS Status;
+
+    *FileRecord = ExAllocateFromNPagedLookasideList(&Vcb->FileRecLookasideList);
+    if (*FileRecord == NULL)
+    {
+        DPRINT1("Couldn't allocate memory for file record!\n");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Status = ReadFileRecord(Vcb, Fcb->MFTIndex, *FileRecord);
+    if (NT_SUCCESS(Status))
+    {
+        Status = FindAttribute(Vcb,
+                               *FileRecord,
+                               AttributeData,
+                               Fcb->Stream,
+                               wcslen(Fcb->Stream),
+                               DataContext,
+                               AttrOffset);
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("No '%S' data stream associated with file!\n", Fcb->Stream);
+        ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, *FileRecord);
+    }
+
+    return Status;
+}
+
+/* Writes zeroes over the allocated clusters of a range of a non-resident attribute, holes are skipped */
+static
+NTSTATUS
+NtfsZeroAttributeRange(PDEVICE_EXTENSION Vcb,
+                       PNTFS_ATTR_CONTEXT AttrContext,
+                       ULONGLONG Offset,
+                       ULONGLONG Length)
+{
+    ULONG BytesPerCluster = Vcb->NtfsInfo.BytesPerCluster;
+    PUCHAR ZeroBuffer;
+    LONGLONG Lcn;
+    ULONGLONG RunClusters;
+    ULONG ToWrite;
+    ULONG Written;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    ZeroBuffer = ExAllocatePoolWithTag(NonPagedPool, BytesPerCluster, TAG_NTFS);
+    if (ZeroBuffer == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    RtlZeroMemory(ZeroBuffer, BytesPerCluster);
+
+    while (Length > 0)
+    {
+        if (!NtfsLookupAttributeRun(AttrContext, Offset / BytesPerCluster, &Lcn, &RunClusters))
+            break;
+
+        // Don't go past the current cluster, so that a hole is found where it starts
+        ToWrite = (ULONG)min(BytesPerCluster - (Offset % BytesPerCluster), Length);
+
+        if (Lcn != -1)
+        {
+            Status = WriteAttribute(Vcb, AttrContext, Offset, ZeroBuffer, ToWrite, &Written, NULL);
+            if (!NT_SUCCESS(Status))
+                break;
+        }
+
+        Offset += ToWrite;
+        Length -= ToWrite;
+    }
+
+    ExFreePoolWithTag(ZeroBuffer, TAG_NTFS);
+
+    return Status;
+}
+
+/**
+* @name NtfsAllocateAttributeRange
+* @implemented
+*
+* Gives clusters to the holes of a sparse attribute that a write is about to fill.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @param AttrContext
+* Pointer to an NTFS_ATTR_CONTEXT describing the attribute being written to.
+*
+* @param AttrOffset
+* Byte offset of the attribute relative to its file record.
+*
+* @param FileRecord
+* Pointer to a complete copy of the file record containing the attribute.
+*
+* @param Offset
+* Byte offset of the write in the attribute.
+*
+* @param Length
+* Length of the write, in bytes.
+*
+* @return
+* STATUS_SUCCESS if the whole range is allocated, which it always is for attributes that
+* aren't sparse. STATUS_END_OF_FILE if the range is beyond HighestVCN, or an error from
+* NtfsAllocateClusters() or StoreDataRuns().
+*
+* @remarks
+* The parts of the new clusters the write doesn't cover are zeroed on the disk.
+*/
+NTSTATUS
+NtfsAllocateAttributeRange(PDEVICE_EXTENSION Vcb,
+                           PNTFS_ATTR_CONTEXT AttrContext,
+                           ULONG AttrOffset,
+                           PFILE_RECORD_HEADER FileRecord,
+                           ULONGLONG Offset,
+                           ULONG Length)
+{
+    ULONG BytesPerCluster = Vcb->NtfsInfo.BytesPerCluster;
+    ULONGLONG FirstVcn = Offset / BytesPerCluster;
+    ULONGLONG EndVcn = (Offset + Length + BytesPerCluster - 1) / BytesPerCluster;
+    ULONGLONG Vcn;
+    ULONGLONG RunClusters;
+    ULONGLONG FirstAssignedCluster;
+    ULONG AssignedClusters;
+    LONGLONG Lcn;
+    LONGLONG PreviousLcn = -1;
+    BOOLEAN FirstAllocated = FALSE;
+    BOOLEAN LastAllocated = FALSE;
+    BOOLEAN Changed = FALSE;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    if (!AttrContext->pRecord->IsNonResident ||
+        !(AttrContext->pRecord->Flags & ATTR_FLAG_SPARSE) ||
+        Length == 0)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    // Place the new clusters after the ones in front of the write, if there are any
+    if (FirstVcn != 0 &&
+        NtfsLookupAttributeRun(AttrContext, FirstVcn - 1, &Lcn, &RunClusters))
+    {
+        PreviousLcn = Lcn;
+    }
+
+    for (Vcn = FirstVcn; Vcn < EndVcn; Vcn += RunClusters)
+    {
+        if (!NtfsLookupAttributeRun(AttrContext, Vcn, &Lcn, &RunClusters))
+        {
+            DPRINT1("Write beyond the last cluster of the attribute! Vcn: %I64u\n", Vcn);
+            Status = STATUS_END_OF_FILE;
+            break;
+        }
+
+        RunClusters = min(RunClusters, EndVcn - Vcn);
+
+        if (Lcn != -1)
+        {
+            PreviousLcn = Lcn + RunClusters - 1;
+            continue;
+        }
+
+        Status = NtfsAllocateClusters(Vcb,
+                                      PreviousLcn + 1,
+                                      (ULONG)RunClusters,
+                                      FALSE,
+                                      &FirstAssignedCluster,
+                                      &AssignedClusters);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Error: Unable to allocate requested clusters!\n");
+            break;
+        }
+
+        _SEH2_TRY
+        {
+            if (!FsRtlAddLargeMcbEntry(&AttrContext->DataRunsMCB,
+                                       Vcn,
+                                       FirstAssignedCluster,
+                                       AssignedClusters))
+            {
+                ExRaiseStatus(STATUS_UNSUCCESSFUL);
+            }
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            Status = _SEH2_GetExceptionCode();
+        }
+        _SEH2_END;
+
+        AttrContext->CachedRunLength = 0;
+
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Failed to add LargeMcb Entry!\n");
+            NtfsDeallocateClusters(Vcb, FirstAssignedCluster, AssignedClusters);
+            break;
+        }
+
+        Changed = TRUE;
+        if (Vcn == FirstVcn)
+            FirstAllocated = TRUE;
+        if (Vcn + AssignedClusters == EndVcn)
+            LastAllocated = TRUE;
+
+        RunClusters = AssignedClusters;
+        PreviousLcn = FirstAssignedCluster + AssignedClusters - 1;
+    }
+
+    // Whatever was allocated is recorded, even if the rest of the range couldn't be
+    if (Changed)
+    {
+        NTSTATUS StoreStatus;
+
+        StoreStatus = StoreDataRuns(Vcb, AttrContext, AttrOffset, FileRecord);
+        if (NT_SUCCESS(StoreStatus))
+            StoreStatus = UpdateFileRecord(Vcb, AttrContext->FileMFTIndex, FileRecord);
+
+        if (NT_SUCCESS(Status))
+            Status = StoreStatus;
+    }
+
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    // The new clusters may hold anything, clear what the write leaves of them
+    if (FirstAllocated && (Offset % BytesPerCluster) != 0)
+    {
+        Status = NtfsZeroAttributeRange(Vcb,
+                                        AttrContext,
+                                        FirstVcn * BytesPerCluster,
+                                        Offset % BytesPerCluster);
+    }
+
+    if (NT_SUCCESS(Status) && LastAllocated && ((Offset + Length) % BytesPerCluster) != 0)
+    {
+        Status = NtfsZeroAttributeRange(Vcb,
+                                        AttrContext,
+                                        Offset + Length,
+                                        EndVcn * BytesPerCluster - (Offset + Length));
+    }
+
+    return Status;
+}
+
+/**
+* @name NtfsDeallocateAttributeRange
+* @implemented
+*
+* Turns whole clusters of a sparse attribute into a hole, and frees them.
+*
+* @param Vcb
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @param AttrContext
+* Pointer to an NTFS_ATTR_CONTEXT describing the attribute.
+*
+* @param AttrOffset
+* Byte offset of the attribute relative to its file record.
+*
+* @param FileRecord
+* Pointer to a complete copy of the file record containing the attribute.
+*
+* @param FirstVcn
+* First cluster of the range.
+*
+* @param ClusterCount
+* Number of clusters in the range. The parts of it that are already a hole are skipped.
+*
+* @return
+* STATUS_SUCCESS, or an error from NtfsDeallocateClusters() or StoreDataRuns().
+*/
+NTSTATUS
+NtfsDeallocateAttributeRange(PDEVICE_EXTENSION Vcb,
+                             PNTFS_ATTR_CONTEXT AttrContext,
+                             ULONG AttrOffset,
+                             PFILE_RECORD_HEADER FileRecord,
+                             ULONGLONG FirstVcn,
+                             ULONGLONG ClusterCount)
+{
+    ULONGLONG EndVcn = FirstVcn + ClusterCount;
+    ULONGLONG Vcn;
+    ULONGLONG RunClusters;
+    LONGLONG Lcn;
+    BOOLEAN Changed = FALSE;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    for (Vcn = FirstVcn; Vcn < EndVcn; Vcn += RunClusters)
+    {
+        if (!NtfsLookupAttributeRun(AttrContext, Vcn, &Lcn, &RunClusters))
+            break;
+
+        RunClusters = min(RunClusters, min(EndVcn - Vcn, MAXULONG));
+
+        if (Lcn == -1)
+            continue;
+
+        // Unmap the clusters before they're given back to the volume
+        _SEH2_TRY
+        {
+            FsRtlRemoveLargeMcbEntry(&AttrContext->DataRunsMCB, Vcn, RunClusters);
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            Status = _SEH2_GetExceptionCode();
+        }
+        _SEH2_END;
+
+        AttrContext->CachedRunLength = 0;
+
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Failed to remove LargeMcb Entry!\n");
+            break;
+        }
+
+        Changed = TRUE;
+
+        Status = NtfsDeallocateClusters(Vcb, Lcn, (ULONG)RunClusters);
+        if (!NT_SUCCESS(Status))
+            break;
+    }
+
+    if (Changed)
+    {
+        NTSTATUS StoreStatus;
+
+        StoreStatus = StoreDataRuns(Vcb, AttrContext, AttrOffset, FileRecord);
+        if (NT_SUCCESS(StoreStatus))
+            StoreStatus = UpdateFileRecord(Vcb, AttrContext->FileMFTIndex, FileRecord);
+
+        if (NT_SUCCESS(Status))
+            Status = StoreStatus;
+    }
+
+    return Status;
+}
+
+/**
+* @name NtfsSetSparse
+* @implemented
+*
+* Handles FSCTL_SET_SPARSE: marks the stream of a file as sparse, so that the clusters
+* it doesn't use can be released.
+*
+* @param Vcb
+* Points to the DEVICE_EXTENSION of the volume.
+*
+* @param Irp
+* Request, optionally holding a FILE_SET_SPARSE_BUFFER.
+*
+* @return
+* STATUS_SUCCESS, STATUS_INVALID_PARAMETER for a directory or a volume,
+* STATUS_NOT_IMPLEMENTED to clear the sparse state of a file or to make a compressed
+* file sparse.
+*
+* @remarks
+* A resident stream isn't changed, only the file is marked. The stream becomes sparse
+* when it's moved out of the file record.
+*/
+NTSTATUS
+NtfsSetSparse(PDEVICE_EXTENSION Vcb,
+              PIRP Irp)
+{
+    PIO_STACK_LOCATION Stack = IoGetCurrentIrpStackLocation(Irp);
+    PNTFS_FCB Fcb = Stack->FileObject->FsContext;
+    PFILE_RECORD_HEADER FileRecord;
+    PNTFS_ATTR_CONTEXT DataContext;
+    PSTANDARD_INFORMATION StandardInfo;
+    ULONG AttrOffset;
+    BOOLEAN SetSparse = TRUE;
+    NTSTATUS Status;
+
+    if (Stack->Parameters.FileSystemControl.InputBufferLength >= sizeof(FILE_SET_SPARSE_BUFFER))
+        SetSparse = ((PFILE_SET_SPARSE_BUFFER)Irp->AssociatedIrp.SystemBuffer)->SetSparse;
+
+    if (!NtfsGlobalData->EnableWriteSupport)
+    {
+        DPRINT1("NTFS write-support is EXPERIMENTAL and is disabled by default!\n");
+        return STATUS_ACCESS_DENIED;
+    }
+
+    if ((Fcb->Flags & FCB_IS_VOLUME) || NtfsFCBIsDirectory(Fcb))
+        return STATUS_INVALID_PARAMETER;
+
+    if (!SetSparse)
+    {
+        if (!(Fcb->Entry.FileAttributes & NTFS_FILE_TYPE_SPARSE))
+            return STATUS_SUCCESS;
+
+        DPRINT1("FIXME: Clearing the sparse state of a file is not supported yet!\n");
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    if (NtfsFCBIsCompressed(Fcb))
+    {
+        DPRINT1("FIXME: Sparse compressed files are not supported yet!\n");
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    ExAcquireResourceExclusiveLite(&Fcb->MainResource, TRUE);
+
+    Status = NtfsSparseFindStream(Vcb, Fcb, &FileRecord, &DataContext, &AttrOffset);
+    if (!NT_SUCCESS(Status))
+    {
+        ExReleaseResourceLite(&Fcb->MainResource);
+        return Status;
+    }
+
+    if (DataContext->pRecord->IsNonResident &&
+        !(DataContext->pRecord->Flags & ATTR_FLAG_SPARSE))
+    {
+        Status = NtfsMakeAttributeSparse(Vcb, DataContext, AttrOffset, FileRecord);
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        StandardInfo = GetStandardInformationFromRecord(Vcb, FileRecord);
+        if (StandardInfo != NULL)
+            StandardInfo->FileAttribute |= NTFS_FILE_TYPE_SPARSE;
+
+        Status = UpdateFileRecord(Vcb, Fcb->MFTIndex, FileRecord);
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        Fcb->Entry.FileAttributes |= NTFS_FILE_TYPE_SPARSE;
+        NtfsUsnPostChange(Vcb, Fcb, USN_REASON_BASIC_INFO_CHANGE);
+    }
+
+    ReleaseAttributeContext(DataContext);
+    ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+    ExReleaseResourceLite(&Fcb->MainResource);
+
+    return Status;
+}
+
+/**
+* @name NtfsSetZeroData
+* @implemented
+*
+* Handles FSCTL_SET_ZERO_DATA: fills a range of a file with zeroes. In a sparse stream,
+* the whole clusters of the range become a hole and are freed.
+*
+* @param Vcb
+* Points to the DEVICE_EXTENSION of the volume.
+*
+* @param Irp
+* Request holding a FILE_ZERO_DATA_INFORMATION.
+*
+* @return
+* STATUS_SUCCESS, STATUS_INVALID_PARAMETER for an invalid range, a directory or a volume,
+* STATUS_USER_MAPPED_FILE if the cached range can't be purged because the file is mapped.
+*
+* @remarks
+* The part of the range beyond the end of the file is ignored.
+*/
+NTSTATUS
+NtfsSetZeroData(PDEVICE_EXTENSION Vcb,
+                PIRP Irp)
+{
+    PIO_STACK_LOCATION Stack = IoGetCurrentIrpStackLocation(Irp);
+    PFILE_OBJECT FileObject = Stack->FileObject;
+    PNTFS_FCB Fcb = FileObject->FsContext;
+    ULONG BytesPerCluster = Vcb->NtfsInfo.BytesPerCluster;
+    FILE_ZERO_DATA_INFORMATION ZeroData;
+    PFILE_RECORD_HEADER FileRecord;
+    PNTFS_ATTR_CONTEXT DataContext;
+    ULONG AttrOffset;
+    LARGE_INTEGER Start, End;
+    ULONGLONG FileSize;
+    NTSTATUS Status;
+
+    if (Stack->Parameters.FileSystemControl.InputBufferLength < sizeof(FILE_ZERO_DATA_INFORMATION))
+        return STATUS_INVALID_PARAMETER;
+
+    ZeroData = *(PFILE_ZERO_DATA_INFORMATION)Irp->AssociatedIrp.SystemBuffer;
+    if (ZeroData.FileOffset.QuadPart < 0 ||
+        ZeroData.BeyondFinalZero.QuadPart < ZeroData.FileOffset.QuadPart)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (!NtfsGlobalData->EnableWriteSupport)
+    {
+        DPRINT1("NTFS write-support is EXPERIMENTAL and is disabled by default!\n");
+        return STATUS_ACCESS_DENIED;
+    }
+
+    if ((Fcb->Flags & FCB_IS_VOLUME) || NtfsFCBIsDirectory(Fcb))
+        return STATUS_INVALID_PARAMETER;
+
+    if (NtfsFCBIsCompressed(Fcb))
+    {
+        DPRINT1("FIXME: Compressed files are not supported yet!\n");
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    ExAcquireResourceExclusiveLite(&Fcb->MainResource, TRUE);
+
+    FileSize = Fcb->RFCB.FileSize.QuadPart;
+    Start.QuadPart = ZeroData.FileOffset.QuadPart;
+    End.QuadPart = min(ZeroData.BeyondFinalZero.QuadPart, FileSize);
+    if (Start.QuadPart >= End.QuadPart)
+    {
+        ExReleaseResourceLite(&Fcb->MainResource);
+        return STATUS_SUCCESS;
+    }
+
+    Status = NtfsSparseFindStream(Vcb, Fcb, &FileRecord, &DataContext, &AttrOffset);
+    if (!NT_SUCCESS(Status))
+    {
+        ExReleaseResourceLite(&Fcb->MainResource);
+        return Status;
+    }
+
+    if (DataContext->pRecord->IsNonResident &&
+        (DataContext->pRecord->Flags & ATTR_FLAG_SPARSE))
+    {
+        IO_STATUS_BLOCK IoStatus;
+        ULONGLONG FirstWholeVcn, EndWholeVcn;
+
+        // The disk is changed directly, so nothing of the range may stay in the cache
+        CcFlushCache(FileObject->SectionObjectPointer, NULL, 0, &IoStatus);
+        if (!CcPurgeCacheSection(FileObject->SectionObjectPointer, &Start, 0, FALSE))
+        {
+            DPRINT1("Couldn't purge the cache of %wS!\n", Fcb->ObjectName);
+            Status = STATUS_USER_MAPPED_FILE;
+        }
+        else
+        {
+            ExAcquireResourceExclusiveLite(&Fcb->PagingIoResource, TRUE);
+
+            // The last cluster of the file can be released even if the range ends inside it
+            FirstWholeVcn = ROUND_UP(Start.QuadPart, BytesPerCluster) / BytesPerCluster;
+            if (End.QuadPart == FileSize)
+                EndWholeVcn = ROUND_UP(End.QuadPart, BytesPerCluster) / BytesPerCluster;
+            else
+                EndWholeVcn = End.QuadPart / BytesPerCluster;
+
+            if (FirstWholeVcn < EndWholeVcn)
+            {
+                Status = NtfsZeroAttributeRange(Vcb,
+                                                DataContext,
+                                                Start.QuadPart,
+                                                FirstWholeVcn * BytesPerCluster - Start.QuadPart);
+
+                if (NT_SUCCESS(Status) && (ULONGLONG)End.QuadPart > EndWholeVcn * BytesPerCluster)
+                {
+                    Status = NtfsZeroAttributeRange(Vcb,
+                                                    DataContext,
+                                                    EndWholeVcn * BytesPerCluster,
+                                                    End.QuadPart - EndWholeVcn * BytesPerCluster);
+                }
+
+                if (NT_SUCCESS(Status))
+                {
+                    Status = NtfsDeallocateAttributeRange(Vcb,
+                                                          DataContext,
+                                                          AttrOffset,
+                                                          FileRecord,
+                                                          FirstWholeVcn,
+                                                          EndWholeVcn - FirstWholeVcn);
+                }
+            }
+            else
+            {
+                Status = NtfsZeroAttributeRange(Vcb,
+                                                DataContext,
+                                                Start.QuadPart,
+                                                End.QuadPart - Start.QuadPart);
+            }
+
+            ExReleaseResourceLite(&Fcb->PagingIoResource);
+        }
+    }
+    else
+    {
+        // Without holes, the range can only be overwritten, which is done through the cache like a write
+        _SEH2_TRY
+        {
+            if (FileObject->PrivateCacheMap == NULL)
+            {
+                CcInitializeCacheMap(FileObject,
+                                     (PCC_FILE_SIZES)(&Fcb->RFCB.AllocationSize),
+                                     FALSE,
+                                     &(NtfsGlobalData->CacheMgrCallbacks),
+                                     Fcb);
+            }
+
+            CcZeroData(FileObject, &Start, &End, TRUE);
+        }
+        _SEH2_EXCEPT(EXCEPTION_EXECUTE_HANDLER)
+        {
+            Status = _SEH2_GetExceptionCode();
+        }
+        _SEH2_END;
+    }
+
+    if (NT_SUCCESS(Status))
+        NtfsUsnPostChange(Vcb, Fcb, USN_REASON_DATA_OVERWRITE);
+
+    ReleaseAttributeContext(DataContext);
+    ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+    ExReleaseResourceLite(&Fcb->MainResource);
+
+    return Status;
+}
+
+/**
+* @name NtfsQueryAllocatedRanges
+* @implemented
+*
+* Handles FSCTL_QUERY_ALLOCATED_RANGES: returns the parts of a range of a file that
+* aren't in a hole.
+*
+* @param Vcb
+* Points to the DEVICE_EXTENSION of the volume.
+*
+* @param Irp
+* Request holding a FILE_ALLOCATED_RANGE_BUFFER, and receiving an array of them.
+*
+* @return
+* STATUS_SUCCESS, STATUS_BUFFER_OVERFLOW if there are more ranges than the output can hold,
+* STATUS_INVALID_PARAMETER for an invalid range or a volume.
+*
+* @remarks
+* Adjacent runs are returned as one range. A stream that isn't sparse is one range, up
+* to the end of the file.
+*/
+NTSTATUS
+NtfsQueryAllocatedRanges(PDEVICE_EXTENSION Vcb,
+                         PIRP Irp)
+{
+    PIO_STACK_LOCATION Stack = IoGetCurrentIrpStackLocation(Irp);
+    PNTFS_FCB Fcb = Stack->FileObject->FsContext;
+    ULONG BytesPerCluster = Vcb->NtfsInfo.BytesPerCluster;
+    FILE_ALLOCATED_RANGE_BUFFER Query;
+    PFILE_ALLOCATED_RANGE_BUFFER Ranges;
+    PVOID OutputBuffer;
+    ULONG MaxRanges;
+    ULONG RangeCount = 0;
+    PFILE_RECORD_HEADER FileRecord;
+    PNTFS_ATTR_CONTEXT DataContext;
+    ULONG AttrOffset;
+    ULONGLONG Start, End;
+    ULONGLONG Vcn;
+    ULONGLONG RunClusters;
+    LONGLONG Lcn;
+    NTSTATUS Status;
+
+    Status = NtfsCaptureFsctlBuffers(Irp, &Query, sizeof(Query), &OutputBuffer, sizeof(FILE_ALLOCATED_RANGE_BUFFER));
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    if (Query.FileOffset.QuadPart < 0 ||
+        Query.Length.QuadPart < 0 ||
+        Query.FileOffset.QuadPart + Query.Length.QuadPart < Query.FileOffset.QuadPart)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if ((Fcb->Flags & FCB_IS_VOLUME) || NtfsFCBIsDirectory(Fcb))
+        return STATUS_INVALID_PARAMETER;
+
+    MaxRanges = min(Stack->Parameters.FileSystemControl.OutputBufferLength, NTFS_ALLOCATED_RANGES_OUTPUT_MAX) /
+                sizeof(FILE_ALLOCATED_RANGE_BUFFER);
+
+    Ranges = ExAllocatePoolWithTag(PagedPool, MaxRanges * sizeof(FILE_ALLOCATED_RANGE_BUFFER), TAG_NTFS);
+    if (Ranges == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    ExAcquireResourceSharedLite(&Fcb->MainResource, TRUE);
+
+    Start = Query.FileOffset.QuadPart;
+    End = min(Query.FileOffset.QuadPart + Query.Length.QuadPart, Fcb->RFCB.FileSize.QuadPart);
+
+    if (Start < End)
+    {
+        Status = NtfsSparseFindStream(Vcb, Fcb, &FileRecord, &DataContext, &AttrOffset);
+        if (NT_SUCCESS(Status))
+        {
+            if (!DataContext->pRecord->IsNonResident ||
+                !(DataContext->pRecord->Flags & ATTR_FLAG_SPARSE))
+            {
+                Ranges[0].FileOffset.QuadPart = Start;
+                Ranges[0].Length.QuadPart = End - Start;
+                RangeCount = 1;
+            }
+            else
+            {
+                for (Vcn = Start / BytesPerCluster; Vcn * BytesPerCluster < End; Vcn += RunClusters)
+                {
+                    ULONGLONG RangeStart, RangeEnd;
+
+                    if (!NtfsLookupAttributeRun(DataContext, Vcn, &Lcn, &RunClusters))
+                        break;
+
+                    if (Lcn == -1)
+                        continue;
+
+                    RangeStart = max(Vcn * BytesPerCluster, Start);
+                    RangeEnd = min((Vcn + RunClusters) * BytesPerCluster, End);
+
+                    // Runs that follow each other are one range for the caller
+                    if (RangeCount != 0 &&
+                        (ULONGLONG)(Ranges[RangeCount - 1].FileOffset.QuadPart + Ranges[RangeCount - 1].Length.QuadPart) == RangeStart)
+                    {
+                        Ranges[RangeCount - 1].Length.QuadPart = RangeEnd - Ranges[RangeCount - 1].FileOffset.QuadPart;
+                        continue;
+                    }
+
+                    if (RangeCount == MaxRanges)
+                    {
+                        Status = STATUS_BUFFER_OVERFLOW;
+                        break;
+                    }
+
+                    Ranges[RangeCount].FileOffset.QuadPart = RangeStart;
+                    Ranges[RangeCount].Length.QuadPart = RangeEnd - RangeStart;
+                    RangeCount++;
+                }
+            }
+
+            ReleaseAttributeContext(DataContext);
+            ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+        }
+    }
+
+    ExReleaseResourceLite(&Fcb->MainResource);
+
+    if (NT_SUCCESS(Status) || Status == STATUS_BUFFER_OVERFLOW)
+    {
+        NTSTATUS ReturnStatus;
+
+        ReturnStatus = NtfsReturnFsctlOutput(Irp, OutputBuffer, Ranges, RangeCount * sizeof(FILE_ALLOCATED_RANGE_BUFFER));
+        if (!NT_SUCCESS(ReturnStatus))
+            Status = ReturnStatus;
+    }
+
+    ExFreePoolWithTag(Ranges, TAG_NTFS);
+
+    return Status;
+}
+
+/* EOF */
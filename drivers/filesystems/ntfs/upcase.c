@@ -0,0 +1,292 @@
+/*
+ * PROJECT:     ReactOS NTFS driver
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     $UpCase table and file name collation
+ * COPYRIGHT:   Copyright 2026 ReactOS Team
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include "ntfs.h"
+
+#if defined(_M_AMD64) || defined(__x86_64__)
+#include <emmintrin.h>
+#define NTFS_COLLATE_SSE2
+#endif
+
+#define NDEBUG
+#include <debug.h>
+
+/* FUNCTIONS ****************************************************************/
+
+FORCEINLINE
+WCHAR
+NtfsUpcaseChar(PDEVICE_EXTENSION Vcb,
+               WCHAR Char)
+{
+    if (Vcb->UpcaseTable != NULL)
+        return Vcb->UpcaseTable[Char];
+
+    return RtlUpcaseUnicodeChar(Char);
+}
+
+/* Fills the table with the system's upcase rules, for volumes whose $UpCase can't be used */
+static
+VOID
+NtfsBuildSystemUpcaseTable(PWCHAR UpcaseTable)
+{
+    ULONG Char;
+
+    for (Char = 0; Char < NTFS_UPCASE_TABLE_CHARS; Char++)
+    {
+        UpcaseTable[Char] = RtlUpcaseUnicodeChar((WCHAR)Char);
+    }
+}
+
+/**
+* @name NtfsInitializeUpcaseTable
+* @implemented
+*
+* Reads the $UpCase file of a volume, which every case-insensitive name comparison on the
+* volume then uses.
+*
+* @param DeviceExt
+* Points to the DEVICE_EXTENSION of the volume being mounted.
+*
+* @remarks
+* Never fails the mount: if $UpCase can't be read, the system's upcase rules are used instead,
+* and if the table can't even be allocated, names are upcased with RtlUpcaseUnicodeChar().
+*/
+VOID
+NtfsInitializeUpcaseTable(PDEVICE_EXTENSION DeviceExt)
+{
+    PFILE_RECORD_HEADER UpcaseRecord;
+    PNTFS_ATTR_CONTEXT DataContext;
+    PWCHAR UpcaseTable;
+    ULONG Char;
+    NTSTATUS Status;
+
+    DeviceExt->UpcaseTable = NULL;
+    DeviceExt->UpcaseAsciiIsStandard = FALSE;
+
+    UpcaseTable = ExAllocatePoolWithTag(PagedPool, NTFS_UPCASE_TABLE_CHARS * sizeof(WCHAR), TAG_UPCASE);
+    if (UpcaseTable == NULL)
+    {
+        DPRINT1("Couldn't allocate the upcase table, using the system's upcase rules\n");
+        return;
+    }
+
+    UpcaseRecord = ExAllocateFromNPagedLookasideList(&DeviceExt->FileRecLookasideList);
+    if (UpcaseRecord == NULL)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+    else
+    {
+        Status = ReadFileRecord(DeviceExt, NTFS_FILE_UPCASE, UpcaseRecord);
+        if (NT_SUCCESS(Status))
+        {
+            Status = FindAttribute(DeviceExt, UpcaseRecord, AttributeData, L"", 0, &DataContext, NULL);
+        }
+
+        if (NT_SUCCESS(Status))
+        {
+            if (AttributeDataLength(DataContext->pRecord) != NTFS_UPCASE_TABLE_CHARS * sizeof(WCHAR))
+            {
+                DPRINT1("$UpCase has an unexpected size: %I64u\n", AttributeDataLength(DataContext->pRecord));
+                Status = STATUS_DISK_CORRUPT_ERROR;
+            }
+            else if (ReadAttribute(DeviceExt,
+                                   DataContext,
+                                   0,
+                                   (PCHAR)UpcaseTable,
+                                   NTFS_UPCASE_TABLE_CHARS * sizeof(WCHAR)) != NTFS_UPCASE_TABLE_CHARS * sizeof(WCHAR))
+            {
+                Status = STATUS_UNSUCCESSFUL;
+            }
+
+            ReleaseAttributeContext(DataContext);
+        }
+
+        ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, UpcaseRecord);
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Couldn't read $UpCase (Status %lx), using the system's upcase rules\n", Status);
+        NtfsBuildSystemUpcaseTable(UpcaseTable);
+    }
+
+    // The vectorized compare upcases 'a' to 'z' itself, and leaves the rest of the table alone
+    DeviceExt->UpcaseAsciiIsStandard = TRUE;
+    for (Char = 0; Char < 0x80; Char++)
+    {
+        WCHAR Expected = (Char >= 'a' && Char <= 'z') ? (WCHAR)(Char - 'a' + 'A') : (WCHAR)Char;
+
+        if (UpcaseTable[Char] != Expected)
+        {
+            DPRINT1("$UpCase doesn't map U+%04lx the usual way\n", Char);
+            DeviceExt->UpcaseAsciiIsStandard = FALSE;
+            break;
+        }
+    }
+
+    DeviceExt->UpcaseTable = UpcaseTable;
+}
+
+VOID
+NtfsUninitializeUpcaseTable(PDEVICE_EXTENSION DeviceExt)
+{
+    if (DeviceExt->UpcaseTable != NULL)
+    {
+        ExFreePoolWithTag(DeviceExt->UpcaseTable, TAG_UPCASE);
+        DeviceExt->UpcaseTable = NULL;
+    }
+}
+
+/* Upcases Length characters of Source into Destination with the volume's rules; they may be the same buffer */
+VOID
+NtfsUpcaseName(PDEVICE_EXTENSION Vcb,
+               PWCHAR Destination,
+               PCWSTR Source,
+               ULONG Length)
+{
+    ULONG i;
+
+    for (i = 0; i < Length; i++)
+    {
+        Destination[i] = NtfsUpcaseChar(Vcb, Source[i]);
+    }
+}
+
+static
+LONG
+NtfsCompareUpcasedChars(PDEVICE_EXTENSION Vcb,
+                        PCWSTR Name1,
+                        PCWSTR Name2,
+                        ULONG Length)
+{
+    WCHAR Char1, Char2;
+    ULONG i;
+
+    for (i = 0; i < Length; i++)
+    {
+        Char1 = NtfsUpcaseChar(Vcb, Name1[i]);
+        Char2 = NtfsUpcaseChar(Vcb, Name2[i]);
+        if (Char1 != Char2)
+            return (LONG)Char1 - (LONG)Char2;
+    }
+
+    return 0;
+}
+
+/* Compares Length characters of two names as if both were upcased */
+static
+LONG
+NtfsCompareUpcased(PDEVICE_EXTENSION Vcb,
+                   PCWSTR Name1,
+                   PCWSTR Name2,
+                   ULONG Length)
+{
+    ULONG i = 0;
+
+#ifdef NTFS_COLLATE_SSE2
+    /* Most names are ASCII: upcase and compare them eight characters at a time */
+    if (Vcb->UpcaseAsciiIsStandard)
+    {
+        LONG Comparison;
+        const __m128i NonAscii = _mm_set1_epi16((SHORT)0xFF80);
+        const __m128i BeforeLowerA = _mm_set1_epi16('a' - 1);
+        const __m128i AfterLowerZ = _mm_set1_epi16('z' + 1);
+        const __m128i CaseBit = _mm_set1_epi16(0x20);
+        const __m128i Zero = _mm_setzero_si128();
+        __m128i Chars1, Chars2, Lower;
+
+        for (; i + 8 <= Length; i += 8)
+        {
+            Chars1 = _mm_loadu_si128((const __m128i *)&Name1[i]);
+            Chars2 = _mm_loadu_si128((const __m128i *)&Name2[i]);
+
+            // Blocks with a character above U+007F, or a difference, are left to the table
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(Chars1, Chars2), NonAscii), Zero)) == 0xFFFF)
+            {
+                // Signed compares are fine, every character is below 0x80
+                Lower = _mm_and_si128(_mm_cmpgt_epi16(Chars1, BeforeLowerA), _mm_cmplt_epi16(Chars1, AfterLowerZ));
+                Chars1 = _mm_sub_epi16(Chars1, _mm_and_si128(Lower, CaseBit));
+                Lower = _mm_and_si128(_mm_cmpgt_epi16(Chars2, BeforeLowerA), _mm_cmplt_epi16(Chars2, AfterLowerZ));
+                Chars2 = _mm_sub_epi16(Chars2, _mm_and_si128(Lower, CaseBit));
+
+                if (_mm_movemask_epi8(_mm_cmpeq_epi16(Chars1, Chars2)) == 0xFFFF)
+                    continue;
+            }
+
+            Comparison = NtfsCompareUpcasedChars(Vcb, &Name1[i], &Name2[i], 8);
+            if (Comparison != 0)
+                return Comparison;
+        }
+    }
+#endif
+
+    return NtfsCompareUpcasedChars(Vcb, &Name1[i], &Name2[i], Length - i);
+}
+
+/**
+* @name NtfsCollateFileNames
+* @implemented
+*
+* Compares two file names in the order of the COLLATION_FILE_NAME rule, which is the order
+* of $I30 indexes.
+*
+* @param Vcb
+* Points to the DEVICE_EXTENSION of the volume holding the names; its $UpCase table is used.
+*
+* @param Name1
+* @param Length1
+* First name and its length, in characters.
+*
+* @param Name2
+* @param Length2
+* Second name and its length, in characters.
+*
+* @param CaseSensitive
+* If TRUE, names which only differ by case are ordered by their character values
+* instead of being equal. Used for files created with FILE_FLAG_POSIX_SEMANTICS.
+*
+* @return
+* A negative value if Name1 sorts first, 0 if the names are equal, a positive value otherwise.
+*
+* @remarks
+* Names are ordered by their upcased characters, and a name sorts before the longer names
+* it's a prefix of.
+*/
+LONG
+NtfsCollateFileNames(PDEVICE_EXTENSION Vcb,
+                     PCWSTR Name1,
+                     ULONG Length1,
+                     PCWSTR Name2,
+                     ULONG Length2,
+                     BOOLEAN CaseSensitive)
+{
+    LONG Comparison;
+    ULONG i;
+
+    Comparison = NtfsCompareUpcased(Vcb, Name1, Name2, min(Length1, Length2));
+    if (Comparison != 0)
+        return Comparison;
+
+    if (Length1 != Length2)
+        return (Length1 < Length2) ? -1 : 1;
+
+    if (CaseSensitive)
+    {
+        for (i = 0; i < Length1; i++)
+        {
+            if (Name1[i] != Name2[i])
+                return (LONG)Name1[i] - (LONG)Name2[i];
+        }
+    }
+
+    return 0;
+}
+
+/* EOF */
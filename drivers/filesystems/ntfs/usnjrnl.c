@@ -0,0 +1,1067 @@
+/*
+ * PROJECT:     ReactOS NTFS driver
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Change journal kept in $Extend\$UsnJrnl
+ * COPYRIGHT:   Copyright 2026 ReactOS Team
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include "ntfs.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* GLOBALS *****************************************************************/
+
+/* Used when FSCTL_CREATE_USN_JOURNAL leaves them to the file system */
+#define NTFS_USN_DEFAULT_MAXIMUM_SIZE       (32 * 1024 * 1024)
+#define NTFS_USN_DEFAULT_ALLOCATION_DELTA   (4 * 1024 * 1024)
+
+/* Records buffered before they're written to $J */
+#define NTFS_USN_BUFFER_SIZE                0x10000
+
+/* Largest reply of FSCTL_READ_USN_JOURNAL and FSCTL_ENUM_USN_DATA */
+#define NTFS_USN_OUTPUT_MAX                 0x10000
+
+#define NTFS_USN_MAX_USN                    0x7FFFFFFFFFFF0000LL
+
+/* Value of the $Max stream */
+typedef struct
+{
+    ULONGLONG MaximumSize;
+    ULONGLONG AllocationDelta;
+    ULONGLONG UsnJournalID;
+    USN LowestValidUsn;
+} NTFS_USN_MAX, *PNTFS_USN_MAX;
+
+static UNICODE_STRING UsnJrnlName = RTL_CONSTANT_STRING(L"$UsnJrnl");
+
+/* FUNCTIONS ****************************************************************/
+
+/* Returns the $STANDARD_INFORMATION of a base file record if it has room for a USN, it's always the first attribute */
+static
+PNTFS_STANDARD_INFORMATION_V3
+NtfsUsnGetStandardInformation(PFILE_RECORD_HEADER FileRecord)
+{
+    PNTFS_ATTR_RECORD Attribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)FileRecord + FileRecord->AttributeOffset);
+
+    if (Attribute->Type != AttributeStandardInformation ||
+        Attribute->IsNonResident ||
+        Attribute->Resident.ValueLength < sizeof(NTFS_STANDARD_INFORMATION_V3))
+    {
+        return NULL;
+    }
+
+    return (PNTFS_STANDARD_INFORMATION_V3)((ULONG_PTR)Attribute + Attribute->Resident.ValueOffset);
+}
+
+static
+NTSTATUS
+NtfsUsnFindJournalRecord(PDEVICE_EXTENSION Vcb,
+                         PULONGLONG MftIndex)
+{
+    ULONG FirstEntry = 0;
+
+    return NtfsFindMftRecord(Vcb, NTFS_FILE_EXTEND, &UsnJrnlName, &FirstEntry, FALSE, FALSE, MftIndex);
+}
+
+/* Writes the journal's limits and identity to $Max. The journal lock must be held exclusive. */
+static
+NTSTATUS
+NtfsUsnWriteMax(PDEVICE_EXTENSION Vcb,
+                PFILE_RECORD_HEADER FileRecord)
+{
+    PNTFS_USN_JOURNAL Journal = &Vcb->UsnJournal;
+    PNTFS_ATTR_CONTEXT MaxContext;
+    NTFS_USN_MAX Max;
+    ULONG LengthWritten;
+    NTSTATUS Status;
+
+    Status = FindAttribute(Vcb, FileRecord, AttributeData, L"$Max", 4, &MaxContext, NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("$UsnJrnl has no $Max stream!\n");
+        return Status;
+    }
+
+    Max.MaximumSize = Journal->MaximumSize;
+    Max.AllocationDelta = Journal->AllocationDelta;
+    Max.UsnJournalID = Journal->UsnJournalID;
+    Max.LowestValidUsn = Journal->LowestValidUsn;
+
+    if (MaxContext->pRecord->IsNonResident ||
+        MaxContext->pRecord->Resident.ValueLength < sizeof(NTFS_USN_MAX))
+    {
+        DPRINT1("$Max has an unexpected layout!\n");
+        Status = STATUS_DISK_CORRUPT_ERROR;
+    }
+    else
+    {
+        Status = WriteAttribute(Vcb, MaxContext, 0, (PUCHAR)&Max, sizeof(Max), &LengthWritten, FileRecord);
+    }
+
+    ReleaseAttributeContext(MaxContext);
+
+    return Status;
+}
+
+/*
+ * Drops the oldest records once $J holds more than its maximum size and allocation delta,
+ * like Windows does: the start of $J becomes a hole, so USNs keep growing and readers can
+ * tell the records they missed from STATUS_JOURNAL_ENTRY_DELETED.
+ * The journal lock must be held exclusive.
+ */
+static
+NTSTATUS
+NtfsUsnTrimJournal(PDEVICE_EXTENSION Vcb,
+                   PFILE_RECORD_HEADER FileRecord,
+                   PNTFS_ATTR_CONTEXT DataContext,
+                   ULONG AttrOffset)
+{
+    PNTFS_USN_JOURNAL Journal = &Vcb->UsnJournal;
+    ULONG BytesPerCluster = Vcb->NtfsInfo.BytesPerCluster;
+    PSTANDARD_INFORMATION StandardInfo;
+    USN LowestValidUsn;
+    NTSTATUS Status;
+
+    // Records don't cross a page, so the first one left starts where the hole ends
+    LowestValidUsn = ROUND_DOWN(Journal->NextUsn - Journal->MaximumSize, max(BytesPerCluster, USN_PAGE_SIZE));
+    if (LowestValidUsn <= Journal->LowestValidUsn)
+        return STATUS_SUCCESS;
+
+    // Journals this driver created before are made sparse now
+    if (!(DataContext->pRecord->Flags & ATTR_FLAG_SPARSE))
+    {
+        Status = NtfsMakeAttributeSparse(Vcb, DataContext, AttrOffset, FileRecord);
+        if (!NT_SUCCESS(Status))
+            return Status;
+
+        StandardInfo = GetStandardInformationFromRecord(Vcb, FileRecord);
+        if (StandardInfo != NULL)
+            StandardInfo->FileAttribute |= NTFS_FILE_TYPE_SPARSE;
+
+        Status = UpdateFileRecord(Vcb, Journal->MftIndex, FileRecord);
+        if (!NT_SUCCESS(Status))
+            return Status;
+    }
+
+    DPRINT("Dropping the records of $UsnJrnl before USN %I64u\n", LowestValidUsn);
+
+    // Even if only part of the range was freed, the records in it are gone
+    Status = NtfsDeallocateAttributeRange(Vcb,
+                                          DataContext,
+                                          AttrOffset,
+                                          FileRecord,
+                                          Journal->LowestValidUsn / BytesPerCluster,
+                                          (LowestValidUsn - ROUND_DOWN(Journal->LowestValidUsn, BytesPerCluster)) / BytesPerCluster);
+    Journal->LowestValidUsn = LowestValidUsn;
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    return NtfsUsnWriteMax(Vcb, FileRecord);
+}
+
+/* Writes the buffered records to $J. The journal lock must be held exclusive. */
+static
+NTSTATUS
+NtfsUsnFlushBuffer(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_USN_JOURNAL Journal = &Vcb->UsnJournal;
+    PFILE_RECORD_HEADER FileRecord;
+    PNTFS_ATTR_CONTEXT DataContext;
+    ULONG AttrOffset;
+    LARGE_INTEGER DataSize;
+    ULONG LengthWritten;
+    NTSTATUS Status;
+
+    if (!Journal->Active || Journal->NextUsn == Journal->WrittenUsn)
+        return STATUS_SUCCESS;
+
+    FileRecord = ExAllocateFromNPagedLookasideList(&Vcb->FileRecLookasideList);
+    if (FileRecord == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    Status = ReadFileRecord(Vcb, Journal->MftIndex, FileRecord);
+    if (NT_SUCCESS(Status))
+        Status = FindAttribute(Vcb, FileRecord, AttributeData, L"$J", 2, &DataContext, &AttrOffset);
+
+    if (NT_SUCCESS(Status))
+    {
+        // $J grows as records are written, its clusters are allocated after the last ones
+        if (AttributeDataLength(DataContext->pRecord) < (ULONGLONG)Journal->NextUsn)
+        {
+            DataSize.QuadPart = Journal->NextUsn;
+            Status = SetNonResidentAttributeDataLength(Vcb, DataContext, AttrOffset, FileRecord, &DataSize);
+            if (NT_SUCCESS(Status))
+                Status = UpdateFileRecord(Vcb, Journal->MftIndex, FileRecord);
+        }
+
+        // A sparse $J grows by a hole
+        if (NT_SUCCESS(Status))
+        {
+            Status = NtfsAllocateAttributeRange(Vcb,
+                                                DataContext,
+                                                AttrOffset,
+                                                FileRecord,
+                                                Journal->WrittenUsn,
+                                                (ULONG)(Journal->NextUsn - Journal->WrittenUsn));
+        }
+
+        if (NT_SUCCESS(Status))
+        {
+            Status = WriteAttribute(Vcb,
+                                    DataContext,
+                                    Journal->WrittenUsn,
+                                    Journal->Buffer,
+                                    (ULONG)(Journal->NextUsn - Journal->WrittenUsn),
+                                    &LengthWritten,
+                                    FileRecord);
+        }
+
+        if (NT_SUCCESS(Status))
+        {
+            Journal->WrittenUsn = Journal->NextUsn;
+            Journal->Flushes++;
+
+            if ((ULONGLONG)(Journal->NextUsn - Journal->LowestValidUsn) > Journal->MaximumSize + Journal->AllocationDelta)
+                Status = NtfsUsnTrimJournal(Vcb, FileRecord, DataContext, AttrOffset);
+        }
+
+        ReleaseAttributeContext(DataContext);
+    }
+
+    ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+
+    if (!NT_SUCCESS(Status))
+    {
+        // Records can't be dropped silently: readers would miss changes. Stop journaling instead.
+        DPRINT1("Couldn't write $UsnJrnl (Status %lx), the change journal is disabled\n", Status);
+        Journal->Active = FALSE;
+    }
+
+    return Status;
+}
+
+/**
+* @name NtfsInitializeUsnJournal
+* @implemented
+*
+* Looks for the change journal of a volume being mounted, and activates it if this driver
+* can maintain it.
+*
+* @param Vcb
+* Points to the DEVICE_EXTENSION of the volume being mounted.
+*
+* @remarks
+* Never fails the mount. The journal is left inactive if write support is disabled, if the
+* volume doesn't have one, or if its $J is compressed; FSCTL_QUERY_USN_JOURNAL then returns
+* STATUS_JOURNAL_NOT_ACTIVE. The sparse $J of Windows is maintained the way Windows does.
+*/
+VOID
+NtfsInitializeUsnJournal(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_USN_JOURNAL Journal = &Vcb->UsnJournal;
+    PFILE_RECORD_HEADER FileRecord;
+    PNTFS_ATTR_CONTEXT DataContext;
+    NTFS_USN_MAX Max;
+    NTSTATUS Status;
+
+    RtlZeroMemory(Journal, sizeof(NTFS_USN_JOURNAL));
+    ExInitializeResourceLite(&Journal->Resource);
+
+    if (!NtfsGlobalData->EnableWriteSupport || Vcb->NtfsInfo.MajorVersion < 3)
+        return;
+
+    Status = NtfsUsnFindJournalRecord(Vcb, &Journal->MftIndex);
+    if (!NT_SUCCESS(Status))
+        return;
+
+    FileRecord = ExAllocateFromNPagedLookasideList(&Vcb->FileRecLookasideList);
+    if (FileRecord == NULL)
+        return;
+
+    Status = ReadFileRecord(Vcb, Journal->MftIndex, FileRecord);
+    if (NT_SUCCESS(Status))
+        Status = FindAttribute(Vcb, FileRecord, AttributeData, L"$Max", 4, &DataContext, NULL);
+
+    if (NT_SUCCESS(Status))
+    {
+        if (ReadAttribute(Vcb, DataContext, 0, (PCHAR)&Max, sizeof(Max)) != sizeof(Max))
+            Status = STATUS_DISK_CORRUPT_ERROR;
+
+        ReleaseAttributeContext(DataContext);
+    }
+
+    if (NT_SUCCESS(Status))
+        Status = FindAttribute(Vcb, FileRecord, AttributeData, L"$J", 2, &DataContext, NULL);
+
+    if (NT_SUCCESS(Status))
+    {
+        if (!DataContext->pRecord->IsNonResident ||
+            (DataContext->pRecord->Flags & ATTR_FLAG_COMPRESSED))
+        {
+            DPRINT1("$UsnJrnl:$J is resident or compressed, the change journal stays inactive\n");
+            Status = STATUS_NOT_IMPLEMENTED;
+        }
+        else
+        {
+            Journal->NextUsn = AttributeDataLength(DataContext->pRecord);
+            Journal->WrittenUsn = Journal->NextUsn;
+        }
+
+        ReleaseAttributeContext(DataContext);
+    }
+
+    ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Couldn't open $UsnJrnl (Status %lx)\n", Status);
+        return;
+    }
+
+    Journal->Buffer = ExAllocatePoolWithTag(NonPagedPool, NTFS_USN_BUFFER_SIZE, TAG_USN);
+    if (Journal->Buffer == NULL)
+        return;
+
+    Journal->MaximumSize = Max.MaximumSize;
+    Journal->AllocationDelta = Max.AllocationDelta;
+    Journal->UsnJournalID = Max.UsnJournalID;
+    Journal->LowestValidUsn = Max.LowestValidUsn;
+    Journal->Active = TRUE;
+}
+
+VOID
+NtfsUninitializeUsnJournal(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_USN_JOURNAL Journal = &Vcb->UsnJournal;
+
+    Journal->Active = FALSE;
+
+    if (Journal->Buffer != NULL)
+    {
+        ExFreePoolWithTag(Journal->Buffer, TAG_USN);
+        Journal->Buffer = NULL;
+    }
+
+    ExDeleteResourceLite(&Journal->Resource);
+}
+
+/**
+* @name NtfsFlushUsnJournal
+* @implemented
+*
+* Writes the change journal records buffered by the request that just ended to $J.
+*
+* @param Vcb
+* Points to the DEVICE_EXTENSION of the volume.
+*
+* @return
+* STATUS_SUCCESS, or the error that disabled the journal.
+*/
+NTSTATUS
+NtfsFlushUsnJournal(PDEVICE_EXTENSION Vcb)
+{
+    NTSTATUS Status;
+
+    ExAcquireResourceExclusiveLite(&Vcb->UsnJournal.Resource, TRUE);
+    Status = NtfsUsnFlushBuffer(Vcb);
+    ExReleaseResourceLite(&Vcb->UsnJournal.Resource);
+
+    return Status;
+}
+
+/* Appends a record for a file to the journal. The journal lock must be held exclusive. */
+static
+VOID
+NtfsUsnWriteRecord(PDEVICE_EXTENSION Vcb,
+                   PNTFS_FCB Fcb,
+                   ULONG Reason)
+{
+    PNTFS_USN_JOURNAL Journal = &Vcb->UsnJournal;
+    PFILE_RECORD_HEADER FileRecord;
+    PNTFS_STANDARD_INFORMATION_V3 StdInfo;
+    PUSN_RECORD UsnRecord;
+    LARGE_INTEGER SystemTime;
+    ULONG NameLength;
+    ULONG RecordLength;
+    ULONG PageLeft;
+    NTSTATUS Status;
+
+    NameLength = (ULONG)wcslen(Fcb->ObjectName) * sizeof(WCHAR);
+    RecordLength = ALIGN_UP_BY(FIELD_OFFSET(USN_RECORD, FileName) + NameLength, sizeof(ULONGLONG));
+
+    // Make room for the record, and for the padding before it
+    if ((ULONG)(Journal->NextUsn - Journal->WrittenUsn) + USN_PAGE_SIZE + RecordLength > NTFS_USN_BUFFER_SIZE)
+    {
+        if (!NT_SUCCESS(NtfsUsnFlushBuffer(Vcb)))
+            return;
+    }
+
+    FileRecord = ExAllocateFromNPagedLookasideList(&Vcb->FileRecLookasideList);
+    if (FileRecord == NULL)
+        return;
+
+    Status = ReadFileRecord(Vcb, Fcb->MFTIndex, FileRecord);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Couldn't read file record %I64u for the change journal\n", Fcb->MFTIndex);
+        ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+        return;
+    }
+
+    // Records never cross a page of $J, readers skip the zeroes at the end of a page
+    PageLeft = USN_PAGE_SIZE - (ULONG)(Journal->NextUsn % USN_PAGE_SIZE);
+    if (RecordLength > PageLeft)
+    {
+        RtlZeroMemory(Journal->Buffer + (Journal->NextUsn - Journal->WrittenUsn), PageLeft);
+        Journal->NextUsn += PageLeft;
+    }
+
+    UsnRecord = (PUSN_RECORD)(Journal->Buffer + (Journal->NextUsn - Journal->WrittenUsn));
+    RtlZeroMemory(UsnRecord, RecordLength);
+
+    KeQuerySystemTime(&SystemTime);
+
+    UsnRecord->RecordLength = RecordLength;
+    UsnRecord->MajorVersion = 2;
+    UsnRecord->MinorVersion = 0;
+    UsnRecord->FileReferenceNumber = Fcb->MFTIndex | ((ULONGLONG)FileRecord->SequenceNumber << 48);
+    UsnRecord->ParentFileReferenceNumber = Fcb->Entry.DirectoryFileReferenceNumber;
+    UsnRecord->Usn = Journal->NextUsn;
+    UsnRecord->TimeStamp = SystemTime;
+    UsnRecord->Reason = Reason;
+    NtfsFileFlagsToAttributes(Fcb->Entry.FileAttributes, &UsnRecord->FileAttributes);
+    UsnRecord->FileNameLength = (USHORT)NameLength;
+    UsnRecord->FileNameOffset = FIELD_OFFSET(USN_RECORD, FileName);
+    RtlCopyMemory(UsnRecord->FileName, Fcb->ObjectName, NameLength);
+
+    // The file's last USN, which FSCTL_ENUM_USN_DATA returns
+    StdInfo = NtfsUsnGetStandardInformation(FileRecord);
+    if (StdInfo != NULL)
+    {
+        StdInfo->Usn = Journal->NextUsn;
+        UpdateFileRecord(Vcb, Fcb->MFTIndex, FileRecord);
+    }
+
+    Journal->NextUsn += RecordLength;
+    Journal->Records++;
+
+    ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+}
+
+/* Whether the change journal follows the changes of a file */
+static
+BOOLEAN
+NtfsUsnIsJournaled(PDEVICE_EXTENSION Vcb,
+                   PNTFS_FCB Fcb)
+{
+    return (Vcb->UsnJournal.Active &&
+            !(Fcb->Flags & (FCB_IS_VOLUME | FCB_IS_VOLUME_STREAM)) &&
+            Fcb->MFTIndex >= NTFS_FILE_FIRST_USER_FILE &&
+            Fcb->MFTIndex != Vcb->UsnJournal.MftIndex);
+}
+
+/* Changes of named streams have reasons of their own */
+static
+ULONG
+NtfsUsnStreamReason(PNTFS_FCB Fcb,
+                    ULONG Reason)
+{
+    const ULONG DataReasons = USN_REASON_DATA_OVERWRITE | USN_REASON_DATA_EXTEND | USN_REASON_DATA_TRUNCATION;
+
+    if (Fcb->Stream[0] != UNICODE_NULL)
+        Reason = (Reason & ~DataReasons) | ((Reason & DataReasons) << 4);
+
+    return Reason;
+}
+
+/**
+* @name NtfsUsnPostChange
+* @implemented
+*
+* Records a change of a file in the change journal.
+*
+* @param Vcb
+* Points to the DEVICE_EXTENSION of the volume holding the file.
+*
+* @param Fcb
+* File that changed.
+*
+* @param Reason
+* USN_REASON_* flags of the change. The DATA_* reasons are turned into NAMED_DATA_* ones
+* for named streams.
+*
+* @remarks
+* Like on Windows, a file gets a record the first time each reason shows up while it's
+* open, each record carrying all the reasons seen so far; further writes cost nothing.
+* The records are written to $J at the end of the request, see NtfsFlushUsnJournal().
+*/
+VOID
+NtfsUsnPostChange(PDEVICE_EXTENSION Vcb,
+                  PNTFS_FCB Fcb,
+                  ULONG Reason)
+{
+    if (!NtfsUsnIsJournaled(Vcb, Fcb))
+        return;
+
+    Reason = NtfsUsnStreamReason(Fcb, Reason);
+    if ((Fcb->UsnReasons & Reason) == Reason)
+        return;
+
+    ExAcquireResourceExclusiveLite(&Vcb->UsnJournal.Resource, TRUE);
+
+    if (Vcb->UsnJournal.Active && (Fcb->UsnReasons & Reason) != Reason)
+    {
+        Fcb->UsnReasons |= Reason;
+        NtfsUsnWriteRecord(Vcb, Fcb, Fcb->UsnReasons);
+    }
+
+    ExReleaseResourceLite(&Vcb->UsnJournal.Resource);
+}
+
+/**
+* @name NtfsUsnPostClose
+* @implemented
+*
+* Writes the USN_REASON_CLOSE record of a file whose last handle is being closed, if it
+* changed while it was open.
+*
+* @param Vcb
+* Points to the DEVICE_EXTENSION of the volume holding the file.
+*
+* @param Fcb
+* File being closed. Its reasons start over for the next open.
+*/
+VOID
+NtfsUsnPostClose(PDEVICE_EXTENSION Vcb,
+                 PNTFS_FCB Fcb)
+{
+    if (Fcb->UsnReasons == 0)
+        return;
+
+    ExAcquireResourceExclusiveLite(&Vcb->UsnJournal.Resource, TRUE);
+
+    if (NtfsUsnIsJournaled(Vcb, Fcb))
+        NtfsUsnWriteRecord(Vcb, Fcb, Fcb->UsnReasons | USN_REASON_CLOSE);
+
+    Fcb->UsnReasons = 0;
+
+    ExReleaseResourceLite(&Vcb->UsnJournal.Resource);
+}
+
+/* Whether a change would add nothing to the journal; fast I/O only proceeds then, as it can't flush it */
+BOOLEAN
+NtfsUsnIsChangePosted(PDEVICE_EXTENSION Vcb,
+                      PNTFS_FCB Fcb,
+                      ULONG Reason)
+{
+    if (!NtfsUsnIsJournaled(Vcb, Fcb))
+        return TRUE;
+
+    Reason = NtfsUsnStreamReason(Fcb, Reason);
+
+    return ((Fcb->UsnReasons & Reason) == Reason);
+}
+
+/* Creates $Extend\$UsnJrnl with an empty $J and the given $Max */
+static
+NTSTATUS
+NtfsUsnCreateJournalFile(PDEVICE_EXTENSION Vcb)
+{
+    PNTFS_USN_JOURNAL Journal = &Vcb->UsnJournal;
+    PFILE_RECORD_HEADER FileRecord;
+    PNTFS_ATTR_RECORD NextAttribute;
+    PSTANDARD_INFORMATION StandardInfo;
+    PFILENAME_ATTRIBUTE FilenameAttribute;
+    FILE_OBJECT FileObject;
+    NTFS_USN_MAX Max;
+    ULONGLONG ParentMftIndex;
+    ULONGLONG FileMftIndex;
+    NTSTATUS Status;
+
+    FileRecord = NtfsCreateEmptyFileRecord(Vcb);
+    if (FileRecord == NULL)
+    {
+        DPRINT1("ERROR: Unable to allocate memory for file record!\n");
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    NextAttribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)FileRecord + FileRecord->AttributeOffset);
+    AddStandardInformation(FileRecord, NextAttribute);
+    StandardInfo = (PSTANDARD_INFORMATION)((ULONG_PTR)NextAttribute + NextAttribute->Resident.ValueOffset);
+    StandardInfo->FileAttribute = NTFS_FILE_TYPE_HIDDEN | NTFS_FILE_TYPE_SYSTEM | NTFS_FILE_TYPE_ARCHIVE;
+    NextAttribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)NextAttribute + (ULONG_PTR)NextAttribute->Length);
+
+    // AddFileName() only needs the path of the new file
+    RtlZeroMemory(&FileObject, sizeof(FileObject));
+    RtlInitUnicodeString(&FileObject.FileName, L"\\$Extend\\$UsnJrnl");
+    AddFileName(FileRecord, NextAttribute, Vcb, &FileObject, FALSE, &ParentMftIndex);
+    FilenameAttribute = (PFILENAME_ATTRIBUTE)((ULONG_PTR)NextAttribute + NextAttribute->Resident.ValueOffset);
+    NextAttribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)NextAttribute + (ULONG_PTR)NextAttribute->Length);
+
+    if (ParentMftIndex != NTFS_FILE_EXTEND)
+    {
+        DPRINT1("Couldn't find $Extend!\n");
+        ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+        return STATUS_DISK_CORRUPT_ERROR;
+    }
+
+    // System files have their index as sequence number
+    FilenameAttribute->DirectoryFileReferenceNumber = NTFS_FILE_EXTEND | ((ULONGLONG)NTFS_FILE_EXTEND << 48);
+    FilenameAttribute->FileAttributes = StandardInfo->FileAttribute;
+
+    // $J can then grow without moving $Max
+    Status = AddNonResidentData(Vcb, FileRecord, NextAttribute, L"$J", 2);
+    if (NT_SUCCESS(Status))
+    {
+        NextAttribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)NextAttribute + (ULONG_PTR)NextAttribute->Length);
+
+        Max.MaximumSize = Journal->MaximumSize;
+        Max.AllocationDelta = Journal->AllocationDelta;
+        Max.UsnJournalID = Journal->UsnJournalID;
+        Max.LowestValidUsn = Journal->LowestValidUsn;
+        Status = AddNamedData(Vcb, FileRecord, NextAttribute, L"$Max", 4, &Max, sizeof(Max));
+    }
+
+    if (NT_SUCCESS(Status))
+        Status = AddNewMftEntry(FileRecord, Vcb, &FileMftIndex, TRUE);
+
+    if (NT_SUCCESS(Status))
+    {
+        Journal->MftIndex = FileMftIndex;
+
+        Status = NtfsAddFilenameToDirectory(Vcb,
+                                            NTFS_FILE_EXTEND,
+                                            FileMftIndex | ((ULONGLONG)FileRecord->SequenceNumber << 48),
+                                            FilenameAttribute,
+                                            FALSE);
+    }
+
+    ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+
+    return Status;
+}
+
+/**
+* @name NtfsCreateUsnJournal
+* @implemented
+*
+* Handles FSCTL_CREATE_USN_JOURNAL: creates the change journal of the volume, or changes
+* the limits of the existing one.
+*
+* @param Vcb
+* Points to the DEVICE_EXTENSION of the volume.
+*
+* @param Irp
+* Request holding a CREATE_USN_JOURNAL_DATA.
+*
+* @return
+* STATUS_SUCCESS, or STATUS_NOT_IMPLEMENTED for a journal this driver can't maintain.
+*/
+NTSTATUS
+NtfsCreateUsnJournal(PDEVICE_EXTENSION Vcb,
+                     PIRP Irp)
+{
+    PNTFS_USN_JOURNAL Journal = &Vcb->UsnJournal;
+    CREATE_USN_JOURNAL_DATA CreateData;
+    PFILE_RECORD_HEADER FileRecord;
+    LARGE_INTEGER SystemTime;
+    ULONGLONG MftIndex;
+    NTSTATUS Status;
+
+    Status = NtfsCaptureFsctlBuffers(Irp, &CreateData, sizeof(CreateData), NULL, 0);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    if (!NtfsGlobalData->EnableWriteSupport)
+    {
+        DPRINT1("NTFS write-support is EXPERIMENTAL and is disabled by default!\n");
+        return STATUS_ACCESS_DENIED;
+    }
+
+    if (Vcb->NtfsInfo.MajorVersion < 3)
+        return STATUS_VOLUME_NOT_UPGRADED;
+
+    if (CreateData.MaximumSize == 0)
+        CreateData.MaximumSize = NTFS_USN_DEFAULT_MAXIMUM_SIZE;
+    if (CreateData.AllocationDelta == 0)
+        CreateData.AllocationDelta = NTFS_USN_DEFAULT_ALLOCATION_DELTA;
+
+    ExAcquireResourceExclusiveLite(&Vcb->DirResource, TRUE);
+    ExAcquireResourceExclusiveLite(&Journal->Resource, TRUE);
+
+    if (Journal->Active)
+    {
+        Journal->MaximumSize = ROUND_UP(CreateData.MaximumSize, USN_PAGE_SIZE);
+        Journal->AllocationDelta = ROUND_UP(CreateData.AllocationDelta, USN_PAGE_SIZE);
+
+        FileRecord = ExAllocateFromNPagedLookasideList(&Vcb->FileRecLookasideList);
+        if (FileRecord == NULL)
+        {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+        }
+        else
+        {
+            Status = ReadFileRecord(Vcb, Journal->MftIndex, FileRecord);
+            if (NT_SUCCESS(Status))
+                Status = NtfsUsnWriteMax(Vcb, FileRecord);
+
+            ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+        }
+    }
+    else if (NT_SUCCESS(NtfsUsnFindJournalRecord(Vcb, &MftIndex)))
+    {
+        DPRINT1("FIXME: $UsnJrnl exists but can't be maintained by this driver\n");
+        Status = STATUS_NOT_IMPLEMENTED;
+    }
+    else
+    {
+        if (Journal->Buffer == NULL)
+            Journal->Buffer = ExAllocatePoolWithTag(NonPagedPool, NTFS_USN_BUFFER_SIZE, TAG_USN);
+
+        if (Journal->Buffer == NULL)
+        {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+        }
+        else
+        {
+            KeQuerySystemTime(&SystemTime);
+            Journal->MaximumSize = ROUND_UP(CreateData.MaximumSize, USN_PAGE_SIZE);
+            Journal->AllocationDelta = ROUND_UP(CreateData.AllocationDelta, USN_PAGE_SIZE);
+            Journal->UsnJournalID = SystemTime.QuadPart;
+            Journal->LowestValidUsn = 0;
+            Journal->NextUsn = 0;
+            Journal->WrittenUsn = 0;
+
+            Status = NtfsUsnCreateJournalFile(Vcb);
+            if (NT_SUCCESS(Status))
+                Journal->Active = TRUE;
+        }
+    }
+
+    ExReleaseResourceLite(&Journal->Resource);
+    ExReleaseResourceLite(&Vcb->DirResource);
+
+    return Status;
+}
+
+/* Handles FSCTL_QUERY_USN_JOURNAL */
+NTSTATUS
+NtfsQueryUsnJournal(PDEVICE_EXTENSION Vcb,
+                    PIRP Irp)
+{
+    PNTFS_USN_JOURNAL Journal = &Vcb->UsnJournal;
+    PIO_STACK_LOCATION Stack = IoGetCurrentIrpStackLocation(Irp);
+    PUSN_JOURNAL_DATA JournalData = Irp->AssociatedIrp.SystemBuffer;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    if (Stack->Parameters.FileSystemControl.OutputBufferLength < sizeof(USN_JOURNAL_DATA))
+    {
+        DPRINT1("Invalid output! %lu\n", Stack->Parameters.FileSystemControl.OutputBufferLength);
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    ExAcquireResourceSharedLite(&Journal->Resource, TRUE);
+
+    if (!Journal->Active)
+    {
+        Status = STATUS_JOURNAL_NOT_ACTIVE;
+    }
+    else
+    {
+        JournalData->UsnJournalID = Journal->UsnJournalID;
+        JournalData->FirstUsn = Journal->LowestValidUsn;
+        JournalData->NextUsn = Journal->NextUsn;
+        JournalData->LowestValidUsn = Journal->LowestValidUsn;
+        JournalData->MaxUsn = NTFS_USN_MAX_USN;
+        JournalData->MaximumSize = Journal->MaximumSize;
+        JournalData->AllocationDelta = Journal->AllocationDelta;
+        Irp->IoStatus.Information = sizeof(USN_JOURNAL_DATA);
+    }
+
+    ExReleaseResourceLite(&Journal->Resource);
+
+    return Status;
+}
+
+/**
+* @name NtfsReadUsnJournal
+* @implemented
+*
+* Handles FSCTL_READ_USN_JOURNAL: returns the records of the change journal from a given USN.
+*
+* @param Vcb
+* Points to the DEVICE_EXTENSION of the volume.
+*
+* @param Irp
+* Request holding a READ_USN_JOURNAL_DATA.
+*
+* @return
+* STATUS_SUCCESS, STATUS_JOURNAL_NOT_ACTIVE, or STATUS_JOURNAL_ENTRY_DELETED if the records
+* asked for were dropped when the journal grew past its maximum size.
+*
+* @remarks
+* The reply is the USN to read from next, followed by the records which match ReasonMask and
+* ReturnOnlyOnClose. The request never waits for new records: Timeout and BytesToWaitFor are
+* ignored.
+*/
+NTSTATUS
+NtfsReadUsnJournal(PDEVICE_EXTENSION Vcb,
+                   PIRP Irp)
+{
+    PNTFS_USN_JOURNAL Journal = &Vcb->UsnJournal;
+    PIO_STACK_LOCATION Stack = IoGetCurrentIrpStackLocation(Irp);
+    READ_USN_JOURNAL_DATA ReadData;
+    PVOID OutputBuffer;
+    PUCHAR Output = NULL;
+    PUCHAR Records = NULL;
+    ULONG OutputLength;
+    ULONG OutputUsed;
+    ULONG RecordsLength = 0;
+    ULONG Offset;
+    PUSN_RECORD UsnRecord;
+    PFILE_RECORD_HEADER FileRecord = NULL;
+    PNTFS_ATTR_CONTEXT DataContext;
+    USN Usn;
+    NTSTATUS Status;
+
+    Status = NtfsCaptureFsctlBuffers(Irp, &ReadData, sizeof(ReadData), &OutputBuffer, sizeof(USN));
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    OutputLength = min(Stack->Parameters.FileSystemControl.OutputBufferLength, NTFS_USN_OUTPUT_MAX);
+
+    ExAcquireResourceExclusiveLite(&Journal->Resource, TRUE);
+
+    if (!Journal->Active)
+    {
+        Status = STATUS_JOURNAL_NOT_ACTIVE;
+        goto Cleanup;
+    }
+
+    if (ReadData.UsnJournalID != Journal->UsnJournalID)
+    {
+        DPRINT1("Wrong journal ID %I64x, the journal is %I64x\n", ReadData.UsnJournalID, Journal->UsnJournalID);
+        Status = STATUS_INVALID_PARAMETER;
+        goto Cleanup;
+    }
+
+    if (ReadData.StartUsn < Journal->LowestValidUsn)
+    {
+        Status = STATUS_JOURNAL_ENTRY_DELETED;
+        goto Cleanup;
+    }
+
+    // Records are read back from $J
+    Status = NtfsUsnFlushBuffer(Vcb);
+    if (!NT_SUCCESS(Status))
+        goto Cleanup;
+
+    Output = ExAllocatePoolWithTag(PagedPool, OutputLength, TAG_USN);
+    if (Output == NULL)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Cleanup;
+    }
+
+    OutputUsed = sizeof(USN);
+    Usn = min(ReadData.StartUsn, Journal->NextUsn);
+
+    if (Usn < Journal->NextUsn)
+    {
+        // Read from the start of the page, the records don't cross them
+        RecordsLength = (ULONG)min(Journal->NextUsn - ROUND_DOWN(Usn, USN_PAGE_SIZE), NTFS_USN_OUTPUT_MAX);
+        Records = ExAllocatePoolWithTag(PagedPool, RecordsLength, TAG_USN);
+        FileRecord = ExAllocateFromNPagedLookasideList(&Vcb->FileRecLookasideList);
+        if (Records == NULL || FileRecord == NULL)
+        {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Cleanup;
+        }
+
+        Status = ReadFileRecord(Vcb, Journal->MftIndex, FileRecord);
+        if (NT_SUCCESS(Status))
+            Status = FindAttribute(Vcb, FileRecord, AttributeData, L"$J", 2, &DataContext, NULL);
+        if (!NT_SUCCESS(Status))
+            goto Cleanup;
+
+        RecordsLength = ReadAttribute(Vcb, DataContext, ROUND_DOWN(Usn, USN_PAGE_SIZE), (PCHAR)Records, RecordsLength);
+        ReleaseAttributeContext(DataContext);
+
+        Offset = (ULONG)(Usn % USN_PAGE_SIZE);
+        while (Offset + FIELD_OFFSET(USN_RECORD, FileName) <= RecordsLength)
+        {
+            UsnRecord = (PUSN_RECORD)(Records + Offset);
+
+            // Skip the padding at the end of the page
+            if (UsnRecord->RecordLength == 0)
+            {
+                Offset = ROUND_UP(Offset + 1, USN_PAGE_SIZE);
+                continue;
+            }
+
+            if (UsnRecord->RecordLength < FIELD_OFFSET(USN_RECORD, FileName) ||
+                Offset + UsnRecord->RecordLength > RecordsLength)
+            {
+                break;
+            }
+
+            if ((UsnRecord->Reason & ReadData.ReasonMask) &&
+                (!ReadData.ReturnOnlyOnClose || (UsnRecord->Reason & USN_REASON_CLOSE)))
+            {
+                if (OutputUsed + UsnRecord->RecordLength > OutputLength)
+                    break;
+
+                RtlCopyMemory(Output + OutputUsed, UsnRecord, UsnRecord->RecordLength);
+                OutputUsed += UsnRecord->RecordLength;
+            }
+
+            Offset += UsnRecord->RecordLength;
+        }
+
+        Usn = ROUND_DOWN(Usn, USN_PAGE_SIZE) + min(Offset, RecordsLength);
+    }
+
+    *(USN *)Output = Usn;
+    Status = NtfsReturnFsctlOutput(Irp, OutputBuffer, Output, OutputUsed);
+
+Cleanup:
+    ExReleaseResourceLite(&Journal->Resource);
+
+    if (FileRecord != NULL)
+        ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+    if (Records != NULL)
+        ExFreePoolWithTag(Records, TAG_USN);
+    if (Output != NULL)
+        ExFreePoolWithTag(Output, TAG_USN);
+
+    return Status;
+}
+
+/**
+* @name NtfsEnumUsnData
+* @implemented
+*
+* Handles FSCTL_ENUM_USN_DATA: returns a record for each file of the volume whose last USN
+* is in a given range, in the order of the MFT.
+*
+* @param Vcb
+* Points to the DEVICE_EXTENSION of the volume.
+*
+* @param Irp
+* Request holding an MFT_ENUM_DATA.
+*
+* @return
+* STATUS_SUCCESS, or STATUS_END_OF_FILE once every file record was returned.
+*
+* @remarks
+* The reply is the file reference number to continue from, followed by the records.
+* Doesn't need an active journal: files which never changed have USN 0.
+* $MFT is read with NtfsReadNextMftRecord(), so the records not in use are never read.
+*/
+NTSTATUS
+NtfsEnumUsnData(PDEVICE_EXTENSION Vcb,
+                PIRP Irp)
+{
+    PIO_STACK_LOCATION Stack = IoGetCurrentIrpStackLocation(Irp);
+    MFT_ENUM_DATA EnumData;
+    PVOID OutputBuffer;
+    PUCHAR Output;
+    ULONG OutputLength;
+    ULONG OutputUsed;
+    ULONG RecordLength;
+    NTFS_MFT_SCAN Scan;
+    PFILE_RECORD_HEADER FileRecord;
+    PNTFS_STANDARD_INFORMATION_V3 StdInfo;
+    PFILENAME_ATTRIBUTE FileName;
+    PUSN_RECORD UsnRecord;
+    ULONGLONG MftIndex;
+    ULONGLONG NextIndex;
+    ULONGLONG RecordCount;
+    USN Usn;
+    NTSTATUS Status;
+
+    Status = NtfsCaptureFsctlBuffers(Irp, &EnumData, sizeof(EnumData), &OutputBuffer, sizeof(ULONGLONG));
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    OutputLength = min(Stack->Parameters.FileSystemControl.OutputBufferLength, NTFS_USN_OUTPUT_MAX);
+
+    Output = ExAllocatePoolWithTag(PagedPool, OutputLength, TAG_USN);
+    if (Output == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    Status = NtfsStartMftScan(Vcb, EnumData.StartFileReferenceNumber & NTFS_MFT_MASK, &Scan);
+    if (!NT_SUCCESS(Status))
+    {
+        ExFreePoolWithTag(Output, TAG_USN);
+        return Status;
+    }
+
+    OutputUsed = sizeof(ULONGLONG);
+    RecordCount = Scan.RecordCount;
+    NextIndex = RecordCount;
+    while ((Status = NtfsReadNextMftRecord(Vcb, &Scan, &MftIndex, &FileRecord)) == STATUS_SUCCESS)
+    {
+        if (FileRecord->BaseFileRecord != 0)
+            continue;
+
+        StdInfo = NtfsUsnGetStandardInformation(FileRecord);
+        Usn = (StdInfo != NULL) ? StdInfo->Usn : 0;
+        if (Usn < EnumData.LowUsn || Usn > EnumData.HighUsn)
+            continue;
+
+        FileName = GetBestFileNameFromRecord(Vcb, FileRecord);
+        if (FileName == NULL)
+            continue;
+
+        RecordLength = ALIGN_UP_BY(FIELD_OFFSET(USN_RECORD, FileName) + FileName->NameLength * sizeof(WCHAR), sizeof(ULONGLONG));
+        if (OutputUsed + RecordLength > OutputLength)
+        {
+            // The next call starts with this file
+            NextIndex = MftIndex;
+            break;
+        }
+
+        UsnRecord = (PUSN_RECORD)(Output + OutputUsed);
+        RtlZeroMemory(UsnRecord, RecordLength);
+        UsnRecord->RecordLength = RecordLength;
+        UsnRecord->MajorVersion = 2;
+        UsnRecord->MinorVersion = 0;
+        UsnRecord->FileReferenceNumber = MftIndex | ((ULONGLONG)FileRecord->SequenceNumber << 48);
+        UsnRecord->ParentFileReferenceNumber = FileName->DirectoryFileReferenceNumber;
+        UsnRecord->Usn = Usn;
+        NtfsFileFlagsToAttributes(FileName->FileAttributes, &UsnRecord->FileAttributes);
+        if (FileRecord->Flags & FRH_DIRECTORY)
+            UsnRecord->FileAttributes |= FILE_ATTRIBUTE_DIRECTORY;
+        UsnRecord->FileNameLength = FileName->NameLength * sizeof(WCHAR);
+        UsnRecord->FileNameOffset = FIELD_OFFSET(USN_RECORD, FileName);
+        RtlCopyMemory(UsnRecord->FileName, FileName->Name, UsnRecord->FileNameLength);
+
+        OutputUsed += RecordLength;
+    }
+
+    NtfsEndMftScan(&Scan);
+
+    if (Status != STATUS_SUCCESS && Status != STATUS_END_OF_FILE)
+    {
+        DPRINT1("Enumerating the MFT failed with status %lx\n", Status);
+    }
+    else if (OutputUsed == sizeof(ULONGLONG) && NextIndex == RecordCount)
+    {
+        Status = STATUS_END_OF_FILE;
+    }
+    else
+    {
+        *(PULONGLONG)Output = NextIndex;
+        Status = NtfsReturnFsctlOutput(Irp, OutputBuffer, Output, OutputUsed);
+    }
+
+    ExFreePoolWithTag(Output, TAG_USN);
+
+    return Status;
+}
+
+/* EOF */
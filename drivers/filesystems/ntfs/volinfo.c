@@ -33,92 +33,316 @@
 
 /* FUNCTIONS ****************************************************************/
 
-ULONGLONG
-NtfsGetFreeClusters(PDEVICE_EXTENSION DeviceExt)
+static
+ULONG
+NtfsFreeExtentBucket(ULONGLONG Length)
 {
-    NTSTATUS Status;
-    PFILE_RECORD_HEADER BitmapRecord;
-    PNTFS_ATTR_CONTEXT DataContext;
-    ULONGLONG BitmapDataSize;
-    PCHAR BitmapData;
-    ULONGLONG FreeClusters = 0;
-    ULONG Read = 0;
-    RTL_BITMAP Bitmap;
+    ULONG Bucket = 0;
 
-    DPRINT("NtfsGetFreeClusters(%p)\n", DeviceExt);
+    while (Length > 1 && Bucket < NTFS_FREE_EXTENT_BUCKETS - 1)
+    {
+        Length >>= 1;
+        Bucket++;
+    }
 
-    BitmapRecord = ExAllocateFromNPagedLookasideList(&DeviceExt->FileRecLookasideList);
-    if (BitmapRecord == NULL)
+    return Bucket;
+}
+
+/* Adds a free extent to the index, recently freed extents go first */
+static
+VOID
+NtfsInsertFreeExtent(PNTFS_VOLUME_BITMAP VolumeBitmap,
+                     ULONGLONG Start,
+                     ULONGLONG Length,
+                     BOOLEAN Tail)
+{
+    PNTFS_FREE_EXTENT Extent;
+    ULONG Bucket = NtfsFreeExtentBucket(Length);
+
+    if (VolumeBitmap->ExtentCount[Bucket] == NTFS_FREE_EXTENT_BUCKET_MAX)
     {
-        return 0;
+        // Keep the recently freed extents
+        if (Tail)
+        {
+            VolumeBitmap->ExtentIndexComplete = FALSE;
+            return;
+        }
+
+        Extent = CONTAINING_RECORD(RemoveTailList(&VolumeBitmap->ExtentBuckets[Bucket]), NTFS_FREE_EXTENT, ListEntry);
+        VolumeBitmap->ExtentIndexComplete = FALSE;
     }
+    else
+    {
+        Extent = ExAllocateFromNPagedLookasideList(&VolumeBitmap->ExtentLookasideList);
+        if (Extent == NULL)
+        {
+            VolumeBitmap->ExtentIndexComplete = FALSE;
+            return;
+        }
 
-    Status = ReadFileRecord(DeviceExt, NTFS_FILE_BITMAP, BitmapRecord);
-    if (!NT_SUCCESS(Status))
+        VolumeBitmap->ExtentCount[Bucket]++;
+    }
+
+    Extent->Start = Start;
+    Extent->Length = Length;
+
+    if (Tail)
+        InsertTailList(&VolumeBitmap->ExtentBuckets[Bucket], &Extent->ListEntry);
+    else
+        InsertHeadList(&VolumeBitmap->ExtentBuckets[Bucket], &Extent->ListEntry);
+}
+
+static
+VOID
+NtfsRemoveFreeExtent(PNTFS_VOLUME_BITMAP VolumeBitmap,
+                     PNTFS_FREE_EXTENT Extent)
+{
+    RemoveEntryList(&Extent->ListEntry);
+    VolumeBitmap->ExtentCount[NtfsFreeExtentBucket(Extent->Length)]--;
+    ExFreeToNPagedLookasideList(&VolumeBitmap->ExtentLookasideList, Extent);
+}
+
+static
+VOID
+NtfsClearFreeExtents(PNTFS_VOLUME_BITMAP VolumeBitmap)
+{
+    ULONG i;
+
+    for (i = 0; i < NTFS_FREE_EXTENT_BUCKETS; i++)
     {
-        ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, BitmapRecord);
-        return 0;
+        while (!IsListEmpty(&VolumeBitmap->ExtentBuckets[i]))
+        {
+            NtfsRemoveFreeExtent(VolumeBitmap,
+                                 CONTAINING_RECORD(VolumeBitmap->ExtentBuckets[i].Flink, NTFS_FREE_EXTENT, ListEntry));
+        }
     }
+}
 
-    Status = FindAttribute(DeviceExt, BitmapRecord, AttributeData, L"", 0, &DataContext, NULL);
-    if (!NT_SUCCESS(Status))
+/* Indexes a run of free clusters, without the part of it inside the MFT zone */
+static
+VOID
+NtfsIndexFreeRun(PNTFS_VOLUME_BITMAP VolumeBitmap,
+                 ULONGLONG Start,
+                 ULONGLONG Length,
+                 BOOLEAN Tail)
+{
+    ULONGLONG End = Start + Length;
+
+    if (Start < VolumeBitmap->MftZoneStart)
     {
-        ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, BitmapRecord);
-        return 0;
+        NtfsInsertFreeExtent(VolumeBitmap, Start, min(End, VolumeBitmap->MftZoneStart) - Start, Tail);
     }
 
-    BitmapDataSize = AttributeDataLength(DataContext->pRecord);
-    ASSERT((BitmapDataSize * 8) >= DeviceExt->NtfsInfo.ClusterCount);
-    BitmapData = ExAllocatePoolWithTag(NonPagedPool, ROUND_UP(BitmapDataSize, DeviceExt->NtfsInfo.BytesPerSector), TAG_NTFS);
-    if (BitmapData == NULL)
+    if (End > VolumeBitmap->MftZoneEnd)
     {
-        ReleaseAttributeContext(DataContext);
-        ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, BitmapRecord);
-        return 0;
+        Start = max(Start, VolumeBitmap->MftZoneEnd);
+        NtfsInsertFreeExtent(VolumeBitmap, Start, End - Start, Tail);
     }
+}
 
-    /* FIXME: Totally underoptimized! */
-    for (; Read < BitmapDataSize; Read += DeviceExt->NtfsInfo.BytesPerSector)
+/* Rebuilds the free extent index from the bitmap, lower LCNs first */
+static
+VOID
+NtfsRebuildFreeExtentIndex(PDEVICE_EXTENSION DeviceExt)
+{
+    PNTFS_VOLUME_BITMAP VolumeBitmap = &DeviceExt->VolumeBitmap;
+    ULONG Cluster, RunStart, RunLength;
+
+    DPRINT("NtfsRebuildFreeExtentIndex(%p)\n", DeviceExt);
+
+    NtfsClearFreeExtents(VolumeBitmap);
+    VolumeBitmap->ExtentIndexComplete = TRUE;
+
+    Cluster = 0;
+    for (;;)
     {
-        ReadAttribute(DeviceExt, DataContext, Read, (PCHAR)((ULONG_PTR)BitmapData + Read), DeviceExt->NtfsInfo.BytesPerSector);
+        RunLength = RtlFindNextForwardRunClear(&VolumeBitmap->Bitmap, Cluster, &RunStart);
+        if (RunLength == 0)
+            break;
+
+        NtfsIndexFreeRun(VolumeBitmap, RunStart, RunLength, TRUE);
+        Cluster = RunStart + RunLength;
     }
-    ReleaseAttributeContext(DataContext);
+}
 
-    DPRINT1("Total clusters: %I64x\n", DeviceExt->NtfsInfo.ClusterCount);
-    DPRINT1("Total clusters in bitmap: %I64x\n", BitmapDataSize * 8);
-    DPRINT1("Diff in size: %I64d B\n", ((BitmapDataSize * 8) - DeviceExt->NtfsInfo.ClusterCount) * DeviceExt->NtfsInfo.SectorsPerCluster * DeviceExt->NtfsInfo.BytesPerSector);
+/*
+ * Takes clusters from an indexed free extent: the first extent of at least DesiredClusters,
+ * or the largest one when AllowPartial is set. The clusters aren't marked in the bitmap.
+ */
+static
+BOOLEAN
+NtfsTakeFreeExtent(PNTFS_VOLUME_BITMAP VolumeBitmap,
+                   ULONG DesiredClusters,
+                   BOOLEAN AllowPartial,
+                   PULONGLONG FirstAssignedCluster,
+                   PULONG AssignedClusters)
+{
+    PNTFS_FREE_EXTENT Extent, Found;
+    PLIST_ENTRY ListEntry;
+    ULONGLONG End;
+    ULONG Bucket, Taken, RunStart, RunLength;
+    LONG i;
 
-    RtlInitializeBitMap(&Bitmap, (PULONG)BitmapData, DeviceExt->NtfsInfo.ClusterCount);
-    FreeClusters = RtlNumberOfClearBits(&Bitmap);
+    for (;;)
+    {
+        Found = NULL;
 
-    ExFreePoolWithTag(BitmapData, TAG_NTFS);
-    ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, BitmapRecord);
+        // Extents of the bucket of DesiredClusters may be shorter, every extent of the next ones is long enough
+        for (Bucket = NtfsFreeExtentBucket(DesiredClusters); Bucket < NTFS_FREE_EXTENT_BUCKETS && Found == NULL; Bucket++)
+        {
+            for (ListEntry = VolumeBitmap->ExtentBuckets[Bucket].Flink;
+                 ListEntry != &VolumeBitmap->ExtentBuckets[Bucket];
+                 ListEntry = ListEntry->Flink)
+            {
+                Extent = CONTAINING_RECORD(ListEntry, NTFS_FREE_EXTENT, ListEntry);
+                if (Extent->Length >= DesiredClusters)
+                {
+                    Found = Extent;
+                    break;
+                }
+            }
+        }
 
-    return FreeClusters;
+        // Otherwise use the largest extent there is
+        for (i = NTFS_FREE_EXTENT_BUCKETS - 1; i >= 0 && Found == NULL && AllowPartial; i--)
+        {
+            for (ListEntry = VolumeBitmap->ExtentBuckets[i].Flink;
+                 ListEntry != &VolumeBitmap->ExtentBuckets[i];
+                 ListEntry = ListEntry->Flink)
+            {
+                Extent = CONTAINING_RECORD(ListEntry, NTFS_FREE_EXTENT, ListEntry);
+                if (Found == NULL || Extent->Length > Found->Length)
+                    Found = Extent;
+            }
+        }
+
+        if (Found == NULL)
+            return FALSE;
+
+        Taken = (ULONG)min(Found->Length, DesiredClusters);
+
+        // Clusters of the extent may have been allocated since it was indexed
+        if (!RtlAreBitsClear(&VolumeBitmap->Bitmap, (ULONG)Found->Start, Taken))
+        {
+            End = Found->Start + Found->Length;
+            RunLength = RtlFindNextForwardRunClear(&VolumeBitmap->Bitmap, (ULONG)Found->Start, &RunStart);
+            NtfsRemoveFreeExtent(VolumeBitmap, Found);
+            VolumeBitmap->ExtentIndexComplete = FALSE;
+
+            if (RunLength != 0 && RunStart < End)
+            {
+                NtfsInsertFreeExtent(VolumeBitmap, RunStart, min(RunStart + RunLength, End) - RunStart, FALSE);
+            }
+
+            continue;
+        }
+
+        *FirstAssignedCluster = Found->Start;
+        *AssignedClusters = Taken;
+
+        if (Found->Length == Taken)
+        {
+            NtfsRemoveFreeExtent(VolumeBitmap, Found);
+        }
+        else if (NtfsFreeExtentBucket(Found->Length - Taken) != NtfsFreeExtentBucket(Found->Length))
+        {
+            End = Found->Start + Found->Length;
+            NtfsRemoveFreeExtent(VolumeBitmap, Found);
+            NtfsInsertFreeExtent(VolumeBitmap, *FirstAssignedCluster + Taken, End - *FirstAssignedCluster - Taken, FALSE);
+        }
+        else
+        {
+            Found->Start += Taken;
+            Found->Length -= Taken;
+        }
+
+        return TRUE;
+    }
 }
 
 /**
-* NtfsAllocateClusters
-* Allocates a run of clusters. The run allocated might be smaller than DesiredClusters.
+* @name NtfsInitializeVolumeBitmap
+* @implemented
+*
+* Prepares the in-memory copy of $Bitmap of a volume. The bitmap itself is read
+* the first time clusters are counted, allocated or freed.
+*
+* @param DeviceExt
+* Pointer to the DEVICE_EXTENSION of the volume being mounted.
 */
+VOID
+NtfsInitializeVolumeBitmap(PDEVICE_EXTENSION DeviceExt)
+{
+    PNTFS_VOLUME_BITMAP VolumeBitmap = &DeviceExt->VolumeBitmap;
+    ULONG i;
+
+    RtlZeroMemory(VolumeBitmap, sizeof(NTFS_VOLUME_BITMAP));
+    ExInitializeResourceLite(&VolumeBitmap->Resource);
+    VolumeBitmap->LowestDirtyPage = MAXULONG;
+
+    ExInitializeNPagedLookasideList(&VolumeBitmap->ExtentLookasideList,
+                                    NULL,
+                                    NULL,
+                                    0,
+                                    sizeof(NTFS_FREE_EXTENT),
+                                    TAG_BITMAP,
+                                    0);
+
+    for (i = 0; i < NTFS_FREE_EXTENT_BUCKETS; i++)
+    {
+        InitializeListHead(&VolumeBitmap->ExtentBuckets[i]);
+    }
+}
+
+/**
+* @name NtfsUninitializeVolumeBitmap
+* @implemented
+*
+* Frees the in-memory copy of $Bitmap of a volume. Changes that weren't written back
+* with NtfsFlushVolumeBitmap() are lost.
+*
+* @param DeviceExt
+* Pointer to the DEVICE_EXTENSION of the volume.
+*/
+VOID
+NtfsUninitializeVolumeBitmap(PDEVICE_EXTENSION DeviceExt)
+{
+    PNTFS_VOLUME_BITMAP VolumeBitmap = &DeviceExt->VolumeBitmap;
+
+    if (VolumeBitmap->DirtyCount != 0)
+    {
+        DPRINT1("Dropping %lu dirty $Bitmap pages\n", VolumeBitmap->DirtyCount);
+    }
+
+    if (VolumeBitmap->Loaded)
+    {
+        NtfsClearFreeExtents(VolumeBitmap);
+        ReleaseAttributeContext(VolumeBitmap->DataContext);
+        ExFreePoolWithTag(VolumeBitmap->DirtyBuffer, TAG_BITMAP);
+        ExFreePoolWithTag(VolumeBitmap->Buffer, TAG_BITMAP);
+    }
+
+    ExDeleteNPagedLookasideList(&VolumeBitmap->ExtentLookasideList);
+    ExDeleteResourceLite(&VolumeBitmap->Resource);
+}
+
+/* Reads $Bitmap into memory and counts the free clusters, the caller holds the resource exclusively */
+static
 NTSTATUS
-NtfsAllocateClusters(PDEVICE_EXTENSION DeviceExt,
-                     ULONG FirstDesiredCluster,
-                     ULONG DesiredClusters,
-                     PULONG FirstAssignedCluster,
-                     PULONG AssignedClusters)
+NtfsLoadVolumeBitmap(PDEVICE_EXTENSION DeviceExt)
 {
-    NTSTATUS Status;
+    PNTFS_VOLUME_BITMAP VolumeBitmap = &DeviceExt->VolumeBitmap;
     PFILE_RECORD_HEADER BitmapRecord;
     PNTFS_ATTR_CONTEXT DataContext;
     ULONGLONG BitmapDataSize;
-    PUCHAR BitmapData;
-    ULONGLONG FreeClusters = 0;
-    RTL_BITMAP Bitmap;
-    ULONG AssignedRun;
-    ULONG LengthWritten;
+    ULONG PageCount;
+    NTSTATUS Status;
 
-    DPRINT("NtfsAllocateClusters(%p, %lu, %lu, %p, %p)\n", DeviceExt, FirstDesiredCluster, DesiredClusters, FirstAssignedCluster, AssignedClusters);
+    if (DeviceExt->NtfsInfo.ClusterCount > MAXULONG)
+    {
+        DPRINT1("Volumes of more than 2^32 clusters are not supported\n");
+        return STATUS_NOT_SUPPORTED;
+    }
 
     BitmapRecord = ExAllocateFromNPagedLookasideList(&DeviceExt->FileRecLookasideList);
     if (BitmapRecord == NULL)
@@ -134,72 +358,438 @@ NtfsAllocateClusters(PDEVICE_EXTENSION DeviceExt,
     }
 
     Status = FindAttribute(DeviceExt, BitmapRecord, AttributeData, L"", 0, &DataContext, NULL);
+    ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, BitmapRecord);
     if (!NT_SUCCESS(Status))
     {
-        ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, BitmapRecord);
         return Status;
     }
 
     BitmapDataSize = AttributeDataLength(DataContext->pRecord);
-    BitmapDataSize = min(BitmapDataSize, 0xffffffff);
-    ASSERT((BitmapDataSize * 8) >= DeviceExt->NtfsInfo.ClusterCount);
-    BitmapData = ExAllocatePoolWithTag(NonPagedPool, ROUND_UP(BitmapDataSize, DeviceExt->NtfsInfo.BytesPerSector), TAG_NTFS);
-    if (BitmapData == NULL)
+    if (BitmapDataSize * 8 < DeviceExt->NtfsInfo.ClusterCount)
     {
+        DPRINT1("$Bitmap is too small: %I64u bytes for %I64u clusters\n", BitmapDataSize, DeviceExt->NtfsInfo.ClusterCount);
         ReleaseAttributeContext(DataContext);
-        ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, BitmapRecord);
-        return  STATUS_INSUFFICIENT_RESOURCES;
+        return STATUS_DISK_CORRUPT_ERROR;
     }
 
-    DPRINT("Total clusters: %I64x\n", DeviceExt->NtfsInfo.ClusterCount);
-    DPRINT("Total clusters in bitmap: %I64x\n", BitmapDataSize * 8);
-    DPRINT("Diff in size: %I64d B\n", ((BitmapDataSize * 8) - DeviceExt->NtfsInfo.ClusterCount) * DeviceExt->NtfsInfo.SectorsPerCluster * DeviceExt->NtfsInfo.BytesPerSector);
+    // Only the bytes describing the volume are kept, the tail of $Bitmap is never written
+    BitmapDataSize = ROUND_UP(DeviceExt->NtfsInfo.ClusterCount, 8) / 8;
 
-    ReadAttribute(DeviceExt, DataContext, 0, (PCHAR)BitmapData, (ULONG)BitmapDataSize);
+    // Rounded up so that RtlInitializeBitMap() gets whole ULONGs and the write-back whole pages
+    VolumeBitmap->BufferSize = ROUND_UP((ULONG)BitmapDataSize, NTFS_BITMAP_PAGE_SIZE);
+    VolumeBitmap->Buffer = ExAllocatePoolWithTag(PagedPool, VolumeBitmap->BufferSize, TAG_BITMAP);
+    if (VolumeBitmap->Buffer == NULL)
+    {
+        ReleaseAttributeContext(DataContext);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
 
-    RtlInitializeBitMap(&Bitmap, (PULONG)BitmapData, DeviceExt->NtfsInfo.ClusterCount);
-    FreeClusters = RtlNumberOfClearBits(&Bitmap);
+    RtlZeroMemory(VolumeBitmap->Buffer, VolumeBitmap->BufferSize);
 
-    if (FreeClusters < DesiredClusters)
+    if (ReadAttribute(DeviceExt, DataContext, 0, (PCHAR)VolumeBitmap->Buffer, (ULONG)BitmapDataSize) != BitmapDataSize)
     {
+        DPRINT1("Failed to read $Bitmap\n");
+        ExFreePoolWithTag(VolumeBitmap->Buffer, TAG_BITMAP);
         ReleaseAttributeContext(DataContext);
+        return STATUS_UNSUCCESSFUL;
+    }
 
-        ExFreePoolWithTag(BitmapData, TAG_NTFS);
-        ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, BitmapRecord);
+    PageCount = VolumeBitmap->BufferSize / NTFS_BITMAP_PAGE_SIZE;
+    VolumeBitmap->DirtyBuffer = ExAllocatePoolWithTag(PagedPool, ROUND_UP(PageCount, 32) / 8, TAG_BITMAP);
+    if (VolumeBitmap->DirtyBuffer == NULL)
+    {
+        ExFreePoolWithTag(VolumeBitmap->Buffer, TAG_BITMAP);
+        ReleaseAttributeContext(DataContext);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlInitializeBitMap(&VolumeBitmap->DirtyPages, VolumeBitmap->DirtyBuffer, PageCount);
+    RtlClearAllBits(&VolumeBitmap->DirtyPages);
+
+    RtlInitializeBitMap(&VolumeBitmap->Bitmap, VolumeBitmap->Buffer, (ULONG)DeviceExt->NtfsInfo.ClusterCount);
+    VolumeBitmap->FreeClusters = RtlNumberOfClearBits(&VolumeBitmap->Bitmap);
+    VolumeBitmap->DataContext = DataContext;
+    VolumeBitmap->Loaded = TRUE;
+
+    // NtfsMftZoneReservation 1 to 4 reserves 1/8th to 1/2 of the volume, like Windows does
+    VolumeBitmap->MftZoneStart = min(DeviceExt->NtfsInfo.MftStart.QuadPart, DeviceExt->NtfsInfo.ClusterCount);
+    VolumeBitmap->MftZoneEnd = VolumeBitmap->MftZoneStart +
+                               DeviceExt->NtfsInfo.ClusterCount / 8 * min(max(DeviceExt->NtfsInfo.MftZoneReservation, 1), 4);
+    VolumeBitmap->MftZoneEnd = min(VolumeBitmap->MftZoneEnd, DeviceExt->NtfsInfo.ClusterCount);
+
+    NtfsRebuildFreeExtentIndex(DeviceExt);
+
+    DPRINT("Loaded $Bitmap: %I64u clusters, %I64u free, MFT zone %I64u-%I64u\n",
+           DeviceExt->NtfsInfo.ClusterCount,
+           VolumeBitmap->FreeClusters,
+           VolumeBitmap->MftZoneStart,
+           VolumeBitmap->MftZoneEnd);
+
+    return STATUS_SUCCESS;
+}
+
+/* Acquires the volume bitmap exclusively, loading it if needed */
+static
+NTSTATUS
+NtfsAcquireVolumeBitmap(PDEVICE_EXTENSION DeviceExt)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    ExAcquireResourceExclusiveLite(&DeviceExt->VolumeBitmap.Resource, TRUE);
+
+    if (!DeviceExt->VolumeBitmap.Loaded)
+    {
+        Status = NtfsLoadVolumeBitmap(DeviceExt);
+        if (!NT_SUCCESS(Status))
+        {
+            ExReleaseResourceLite(&DeviceExt->VolumeBitmap.Resource);
+        }
+    }
+
+    return Status;
+}
+
+/* Marks the pages of the bitmap holding the bits of a run of clusters for write-back */
+static
+VOID
+NtfsMarkVolumeBitmapDirty(PNTFS_VOLUME_BITMAP VolumeBitmap,
+                          ULONG FirstCluster,
+                          ULONG ClusterCount)
+{
+    ULONG FirstPage, LastPage, Page;
+
+    ASSERT(ClusterCount != 0);
+
+    FirstPage = (FirstCluster / 8) / NTFS_BITMAP_PAGE_SIZE;
+    LastPage = ((FirstCluster + ClusterCount - 1) / 8) / NTFS_BITMAP_PAGE_SIZE;
+
+    for (Page = FirstPage; Page <= LastPage; Page++)
+    {
+        if (!RtlCheckBit(&VolumeBitmap->DirtyPages, Page))
+        {
+            RtlSetBit(&VolumeBitmap->DirtyPages, Page);
+            VolumeBitmap->DirtyCount++;
+        }
+    }
+
+    VolumeBitmap->LowestDirtyPage = min(VolumeBitmap->LowestDirtyPage, FirstPage);
+    VolumeBitmap->HighestDirtyPage = max(VolumeBitmap->HighestDirtyPage, LastPage);
+}
+
+/**
+* @name NtfsFlushVolumeBitmap
+* @implemented
+*
+* Writes the pages of $Bitmap modified since the last flush back to the volume.
+*
+* @param DeviceExt
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @return
+* STATUS_SUCCESS if every dirty page was written, the status of the first failing write otherwise.
+* Pages that couldn't be written stay dirty.
+*/
+NTSTATUS
+NtfsFlushVolumeBitmap(PDEVICE_EXTENSION DeviceExt)
+{
+    PNTFS_VOLUME_BITMAP VolumeBitmap = &DeviceExt->VolumeBitmap;
+    ULONG Page, RunStart, RunLength;
+    ULONG Offset, Length, LengthWritten;
+    ULONG BitmapDataSize;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    ExAcquireResourceExclusiveLite(&VolumeBitmap->Resource, TRUE);
+
+    if (VolumeBitmap->DirtyCount == 0)
+    {
+        ExReleaseResourceLite(&VolumeBitmap->Resource);
+        return STATUS_SUCCESS;
+    }
+
+    BitmapDataSize = (ULONG)(ROUND_UP(DeviceExt->NtfsInfo.ClusterCount, 8) / 8);
+
+    Page = VolumeBitmap->LowestDirtyPage;
+    while (Page <= VolumeBitmap->HighestDirtyPage)
+    {
+        RunLength = RtlFindNextForwardRunSet(&VolumeBitmap->DirtyPages, Page, &RunStart);
+        if (RunLength == 0 || RunStart > VolumeBitmap->HighestDirtyPage)
+            break;
+
+        Offset = RunStart * NTFS_BITMAP_PAGE_SIZE;
+        Length = min(RunLength * NTFS_BITMAP_PAGE_SIZE, BitmapDataSize - Offset);
+
+        Status = WriteAttribute(DeviceExt,
+                                VolumeBitmap->DataContext,
+                                Offset,
+                                (PUCHAR)VolumeBitmap->Buffer + Offset,
+                                Length,
+                                &LengthWritten,
+                                NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("Failed to write $Bitmap at offset 0x%lx: 0x%08lx\n", Offset, Status);
+            break;
+        }
+
+        RtlClearBits(&VolumeBitmap->DirtyPages, RunStart, RunLength);
+        VolumeBitmap->DirtyCount -= RunLength;
+        Page = RunStart + RunLength;
+    }
+
+    if (VolumeBitmap->DirtyCount == 0)
+    {
+        VolumeBitmap->LowestDirtyPage = MAXULONG;
+        VolumeBitmap->HighestDirtyPage = 0;
+    }
+
+    ExReleaseResourceLite(&VolumeBitmap->Resource);
+
+    return Status;
+}
+
+ULONGLONG
+NtfsGetFreeClusters(PDEVICE_EXTENSION DeviceExt)
+{
+    ULONGLONG FreeClusters;
+
+    DPRINT("NtfsGetFreeClusters(%p)\n", DeviceExt);
+
+    if (!NT_SUCCESS(NtfsAcquireVolumeBitmap(DeviceExt)))
+    {
+        return 0;
+    }
+
+    FreeClusters = DeviceExt->VolumeBitmap.FreeClusters;
+
+    ExReleaseResourceLite(&DeviceExt->VolumeBitmap.Resource);
+
+    return FreeClusters;
+}
+
+/**
+* @name NtfsAllocateClusters
+* @implemented
+*
+* Allocates a run of clusters. The run allocated might be smaller than DesiredClusters.
+*
+* @param DeviceExt
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @param FirstDesiredCluster
+* LCN the run should start at, usually the cluster following the last run of the stream
+* being extended, or 0 if there's no preference.
+*
+* @param DesiredClusters
+* Number of clusters wanted.
+*
+* @param UseMftZone
+* TRUE if the clusters are for $MFT, which is allocated in the MFT zone first.
+*
+* @param FirstAssignedCluster
+* Receives the LCN of the first cluster allocated.
+*
+* @param AssignedClusters
+* Receives the number of clusters allocated, between 1 and DesiredClusters.
+*
+* @return
+* STATUS_SUCCESS on success, STATUS_DISK_FULL if there aren't enough free clusters.
+*
+* @remarks
+* A stream is extended in place when the clusters following it are free. Otherwise, the
+* first indexed free extent large enough is used, falling back on the largest one, so that
+* a stream gets as few runs as possible. Other files only get clusters of the MFT zone
+* once the rest of the volume is full.
+*/
+NTSTATUS
+NtfsAllocateClusters(PDEVICE_EXTENSION DeviceExt,
+                     ULONGLONG FirstDesiredCluster,
+                     ULONG DesiredClusters,
+                     BOOLEAN UseMftZone,
+                     PULONGLONG FirstAssignedCluster,
+                     PULONG AssignedClusters)
+{
+    PNTFS_VOLUME_BITMAP VolumeBitmap = &DeviceExt->VolumeBitmap;
+    NTSTATUS Status;
+    ULONG RunStart, RunLength;
+    ULONGLONG Limit;
+    BOOLEAN Found = FALSE;
+
+    DPRINT("NtfsAllocateClusters(%p, %I64u, %lu, %s, %p, %p)\n",
+           DeviceExt,
+           FirstDesiredCluster,
+           DesiredClusters,
+           UseMftZone ? "TRUE" : "FALSE",
+           FirstAssignedCluster,
+           AssignedClusters);
+
+    if (DesiredClusters == 0)
+    {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Status = NtfsAcquireVolumeBitmap(DeviceExt);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    if (VolumeBitmap->FreeClusters < DesiredClusters)
+    {
+        ExReleaseResourceLite(&VolumeBitmap->Resource);
         return STATUS_DISK_FULL;
     }
 
-    // TODO: Observe MFT reservation zone
+    if (UseMftZone && FirstDesiredCluster == 0)
+    {
+        FirstDesiredCluster = VolumeBitmap->MftZoneStart;
+    }
 
-    // Can we get one contiguous run?
-    AssignedRun = RtlFindClearBitsAndSet(&Bitmap, DesiredClusters, FirstDesiredCluster);
+    // Extend the stream in place if we can
+    if (FirstDesiredCluster != 0 &&
+        FirstDesiredCluster < DeviceExt->NtfsInfo.ClusterCount &&
+        (UseMftZone || FirstDesiredCluster < VolumeBitmap->MftZoneStart || FirstDesiredCluster >= VolumeBitmap->MftZoneEnd))
+    {
+        RunLength = RtlFindNextForwardRunClear(&VolumeBitmap->Bitmap, (ULONG)FirstDesiredCluster, &RunStart);
+        if (RunLength != 0 && RunStart == FirstDesiredCluster)
+        {
+            Limit = FirstDesiredCluster + min(RunLength, DesiredClusters);
+            if (!UseMftZone && FirstDesiredCluster < VolumeBitmap->MftZoneStart)
+                Limit = min(Limit, VolumeBitmap->MftZoneStart);
+
+            *FirstAssignedCluster = FirstDesiredCluster;
+            *AssignedClusters = (ULONG)(Limit - FirstDesiredCluster);
+            Found = TRUE;
+        }
+    }
 
-    if (AssignedRun != 0xFFFFFFFF)
+    if (!Found && UseMftZone)
     {
-        *FirstAssignedCluster = AssignedRun;
-        *AssignedClusters = DesiredClusters;
+        // $MFT may go anywhere, the zone only keeps other files away
+        RunStart = RtlFindClearBits(&VolumeBitmap->Bitmap, DesiredClusters, (ULONG)FirstDesiredCluster);
+        if (RunStart != 0xFFFFFFFF)
+        {
+            *FirstAssignedCluster = RunStart;
+            *AssignedClusters = DesiredClusters;
+            Found = TRUE;
+        }
     }
-    else
+
+    if (!Found)
     {
-        // we can't get one contiguous run
-        *AssignedClusters = RtlFindNextForwardRunClear(&Bitmap, FirstDesiredCluster, FirstAssignedCluster);
+        Found = NtfsTakeFreeExtent(VolumeBitmap, DesiredClusters, FALSE, FirstAssignedCluster, AssignedClusters);
+        if (!Found && !VolumeBitmap->ExtentIndexComplete)
+        {
+            // Some free extents may not be indexed, look for a better one in the bitmap
+            NtfsRebuildFreeExtentIndex(DeviceExt);
+        }
+
+        if (!Found)
+            Found = NtfsTakeFreeExtent(VolumeBitmap, DesiredClusters, TRUE, FirstAssignedCluster, AssignedClusters);
+    }
 
-        if (*AssignedClusters == 0)
+    if (!Found)
+    {
+        // Nothing left outside of the MFT zone
+        RunLength = RtlFindLongestRunClear(&VolumeBitmap->Bitmap, &RunStart);
+        if (RunLength == 0)
         {
-            // we couldn't find any runs starting at DesiredFirstCluster
-            *AssignedClusters = RtlFindLongestRunClear(&Bitmap, FirstAssignedCluster);
+            ExReleaseResourceLite(&VolumeBitmap->Resource);
+            return STATUS_DISK_FULL;
         }
 
+        *FirstAssignedCluster = RunStart;
+        *AssignedClusters = min(RunLength, DesiredClusters);
     }
 
-    Status = WriteAttribute(DeviceExt, DataContext, 0, BitmapData, (ULONG)BitmapDataSize, &LengthWritten, BitmapRecord);
+    RtlSetBits(&VolumeBitmap->Bitmap, (ULONG)*FirstAssignedCluster, *AssignedClusters);
+    VolumeBitmap->FreeClusters -= *AssignedClusters;
+    NtfsMarkVolumeBitmapDirty(VolumeBitmap, (ULONG)*FirstAssignedCluster, *AssignedClusters);
 
-    ReleaseAttributeContext(DataContext);
+    ExReleaseResourceLite(&VolumeBitmap->Resource);
 
-    ExFreePoolWithTag(BitmapData, TAG_NTFS);
-    ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, BitmapRecord);
+    return STATUS_SUCCESS;
+}
 
-    return Status;
+/**
+* @name NtfsDeallocateClusters
+* @implemented
+*
+* Marks a run of clusters as free in the volume bitmap.
+*
+* @param DeviceExt
+* Pointer to the DEVICE_EXTENSION of the volume.
+*
+* @param FirstCluster
+* LCN of the first cluster of the run.
+*
+* @param ClusterCount
+* Number of clusters in the run.
+*
+* @return
+* STATUS_SUCCESS on success, STATUS_INVALID_PARAMETER if the run goes past the end of the volume.
+*/
+NTSTATUS
+NtfsDeallocateClusters(PDEVICE_EXTENSION DeviceExt,
+                       ULONGLONG FirstCluster,
+                       ULONG ClusterCount)
+{
+    PNTFS_VOLUME_BITMAP VolumeBitmap = &DeviceExt->VolumeBitmap;
+    NTSTATUS Status;
+    ULONG Cluster, RunStart, RunEnd;
+
+    DPRINT("NtfsDeallocateClusters(%p, %I64u, %lu)\n", DeviceExt, FirstCluster, ClusterCount);
+
+    if (ClusterCount == 0)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    if (FirstCluster + ClusterCount > DeviceExt->NtfsInfo.ClusterCount)
+    {
+        DPRINT1("Freeing clusters %I64u-%I64u beyond the end of the volume!\n", FirstCluster, FirstCluster + ClusterCount - 1);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Status = NtfsAcquireVolumeBitmap(DeviceExt);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    // Keep the free cluster count exact even if some clusters were free already
+    if (RtlAreBitsSet(&VolumeBitmap->Bitmap, (ULONG)FirstCluster, ClusterCount))
+    {
+        VolumeBitmap->FreeClusters += ClusterCount;
+    }
+    else
+    {
+        DPRINT1("Freeing clusters of %I64u-%I64u that are free already\n", FirstCluster, FirstCluster + ClusterCount - 1);
+        for (Cluster = (ULONG)FirstCluster; Cluster < FirstCluster + ClusterCount; Cluster++)
+        {
+            if (RtlCheckBit(&VolumeBitmap->Bitmap, Cluster))
+                VolumeBitmap->FreeClusters++;
+        }
+    }
+
+    RtlClearBits(&VolumeBitmap->Bitmap, (ULONG)FirstCluster, ClusterCount);
+    NtfsMarkVolumeBitmapDirty(VolumeBitmap, (ULONG)FirstCluster, ClusterCount);
+
+    // Index the whole free extent the run is now part of
+    RunStart = (ULONG)FirstCluster;
+    RunEnd = (ULONG)FirstCluster + ClusterCount;
+    if (RunStart != 0 && !RtlCheckBit(&VolumeBitmap->Bitmap, RunStart - 1))
+    {
+        RtlFindLastBackwardRunClear(&VolumeBitmap->Bitmap, RunStart - 1, &RunStart);
+    }
+    if (RunEnd < DeviceExt->NtfsInfo.ClusterCount && !RtlCheckBit(&VolumeBitmap->Bitmap, RunEnd))
+    {
+        RunEnd += RtlFindNextForwardRunClear(&VolumeBitmap->Bitmap, RunEnd, &Cluster);
+    }
+    NtfsIndexFreeRun(VolumeBitmap, RunStart, RunEnd - RunStart, FALSE);
+
+    ExReleaseResourceLite(&VolumeBitmap->Resource);
+
+    return STATUS_SUCCESS;
 }
 
 static
@@ -26,6 +26,10 @@ PUCHAR x86BiosMemoryMapping;
 /* This the physical address of the bios buffer */
 ULONG64 x86BiosBufferPhysical;
 
+/* Too large for the kernel stack with the code cache. Calls are serialized by
+   videoprt, and HalpBiosDisplayReset only runs once the system is stopped. */
+static FAST486_STATE x86BiosEmulatorContext;
+
 VOID
 NTAPI
 DbgDumpPage(PUCHAR MemBuffer, USHORT Segment)
@@ -297,6 +301,22 @@ x86MemWrite(
     }
 }
 
+static
+PVOID
+FASTCALL
+x86MemMap(
+    PFAST486_STATE State,
+    ULONG Address)
+{
+    /* Same range as above, the last page is left to the memory callbacks */
+    if (((ULONG64)Address + PAGE_SIZE) < 0x100000)
+    {
+        return x86BiosMemoryMapping + Address;
+    }
+
+    return NULL;
+}
+
 static
 BOOLEAN
 ValidatePort(
@@ -415,7 +435,7 @@ x86BiosCall(
     _Inout_ PX86_BIOS_REGISTERS Registers)
 {
     const ULONG StackBase = 0x2000;
-    FAST486_STATE EmulatorContext;
+    PFAST486_STATE EmulatorContext = &x86BiosEmulatorContext;
     ULONG FlatIp;
     PUCHAR InstructionPointer;
 
@@ -423,9 +443,10 @@ x86BiosCall(
         return FALSE;
 
     /* Initialize the emulator context */
-    Fast486Initialize(&EmulatorContext,
+    Fast486Initialize(EmulatorContext,
                       x86MemRead,
                       x86MemWrite,
+                      x86MemMap,
                       x86IoRead,
                       x86IoWrite,
                       x86BOP,
@@ -434,21 +455,21 @@ x86BiosCall(
                       NULL); // Tlb
 
     /* Copy the GP registers */
-    EmulatorContext.GeneralRegs[FAST486_REG_EAX].Long = Registers->Eax;
-    EmulatorContext.GeneralRegs[FAST486_REG_EBX].Long = Registers->Ebx;
-    EmulatorContext.GeneralRegs[FAST486_REG_ECX].Long = Registers->Ecx;
-    EmulatorContext.GeneralRegs[FAST486_REG_EDX].Long = Registers->Edx;
-    EmulatorContext.GeneralRegs[FAST486_REG_ESI].Long = Registers->Esi;
-    EmulatorContext.GeneralRegs[FAST486_REG_EDI].Long = Registers->Edi;
+    EmulatorContext->GeneralRegs[FAST486_REG_EAX].Long = Registers->Eax;
+    EmulatorContext->GeneralRegs[FAST486_REG_EBX].Long = Registers->Ebx;
+    EmulatorContext->GeneralRegs[FAST486_REG_ECX].Long = Registers->Ecx;
+    EmulatorContext->GeneralRegs[FAST486_REG_EDX].Long = Registers->Edx;
+    EmulatorContext->GeneralRegs[FAST486_REG_ESI].Long = Registers->Esi;
+    EmulatorContext->GeneralRegs[FAST486_REG_EDI].Long = Registers->Edi;
 
     /* Initialize segment registers */
-    Fast486SetSegment(&EmulatorContext, FAST486_REG_DS, Registers->SegDs);
-    Fast486SetSegment(&EmulatorContext, FAST486_REG_ES, Registers->SegEs);
+    Fast486SetSegment(EmulatorContext, FAST486_REG_DS, Registers->SegDs);
+    Fast486SetSegment(EmulatorContext, FAST486_REG_ES, Registers->SegEs);
 
     /* Set Eflags */
-    EmulatorContext.Flags.Long = 0;
-    EmulatorContext.Flags.AlwaysSet = 1;
-    EmulatorContext.Flags.If = 1;
+    EmulatorContext->Flags.Long = 0;
+    EmulatorContext->Flags.AlwaysSet = 1;
+    EmulatorContext->Flags.If = 1;
 
     /* Set up the INT stub */
     FlatIp = StackBase - 4;
@@ -458,16 +479,16 @@ x86BiosCall(
     InstructionPointer[2] = 0x90; // NOP. We will stop at this address.
 
     /* Set the stack pointer */
-    Fast486SetStack(&EmulatorContext, 0, StackBase - 8);
+    Fast486SetStack(EmulatorContext, 0, StackBase - 8);
 
     /* Start execution at the INT stub */
-    Fast486ExecuteAt(&EmulatorContext, 0x00, FlatIp);
+    Fast486ExecuteAt(EmulatorContext, 0x00, FlatIp);
 
     while (TRUE)
     {
         /* Get the current flat IP */
-        FlatIp = (EmulatorContext.SegmentRegs[FAST486_REG_CS].Selector << 4) +
-                 EmulatorContext.InstPtr.Long;
+        FlatIp = (EmulatorContext->SegmentRegs[FAST486_REG_CS].Selector << 4) +
+                 EmulatorContext->InstPtr.Long;
 
         /* Make sure we haven't left the allowed memory range */
         if (FlatIp >= 0x100000)
@@ -484,18 +505,18 @@ x86BiosCall(
         }
 
         /* Emulate one instruction */
-        Fast486StepInto(&EmulatorContext);
+        Fast486StepInto(EmulatorContext);
     }
 
     /* Copy the registers back */
-    Registers->Eax = EmulatorContext.GeneralRegs[FAST486_REG_EAX].Long;
-    Registers->Ebx = EmulatorContext.GeneralRegs[FAST486_REG_EBX].Long;
-    Registers->Ecx = EmulatorContext.GeneralRegs[FAST486_REG_ECX].Long;
-    Registers->Edx = EmulatorContext.GeneralRegs[FAST486_REG_EDX].Long;
-    Registers->Esi = EmulatorContext.GeneralRegs[FAST486_REG_ESI].Long;
-    Registers->Edi = EmulatorContext.GeneralRegs[FAST486_REG_EDI].Long;
-    Registers->SegDs = EmulatorContext.SegmentRegs[FAST486_REG_DS].Selector;
-    Registers->SegEs = EmulatorContext.SegmentRegs[FAST486_REG_ES].Selector;
+    Registers->Eax = EmulatorContext->GeneralRegs[FAST486_REG_EAX].Long;
+    Registers->Ebx = EmulatorContext->GeneralRegs[FAST486_REG_EBX].Long;
+    Registers->Ecx = EmulatorContext->GeneralRegs[FAST486_REG_ECX].Long;
+    Registers->Edx = EmulatorContext->GeneralRegs[FAST486_REG_EDX].Long;
+    Registers->Esi = EmulatorContext->GeneralRegs[FAST486_REG_ESI].Long;
+    Registers->Edi = EmulatorContext->GeneralRegs[FAST486_REG_EDI].Long;
+    Registers->SegDs = EmulatorContext->SegmentRegs[FAST486_REG_DS].Selector;
+    Registers->SegEs = EmulatorContext->SegmentRegs[FAST486_REG_ES].Selector;
 
     return TRUE;
 }
@@ -106,15 +106,23 @@
 
 #define FAST486_PAGE_SIZE 4096
 #define FAST486_CACHE_SIZE 32
+#define FAST486_CACHE_LINES 32
+#define FAST486_MEM_TLB_SETS 32
+#define FAST486_MEM_TLB_WAYS 2
 
 /*
  * These are condiciones sine quibus non that should be respected, because
  * otherwise when fetching DWORDs you would read extra garbage bytes
- * (by reading outside of the prefetch buffer). The prefetch cache must
- * also not cross a page boundary.
+ * (by reading outside of a code cache line). The lines are aligned on
+ * their size, which must be a power of two so that a line never crosses
+ * a page boundary.
  */
 C_ASSERT((FAST486_CACHE_SIZE >= sizeof(ULONG))
-         && (FAST486_CACHE_SIZE <= FAST486_PAGE_SIZE));
+         && (FAST486_CACHE_SIZE <= FAST486_PAGE_SIZE)
+         && ((FAST486_CACHE_SIZE & (FAST486_CACHE_SIZE - 1)) == 0)
+         && ((FAST486_CACHE_LINES & (FAST486_CACHE_LINES - 1)) == 0));
+
+C_ASSERT((FAST486_MEM_TLB_SETS & (FAST486_MEM_TLB_SETS - 1)) == 0);
 
 struct _FAST486_STATE;
 typedef struct _FAST486_STATE FAST486_STATE, *PFAST486_STATE;
@@ -200,6 +208,14 @@ VOID
     ULONG Size
 );
 
+typedef
+PVOID
+(FASTCALL *FAST486_MEM_MAP_PROC)
+(
+    PFAST486_STATE State,
+    ULONG Address
+);
+
 typedef
 VOID
 (FASTCALL *FAST486_IO_READ_PROC)
@@ -459,6 +475,22 @@ typedef union _FAST486_FLAGS_REG
     };
 } FAST486_FLAGS_REG, *PFAST486_FLAGS_REG;
 
+typedef struct _FAST486_LAZY_FLAGS
+{
+    ULONG Operation;
+    ULONG SignFlag;
+    ULONG FirstValue;
+    ULONG SecondValue;
+    ULONG Result;
+} FAST486_LAZY_FLAGS, *PFAST486_LAZY_FLAGS;
+
+typedef struct _FAST486_MEM_TLB_ENTRY
+{
+    ULONG Tag;
+    ULONG PageFrame;
+    PUCHAR HostPage;
+} FAST486_MEM_TLB_ENTRY, *PFAST486_MEM_TLB_ENTRY;
+
 typedef struct _FAST486_FPU_DATA_REG
 {
     ULONGLONG Mantissa;
@@ -515,6 +547,7 @@ struct _FAST486_STATE
 {
     FAST486_MEM_READ_PROC MemReadCallback;
     FAST486_MEM_WRITE_PROC MemWriteCallback;
+    FAST486_MEM_MAP_PROC MemMapCallback;
     FAST486_IO_READ_PROC IoReadCallback;
     FAST486_IO_WRITE_PROC IoWriteCallback;
     FAST486_BOP_PROC BopCallback;
@@ -525,6 +558,7 @@ struct _FAST486_STATE
     FAST486_REG InstPtr, SavedInstPtr;
     FAST486_REG SavedStackPtr;
     FAST486_FLAGS_REG Flags;
+    FAST486_LAZY_FLAGS LazyFlags;
     FAST486_TABLE_REG Gdtr, Idtr;
     FAST486_LDT_REG Ldtr;
     FAST486_TASK_REG TaskReg;
@@ -539,10 +573,11 @@ struct _FAST486_STATE
     BOOLEAN DoNotInterrupt;
     PULONG Tlb;
     BOOLEAN TlbEmpty;
+    FAST486_MEM_TLB_ENTRY MemTlb[FAST486_MEM_TLB_SETS][FAST486_MEM_TLB_WAYS];
 #ifndef FAST486_NO_PREFETCH
-    BOOLEAN PrefetchValid;
-    ULONG PrefetchAddress;
-    UCHAR PrefetchCache[FAST486_CACHE_SIZE];
+    ULONG CodeCacheTags[FAST486_CACHE_LINES];
+    ULONG CodeCachePages[FAST486_CACHE_LINES];
+    UCHAR CodeCache[FAST486_CACHE_LINES][FAST486_CACHE_SIZE];
 #endif
 #ifndef FAST486_NO_FPU
     FAST486_FPU_DATA_REG FpuRegisters[FAST486_NUM_FPU_REGS];
@@ -563,6 +598,7 @@ NTAPI
 Fast486Initialize(PFAST486_STATE         State,
                   FAST486_MEM_READ_PROC  MemReadCallback,
                   FAST486_MEM_WRITE_PROC MemWriteCallback,
+                  FAST486_MEM_MAP_PROC   MemMapCallback,
                   FAST486_IO_READ_PROC   IoReadCallback,
                   FAST486_IO_WRITE_PROC  IoWriteCallback,
                   FAST486_BOP_PROC       BopCallback,
@@ -619,6 +655,14 @@ VOID
 NTAPI
 Fast486Rewind(PFAST486_STATE State);
 
+VOID
+NTAPI
+Fast486InvalidateCache(PFAST486_STATE State);
+
+VOID
+NTAPI
+Fast486SyncFlags(PFAST486_STATE State);
+
 #endif // _FAST486_H_
 
 /* EOF */
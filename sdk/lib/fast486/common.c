@@ -29,6 +29,62 @@
 #include <fast486.h>
 #include "common.h"
 
+/* PRIVATE FUNCTIONS **********************************************************/
+
+#ifndef FAST486_NO_PREFETCH
+
+static
+BOOLEAN
+FASTCALL
+Fast486FillCodeCache(PFAST486_STATE State,
+                     ULONG LinearAddress)
+{
+    ULONG Tag = CODE_CACHE_TAG(LinearAddress);
+    ULONG Index = CODE_CACHE_INDEX(LinearAddress);
+    PUCHAR Line = State->CodeCache[Index];
+
+    /* The line is not valid until it has been read completely */
+    State->CodeCacheTags[Index] = INVALID_CACHE_TAG;
+
+    /*
+     * Read from the fetched byte to the end of the line first, so that
+     * a page fault reports the address of the fetch and not of the line.
+     */
+    if (!Fast486ReadLinearMemory(State,
+                                 LinearAddress,
+                                 &Line[LinearAddress - Tag],
+                                 FAST486_CACHE_SIZE - (LinearAddress - Tag),
+                                 TRUE))
+    {
+        /* Exception occurred */
+        return FALSE;
+    }
+
+    /* The beginning of the line is on the same page, so it can't fault */
+    if (LinearAddress != Tag)
+    {
+        Fast486ReadLinearMemory(State, Tag, Line, LinearAddress - Tag, FALSE);
+    }
+
+    /* Remember the physical page, writes may come through another mapping */
+    if (State->ControlRegisters[FAST486_REG_CR0] & FAST486_CR0_PG)
+    {
+        FAST486_PAGE_TABLE TableEntry;
+
+        TableEntry.Value = Fast486GetPageTableEntry(State, Tag, FALSE);
+        State->CodeCachePages[Index] = TableEntry.Address;
+    }
+    else
+    {
+        State->CodeCachePages[Index] = Tag >> 12;
+    }
+
+    State->CodeCacheTags[Index] = Tag;
+    return TRUE;
+}
+
+#endif
+
 /* PUBLIC FUNCTIONS ***********************************************************/
 
 BOOLEAN
@@ -111,44 +167,32 @@ Fast486ReadMemory(PFAST486_STATE State,
     LinearAddress = CachedDescriptor->Base + Offset;
 
 #ifndef FAST486_NO_PREFETCH
-    if (InstFetch && ((Offset + FAST486_CACHE_SIZE - 1) <= CachedDescriptor->Limit))
+    if (InstFetch)
     {
-        State->PrefetchAddress = LinearAddress;
+        PUCHAR Data = (PUCHAR)Buffer;
 
-        if ((State->ControlRegisters[FAST486_REG_CR0] & FAST486_CR0_PG)
-            && (PAGE_OFFSET(State->PrefetchAddress) > (FAST486_PAGE_SIZE - FAST486_CACHE_SIZE)))
+        /* Copy the code from the cache, line by line */
+        while (Size > 0)
         {
-            /* We mustn't prefetch across a page boundary */
-            State->PrefetchAddress = PAGE_ALIGN(State->PrefetchAddress)
-                                     | (FAST486_PAGE_SIZE - FAST486_CACHE_SIZE);
+            ULONG Index = CODE_CACHE_INDEX(LinearAddress);
+            ULONG LineOffset = CODE_CACHE_OFFSET(LinearAddress);
+            ULONG Length = min(Size, FAST486_CACHE_SIZE - LineOffset);
 
-            if ((LinearAddress - State->PrefetchAddress + Size) >= FAST486_CACHE_SIZE)
+            if ((State->CodeCacheTags[Index] != CODE_CACHE_TAG(LinearAddress))
+                && !Fast486FillCodeCache(State, LinearAddress))
             {
-                /* We can't prefetch without possibly violating page permissions */
-                State->PrefetchValid = FALSE;
-                return Fast486ReadLinearMemory(State, LinearAddress, Buffer, Size, TRUE);
+                /* Exception occurred */
+                return FALSE;
             }
-        }
 
-        /* Prefetch */
-        if (Fast486ReadLinearMemory(State,
-                                    State->PrefetchAddress,
-                                    State->PrefetchCache,
-                                    FAST486_CACHE_SIZE,
-                                    TRUE))
-        {
-            State->PrefetchValid = TRUE;
+            RtlMoveMemory(Data, &State->CodeCache[Index][LineOffset], Length);
 
-            RtlMoveMemory(Buffer,
-                          &State->PrefetchCache[LinearAddress - State->PrefetchAddress],
-                          Size);
-            return TRUE;
-        }
-        else
-        {
-            State->PrefetchValid = FALSE;
-            return FALSE;
+            Data += Length;
+            LinearAddress += Length;
+            Size -= Length;
         }
+
+        return TRUE;
     }
     else
 #endif
@@ -230,18 +274,6 @@ Fast486WriteMemory(PFAST486_STATE State,
     /* Find the linear address */
     LinearAddress = CachedDescriptor->Base + Offset;
 
-#ifndef FAST486_NO_PREFETCH
-    if (State->PrefetchValid
-        && (LinearAddress >= State->PrefetchAddress)
-        && ((LinearAddress + Size) <= (State->PrefetchAddress + FAST486_CACHE_SIZE)))
-    {
-        /* Update the prefetch */
-        RtlMoveMemory(&State->PrefetchCache[LinearAddress - State->PrefetchAddress],
-                      Buffer,
-                      min(Size, FAST486_CACHE_SIZE + State->PrefetchAddress - LinearAddress));
-    }
-#endif
-
     /* Write to the linear address */
     return Fast486WriteLinearMemory(State, LinearAddress, Buffer, Size, TRUE);
 }
@@ -304,9 +336,13 @@ Fast486InterruptInternal(PFAST486_STATE State,
                        (IdtEntry->Type == FAST486_IDT_TRAP_GATE_32);
     USHORT OldCs = State->SegmentRegs[FAST486_REG_CS].Selector;
     ULONG OldEip = State->InstPtr.Long;
-    ULONG OldFlags = State->Flags.Long;
+    ULONG OldFlags;
     UCHAR OldCpl = State->Cpl;
 
+    /* The flags pushed on the stack must be up to date */
+    Fast486UpdateFlags(State);
+    OldFlags = State->Flags.Long;
+
     /* Check for protected mode */
     if (State->ControlRegisters[FAST486_REG_CR0] & FAST486_CR0_PE)
     {
@@ -803,6 +839,7 @@ Fast486TaskSwitch(PFAST486_STATE State, FAST486_TASK_SWITCH_TYPE Type, USHORT Se
     }
 
     /* Save the current task into the TSS */
+    Fast486UpdateFlags(State);
     if (State->TaskReg.Modern)
     {
         OldTss.Cr3 = State->ControlRegisters[FAST486_REG_CR3];
@@ -908,8 +945,8 @@ Fast486TaskSwitch(PFAST486_STATE State, FAST486_TASK_SWITCH_TYPE Type, USHORT Se
     }
 
 #ifndef FAST486_NO_PREFETCH
-    /* Context switching invalidates the prefetch */
-    State->PrefetchValid = FALSE;
+    /* Context switching invalidates the code cache */
+    Fast486FlushCodeCache(State);
 #endif
 
     /* Load the registers */
@@ -1310,4 +1347,63 @@ Fast486CallGate(PFAST486_STATE State,
     return TRUE;
 }
 
+VOID
+FASTCALL
+Fast486CalculateLazyFlags(PFAST486_STATE State)
+{
+    BOOLEAN Carry = Fast486GetCarryFlag(State);
+    BOOLEAN Overflow = Fast486GetOverflowFlag(State);
+    BOOLEAN AuxCarry = Fast486GetAuxCarryFlag(State);
+    BOOLEAN Zero = Fast486GetZeroFlag(State);
+    BOOLEAN Sign = Fast486GetSignFlag(State);
+    BOOLEAN Parity = Fast486GetParityFlag(State);
+
+    State->Flags.Cf = Carry;
+    State->Flags.Of = Overflow;
+    State->Flags.Af = AuxCarry;
+    State->Flags.Zf = Zero;
+    State->Flags.Sf = Sign;
+    State->Flags.Pf = Parity;
+
+    /* The flags are up to date */
+    State->LazyFlags.Operation = FAST486_LAZY_NONE;
+}
+
+VOID
+FASTCALL
+Fast486FillMemTlb(PFAST486_STATE State,
+                  ULONG LinearAddress,
+                  ULONG PageFrame,
+                  ULONG Permissions)
+{
+    PFAST486_MEM_TLB_ENTRY Set;
+    PUCHAR HostPage;
+    ULONG Way = FAST486_MEM_TLB_WAYS - 1;
+    ULONG i;
+
+    /* MMIO, hooked and unmapped pages stay with the memory callbacks */
+    HostPage = State->MemMapCallback(State, PageFrame << 12);
+    if (HostPage == NULL) return;
+
+    Set = State->MemTlb[MEM_TLB_SET(LinearAddress)];
+
+    /* Replace the older entry of this page, or else the least recent one */
+    for (i = 0; i < FAST486_MEM_TLB_WAYS - 1; i++)
+    {
+        if ((Set[i].Tag & MEM_TLB_VALID)
+            && (PAGE_ALIGN(Set[i].Tag) == PAGE_ALIGN(LinearAddress)))
+        {
+            Way = i;
+            break;
+        }
+    }
+
+    /* The first way holds the most recent entry */
+    for (i = Way; i > 0; i--) Set[i] = Set[i - 1];
+
+    Set[0].Tag = PAGE_ALIGN(LinearAddress) | MEM_TLB_VALID | Permissions;
+    Set[0].PageFrame = PageFrame;
+    Set[0].HostPage = HostPage;
+}
+
 /* EOF */
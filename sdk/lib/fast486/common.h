@@ -71,6 +71,27 @@ if (State->PrefixFlags & FAST486_PREFIX_LOCK)\
 #define INVALID_TLB_FIELD 0xFFFFFFFF
 #define NUM_TLB_ENTRIES 0x100000
 
+#define CODE_CACHE_TAG(x)    ((x) & ~(FAST486_CACHE_SIZE - 1))
+#define CODE_CACHE_OFFSET(x) ((x) & (FAST486_CACHE_SIZE - 1))
+#define CODE_CACHE_INDEX(x)  (((x) / FAST486_CACHE_SIZE) & (FAST486_CACHE_LINES - 1))
+#define INVALID_CACHE_TAG    0xFFFFFFFF
+
+/* The memory TLB tags are page addresses, the low bits hold the permissions */
+#define MEM_TLB_SET(x)       (((x) >> 12) & (FAST486_MEM_TLB_SETS - 1))
+#define MEM_TLB_VALID        0x001
+#define MEM_TLB_USER         0x002
+#define MEM_TLB_WRITE        0x004
+
+/* Operations whose flags are pending in State->LazyFlags */
+#define FAST486_LAZY_NONE   0
+#define FAST486_LAZY_ADD    1
+#define FAST486_LAZY_ADC    2
+#define FAST486_LAZY_SUB    3
+#define FAST486_LAZY_SBB    4
+#define FAST486_LAZY_LOGIC  5
+#define FAST486_LAZY_INC    6
+#define FAST486_LAZY_DEC    7
+
 typedef struct _FAST486_MOD_REG_RM
 {
     FAST486_GEN_REGS Register;
@@ -194,6 +215,23 @@ Fast486CallGate
     BOOLEAN Call
 );
 
+VOID
+FASTCALL
+Fast486CalculateLazyFlags
+(
+    PFAST486_STATE State
+);
+
+VOID
+FASTCALL
+Fast486FillMemTlb
+(
+    PFAST486_STATE State,
+    ULONG LinearAddress,
+    ULONG PageFrame,
+    ULONG Permissions
+);
+
 /* INLINED FUNCTIONS **********************************************************/
 
 #include "common.inl"
@@ -145,16 +145,190 @@ Fast486GetPageTableEntry(PFAST486_STATE State,
     return TableEntry.Value;
 }
 
+FORCEINLINE
+VOID
+FASTCALL
+Fast486FlushMemTlb(PFAST486_STATE State)
+{
+    /* An entry without the valid bit never matches */
+    RtlZeroMemory(State->MemTlb, sizeof(State->MemTlb));
+}
+
 FORCEINLINE
 VOID
 FASTCALL
 Fast486FlushTlb(PFAST486_STATE State)
 {
+    Fast486FlushMemTlb(State);
+
     if (!State->Tlb || State->TlbEmpty) return;
     RtlFillMemory(State->Tlb, NUM_TLB_ENTRIES * sizeof(ULONG), 0xFF);
     State->TlbEmpty = TRUE;
 }
 
+FORCEINLINE
+VOID
+FASTCALL
+Fast486InvalidateMemTlb(PFAST486_STATE State,
+                        ULONG LinearAddress)
+{
+    PFAST486_MEM_TLB_ENTRY Set = State->MemTlb[MEM_TLB_SET(LinearAddress)];
+    ULONG i;
+
+    for (i = 0; i < FAST486_MEM_TLB_WAYS; i++)
+    {
+        if (PAGE_ALIGN(Set[i].Tag) == PAGE_ALIGN(LinearAddress)) Set[i].Tag = 0;
+    }
+}
+
+FORCEINLINE
+PFAST486_MEM_TLB_ENTRY
+FASTCALL
+Fast486LookupMemTlb(PFAST486_STATE State,
+                    ULONG LinearAddress,
+                    ULONG Size,
+                    ULONG Access)
+{
+    PFAST486_MEM_TLB_ENTRY Set = State->MemTlb[MEM_TLB_SET(LinearAddress)];
+    ULONG Mask = PAGE_ALIGN(0xFFFFFFFF) | MEM_TLB_VALID | Access;
+    ULONG Tag = PAGE_ALIGN(LinearAddress) | MEM_TLB_VALID | Access;
+    ULONG i;
+
+    /* Only the accesses which stay within one page can use the host page */
+    if ((PAGE_OFFSET(LinearAddress) + Size) > FAST486_PAGE_SIZE) return NULL;
+
+    for (i = 0; i < FAST486_MEM_TLB_WAYS; i++)
+    {
+        /* The entry must allow at least the requested access */
+        if ((Set[i].Tag & Mask) == Tag) return &Set[i];
+    }
+
+    return NULL;
+}
+
+FORCEINLINE
+ULONG
+FASTCALL
+Fast486GetPagePermissions(PFAST486_STATE State,
+                          FAST486_PAGE_TABLE TableEntry)
+{
+    ULONG Permissions = 0;
+
+    if (TableEntry.Usermode) Permissions |= MEM_TLB_USER;
+
+    /*
+     * Direct writes would not set the dirty bit, so the page must be dirty
+     * already, and writable as far as Fast486WriteLinearMemory is concerned.
+     */
+    if (TableEntry.Dirty
+        && (TableEntry.Writeable
+        || !(State->ControlRegisters[FAST486_REG_CR0] & FAST486_CR0_WP)))
+    {
+        Permissions |= MEM_TLB_WRITE;
+    }
+
+    return Permissions;
+}
+
+FORCEINLINE
+VOID
+FASTCALL
+Fast486CopyGuestMemory(PVOID Destination,
+                       PVOID Source,
+                       ULONG Size)
+{
+    /* The fixed sizes let the compiler use a single move */
+    switch (Size)
+    {
+        case sizeof(UCHAR):
+        {
+            RtlCopyMemory(Destination, Source, sizeof(UCHAR));
+            break;
+        }
+
+        case sizeof(USHORT):
+        {
+            RtlCopyMemory(Destination, Source, sizeof(USHORT));
+            break;
+        }
+
+        case sizeof(ULONG):
+        {
+            RtlCopyMemory(Destination, Source, sizeof(ULONG));
+            break;
+        }
+
+        default:
+        {
+            RtlCopyMemory(Destination, Source, Size);
+        }
+    }
+}
+
+#ifndef FAST486_NO_PREFETCH
+
+FORCEINLINE
+VOID
+FASTCALL
+Fast486FlushCodeCache(PFAST486_STATE State)
+{
+    /* The line addresses are aligned, so this tag never matches */
+    RtlFillMemory(State->CodeCacheTags, sizeof(State->CodeCacheTags), 0xFF);
+}
+
+FORCEINLINE
+VOID
+FASTCALL
+Fast486InvalidateCodeCache(PFAST486_STATE State,
+                           ULONG LinearAddress,
+                           ULONG Size)
+{
+    ULONG FirstLine = CODE_CACHE_TAG(LinearAddress);
+    ULONG Span = CODE_CACHE_TAG(LinearAddress + Size - 1) - FirstLine;
+    ULONG i;
+
+    if (Span <= FAST486_CACHE_SIZE)
+    {
+        /* The write covers at most two lines, check only those */
+        i = CODE_CACHE_INDEX(FirstLine);
+        if (State->CodeCacheTags[i] == FirstLine) State->CodeCacheTags[i] = INVALID_CACHE_TAG;
+
+        i = CODE_CACHE_INDEX(FirstLine + Span);
+        if (State->CodeCacheTags[i] == FirstLine + Span) State->CodeCacheTags[i] = INVALID_CACHE_TAG;
+    }
+    else
+    {
+        /* String operations write whole blocks, check every line */
+        for (i = 0; i < FAST486_CACHE_LINES; i++)
+        {
+            if ((State->CodeCacheTags[i] - FirstLine) <= Span)
+            {
+                State->CodeCacheTags[i] = INVALID_CACHE_TAG;
+            }
+        }
+    }
+}
+
+FORCEINLINE
+VOID
+FASTCALL
+Fast486InvalidateCodePage(PFAST486_STATE State,
+                          ULONG PageFrame)
+{
+    ULONG i;
+
+    /*
+     * With paging, the same physical page can be mapped at several
+     * linear addresses, so the lines are found by their physical page.
+     */
+    for (i = 0; i < FAST486_CACHE_LINES; i++)
+    {
+        if (State->CodeCachePages[i] == PageFrame) State->CodeCacheTags[i] = INVALID_CACHE_TAG;
+    }
+}
+
+#endif
+
 FORCEINLINE
 BOOLEAN
 FASTCALL
@@ -164,12 +338,26 @@ Fast486ReadLinearMemory(PFAST486_STATE State,
                         ULONG Size,
                         BOOLEAN CheckPrivilege)
 {
+    INT Cpl = Fast486GetCurrentPrivLevel(State);
+    PFAST486_MEM_TLB_ENTRY Entry;
+
+    /* Check if the page is known to be plain RAM */
+    Entry = Fast486LookupMemTlb(State,
+                                LinearAddress,
+                                Size,
+                                (CheckPrivilege && (Cpl > 0)) ? MEM_TLB_USER : 0);
+    if (Entry != NULL)
+    {
+        /* Read it directly */
+        Fast486CopyGuestMemory(Buffer, Entry->HostPage + PAGE_OFFSET(LinearAddress), Size);
+        return TRUE;
+    }
+
     /* Check if paging is enabled */
     if (State->ControlRegisters[FAST486_REG_CR0] & FAST486_CR0_PG)
     {
         ULONG Page;
         FAST486_PAGE_TABLE TableEntry;
-        INT Cpl = Fast486GetCurrentPrivLevel(State);
         ULONG BufferOffset = 0;
 
         for (Page = PAGE_ALIGN(LinearAddress);
@@ -207,6 +395,15 @@ Fast486ReadLinearMemory(PFAST486_STATE State,
                 PageLength = PAGE_OFFSET(LinearAddress + Size - 1) - PageOffset + 1;
             }
 
+            if (TableEntry.Present && (State->MemMapCallback != NULL))
+            {
+                /* Cache the page, writes must still go through here until it is dirty */
+                Fast486FillMemTlb(State,
+                                  Page,
+                                  TableEntry.Address,
+                                  Fast486GetPagePermissions(State, TableEntry));
+            }
+
             /* Read the memory */
             State->MemReadCallback(State,
                                    (TableEntry.Address << 12) | PageOffset,
@@ -218,6 +415,15 @@ Fast486ReadLinearMemory(PFAST486_STATE State,
     }
     else
     {
+        if (State->MemMapCallback != NULL)
+        {
+            /* Without paging, every access is allowed */
+            Fast486FillMemTlb(State,
+                              LinearAddress,
+                              LinearAddress >> 12,
+                              MEM_TLB_USER | MEM_TLB_WRITE);
+        }
+
         /* Read the memory */
         State->MemReadCallback(State, LinearAddress, Buffer, Size);
     }
@@ -234,12 +440,39 @@ Fast486WriteLinearMemory(PFAST486_STATE State,
                          ULONG Size,
                          BOOLEAN CheckPrivilege)
 {
+    INT Cpl = Fast486GetCurrentPrivLevel(State);
+    PFAST486_MEM_TLB_ENTRY Entry;
+
+    /* Check if the page is known to be plain, writable and dirty RAM */
+    Entry = Fast486LookupMemTlb(State,
+                                LinearAddress,
+                                Size,
+                                MEM_TLB_WRITE | ((CheckPrivilege && (Cpl > 0)) ? MEM_TLB_USER : 0));
+    if (Entry != NULL)
+    {
+#ifndef FAST486_NO_PREFETCH
+        if (State->ControlRegisters[FAST486_REG_CR0] & FAST486_CR0_PG)
+        {
+            /* Drop the cached code of this page, through any mapping */
+            Fast486InvalidateCodePage(State, Entry->PageFrame);
+        }
+        else
+        {
+            /* Drop the cached code which this write modifies */
+            Fast486InvalidateCodeCache(State, LinearAddress, Size);
+        }
+#endif
+
+        /* Write it directly */
+        Fast486CopyGuestMemory(Entry->HostPage + PAGE_OFFSET(LinearAddress), Buffer, Size);
+        return TRUE;
+    }
+
     /* Check if paging is enabled */
     if (State->ControlRegisters[FAST486_REG_CR0] & FAST486_CR0_PG)
     {
         ULONG Page;
         FAST486_PAGE_TABLE TableEntry;
-        INT Cpl = Fast486GetCurrentPrivLevel(State);
         ULONG BufferOffset = 0;
 
         for (Page = PAGE_ALIGN(LinearAddress);
@@ -280,6 +513,20 @@ Fast486WriteLinearMemory(PFAST486_STATE State,
                 PageLength = PAGE_OFFSET(LinearAddress + Size - 1) - PageOffset + 1;
             }
 
+            if (TableEntry.Present && (State->MemMapCallback != NULL))
+            {
+                /* Cache the page, it is dirty now */
+                Fast486FillMemTlb(State,
+                                  Page,
+                                  TableEntry.Address,
+                                  Fast486GetPagePermissions(State, TableEntry));
+            }
+
+#ifndef FAST486_NO_PREFETCH
+            /* Drop the cached code of this page, through any mapping */
+            Fast486InvalidateCodePage(State, TableEntry.Address);
+#endif
+
             /* Write the memory */
             State->MemWriteCallback(State,
                                     (TableEntry.Address << 12) | PageOffset,
@@ -291,6 +538,20 @@ Fast486WriteLinearMemory(PFAST486_STATE State,
     }
     else
     {
+#ifndef FAST486_NO_PREFETCH
+        /* Drop the cached code which this write modifies */
+        Fast486InvalidateCodeCache(State, LinearAddress, Size);
+#endif
+
+        if (State->MemMapCallback != NULL)
+        {
+            /* Without paging, every access is allowed */
+            Fast486FillMemTlb(State,
+                              LinearAddress,
+                              LinearAddress >> 12,
+                              MEM_TLB_USER | MEM_TLB_WRITE);
+        }
+
         /* Write the memory */
         State->MemWriteCallback(State, LinearAddress, Buffer, Size);
     }
@@ -569,6 +830,18 @@ Fast486LoadSegmentInternal(PFAST486_STATE State,
     /* Get the cached descriptor */
     CachedDescriptor = &State->SegmentRegs[Segment];
 
+#ifndef FAST486_NO_PREFETCH
+    if ((Segment == FAST486_REG_CS)
+        && (State->ControlRegisters[FAST486_REG_CR0] & FAST486_CR0_PG))
+    {
+        /*
+         * The privilege level can change with CS, and the cached code
+         * was only checked against the page permissions of the old one.
+         */
+        Fast486FlushCodeCache(State);
+    }
+#endif
+
     /* Check for protected mode */
     if (State->ControlRegisters[FAST486_REG_CR0] & FAST486_CR0_PE)
     {
@@ -641,11 +914,6 @@ Fast486LoadSegmentInternal(PFAST486_STATE State,
         {
             /* Loading the code segment */
 
-#ifndef FAST486_NO_PREFETCH
-            /* Invalidate the prefetch */
-            State->PrefetchValid = FALSE;
-#endif
-
             if (!(Selector & SEGMENT_TABLE_INDICATOR) && GET_SEGMENT_INDEX(Selector) == 0)
             {
                 Fast486Exception(State, Exception);
@@ -862,7 +1130,7 @@ Fast486FetchByte(PFAST486_STATE State,
     PFAST486_SEG_REG CachedDescriptor;
     ULONG Offset;
 #ifndef FAST486_NO_PREFETCH
-    ULONG LinearAddress;
+    ULONG LinearAddress, Index;
 #endif
 
     /* Get the cached descriptor of CS */
@@ -873,11 +1141,12 @@ Fast486FetchByte(PFAST486_STATE State,
 #ifndef FAST486_NO_PREFETCH
     LinearAddress = CachedDescriptor->Base + Offset;
 
-    if (State->PrefetchValid
-        && (LinearAddress >= State->PrefetchAddress)
-        && ((LinearAddress + sizeof(UCHAR)) <= (State->PrefetchAddress + FAST486_CACHE_SIZE)))
+    Index = CODE_CACHE_INDEX(LinearAddress);
+
+    if ((State->CodeCacheTags[Index] == CODE_CACHE_TAG(LinearAddress))
+        && (Offset <= CachedDescriptor->Limit))
     {
-        *Data = *(PUCHAR)&State->PrefetchCache[LinearAddress - State->PrefetchAddress];
+        *Data = State->CodeCache[Index][CODE_CACHE_OFFSET(LinearAddress)];
     }
     else
 #endif
@@ -911,7 +1180,7 @@ Fast486FetchWord(PFAST486_STATE State,
     PFAST486_SEG_REG CachedDescriptor;
     ULONG Offset;
 #ifndef FAST486_NO_PREFETCH
-    ULONG LinearAddress;
+    ULONG LinearAddress, Index;
 #endif
 
     /* Get the cached descriptor of CS */
@@ -923,11 +1192,13 @@ Fast486FetchWord(PFAST486_STATE State,
 #ifndef FAST486_NO_PREFETCH
     LinearAddress = CachedDescriptor->Base + Offset;
 
-    if (State->PrefetchValid
-        && (LinearAddress >= State->PrefetchAddress)
-        && ((LinearAddress + sizeof(USHORT)) <= (State->PrefetchAddress + FAST486_CACHE_SIZE)))
+    Index = CODE_CACHE_INDEX(LinearAddress);
+
+    if ((State->CodeCacheTags[Index] == CODE_CACHE_TAG(LinearAddress))
+        && (CODE_CACHE_OFFSET(LinearAddress) <= (FAST486_CACHE_SIZE - sizeof(USHORT)))
+        && ((Offset + sizeof(USHORT) - 1) <= CachedDescriptor->Limit))
     {
-        *Data = *(PUSHORT)&State->PrefetchCache[LinearAddress - State->PrefetchAddress];
+        *Data = *(PUSHORT)&State->CodeCache[Index][CODE_CACHE_OFFSET(LinearAddress)];
     }
     else
 #endif
@@ -962,7 +1233,7 @@ Fast486FetchDword(PFAST486_STATE State,
     PFAST486_SEG_REG CachedDescriptor;
     ULONG Offset;
 #ifndef FAST486_NO_PREFETCH
-    ULONG LinearAddress;
+    ULONG LinearAddress, Index;
 #endif
 
     /* Get the cached descriptor of CS */
@@ -974,11 +1245,13 @@ Fast486FetchDword(PFAST486_STATE State,
 #ifndef FAST486_NO_PREFETCH
     LinearAddress = CachedDescriptor->Base + Offset;
 
-    if (State->PrefetchValid
-        && (LinearAddress >= State->PrefetchAddress)
-        && ((LinearAddress + sizeof(ULONG)) <= (State->PrefetchAddress + FAST486_CACHE_SIZE)))
+    Index = CODE_CACHE_INDEX(LinearAddress);
+
+    if ((State->CodeCacheTags[Index] == CODE_CACHE_TAG(LinearAddress))
+        && (CODE_CACHE_OFFSET(LinearAddress) <= (FAST486_CACHE_SIZE - sizeof(ULONG)))
+        && ((Offset + sizeof(ULONG) - 1) <= CachedDescriptor->Limit))
     {
-        *Data = *(PULONG)&State->PrefetchCache[LinearAddress - State->PrefetchAddress];
+        *Data = *(PULONG)&State->CodeCache[Index][CODE_CACHE_OFFSET(LinearAddress)];
     }
     else
 #endif
@@ -1013,6 +1286,208 @@ Fast486CalculateParity(UCHAR Number)
     return (0x9669 >> ((Number & 0x0F) ^ (Number >> 4))) & 1;
 }
 
+/*
+ * The arithmetic instructions only record their operands and result in
+ * State->LazyFlags, the flags are computed from them when something reads
+ * them. While an operation is pending, the CF, PF, AF, ZF, SF and OF bits of
+ * State->Flags are stale and must be read through the functions below.
+ */
+
+FORCEINLINE
+VOID
+FASTCALL
+Fast486SetLazyFlags(PFAST486_STATE State,
+                    ULONG Operation,
+                    ULONG SignFlag,
+                    ULONG FirstValue,
+                    ULONG SecondValue,
+                    ULONG Result)
+{
+    State->LazyFlags.Operation = Operation;
+    State->LazyFlags.SignFlag = SignFlag;
+    State->LazyFlags.FirstValue = FirstValue;
+    State->LazyFlags.SecondValue = SecondValue;
+    State->LazyFlags.Result = Result;
+}
+
+FORCEINLINE
+BOOLEAN
+FASTCALL
+Fast486GetCarryFlag(PFAST486_STATE State)
+{
+    PFAST486_LAZY_FLAGS Lazy = &State->LazyFlags;
+    ULONG MaxValue = (Lazy->SignFlag - 1) | Lazy->SignFlag;
+
+    switch (Lazy->Operation)
+    {
+        case FAST486_LAZY_ADD:
+        {
+            return (Lazy->Result < Lazy->FirstValue);
+        }
+
+        case FAST486_LAZY_ADC:
+        {
+            /* The carry that was added is whatever the operands don't explain */
+            if ((Lazy->Result - Lazy->FirstValue - Lazy->SecondValue) & MaxValue)
+            {
+                return (Lazy->Result <= Lazy->FirstValue);
+            }
+
+            return (Lazy->Result < Lazy->FirstValue);
+        }
+
+        case FAST486_LAZY_SUB:
+        {
+            return (Lazy->FirstValue < Lazy->SecondValue);
+        }
+
+        case FAST486_LAZY_SBB:
+        {
+            if ((Lazy->FirstValue - Lazy->SecondValue - Lazy->Result) & MaxValue)
+            {
+                return (Lazy->FirstValue <= Lazy->SecondValue);
+            }
+
+            return (Lazy->FirstValue < Lazy->SecondValue);
+        }
+
+        case FAST486_LAZY_LOGIC:
+        {
+            return FALSE;
+        }
+
+        default:
+        {
+            /* INC and DEC don't change CF */
+            return State->Flags.Cf;
+        }
+    }
+}
+
+FORCEINLINE
+BOOLEAN
+FASTCALL
+Fast486GetOverflowFlag(PFAST486_STATE State)
+{
+    PFAST486_LAZY_FLAGS Lazy = &State->LazyFlags;
+
+    switch (Lazy->Operation)
+    {
+        case FAST486_LAZY_ADD:
+        case FAST486_LAZY_ADC:
+        case FAST486_LAZY_INC:
+        {
+            /* The operands have the same sign, and the result doesn't */
+            return ((Lazy->FirstValue ^ Lazy->Result)
+                    & (Lazy->SecondValue ^ Lazy->Result)
+                    & Lazy->SignFlag) != 0;
+        }
+
+        case FAST486_LAZY_SUB:
+        case FAST486_LAZY_SBB:
+        case FAST486_LAZY_DEC:
+        {
+            /* The operands have different signs, and the result has the sign of the second */
+            return ((Lazy->FirstValue ^ Lazy->SecondValue)
+                    & (Lazy->FirstValue ^ Lazy->Result)
+                    & Lazy->SignFlag) != 0;
+        }
+
+        case FAST486_LAZY_LOGIC:
+        {
+            return FALSE;
+        }
+
+        default:
+        {
+            return State->Flags.Of;
+        }
+    }
+}
+
+FORCEINLINE
+BOOLEAN
+FASTCALL
+Fast486GetAuxCarryFlag(PFAST486_STATE State)
+{
+    PFAST486_LAZY_FLAGS Lazy = &State->LazyFlags;
+
+    if (Lazy->Operation == FAST486_LAZY_NONE) return State->Flags.Af;
+
+    /* This is the carry into bit 4, the logical operations store the old AF there */
+    return ((Lazy->FirstValue ^ Lazy->SecondValue ^ Lazy->Result) & 0x10) != 0;
+}
+
+FORCEINLINE
+BOOLEAN
+FASTCALL
+Fast486GetZeroFlag(PFAST486_STATE State)
+{
+    if (State->LazyFlags.Operation == FAST486_LAZY_NONE) return State->Flags.Zf;
+    return (State->LazyFlags.Result == 0);
+}
+
+FORCEINLINE
+BOOLEAN
+FASTCALL
+Fast486GetSignFlag(PFAST486_STATE State)
+{
+    if (State->LazyFlags.Operation == FAST486_LAZY_NONE) return State->Flags.Sf;
+    return ((State->LazyFlags.Result & State->LazyFlags.SignFlag) != 0);
+}
+
+FORCEINLINE
+BOOLEAN
+FASTCALL
+Fast486GetParityFlag(PFAST486_STATE State)
+{
+    if (State->LazyFlags.Operation == FAST486_LAZY_NONE) return State->Flags.Pf;
+    return Fast486CalculateParity(LOBYTE(State->LazyFlags.Result));
+}
+
+FORCEINLINE
+VOID
+FASTCALL
+Fast486SetLazyLogicFlags(PFAST486_STATE State,
+                         ULONG SignFlag,
+                         ULONG Result)
+{
+    /* AND, OR, XOR and TEST keep AF, which must survive in the record */
+    ULONG AuxCarry = Fast486GetAuxCarryFlag(State) ? 0x10 : 0;
+
+    Fast486SetLazyFlags(State, FAST486_LAZY_LOGIC, SignFlag, Result, AuxCarry, Result);
+}
+
+FORCEINLINE
+VOID
+FASTCALL
+Fast486SetLazyIncDecFlags(PFAST486_STATE State,
+                          ULONG Operation,
+                          ULONG SignFlag,
+                          ULONG Value)
+{
+    /* INC and DEC keep CF, which is stored before it's overwritten */
+    State->Flags.Cf = Fast486GetCarryFlag(State);
+
+    if (Operation == FAST486_LAZY_INC)
+    {
+        Fast486SetLazyFlags(State, Operation, SignFlag, Value - 1, 1, Value);
+    }
+    else
+    {
+        Fast486SetLazyFlags(State, Operation, SignFlag, Value + 1, 1, Value);
+    }
+}
+
+FORCEINLINE
+VOID
+FASTCALL
+Fast486UpdateFlags(PFAST486_STATE State)
+{
+    /* Store the pending flags in State->Flags */
+    if (State->LazyFlags.Operation != FAST486_LAZY_NONE) Fast486CalculateLazyFlags(State);
+}
+
 FORCEINLINE
 BOOLEAN
 FASTCALL
@@ -78,6 +78,9 @@ NextInst:
 
             // TODO: Check for CALL/RET to update ProcedureCallCount.
 
+            /* Compute the pending flags if the handler needs them */
+            if (!Fast486OpcodeLazyFlags[Opcode]) Fast486UpdateFlags(State);
+
             /* Call the opcode handler */
             CurrentHandler = Fast486OpcodeHandlers[Opcode];
             CurrentHandler(State, Opcode);
@@ -126,6 +129,9 @@ VOID
 NTAPI
 Fast486DumpState(PFAST486_STATE State)
 {
+    /* Show the real flags */
+    Fast486UpdateFlags(State);
+
     DbgPrint("\nFast486DumpState -->\n");
     DbgPrint("\nCPU currently executing in %s mode at %04X:%08X\n",
             (State->ControlRegisters[FAST486_REG_CR0] & FAST486_CR0_PE) ? "protected" : "real",
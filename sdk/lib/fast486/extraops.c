@@ -295,6 +295,28 @@ Fast486ExtendedHandlers[FAST486_NUM_OPCODE_HANDLERS] =
     Fast486ExtOpcodeInvalid,                                // Invalid
 };
 
+/* Same as Fast486OpcodeLazyFlags, for the second byte of the opcode */
+const UCHAR
+Fast486ExtendedLazyFlags[FAST486_NUM_OPCODE_HANDLERS] =
+{
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x00 - 0x0F */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x10 - 0x1F */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x20 - 0x2F */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x30 - 0x3F */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x40 - 0x4F */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x50 - 0x5F */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x60 - 0x6F */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0x70 - 0x7F */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0x80 - 0x8F */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0x90 - 0x9F */
+    1, 1, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, /* 0xA0 - 0xAF */
+    0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 1, 1, /* 0xB0 - 0xBF */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0xC0 - 0xCF */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0xD0 - 0xDF */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 0xE0 - 0xEF */
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0  /* 0xF0 - 0xFF */
+};
+
 /* PUBLIC FUNCTIONS ***********************************************************/
 
 FAST486_OPCODE_HANDLER(Fast486ExtOpcodeInvalid)
@@ -636,8 +658,8 @@ FAST486_OPCODE_HANDLER(Fast486ExtOpcodeLoadControlReg)
     }
 
 #ifndef FAST486_NO_PREFETCH
-    /* Changing CR0 or CR3 can interfere with prefetching (because of paging) */
-    State->PrefetchValid = FALSE;
+    /* Changing CR0 or CR3 changes the mapping of the cached code (because of paging) */
+    Fast486FlushCodeCache(State);
 #endif
 
     if (ModRegRm.Register == (FAST486_GEN_REGS)FAST486_REG_CR3)
@@ -645,6 +667,11 @@ FAST486_OPCODE_HANDLER(Fast486ExtOpcodeLoadControlReg)
         /* Flush the TLB */
         Fast486FlushTlb(State);
     }
+    else if (ModRegRm.Register == (FAST486_GEN_REGS)FAST486_REG_CR0)
+    {
+        /* The memory TLB also depends on the paging and write protection bits */
+        Fast486FlushMemTlb(State);
+    }
 
     /* Load a value to the control register */
     State->ControlRegisters[ModRegRm.Register] = Value;
@@ -1882,56 +1909,57 @@ FAST486_OPCODE_HANDLER(Fast486ExtOpcodeConditionalJmp)
         /* JO / JNO */
         case 0:
         {
-            Jump = State->Flags.Of;
+            Jump = Fast486GetOverflowFlag(State);
             break;
         }
 
         /* JC / JNC */
         case 1:
         {
-            Jump = State->Flags.Cf;
+            Jump = Fast486GetCarryFlag(State);
             break;
         }
 
         /* JZ / JNZ */
         case 2:
         {
-            Jump = State->Flags.Zf;
+            Jump = Fast486GetZeroFlag(State);
             break;
         }
 
         /* JBE / JNBE */
         case 3:
         {
-            Jump = State->Flags.Cf || State->Flags.Zf;
+            Jump = Fast486GetCarryFlag(State) || Fast486GetZeroFlag(State);
             break;
         }
 
         /* JS / JNS */
         case 4:
         {
-            Jump = State->Flags.Sf;
+            Jump = Fast486GetSignFlag(State);
             break;
         }
 
         /* JP / JNP */
         case 5:
         {
-            Jump = State->Flags.Pf;
+            Jump = Fast486GetParityFlag(State);
             break;
         }
 
         /* JL / JNL */
         case 6:
         {
-            Jump = State->Flags.Sf != State->Flags.Of;
+            Jump = Fast486GetSignFlag(State) != Fast486GetOverflowFlag(State);
             break;
         }
 
         /* JLE / JNLE */
         case 7:
         {
-            Jump = (State->Flags.Sf != State->Flags.Of) || State->Flags.Zf;
+            Jump = (Fast486GetSignFlag(State) != Fast486GetOverflowFlag(State))
+                   || Fast486GetZeroFlag(State);
             break;
         }
     }
@@ -1972,56 +2000,57 @@ FAST486_OPCODE_HANDLER(Fast486ExtOpcodeConditionalSet)
         /* SETO / SETNO */
         case 0:
         {
-            Value = State->Flags.Of;
+            Value = Fast486GetOverflowFlag(State);
             break;
         }
 
         /* SETC / SETNC */
         case 1:
         {
-            Value = State->Flags.Cf;
+            Value = Fast486GetCarryFlag(State);
             break;
         }
 
         /* SETZ / SETNZ */
         case 2:
         {
-            Value = State->Flags.Zf;
+            Value = Fast486GetZeroFlag(State);
             break;
         }
 
         /* SETBE / SETNBE */
         case 3:
         {
-            Value = State->Flags.Cf || State->Flags.Zf;
+            Value = Fast486GetCarryFlag(State) || Fast486GetZeroFlag(State);
             break;
         }
 
         /* SETS / SETNS */
         case 4:
         {
-            Value = State->Flags.Sf;
+            Value = Fast486GetSignFlag(State);
             break;
         }
 
         /* SETP / SETNP */
         case 5:
         {
-            Value = State->Flags.Pf;
+            Value = Fast486GetParityFlag(State);
             break;
         }
 
         /* SETL / SETNL */
         case 6:
         {
-            Value = State->Flags.Sf != State->Flags.Of;
+            Value = Fast486GetSignFlag(State) != Fast486GetOverflowFlag(State);
             break;
         }
 
         /* SETLE / SETNLE */
         case 7:
         {
-            Value = (State->Flags.Sf != State->Flags.Of) || State->Flags.Zf;
+            Value = (Fast486GetSignFlag(State) != Fast486GetOverflowFlag(State))
+                    || Fast486GetZeroFlag(State);
             break;
         }
     }
@@ -2204,6 +2233,9 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeExtended)
         return;
     }
 
+    /* Compute the pending flags if the handler needs them */
+    if (!Fast486ExtendedLazyFlags[SecondOpcode]) Fast486UpdateFlags(State);
+
     /* Call the extended opcode handler */
     Fast486ExtendedHandlers[SecondOpcode](State, SecondOpcode);
 }
@@ -103,6 +103,7 @@ NTAPI
 Fast486Initialize(PFAST486_STATE         State,
                   FAST486_MEM_READ_PROC  MemReadCallback,
                   FAST486_MEM_WRITE_PROC MemWriteCallback,
+                  FAST486_MEM_MAP_PROC   MemMapCallback,
                   FAST486_IO_READ_PROC   IoReadCallback,
                   FAST486_IO_WRITE_PROC  IoWriteCallback,
                   FAST486_BOP_PROC       BopCallback,
@@ -119,6 +120,13 @@ Fast486Initialize(PFAST486_STATE         State,
     State->IntAckCallback   = (IntAckCallback   ? IntAckCallback   : Fast486IntAckCallback  );
     State->FpuCallback      = (FpuCallback      ? FpuCallback      : Fast486FpuCallback     );
 
+    /*
+     * The map callback is optional. It returns the host address of a physical
+     * page of plain RAM, or NULL for the pages which the memory callbacks
+     * must handle (MMIO, hooked or unmapped pages).
+     */
+    State->MemMapCallback   = MemMapCallback;
+
     /* Set the TLB (if given) */
     State->Tlb = Tlb;
 
@@ -135,6 +143,7 @@ Fast486Reset(PFAST486_STATE State)
     /* Save the callbacks and TLB */
     FAST486_MEM_READ_PROC  MemReadCallback  = State->MemReadCallback;
     FAST486_MEM_WRITE_PROC MemWriteCallback = State->MemWriteCallback;
+    FAST486_MEM_MAP_PROC   MemMapCallback   = State->MemMapCallback;
     FAST486_IO_READ_PROC   IoReadCallback   = State->IoReadCallback;
     FAST486_IO_WRITE_PROC  IoWriteCallback  = State->IoWriteCallback;
     FAST486_BOP_PROC       BopCallback      = State->BopCallback;
@@ -189,6 +198,7 @@ Fast486Reset(PFAST486_STATE State)
     /* Restore the callbacks and TLB */
     State->MemReadCallback  = MemReadCallback;
     State->MemWriteCallback = MemWriteCallback;
+    State->MemMapCallback   = MemMapCallback;
     State->IoReadCallback   = IoReadCallback;
     State->IoWriteCallback  = IoWriteCallback;
     State->BopCallback      = BopCallback;
@@ -198,6 +208,11 @@ Fast486Reset(PFAST486_STATE State)
 
     /* Flush the TLB */
     Fast486FlushTlb(State);
+
+#ifndef FAST486_NO_PREFETCH
+    /* Empty the code cache */
+    Fast486FlushCodeCache(State);
+#endif
 }
 
 VOID
@@ -256,8 +271,37 @@ Fast486Rewind(PFAST486_STATE State)
     State->InstPtr.Long = State->SavedInstPtr.Long;
 
 #ifndef FAST486_NO_PREFETCH
-    State->PrefetchValid = FALSE;
+    Fast486FlushCodeCache(State);
 #endif
 }
 
+VOID
+NTAPI
+Fast486InvalidateCache(PFAST486_STATE State)
+{
+    /*
+     * This function must be used when the host modified the memory of
+     * the guest by other means than the memory callbacks of the CPU,
+     * outside of a BOP handler, e.g. when loading a program or doing DMA,
+     * and when the pages returned by the map callback changed (e.g. when
+     * a memory hook was installed or the A20 line was toggled).
+     */
+    Fast486FlushMemTlb(State);
+
+#ifndef FAST486_NO_PREFETCH
+    Fast486FlushCodeCache(State);
+#endif
+}
+
+VOID
+NTAPI
+Fast486SyncFlags(PFAST486_STATE State)
+{
+    /*
+     * The arithmetic flags are computed lazily, this function must be used
+     * before the host reads or modifies State->Flags during the emulation.
+     */
+    Fast486UpdateFlags(State);
+}
+
 /* EOF */
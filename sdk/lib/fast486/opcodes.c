@@ -296,6 +296,31 @@ Fast486OpcodeHandlers[FAST486_NUM_OPCODE_HANDLERS] =
     Fast486OpcodeGroupFF,               /* 0xFF */
 };
 
+/*
+ * The opcodes whose handlers don't use the arithmetic flags, or only through
+ * the lazy flags functions. The pending flags are computed before the others.
+ */
+const UCHAR
+Fast486OpcodeLazyFlags[FAST486_NUM_OPCODE_HANDLERS] =
+{
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0x00 - 0x0F */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0x10 - 0x1F */
+    1, 1, 1, 1, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 0, /* 0x20 - 0x2F */
+    1, 1, 1, 1, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 0, /* 0x30 - 0x3F */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0x40 - 0x4F */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0x50 - 0x5F */
+    1, 1, 1, 0, 1, 1, 1, 1, 1, 0, 1, 0, 0, 0, 0, 0, /* 0x60 - 0x6F */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0x70 - 0x7F */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0x80 - 0x8F */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, /* 0x90 - 0x9F */
+    1, 1, 1, 1, 1, 1, 0, 0, 1, 1, 1, 1, 1, 1, 0, 0, /* 0xA0 - 0xAF */
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 0xB0 - 0xBF */
+    0, 0, 1, 1, 0, 0, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, /* 0xC0 - 0xCF */
+    0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, /* 0xD0 - 0xDF */
+    1, 1, 1, 1, 0, 0, 0, 0, 1, 1, 0, 1, 0, 0, 0, 0, /* 0xE0 - 0xEF */
+    1, 0, 1, 1, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1  /* 0xF0 - 0xFF */
+};
+
 /* PUBLIC FUNCTIONS ***********************************************************/
 
 FAST486_OPCODE_HANDLER(Fast486OpcodeInvalid)
@@ -422,21 +447,13 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeIncrement)
     if (Size)
     {
         Value = ++State->GeneralRegs[Opcode & 0x07].Long;
-
-        State->Flags.Of = (Value == SIGN_FLAG_LONG);
-        State->Flags.Sf = ((Value & SIGN_FLAG_LONG) != 0);
+        Fast486SetLazyIncDecFlags(State, FAST486_LAZY_INC, SIGN_FLAG_LONG, Value);
     }
     else
     {
         Value = ++State->GeneralRegs[Opcode & 0x07].LowWord;
-
-        State->Flags.Of = (Value == SIGN_FLAG_WORD);
-        State->Flags.Sf = ((Value & SIGN_FLAG_WORD) != 0);
+        Fast486SetLazyIncDecFlags(State, FAST486_LAZY_INC, SIGN_FLAG_WORD, Value);
     }
-
-    State->Flags.Zf = (Value == 0);
-    State->Flags.Af = ((Value & 0x0F) == 0);
-    State->Flags.Pf = Fast486CalculateParity(LOBYTE(Value));
 }
 
 FAST486_OPCODE_HANDLER(Fast486OpcodeDecrement)
@@ -453,21 +470,13 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeDecrement)
     if (Size)
     {
         Value = --State->GeneralRegs[Opcode & 0x07].Long;
-
-        State->Flags.Of = (Value == (SIGN_FLAG_LONG - 1));
-        State->Flags.Sf = ((Value & SIGN_FLAG_LONG) != 0);
+        Fast486SetLazyIncDecFlags(State, FAST486_LAZY_DEC, SIGN_FLAG_LONG, Value);
     }
     else
     {
         Value = --State->GeneralRegs[Opcode & 0x07].LowWord;
-
-        State->Flags.Of = (Value == (SIGN_FLAG_WORD - 1));
-        State->Flags.Sf = ((Value & SIGN_FLAG_WORD) != 0);
+        Fast486SetLazyIncDecFlags(State, FAST486_LAZY_DEC, SIGN_FLAG_WORD, Value);
     }
-
-    State->Flags.Zf = (Value == 0);
-    State->Flags.Af = ((Value & 0x0F) == 0x0F);
-    State->Flags.Pf = Fast486CalculateParity(LOBYTE(Value));
 }
 
 FAST486_OPCODE_HANDLER(Fast486OpcodePushReg)
@@ -557,56 +566,57 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeShortConditionalJmp)
         /* JO / JNO */
         case 0:
         {
-            Jump = State->Flags.Of;
+            Jump = Fast486GetOverflowFlag(State);
             break;
         }
 
         /* JC / JNC */
         case 1:
         {
-            Jump = State->Flags.Cf;
+            Jump = Fast486GetCarryFlag(State);
             break;
         }
 
         /* JZ / JNZ */
         case 2:
         {
-            Jump = State->Flags.Zf;
+            Jump = Fast486GetZeroFlag(State);
             break;
         }
 
         /* JBE / JNBE */
         case 3:
         {
-            Jump = State->Flags.Cf || State->Flags.Zf;
+            Jump = Fast486GetCarryFlag(State) || Fast486GetZeroFlag(State);
             break;
         }
 
         /* JS / JNS */
         case 4:
         {
-            Jump = State->Flags.Sf;
+            Jump = Fast486GetSignFlag(State);
             break;
         }
 
         /* JP / JNP */
         case 5:
         {
-            Jump = State->Flags.Pf;
+            Jump = Fast486GetParityFlag(State);
             break;
         }
 
         /* JL / JNL */
         case 6:
         {
-            Jump = State->Flags.Sf != State->Flags.Of;
+            Jump = Fast486GetSignFlag(State) != Fast486GetOverflowFlag(State);
             break;
         }
 
         /* JLE / JNLE */
         case 7:
         {
-            Jump = (State->Flags.Sf != State->Flags.Of) || State->Flags.Zf;
+            Jump = (Fast486GetSignFlag(State) != Fast486GetOverflowFlag(State))
+                   || Fast486GetZeroFlag(State);
             break;
         }
     }
@@ -1066,13 +1076,8 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAddByteModrm)
     Result = FirstValue + SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = (Result < FirstValue) && (Result < SecondValue);
-    State->Flags.Of = ((FirstValue & SIGN_FLAG_BYTE) == (SecondValue & SIGN_FLAG_BYTE))
-                      && ((FirstValue & SIGN_FLAG_BYTE) != (Result & SIGN_FLAG_BYTE));
-    State->Flags.Af = ((((FirstValue & 0x0F) + (SecondValue & 0x0F)) & 0x10) != 0);
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State, FAST486_LAZY_ADD, SIGN_FLAG_BYTE,
+                        FirstValue, SecondValue, Result);
 
     /* Write back the result */
     Fast486WriteModrmByteOperands(State,
@@ -1119,13 +1124,8 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAddModrm)
         Result = FirstValue + SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = (Result < FirstValue) && (Result < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_LONG) == (SecondValue & SIGN_FLAG_LONG))
-                          && ((FirstValue & SIGN_FLAG_LONG) != (Result & SIGN_FLAG_LONG));
-        State->Flags.Af = ((((FirstValue & 0x0F) + (SecondValue & 0x0F)) & 0x10) != 0);
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State, FAST486_LAZY_ADD, SIGN_FLAG_LONG,
+                            FirstValue, SecondValue, Result);
 
         /* Write back the result */
         Fast486WriteModrmDwordOperands(State,
@@ -1150,13 +1150,8 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAddModrm)
         Result = FirstValue + SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = (Result < FirstValue) && (Result < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_WORD) == (SecondValue & SIGN_FLAG_WORD))
-                          && ((FirstValue & SIGN_FLAG_WORD) != (Result & SIGN_FLAG_WORD));
-        State->Flags.Af = ((((FirstValue & 0x0F) + (SecondValue & 0x0F)) & 0x10) != 0);
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State, FAST486_LAZY_ADD, SIGN_FLAG_WORD,
+                            FirstValue, SecondValue, Result);
 
         /* Write back the result */
         Fast486WriteModrmWordOperands(State,
@@ -1186,13 +1181,8 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAddAl)
     Result = FirstValue + SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = (Result < FirstValue) && (Result < SecondValue);
-    State->Flags.Of = ((FirstValue & SIGN_FLAG_BYTE) == (SecondValue & SIGN_FLAG_BYTE))
-                      && ((FirstValue & SIGN_FLAG_BYTE) != (Result & SIGN_FLAG_BYTE));
-    State->Flags.Af = ((((FirstValue & 0x0F) + (SecondValue & 0x0F)) & 0x10) != 0);
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State, FAST486_LAZY_ADD, SIGN_FLAG_BYTE,
+                        FirstValue, SecondValue, Result);
 
     /* Write back the result */
     State->GeneralRegs[FAST486_REG_EAX].LowByte = Result;
@@ -1223,13 +1213,8 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAddEax)
         Result = FirstValue + SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = (Result < FirstValue) && (Result < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_LONG) == (SecondValue & SIGN_FLAG_LONG))
-                          && ((FirstValue & SIGN_FLAG_LONG) != (Result & SIGN_FLAG_LONG));
-        State->Flags.Af = ((((FirstValue & 0x0F) + (SecondValue & 0x0F)) & 0x10) != 0);
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State, FAST486_LAZY_ADD, SIGN_FLAG_LONG,
+                            FirstValue, SecondValue, Result);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].Long = Result;
@@ -1249,13 +1234,8 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAddEax)
         Result = FirstValue + SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = (Result < FirstValue) && (Result < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_WORD) == (SecondValue & SIGN_FLAG_WORD))
-                          && ((FirstValue & SIGN_FLAG_WORD) != (Result & SIGN_FLAG_WORD));
-        State->Flags.Af = ((((FirstValue & 0x0F) + (SecondValue & 0x0F)) & 0x10) != 0);
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State, FAST486_LAZY_ADD, SIGN_FLAG_WORD,
+                            FirstValue, SecondValue, Result);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].LowWord = Result;
@@ -1293,11 +1273,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeOrByteModrm)
     Result = FirstValue | SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = FALSE;
-    State->Flags.Of = FALSE;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyLogicFlags(State, SIGN_FLAG_BYTE, Result);
 
     /* Write back the result */
     Fast486WriteModrmByteOperands(State,
@@ -1344,11 +1320,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeOrModrm)
         Result = FirstValue | SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyLogicFlags(State, SIGN_FLAG_LONG, Result);
 
         /* Write back the result */
         Fast486WriteModrmDwordOperands(State,
@@ -1373,11 +1345,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeOrModrm)
         Result = FirstValue | SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyLogicFlags(State, SIGN_FLAG_WORD, Result);
 
         /* Write back the result */
         Fast486WriteModrmWordOperands(State,
@@ -1407,11 +1375,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeOrAl)
     Result = FirstValue | SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = FALSE;
-    State->Flags.Of = FALSE;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyLogicFlags(State, SIGN_FLAG_BYTE, Result);
 
     /* Write back the result */
     State->GeneralRegs[FAST486_REG_EAX].LowByte = Result;
@@ -1442,11 +1406,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeOrEax)
         Result = FirstValue | SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyLogicFlags(State, SIGN_FLAG_LONG, Result);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].Long = Result;
@@ -1466,11 +1426,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeOrEax)
         Result = FirstValue | SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyLogicFlags(State, SIGN_FLAG_WORD, Result);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].LowWord = Result;
@@ -1508,11 +1464,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAndByteModrm)
     Result = FirstValue & SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = FALSE;
-    State->Flags.Of = FALSE;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyLogicFlags(State, SIGN_FLAG_BYTE, Result);
 
     /* Write back the result */
     Fast486WriteModrmByteOperands(State,
@@ -1559,11 +1511,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAndModrm)
         Result = FirstValue & SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyLogicFlags(State, SIGN_FLAG_LONG, Result);
 
         /* Write back the result */
         Fast486WriteModrmDwordOperands(State,
@@ -1588,11 +1536,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAndModrm)
         Result = FirstValue & SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyLogicFlags(State, SIGN_FLAG_WORD, Result);
 
         /* Write back the result */
         Fast486WriteModrmWordOperands(State,
@@ -1622,11 +1566,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAndAl)
     Result = FirstValue & SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = FALSE;
-    State->Flags.Of = FALSE;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyLogicFlags(State, SIGN_FLAG_BYTE, Result);
 
     /* Write back the result */
     State->GeneralRegs[FAST486_REG_EAX].LowByte = Result;
@@ -1657,11 +1597,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAndEax)
         Result = FirstValue & SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyLogicFlags(State, SIGN_FLAG_LONG, Result);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].Long = Result;
@@ -1681,11 +1617,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAndEax)
         Result = FirstValue & SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyLogicFlags(State, SIGN_FLAG_WORD, Result);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].LowWord = Result;
@@ -1723,11 +1655,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeXorByteModrm)
     Result = FirstValue ^ SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = FALSE;
-    State->Flags.Of = FALSE;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyLogicFlags(State, SIGN_FLAG_BYTE, Result);
 
     /* Write back the result */
     Fast486WriteModrmByteOperands(State,
@@ -1774,11 +1702,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeXorModrm)
         Result = FirstValue ^ SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyLogicFlags(State, SIGN_FLAG_LONG, Result);
 
         /* Write back the result */
         Fast486WriteModrmDwordOperands(State,
@@ -1803,11 +1727,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeXorModrm)
         Result = FirstValue ^ SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyLogicFlags(State, SIGN_FLAG_WORD, Result);
 
         /* Write back the result */
         Fast486WriteModrmWordOperands(State,
@@ -1837,11 +1757,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeXorAl)
     Result = FirstValue ^ SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = FALSE;
-    State->Flags.Of = FALSE;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyLogicFlags(State, SIGN_FLAG_BYTE, Result);
 
     /* Write back the result */
     State->GeneralRegs[FAST486_REG_EAX].LowByte = Result;
@@ -1872,11 +1788,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeXorEax)
         Result = FirstValue ^ SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyLogicFlags(State, SIGN_FLAG_LONG, Result);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].Long = Result;
@@ -1896,11 +1808,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeXorEax)
         Result = FirstValue ^ SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyLogicFlags(State, SIGN_FLAG_WORD, Result);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].LowWord = Result;
@@ -1937,11 +1845,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeTestByteModrm)
     Result = FirstValue & SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = FALSE;
-    State->Flags.Of = FALSE;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyLogicFlags(State, SIGN_FLAG_BYTE, Result);
 }
 
 FAST486_OPCODE_HANDLER(Fast486OpcodeTestModrm)
@@ -1982,11 +1886,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeTestModrm)
         Result = FirstValue & SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyLogicFlags(State, SIGN_FLAG_LONG, Result);
     }
     else
     {
@@ -2005,11 +1905,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeTestModrm)
         Result = FirstValue & SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyLogicFlags(State, SIGN_FLAG_WORD, Result);
     }
 }
 
@@ -2033,11 +1929,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeTestAl)
     Result = FirstValue & SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = FALSE;
-    State->Flags.Of = FALSE;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyLogicFlags(State, SIGN_FLAG_BYTE, Result);
 }
 
 FAST486_OPCODE_HANDLER(Fast486OpcodeTestEax)
@@ -2065,11 +1957,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeTestEax)
         Result = FirstValue & SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyLogicFlags(State, SIGN_FLAG_LONG, Result);
     }
     else
     {
@@ -2086,11 +1974,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeTestEax)
         Result = FirstValue & SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = FALSE;
-        State->Flags.Of = FALSE;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyLogicFlags(State, SIGN_FLAG_WORD, Result);
     }
 }
 
@@ -2273,20 +2157,11 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAdcByteModrm)
     }
 
     /* Calculate the result */
-    Result = FirstValue + SecondValue + State->Flags.Cf;
-
-    /* Special exception for CF */
-    State->Flags.Cf = State->Flags.Cf
-                      && ((FirstValue == 0xFF) || (SecondValue == 0xFF));
+    Result = FirstValue + SecondValue + Fast486GetCarryFlag(State);
 
     /* Update the flags */
-    State->Flags.Cf = State->Flags.Cf || ((Result < FirstValue) && (Result < SecondValue));
-    State->Flags.Of = ((FirstValue & SIGN_FLAG_BYTE) == (SecondValue & SIGN_FLAG_BYTE))
-                      && ((FirstValue & SIGN_FLAG_BYTE) != (Result & SIGN_FLAG_BYTE));
-    State->Flags.Af = ((FirstValue ^ SecondValue ^ Result) & 0x10) != 0;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State, FAST486_LAZY_ADC, SIGN_FLAG_BYTE,
+                        FirstValue, SecondValue, Result);
 
     /* Write back the result */
     Fast486WriteModrmByteOperands(State,
@@ -2330,20 +2205,11 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAdcModrm)
         }
 
         /* Calculate the result */
-        Result = FirstValue + SecondValue + State->Flags.Cf;
-
-        /* Special exception for CF */
-        State->Flags.Cf = State->Flags.Cf
-                          && ((FirstValue == 0xFFFFFFFF) || (SecondValue == 0xFFFFFFFF));
+        Result = FirstValue + SecondValue + Fast486GetCarryFlag(State);
 
         /* Update the flags */
-        State->Flags.Cf = State->Flags.Cf || ((Result < FirstValue) && (Result < SecondValue));
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_LONG) == (SecondValue & SIGN_FLAG_LONG))
-                          && ((FirstValue & SIGN_FLAG_LONG) != (Result & SIGN_FLAG_LONG));
-        State->Flags.Af = ((FirstValue ^ SecondValue ^ Result) & 0x10) != 0;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State, FAST486_LAZY_ADC, SIGN_FLAG_LONG,
+                            FirstValue, SecondValue, Result);
 
         /* Write back the result */
         Fast486WriteModrmDwordOperands(State,
@@ -2365,20 +2231,11 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAdcModrm)
         }
 
         /* Calculate the result */
-        Result = FirstValue + SecondValue + State->Flags.Cf;
-
-        /* Special exception for CF */
-        State->Flags.Cf = State->Flags.Cf
-                          && ((FirstValue == 0xFFFF) || (SecondValue == 0xFFFF));
+        Result = FirstValue + SecondValue + Fast486GetCarryFlag(State);
 
         /* Update the flags */
-        State->Flags.Cf = State->Flags.Cf || ((Result < FirstValue) && (Result < SecondValue));
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_WORD) == (SecondValue & SIGN_FLAG_WORD))
-                          && ((FirstValue & SIGN_FLAG_WORD) != (Result & SIGN_FLAG_WORD));
-        State->Flags.Af = ((FirstValue ^ SecondValue ^ Result) & 0x10) != 0;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State, FAST486_LAZY_ADC, SIGN_FLAG_WORD,
+                            FirstValue, SecondValue, Result);
 
         /* Write back the result */
         Fast486WriteModrmWordOperands(State,
@@ -2406,20 +2263,11 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAdcAl)
     }
 
     /* Calculate the result */
-    Result = FirstValue + SecondValue + State->Flags.Cf;
-
-    /* Special exception for CF */
-    State->Flags.Cf = State->Flags.Cf &&
-                      ((FirstValue == 0xFF) || (SecondValue == 0xFF));
+    Result = FirstValue + SecondValue + Fast486GetCarryFlag(State);
 
     /* Update the flags */
-    State->Flags.Cf = State->Flags.Cf || ((Result < FirstValue) && (Result < SecondValue));
-    State->Flags.Of = ((FirstValue & SIGN_FLAG_BYTE) == (SecondValue & SIGN_FLAG_BYTE))
-                      && ((FirstValue & SIGN_FLAG_BYTE) != (Result & SIGN_FLAG_BYTE));
-    State->Flags.Af = ((FirstValue ^ SecondValue ^ Result) & 0x10) != 0;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State, FAST486_LAZY_ADC, SIGN_FLAG_BYTE,
+                        FirstValue, SecondValue, Result);
 
     /* Write back the result */
     State->GeneralRegs[FAST486_REG_EAX].LowByte = Result;
@@ -2447,20 +2295,11 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAdcEax)
         }
 
         /* Calculate the result */
-        Result = FirstValue + SecondValue + State->Flags.Cf;
-
-        /* Special exception for CF */
-        State->Flags.Cf = State->Flags.Cf &&
-                          ((FirstValue == 0xFFFFFFFF) || (SecondValue == 0xFFFFFFFF));
+        Result = FirstValue + SecondValue + Fast486GetCarryFlag(State);
 
         /* Update the flags */
-        State->Flags.Cf = State->Flags.Cf || ((Result < FirstValue) && (Result < SecondValue));
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_LONG) == (SecondValue & SIGN_FLAG_LONG))
-                          && ((FirstValue & SIGN_FLAG_LONG) != (Result & SIGN_FLAG_LONG));
-        State->Flags.Af = ((FirstValue ^ SecondValue ^ Result) & 0x10) != 0;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State, FAST486_LAZY_ADC, SIGN_FLAG_LONG,
+                            FirstValue, SecondValue, Result);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].Long = Result;
@@ -2477,20 +2316,11 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeAdcEax)
         }
 
         /* Calculate the result */
-        Result = FirstValue + SecondValue + State->Flags.Cf;
-
-        /* Special exception for CF */
-        State->Flags.Cf = State->Flags.Cf &&
-                          ((FirstValue == 0xFFFF) || (SecondValue == 0xFFFF));
+        Result = FirstValue + SecondValue + Fast486GetCarryFlag(State);
 
         /* Update the flags */
-        State->Flags.Cf = State->Flags.Cf || ((Result < FirstValue) && (Result < SecondValue));
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_WORD) == (SecondValue & SIGN_FLAG_WORD))
-                          && ((FirstValue & SIGN_FLAG_WORD) != (Result & SIGN_FLAG_WORD));
-        State->Flags.Af = ((FirstValue ^ SecondValue ^ Result) & 0x10) != 0;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State, FAST486_LAZY_ADC, SIGN_FLAG_WORD,
+                            FirstValue, SecondValue, Result);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].LowWord = Result;
@@ -2526,7 +2356,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeSbbByteModrm)
     UCHAR FirstValue, SecondValue, Result;
     FAST486_MOD_REG_RM ModRegRm;
     BOOLEAN AddressSize = State->SegmentRegs[FAST486_REG_CS].Size;
-    INT Carry = State->Flags.Cf ? 1 : 0;
+    INT Carry = Fast486GetCarryFlag(State) ? 1 : 0;
 
     /* Make sure this is the right instruction */
     ASSERT((Opcode & 0xFD) == 0x18);
@@ -2560,13 +2390,8 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeSbbByteModrm)
     Result = FirstValue - SecondValue - Carry;
 
     /* Update the flags */
-    State->Flags.Cf = Carry ? (FirstValue <= SecondValue) : (FirstValue < SecondValue);
-    State->Flags.Of = ((FirstValue & SIGN_FLAG_BYTE) != (SecondValue & SIGN_FLAG_BYTE))
-                      && ((FirstValue & SIGN_FLAG_BYTE) != (Result & SIGN_FLAG_BYTE));
-    State->Flags.Af = ((FirstValue ^ SecondValue ^ Result) & 0x10) != 0;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State, FAST486_LAZY_SBB, SIGN_FLAG_BYTE,
+                        FirstValue, SecondValue, Result);
 
     /* Write back the result */
     Fast486WriteModrmByteOperands(State,
@@ -2579,7 +2404,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeSbbModrm)
 {
     FAST486_MOD_REG_RM ModRegRm;
     BOOLEAN OperandSize, AddressSize;
-    INT Carry = State->Flags.Cf ? 1 : 0;
+    INT Carry = Fast486GetCarryFlag(State) ? 1 : 0;
 
     /* Make sure this is the right instruction */
     ASSERT((Opcode & 0xFD) == 0x19);
@@ -2621,13 +2446,8 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeSbbModrm)
         Result = FirstValue - SecondValue - Carry;
 
         /* Update the flags */
-        State->Flags.Cf = Carry ? (FirstValue <= SecondValue) : (FirstValue < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_LONG) != (SecondValue & SIGN_FLAG_LONG))
-                          && ((FirstValue & SIGN_FLAG_LONG) != (Result & SIGN_FLAG_LONG));
-        State->Flags.Af = ((FirstValue ^ SecondValue ^ Result) & 0x10) != 0;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State, FAST486_LAZY_SBB, SIGN_FLAG_LONG,
+                            FirstValue, SecondValue, Result);
 
         /* Write back the result */
         Fast486WriteModrmDwordOperands(State,
@@ -2659,13 +2479,8 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeSbbModrm)
         Result = FirstValue - SecondValue - Carry;
 
         /* Update the flags */
-        State->Flags.Cf = Carry ? (FirstValue <= SecondValue) : (FirstValue < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_WORD) != (SecondValue & SIGN_FLAG_WORD))
-                          && ((FirstValue & SIGN_FLAG_WORD) != (Result & SIGN_FLAG_WORD));
-        State->Flags.Af = ((FirstValue ^ SecondValue ^ Result) & 0x10) != 0;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State, FAST486_LAZY_SBB, SIGN_FLAG_WORD,
+                            FirstValue, SecondValue, Result);
 
         /* Write back the result */
         Fast486WriteModrmWordOperands(State,
@@ -2679,7 +2494,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeSbbAl)
 {
     UCHAR FirstValue = State->GeneralRegs[FAST486_REG_EAX].LowByte;
     UCHAR SecondValue, Result;
-    INT Carry = State->Flags.Cf ? 1 : 0;
+    INT Carry = Fast486GetCarryFlag(State) ? 1 : 0;
 
     /* Make sure this is the right instruction */
     ASSERT(Opcode == 0x1C);
@@ -2696,13 +2511,8 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeSbbAl)
     Result = FirstValue - SecondValue - Carry;
 
     /* Update the flags */
-    State->Flags.Cf = Carry ? (FirstValue <= SecondValue) : (FirstValue < SecondValue);
-    State->Flags.Of = ((FirstValue & SIGN_FLAG_BYTE) != (SecondValue & SIGN_FLAG_BYTE))
-                      && ((FirstValue & SIGN_FLAG_BYTE) != (Result & SIGN_FLAG_BYTE));
-    State->Flags.Af = ((FirstValue ^ SecondValue ^ Result) & 0x10) != 0;
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State, FAST486_LAZY_SBB, SIGN_FLAG_BYTE,
+                        FirstValue, SecondValue, Result);
 
     /* Write back the result */
     State->GeneralRegs[FAST486_REG_EAX].LowByte = Result;
@@ -2711,7 +2521,7 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeSbbAl)
 FAST486_OPCODE_HANDLER(Fast486OpcodeSbbEax)
 {
     BOOLEAN Size = State->SegmentRegs[FAST486_REG_CS].Size;
-    INT Carry = State->Flags.Cf ? 1 : 0;
+    INT Carry = Fast486GetCarryFlag(State) ? 1 : 0;
 
     /* Make sure this is the right instruction */
     ASSERT(Opcode == 0x1D);
@@ -2734,13 +2544,8 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeSbbEax)
         Result = FirstValue - SecondValue - Carry;
 
         /* Update the flags */
-        State->Flags.Cf = Carry ? (FirstValue <= SecondValue) : (FirstValue < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_LONG) != (SecondValue & SIGN_FLAG_LONG))
-                          && ((FirstValue & SIGN_FLAG_LONG) != (Result & SIGN_FLAG_LONG));
-        State->Flags.Af = ((FirstValue ^ SecondValue ^ Result) & 0x10) != 0;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State, FAST486_LAZY_SBB, SIGN_FLAG_LONG,
+                            FirstValue, SecondValue, Result);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].Long = Result;
@@ -2760,13 +2565,8 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeSbbEax)
         Result = FirstValue - SecondValue - Carry;
 
         /* Update the flags */
-        State->Flags.Cf = Carry ? (FirstValue <= SecondValue) : (FirstValue < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_WORD) != (SecondValue & SIGN_FLAG_WORD))
-                          && ((FirstValue & SIGN_FLAG_WORD) != (Result & SIGN_FLAG_WORD));
-        State->Flags.Af = ((FirstValue ^ SecondValue ^ Result) & 0x10) != 0;
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State, FAST486_LAZY_SBB, SIGN_FLAG_WORD,
+                            FirstValue, SecondValue, Result);
 
         /* Write back the result */
         State->GeneralRegs[FAST486_REG_EAX].LowWord = Result;
@@ -2872,13 +2672,8 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeCmpSubByteModrm)
     Result = FirstValue - SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = (FirstValue < SecondValue);
-    State->Flags.Of = ((FirstValue & SIGN_FLAG_BYTE) != (SecondValue & SIGN_FLAG_BYTE))
-                      && ((FirstValue & SIGN_FLAG_BYTE) != (Result & SIGN_FLAG_BYTE));
-    State->Flags.Af = (FirstValue & 0x0F) < (SecondValue & 0x0F);
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State, FAST486_LAZY_SUB, SIGN_FLAG_BYTE,
+                        FirstValue, SecondValue, Result);
 
     /* Check if this is not a CMP */
     if (!(Opcode & 0x10))
@@ -2936,13 +2731,8 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeCmpSubModrm)
         Result = FirstValue - SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = (FirstValue < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_LONG) != (SecondValue & SIGN_FLAG_LONG))
-                          && ((FirstValue & SIGN_FLAG_LONG) != (Result & SIGN_FLAG_LONG));
-        State->Flags.Af = (FirstValue & 0x0F) < (SecondValue & 0x0F);
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State, FAST486_LAZY_SUB, SIGN_FLAG_LONG,
+                            FirstValue, SecondValue, Result);
 
         /* Check if this is not a CMP */
         if (!(Opcode & 0x10))
@@ -2978,13 +2768,8 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeCmpSubModrm)
         Result = FirstValue - SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = (FirstValue < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_WORD) != (SecondValue & SIGN_FLAG_WORD))
-                          && ((FirstValue & SIGN_FLAG_WORD) != (Result & SIGN_FLAG_WORD));
-        State->Flags.Af = (FirstValue & 0x0F) < (SecondValue & 0x0F);
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State, FAST486_LAZY_SUB, SIGN_FLAG_WORD,
+                            FirstValue, SecondValue, Result);
 
         /* Check if this is not a CMP */
         if (!(Opcode & 0x10))
@@ -3018,13 +2803,8 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeCmpSubAl)
     Result = FirstValue - SecondValue;
 
     /* Update the flags */
-    State->Flags.Cf = (FirstValue < SecondValue);
-    State->Flags.Of = ((FirstValue & SIGN_FLAG_BYTE) != (SecondValue & SIGN_FLAG_BYTE))
-                      && ((FirstValue & SIGN_FLAG_BYTE) != (Result & SIGN_FLAG_BYTE));
-    State->Flags.Af = (FirstValue & 0x0F) < (SecondValue & 0x0F);
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Result);
+    Fast486SetLazyFlags(State, FAST486_LAZY_SUB, SIGN_FLAG_BYTE,
+                        FirstValue, SecondValue, Result);
 
     /* Check if this is not a CMP */
     if (!(Opcode & 0x10))
@@ -3059,13 +2839,8 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeCmpSubEax)
         Result = FirstValue - SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = (FirstValue < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_LONG) != (SecondValue & SIGN_FLAG_LONG))
-                          && ((FirstValue & SIGN_FLAG_LONG) != (Result & SIGN_FLAG_LONG));
-        State->Flags.Af = (FirstValue & 0x0F) < (SecondValue & 0x0F);
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_LONG) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State, FAST486_LAZY_SUB, SIGN_FLAG_LONG,
+                            FirstValue, SecondValue, Result);
 
         /* Check if this is not a CMP */
         if (!(Opcode & 0x10))
@@ -3089,13 +2864,8 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeCmpSubEax)
         Result = FirstValue - SecondValue;
 
         /* Update the flags */
-        State->Flags.Cf = (FirstValue < SecondValue);
-        State->Flags.Of = ((FirstValue & SIGN_FLAG_WORD) != (SecondValue & SIGN_FLAG_WORD))
-                          && ((FirstValue & SIGN_FLAG_WORD) != (Result & SIGN_FLAG_WORD));
-        State->Flags.Af = (FirstValue & 0x0F) < (SecondValue & 0x0F);
-        State->Flags.Zf = (Result == 0);
-        State->Flags.Sf = ((Result & SIGN_FLAG_WORD) != 0);
-        State->Flags.Pf = Fast486CalculateParity(Result);
+        Fast486SetLazyFlags(State, FAST486_LAZY_SUB, SIGN_FLAG_WORD,
+                            FirstValue, SecondValue, Result);
 
         /* Check if this is not a CMP */
         if (!(Opcode & 0x10))
@@ -4140,14 +3910,14 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeLdsLes)
                 return;
             }
 
-#ifndef FAST486_NO_PREFETCH
-            /* Invalidate the prefetch since BOP handlers can alter the memory */
-            State->PrefetchValid = FALSE;
-#endif
-
             /* Call the BOP handler */
             State->BopCallback(State, BopCode);
 
+#ifndef FAST486_NO_PREFETCH
+            /* Invalidate the code cache since BOP handlers can alter the memory */
+            Fast486FlushCodeCache(State);
+#endif
+
             /*
              * If an interrupt should occur at this time, delay it.
              * We must do this because if an interrupt begins and the BOP callback
@@ -4800,12 +4570,12 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeLoop)
     if (Opcode == 0xE0)
     {
         /* Additional rule for LOOPNZ */
-        if (State->Flags.Zf) Condition = FALSE;
+        if (Fast486GetZeroFlag(State)) Condition = FALSE;
     }
     else if (Opcode == 0xE1)
     {
         /* Additional rule for LOOPZ */
-        if (!State->Flags.Zf) Condition = FALSE;
+        if (!Fast486GetZeroFlag(State)) Condition = FALSE;
     }
 
     /* Fetch the offset */
@@ -37,6 +37,10 @@ extern
 FAST486_OPCODE_HANDLER_PROC
 Fast486OpcodeHandlers[FAST486_NUM_OPCODE_HANDLERS];
 
+extern
+const UCHAR
+Fast486OpcodeLazyFlags[FAST486_NUM_OPCODE_HANDLERS];
+
 FAST486_OPCODE_HANDLER(Fast486OpcodeInvalid);
 
 FAST486_OPCODE_HANDLER(Fast486OpcodePrefix);
@@ -56,13 +56,8 @@ Fast486ArithmeticOperation(PFAST486_STATE State,
         case 0:
         {
             Result = (FirstValue + SecondValue) & MaxValue;
-
-            /* Update CF, OF and AF */
-            State->Flags.Cf = (Result < FirstValue) && (Result < SecondValue);
-            State->Flags.Of = ((FirstValue & SignFlag) == (SecondValue & SignFlag))
-                              && ((FirstValue & SignFlag) != (Result & SignFlag));
-            State->Flags.Af = ((((FirstValue & 0x0F) + (SecondValue & 0x0F)) & 0x10) != 0);
-
+            Fast486SetLazyFlags(State, FAST486_LAZY_ADD, SignFlag,
+                                FirstValue, SecondValue, Result);
             break;
         }
 
@@ -70,42 +65,29 @@ Fast486ArithmeticOperation(PFAST486_STATE State,
         case 1:
         {
             Result = FirstValue | SecondValue;
-            State->Flags.Cf = State->Flags.Of = FALSE;
+            Fast486SetLazyLogicFlags(State, SignFlag, Result);
             break;
         }
 
         /* ADC */
         case 2:
         {
-            INT Carry = State->Flags.Cf ? 1 : 0;
+            INT Carry = Fast486GetCarryFlag(State) ? 1 : 0;
 
             Result = (FirstValue + SecondValue + Carry) & MaxValue;
-
-            /* Update CF, OF and AF */
-            State->Flags.Cf = ((SecondValue == MaxValue) && (Carry == 1))
-                              || ((Result < FirstValue) && (Result < (SecondValue + Carry)));
-            State->Flags.Of = ((FirstValue & SignFlag) == (SecondValue & SignFlag))
-                              && ((FirstValue & SignFlag) != (Result & SignFlag));
-            State->Flags.Af = ((FirstValue ^ SecondValue ^ Result) & 0x10) != 0;
-
+            Fast486SetLazyFlags(State, FAST486_LAZY_ADC, SignFlag,
+                                FirstValue, SecondValue, Result);
             break;
         }
 
         /* SBB */
         case 3:
         {
-            INT Carry = State->Flags.Cf ? 1 : 0;
+            INT Carry = Fast486GetCarryFlag(State) ? 1 : 0;
 
             Result = (FirstValue - SecondValue - Carry) & MaxValue;
-
-            /* Update CF, OF and AF */
-            State->Flags.Cf = Carry
-                              ? (FirstValue <= SecondValue)
-                              : (FirstValue < SecondValue);
-            State->Flags.Of = ((FirstValue & SignFlag) != (SecondValue & SignFlag))
-                              && ((FirstValue & SignFlag) != (Result & SignFlag));
-            State->Flags.Af = ((FirstValue ^ SecondValue ^ Result) & 0x10) != 0;
-
+            Fast486SetLazyFlags(State, FAST486_LAZY_SBB, SignFlag,
+                                FirstValue, SecondValue, Result);
             break;
         }
 
@@ -113,7 +95,7 @@ Fast486ArithmeticOperation(PFAST486_STATE State,
         case 4:
         {
             Result = FirstValue & SecondValue;
-            State->Flags.Cf = State->Flags.Of = FALSE;
+            Fast486SetLazyLogicFlags(State, SignFlag, Result);
             break;
         }
 
@@ -122,13 +104,8 @@ Fast486ArithmeticOperation(PFAST486_STATE State,
         case 7:
         {
             Result = (FirstValue - SecondValue) & MaxValue;
-
-            /* Update CF, OF and AF */
-            State->Flags.Cf = (FirstValue < SecondValue);
-            State->Flags.Of = ((FirstValue & SignFlag) != (SecondValue & SignFlag))
-                              && ((FirstValue & SignFlag) != (Result & SignFlag));
-            State->Flags.Af = (FirstValue & 0x0F) < (SecondValue & 0x0F);
-
+            Fast486SetLazyFlags(State, FAST486_LAZY_SUB, SignFlag,
+                                FirstValue, SecondValue, Result);
             break;
         }
 
@@ -136,7 +113,7 @@ Fast486ArithmeticOperation(PFAST486_STATE State,
         case 6:
         {
             Result = FirstValue ^ SecondValue;
-            State->Flags.Cf = State->Flags.Of = FALSE;
+            Fast486SetLazyLogicFlags(State, SignFlag, Result);
             break;
         }
 
@@ -147,11 +124,6 @@ Fast486ArithmeticOperation(PFAST486_STATE State,
         }
     }
 
-    /* Update ZF, SF and PF */
-    State->Flags.Zf = (Result == 0);
-    State->Flags.Sf = ((Result & SignFlag) != 0);
-    State->Flags.Pf = Fast486CalculateParity(LOBYTE(Result));
-
     /* Return the result */
     return Result;
 }
@@ -1358,24 +1330,17 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeGroupFE)
 
     if (ModRegRm.Register == 0)
     {
-        /* Increment and update OF and AF */
+        /* Increment */
         Value++;
-        State->Flags.Of = (Value == SIGN_FLAG_BYTE);
-        State->Flags.Af = ((Value & 0x0F) == 0);
+        Fast486SetLazyIncDecFlags(State, FAST486_LAZY_INC, SIGN_FLAG_BYTE, Value);
     }
     else
     {
-        /* Decrement and update OF and AF */
-        State->Flags.Of = (Value == SIGN_FLAG_BYTE);
+        /* Decrement */
         Value--;
-        State->Flags.Af = ((Value & 0x0F) == 0x0F);
+        Fast486SetLazyIncDecFlags(State, FAST486_LAZY_DEC, SIGN_FLAG_BYTE, Value);
     }
 
-    /* Update flags */
-    State->Flags.Zf = (Value == 0);
-    State->Flags.Sf = ((Value & SIGN_FLAG_BYTE) != 0);
-    State->Flags.Pf = Fast486CalculateParity(Value);
-
     /* Write back the result */
     Fast486WriteModrmByteOperands(State, &ModRegRm, FALSE, Value);
 }
@@ -1416,17 +1381,15 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeGroupFF)
 
         if (ModRegRm.Register == 0)
         {
-            /* Increment and update OF and AF */
+            /* Increment */
             Value++;
-            State->Flags.Of = (Value == SIGN_FLAG_LONG);
-            State->Flags.Af = ((Value & 0x0F) == 0);
+            Fast486SetLazyIncDecFlags(State, FAST486_LAZY_INC, SIGN_FLAG_LONG, Value);
         }
         else if (ModRegRm.Register == 1)
         {
-            /* Decrement and update OF and AF */
-            State->Flags.Of = (Value == SIGN_FLAG_LONG);
+            /* Decrement */
             Value--;
-            State->Flags.Af = ((Value & 0x0F) == 0x0F);
+            Fast486SetLazyIncDecFlags(State, FAST486_LAZY_DEC, SIGN_FLAG_LONG, Value);
         }
         else if (ModRegRm.Register == 2)
         {
@@ -1556,11 +1519,6 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeGroupFF)
 
         if (ModRegRm.Register <= 1)
         {
-            /* Update flags */
-            State->Flags.Sf = ((Value & SIGN_FLAG_LONG) != 0);
-            State->Flags.Zf = (Value == 0);
-            State->Flags.Pf = Fast486CalculateParity(Value);
-
             /* Write back the result */
             Fast486WriteModrmDwordOperands(State, &ModRegRm, FALSE, Value);
         }
@@ -1577,17 +1535,15 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeGroupFF)
 
         if (ModRegRm.Register == 0)
         {
-            /* Increment and update OF */
+            /* Increment */
             Value++;
-            State->Flags.Of = (Value == SIGN_FLAG_WORD);
-            State->Flags.Af = ((Value & 0x0F) == 0);
+            Fast486SetLazyIncDecFlags(State, FAST486_LAZY_INC, SIGN_FLAG_WORD, Value);
         }
         else if (ModRegRm.Register == 1)
         {
-            /* Decrement and update OF */
-            State->Flags.Of = (Value == SIGN_FLAG_WORD);
+            /* Decrement */
             Value--;
-            State->Flags.Af = ((Value & 0x0F) == 0x0F);
+            Fast486SetLazyIncDecFlags(State, FAST486_LAZY_DEC, SIGN_FLAG_WORD, Value);
         }
         else if (ModRegRm.Register == 2)
         {
@@ -1735,11 +1691,6 @@ FAST486_OPCODE_HANDLER(Fast486OpcodeGroupFF)
 
         if (ModRegRm.Register <= 1)
         {
-            /* Update flags */
-            State->Flags.Sf = ((Value & SIGN_FLAG_WORD) != 0);
-            State->Flags.Zf = (Value == 0);
-            State->Flags.Pf = Fast486CalculateParity(Value);
-
             /* Write back the result */
             Fast486WriteModrmWordOperands(State, &ModRegRm, FALSE, Value);
         }
@@ -2260,8 +2211,8 @@ FAST486_OPCODE_HANDLER(Fast486ExtOpcodeGroup0F01)
         case 7:
         {
 #ifndef FAST486_NO_PREFETCH
-            /* Invalidate the prefetch */
-            State->PrefetchValid = FALSE;
+            /* Invalidate the code cache */
+            Fast486FlushCodeCache(State);
 #endif
 
             /* This is a privileged instruction */
@@ -2284,6 +2235,9 @@ FAST486_OPCODE_HANDLER(Fast486ExtOpcodeGroup0F01)
                 State->Tlb[ModRegRm.MemoryAddress >> 12] = INVALID_TLB_FIELD;
             }
 
+            /* Clear the memory TLB entry too */
+            Fast486InvalidateMemTlb(State, ModRegRm.MemoryAddress);
+
             break;
         }
 
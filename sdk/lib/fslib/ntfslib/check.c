@@ -0,0 +1,2386 @@
+/*
+ * COPYRIGHT:   See COPYING in the top level directory
+ * PROJECT:     ReactOS NTFS FS library
+ * FILE:        lib/fslib/ntfslib/check.c
+ * PURPOSE:     NTFS consistency check. $MFT is read in large sequential
+ *              chunks which are validated by several workers at once, the
+ *              directory indexes and $Bitmap are checked against the file
+ *              records.
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include "ntfslib.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* GLOBALS ******************************************************************/
+
+#define NTFS_CHECK_CHUNK_SIZE       (4 * 1024 * 1024)
+#define NTFS_CHECK_MAX_THREADS      64
+#define NTFS_CHECK_MAX_DEPTH        32
+#define NTFS_CHECK_MAX_REPORTS      32
+#define NTFS_CHECK_MAX_MESSAGES     256
+#define NTFS_CHECK_MAX_LIST_SIZE    (16 * 1024 * 1024)
+#define NTFS_CHECK_MAX_MIRROR_SIZE  0x10000
+#define NTFS_CHECK_RUN_INCREMENT    64
+#define NTFS_CHECK_UPCASE_SIZE      0x20000
+
+#define NTFS_CHECK_LCN_SPARSE       (-1LL)
+
+#define NTFS_CHECK_FILE_NAME_SIZE   FIELD_OFFSET(FILENAME_ATTRIBUTE, Name)
+
+/* Metadata journal of the ReactOS driver, see drivers/filesystems/ntfs/logfile.c */
+#define NTFS_LOG_RESTART_OFFSET     0x4000
+#define NTFS_LOG_RESTART_SIGNATURE  0x5453524E  /* "NRST" */
+#define NTFS_LOG_RECORD_SIGNATURE   0x4443524E  /* "NRCD" */
+#define NTFS_LOG_VERSION            1
+#define NTFS_LOG_MAX_RECORD_SIZE    0x800000
+
+typedef struct _NTFS_LOG_RESTART_AREA
+{
+    ULONG Signature;
+    ULONG Version;
+    ULONGLONG NextSequence;
+    ULONGLONG AreaStart;
+    ULONGLONG AreaEnd;
+    ULONG Checksum;
+    ULONG Flags;
+} NTFS_LOG_RESTART_AREA, *PNTFS_LOG_RESTART_AREA;
+
+typedef struct _NTFS_LOG_RECORD_HEADER
+{
+    ULONG Signature;
+    ULONG Checksum;
+    ULONGLONG Sequence;
+    ULONG Length;
+    ULONG HeaderSectors;
+    ULONG SectorCount;
+    ULONG Reserved;
+} NTFS_LOG_RECORD_HEADER, *PNTFS_LOG_RECORD_HEADER;
+
+static const WCHAR NtfsCheckIndexName[] = {'$', 'I', '3', '0'};
+
+typedef enum _NTFS_CHECK_ERROR
+{
+    /* Damage of the file records themselves */
+    NtfsCheckErrorRecordHeader,
+    NtfsCheckErrorRecordFixups,
+    NtfsCheckErrorAttribute,
+    NtfsCheckErrorAttributeOrder,
+    NtfsCheckErrorMappingPairs,
+    NtfsCheckErrorCrossLink,
+    NtfsCheckErrorStandardInformation,
+    NtfsCheckErrorAttributeList,
+
+    /* Damage of the directory indexes */
+    NtfsCheckErrorIndexRoot,
+    NtfsCheckErrorIndexBuffer,
+    NtfsCheckErrorIndexEntry,
+    NtfsCheckErrorIndexOrder,
+    NtfsCheckErrorIndexParent,
+    NtfsCheckErrorIndexBlockLost,
+    NtfsCheckErrorIndexMismatch,
+
+    /* Damage of the volume metadata */
+    NtfsCheckErrorUpCase,
+    NtfsCheckErrorMirror,
+    NtfsCheckErrorBitmapSize,
+    NtfsCheckErrorUsedClustersFree,
+    NtfsCheckErrorFreeClustersUsed
+} NTFS_CHECK_ERROR;
+
+/* Each message takes the record number and a value */
+static const PCSTR NtfsCheckMessages[] =
+{
+    "File record %llu: damaged record header\n",
+    "File record %llu: damaged update sequence array\n",
+    "File record %llu: damaged attribute of type 0x%llx\n",
+    "File record %llu: attribute of type 0x%llx is out of order\n",
+    "File record %llu: damaged mapping pairs in the attribute of type 0x%llx\n",
+    "File record %llu: cluster %llu is also used by another file\n",
+    "File record %llu: missing $STANDARD_INFORMATION\n",
+    "File record %llu: damaged attribute list, entry of type 0x%llx\n",
+    "Directory %llu: damaged or missing $INDEX_ROOT\n",
+    "Directory %llu: damaged index block at VCN %llu\n",
+    "Directory %llu: damaged index entry in the block at VCN %llu\n",
+    "Directory %llu: index entry of file %llu is out of order\n",
+    "Directory %llu: index entry of file %llu names another parent directory\n",
+    "Directory %llu: index block at VCN %llu is allocated but not in the tree\n",
+    "Directory %llu: index entries don't match the file names of the files\n",
+    "File record %llu: damaged $UpCase, using an ASCII upcase table\n",
+    "File record %llu: differs from its copy in $MFTMirr\n",
+    "File record %llu: $Bitmap is too small for the volume\n",
+    "File record %llu: $Bitmap marks %llu clusters in use as free\n",
+    "File record %llu: $Bitmap marks %llu free clusters as in use\n",
+};
+
+typedef struct _NTFS_CHECK_RUN
+{
+    ULONGLONG Vcn;
+    LONGLONG Lcn;               /* NTFS_CHECK_LCN_SPARSE for a hole */
+    ULONGLONG Clusters;
+} NTFS_CHECK_RUN, *PNTFS_CHECK_RUN;
+
+typedef struct _NTFS_CHECK_STREAM
+{
+    PNTFS_CHECK_RUN Runs;
+    ULONG RunCount;
+    ULONG MaxRuns;
+    ULONGLONG NextVcn;
+    ULONGLONG DataSize;
+    PUCHAR Resident;            /* Copy of the value of a resident attribute */
+} NTFS_CHECK_STREAM, *PNTFS_CHECK_STREAM;
+
+typedef struct _NTFS_CHECK_REPORT
+{
+    ULONGLONG MftIndex;
+    ULONGLONG Value;
+    NTFS_CHECK_ERROR Error;
+} NTFS_CHECK_REPORT, *PNTFS_CHECK_REPORT;
+
+/* Position in an index node during the walk of a directory index */
+typedef struct _NTFS_CHECK_LEVEL
+{
+    PUCHAR Entries;             /* Start of the INDEX_HEADER_ATTRIBUTE */
+    ULONG Offset;
+    ULONG End;
+    ULONGLONG Vcn;
+    BOOLEAN Node;
+    BOOLEAN Descended;
+} NTFS_CHECK_LEVEL, *PNTFS_CHECK_LEVEL;
+
+struct _NTFS_CHECK_CONTEXT;
+
+typedef struct _NTFS_CHECK_WORKER_CONTEXT
+{
+    struct _NTFS_CHECK_CONTEXT *Check;
+    ULONG Number;
+    NTSTATUS Status;
+
+    PUCHAR Chunk;
+    PUCHAR Record;              /* Extension records of the file being checked */
+    PUCHAR IndexBlocks;         /* One index record per level */
+    NTFS_CHECK_STREAM IndexRoot;
+    NTFS_CHECK_STREAM IndexAllocation;
+    NTFS_CHECK_STREAM IndexBitmap;
+    PUCHAR Visited;
+    ULONG VisitedSize;
+    NTFS_CHECK_LEVEL Levels[NTFS_CHECK_MAX_DEPTH];
+    WCHAR PreviousName[256];
+    ULONG PreviousLength;
+
+    ULONGLONG FileRecords;
+    ULONGLONG Directories;
+    ULONGLONG IndexEntries;
+    ULONG Errors;
+    ULONG ReportCount;
+    NTFS_CHECK_REPORT Reports[NTFS_CHECK_MAX_REPORTS];
+} NTFS_CHECK_WORKER_CONTEXT, *PNTFS_CHECK_WORKER_CONTEXT;
+
+typedef struct _NTFS_CHECK_CONTEXT
+{
+    PNTFS_CHECK_PARAMETERS Parameters;
+    PNTFS_CHECK_RESULTS Results;
+
+    ULONG BytesPerSector;
+    ULONG BytesPerCluster;
+    ULONG BytesPerFileRecord;
+    ULONG BytesPerIndexRecord;
+    ULONG BytesPerIndexVcn;
+    ULONGLONG ClusterCount;
+    ULONGLONG MftLcn;
+
+    NTFS_CHECK_STREAM Mft;
+    ULONGLONG MftRecords;
+    PUCHAR MftBitmap;
+    PWCHAR UpCase;
+
+    /* Shared by the workers, only updated with interlocked operations */
+    volatile LONG *Clusters;    /* Clusters used by the files */
+    volatile LONG *Balances;    /* Per directory, $FILE_NAME minus $I30 entry hashes */
+    volatile LONG *Damaged;     /* Directories whose index is already reported */
+    volatile LONG NextChunk;
+    volatile LONG ChunksDone;
+    volatile LONG Failed;
+    volatile LONG RecordDamage;
+    volatile LONG SystemDamage;
+    ULONG ChunkCount;
+    ULONG RecordsPerChunk;
+
+    ULONG Messages;
+    PNTFS_CHECK_WORKER_CONTEXT Workers[NTFS_CHECK_MAX_THREADS];
+    ULONG WorkerCount;
+} NTFS_CHECK_CONTEXT, *PNTFS_CHECK_CONTEXT;
+
+/* FUNCTIONS ****************************************************************/
+
+static
+VOID
+NtfsCheckPrint(PNTFS_CHECK_CONTEXT Check,
+               PCSTR Format,
+               ...)
+{
+    CHAR Message[256];
+    va_list Arguments;
+
+    va_start(Arguments, Format);
+    _vsnprintf(Message, sizeof(Message), Format, Arguments);
+    va_end(Arguments);
+    Message[sizeof(Message) - 1] = 0;
+
+    Check->Parameters->MessageRoutine(Check->Parameters->Context, Message);
+}
+
+static
+VOID
+NtfsCheckPrintError(PNTFS_CHECK_CONTEXT Check,
+                    NTFS_CHECK_ERROR Error,
+                    ULONGLONG MftIndex,
+                    ULONGLONG Value)
+{
+    /* A badly damaged volume would flood the output */
+    Check->Messages++;
+    if (Check->Messages > NTFS_CHECK_MAX_MESSAGES && !Check->Parameters->Verbose)
+        return;
+
+    NtfsCheckPrint(Check, NtfsCheckMessages[Error],
+                   (unsigned long long)MftIndex, (unsigned long long)Value);
+}
+
+/* Errors found by the main thread are printed right away */
+static
+VOID
+NtfsCheckVolumeError(PNTFS_CHECK_CONTEXT Check,
+                     NTFS_CHECK_ERROR Error,
+                     ULONGLONG MftIndex,
+                     ULONGLONG Value)
+{
+    Check->Results->Errors++;
+    NtfsCheckPrintError(Check, Error, MftIndex, Value);
+}
+
+/* Errors found by the workers are kept and printed in record order once the scan is done */
+static
+VOID
+NtfsCheckRecordError(PNTFS_CHECK_WORKER_CONTEXT Worker,
+                     NTFS_CHECK_ERROR Error,
+                     ULONGLONG MftIndex,
+                     ULONGLONG Value)
+{
+    PNTFS_CHECK_CONTEXT Check = Worker->Check;
+
+    Worker->Errors++;
+    if (Worker->ReportCount < NTFS_CHECK_MAX_REPORTS)
+    {
+        Worker->Reports[Worker->ReportCount].MftIndex = MftIndex;
+        Worker->Reports[Worker->ReportCount].Value = Value;
+        Worker->Reports[Worker->ReportCount].Error = Error;
+        Worker->ReportCount++;
+    }
+
+    /* The repairs are only safe when the files they are derived from are sound */
+    if (Error < NtfsCheckErrorIndexRoot)
+        InterlockedOr(&Check->RecordDamage, 1);
+    if (MftIndex < NTFS_FILE_FIRST_USER_FILE)
+        InterlockedOr(&Check->SystemDamage, 1);
+}
+
+static
+BOOLEAN
+NtfsCheckTestBit(PUCHAR Bitmap,
+                 ULONGLONG Bit)
+{
+    return (Bitmap[Bit / 8] & (1 << (Bit % 8))) != 0;
+}
+
+static
+ULONG
+NtfsCheckCountBits(UCHAR Value)
+{
+    ULONG Count = 0;
+
+    while (Value != 0)
+    {
+        Value &= Value - 1;
+        Count++;
+    }
+
+    return Count;
+}
+
+static
+ULONG
+NtfsCheckHashName(ULONGLONG FileReference,
+                  USHORT ParentSequence,
+                  PFILENAME_ATTRIBUTE FileName)
+{
+    PUCHAR Name = (PUCHAR)FileName->Name;
+    ULONG Hash = 0x811C9DC5;
+    ULONG i;
+
+    /* FNV-1a of everything that must match between a $FILE_NAME and its index entry */
+    for (i = 0; i < sizeof(ULONGLONG); i++)
+        Hash = (Hash ^ (UCHAR)(FileReference >> (i * 8))) * 0x01000193;
+    Hash = (Hash ^ (UCHAR)ParentSequence) * 0x01000193;
+    Hash = (Hash ^ (UCHAR)(ParentSequence >> 8)) * 0x01000193;
+    Hash = (Hash ^ FileName->NameType) * 0x01000193;
+    Hash = (Hash ^ FileName->NameLength) * 0x01000193;
+    for (i = 0; i < FileName->NameLength * sizeof(WCHAR); i++)
+        Hash = (Hash ^ Name[i]) * 0x01000193;
+
+    return Hash;
+}
+
+static
+LONG
+NtfsCheckCompareNames(PNTFS_CHECK_CONTEXT Check,
+                      PCWSTR First,
+                      ULONG FirstLength,
+                      PCWSTR Second,
+                      ULONG SecondLength)
+{
+    ULONG i;
+    WCHAR FirstChar, SecondChar;
+
+    for (i = 0; i < FirstLength && i < SecondLength; i++)
+    {
+        FirstChar = Check->UpCase[First[i]];
+        SecondChar = Check->UpCase[Second[i]];
+        if (FirstChar != SecondChar)
+            return (FirstChar < SecondChar) ? -1 : 1;
+    }
+
+    return (LONG)FirstLength - (LONG)SecondLength;
+}
+
+static
+BOOLEAN
+NtfsCheckFixups(PVOID Record,
+                ULONG Size)
+{
+    PNTFS_RECORD_HEADER Header = Record;
+    PUSHORT Usa, Block;
+    ULONG i;
+
+    if ((Header->UsaOffset & 1) != 0 ||
+        Header->UsaCount != Size / NTFS_BLOCK_SIZE + 1 ||
+        Header->UsaOffset + Header->UsaCount * sizeof(USHORT) > NTFS_BLOCK_SIZE - sizeof(USHORT))
+    {
+        return FALSE;
+    }
+
+    Usa = (PUSHORT)((PUCHAR)Record + Header->UsaOffset);
+    for (i = 1; i < Header->UsaCount; i++)
+    {
+        Block = (PUSHORT)((PUCHAR)Record + i * NTFS_BLOCK_SIZE - sizeof(USHORT));
+        if (*Block != Usa[0])
+            return FALSE;
+
+        *Block = Usa[i];
+    }
+
+    return TRUE;
+}
+
+static
+VOID
+NtfsCheckFreeStream(PNTFS_CHECK_STREAM Stream)
+{
+    if (Stream->Runs != NULL)
+        NtfsLibFree(Stream->Runs);
+    if (Stream->Resident != NULL)
+        NtfsLibFree(Stream->Resident);
+
+    RtlZeroMemory(Stream, sizeof(NTFS_CHECK_STREAM));
+}
+
+static
+VOID
+NtfsCheckResetStream(PNTFS_CHECK_STREAM Stream)
+{
+    if (Stream->Resident != NULL)
+    {
+        NtfsLibFree(Stream->Resident);
+        Stream->Resident = NULL;
+    }
+
+    Stream->RunCount = 0;
+    Stream->NextVcn = 0;
+    Stream->DataSize = 0;
+}
+
+/**
+* @name NtfsCheckNextRun
+* @implemented
+*
+* Decodes one mapping pair.
+*
+* @param Lcn
+* LCN of the previous run on input, of the decoded run on output. Holes
+* leave it alone.
+*
+* @return
+* 1 for a run, 0 at the end of the mapping pairs or -1 if they are damaged.
+*/
+static
+LONG
+NtfsCheckNextRun(PUCHAR *Pairs,
+                 PUCHAR End,
+                 LONGLONG *Lcn,
+                 ULONGLONG *Clusters,
+                 PBOOLEAN Sparse)
+{
+    PUCHAR Pair = *Pairs;
+    UCHAR LengthSize, OffsetSize;
+    ULONGLONG Length = 0, Offset = 0;
+    ULONG i;
+
+    if (Pair >= End)
+        return -1;
+    if (*Pair == 0)
+        return 0;
+
+    LengthSize = *Pair & 0xF;
+    OffsetSize = *Pair >> 4;
+    Pair++;
+    if (LengthSize == 0 || LengthSize > 8 || OffsetSize > 8 || Pair + LengthSize + OffsetSize > End)
+        return -1;
+
+    for (i = 0; i < LengthSize; i++)
+        Length |= (ULONGLONG)Pair[i] << (i * 8);
+    Pair += LengthSize;
+
+    if (OffsetSize != 0)
+    {
+        for (i = 0; i < OffsetSize; i++)
+            Offset |= (ULONGLONG)Pair[i] << (i * 8);
+        if (OffsetSize < 8 && (Pair[OffsetSize - 1] & 0x80) != 0)
+            Offset |= ~0ULL << (OffsetSize * 8);
+        Pair += OffsetSize;
+
+        *Lcn += (LONGLONG)Offset;
+    }
+
+    if ((LONGLONG)Length <= 0)
+        return -1;
+
+    *Clusters = Length;
+    *Sparse = (OffsetSize == 0);
+    *Pairs = Pair;
+    return 1;
+}
+
+static
+BOOLEAN
+NtfsCheckValidRun(PNTFS_CHECK_CONTEXT Check,
+                  LONGLONG Lcn,
+                  ULONGLONG Clusters)
+{
+    return Lcn >= 0 && (ULONGLONG)Lcn < Check->ClusterCount && Clusters <= Check->ClusterCount - Lcn;
+}
+
+/* Empty attributes have no runs, and the driver leaves either -1 or 0 as their highest VCN */
+static
+BOOLEAN
+NtfsCheckValidVcnRange(PNTFS_ATTR_RECORD Attribute,
+                       ULONGLONG Clusters)
+{
+    ULONGLONG LowestVcn = Attribute->NonResident.LowestVCN;
+    ULONGLONG HighestVcn = Attribute->NonResident.HighestVCN;
+
+    if (Clusters == 0)
+        return HighestVcn + 1 == LowestVcn || (LowestVcn == 0 && HighestVcn == 0);
+
+    return HighestVcn >= LowestVcn && HighestVcn - LowestVcn + 1 == Clusters;
+}
+
+static
+NTSTATUS
+NtfsCheckAddRuns(PNTFS_CHECK_CONTEXT Check,
+                 PNTFS_CHECK_STREAM Stream,
+                 PNTFS_ATTR_RECORD Attribute)
+{
+    PUCHAR Pairs, End;
+    PNTFS_CHECK_RUN Runs;
+    LONGLONG Lcn = 0;
+    ULONGLONG Clusters, FirstVcn;
+    BOOLEAN Sparse;
+    LONG Result;
+
+    if (Attribute->NonResident.MappingPairsOffset >= Attribute->Length)
+        return STATUS_DISK_CORRUPT_ERROR;
+
+    if (Attribute->NonResident.LowestVCN == 0)
+    {
+        NtfsCheckResetStream(Stream);
+        Stream->DataSize = Attribute->NonResident.DataSize;
+    }
+    else if (Stream->Resident != NULL || Attribute->NonResident.LowestVCN != Stream->NextVcn)
+    {
+        return STATUS_DISK_CORRUPT_ERROR;
+    }
+
+    FirstVcn = Stream->NextVcn;
+    Pairs = (PUCHAR)Attribute + Attribute->NonResident.MappingPairsOffset;
+    End = (PUCHAR)Attribute + Attribute->Length;
+    while ((Result = NtfsCheckNextRun(&Pairs, End, &Lcn, &Clusters, &Sparse)) > 0)
+    {
+        if (!Sparse && !NtfsCheckValidRun(Check, Lcn, Clusters))
+            return STATUS_DISK_CORRUPT_ERROR;
+
+        if (Stream->RunCount == Stream->MaxRuns)
+        {
+            Runs = NtfsLibAllocate((Stream->MaxRuns + NTFS_CHECK_RUN_INCREMENT) * sizeof(NTFS_CHECK_RUN));
+            if (Runs == NULL)
+                return STATUS_INSUFFICIENT_RESOURCES;
+
+            if (Stream->Runs != NULL)
+            {
+                RtlCopyMemory(Runs, Stream->Runs, Stream->RunCount * sizeof(NTFS_CHECK_RUN));
+                NtfsLibFree(Stream->Runs);
+            }
+            Stream->Runs = Runs;
+            Stream->MaxRuns += NTFS_CHECK_RUN_INCREMENT;
+        }
+
+        Stream->Runs[Stream->RunCount].Vcn = Stream->NextVcn;
+        Stream->Runs[Stream->RunCount].Lcn = Sparse ? NTFS_CHECK_LCN_SPARSE : Lcn;
+        Stream->Runs[Stream->RunCount].Clusters = Clusters;
+        Stream->RunCount++;
+        Stream->NextVcn += Clusters;
+    }
+
+    if (Result < 0 || !NtfsCheckValidVcnRange(Attribute, Stream->NextVcn - FirstVcn))
+        return STATUS_DISK_CORRUPT_ERROR;
+
+    return STATUS_SUCCESS;
+}
+
+static
+NTSTATUS
+NtfsCheckAddExtent(PNTFS_CHECK_CONTEXT Check,
+                   PNTFS_CHECK_STREAM Stream,
+                   PNTFS_ATTR_RECORD Attribute)
+{
+    if (Attribute->IsNonResident)
+        return NtfsCheckAddRuns(Check, Stream, Attribute);
+
+    /* A resident attribute has a single extent */
+    if (Stream->Resident != NULL || Stream->RunCount != 0 ||
+        Attribute->Resident.ValueOffset + Attribute->Resident.ValueLength > Attribute->Length)
+    {
+        return STATUS_DISK_CORRUPT_ERROR;
+    }
+
+    Stream->Resident = NtfsLibAllocate(max(Attribute->Resident.ValueLength, 1));
+    if (Stream->Resident == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    RtlCopyMemory(Stream->Resident,
+                  (PUCHAR)Attribute + Attribute->Resident.ValueOffset,
+                  Attribute->Resident.ValueLength);
+    Stream->DataSize = Attribute->Resident.ValueLength;
+
+    return STATUS_SUCCESS;
+}
+
+static
+PNTFS_CHECK_RUN
+NtfsCheckFindRun(PNTFS_CHECK_STREAM Stream,
+                 ULONGLONG Vcn)
+{
+    ULONG Low = 0, High = Stream->RunCount, Middle;
+
+    while (Low < High)
+    {
+        Middle = (Low + High) / 2;
+        if (Vcn < Stream->Runs[Middle].Vcn)
+            High = Middle;
+        else if (Vcn >= Stream->Runs[Middle].Vcn + Stream->Runs[Middle].Clusters)
+            Low = Middle + 1;
+        else
+            return &Stream->Runs[Middle];
+    }
+
+    return NULL;
+}
+
+/**
+* @name NtfsCheckTransfer
+* @implemented
+*
+* Reads or writes a range of a stream, one request per run.
+*
+* @return
+* STATUS_SUCCESS, STATUS_DISK_CORRUPT_ERROR if the range isn't allocated
+* or the error of the read or write routine.
+*/
+static
+NTSTATUS
+NtfsCheckTransfer(PNTFS_CHECK_CONTEXT Check,
+                  PNTFS_CHECK_STREAM Stream,
+                  ULONGLONG Offset,
+                  PVOID Buffer,
+                  ULONG Length,
+                  BOOLEAN Write)
+{
+    PNTFS_CHECK_PARAMETERS Parameters = Check->Parameters;
+    PUCHAR Data = Buffer;
+    PNTFS_CHECK_RUN Run;
+    ULONGLONG RunOffset;
+    ULONG Size;
+    NTSTATUS Status;
+
+    if (Stream->Resident != NULL)
+    {
+        if (Write || Offset > Stream->DataSize || Length > Stream->DataSize - Offset)
+            return STATUS_DISK_CORRUPT_ERROR;
+
+        RtlCopyMemory(Buffer, Stream->Resident + Offset, Length);
+        return STATUS_SUCCESS;
+    }
+
+    while (Length > 0)
+    {
+        Run = NtfsCheckFindRun(Stream, Offset / Check->BytesPerCluster);
+        if (Run == NULL)
+            return STATUS_DISK_CORRUPT_ERROR;
+
+        RunOffset = Offset - Run->Vcn * Check->BytesPerCluster;
+        Size = (ULONG)min(Length, Run->Clusters * Check->BytesPerCluster - RunOffset);
+
+        if (Run->Lcn == NTFS_CHECK_LCN_SPARSE)
+        {
+            if (Write)
+                return STATUS_DISK_CORRUPT_ERROR;
+
+            RtlZeroMemory(Data, Size);
+        }
+        else
+        {
+            if (Write)
+                Status = Parameters->WriteRoutine(Parameters->Context, Run->Lcn * Check->BytesPerCluster + RunOffset, Data, Size);
+            else
+                Status = Parameters->ReadRoutine(Parameters->Context, Run->Lcn * Check->BytesPerCluster + RunOffset, Data, Size);
+            if (!NT_SUCCESS(Status))
+                return Status;
+        }
+
+        Offset += Size;
+        Data += Size;
+        Length -= Size;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/* Failures other than damage of the volume stop the check */
+static
+BOOLEAN
+NtfsCheckIsFatal(NTSTATUS Status)
+{
+    return !NT_SUCCESS(Status) &&
+           Status != STATUS_DISK_CORRUPT_ERROR &&
+           Status != STATUS_OBJECT_NAME_NOT_FOUND;
+}
+
+static
+NTSTATUS
+NtfsCheckReadRecord(PNTFS_CHECK_CONTEXT Check,
+                    ULONGLONG MftIndex,
+                    PFILE_RECORD_HEADER Record)
+{
+    NTSTATUS Status;
+
+    if (MftIndex >= Check->MftRecords)
+        return STATUS_DISK_CORRUPT_ERROR;
+
+    Status = NtfsCheckTransfer(Check, &Check->Mft, MftIndex * Check->BytesPerFileRecord,
+                               Record, Check->BytesPerFileRecord, FALSE);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    if (Record->Ntfs.Type != NRH_FILE_TYPE ||
+        !NtfsCheckFixups(Record, Check->BytesPerFileRecord) ||
+        !(Record->Flags & FRH_IN_USE) ||
+        Record->BytesInUse > Check->BytesPerFileRecord ||
+        Record->AttributeOffset >= Record->BytesInUse)
+    {
+        return STATUS_DISK_CORRUPT_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+* @name NtfsCheckFindAttribute
+* @implemented
+*
+* Finds an attribute in a single file record, stopping at the first one
+* which doesn't fit in the record.
+*
+* @param Instance
+* Instance of the attribute, or -1 for the first one of that type and name.
+*/
+static
+PNTFS_ATTR_RECORD
+NtfsCheckFindAttribute(PFILE_RECORD_HEADER Record,
+                       ULONG Type,
+                       PCWSTR Name,
+                       ULONG NameLength,
+                       LONG Instance)
+{
+    PNTFS_ATTR_RECORD Attribute;
+    ULONG Offset = Record->AttributeOffset;
+
+    while (Offset + FIELD_OFFSET(NTFS_ATTR_RECORD, Resident) <= Record->BytesInUse)
+    {
+        Attribute = (PNTFS_ATTR_RECORD)((PUCHAR)Record + Offset);
+        if (Attribute->Type == AttributeEnd ||
+            Attribute->Length < FIELD_OFFSET(NTFS_ATTR_RECORD, Resident) ||
+            Offset + Attribute->Length > Record->BytesInUse ||
+            Attribute->NameOffset + Attribute->NameLength * sizeof(WCHAR) > Attribute->Length)
+        {
+            break;
+        }
+
+        if (Attribute->Type == Type &&
+            Attribute->NameLength == NameLength &&
+            (Instance < 0 || Attribute->Instance == Instance) &&
+            RtlEqualMemory((PUCHAR)Attribute + Attribute->NameOffset, Name, NameLength * sizeof(WCHAR)))
+        {
+            return Attribute;
+        }
+
+        Offset += Attribute->Length;
+    }
+
+    return NULL;
+}
+
+static
+NTSTATUS
+NtfsCheckReadAttributeList(PNTFS_CHECK_CONTEXT Check,
+                           PNTFS_ATTR_RECORD Attribute,
+                           PUCHAR *List,
+                           PULONG ListLength)
+{
+    NTFS_CHECK_STREAM Stream;
+    NTSTATUS Status;
+
+    RtlZeroMemory(&Stream, sizeof(Stream));
+    Status = NtfsCheckAddExtent(Check, &Stream, Attribute);
+    if (NT_SUCCESS(Status) && Stream.DataSize > NTFS_CHECK_MAX_LIST_SIZE)
+        Status = STATUS_DISK_CORRUPT_ERROR;
+
+    if (NT_SUCCESS(Status))
+    {
+        *ListLength = (ULONG)Stream.DataSize;
+        *List = NtfsLibAllocate(max(*ListLength, 1));
+        if (*List == NULL)
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        Status = NtfsCheckTransfer(Check, &Stream, 0, *List, *ListLength, FALSE);
+        if (!NT_SUCCESS(Status))
+            NtfsLibFree(*List);
+    }
+
+    NtfsCheckFreeStream(&Stream);
+    return Status;
+}
+
+/**
+* @name NtfsCheckLoadAttribute
+* @implemented
+*
+* Loads the runs, or the value when it is resident, of an attribute of a
+* file. The extents of a file with an $ATTRIBUTE_LIST are gathered from its
+* extension records.
+*
+* @param Scratch
+* Buffer of a file record, used to read the extension records.
+*
+* @return
+* STATUS_SUCCESS, STATUS_OBJECT_NAME_NOT_FOUND if the file has no such
+* attribute, STATUS_DISK_CORRUPT_ERROR if it is damaged or an I/O error.
+*/
+static
+NTSTATUS
+NtfsCheckLoadAttribute(PNTFS_CHECK_CONTEXT Check,
+                       PFILE_RECORD_HEADER BaseRecord,
+                       ULONGLONG BaseIndex,
+                       ULONG Type,
+                       PCWSTR Name,
+                       ULONG NameLength,
+                       PFILE_RECORD_HEADER Scratch,
+                       PNTFS_CHECK_STREAM Stream)
+{
+    PNTFS_ATTR_RECORD Attribute;
+    PNTFS_ATTRIBUTE_LIST_ITEM Item;
+    PFILE_RECORD_HEADER Record;
+    PUCHAR List = NULL;
+    ULONG ListLength = 0, Offset;
+    BOOLEAN Found = FALSE;
+    NTSTATUS Status;
+
+    NtfsCheckResetStream(Stream);
+
+    Attribute = NtfsCheckFindAttribute(BaseRecord, AttributeAttributeList, NULL, 0, -1);
+    if (Attribute == NULL)
+    {
+        Attribute = NtfsCheckFindAttribute(BaseRecord, Type, Name, NameLength, -1);
+        if (Attribute == NULL)
+            return STATUS_OBJECT_NAME_NOT_FOUND;
+
+        return NtfsCheckAddExtent(Check, Stream, Attribute);
+    }
+
+    Status = NtfsCheckReadAttributeList(Check, Attribute, &List, &ListLength);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    /* The list is sorted, the extents of an attribute come by increasing VCN */
+    for (Offset = 0; Offset + sizeof(NTFS_ATTRIBUTE_LIST_ITEM) <= ListLength; Offset += Item->Length)
+    {
+        Item = (PNTFS_ATTRIBUTE_LIST_ITEM)(List + Offset);
+        if (Item->Length < sizeof(NTFS_ATTRIBUTE_LIST_ITEM) ||
+            Offset + Item->Length > ListLength ||
+            Item->NameOffset + Item->NameLength * sizeof(WCHAR) > Item->Length)
+        {
+            Status = STATUS_DISK_CORRUPT_ERROR;
+            break;
+        }
+
+        if (Item->Type != Type ||
+            Item->NameLength != NameLength ||
+            !RtlEqualMemory((PUCHAR)Item + Item->NameOffset, Name, NameLength * sizeof(WCHAR)))
+        {
+            continue;
+        }
+
+        if ((Item->MFTIndex & NTFS_MFT_MASK) == BaseIndex)
+        {
+            Record = BaseRecord;
+        }
+        else
+        {
+            Status = NtfsCheckReadRecord(Check, Item->MFTIndex & NTFS_MFT_MASK, Scratch);
+            if (!NT_SUCCESS(Status))
+                break;
+
+            if ((Scratch->BaseFileRecord & NTFS_MFT_MASK) != BaseIndex)
+            {
+                Status = STATUS_DISK_CORRUPT_ERROR;
+                break;
+            }
+            Record = Scratch;
+        }
+
+        Attribute = NtfsCheckFindAttribute(Record, Type, Name, NameLength, Item->Instance);
+        if (Attribute == NULL)
+        {
+            Status = STATUS_DISK_CORRUPT_ERROR;
+            break;
+        }
+
+        Status = NtfsCheckAddExtent(Check, Stream, Attribute);
+        if (!NT_SUCCESS(Status))
+            break;
+
+        Found = TRUE;
+    }
+
+    NtfsLibFree(List);
+
+    if (NT_SUCCESS(Status) && !Found)
+        Status = STATUS_OBJECT_NAME_NOT_FOUND;
+
+    return Status;
+}
+
+static
+VOID
+NtfsCheckMarkClusters(PNTFS_CHECK_WORKER_CONTEXT Worker,
+                      ULONGLONG MftIndex,
+                      ULONGLONG Lcn,
+                      ULONGLONG Clusters)
+{
+    PNTFS_CHECK_CONTEXT Check = Worker->Check;
+    ULONGLONG Cluster = Lcn, End = Lcn + Clusters;
+    ULONG Bit, Count;
+    LONG Mask, Old;
+    BOOLEAN Reported = FALSE;
+
+    while (Cluster < End)
+    {
+        Bit = (ULONG)(Cluster % 32);
+        Count = (ULONG)min(32 - Bit, End - Cluster);
+        Mask = (LONG)((Count == 32) ? 0xFFFFFFFF : ((1UL << Count) - 1) << Bit);
+
+        Old = InterlockedOr(&Check->Clusters[Cluster / 32], Mask);
+        if ((Old & Mask) != 0 && !Reported)
+        {
+            /* Only the second owner of the cluster is known */
+            for (Bit = 0; !(Old & Mask & (1UL << Bit)); Bit++);
+            NtfsCheckRecordError(Worker, NtfsCheckErrorCrossLink, MftIndex, (Cluster & ~31ULL) + Bit);
+            Reported = TRUE;
+        }
+
+        Cluster += Count;
+    }
+}
+
+static
+BOOLEAN
+NtfsCheckAttributeRuns(PNTFS_CHECK_WORKER_CONTEXT Worker,
+                       ULONGLONG MftIndex,
+                       PNTFS_ATTR_RECORD Attribute)
+{
+    PUCHAR Pairs = (PUCHAR)Attribute + Attribute->NonResident.MappingPairsOffset;
+    PUCHAR End = (PUCHAR)Attribute + Attribute->Length;
+    LONGLONG Lcn = 0;
+    ULONGLONG Clusters, Total = 0;
+    BOOLEAN Sparse;
+    LONG Result;
+
+    while ((Result = NtfsCheckNextRun(&Pairs, End, &Lcn, &Clusters, &Sparse)) > 0)
+    {
+        if (!Sparse)
+        {
+            if (!NtfsCheckValidRun(Worker->Check, Lcn, Clusters))
+                return FALSE;
+
+            NtfsCheckMarkClusters(Worker, MftIndex, Lcn, Clusters);
+        }
+
+        Total += Clusters;
+    }
+
+    return Result == 0 && NtfsCheckValidVcnRange(Attribute, Total);
+}
+
+static
+VOID
+NtfsCheckAddFileName(PNTFS_CHECK_WORKER_CONTEXT Worker,
+                     ULONGLONG FileReference,
+                     PFILENAME_ATTRIBUTE FileName)
+{
+    PNTFS_CHECK_CONTEXT Check = Worker->Check;
+    ULONGLONG Parent = FileName->DirectoryFileReferenceNumber & NTFS_MFT_MASK;
+
+    if (Parent >= Check->MftRecords)
+    {
+        NtfsCheckRecordError(Worker, NtfsCheckErrorAttribute, FileReference & NTFS_MFT_MASK, AttributeFileName);
+        return;
+    }
+
+    InterlockedExchangeAdd(&Check->Balances[Parent],
+                           (LONG)NtfsCheckHashName(FileReference,
+                                                   (USHORT)(FileName->DirectoryFileReferenceNumber >> 48),
+                                                   FileName));
+}
+
+static
+VOID
+NtfsCheckDamagedIndex(PNTFS_CHECK_WORKER_CONTEXT Worker,
+                      NTFS_CHECK_ERROR Error,
+                      ULONGLONG MftIndex,
+                      ULONGLONG Value)
+{
+    NtfsCheckRecordError(Worker, Error, MftIndex, Value);
+    InterlockedOr(&Worker->Check->Damaged[MftIndex / 32], (LONG)(1UL << (MftIndex % 32)));
+}
+
+static
+BOOLEAN
+NtfsCheckIndexHeader(PINDEX_HEADER_ATTRIBUTE Header,
+                     ULONG Size)
+{
+    return Header->FirstEntryOffset >= sizeof(INDEX_HEADER_ATTRIBUTE) &&
+           Header->FirstEntryOffset < Header->TotalSizeOfEntries &&
+           Header->TotalSizeOfEntries <= Size;
+}
+
+/**
+* @name NtfsCheckReadIndexBlock
+* @implemented
+*
+* Reads and validates a node of a directory index, which must be allocated
+* in the index bitmap and not reached before.
+*
+* @return
+* STATUS_SUCCESS, STATUS_DISK_CORRUPT_ERROR if the node is damaged or an
+* I/O error.
+*/
+static
+NTSTATUS
+NtfsCheckReadIndexBlock(PNTFS_CHECK_WORKER_CONTEXT Worker,
+                        ULONGLONG Vcn,
+                        ULONG Depth)
+{
+    PNTFS_CHECK_CONTEXT Check = Worker->Check;
+    PNTFS_CHECK_LEVEL Level = &Worker->Levels[Depth];
+    PINDEX_BUFFER Block = (PINDEX_BUFFER)(Worker->IndexBlocks + Depth * Check->BytesPerIndexRecord);
+    ULONGLONG Offset, BlockNumber;
+    NTSTATUS Status;
+
+    Offset = Vcn * Check->BytesPerIndexVcn;
+    BlockNumber = Offset / Check->BytesPerIndexRecord;
+    if (Vcn > Worker->IndexAllocation.NextVcn * Check->BytesPerCluster / Check->BytesPerIndexVcn ||
+        Offset % Check->BytesPerIndexRecord != 0 ||
+        Offset + Check->BytesPerIndexRecord > Worker->IndexAllocation.NextVcn * Check->BytesPerCluster ||
+        BlockNumber >= Worker->IndexBitmap.DataSize * 8 ||
+        !NtfsCheckTestBit(Worker->IndexBitmap.Resident, BlockNumber) ||
+        NtfsCheckTestBit(Worker->Visited, BlockNumber))
+    {
+        return STATUS_DISK_CORRUPT_ERROR;
+    }
+
+    Worker->Visited[BlockNumber / 8] |= 1 << (BlockNumber % 8);
+
+    Status = NtfsCheckTransfer(Check, &Worker->IndexAllocation, Offset, Block, Check->BytesPerIndexRecord, FALSE);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    if (Block->Ntfs.Type != NRH_INDX_TYPE ||
+        !NtfsCheckFixups(Block, Check->BytesPerIndexRecord) ||
+        Block->VCN != Vcn ||
+        !NtfsCheckIndexHeader(&Block->Header, Check->BytesPerIndexRecord - FIELD_OFFSET(INDEX_BUFFER, Header)))
+    {
+        return STATUS_DISK_CORRUPT_ERROR;
+    }
+
+    Level->Entries = (PUCHAR)&Block->Header;
+    Level->Offset = Block->Header.FirstEntryOffset;
+    Level->End = Block->Header.TotalSizeOfEntries;
+    Level->Vcn = Vcn;
+    Level->Node = (Block->Header.Flags & INDEX_NODE_LARGE) != 0;
+    Level->Descended = FALSE;
+
+    return STATUS_SUCCESS;
+}
+
+static
+BOOLEAN
+NtfsCheckValidIndexEntry(PNTFS_CHECK_LEVEL Level,
+                    PINDEX_ENTRY_ATTRIBUTE Entry)
+{
+    PFILENAME_ATTRIBUTE Key = (PFILENAME_ATTRIBUTE)(Entry + 1);
+    ULONG Available;
+
+    if (Level->Offset + sizeof(INDEX_ENTRY_ATTRIBUTE) > Level->End ||
+        Entry->Length < sizeof(INDEX_ENTRY_ATTRIBUTE) ||
+        Entry->Length % 8 != 0 ||
+        Level->Offset + Entry->Length > Level->End ||
+        ((Entry->Flags & NTFS_INDEX_ENTRY_NODE) != 0) != Level->Node)
+    {
+        return FALSE;
+    }
+
+    /* The VCN of the child node ends the entry */
+    Available = Entry->Length - sizeof(INDEX_ENTRY_ATTRIBUTE);
+    if (Entry->Flags & NTFS_INDEX_ENTRY_NODE)
+    {
+        if (Available < sizeof(ULONGLONG))
+            return FALSE;
+        Available -= sizeof(ULONGLONG);
+    }
+
+    if (Entry->Flags & NTFS_INDEX_ENTRY_END)
+        return TRUE;
+
+    return Entry->KeyLength <= Available &&
+           Entry->KeyLength >= NTFS_CHECK_FILE_NAME_SIZE &&
+           NTFS_CHECK_FILE_NAME_SIZE + Key->NameLength * sizeof(WCHAR) <= Entry->KeyLength;
+}
+
+/**
+* @name NtfsCheckDirectory
+* @implemented
+*
+* Walks the $I30 index of a directory in key order. Every node must be
+* sound, allocated and reached once, the keys must be sorted and name the
+* directory as their parent. The hash of each entry is taken from the
+* balance of the directory, which the $FILE_NAME attributes of its files
+* bring back to zero.
+*/
+static
+VOID
+NtfsCheckDirectory(PNTFS_CHECK_WORKER_CONTEXT Worker,
+                   ULONGLONG MftIndex,
+                   PFILE_RECORD_HEADER Record)
+{
+    PNTFS_CHECK_CONTEXT Check = Worker->Check;
+    PINDEX_ROOT_ATTRIBUTE Root;
+    PNTFS_CHECK_LEVEL Level;
+    PINDEX_ENTRY_ATTRIBUTE Entry;
+    PFILENAME_ATTRIBUTE Key;
+    PUCHAR Bitmap;
+    ULONGLONG Blocks, Block;
+    ULONG Depth, Size;
+    NTSTATUS Status;
+
+    Status = NtfsCheckLoadAttribute(Check, Record, MftIndex, AttributeIndexRoot, NtfsCheckIndexName, 4,
+                                    (PFILE_RECORD_HEADER)Worker->Record, &Worker->IndexRoot);
+    Root = (PINDEX_ROOT_ATTRIBUTE)Worker->IndexRoot.Resident;
+    if (NT_SUCCESS(Status) &&
+        (Root == NULL ||
+         Worker->IndexRoot.DataSize < sizeof(INDEX_ROOT_ATTRIBUTE) ||
+         Root->AttributeType != AttributeFileName ||
+         Root->CollationRule != COLLATION_FILE_NAME ||
+         !NtfsCheckIndexHeader(&Root->Header, (ULONG)Worker->IndexRoot.DataSize - FIELD_OFFSET(INDEX_ROOT_ATTRIBUTE, Header))))
+    {
+        Status = STATUS_DISK_CORRUPT_ERROR;
+    }
+
+    if (NT_SUCCESS(Status) && (Root->Header.Flags & INDEX_ROOT_LARGE))
+    {
+        Status = NtfsCheckLoadAttribute(Check, Record, MftIndex, AttributeIndexAllocation, NtfsCheckIndexName, 4,
+                                        (PFILE_RECORD_HEADER)Worker->Record, &Worker->IndexAllocation);
+        if (NT_SUCCESS(Status))
+        {
+            Status = NtfsCheckLoadAttribute(Check, Record, MftIndex, AttributeBitmap, NtfsCheckIndexName, 4,
+                                            (PFILE_RECORD_HEADER)Worker->Record, &Worker->IndexBitmap);
+        }
+
+        /* The bitmap is read in memory, the index blocks as they are reached */
+        if (NT_SUCCESS(Status) &&
+            (Worker->IndexAllocation.Resident != NULL ||
+             Worker->IndexBitmap.DataSize > NTFS_CHECK_MAX_LIST_SIZE))
+        {
+            Status = STATUS_DISK_CORRUPT_ERROR;
+        }
+
+        if (NT_SUCCESS(Status) && Worker->IndexBitmap.Resident == NULL)
+        {
+            Size = (ULONG)Worker->IndexBitmap.DataSize;
+            Bitmap = NtfsLibAllocate(max(Size, 1));
+            if (Bitmap == NULL)
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+            else
+                Status = NtfsCheckTransfer(Check, &Worker->IndexBitmap, 0, Bitmap, Size, FALSE);
+
+            /* From now on it is used like the value of a resident bitmap */
+            if (Bitmap != NULL)
+                Worker->IndexBitmap.Resident = Bitmap;
+        }
+
+        Size = (ULONG)Worker->IndexBitmap.DataSize;
+        if (NT_SUCCESS(Status) && Size > Worker->VisitedSize)
+        {
+            if (Worker->Visited != NULL)
+                NtfsLibFree(Worker->Visited);
+
+            Worker->VisitedSize = 0;
+            Worker->Visited = NtfsLibAllocate(Size);
+            if (Worker->Visited == NULL)
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+            else
+                Worker->VisitedSize = Size;
+        }
+
+        if (NT_SUCCESS(Status))
+            RtlZeroMemory(Worker->Visited, Size);
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        if (NtfsCheckIsFatal(Status))
+            Worker->Status = Status;
+        else
+            NtfsCheckDamagedIndex(Worker, NtfsCheckErrorIndexRoot, MftIndex, 0);
+        return;
+    }
+
+    Level = &Worker->Levels[0];
+    Level->Entries = (PUCHAR)&Root->Header;
+    Level->Offset = Root->Header.FirstEntryOffset;
+    Level->End = Root->Header.TotalSizeOfEntries;
+    Level->Vcn = 0;
+    Level->Node = (Root->Header.Flags & INDEX_ROOT_LARGE) != 0;
+    Level->Descended = FALSE;
+    Worker->PreviousLength = (ULONG)-1;
+    Depth = 1;
+
+    while (Depth > 0)
+    {
+        Level = &Worker->Levels[Depth - 1];
+        Entry = (PINDEX_ENTRY_ATTRIBUTE)(Level->Entries + Level->Offset);
+        if (!NtfsCheckValidIndexEntry(Level, Entry))
+        {
+            NtfsCheckDamagedIndex(Worker, NtfsCheckErrorIndexEntry, MftIndex, Level->Vcn);
+            return;
+        }
+
+        /* The keys of the child node come before the key of the entry */
+        if ((Entry->Flags & NTFS_INDEX_ENTRY_NODE) && !Level->Descended)
+        {
+            Level->Descended = TRUE;
+
+            Block = *(ULONGLONG *)((PUCHAR)Entry + Entry->Length - sizeof(ULONGLONG));
+            Status = (Depth < NTFS_CHECK_MAX_DEPTH) ? NtfsCheckReadIndexBlock(Worker, Block, Depth) : STATUS_DISK_CORRUPT_ERROR;
+            if (!NT_SUCCESS(Status))
+            {
+                if (NtfsCheckIsFatal(Status))
+                    Worker->Status = Status;
+                else
+                    NtfsCheckDamagedIndex(Worker, NtfsCheckErrorIndexBuffer, MftIndex, Block);
+                return;
+            }
+
+            Depth++;
+            continue;
+        }
+
+        if (Entry->Flags & NTFS_INDEX_ENTRY_END)
+        {
+            Depth--;
+            continue;
+        }
+
+        Key = (PFILENAME_ATTRIBUTE)(Entry + 1);
+        if (Worker->PreviousLength != (ULONG)-1 &&
+            NtfsCheckCompareNames(Check, Worker->PreviousName, Worker->PreviousLength, Key->Name, Key->NameLength) > 0)
+        {
+            NtfsCheckDamagedIndex(Worker, NtfsCheckErrorIndexOrder, MftIndex, Entry->Data.Directory.IndexedFile & NTFS_MFT_MASK);
+        }
+
+        if ((Key->DirectoryFileReferenceNumber & NTFS_MFT_MASK) != MftIndex)
+            NtfsCheckDamagedIndex(Worker, NtfsCheckErrorIndexParent, MftIndex, Entry->Data.Directory.IndexedFile & NTFS_MFT_MASK);
+
+        InterlockedExchangeAdd(&Check->Balances[MftIndex],
+                               (LONG)(0U - NtfsCheckHashName(Entry->Data.Directory.IndexedFile, Record->SequenceNumber, Key)));
+
+        RtlCopyMemory(Worker->PreviousName, Key->Name, Key->NameLength * sizeof(WCHAR));
+        Worker->PreviousLength = Key->NameLength;
+        Worker->IndexEntries++;
+
+        Level->Descended = FALSE;
+        Level->Offset += Entry->Length;
+    }
+
+    if (!(Root->Header.Flags & INDEX_ROOT_LARGE))
+        return;
+
+    /* Whatever is allocated and wasn't reached is lost */
+    Blocks = min(Worker->IndexBitmap.DataSize * 8,
+                 Worker->IndexAllocation.NextVcn * Check->BytesPerCluster / Check->BytesPerIndexRecord);
+    for (Block = 0; Block < Blocks; Block++)
+    {
+        if (NtfsCheckTestBit(Worker->IndexBitmap.Resident, Block) && !NtfsCheckTestBit(Worker->Visited, Block))
+        {
+            NtfsCheckDamagedIndex(Worker, NtfsCheckErrorIndexBlockLost, MftIndex,
+                                  Block * Check->BytesPerIndexRecord / Check->BytesPerIndexVcn);
+            break;
+        }
+    }
+}
+
+/**
+* @name NtfsCheckFileRecord
+* @implemented
+*
+* Validates a file record marked in use in the $MFT bitmap and its
+* attributes, marks the clusters it uses and adds its names to the balance
+* of their directories. Directories also have their index checked.
+*/
+static
+VOID
+NtfsCheckFileRecord(PNTFS_CHECK_WORKER_CONTEXT Worker,
+                    ULONGLONG MftIndex,
+                    PFILE_RECORD_HEADER Record)
+{
+    PNTFS_CHECK_CONTEXT Check = Worker->Check;
+    PNTFS_ATTR_RECORD Attribute;
+    ULONGLONG FileReference;
+    ULONG Offset, PreviousType = 0;
+    BOOLEAN StandardInformation = FALSE, AttributeList = FALSE, IndexRoot = FALSE;
+    BOOLEAN Damaged = FALSE;
+
+    /* The reserved records are in the bitmap but may have never been used */
+    if (Record->Ntfs.Type != NRH_FILE_TYPE && MftIndex >= NTFS_FILE_FIRST_USER_FILE)
+    {
+        NtfsCheckRecordError(Worker, NtfsCheckErrorRecordHeader, MftIndex, 0);
+        return;
+    }
+    if (Record->Ntfs.Type != NRH_FILE_TYPE)
+        return;
+
+    if (!NtfsCheckFixups(Record, Check->BytesPerFileRecord))
+    {
+        NtfsCheckRecordError(Worker, NtfsCheckErrorRecordFixups, MftIndex, 0);
+        return;
+    }
+
+    if (!(Record->Flags & FRH_IN_USE))
+        return;
+
+    if (Record->AttributeOffset % 8 != 0 ||
+        Record->AttributeOffset < Record->Ntfs.UsaOffset + Record->Ntfs.UsaCount * sizeof(USHORT) ||
+        Record->BytesAllocated != Check->BytesPerFileRecord ||
+        Record->BytesInUse > Check->BytesPerFileRecord ||
+        Record->AttributeOffset + sizeof(ULONG) > Record->BytesInUse ||
+        (Record->Ntfs.UsaOffset >= FIELD_OFFSET(FILE_RECORD_HEADER, MFTRecordNumber) + sizeof(ULONG) &&
+         Record->MFTRecordNumber != (ULONG)MftIndex))
+    {
+        NtfsCheckRecordError(Worker, NtfsCheckErrorRecordHeader, MftIndex, 0);
+        return;
+    }
+
+    /* The names of an extension record belong to its base file */
+    if (Record->BaseFileRecord != 0)
+        FileReference = Record->BaseFileRecord;
+    else
+        FileReference = MftIndex | ((ULONGLONG)Record->SequenceNumber << 48);
+
+    Offset = Record->AttributeOffset;
+    for (;;)
+    {
+        Attribute = (PNTFS_ATTR_RECORD)((PUCHAR)Record + Offset);
+        if (Offset + sizeof(ULONG) > Record->BytesInUse)
+        {
+            NtfsCheckRecordError(Worker, NtfsCheckErrorAttribute, MftIndex, AttributeEnd);
+            Damaged = TRUE;
+            break;
+        }
+
+        if (Attribute->Type == AttributeEnd)
+            break;
+
+        if (Offset + FIELD_OFFSET(NTFS_ATTR_RECORD, Resident) > Record->BytesInUse ||
+            Attribute->Length < FIELD_OFFSET(NTFS_ATTR_RECORD, Resident.Reserved) + sizeof(UCHAR) ||
+            Attribute->Length % 8 != 0 ||
+            Offset + Attribute->Length > Record->BytesInUse ||
+            Attribute->NameOffset + Attribute->NameLength * sizeof(WCHAR) > Attribute->Length)
+        {
+            NtfsCheckRecordError(Worker, NtfsCheckErrorAttribute, MftIndex, Attribute->Type);
+            Damaged = TRUE;
+            break;
+        }
+
+        if (Attribute->Type < PreviousType)
+            NtfsCheckRecordError(Worker, NtfsCheckErrorAttributeOrder, MftIndex, Attribute->Type);
+        PreviousType = Attribute->Type;
+
+        if (!Attribute->IsNonResident)
+        {
+            if (Attribute->Resident.ValueOffset + Attribute->Resident.ValueLength > Attribute->Length)
+            {
+                NtfsCheckRecordError(Worker, NtfsCheckErrorAttribute, MftIndex, Attribute->Type);
+                Damaged = TRUE;
+                break;
+            }
+
+            switch (Attribute->Type)
+            {
+                case AttributeStandardInformation:
+                    StandardInformation = TRUE;
+                    if (Attribute->Resident.ValueLength < FIELD_OFFSET(STANDARD_INFORMATION, OwnerId))
+                        NtfsCheckRecordError(Worker, NtfsCheckErrorAttribute, MftIndex, Attribute->Type);
+                    break;
+
+                case AttributeAttributeList:
+                    AttributeList = TRUE;
+                    break;
+
+                case AttributeFileName:
+                {
+                    PFILENAME_ATTRIBUTE FileName = (PFILENAME_ATTRIBUTE)((PUCHAR)Attribute + Attribute->Resident.ValueOffset);
+
+                    if (Attribute->Resident.ValueLength < NTFS_CHECK_FILE_NAME_SIZE ||
+                        NTFS_CHECK_FILE_NAME_SIZE + FileName->NameLength * sizeof(WCHAR) > Attribute->Resident.ValueLength)
+                    {
+                        NtfsCheckRecordError(Worker, NtfsCheckErrorAttribute, MftIndex, Attribute->Type);
+                        break;
+                    }
+
+                    NtfsCheckAddFileName(Worker, FileReference, FileName);
+                    break;
+                }
+
+                case AttributeIndexRoot:
+                    if (Attribute->NameLength == 4 &&
+                        RtlEqualMemory((PUCHAR)Attribute + Attribute->NameOffset, NtfsCheckIndexName,
+                                       sizeof(NtfsCheckIndexName)))
+                    {
+                        IndexRoot = TRUE;
+                    }
+                    break;
+            }
+        }
+        else
+        {
+            if (Attribute->Length < FIELD_OFFSET(NTFS_ATTR_RECORD, NonResident.InitializedSize) + sizeof(LONGLONG) ||
+                Attribute->NonResident.MappingPairsOffset >= Attribute->Length ||
+                Attribute->Type == AttributeStandardInformation ||
+                Attribute->Type == AttributeFileName ||
+                Attribute->Type == AttributeIndexRoot)
+            {
+                NtfsCheckRecordError(Worker, NtfsCheckErrorAttribute, MftIndex, Attribute->Type);
+                Damaged = TRUE;
+                break;
+            }
+
+            if (Attribute->NonResident.LowestVCN == 0 &&
+                (Attribute->NonResident.DataSize < 0 ||
+                 Attribute->NonResident.InitializedSize > Attribute->NonResident.DataSize ||
+                 (!(Attribute->Flags & (ATTR_FLAG_COMPRESSED | ATTR_FLAG_SPARSE)) &&
+                  Attribute->NonResident.DataSize > Attribute->NonResident.AllocatedSize)))
+            {
+                NtfsCheckRecordError(Worker, NtfsCheckErrorAttribute, MftIndex, Attribute->Type);
+            }
+
+            if (!NtfsCheckAttributeRuns(Worker, MftIndex, Attribute))
+            {
+                NtfsCheckRecordError(Worker, NtfsCheckErrorMappingPairs, MftIndex, Attribute->Type);
+                Damaged = TRUE;
+            }
+        }
+
+        Offset += Attribute->Length;
+    }
+
+    if (Record->BaseFileRecord != 0)
+        return;
+
+    Worker->FileRecords++;
+    if (!StandardInformation && !Damaged)
+        NtfsCheckRecordError(Worker, NtfsCheckErrorStandardInformation, MftIndex, 0);
+
+    if (Record->Flags & FRH_DIRECTORY)
+    {
+        Worker->Directories++;
+        if (Damaged || (!IndexRoot && !AttributeList))
+            NtfsCheckDamagedIndex(Worker, NtfsCheckErrorIndexRoot, MftIndex, 0);
+        else
+            NtfsCheckDirectory(Worker, MftIndex, Record);
+    }
+}
+
+static
+BOOLEAN
+NtfsCheckAnyRecordInUse(PNTFS_CHECK_CONTEXT Check,
+                        ULONGLONG First,
+                        ULONG Count)
+{
+    ULONGLONG i;
+
+    for (i = First; i < First + Count; i++)
+    {
+        if (i % 8 == 0 && i + 8 <= First + Count && Check->MftBitmap[i / 8] == 0)
+        {
+            i += 7;
+            continue;
+        }
+
+        if (NtfsCheckTestBit(Check->MftBitmap, i))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/**
+* @name NtfsCheckWorker
+* @implemented
+*
+* Body of the workers. Each one takes the next chunk of $MFT, reads it in
+* one request and checks the records in use, until $MFT is exhausted or a
+* worker failed. Chunks without records in use aren't read at all.
+*/
+static
+VOID
+NtfsCheckWorker(PVOID Parameter)
+{
+    PNTFS_CHECK_WORKER_CONTEXT Worker = Parameter;
+    PNTFS_CHECK_CONTEXT Check = Worker->Check;
+    PNTFS_CHECK_PARAMETERS Parameters = Check->Parameters;
+    ULONGLONG First;
+    ULONG Chunk, Count, Done, i;
+
+    for (;;)
+    {
+        Chunk = (ULONG)InterlockedIncrement(&Check->NextChunk) - 1;
+        if (Chunk >= Check->ChunkCount || Check->Failed)
+            break;
+
+        First = (ULONGLONG)Chunk * Check->RecordsPerChunk;
+        Count = (ULONG)min(Check->RecordsPerChunk, Check->MftRecords - First);
+
+        if (NtfsCheckAnyRecordInUse(Check, First, Count))
+        {
+            Worker->Status = NtfsCheckTransfer(Check, &Check->Mft, First * Check->BytesPerFileRecord,
+                                               Worker->Chunk, Count * Check->BytesPerFileRecord, FALSE);
+
+            for (i = 0; i < Count && NT_SUCCESS(Worker->Status); i++)
+            {
+                if (NtfsCheckTestBit(Check->MftBitmap, First + i))
+                {
+                    NtfsCheckFileRecord(Worker, First + i,
+                                        (PFILE_RECORD_HEADER)(Worker->Chunk + i * Check->BytesPerFileRecord));
+                }
+            }
+
+            if (!NT_SUCCESS(Worker->Status))
+            {
+                DPRINT1("Checking the file records at %I64u failed (Status 0x%08x)\n", First, Worker->Status);
+                InterlockedOr(&Check->Failed, 1);
+                break;
+            }
+        }
+
+        /* The first worker reports for everyone */
+        Done = (ULONG)InterlockedIncrement(&Check->ChunksDone);
+        if (Worker->Number == 0 && Parameters->ProgressRoutine != NULL)
+            Parameters->ProgressRoutine(Parameters->Context, Done * 90 / Check->ChunkCount);
+    }
+}
+
+static
+NTSTATUS
+NtfsCheckReadBootSector(PNTFS_CHECK_CONTEXT Check)
+{
+    PNTFS_CHECK_PARAMETERS Parameters = Check->Parameters;
+    PBOOT_SECTOR BootSector;
+    ULONG SectorsPerCluster;
+    NTSTATUS Status;
+
+    BootSector = NtfsLibAllocate(sizeof(BOOT_SECTOR));
+    if (BootSector == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    Status = Parameters->ReadRoutine(Parameters->Context, 0, BootSector, sizeof(BOOT_SECTOR));
+    if (!NT_SUCCESS(Status))
+    {
+        NtfsLibFree(BootSector);
+        return Status;
+    }
+
+    /* Newer formats store large clusters as the negated log2 of their sectors */
+    SectorsPerCluster = BootSector->BPB.SectorsPerCluster;
+    if (SectorsPerCluster > 0x80)
+        SectorsPerCluster = (SectorsPerCluster < 0xF4) ? 0 : 1UL << (0x100 - SectorsPerCluster);
+
+    Check->BytesPerSector = BootSector->BPB.BytesPerSector;
+    Check->BytesPerCluster = Check->BytesPerSector * SectorsPerCluster;
+    Status = STATUS_UNRECOGNIZED_VOLUME;
+    if (!RtlEqualMemory(BootSector->OEMID, "NTFS    ", 8) ||
+        Check->BytesPerSector < 256 || Check->BytesPerSector > 4096 ||
+        (Check->BytesPerSector & (Check->BytesPerSector - 1)) != 0 ||
+        SectorsPerCluster == 0 || (SectorsPerCluster & (SectorsPerCluster - 1)) != 0 ||
+        Check->BytesPerCluster > 0x200000)
+    {
+        NtfsLibFree(BootSector);
+        return Status;
+    }
+
+    if (BootSector->EBPB.ClustersPerMftRecord > 0)
+        Check->BytesPerFileRecord = BootSector->EBPB.ClustersPerMftRecord * Check->BytesPerCluster;
+    else
+        Check->BytesPerFileRecord = 1UL << -BootSector->EBPB.ClustersPerMftRecord;
+
+    if (BootSector->EBPB.ClustersPerIndexRecord > 0)
+        Check->BytesPerIndexRecord = BootSector->EBPB.ClustersPerIndexRecord * Check->BytesPerCluster;
+    else
+        Check->BytesPerIndexRecord = 1UL << -BootSector->EBPB.ClustersPerIndexRecord;
+
+    /* Index VCNs count clusters, or 512 byte blocks for index records smaller than a cluster */
+    if (Check->BytesPerIndexRecord >= Check->BytesPerCluster)
+        Check->BytesPerIndexVcn = Check->BytesPerCluster;
+    else
+        Check->BytesPerIndexVcn = NTFS_BLOCK_SIZE;
+
+    Check->ClusterCount = BootSector->EBPB.SectorCount / SectorsPerCluster;
+    Check->MftLcn = BootSector->EBPB.MftLocation;
+
+    if (Check->BytesPerFileRecord >= NTFS_BLOCK_SIZE && Check->BytesPerFileRecord <= 0x10000 &&
+        (Check->BytesPerFileRecord & (Check->BytesPerFileRecord - 1)) == 0 &&
+        Check->BytesPerIndexRecord >= NTFS_BLOCK_SIZE && Check->BytesPerIndexRecord <= 0x10000 &&
+        (Check->BytesPerIndexRecord & (Check->BytesPerIndexRecord - 1)) == 0 &&
+        Check->MftLcn < Check->ClusterCount)
+    {
+        Status = STATUS_SUCCESS;
+    }
+
+    NtfsLibFree(BootSector);
+    return Status;
+}
+
+/**
+* @name NtfsCheckLoadMft
+* @implemented
+*
+* Maps $MFT and reads its bitmap. The first extent of $MFT:$DATA, in record
+* 0 itself, is enough to reach the extension records holding the others.
+*/
+static
+NTSTATUS
+NtfsCheckLoadMft(PNTFS_CHECK_CONTEXT Check,
+                 PFILE_RECORD_HEADER Record,
+                 PFILE_RECORD_HEADER Scratch)
+{
+    PNTFS_CHECK_PARAMETERS Parameters = Check->Parameters;
+    PNTFS_ATTR_RECORD Attribute;
+    NTFS_CHECK_STREAM Stream;
+    NTSTATUS Status;
+    ULONG Size;
+
+    Status = Parameters->ReadRoutine(Parameters->Context, Check->MftLcn * Check->BytesPerCluster,
+                                     Record, Check->BytesPerFileRecord);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    if (Record->Ntfs.Type != NRH_FILE_TYPE ||
+        !NtfsCheckFixups(Record, Check->BytesPerFileRecord) ||
+        Record->BytesInUse > Check->BytesPerFileRecord ||
+        Record->AttributeOffset >= Record->BytesInUse)
+    {
+        DPRINT1("The file record of $MFT is damaged\n");
+        return STATUS_DISK_CORRUPT_ERROR;
+    }
+
+    Attribute = NtfsCheckFindAttribute(Record, AttributeData, NULL, 0, -1);
+    if (Attribute == NULL || !Attribute->IsNonResident || Attribute->NonResident.LowestVCN != 0)
+        return STATUS_DISK_CORRUPT_ERROR;
+
+    Status = NtfsCheckAddRuns(Check, &Check->Mft, Attribute);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    RtlZeroMemory(&Stream, sizeof(Stream));
+    Status = NtfsCheckLoadAttribute(Check, Record, NTFS_FILE_MFT, AttributeData, NULL, 0, Scratch, &Stream);
+    if (!NT_SUCCESS(Status))
+    {
+        NtfsCheckFreeStream(&Stream);
+        return Status;
+    }
+
+    NtfsCheckFreeStream(&Check->Mft);
+    Check->Mft = Stream;
+    Check->MftRecords = min(Check->Mft.DataSize, Check->Mft.NextVcn * Check->BytesPerCluster) / Check->BytesPerFileRecord;
+    if (Check->MftRecords < NTFS_FILE_FIRST_USER_FILE)
+        return STATUS_DISK_CORRUPT_ERROR;
+
+    /* Records past the end of the bitmap are free */
+    RtlZeroMemory(&Stream, sizeof(Stream));
+    Status = NtfsCheckLoadAttribute(Check, Record, NTFS_FILE_MFT, AttributeBitmap, NULL, 0, Scratch, &Stream);
+    if (NT_SUCCESS(Status))
+    {
+        Size = (ULONG)min(Stream.DataSize, (Check->MftRecords + 7) / 8);
+        Check->MftBitmap = NtfsLibAllocate((SIZE_T)(Check->MftRecords + 7) / 8);
+        if (Check->MftBitmap == NULL)
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+        else
+            Status = NtfsCheckTransfer(Check, &Stream, 0, Check->MftBitmap, Size, FALSE);
+    }
+
+    NtfsCheckFreeStream(&Stream);
+    return Status;
+}
+
+static
+NTSTATUS
+NtfsCheckIsDirty(PNTFS_CHECK_CONTEXT Check,
+                 PFILE_RECORD_HEADER Record,
+                 PBOOLEAN Dirty)
+{
+    PNTFS_ATTR_RECORD Attribute;
+    PVOLINFO_ATTRIBUTE VolumeInformation;
+    NTSTATUS Status;
+
+    Status = NtfsCheckReadRecord(Check, NTFS_FILE_VOLUME, Record);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    /* Without a readable state, the volume has to be checked */
+    *Dirty = TRUE;
+    Attribute = NtfsCheckFindAttribute(Record, AttributeVolumeInformation, NULL, 0, -1);
+    if (Attribute != NULL && !Attribute->IsNonResident &&
+        Attribute->Resident.ValueLength >= sizeof(VOLINFO_ATTRIBUTE) &&
+        Attribute->Resident.ValueOffset + Attribute->Resident.ValueLength <= Attribute->Length)
+    {
+        VolumeInformation = (PVOLINFO_ATTRIBUTE)((PUCHAR)Attribute + Attribute->Resident.ValueOffset);
+        *Dirty = (VolumeInformation->Flags & VOLUME_IS_DIRTY) != 0;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static
+ULONG
+NtfsCheckLogChecksum(PUCHAR Buffer,
+                     ULONG Length)
+{
+    PULONG Data = (PULONG)Buffer;
+    ULONG Checksum = 0;
+    ULONG i;
+
+    for (i = 0; i < Length / sizeof(ULONG); i++)
+        Checksum = ((Checksum << 1) | (Checksum >> 31)) + Data[i];
+
+    return Checksum;
+}
+
+/**
+* @name NtfsCheckIsLogEmpty
+* @implemented
+*
+* Looks for records in the metadata journal of the ReactOS driver, which it
+* keeps in $LogFile: the driver applies them when it mounts the volume, and
+* until then the metadata on the disk is older than they are.
+*
+* @param Empty
+* Set to FALSE if the record that follows the restart area is complete, the
+* same way as the driver decides to apply it.
+*
+* @return
+* STATUS_SUCCESS, or the error that prevented reading $LogFile.
+*/
+static
+NTSTATUS
+NtfsCheckIsLogEmpty(PNTFS_CHECK_CONTEXT Check,
+                    PFILE_RECORD_HEADER Record,
+                    PFILE_RECORD_HEADER Scratch,
+                    PBOOLEAN Empty)
+{
+    NTFS_CHECK_STREAM Stream;
+    NTFS_LOG_RESTART_AREA RestartArea;
+    NTFS_LOG_RECORD_HEADER Header;
+    PUCHAR Buffer = NULL;
+    ULONG Checksum;
+    NTSTATUS Status;
+
+    *Empty = TRUE;
+
+    RtlZeroMemory(&Stream, sizeof(Stream));
+    Status = NtfsCheckReadRecord(Check, NTFS_FILE_LOGFILE, Record);
+    if (NT_SUCCESS(Status))
+        Status = NtfsCheckLoadAttribute(Check, Record, NTFS_FILE_LOGFILE, AttributeData, NULL, 0, Scratch, &Stream);
+    if (!NT_SUCCESS(Status) || Stream.DataSize < NTFS_LOG_RESTART_OFFSET + sizeof(RestartArea))
+        goto Cleanup;
+
+    Status = NtfsCheckTransfer(Check, &Stream, NTFS_LOG_RESTART_OFFSET, &RestartArea, sizeof(RestartArea), FALSE);
+    if (!NT_SUCCESS(Status))
+        goto Cleanup;
+
+    /* Windows only leaves 0xFF there, or its own log which it applies itself */
+    Checksum = RestartArea.Checksum;
+    RestartArea.Checksum = 0;
+    if (RestartArea.Signature != NTFS_LOG_RESTART_SIGNATURE ||
+        RestartArea.Version != NTFS_LOG_VERSION ||
+        NtfsCheckLogChecksum((PUCHAR)&RestartArea, sizeof(RestartArea)) != Checksum ||
+        RestartArea.AreaStart >= RestartArea.AreaEnd ||
+        RestartArea.AreaEnd > Stream.DataSize ||
+        RestartArea.AreaEnd - RestartArea.AreaStart < sizeof(Header))
+    {
+        goto Cleanup;
+    }
+
+    Status = NtfsCheckTransfer(Check, &Stream, RestartArea.AreaStart, &Header, sizeof(Header), FALSE);
+    if (!NT_SUCCESS(Status))
+        goto Cleanup;
+
+    /* Older records, that the driver already wrote in place, end the log */
+    if (Header.Signature != NTFS_LOG_RECORD_SIGNATURE ||
+        Header.Sequence != RestartArea.NextSequence ||
+        Header.HeaderSectors == 0 ||
+        Header.SectorCount == 0 ||
+        Header.Length > NTFS_LOG_MAX_RECORD_SIZE ||
+        (ULONGLONG)Header.Length != ((ULONGLONG)Header.HeaderSectors + Header.SectorCount) * Check->BytesPerSector ||
+        Header.Length > RestartArea.AreaEnd - RestartArea.AreaStart)
+    {
+        goto Cleanup;
+    }
+
+    Buffer = NtfsLibAllocate(Header.Length);
+    if (Buffer == NULL)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Cleanup;
+    }
+
+    Status = NtfsCheckTransfer(Check, &Stream, RestartArea.AreaStart, Buffer, Header.Length, FALSE);
+    if (!NT_SUCCESS(Status))
+        goto Cleanup;
+
+    /* A record that was only partly written isn't applied */
+    ((PNTFS_LOG_RECORD_HEADER)Buffer)->Checksum = 0;
+    *Empty = (NtfsCheckLogChecksum(Buffer, Header.Length) != Header.Checksum);
+
+Cleanup:
+    if (Buffer != NULL)
+        NtfsLibFree(Buffer);
+    NtfsCheckFreeStream(&Stream);
+
+    return Status;
+}
+
+static
+NTSTATUS
+NtfsCheckLoadUpCase(PNTFS_CHECK_CONTEXT Check,
+                    PFILE_RECORD_HEADER Record,
+                    PFILE_RECORD_HEADER Scratch)
+{
+    NTFS_CHECK_STREAM Stream;
+    NTSTATUS Status;
+    ULONG i;
+
+    Check->UpCase = NtfsLibAllocate(NTFS_CHECK_UPCASE_SIZE);
+    if (Check->UpCase == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    RtlZeroMemory(&Stream, sizeof(Stream));
+    Status = NtfsCheckReadRecord(Check, NTFS_FILE_UPCASE, Record);
+    if (NT_SUCCESS(Status))
+        Status = NtfsCheckLoadAttribute(Check, Record, NTFS_FILE_UPCASE, AttributeData, NULL, 0, Scratch, &Stream);
+    if (NT_SUCCESS(Status) && Stream.DataSize < NTFS_CHECK_UPCASE_SIZE)
+        Status = STATUS_DISK_CORRUPT_ERROR;
+    if (NT_SUCCESS(Status))
+        Status = NtfsCheckTransfer(Check, &Stream, 0, Check->UpCase, NTFS_CHECK_UPCASE_SIZE, FALSE);
+
+    NtfsCheckFreeStream(&Stream);
+    if (NtfsCheckIsFatal(Status))
+        return Status;
+
+    /* The index order is still worth checking for the common names */
+    if (!NT_SUCCESS(Status))
+    {
+        NtfsCheckVolumeError(Check, NtfsCheckErrorUpCase, NTFS_FILE_UPCASE, 0);
+        for (i = 0; i < NTFS_CHECK_UPCASE_SIZE / sizeof(WCHAR); i++)
+            Check->UpCase[i] = (i >= 'a' && i <= 'z') ? (WCHAR)(i - ('a' - 'A')) : (WCHAR)i;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static
+PNTFS_CHECK_WORKER_CONTEXT
+NtfsCheckAllocateWorker(PNTFS_CHECK_CONTEXT Check,
+                        ULONG Number)
+{
+    PNTFS_CHECK_WORKER_CONTEXT Worker;
+
+    Worker = NtfsLibAllocate(sizeof(NTFS_CHECK_WORKER_CONTEXT));
+    if (Worker == NULL)
+        return NULL;
+
+    Worker->Check = Check;
+    Worker->Number = Number;
+    Worker->Chunk = NtfsLibAllocate(NTFS_CHECK_CHUNK_SIZE);
+    Worker->Record = NtfsLibAllocate(Check->BytesPerFileRecord);
+    Worker->IndexBlocks = NtfsLibAllocate(NTFS_CHECK_MAX_DEPTH * Check->BytesPerIndexRecord);
+    if (Worker->Chunk == NULL || Worker->Record == NULL || Worker->IndexBlocks == NULL)
+    {
+        if (Worker->Chunk != NULL)
+            NtfsLibFree(Worker->Chunk);
+        if (Worker->Record != NULL)
+            NtfsLibFree(Worker->Record);
+        if (Worker->IndexBlocks != NULL)
+            NtfsLibFree(Worker->IndexBlocks);
+        NtfsLibFree(Worker);
+        return NULL;
+    }
+
+    return Worker;
+}
+
+static
+VOID
+NtfsCheckFreeWorker(PNTFS_CHECK_WORKER_CONTEXT Worker)
+{
+    NtfsCheckFreeStream(&Worker->IndexRoot);
+    NtfsCheckFreeStream(&Worker->IndexAllocation);
+    NtfsCheckFreeStream(&Worker->IndexBitmap);
+    if (Worker->Visited != NULL)
+        NtfsLibFree(Worker->Visited);
+    NtfsLibFree(Worker->IndexBlocks);
+    NtfsLibFree(Worker->Record);
+    NtfsLibFree(Worker->Chunk);
+    NtfsLibFree(Worker);
+}
+
+/**
+* @name NtfsCheckScan
+* @implemented
+*
+* Runs the workers over $MFT, then prints what they found in record order.
+* Each worker holds a chunk of $MFT and the nodes of one index path, the
+* shared state is a bit per cluster and 4 bytes per file record.
+*/
+static
+NTSTATUS
+NtfsCheckScan(PNTFS_CHECK_CONTEXT Check)
+{
+    PNTFS_CHECK_PARAMETERS Parameters = Check->Parameters;
+    PNTFS_CHECK_RESULTS Results = Check->Results;
+    PVOID WorkerParameters[NTFS_CHECK_MAX_THREADS];
+    PNTFS_CHECK_REPORT Reports, Report;
+    NTFS_CHECK_REPORT Swap;
+    ULONG ReportCount = 0, Errors = 0, i, j;
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    Check->RecordsPerChunk = NTFS_CHECK_CHUNK_SIZE / Check->BytesPerFileRecord;
+    Check->ChunkCount = (ULONG)((Check->MftRecords + Check->RecordsPerChunk - 1) / Check->RecordsPerChunk);
+
+    Check->WorkerCount = min(max(Parameters->ThreadCount, 1), NTFS_CHECK_MAX_THREADS);
+    if (Parameters->RunWorkersRoutine == NULL)
+        Check->WorkerCount = 1;
+    Check->WorkerCount = min(Check->WorkerCount, Check->ChunkCount);
+
+    for (i = 0; i < Check->WorkerCount; i++)
+    {
+        Check->Workers[i] = NtfsCheckAllocateWorker(Check, i);
+        if (Check->Workers[i] == NULL)
+        {
+            /* Fewer workers will do */
+            if (i == 0)
+                return STATUS_INSUFFICIENT_RESOURCES;
+
+            Check->WorkerCount = i;
+            break;
+        }
+
+        WorkerParameters[i] = Check->Workers[i];
+    }
+
+    if (Parameters->Verbose)
+    {
+        NtfsCheckPrint(Check, "Checking %llu file records with %lu threads\n",
+                       (unsigned long long)Check->MftRecords, (unsigned long)Check->WorkerCount);
+    }
+
+    if (Check->WorkerCount > 1)
+        Status = Parameters->RunWorkersRoutine(Parameters->Context, NtfsCheckWorker, WorkerParameters, Check->WorkerCount);
+    else
+        NtfsCheckWorker(Check->Workers[0]);
+
+    for (i = 0; i < Check->WorkerCount && NT_SUCCESS(Status); i++)
+    {
+        Status = Check->Workers[i]->Status;
+        ReportCount += Check->Workers[i]->ReportCount;
+    }
+
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    Reports = NtfsLibAllocate(max(ReportCount, 1) * sizeof(NTFS_CHECK_REPORT));
+    if (Reports == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    ReportCount = 0;
+    for (i = 0; i < Check->WorkerCount; i++)
+    {
+        Results->FileRecords += Check->Workers[i]->FileRecords;
+        Results->Directories += Check->Workers[i]->Directories;
+        Results->IndexEntries += Check->Workers[i]->IndexEntries;
+        Errors += Check->Workers[i]->Errors;
+
+        for (j = 0; j < Check->Workers[i]->ReportCount; j++)
+            Reports[ReportCount++] = Check->Workers[i]->Reports[j];
+    }
+
+    /* There are at most a few thousands of them */
+    for (i = 1; i < ReportCount; i++)
+    {
+        for (j = i; j > 0 && Reports[j - 1].MftIndex > Reports[j].MftIndex; j--)
+        {
+            Swap = Reports[j];
+            Reports[j] = Reports[j - 1];
+            Reports[j - 1] = Swap;
+        }
+    }
+
+    for (i = 0; i < ReportCount; i++)
+    {
+        Report = &Reports[i];
+        NtfsCheckPrintError(Check, Report->Error, Report->MftIndex, Report->Value);
+    }
+
+    if (Errors > ReportCount)
+        NtfsCheckPrint(Check, "%lu more errors were found in the file records\n", (unsigned long)(Errors - ReportCount));
+
+    Results->Errors += Errors;
+    NtfsLibFree(Reports);
+    return STATUS_SUCCESS;
+}
+
+static
+VOID
+NtfsCheckBalances(PNTFS_CHECK_CONTEXT Check)
+{
+    ULONGLONG i;
+
+    for (i = 0; i < Check->MftRecords; i++)
+    {
+        if (Check->Balances[i] != 0 && !(Check->Damaged[i / 32] & (1UL << (i % 32))))
+            NtfsCheckVolumeError(Check, NtfsCheckErrorIndexMismatch, i, 0);
+    }
+}
+
+/**
+* @name NtfsCheckErrorMirror
+* @implemented
+*
+* Compares the first records of $MFT with their copies in $MFTMirr. The
+* mirror is refreshed from $MFT only when the system files were found sound.
+*/
+static
+NTSTATUS
+NtfsCheckMirror(PNTFS_CHECK_CONTEXT Check,
+                PFILE_RECORD_HEADER Record,
+                PFILE_RECORD_HEADER Scratch)
+{
+    PNTFS_CHECK_PARAMETERS Parameters = Check->Parameters;
+    NTFS_CHECK_STREAM Stream;
+    PUCHAR Records;
+    ULONG Size, Count, i;
+    BOOLEAN Differ = FALSE;
+    NTSTATUS Status;
+
+    RtlZeroMemory(&Stream, sizeof(Stream));
+    Status = NtfsCheckReadRecord(Check, NTFS_FILE_MFTMIRR, Record);
+    if (NT_SUCCESS(Status))
+        Status = NtfsCheckLoadAttribute(Check, Record, NTFS_FILE_MFTMIRR, AttributeData, NULL, 0, Scratch, &Stream);
+    if (NT_SUCCESS(Status) && (Stream.Resident != NULL || Stream.DataSize < Check->BytesPerFileRecord))
+        Status = STATUS_DISK_CORRUPT_ERROR;
+    if (!NT_SUCCESS(Status))
+    {
+        NtfsCheckFreeStream(&Stream);
+        if (NtfsCheckIsFatal(Status))
+            return Status;
+
+        NtfsCheckVolumeError(Check, NtfsCheckErrorMirror, NTFS_FILE_MFTMIRR, 0);
+        return STATUS_SUCCESS;
+    }
+
+    Size = (ULONG)min(min(Stream.DataSize, NTFS_CHECK_MAX_MIRROR_SIZE), Check->MftRecords * Check->BytesPerFileRecord);
+    Count = Size / Check->BytesPerFileRecord;
+    Size = Count * Check->BytesPerFileRecord;
+
+    /* The worker buffer is free again */
+    Records = Check->Workers[0]->Chunk;
+    Status = NtfsCheckTransfer(Check, &Check->Mft, 0, Records, Size, FALSE);
+    if (NT_SUCCESS(Status))
+        Status = NtfsCheckTransfer(Check, &Stream, 0, Records + Size, Size, FALSE);
+
+    for (i = 0; i < Count && NT_SUCCESS(Status); i++)
+    {
+        if (!RtlEqualMemory(Records + i * Check->BytesPerFileRecord,
+                            Records + Size + i * Check->BytesPerFileRecord,
+                            Check->BytesPerFileRecord))
+        {
+            NtfsCheckVolumeError(Check, NtfsCheckErrorMirror, i, 0);
+            Differ = TRUE;
+        }
+    }
+
+    if (NT_SUCCESS(Status) && Differ && Parameters->FixErrors && Parameters->WriteRoutine != NULL)
+    {
+        if (Check->SystemDamage)
+        {
+            NtfsCheckPrint(Check, "$MFTMirr is left alone while the system files are damaged\n");
+        }
+        else
+        {
+            Status = NtfsCheckTransfer(Check, &Stream, 0, Records, Size, TRUE);
+            if (NT_SUCCESS(Status))
+            {
+                for (i = 0; i < Count; i++)
+                {
+                    if (!RtlEqualMemory(Records + i * Check->BytesPerFileRecord,
+                                        Records + Size + i * Check->BytesPerFileRecord,
+                                        Check->BytesPerFileRecord))
+                    {
+                        Check->Results->FixedErrors++;
+                    }
+                }
+                NtfsCheckPrint(Check, "Copied the first %lu file records to $MFTMirr\n", (unsigned long)Count);
+            }
+        }
+    }
+
+    NtfsCheckFreeStream(&Stream);
+    return Status;
+}
+
+/**
+* @name NtfsCheckBitmap
+* @implemented
+*
+* Compares $Bitmap with the clusters used by the files, chunk by chunk.
+* Each chunk that differs is rewritten when fixing errors, unless damaged
+* files may have lost track of clusters which are still in use.
+*/
+static
+NTSTATUS
+NtfsCheckBitmap(PNTFS_CHECK_CONTEXT Check,
+                PFILE_RECORD_HEADER Record,
+                PFILE_RECORD_HEADER Scratch)
+{
+    PNTFS_CHECK_PARAMETERS Parameters = Check->Parameters;
+    PNTFS_CHECK_RESULTS Results = Check->Results;
+    PUCHAR Expected = (PUCHAR)Check->Clusters;
+    PUCHAR Bitmap = Check->Workers[0]->Chunk;
+    NTFS_CHECK_STREAM Stream;
+    ULONGLONG Offset, BitmapSize, UsedFree = 0, FreeUsed = 0;
+    ULONG Length, Bytes, i;
+    UCHAR Mask, Difference;
+    BOOLEAN Fix, Changed;
+    NTSTATUS Status;
+
+    Fix = Parameters->FixErrors && Parameters->WriteRoutine != NULL && !Check->RecordDamage;
+
+    RtlZeroMemory(&Stream, sizeof(Stream));
+    Status = NtfsCheckReadRecord(Check, NTFS_FILE_BITMAP, Record);
+    if (NT_SUCCESS(Status))
+        Status = NtfsCheckLoadAttribute(Check, Record, NTFS_FILE_BITMAP, AttributeData, NULL, 0, Scratch, &Stream);
+    if (NT_SUCCESS(Status) &&
+        (Stream.Resident != NULL ||
+         Stream.DataSize < (Check->ClusterCount + 7) / 8 ||
+         Stream.NextVcn * Check->BytesPerCluster < Stream.DataSize))
+    {
+        Status = STATUS_DISK_CORRUPT_ERROR;
+    }
+    if (!NT_SUCCESS(Status))
+    {
+        NtfsCheckFreeStream(&Stream);
+        if (NtfsCheckIsFatal(Status))
+            return Status;
+
+        NtfsCheckVolumeError(Check, NtfsCheckErrorBitmapSize, NTFS_FILE_BITMAP, 0);
+        return STATUS_SUCCESS;
+    }
+
+    /* Whole sectors are read and written back */
+    BitmapSize = (Stream.DataSize + Check->BytesPerSector - 1) & ~((ULONGLONG)Check->BytesPerSector - 1);
+    BitmapSize = min(BitmapSize, Stream.NextVcn * Check->BytesPerCluster);
+
+    for (Offset = 0; Offset < BitmapSize && NT_SUCCESS(Status); Offset += Length)
+    {
+        Length = (ULONG)min(NTFS_CHECK_CHUNK_SIZE, BitmapSize - Offset);
+        Status = NtfsCheckTransfer(Check, &Stream, Offset, Bitmap, Length, FALSE);
+        if (!NT_SUCCESS(Status))
+            break;
+
+        /* The bits past the last cluster are left alone */
+        Changed = FALSE;
+        Bytes = (ULONG)min(Length, (Check->ClusterCount + 7) / 8 - min(Offset, (Check->ClusterCount + 7) / 8));
+        for (i = 0; i < Bytes; i++)
+        {
+            Mask = 0xFF;
+            if ((Offset + i + 1) * 8 > Check->ClusterCount)
+                Mask = (UCHAR)((1 << (Check->ClusterCount % 8)) - 1);
+
+            Difference = (Bitmap[i] ^ Expected[Offset + i]) & Mask;
+            if (Difference == 0)
+                continue;
+
+            UsedFree += NtfsCheckCountBits(Difference & Expected[Offset + i]);
+            FreeUsed += NtfsCheckCountBits(Difference & Bitmap[i]);
+            Bitmap[i] ^= Difference;
+            Changed = TRUE;
+        }
+
+        if (Changed && Fix)
+            Status = NtfsCheckTransfer(Check, &Stream, Offset, Bitmap, Length, TRUE);
+    }
+
+    NtfsCheckFreeStream(&Stream);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    if (UsedFree != 0)
+        NtfsCheckVolumeError(Check, NtfsCheckErrorUsedClustersFree, NTFS_FILE_BITMAP, UsedFree);
+    if (FreeUsed != 0)
+        NtfsCheckVolumeError(Check, NtfsCheckErrorFreeClustersUsed, NTFS_FILE_BITMAP, FreeUsed);
+
+    if (UsedFree != 0 || FreeUsed != 0)
+    {
+        if (Fix)
+        {
+            Results->FixedErrors += (UsedFree != 0) + (FreeUsed != 0);
+            NtfsCheckPrint(Check, "Corrected $Bitmap\n");
+        }
+        else if (Parameters->FixErrors)
+        {
+            NtfsCheckPrint(Check, "$Bitmap is left alone while file records are damaged\n");
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/**
+* @name NtfsCheckVolume
+* @implemented
+*
+* Checks an NTFS volume. The file records are validated by workers which
+* share out the chunks of $MFT, each one also checking the indexes of the
+* directories it finds. Then the names in the indexes are balanced against
+* the $FILE_NAME attributes of the files, $MFTMirr is compared with $MFT
+* and $Bitmap with the clusters in use. Only $MFTMirr and $Bitmap are
+* repaired.
+*
+* @param Parameters
+* Options, the I/O, worker, message and progress routines.
+*
+* @param Results
+* Filled in with the statistics of the volume and the errors found.
+*
+* @return
+* STATUS_SUCCESS if the volume is sound or all the errors were fixed,
+* STATUS_DISK_CORRUPT_ERROR if errors remain, STATUS_UNRECOGNIZED_VOLUME
+* if it isn't NTFS, otherwise the error which stopped the check.
+*/
+NTSTATUS
+NtfsCheckVolume(IN PNTFS_CHECK_PARAMETERS Parameters,
+                OUT PNTFS_CHECK_RESULTS Results)
+{
+    NTFS_CHECK_CONTEXT Check;
+    PFILE_RECORD_HEADER Record = NULL, Scratch = NULL;
+    ULONGLONG Words, i;
+    BOOLEAN Dirty, LogEmpty;
+    NTSTATUS Status;
+
+    RtlZeroMemory(Results, sizeof(NTFS_CHECK_RESULTS));
+    RtlZeroMemory(&Check, sizeof(Check));
+    Check.Parameters = Parameters;
+    Check.Results = Results;
+
+    Status = NtfsCheckReadBootSector(&Check);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Not an NTFS volume (Status 0x%08x)\n", Status);
+        return Status;
+    }
+
+    Results->BytesPerCluster = Check.BytesPerCluster;
+    Results->ClusterCount = Check.ClusterCount;
+
+    Record = NtfsLibAllocate(Check.BytesPerFileRecord);
+    Scratch = NtfsLibAllocate(Check.BytesPerFileRecord);
+    if (Record == NULL || Scratch == NULL)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Cleanup;
+    }
+
+    Status = NtfsCheckLoadMft(&Check, Record, Scratch);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Cannot load $MFT (Status 0x%08x)\n", Status);
+        goto Cleanup;
+    }
+
+    /* Neither checking nor repairing makes sense on metadata the journal is about to replace */
+    Status = NtfsCheckIsLogEmpty(&Check, Record, Scratch, &LogEmpty);
+    if (NtfsCheckIsFatal(Status))
+        goto Cleanup;
+
+    if (!LogEmpty)
+    {
+        NtfsCheckPrint(&Check, "$LogFile holds changes that aren't written in place yet, mount the volume with ReactOS first\n");
+        Results->LogNotEmpty = TRUE;
+        Status = STATUS_VOLUME_DIRTY;
+        goto Cleanup;
+    }
+
+    if (Parameters->CheckOnlyIfDirty)
+    {
+        Status = NtfsCheckIsDirty(&Check, Record, &Dirty);
+        if (NtfsCheckIsFatal(Status))
+            goto Cleanup;
+
+        if (NT_SUCCESS(Status) && !Dirty)
+        {
+            NtfsCheckPrint(&Check, "The volume is clean\n");
+            Results->Skipped = TRUE;
+            goto Cleanup;
+        }
+    }
+
+    Status = NtfsCheckLoadUpCase(&Check, Record, Scratch);
+    if (!NT_SUCCESS(Status))
+        goto Cleanup;
+
+    Words = (Check.ClusterCount + 31) / 32;
+    Check.Clusters = NtfsLibAllocate((SIZE_T)Words * sizeof(LONG));
+    Check.Balances = NtfsLibAllocate((SIZE_T)Check.MftRecords * sizeof(LONG));
+    Check.Damaged = NtfsLibAllocate((SIZE_T)(Check.MftRecords + 31) / 32 * sizeof(LONG));
+    if (Check.Clusters == NULL || Check.Balances == NULL || Check.Damaged == NULL)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Cleanup;
+    }
+
+    Status = NtfsCheckScan(&Check);
+    if (!NT_SUCCESS(Status))
+        goto Cleanup;
+
+    if (Parameters->Verbose)
+        NtfsCheckPrint(&Check, "Checking the directory indexes against the file names\n");
+    NtfsCheckBalances(&Check);
+
+    if (Parameters->Verbose)
+        NtfsCheckPrint(&Check, "Checking $MFTMirr\n");
+    Status = NtfsCheckMirror(&Check, Record, Scratch);
+    if (!NT_SUCCESS(Status))
+        goto Cleanup;
+
+    if (Parameters->ProgressRoutine != NULL)
+        Parameters->ProgressRoutine(Parameters->Context, 95);
+
+    if (Parameters->Verbose)
+        NtfsCheckPrint(&Check, "Checking $Bitmap\n");
+    Status = NtfsCheckBitmap(&Check, Record, Scratch);
+    if (!NT_SUCCESS(Status))
+        goto Cleanup;
+
+    for (i = 0; i < Words * sizeof(LONG); i++)
+        Results->ClustersInUse += NtfsCheckCountBits(((PUCHAR)Check.Clusters)[i]);
+
+    if (Parameters->ProgressRoutine != NULL)
+        Parameters->ProgressRoutine(Parameters->Context, 100);
+
+    NtfsCheckPrint(&Check, "%llu files, %llu directories, %llu index entries\n",
+                   (unsigned long long)Results->FileRecords,
+                   (unsigned long long)Results->Directories,
+                   (unsigned long long)Results->IndexEntries);
+    NtfsCheckPrint(&Check, "%llu of %llu clusters of %lu bytes in use\n",
+                   (unsigned long long)Results->ClustersInUse,
+                   (unsigned long long)Results->ClusterCount,
+                   (unsigned long)Results->BytesPerCluster);
+    if (Results->Errors == 0)
+        NtfsCheckPrint(&Check, "No errors found\n");
+    else
+        NtfsCheckPrint(&Check, "%lu errors found, %lu fixed\n", (unsigned long)Results->Errors, (unsigned long)Results->FixedErrors);
+
+    if (Results->Errors > Results->FixedErrors)
+        Status = STATUS_DISK_CORRUPT_ERROR;
+
+Cleanup:
+    for (i = 0; i < Check.WorkerCount; i++)
+        NtfsCheckFreeWorker(Check.Workers[i]);
+    if (Check.Damaged != NULL)
+        NtfsLibFree((PVOID)Check.Damaged);
+    if (Check.Balances != NULL)
+        NtfsLibFree((PVOID)Check.Balances);
+    if (Check.Clusters != NULL)
+        NtfsLibFree((PVOID)Check.Clusters);
+    if (Check.UpCase != NULL)
+        NtfsLibFree(Check.UpCase);
+    if (Check.MftBitmap != NULL)
+        NtfsLibFree(Check.MftBitmap);
+    NtfsCheckFreeStream(&Check.Mft);
+    if (Scratch != NULL)
+        NtfsLibFree(Scratch);
+    if (Record != NULL)
+        NtfsLibFree(Record);
+
+    return Status;
+}
@@ -0,0 +1,1411 @@
+/*
+ * COPYRIGHT:   See COPYING in the top level directory
+ * PROJECT:     ReactOS NTFS FS library
+ * FILE:        lib/fslib/ntfslib/format.c
+ * PURPOSE:     NTFS volume layout. All the metadata is built in memory and
+ *              written with a few large sequential writes.
+ */
+
+/* INCLUDES *****************************************************************/
+
+#include "ntfslib.h"
+
+#define NDEBUG
+#include <debug.h>
+
+/* GLOBALS ******************************************************************/
+
+#define NTFS_FORMAT_BOOT_SIZE           0x2000
+#define NTFS_FORMAT_ATTRDEF_SIZE        0xA00
+#define NTFS_FORMAT_UPCASE_SIZE         0x20000
+#define NTFS_FORMAT_INDEX_RECORD_SIZE   0x1000
+#define NTFS_FORMAT_MIRROR_RECORDS      4
+#define NTFS_FORMAT_SMALL_MFT_RECORDS   64
+#define NTFS_FORMAT_MFT_RECORDS         256
+#define NTFS_FORMAT_SMALL_VOLUME        (256ULL * 1024 * 1024)
+#define NTFS_FORMAT_MIN_LOG_SIZE        (1024 * 1024)
+#define NTFS_FORMAT_MAX_LOG_SIZE        (64 * 1024 * 1024)
+#define NTFS_FORMAT_MAX_CLUSTER_SIZE    0x10000
+#define NTFS_FORMAT_CHUNK_SIZE          (4 * 1024 * 1024)
+
+/* $Secure:$SDS is made of 256KB blocks, each one followed by its mirror */
+#define NTFS_FORMAT_SDS_BLOCK           0x40000
+#define NTFS_FORMAT_SECURITY_ID         0x100
+
+/* Files of $Extend, right after the records reserved for the MFT extension */
+#define NTFS_FILE_QUOTA                 24
+#define NTFS_FILE_OBJID                 25
+#define NTFS_FILE_REPARSE               26
+#define NTFS_FORMAT_SYSTEM_RECORDS      27
+
+#define ATTRDEF_INDEXABLE               0x02
+#define ATTRDEF_RESIDENT                0x40
+#define ATTRDEF_LOG_NONRESIDENT         0x80
+
+#define QUOTA_FLAG_DEFAULT_LIMITS       0x00000001
+
+#define NTFS_FORMAT_ALIGN(Value, Alignment) (((Value) + (Alignment) - 1) & ~((ULONGLONG)(Alignment) - 1))
+
+typedef struct
+{
+    ULONGLONG Lcn;
+    ULONGLONG Clusters;
+} NTFS_FORMAT_EXTENT, *PNTFS_FORMAT_EXTENT;
+
+typedef struct
+{
+    PNTFS_FORMAT_PARAMETERS Parameters;
+
+    ULONG BytesPerSector;
+    ULONG BytesPerCluster;
+    ULONG BytesPerFileRecord;
+    ULONG BytesPerIndexRecord;
+    ULONGLONG SectorCount;
+    ULONGLONG ClusterCount;
+
+    ULONG MftRecordCount;
+    ULONG MftBitmapSize;
+    ULONG SdsSize;
+    ULONGLONG LogFileSize;
+    ULONGLONG BitmapSize;
+
+    /* In disk order, $Boot to $MFT are contiguous */
+    NTFS_FORMAT_EXTENT Boot;
+    NTFS_FORMAT_EXTENT AttrDef;
+    NTFS_FORMAT_EXTENT UpCase;
+    NTFS_FORMAT_EXTENT RootIndex;
+    NTFS_FORMAT_EXTENT Sds;
+    NTFS_FORMAT_EXTENT MftBitmap;
+    NTFS_FORMAT_EXTENT Bitmap;
+    NTFS_FORMAT_EXTENT LogFile;
+    NTFS_FORMAT_EXTENT Mft;
+    NTFS_FORMAT_EXTENT MftMirr;
+    ULONGLONG MetadataEnd;
+
+    PUCHAR Metadata;        /* $Boot up to, but excluding, $Bitmap */
+    PUCHAR MftBuffer;
+    PUCHAR MftMirror;
+    PBOOT_SECTOR BootSector;
+    PWCHAR UpCaseTable;
+    SECURITY_DESCRIPTOR_HEADER SecurityHeader;
+
+    /* Sequential writer */
+    PUCHAR Buffer;
+    ULONG BufferUsed;
+    ULONGLONG BufferOffset;
+    ULONGLONG BytesWritten;
+    ULONGLONG BytesToWrite;
+    ULONG Percent;
+} NTFS_FORMAT_CONTEXT, *PNTFS_FORMAT_CONTEXT;
+
+typedef struct
+{
+    PCWSTR Name;
+    ULONG Type;
+    ULONG CollationRule;
+    ULONG Flags;
+    LONGLONG MinimumSize;
+    LONGLONG MaximumSize;
+} NTFS_FORMAT_ATTRDEF, *PNTFS_FORMAT_ATTRDEF;
+
+static const NTFS_FORMAT_ATTRDEF NtfsFormatAttrDefs[] =
+{
+    { L"$STANDARD_INFORMATION", AttributeStandardInformation, COLLATION_BINARY, ATTRDEF_RESIDENT, 0x30, 0x48 },
+    { L"$ATTRIBUTE_LIST", AttributeAttributeList, COLLATION_BINARY, ATTRDEF_LOG_NONRESIDENT, 0, -1 },
+    { L"$FILE_NAME", AttributeFileName, COLLATION_FILE_NAME, ATTRDEF_RESIDENT | ATTRDEF_INDEXABLE, 0x44, 0x242 },
+    { L"$OBJECT_ID", AttributeObjectId, COLLATION_BINARY, ATTRDEF_RESIDENT, 0, 0x100 },
+    { L"$SECURITY_DESCRIPTOR", AttributeSecurityDescriptor, COLLATION_BINARY, ATTRDEF_LOG_NONRESIDENT, 0, -1 },
+    { L"$VOLUME_NAME", AttributeVolumeName, COLLATION_BINARY, ATTRDEF_RESIDENT, 2, 0x100 },
+    { L"$VOLUME_INFORMATION", AttributeVolumeInformation, COLLATION_BINARY, ATTRDEF_RESIDENT, 0xC, 0xC },
+    { L"$DATA", AttributeData, COLLATION_BINARY, 0, 0, -1 },
+    { L"$INDEX_ROOT", AttributeIndexRoot, COLLATION_BINARY, ATTRDEF_RESIDENT, 0, -1 },
+    { L"$INDEX_ALLOCATION", AttributeIndexAllocation, COLLATION_BINARY, ATTRDEF_LOG_NONRESIDENT, 0, -1 },
+    { L"$BITMAP", AttributeBitmap, COLLATION_BINARY, ATTRDEF_LOG_NONRESIDENT, 0, -1 },
+    { L"$REPARSE_POINT", AttributeReparsePoint, COLLATION_BINARY, ATTRDEF_LOG_NONRESIDENT, 0, 0x4000 },
+    { L"$EA_INFORMATION", AttributeEAInformation, COLLATION_BINARY, ATTRDEF_RESIDENT, 8, 8 },
+    { L"$EA", AttributeEA, COLLATION_BINARY, 0, 0, 0x10000 },
+    { L"$LOGGED_UTILITY_STREAM", AttributeLoggedUtilityStream, COLLATION_BINARY, ATTRDEF_LOG_NONRESIDENT, 0, 0x10000 },
+};
+
+/* Security descriptor shared by all the files of a new volume:
+ * owner and group Administrators, inheritable full control for SYSTEM and
+ * Administrators, modify for Authenticated Users, read for Everyone */
+static const UCHAR NtfsFormatSecurityDescriptor[] =
+{
+    0x01, 0x00, 0x04, 0x80,     /* SE_SELF_RELATIVE | SE_DACL_PRESENT */
+    0x70, 0x00, 0x00, 0x00,     /* Owner */
+    0x80, 0x00, 0x00, 0x00,     /* Group */
+    0x00, 0x00, 0x00, 0x00,     /* Sacl */
+    0x14, 0x00, 0x00, 0x00,     /* Dacl */
+    0x02, 0x00, 0x5C, 0x00, 0x04, 0x00, 0x00, 0x00,
+    0x00, 0x03, 0x14, 0x00, 0xFF, 0x01, 0x1F, 0x00,
+    0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x12, 0x00, 0x00, 0x00,
+    0x00, 0x03, 0x18, 0x00, 0xFF, 0x01, 0x1F, 0x00,
+    0x01, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x20, 0x00, 0x00, 0x00, 0x20, 0x02, 0x00, 0x00,
+    0x00, 0x03, 0x14, 0x00, 0xBF, 0x01, 0x13, 0x00,
+    0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x0B, 0x00, 0x00, 0x00,
+    0x00, 0x03, 0x14, 0x00, 0xA9, 0x00, 0x12, 0x00,
+    0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x01, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x20, 0x00, 0x00, 0x00, 0x20, 0x02, 0x00, 0x00,
+    0x01, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x20, 0x00, 0x00, 0x00, 0x20, 0x02, 0x00, 0x00,
+};
+
+/* FUNCTIONS ****************************************************************/
+
+static
+BOOLEAN
+NtfsFormatIsPowerOfTwo(ULONG Value)
+{
+    return Value != 0 && (Value & (Value - 1)) == 0;
+}
+
+static
+CHAR
+NtfsFormatClustersPerRecord(PNTFS_FORMAT_CONTEXT Fmt,
+                            ULONG RecordSize)
+{
+    CHAR Shift = 0;
+
+    if (RecordSize >= Fmt->BytesPerCluster)
+        return (CHAR)(RecordSize / Fmt->BytesPerCluster);
+
+    /* Smaller than a cluster: stored as the negated log2 of the size */
+    while ((1UL << Shift) < RecordSize)
+        Shift++;
+
+    return -Shift;
+}
+
+static
+VOID
+NtfsFormatPlace(PNTFS_FORMAT_CONTEXT Fmt,
+                PNTFS_FORMAT_EXTENT Extent,
+                ULONGLONG *NextLcn,
+                ULONGLONG Size)
+{
+    Extent->Lcn = *NextLcn;
+    Extent->Clusters = (Size + Fmt->BytesPerCluster - 1) / Fmt->BytesPerCluster;
+    *NextLcn += Extent->Clusters;
+}
+
+/**
+* @name NtfsFormatComputeLayout
+* @implemented
+*
+* Validates the format parameters and places the system files on the volume.
+* $Boot, the small metadata files, $Bitmap, $LogFile and $MFT are laid out
+* back to back from cluster 0 so that they can be written in one pass, $MFT
+* last so that it can grow without fragmenting. $MFTMirr sits in the middle
+* of the volume.
+*
+* @param Fmt
+* Format context, the geometry and extents are filled in.
+*
+* @return
+* STATUS_SUCCESS, STATUS_INVALID_PARAMETER for an unsupported geometry or
+* STATUS_DISK_FULL if the volume is too small for the metadata.
+*/
+static
+NTSTATUS
+NtfsFormatComputeLayout(PNTFS_FORMAT_CONTEXT Fmt)
+{
+    PNTFS_FORMAT_PARAMETERS Parameters = Fmt->Parameters;
+    ULONGLONG NextLcn;
+    ULONGLONG VolumeBytes;
+
+    Fmt->BytesPerSector = Parameters->BytesPerSector;
+    if (!NtfsFormatIsPowerOfTwo(Fmt->BytesPerSector) ||
+        Fmt->BytesPerSector < NTFS_BLOCK_SIZE ||
+        Fmt->BytesPerSector > NTFS_FORMAT_INDEX_RECORD_SIZE)
+    {
+        DPRINT1("Unsupported sector size %lu\n", Fmt->BytesPerSector);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (Parameters->VolumeSize / Fmt->BytesPerSector < 2)
+    {
+        DPRINT1("Volume too small\n");
+        return STATUS_DISK_FULL;
+    }
+
+    /* The last sector holds the backup boot sector, outside of the volume */
+    Fmt->SectorCount = Parameters->VolumeSize / Fmt->BytesPerSector - 1;
+    VolumeBytes = Fmt->SectorCount * Fmt->BytesPerSector;
+
+    Fmt->BytesPerCluster = Parameters->BytesPerCluster;
+    if (Fmt->BytesPerCluster == 0)
+    {
+        /* 4KB, doubled as needed to keep the cluster count in 32 bits */
+        Fmt->BytesPerCluster = max(4096, Fmt->BytesPerSector);
+        while (VolumeBytes / Fmt->BytesPerCluster > MAXULONG &&
+               Fmt->BytesPerCluster < NTFS_FORMAT_MAX_CLUSTER_SIZE)
+        {
+            Fmt->BytesPerCluster <<= 1;
+        }
+    }
+
+    if (!NtfsFormatIsPowerOfTwo(Fmt->BytesPerCluster) ||
+        Fmt->BytesPerCluster < Fmt->BytesPerSector ||
+        Fmt->BytesPerCluster > NTFS_FORMAT_MAX_CLUSTER_SIZE)
+    {
+        DPRINT1("Unsupported cluster size %lu\n", Fmt->BytesPerCluster);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Fmt->ClusterCount = VolumeBytes / Fmt->BytesPerCluster;
+    if (Fmt->ClusterCount > MAXULONG)
+    {
+        DPRINT1("Too many clusters (%I64u) for a cluster size of %lu\n", Fmt->ClusterCount, Fmt->BytesPerCluster);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (Parameters->Label != NULL && Parameters->Label->Length > 32 * sizeof(WCHAR))
+    {
+        DPRINT1("Label too long\n");
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Fmt->BytesPerFileRecord = max(1024, Fmt->BytesPerSector);
+    Fmt->BytesPerIndexRecord = NTFS_FORMAT_INDEX_RECORD_SIZE;
+
+    Fmt->MftRecordCount = (VolumeBytes < NTFS_FORMAT_SMALL_VOLUME) ? NTFS_FORMAT_SMALL_MFT_RECORDS : NTFS_FORMAT_MFT_RECORDS;
+    Fmt->MftBitmapSize = (ULONG)NTFS_FORMAT_ALIGN(Fmt->MftRecordCount / 8, 8);
+    Fmt->SdsSize = NTFS_FORMAT_SDS_BLOCK +
+                   (ULONG)NTFS_FORMAT_ALIGN(sizeof(SECURITY_DESCRIPTOR_HEADER) + sizeof(NtfsFormatSecurityDescriptor), 16);
+    Fmt->BitmapSize = NTFS_FORMAT_ALIGN((Fmt->ClusterCount + 7) / 8, 8);
+
+    Fmt->LogFileSize = VolumeBytes / 100;
+    Fmt->LogFileSize = max(Fmt->LogFileSize, NTFS_FORMAT_MIN_LOG_SIZE);
+    Fmt->LogFileSize = min(Fmt->LogFileSize, NTFS_FORMAT_MAX_LOG_SIZE);
+    Fmt->LogFileSize = NTFS_FORMAT_ALIGN(Fmt->LogFileSize, Fmt->BytesPerCluster);
+
+    NextLcn = 0;
+    NtfsFormatPlace(Fmt, &Fmt->Boot, &NextLcn, NTFS_FORMAT_BOOT_SIZE);
+    NtfsFormatPlace(Fmt, &Fmt->AttrDef, &NextLcn, NTFS_FORMAT_ATTRDEF_SIZE);
+    NtfsFormatPlace(Fmt, &Fmt->UpCase, &NextLcn, NTFS_FORMAT_UPCASE_SIZE);
+    NtfsFormatPlace(Fmt, &Fmt->RootIndex, &NextLcn, Fmt->BytesPerIndexRecord);
+    NtfsFormatPlace(Fmt, &Fmt->Sds, &NextLcn, Fmt->SdsSize);
+    NtfsFormatPlace(Fmt, &Fmt->MftBitmap, &NextLcn, Fmt->MftBitmapSize);
+    NtfsFormatPlace(Fmt, &Fmt->Bitmap, &NextLcn, Fmt->BitmapSize);
+    NtfsFormatPlace(Fmt, &Fmt->LogFile, &NextLcn, Fmt->LogFileSize);
+    NtfsFormatPlace(Fmt, &Fmt->Mft, &NextLcn, (ULONGLONG)Fmt->MftRecordCount * Fmt->BytesPerFileRecord);
+    Fmt->MetadataEnd = NextLcn;
+
+    NextLcn = max(Fmt->ClusterCount / 2, Fmt->MetadataEnd);
+    NtfsFormatPlace(Fmt, &Fmt->MftMirr, &NextLcn, NTFS_FORMAT_MIRROR_RECORDS * Fmt->BytesPerFileRecord);
+
+    if (NextLcn > Fmt->ClusterCount)
+    {
+        DPRINT1("Volume too small: %I64u clusters, %I64u needed\n", Fmt->ClusterCount, NextLcn);
+        return STATUS_DISK_FULL;
+    }
+
+    DPRINT("Clusters %I64u of %lu bytes, MFT at %I64u, mirror at %I64u, log %I64u bytes\n",
+           Fmt->ClusterCount, Fmt->BytesPerCluster, Fmt->Mft.Lcn, Fmt->MftMirr.Lcn, Fmt->LogFileSize);
+
+    return STATUS_SUCCESS;
+}
+
+static
+PVOID
+NtfsFormatExtentBuffer(PNTFS_FORMAT_CONTEXT Fmt,
+                       PNTFS_FORMAT_EXTENT Extent)
+{
+    return Fmt->Metadata + Extent->Lcn * Fmt->BytesPerCluster;
+}
+
+static
+VOID
+NtfsFormatBuildBootSector(PNTFS_FORMAT_CONTEXT Fmt)
+{
+    PNTFS_FORMAT_PARAMETERS Parameters = Fmt->Parameters;
+    PBOOT_SECTOR BootSector = Fmt->BootSector;
+
+    BootSector->Jump[0] = 0xEB;
+    BootSector->Jump[1] = 0x52;
+    BootSector->Jump[2] = 0x90;
+    RtlCopyMemory(BootSector->OEMID, "NTFS    ", 8);
+
+    BootSector->BPB.BytesPerSector = (USHORT)Fmt->BytesPerSector;
+    BootSector->BPB.SectorsPerCluster = (UCHAR)(Fmt->BytesPerCluster / Fmt->BytesPerSector);
+    BootSector->BPB.MediaId = 0xF8;
+    BootSector->BPB.SectorsPerTrack = Parameters->SectorsPerTrack;
+    BootSector->BPB.Heads = Parameters->Heads;
+    BootSector->BPB.HiddenSectors = Parameters->HiddenSectors;
+
+    BootSector->EBPB.Unknown[0] = 0x80;
+    BootSector->EBPB.Unknown[1] = 0x80;
+    BootSector->EBPB.SectorCount = Fmt->SectorCount;
+    BootSector->EBPB.MftLocation = Fmt->Mft.Lcn;
+    BootSector->EBPB.MftMirrLocation = Fmt->MftMirr.Lcn;
+    BootSector->EBPB.ClustersPerMftRecord = NtfsFormatClustersPerRecord(Fmt, Fmt->BytesPerFileRecord);
+    BootSector->EBPB.ClustersPerIndexRecord = NtfsFormatClustersPerRecord(Fmt, Fmt->BytesPerIndexRecord);
+    BootSector->EBPB.SerialNumber = Parameters->SerialNumber;
+
+    /* The volume isn't bootable until a boot loader is installed: cli, hlt, jmp $-1 */
+    BootSector->BootStrap[0] = 0xFA;
+    BootSector->BootStrap[1] = 0xF4;
+    BootSector->BootStrap[2] = 0xEB;
+    BootSector->BootStrap[3] = 0xFD;
+    BootSector->EndSector = 0xAA55;
+}
+
+static
+VOID
+NtfsFormatBuildAttrDef(PNTFS_FORMAT_CONTEXT Fmt)
+{
+    PATTRDEF_ENTRY Entry = NtfsFormatExtentBuffer(Fmt, &Fmt->AttrDef);
+    ULONG i, j;
+
+    for (i = 0; i < sizeof(NtfsFormatAttrDefs) / sizeof(NtfsFormatAttrDefs[0]); i++, Entry++)
+    {
+        for (j = 0; NtfsFormatAttrDefs[i].Name[j] != 0; j++)
+            Entry->Name[j] = NtfsFormatAttrDefs[i].Name[j];
+
+        Entry->Type = NtfsFormatAttrDefs[i].Type;
+        Entry->CollationRule = NtfsFormatAttrDefs[i].CollationRule;
+        Entry->Flags = NtfsFormatAttrDefs[i].Flags;
+        Entry->MinimumSize = NtfsFormatAttrDefs[i].MinimumSize;
+        Entry->MaximumSize = NtfsFormatAttrDefs[i].MaximumSize;
+    }
+}
+
+static
+VOID
+NtfsFormatBuildUpCase(PNTFS_FORMAT_CONTEXT Fmt)
+{
+    ULONG i;
+
+    Fmt->UpCaseTable = NtfsFormatExtentBuffer(Fmt, &Fmt->UpCase);
+    for (i = 0; i < NTFS_FORMAT_UPCASE_SIZE / sizeof(WCHAR); i++)
+        Fmt->UpCaseTable[i] = RtlUpcaseUnicodeChar((WCHAR)i);
+}
+
+static
+VOID
+NtfsFormatBuildSecure(PNTFS_FORMAT_CONTEXT Fmt)
+{
+    PUCHAR Sds = NtfsFormatExtentBuffer(Fmt, &Fmt->Sds);
+    const ULONG *Data = (const ULONG *)NtfsFormatSecurityDescriptor;
+    ULONG Hash = 0;
+    ULONG i;
+
+    for (i = 0; i < sizeof(NtfsFormatSecurityDescriptor) / sizeof(ULONG); i++)
+        Hash = Data[i] + ((Hash << 3) | (Hash >> 29));
+
+    Fmt->SecurityHeader.Hash = Hash;
+    Fmt->SecurityHeader.SecurityId = NTFS_FORMAT_SECURITY_ID;
+    Fmt->SecurityHeader.Offset = 0;
+    Fmt->SecurityHeader.Length = sizeof(SECURITY_DESCRIPTOR_HEADER) + sizeof(NtfsFormatSecurityDescriptor);
+
+    /* The entry and its mirror in the next block */
+    for (i = 0; i < 2; i++)
+    {
+        RtlCopyMemory(Sds, &Fmt->SecurityHeader, sizeof(SECURITY_DESCRIPTOR_HEADER));
+        RtlCopyMemory(Sds + sizeof(SECURITY_DESCRIPTOR_HEADER), NtfsFormatSecurityDescriptor, sizeof(NtfsFormatSecurityDescriptor));
+        Sds += NTFS_FORMAT_SDS_BLOCK;
+    }
+}
+
+static
+USHORT
+NtfsFormatSequenceNumber(ULONG MftIndex)
+{
+    /* The system files use their record number as sequence number */
+    return (MftIndex != NTFS_FILE_MFT && MftIndex < NTFS_FILE_FIRST_USER_FILE) ? (USHORT)MftIndex : 1;
+}
+
+static
+ULONGLONG
+NtfsFormatFileReference(ULONG MftIndex)
+{
+    return MftIndex | ((ULONGLONG)NtfsFormatSequenceNumber(MftIndex) << 48);
+}
+
+static
+PFILE_RECORD_HEADER
+NtfsFormatRecord(PNTFS_FORMAT_CONTEXT Fmt,
+                 ULONG MftIndex)
+{
+    return (PFILE_RECORD_HEADER)(Fmt->MftBuffer + MftIndex * Fmt->BytesPerFileRecord);
+}
+
+static
+VOID
+NtfsFormatInitRecord(PNTFS_FORMAT_CONTEXT Fmt,
+                     ULONG MftIndex,
+                     USHORT Flags)
+{
+    PFILE_RECORD_HEADER FileRecord = NtfsFormatRecord(Fmt, MftIndex);
+    PULONG End;
+
+    RtlZeroMemory(FileRecord, Fmt->BytesPerFileRecord);
+
+    FileRecord->Ntfs.Type = NRH_FILE_TYPE;
+    FileRecord->Ntfs.UsaOffset = FIELD_OFFSET(FILE_RECORD_HEADER, MFTRecordNumber) + sizeof(ULONG);
+    FileRecord->Ntfs.UsaCount = (USHORT)(Fmt->BytesPerFileRecord / NTFS_BLOCK_SIZE + 1);
+    FileRecord->SequenceNumber = NtfsFormatSequenceNumber(MftIndex);
+    FileRecord->AttributeOffset = (USHORT)NTFS_FORMAT_ALIGN(FileRecord->Ntfs.UsaOffset + FileRecord->Ntfs.UsaCount * sizeof(USHORT), 8);
+    FileRecord->Flags = Flags;
+    FileRecord->BytesInUse = FileRecord->AttributeOffset + sizeof(ULONG) * 2;
+    FileRecord->BytesAllocated = Fmt->BytesPerFileRecord;
+    FileRecord->MFTRecordNumber = MftIndex;
+
+    End = (PULONG)((PUCHAR)FileRecord + FileRecord->AttributeOffset);
+    End[0] = AttributeEnd;
+}
+
+static
+ULONG
+NtfsFormatNameLength(PCWSTR Name)
+{
+    ULONG Length = 0;
+
+    while (Name != NULL && Name[Length] != 0)
+        Length++;
+
+    return Length;
+}
+
+static
+PNTFS_ATTR_RECORD
+NtfsFormatAllocateAttribute(PFILE_RECORD_HEADER FileRecord,
+                            ULONG Type,
+                            PCWSTR Name,
+                            ULONG HeaderLength,
+                            ULONG Length)
+{
+    PNTFS_ATTR_RECORD Attribute;
+    PULONG End;
+
+    Attribute = (PNTFS_ATTR_RECORD)((PUCHAR)FileRecord + FileRecord->BytesInUse - sizeof(ULONG) * 2);
+    ASSERT(FileRecord->BytesInUse + Length <= FileRecord->BytesAllocated);
+
+    RtlZeroMemory(Attribute, Length);
+    Attribute->Type = Type;
+    Attribute->Length = Length;
+    Attribute->Instance = FileRecord->NextAttributeNumber++;
+
+    Attribute->NameLength = (UCHAR)NtfsFormatNameLength(Name);
+    if (Attribute->NameLength != 0)
+    {
+        Attribute->NameOffset = (USHORT)HeaderLength;
+        RtlCopyMemory((PUCHAR)Attribute + HeaderLength, Name, Attribute->NameLength * sizeof(WCHAR));
+    }
+
+    FileRecord->BytesInUse += Length;
+    End = (PULONG)((PUCHAR)Attribute + Length);
+    End[0] = AttributeEnd;
+    End[1] = 0;
+
+    return Attribute;
+}
+
+static
+PVOID
+NtfsFormatAddResident(PFILE_RECORD_HEADER FileRecord,
+                      ULONG Type,
+                      PCWSTR Name,
+                      ULONG ValueLength,
+                      UCHAR Flags)
+{
+    PNTFS_ATTR_RECORD Attribute;
+    ULONG NameLength = NtfsFormatNameLength(Name);
+    ULONG HeaderLength = FIELD_OFFSET(NTFS_ATTR_RECORD, Resident.Reserved) + sizeof(UCHAR);
+    ULONG ValueOffset = (ULONG)NTFS_FORMAT_ALIGN(HeaderLength + NameLength * sizeof(WCHAR), 8);
+
+    Attribute = NtfsFormatAllocateAttribute(FileRecord,
+                                            Type,
+                                            Name,
+                                            HeaderLength,
+                                            (ULONG)NTFS_FORMAT_ALIGN(ValueOffset + ValueLength, 8));
+    Attribute->Resident.ValueLength = ValueLength;
+    Attribute->Resident.ValueOffset = (USHORT)ValueOffset;
+    Attribute->Resident.Flags = Flags;
+
+    return (PUCHAR)Attribute + ValueOffset;
+}
+
+static
+ULONG
+NtfsFormatRunFieldSize(ULONGLONG Value)
+{
+    ULONG Size = 1;
+
+    /* Both fields are read as signed */
+    while (Size < 8 && Value >= (1ULL << (Size * 8 - 1)))
+        Size++;
+
+    return Size;
+}
+
+/**
+* @name NtfsFormatAddNonResident
+* @implemented
+*
+* Adds a non-resident attribute described by a single data run.
+*
+* @param Lcn
+* First cluster of the run, or -1 for a sparse run.
+*
+* @param Clusters
+* Length of the run, in clusters.
+*
+* @param DataSize
+* Data and initialized size of the attribute.
+*/
+static
+VOID
+NtfsFormatAddNonResident(PNTFS_FORMAT_CONTEXT Fmt,
+                         PFILE_RECORD_HEADER FileRecord,
+                         ULONG Type,
+                         PCWSTR Name,
+                         LONGLONG Lcn,
+                         ULONGLONG Clusters,
+                         ULONGLONG DataSize)
+{
+    PNTFS_ATTR_RECORD Attribute;
+    UCHAR Runs[2 + 2 * sizeof(ULONGLONG)];
+    ULONG NameLength = NtfsFormatNameLength(Name);
+    ULONG HeaderLength = FIELD_OFFSET(NTFS_ATTR_RECORD, NonResident.InitializedSize) + sizeof(LONGLONG);
+    ULONG MappingPairsOffset = (ULONG)NTFS_FORMAT_ALIGN(HeaderLength + NameLength * sizeof(WCHAR), 8);
+    ULONG LengthSize, OffsetSize, RunsLength;
+
+    LengthSize = NtfsFormatRunFieldSize(Clusters);
+    OffsetSize = (Lcn < 0) ? 0 : NtfsFormatRunFieldSize(Lcn);
+    Runs[0] = (UCHAR)((OffsetSize << 4) | LengthSize);
+    RtlCopyMemory(&Runs[1], &Clusters, LengthSize);
+    RtlCopyMemory(&Runs[1 + LengthSize], &Lcn, OffsetSize);
+    RunsLength = 1 + LengthSize + OffsetSize;
+    Runs[RunsLength++] = 0;
+
+    Attribute = NtfsFormatAllocateAttribute(FileRecord,
+                                            Type,
+                                            Name,
+                                            HeaderLength,
+                                            (ULONG)NTFS_FORMAT_ALIGN(MappingPairsOffset + RunsLength, 8));
+    Attribute->IsNonResident = 1;
+
+    Attribute->NonResident.LowestVCN = 0;
+    Attribute->NonResident.HighestVCN = Clusters - 1;
+    Attribute->NonResident.MappingPairsOffset = (USHORT)MappingPairsOffset;
+    Attribute->NonResident.AllocatedSize = Clusters * Fmt->BytesPerCluster;
+    Attribute->NonResident.DataSize = DataSize;
+    Attribute->NonResident.InitializedSize = DataSize;
+    RtlCopyMemory((PUCHAR)Attribute + MappingPairsOffset, Runs, RunsLength);
+}
+
+static
+VOID
+NtfsFormatAddExtent(PNTFS_FORMAT_CONTEXT Fmt,
+                    PFILE_RECORD_HEADER FileRecord,
+                    ULONG Type,
+                    PCWSTR Name,
+                    PNTFS_FORMAT_EXTENT Extent,
+                    ULONGLONG DataSize)
+{
+    NtfsFormatAddNonResident(Fmt, FileRecord, Type, Name, Extent->Lcn, Extent->Clusters, DataSize);
+}
+
+static
+VOID
+NtfsFormatAddStandardInformation(PNTFS_FORMAT_CONTEXT Fmt,
+                                 PFILE_RECORD_HEADER FileRecord,
+                                 ULONG FileAttributes)
+{
+    PSTANDARD_INFORMATION StandardInfo;
+
+    StandardInfo = NtfsFormatAddResident(FileRecord, AttributeStandardInformation, NULL, sizeof(STANDARD_INFORMATION), 0);
+    StandardInfo->CreationTime = Fmt->Parameters->Time;
+    StandardInfo->ChangeTime = Fmt->Parameters->Time;
+    StandardInfo->LastWriteTime = Fmt->Parameters->Time;
+    StandardInfo->LastAccessTime = Fmt->Parameters->Time;
+    StandardInfo->FileAttribute = FileAttributes & 0xFFFF;
+    StandardInfo->SecurityId = NTFS_FORMAT_SECURITY_ID;
+}
+
+static
+VOID
+NtfsFormatAddFileName(PNTFS_FORMAT_CONTEXT Fmt,
+                      PFILE_RECORD_HEADER FileRecord,
+                      ULONG ParentIndex,
+                      PCWSTR Name,
+                      ULONG FileAttributes,
+                      PNTFS_FORMAT_EXTENT Extent,
+                      ULONGLONG DataSize)
+{
+    PFILENAME_ATTRIBUTE FileName;
+    ULONG NameLength = NtfsFormatNameLength(Name);
+
+    FileName = NtfsFormatAddResident(FileRecord,
+                                     AttributeFileName,
+                                     NULL,
+                                     FIELD_OFFSET(FILENAME_ATTRIBUTE, Name) + NameLength * sizeof(WCHAR),
+                                     RA_INDEXED);
+    FileName->DirectoryFileReferenceNumber = NtfsFormatFileReference(ParentIndex);
+    FileName->CreationTime = Fmt->Parameters->Time;
+    FileName->ChangeTime = Fmt->Parameters->Time;
+    FileName->LastWriteTime = Fmt->Parameters->Time;
+    FileName->LastAccessTime = Fmt->Parameters->Time;
+    FileName->AllocatedSize = (Extent != NULL) ? Extent->Clusters * Fmt->BytesPerCluster : 0;
+    FileName->DataSize = DataSize;
+    FileName->FileAttributes = FileAttributes;
+    FileName->NameLength = (UCHAR)NameLength;
+    FileName->NameType = NTFS_FILE_NAME_WIN32_AND_DOS;
+    RtlCopyMemory(FileName->Name, Name, NameLength * sizeof(WCHAR));
+
+    FileRecord->LinkCount++;
+}
+
+static
+VOID
+NtfsFormatAddSystemFile(PNTFS_FORMAT_CONTEXT Fmt,
+                        ULONG MftIndex,
+                        PCWSTR Name,
+                        PNTFS_FORMAT_EXTENT Extent,
+                        ULONGLONG DataSize)
+{
+    PFILE_RECORD_HEADER FileRecord = NtfsFormatRecord(Fmt, MftIndex);
+    ULONG FileAttributes = NTFS_FILE_TYPE_HIDDEN | NTFS_FILE_TYPE_SYSTEM;
+
+    NtfsFormatAddStandardInformation(Fmt, FileRecord, FileAttributes);
+    NtfsFormatAddFileName(Fmt, FileRecord, NTFS_FILE_ROOT, Name, FileAttributes, Extent, DataSize);
+
+    if (Extent != NULL)
+        NtfsFormatAddExtent(Fmt, FileRecord, AttributeData, NULL, Extent, DataSize);
+    else if (MftIndex != NTFS_FILE_VOLUME)
+        NtfsFormatAddResident(FileRecord, AttributeData, NULL, 0, 0);
+}
+
+static
+ULONG
+NtfsFormatAddViewEntry(PUCHAR Buffer,
+                       PVOID Key,
+                       USHORT KeyLength,
+                       PVOID Data,
+                       USHORT DataLength)
+{
+    PINDEX_ENTRY_ATTRIBUTE Entry = (PINDEX_ENTRY_ATTRIBUTE)Buffer;
+
+    Entry->Data.ViewIndex.DataOffset = sizeof(INDEX_ENTRY_ATTRIBUTE) + KeyLength;
+    Entry->Data.ViewIndex.DataLength = DataLength;
+    Entry->Length = (USHORT)NTFS_FORMAT_ALIGN(sizeof(INDEX_ENTRY_ATTRIBUTE) + KeyLength + DataLength, 8);
+    Entry->KeyLength = KeyLength;
+    RtlCopyMemory(Buffer + sizeof(INDEX_ENTRY_ATTRIBUTE), Key, KeyLength);
+    RtlCopyMemory(Buffer + Entry->Data.ViewIndex.DataOffset, Data, DataLength);
+
+    return Entry->Length;
+}
+
+static
+VOID
+NtfsFormatApplyFixups(PVOID Record,
+                      ULONG Size)
+{
+    PNTFS_RECORD_HEADER Header = Record;
+    PUSHORT Usa = (PUSHORT)((PUCHAR)Record + Header->UsaOffset);
+    PUSHORT Block;
+    ULONG i;
+
+    ASSERT(Header->UsaCount == Size / NTFS_BLOCK_SIZE + 1);
+
+    Usa[0] = 1;
+    for (i = 1; i < Header->UsaCount; i++)
+    {
+        Block = (PUSHORT)((PUCHAR)Record + i * NTFS_BLOCK_SIZE - sizeof(USHORT));
+        Usa[i] = *Block;
+        *Block = Usa[0];
+    }
+}
+
+/**
+* @name NtfsFormatAddIndex
+* @implemented
+*
+* Adds an index to a file record. The index stays in $INDEX_ROOT when it
+* fits in the record, otherwise its entries go to a single index record
+* which is written to Allocation.
+*
+* @param Entries
+* Sorted index entries, without the end entry.
+*
+* @param Allocation
+* Optional extent for the index record, only the root directory has one.
+*
+* @return
+* STATUS_SUCCESS or STATUS_UNSUCCESSFUL if the entries don't fit.
+*/
+static
+NTSTATUS
+NtfsFormatAddIndex(PNTFS_FORMAT_CONTEXT Fmt,
+                   PFILE_RECORD_HEADER FileRecord,
+                   PCWSTR Name,
+                   ULONG AttributeType,
+                   ULONG CollationRule,
+                   PUCHAR Entries,
+                   ULONG EntriesLength,
+                   PNTFS_FORMAT_EXTENT Allocation)
+{
+    PINDEX_ROOT_ATTRIBUTE IndexRoot;
+    PINDEX_ENTRY_ATTRIBUTE EndEntry;
+    PINDEX_BUFFER IndexBuffer;
+    PUCHAR Bitmap;
+    ULONG ValueLength, Available, HeaderLength;
+    BOOLEAN Large;
+
+    /* Resident header, name and $INDEX_ROOT header in front of the entries */
+    HeaderLength = (ULONG)NTFS_FORMAT_ALIGN(FIELD_OFFSET(NTFS_ATTR_RECORD, Resident.Reserved) + sizeof(UCHAR) +
+                                            NtfsFormatNameLength(Name) * sizeof(WCHAR), 8) +
+                   sizeof(INDEX_ROOT_ATTRIBUTE);
+    Available = FileRecord->BytesAllocated - FileRecord->BytesInUse;
+    Large = (HeaderLength + EntriesLength + sizeof(INDEX_ENTRY_ATTRIBUTE) > Available);
+
+    if (Large && (Allocation == NULL ||
+                  sizeof(INDEX_BUFFER) + (Fmt->BytesPerIndexRecord / NTFS_BLOCK_SIZE + 1) * sizeof(USHORT) + 8 +
+                  EntriesLength + sizeof(INDEX_ENTRY_ATTRIBUTE) > Fmt->BytesPerIndexRecord))
+    {
+        DPRINT1("Index of record %lu too large\n", FileRecord->MFTRecordNumber);
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    ValueLength = sizeof(INDEX_ROOT_ATTRIBUTE) + sizeof(INDEX_ENTRY_ATTRIBUTE);
+    ValueLength += Large ? sizeof(ULONGLONG) : EntriesLength;
+
+    IndexRoot = NtfsFormatAddResident(FileRecord, AttributeIndexRoot, Name, ValueLength, 0);
+    IndexRoot->AttributeType = AttributeType;
+    IndexRoot->CollationRule = CollationRule;
+    IndexRoot->SizeOfEntry = Fmt->BytesPerIndexRecord;
+    if (Fmt->BytesPerIndexRecord >= Fmt->BytesPerCluster)
+        IndexRoot->ClustersPerIndexRecord = (UCHAR)(Fmt->BytesPerIndexRecord / Fmt->BytesPerCluster);
+    else
+        IndexRoot->ClustersPerIndexRecord = (UCHAR)(Fmt->BytesPerIndexRecord / NTFS_BLOCK_SIZE);
+    IndexRoot->Header.FirstEntryOffset = sizeof(INDEX_HEADER_ATTRIBUTE);
+    IndexRoot->Header.TotalSizeOfEntries = ValueLength - FIELD_OFFSET(INDEX_ROOT_ATTRIBUTE, Header);
+    IndexRoot->Header.AllocatedSize = IndexRoot->Header.TotalSizeOfEntries;
+    IndexRoot->Header.Flags = Large ? INDEX_ROOT_LARGE : INDEX_ROOT_SMALL;
+
+    EndEntry = (PINDEX_ENTRY_ATTRIBUTE)(IndexRoot + 1);
+    if (!Large)
+    {
+        /* Empty indexes come without entries */
+        if (EntriesLength != 0)
+            RtlCopyMemory(EndEntry, Entries, EntriesLength);
+        EndEntry = (PINDEX_ENTRY_ATTRIBUTE)((PUCHAR)EndEntry + EntriesLength);
+        EndEntry->Length = sizeof(INDEX_ENTRY_ATTRIBUTE);
+        EndEntry->Flags = NTFS_INDEX_ENTRY_END;
+        return STATUS_SUCCESS;
+    }
+
+    /* The end entry points at the index record, VCN 0 */
+    EndEntry->Length = sizeof(INDEX_ENTRY_ATTRIBUTE) + sizeof(ULONGLONG);
+    EndEntry->Flags = NTFS_INDEX_ENTRY_NODE | NTFS_INDEX_ENTRY_END;
+
+    IndexBuffer = NtfsFormatExtentBuffer(Fmt, Allocation);
+    IndexBuffer->Ntfs.Type = NRH_INDX_TYPE;
+    IndexBuffer->Ntfs.UsaOffset = sizeof(INDEX_BUFFER);
+    IndexBuffer->Ntfs.UsaCount = (USHORT)(Fmt->BytesPerIndexRecord / NTFS_BLOCK_SIZE + 1);
+    IndexBuffer->VCN = 0;
+    IndexBuffer->Header.FirstEntryOffset = (ULONG)NTFS_FORMAT_ALIGN(sizeof(INDEX_BUFFER) + IndexBuffer->Ntfs.UsaCount * sizeof(USHORT), 8) -
+                                           FIELD_OFFSET(INDEX_BUFFER, Header);
+    IndexBuffer->Header.TotalSizeOfEntries = IndexBuffer->Header.FirstEntryOffset + EntriesLength + sizeof(INDEX_ENTRY_ATTRIBUTE);
+    IndexBuffer->Header.AllocatedSize = Fmt->BytesPerIndexRecord - FIELD_OFFSET(INDEX_BUFFER, Header);
+    IndexBuffer->Header.Flags = INDEX_NODE_SMALL;
+
+    EndEntry = (PINDEX_ENTRY_ATTRIBUTE)((PUCHAR)&IndexBuffer->Header + IndexBuffer->Header.FirstEntryOffset);
+    RtlCopyMemory(EndEntry, Entries, EntriesLength);
+    EndEntry = (PINDEX_ENTRY_ATTRIBUTE)((PUCHAR)EndEntry + EntriesLength);
+    EndEntry->Length = sizeof(INDEX_ENTRY_ATTRIBUTE);
+    EndEntry->Flags = NTFS_INDEX_ENTRY_END;
+
+    NtfsFormatApplyFixups(IndexBuffer, Fmt->BytesPerIndexRecord);
+
+    NtfsFormatAddExtent(Fmt, FileRecord, AttributeIndexAllocation, Name, Allocation, Fmt->BytesPerIndexRecord);
+    Bitmap = NtfsFormatAddResident(FileRecord, AttributeBitmap, Name, sizeof(ULONGLONG), 0);
+    Bitmap[0] = 1;
+
+    return STATUS_SUCCESS;
+}
+
+static
+PFILENAME_ATTRIBUTE
+NtfsFormatFindFileName(PFILE_RECORD_HEADER FileRecord)
+{
+    PNTFS_ATTR_RECORD Attribute = (PNTFS_ATTR_RECORD)((PUCHAR)FileRecord + FileRecord->AttributeOffset);
+
+    while (Attribute->Type != AttributeEnd)
+    {
+        if (Attribute->Type == AttributeFileName)
+            return (PFILENAME_ATTRIBUTE)((PUCHAR)Attribute + Attribute->Resident.ValueOffset);
+
+        Attribute = (PNTFS_ATTR_RECORD)((PUCHAR)Attribute + Attribute->Length);
+    }
+
+    return NULL;
+}
+
+static
+LONG
+NtfsFormatCompareFileNames(PNTFS_FORMAT_CONTEXT Fmt,
+                           PFILENAME_ATTRIBUTE First,
+                           PFILENAME_ATTRIBUTE Second)
+{
+    ULONG i;
+    WCHAR FirstChar, SecondChar;
+
+    for (i = 0; i < First->NameLength && i < Second->NameLength; i++)
+    {
+        FirstChar = Fmt->UpCaseTable[First->Name[i]];
+        SecondChar = Fmt->UpCaseTable[Second->Name[i]];
+        if (FirstChar != SecondChar)
+            return (FirstChar < SecondChar) ? -1 : 1;
+    }
+
+    return (LONG)First->NameLength - (LONG)Second->NameLength;
+}
+
+/**
+* @name NtfsFormatAddDirectoryIndex
+* @implemented
+*
+* Builds the $I30 index of a directory from the $FILE_NAME attributes of
+* the system records whose parent it is. Must be called once all of its
+* children, and the directory's own $FILE_NAME, are in place.
+*/
+static
+NTSTATUS
+NtfsFormatAddDirectoryIndex(PNTFS_FORMAT_CONTEXT Fmt,
+                            ULONG DirectoryIndex,
+                            PNTFS_FORMAT_EXTENT Allocation)
+{
+    PFILENAME_ATTRIBUTE Children[NTFS_FORMAT_SYSTEM_RECORDS];
+    ULONG ChildIndexes[NTFS_FORMAT_SYSTEM_RECORDS];
+    PFILENAME_ATTRIBUTE FileName;
+    PINDEX_ENTRY_ATTRIBUTE Entry;
+    UCHAR Entries[NTFS_FORMAT_INDEX_RECORD_SIZE];
+    ULONG Count = 0, EntriesLength = 0, FileNameLength;
+    ULONG i, j;
+
+    for (i = 0; i < NTFS_FORMAT_SYSTEM_RECORDS; i++)
+    {
+        FileName = NtfsFormatFindFileName(NtfsFormatRecord(Fmt, i));
+        if (FileName == NULL || (FileName->DirectoryFileReferenceNumber & NTFS_MFT_MASK) != DirectoryIndex)
+            continue;
+
+        /* Insertion sort, in collation order */
+        for (j = Count; j > 0 && NtfsFormatCompareFileNames(Fmt, Children[j - 1], FileName) > 0; j--)
+        {
+            Children[j] = Children[j - 1];
+            ChildIndexes[j] = ChildIndexes[j - 1];
+        }
+
+        Children[j] = FileName;
+        ChildIndexes[j] = i;
+        Count++;
+    }
+
+    RtlZeroMemory(Entries, sizeof(Entries));
+    for (i = 0; i < Count; i++)
+    {
+        FileNameLength = FIELD_OFFSET(FILENAME_ATTRIBUTE, Name) + Children[i]->NameLength * sizeof(WCHAR);
+        Entry = (PINDEX_ENTRY_ATTRIBUTE)(Entries + EntriesLength);
+        Entry->Data.Directory.IndexedFile = NtfsFormatFileReference(ChildIndexes[i]);
+        Entry->Length = (USHORT)NTFS_FORMAT_ALIGN(sizeof(INDEX_ENTRY_ATTRIBUTE) + FileNameLength, 8);
+        Entry->KeyLength = (USHORT)FileNameLength;
+        RtlCopyMemory(Entry + 1, Children[i], FileNameLength);
+        EntriesLength += Entry->Length;
+    }
+
+    return NtfsFormatAddIndex(Fmt,
+                              NtfsFormatRecord(Fmt, DirectoryIndex),
+                              L"$I30",
+                              AttributeFileName,
+                              COLLATION_FILE_NAME,
+                              Entries,
+                              EntriesLength,
+                              Allocation);
+}
+
+static
+VOID
+NtfsFormatAddExtendFile(PNTFS_FORMAT_CONTEXT Fmt,
+                        ULONG MftIndex,
+                        PCWSTR Name)
+{
+    PFILE_RECORD_HEADER FileRecord = NtfsFormatRecord(Fmt, MftIndex);
+    ULONG FileAttributes = NTFS_FILE_TYPE_HIDDEN | NTFS_FILE_TYPE_SYSTEM | NTFS_FILE_TYPE_ARCHIVE | NTFS_FILE_TYPE_VIEW_INDEX;
+
+    NtfsFormatAddStandardInformation(Fmt, FileRecord, FileAttributes);
+    NtfsFormatAddFileName(Fmt, FileRecord, NTFS_FILE_EXTEND, Name, FileAttributes, NULL, 0);
+}
+
+/**
+* @name NtfsFormatBuildMft
+* @implemented
+*
+* Builds the initial MFT: the system files, the reserved records, the files
+* of $Extend and empty records up to the initial MFT size, and derives the
+* MFT bitmap and $MFTMirr from it.
+*/
+static
+NTSTATUS
+NtfsFormatBuildMft(PNTFS_FORMAT_CONTEXT Fmt)
+{
+    PNTFS_FORMAT_PARAMETERS Parameters = Fmt->Parameters;
+    PFILE_RECORD_HEADER FileRecord;
+    PVOLINFO_ATTRIBUTE VolumeInfo;
+    QUOTA_CONTROL_ENTRY QuotaDefaults;
+    PUCHAR VolumeName, MftBitmap;
+    UCHAR Entries[2 * sizeof(INDEX_ENTRY_ATTRIBUTE) + sizeof(SECURITY_DESCRIPTOR_HEADER) + sizeof(QUOTA_CONTROL_ENTRY) + 16];
+    SECURITY_HASH_KEY HashKey;
+    ULONG Key, EntriesLength, i;
+    USHORT Flags;
+    NTSTATUS Status;
+
+    for (i = 0; i < Fmt->MftRecordCount; i++)
+    {
+        if (i < NTFS_FILE_FIRST_USER_FILE || (i >= NTFS_FILE_QUOTA && i < NTFS_FORMAT_SYSTEM_RECORDS))
+            Flags = FRH_IN_USE;
+        else
+            Flags = 0;
+
+        if (i == NTFS_FILE_ROOT || i == NTFS_FILE_EXTEND)
+            Flags |= FRH_DIRECTORY;
+        else if (i == NTFS_FILE_SECURE || i >= NTFS_FILE_QUOTA)
+            Flags |= (Flags & FRH_IN_USE) ? FRH_VIEW_INDEX : 0;
+
+        NtfsFormatInitRecord(Fmt, i, Flags);
+    }
+
+    /* $MFT */
+    NtfsFormatAddSystemFile(Fmt, NTFS_FILE_MFT, L"$MFT", &Fmt->Mft, (ULONGLONG)Fmt->MftRecordCount * Fmt->BytesPerFileRecord);
+    NtfsFormatAddExtent(Fmt, NtfsFormatRecord(Fmt, NTFS_FILE_MFT), AttributeBitmap, NULL, &Fmt->MftBitmap, Fmt->MftBitmapSize);
+
+    NtfsFormatAddSystemFile(Fmt, NTFS_FILE_MFTMIRR, L"$MFTMirr", &Fmt->MftMirr, NTFS_FORMAT_MIRROR_RECORDS * Fmt->BytesPerFileRecord);
+    NtfsFormatAddSystemFile(Fmt, NTFS_FILE_LOGFILE, L"$LogFile", &Fmt->LogFile, Fmt->LogFileSize);
+
+    /* $Volume */
+    FileRecord = NtfsFormatRecord(Fmt, NTFS_FILE_VOLUME);
+    NtfsFormatAddSystemFile(Fmt, NTFS_FILE_VOLUME, L"$Volume", NULL, 0);
+    VolumeName = NtfsFormatAddResident(FileRecord,
+                                       AttributeVolumeName,
+                                       NULL,
+                                       (Parameters->Label != NULL) ? Parameters->Label->Length : 0,
+                                       0);
+    if (Parameters->Label != NULL)
+        RtlCopyMemory(VolumeName, Parameters->Label->Buffer, Parameters->Label->Length);
+    VolumeInfo = NtfsFormatAddResident(FileRecord, AttributeVolumeInformation, NULL, sizeof(VOLINFO_ATTRIBUTE), 0);
+    VolumeInfo->MajorVersion = 3;
+    VolumeInfo->MinorVersion = 1;
+    NtfsFormatAddResident(FileRecord, AttributeData, NULL, 0, 0);
+
+    NtfsFormatAddSystemFile(Fmt, NTFS_FILE_ATTRDEF, L"$AttrDef", &Fmt->AttrDef, NTFS_FORMAT_ATTRDEF_SIZE);
+    NtfsFormatAddSystemFile(Fmt, NTFS_FILE_BITMAP, L"$Bitmap", &Fmt->Bitmap, Fmt->BitmapSize);
+    NtfsFormatAddSystemFile(Fmt, NTFS_FILE_BOOT, L"$Boot", &Fmt->Boot, NTFS_FORMAT_BOOT_SIZE);
+
+    /* $BadClus: a sparse $Bad stream the size of the volume */
+    NtfsFormatAddSystemFile(Fmt, NTFS_FILE_BADCLUS, L"$BadClus", NULL, 0);
+    NtfsFormatAddNonResident(Fmt,
+                             NtfsFormatRecord(Fmt, NTFS_FILE_BADCLUS),
+                             AttributeData,
+                             L"$Bad",
+                             -1,
+                             Fmt->ClusterCount,
+                             Fmt->ClusterCount * Fmt->BytesPerCluster);
+
+    /* $Secure, with the descriptor shared by all the files */
+    FileRecord = NtfsFormatRecord(Fmt, NTFS_FILE_SECURE);
+    NtfsFormatAddStandardInformation(Fmt, FileRecord, NTFS_FILE_TYPE_HIDDEN | NTFS_FILE_TYPE_SYSTEM | NTFS_FILE_TYPE_ARCHIVE);
+    NtfsFormatAddFileName(Fmt,
+                          FileRecord,
+                          NTFS_FILE_ROOT,
+                          L"$Secure",
+                          NTFS_FILE_TYPE_HIDDEN | NTFS_FILE_TYPE_SYSTEM | NTFS_FILE_TYPE_ARCHIVE | NTFS_FILE_TYPE_VIEW_INDEX,
+                          NULL,
+                          0);
+    NtfsFormatAddExtent(Fmt, FileRecord, AttributeData, L"$SDS", &Fmt->Sds, Fmt->SdsSize);
+
+    RtlZeroMemory(Entries, sizeof(Entries));
+    HashKey.Hash = Fmt->SecurityHeader.Hash;
+    HashKey.SecurityId = Fmt->SecurityHeader.SecurityId;
+    EntriesLength = NtfsFormatAddViewEntry(Entries,
+                                           &HashKey,
+                                           sizeof(HashKey),
+                                           &Fmt->SecurityHeader,
+                                           sizeof(SECURITY_DESCRIPTOR_HEADER));
+    Status = NtfsFormatAddIndex(Fmt, FileRecord, L"$SDH", 0, COLLATION_NTOFS_SECURITY_HASH, Entries, EntriesLength, NULL);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    RtlZeroMemory(Entries, sizeof(Entries));
+    EntriesLength = NtfsFormatAddViewEntry(Entries,
+                                           &Fmt->SecurityHeader.SecurityId,
+                                           sizeof(ULONG),
+                                           &Fmt->SecurityHeader,
+                                           sizeof(SECURITY_DESCRIPTOR_HEADER));
+    Status = NtfsFormatAddIndex(Fmt, FileRecord, L"$SII", 0, COLLATION_NTOFS_ULONG, Entries, EntriesLength, NULL);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    NtfsFormatAddSystemFile(Fmt, NTFS_FILE_UPCASE, L"$UpCase", &Fmt->UpCase, NTFS_FORMAT_UPCASE_SIZE);
+
+    /* Reserved records, in use but without a name */
+    for (i = NTFS_FILE_EXTEND + 1; i < NTFS_FILE_FIRST_USER_FILE; i++)
+    {
+        FileRecord = NtfsFormatRecord(Fmt, i);
+        NtfsFormatAddStandardInformation(Fmt, FileRecord, NTFS_FILE_TYPE_HIDDEN | NTFS_FILE_TYPE_SYSTEM);
+        NtfsFormatAddResident(FileRecord, AttributeData, NULL, 0, 0);
+    }
+
+    /* $Extend\$Quota, with the default limits in $Q */
+    NtfsFormatAddExtendFile(Fmt, NTFS_FILE_QUOTA, L"$Quota");
+    FileRecord = NtfsFormatRecord(Fmt, NTFS_FILE_QUOTA);
+    Status = NtfsFormatAddIndex(Fmt, FileRecord, L"$O", 0, COLLATION_NTOFS_SID, NULL, 0, NULL);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    RtlZeroMemory(&QuotaDefaults, sizeof(QuotaDefaults));
+    QuotaDefaults.Version = 2;
+    QuotaDefaults.Flags = QUOTA_FLAG_DEFAULT_LIMITS;
+    QuotaDefaults.ChangeTime = Parameters->Time;
+    QuotaDefaults.Threshold = -1;
+    QuotaDefaults.Limit = -1;
+
+    RtlZeroMemory(Entries, sizeof(Entries));
+    Key = 1;
+    EntriesLength = NtfsFormatAddViewEntry(Entries, &Key, sizeof(ULONG), &QuotaDefaults, sizeof(QUOTA_CONTROL_ENTRY));
+    Status = NtfsFormatAddIndex(Fmt, FileRecord, L"$Q", 0, COLLATION_NTOFS_ULONG, Entries, EntriesLength, NULL);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    NtfsFormatAddExtendFile(Fmt, NTFS_FILE_OBJID, L"$ObjId");
+    Status = NtfsFormatAddIndex(Fmt, NtfsFormatRecord(Fmt, NTFS_FILE_OBJID), L"$O", 0, COLLATION_NTOFS_ULONGS, NULL, 0, NULL);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    NtfsFormatAddExtendFile(Fmt, NTFS_FILE_REPARSE, L"$Reparse");
+    Status = NtfsFormatAddIndex(Fmt, NtfsFormatRecord(Fmt, NTFS_FILE_REPARSE), L"$R", 0, COLLATION_NTOFS_ULONGS, NULL, 0, NULL);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    /* The directories come last, their indexes list the files above */
+    FileRecord = NtfsFormatRecord(Fmt, NTFS_FILE_EXTEND);
+    NtfsFormatAddStandardInformation(Fmt, FileRecord, NTFS_FILE_TYPE_HIDDEN | NTFS_FILE_TYPE_SYSTEM);
+    NtfsFormatAddFileName(Fmt,
+                          FileRecord,
+                          NTFS_FILE_ROOT,
+                          L"$Extend",
+                          NTFS_FILE_TYPE_HIDDEN | NTFS_FILE_TYPE_SYSTEM | NTFS_FILE_TYPE_DIRECTORY,
+                          NULL,
+                          0);
+    Status = NtfsFormatAddDirectoryIndex(Fmt, NTFS_FILE_EXTEND, NULL);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    FileRecord = NtfsFormatRecord(Fmt, NTFS_FILE_ROOT);
+    NtfsFormatAddStandardInformation(Fmt, FileRecord, NTFS_FILE_TYPE_HIDDEN | NTFS_FILE_TYPE_SYSTEM);
+    NtfsFormatAddFileName(Fmt,
+                          FileRecord,
+                          NTFS_FILE_ROOT,
+                          L".",
+                          NTFS_FILE_TYPE_HIDDEN | NTFS_FILE_TYPE_SYSTEM | NTFS_FILE_TYPE_DIRECTORY,
+                          NULL,
+                          0);
+    Status = NtfsFormatAddDirectoryIndex(Fmt, NTFS_FILE_ROOT, &Fmt->RootIndex);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    MftBitmap = NtfsFormatExtentBuffer(Fmt, &Fmt->MftBitmap);
+    for (i = 0; i < Fmt->MftRecordCount; i++)
+    {
+        FileRecord = NtfsFormatRecord(Fmt, i);
+        if (FileRecord->Flags & FRH_IN_USE)
+            MftBitmap[i / 8] |= 1 << (i % 8);
+
+        NtfsFormatApplyFixups(FileRecord, Fmt->BytesPerFileRecord);
+    }
+
+    RtlCopyMemory(Fmt->MftMirror, Fmt->MftBuffer, NTFS_FORMAT_MIRROR_RECORDS * Fmt->BytesPerFileRecord);
+
+    return STATUS_SUCCESS;
+}
+
+static
+NTSTATUS
+NtfsFormatFlush(PNTFS_FORMAT_CONTEXT Fmt)
+{
+    PNTFS_FORMAT_PARAMETERS Parameters = Fmt->Parameters;
+    NTSTATUS Status;
+    ULONG Percent;
+
+    if (Fmt->BufferUsed == 0)
+        return STATUS_SUCCESS;
+
+    Status = Parameters->WriteRoutine(Parameters->Context, Fmt->BufferOffset, Fmt->Buffer, Fmt->BufferUsed);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Failed to write %lu bytes at %I64u (Status 0x%08lx)\n", Fmt->BufferUsed, Fmt->BufferOffset, Status);
+        return Status;
+    }
+
+    Fmt->BufferOffset += Fmt->BufferUsed;
+    Fmt->BytesWritten += Fmt->BufferUsed;
+    Fmt->BufferUsed = 0;
+
+    Percent = (ULONG)(Fmt->BytesWritten * 100 / Fmt->BytesToWrite);
+    if (Parameters->ProgressRoutine != NULL && Percent != Fmt->Percent)
+    {
+        Fmt->Percent = Percent;
+        Parameters->ProgressRoutine(Parameters->Context, Percent);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static
+NTSTATUS
+NtfsFormatSeek(PNTFS_FORMAT_CONTEXT Fmt,
+               ULONGLONG Offset)
+{
+    NTSTATUS Status;
+
+    Status = NtfsFormatFlush(Fmt);
+    Fmt->BufferOffset = Offset;
+
+    return Status;
+}
+
+/**
+* @name NtfsFormatAppend
+* @implemented
+*
+* Appends data at the current position of the sequential writer. The data
+* is gathered into NTFS_FORMAT_CHUNK_SIZE writes.
+*
+* @param Data
+* Data to write, or NULL to write Length bytes of Fill.
+*/
+static
+NTSTATUS
+NtfsFormatAppend(PNTFS_FORMAT_CONTEXT Fmt,
+                 PVOID Data,
+                 UCHAR Fill,
+                 ULONGLONG Length)
+{
+    ULONG Piece;
+    NTSTATUS Status;
+
+    while (Length != 0)
+    {
+        if (Fmt->BufferUsed == NTFS_FORMAT_CHUNK_SIZE)
+        {
+            Status = NtfsFormatFlush(Fmt);
+            if (!NT_SUCCESS(Status))
+                return Status;
+        }
+
+        Piece = (ULONG)min(Length, NTFS_FORMAT_CHUNK_SIZE - Fmt->BufferUsed);
+        if (Data != NULL)
+        {
+            RtlCopyMemory(Fmt->Buffer + Fmt->BufferUsed, Data, Piece);
+            Data = (PUCHAR)Data + Piece;
+        }
+        else
+        {
+            memset(Fmt->Buffer + Fmt->BufferUsed, Fill, Piece);
+        }
+
+        Fmt->BufferUsed += Piece;
+        Length -= Piece;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static
+VOID
+NtfsFormatSetBits(PUCHAR Bits,
+                  ULONGLONG FirstBit,
+                  ULONG BitCount,
+                  ULONGLONG Start,
+                  ULONGLONG Count)
+{
+    ULONGLONG Bit, End;
+
+    Bit = max(Start, FirstBit);
+    End = min(Start + Count, FirstBit + BitCount);
+    for (; Bit < End; Bit++)
+    {
+        if ((Bit - FirstBit) % 8 == 0 && Bit + 8 <= End)
+        {
+            Bits[(Bit - FirstBit) / 8] = 0xFF;
+            Bit += 7;
+        }
+        else
+        {
+            Bits[(Bit - FirstBit) / 8] |= 1 << ((Bit - FirstBit) % 8);
+        }
+    }
+}
+
+/**
+* @name NtfsFormatAppendBitmap
+* @implemented
+*
+* Streams $Bitmap into the sequential writer. The bitmap of a multi-TB
+* volume is hundreds of MB, so it is generated piece by piece in the write
+* buffer rather than built in memory. The metadata, $MFTMirr and the
+* padding bits past the last cluster are allocated.
+*/
+static
+NTSTATUS
+NtfsFormatAppendBitmap(PNTFS_FORMAT_CONTEXT Fmt)
+{
+    ULONGLONG Offset;
+    ULONG Piece;
+    PUCHAR Bits;
+    NTSTATUS Status;
+
+    for (Offset = 0; Offset < Fmt->BitmapSize; Offset += Piece)
+    {
+        if (Fmt->BufferUsed == NTFS_FORMAT_CHUNK_SIZE)
+        {
+            Status = NtfsFormatFlush(Fmt);
+            if (!NT_SUCCESS(Status))
+                return Status;
+        }
+
+        Piece = (ULONG)min(Fmt->BitmapSize - Offset, NTFS_FORMAT_CHUNK_SIZE - Fmt->BufferUsed);
+        Bits = Fmt->Buffer + Fmt->BufferUsed;
+        RtlZeroMemory(Bits, Piece);
+
+        NtfsFormatSetBits(Bits, Offset * 8, Piece * 8, 0, Fmt->MetadataEnd);
+        NtfsFormatSetBits(Bits, Offset * 8, Piece * 8, Fmt->MftMirr.Lcn, Fmt->MftMirr.Clusters);
+        NtfsFormatSetBits(Bits, Offset * 8, Piece * 8, Fmt->ClusterCount, Fmt->BitmapSize * 8 - Fmt->ClusterCount);
+
+        Fmt->BufferUsed += Piece;
+    }
+
+    return NtfsFormatAppend(Fmt, NULL, 0, Fmt->Bitmap.Clusters * Fmt->BytesPerCluster - Fmt->BitmapSize);
+}
+
+/**
+* @name NtfsFormatWriteVolume
+* @implemented
+*
+* Writes the volume front to back. $Boot through $MFT form one contiguous
+* stream, followed by $MFTMirr and, unless formatting quickly, zeroes over
+* the data clusters. The boot sector and its backup are written last, so an
+* interrupted format doesn't leave a mountable volume behind.
+*/
+static
+NTSTATUS
+NtfsFormatWriteVolume(PNTFS_FORMAT_CONTEXT Fmt)
+{
+    ULONG BytesPerCluster = Fmt->BytesPerCluster;
+    ULONGLONG MirrorEnd = Fmt->MftMirr.Lcn + Fmt->MftMirr.Clusters;
+    NTSTATUS Status;
+
+    if (Fmt->Parameters->QuickFormat)
+        Fmt->BytesToWrite = (Fmt->MetadataEnd + Fmt->MftMirr.Clusters) * BytesPerCluster;
+    else
+        Fmt->BytesToWrite = Fmt->ClusterCount * BytesPerCluster;
+    Fmt->BytesToWrite += 2 * Fmt->BytesPerSector;
+
+    Status = NtfsFormatAppend(Fmt, Fmt->Metadata, 0, Fmt->Bitmap.Lcn * BytesPerCluster);
+    if (NT_SUCCESS(Status))
+        Status = NtfsFormatAppendBitmap(Fmt);
+    if (NT_SUCCESS(Status))
+        Status = NtfsFormatAppend(Fmt, NULL, 0xFF, Fmt->LogFile.Clusters * BytesPerCluster);
+    if (NT_SUCCESS(Status))
+        Status = NtfsFormatAppend(Fmt, Fmt->MftBuffer, 0, Fmt->Mft.Clusters * BytesPerCluster);
+
+    if (NT_SUCCESS(Status))
+    {
+        if (Fmt->Parameters->QuickFormat)
+            Status = NtfsFormatSeek(Fmt, Fmt->MftMirr.Lcn * BytesPerCluster);
+        else
+            Status = NtfsFormatAppend(Fmt, NULL, 0, (Fmt->MftMirr.Lcn - Fmt->MetadataEnd) * BytesPerCluster);
+    }
+    if (NT_SUCCESS(Status))
+        Status = NtfsFormatAppend(Fmt, Fmt->MftMirror, 0, Fmt->MftMirr.Clusters * BytesPerCluster);
+    if (NT_SUCCESS(Status) && !Fmt->Parameters->QuickFormat)
+        Status = NtfsFormatAppend(Fmt, NULL, 0, (Fmt->ClusterCount - MirrorEnd) * BytesPerCluster);
+
+    if (NT_SUCCESS(Status))
+        Status = NtfsFormatSeek(Fmt, 0);
+    if (NT_SUCCESS(Status))
+        Status = NtfsFormatAppend(Fmt, Fmt->BootSector, 0, Fmt->BytesPerSector);
+    if (NT_SUCCESS(Status))
+        Status = NtfsFormatSeek(Fmt, Fmt->SectorCount * Fmt->BytesPerSector);
+    if (NT_SUCCESS(Status))
+        Status = NtfsFormatAppend(Fmt, Fmt->BootSector, 0, Fmt->BytesPerSector);
+    if (NT_SUCCESS(Status))
+        Status = NtfsFormatFlush(Fmt);
+
+    return Status;
+}
+
+/**
+* @name NtfsFormatVolume
+* @implemented
+*
+* Formats a volume as NTFS 3.1. The system files are built in memory and the
+* volume is written through Parameters->WriteRoutine with a few large
+* sequential writes, so that a quick format of a multi-TB volume only writes
+* its metadata.
+*
+* @param Parameters
+* Geometry of the volume, options and the write and progress routines.
+*
+* @return
+* STATUS_SUCCESS on success, otherwise an error code from the layout or the
+* write routine.
+*/
+NTSTATUS
+NtfsFormatVolume(IN PNTFS_FORMAT_PARAMETERS Parameters)
+{
+    NTFS_FORMAT_CONTEXT Fmt;
+    NTSTATUS Status;
+
+    RtlZeroMemory(&Fmt, sizeof(Fmt));
+    Fmt.Parameters = Parameters;
+
+    Status = NtfsFormatComputeLayout(&Fmt);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    Fmt.Metadata = NtfsLibAllocate(Fmt.Bitmap.Lcn * Fmt.BytesPerCluster);
+    Fmt.MftBuffer = NtfsLibAllocate(Fmt.Mft.Clusters * Fmt.BytesPerCluster);
+    Fmt.MftMirror = NtfsLibAllocate(Fmt.MftMirr.Clusters * Fmt.BytesPerCluster);
+    Fmt.BootSector = NtfsLibAllocate(Fmt.BytesPerSector);
+    Fmt.Buffer = NtfsLibAllocate(NTFS_FORMAT_CHUNK_SIZE);
+    if (Fmt.Metadata == NULL || Fmt.MftBuffer == NULL || Fmt.MftMirror == NULL ||
+        Fmt.BootSector == NULL || Fmt.Buffer == NULL)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Cleanup;
+    }
+
+    NtfsFormatBuildBootSector(&Fmt);
+    NtfsFormatBuildAttrDef(&Fmt);
+    NtfsFormatBuildUpCase(&Fmt);
+    NtfsFormatBuildSecure(&Fmt);
+
+    Status = NtfsFormatBuildMft(&Fmt);
+    if (NT_SUCCESS(Status))
+        Status = NtfsFormatWriteVolume(&Fmt);
+
+Cleanup:
+    if (Fmt.Buffer != NULL)
+        NtfsLibFree(Fmt.Buffer);
+    if (Fmt.BootSector != NULL)
+        NtfsLibFree(Fmt.BootSector);
+    if (Fmt.MftMirror != NULL)
+        NtfsLibFree(Fmt.MftMirror);
+    if (Fmt.MftBuffer != NULL)
+        NtfsLibFree(Fmt.MftBuffer);
+    if (Fmt.Metadata != NULL)
+        NtfsLibFree(Fmt.Metadata);
+
+    return Status;
+}
@@ -6,13 +6,85 @@
  * PROGRAMMERS: Pierre Schweitzer
  */
 
-#define NTOS_MODE_USER
-#include <ndk/umtypes.h>
-#include <fmifs/fmifs.h>
+#include "ntfslib.h"
 
 #define NDEBUG
 #include <debug.h>
 
+typedef struct _NTFSLIB_FORMAT_CONTEXT
+{
+    HANDLE FileHandle;
+    PFMIFSCALLBACK Callback;
+    ULONG Percent;
+} NTFSLIB_FORMAT_CONTEXT, *PNTFSLIB_FORMAT_CONTEXT;
+
+typedef struct _NTFSLIB_CHECK_CONTEXT
+{
+    HANDLE FileHandle;
+    PFMIFSCALLBACK Callback;
+    ULONG BytesPerSector;
+    ULONG Percent;
+} NTFSLIB_CHECK_CONTEXT, *PNTFSLIB_CHECK_CONTEXT;
+
+typedef struct _NTFSLIB_CHECK_THREAD
+{
+    PNTFS_CHECK_WORKER Worker;
+    PVOID Parameter;
+    HANDLE Handle;
+} NTFSLIB_CHECK_THREAD, *PNTFSLIB_CHECK_THREAD;
+
+/* The scan is mostly bound by the disk, a few workers keep it busy */
+#define NTFSLIB_CHECK_MAX_THREADS 8
+
+static
+NTSTATUS
+NtfsLibWrite(
+    IN PVOID Context,
+    IN ULONGLONG Offset,
+    IN PVOID Buffer,
+    IN ULONG Length)
+{
+    PNTFSLIB_FORMAT_CONTEXT FormatContext = Context;
+    IO_STATUS_BLOCK Iosb;
+    LARGE_INTEGER FileOffset;
+    NTSTATUS Status;
+
+    FileOffset.QuadPart = Offset;
+    Status = NtWriteFile(FormatContext->FileHandle,
+                         NULL,
+                         NULL,
+                         NULL,
+                         &Iosb,
+                         Buffer,
+                         Length,
+                         &FileOffset,
+                         NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("NtWriteFile() failed at offset %I64u (Status 0x%08x)\n", Offset, Status);
+    }
+
+    return Status;
+}
+
+static
+VOID
+NtfsLibProgress(
+    IN PVOID Context,
+    IN ULONG Percent)
+{
+    PNTFSLIB_FORMAT_CONTEXT FormatContext = Context;
+
+    if (Percent > FormatContext->Percent)
+    {
+        FormatContext->Percent = Percent;
+        if (FormatContext->Callback != NULL)
+        {
+            FormatContext->Callback(PROGRESS, 0, &FormatContext->Percent);
+        }
+    }
+}
+
 BOOLEAN
 NTAPI
 NtfsFormat(
@@ -24,8 +96,435 @@ NtfsFormat(
     IN PUNICODE_STRING Label,
     IN ULONG ClusterSize)
 {
-    UNIMPLEMENTED;
-    return TRUE;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    DISK_GEOMETRY DiskGeometry;
+    IO_STATUS_BLOCK Iosb;
+    HANDLE FileHandle;
+    PARTITION_INFORMATION_EX PartitionInfo;
+    NTFSLIB_FORMAT_CONTEXT Context;
+    NTFS_FORMAT_PARAMETERS Parameters;
+    LARGE_INTEGER SystemTime;
+    NTSTATUS Status, LockStatus;
+
+    DPRINT("NtfsFormat(DriveRoot '%wZ')\n", DriveRoot);
+
+    UNREFERENCED_PARAMETER(BackwardCompatible);
+    UNREFERENCED_PARAMETER(MediaType);
+
+    InitializeObjectAttributes(&ObjectAttributes,
+                               DriveRoot,
+                               0,
+                               NULL,
+                               NULL);
+
+    Status = NtOpenFile(&FileHandle,
+                        FILE_GENERIC_READ | FILE_GENERIC_WRITE | SYNCHRONIZE,
+                        &ObjectAttributes,
+                        &Iosb,
+                        FILE_SHARE_READ,
+                        FILE_SYNCHRONOUS_IO_ALERT);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("NtOpenFile() failed with status 0x%08x\n", Status);
+        return FALSE;
+    }
+
+    Status = NtDeviceIoControlFile(FileHandle,
+                                   NULL,
+                                   NULL,
+                                   NULL,
+                                   &Iosb,
+                                   IOCTL_DISK_GET_DRIVE_GEOMETRY,
+                                   NULL,
+                                   0,
+                                   &DiskGeometry,
+                                   sizeof(DISK_GEOMETRY));
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT("IOCTL_DISK_GET_DRIVE_GEOMETRY failed with status 0x%08x\n", Status);
+        NtClose(FileHandle);
+        return FALSE;
+    }
+
+    if (DiskGeometry.MediaType == FixedMedia)
+    {
+        Status = NtDeviceIoControlFile(FileHandle,
+                                       NULL,
+                                       NULL,
+                                       NULL,
+                                       &Iosb,
+                                       IOCTL_DISK_GET_PARTITION_INFO_EX,
+                                       NULL,
+                                       0,
+                                       &PartitionInfo,
+                                       sizeof(PARTITION_INFORMATION_EX));
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT("IOCTL_DISK_GET_PARTITION_INFO_EX failed with status 0x%08x\n", Status);
+            NtClose(FileHandle);
+            return FALSE;
+        }
+    }
+    else
+    {
+        PartitionInfo.PartitionStyle = PARTITION_STYLE_MBR;
+        PartitionInfo.StartingOffset.QuadPart = 0ULL;
+        PartitionInfo.PartitionLength.QuadPart =
+            DiskGeometry.Cylinders.QuadPart *
+            (ULONGLONG)DiskGeometry.TracksPerCylinder *
+            (ULONGLONG)DiskGeometry.SectorsPerTrack *
+            (ULONGLONG)DiskGeometry.BytesPerSector;
+        PartitionInfo.Mbr.HiddenSectors = 0;
+    }
+
+    DPRINT("StartingOffset %I64d\n", PartitionInfo.StartingOffset.QuadPart);
+    DPRINT("PartitionLength %I64d\n", PartitionInfo.PartitionLength.QuadPart);
+
+    Context.FileHandle = FileHandle;
+    Context.Callback = Callback;
+    Context.Percent = 0;
+
+    if (Callback != NULL)
+    {
+        Callback(PROGRESS, 0, (PVOID)&Context.Percent);
+    }
+
+    LockStatus = NtFsControlFile(FileHandle,
+                                 NULL,
+                                 NULL,
+                                 NULL,
+                                 &Iosb,
+                                 FSCTL_LOCK_VOLUME,
+                                 NULL,
+                                 0,
+                                 NULL,
+                                 0);
+    if (!NT_SUCCESS(LockStatus))
+    {
+        DPRINT1("WARNING: Failed to lock volume for formatting! Format may fail! (Status: 0x%x)\n", LockStatus);
+    }
+
+    NtQuerySystemTime(&SystemTime);
+
+    RtlZeroMemory(&Parameters, sizeof(Parameters));
+    Parameters.VolumeSize = PartitionInfo.PartitionLength.QuadPart;
+    Parameters.BytesPerSector = DiskGeometry.BytesPerSector;
+    Parameters.BytesPerCluster = ClusterSize;
+    Parameters.SectorsPerTrack = (USHORT)DiskGeometry.SectorsPerTrack;
+    Parameters.Heads = (USHORT)DiskGeometry.TracksPerCylinder;
+    if (PartitionInfo.PartitionStyle == PARTITION_STYLE_MBR)
+        Parameters.HiddenSectors = PartitionInfo.Mbr.HiddenSectors;
+    else
+        Parameters.HiddenSectors = (ULONG)(PartitionInfo.StartingOffset.QuadPart / DiskGeometry.BytesPerSector);
+    Parameters.QuickFormat = QuickFormat;
+    Parameters.Label = Label;
+    Parameters.Time = SystemTime.QuadPart;
+    Parameters.SerialNumber = SystemTime.QuadPart * 0x9E3779B97F4A7C15ULL;
+    Parameters.WriteRoutine = NtfsLibWrite;
+    Parameters.ProgressRoutine = NtfsLibProgress;
+    Parameters.Context = &Context;
+
+    Status = NtfsFormatVolume(&Parameters);
+
+    /* Attempt to dismount formatted volume */
+    LockStatus = NtFsControlFile(FileHandle,
+                                 NULL,
+                                 NULL,
+                                 NULL,
+                                 &Iosb,
+                                 FSCTL_DISMOUNT_VOLUME,
+                                 NULL,
+                                 0,
+                                 NULL,
+                                 0);
+    if (!NT_SUCCESS(LockStatus))
+    {
+        DPRINT1("Failed to umount volume (Status: 0x%x)\n", LockStatus);
+    }
+
+    LockStatus = NtFsControlFile(FileHandle,
+                                 NULL,
+                                 NULL,
+                                 NULL,
+                                 &Iosb,
+                                 FSCTL_UNLOCK_VOLUME,
+                                 NULL,
+                                 0,
+                                 NULL,
+                                 0);
+    if (!NT_SUCCESS(LockStatus))
+    {
+        DPRINT1("Failed to unlock volume (Status: 0x%x)\n", LockStatus);
+    }
+
+    NtClose(FileHandle);
+
+    DPRINT("NtfsFormat() done. Status 0x%08x\n", Status);
+    return NT_SUCCESS(Status);
+}
+
+static
+NTSTATUS
+NtfsLibCheckTransfer(
+    IN PNTFSLIB_CHECK_CONTEXT CheckContext,
+    IN ULONGLONG Offset,
+    IN PVOID Buffer,
+    IN ULONG Length,
+    IN BOOLEAN Write)
+{
+    IO_STATUS_BLOCK Iosb;
+    LARGE_INTEGER FileOffset;
+    HANDLE Event;
+    NTSTATUS Status;
+
+    /* The volume is opened for asynchronous I/O so that the workers don't
+     * wait on each other, every request waits on its own event */
+    Status = NtCreateEvent(&Event, EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE);
+    if (!NT_SUCCESS(Status))
+        return Status;
+
+    FileOffset.QuadPart = Offset;
+    if (Write)
+    {
+        Status = NtWriteFile(CheckContext->FileHandle,
+                             Event,
+                             NULL,
+                             NULL,
+                             &Iosb,
+                             Buffer,
+                             Length,
+                             &FileOffset,
+                             NULL);
+    }
+    else
+    {
+        Status = NtReadFile(CheckContext->FileHandle,
+                            Event,
+                            NULL,
+                            NULL,
+                            &Iosb,
+                            Buffer,
+                            Length,
+                            &FileOffset,
+                            NULL);
+    }
+
+    if (Status == STATUS_PENDING)
+    {
+        NtWaitForSingleObject(Event, FALSE, NULL);
+        Status = Iosb.Status;
+    }
+
+    NtClose(Event);
+
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Transfer of %lu bytes at offset %I64u failed (Status 0x%08x)\n", Length, Offset, Status);
+    }
+
+    return Status;
+}
+
+static
+NTSTATUS
+NtfsLibCheckRead(
+    IN PVOID Context,
+    IN ULONGLONG Offset,
+    OUT PVOID Buffer,
+    IN ULONG Length)
+{
+    PNTFSLIB_CHECK_CONTEXT CheckContext = Context;
+    ULONG SectorMask = CheckContext->BytesPerSector - 1;
+    ULONGLONG AlignedOffset;
+    ULONG AlignedLength;
+    PUCHAR Bounce;
+    NTSTATUS Status;
+
+    if ((Offset & SectorMask) == 0 && (Length & SectorMask) == 0)
+        return NtfsLibCheckTransfer(CheckContext, Offset, Buffer, Length, FALSE);
+
+    /* File records can be smaller than the sectors */
+    AlignedOffset = Offset & ~(ULONGLONG)SectorMask;
+    AlignedLength = (ULONG)(((Offset + Length + SectorMask) & ~(ULONGLONG)SectorMask) - AlignedOffset);
+    Bounce = RtlAllocateHeap(RtlGetProcessHeap(), 0, AlignedLength);
+    if (Bounce == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    Status = NtfsLibCheckTransfer(CheckContext, AlignedOffset, Bounce, AlignedLength, FALSE);
+    if (NT_SUCCESS(Status))
+        RtlCopyMemory(Buffer, Bounce + (Offset - AlignedOffset), Length);
+
+    RtlFreeHeap(RtlGetProcessHeap(), 0, Bounce);
+    return Status;
+}
+
+static
+NTSTATUS
+NtfsLibCheckWrite(
+    IN PVOID Context,
+    IN ULONGLONG Offset,
+    IN PVOID Buffer,
+    IN ULONG Length)
+{
+    PNTFSLIB_CHECK_CONTEXT CheckContext = Context;
+
+    /* Only whole sectors of $Bitmap and $MFTMirr are written */
+    if (((Offset | Length) & (CheckContext->BytesPerSector - 1)) != 0)
+    {
+        DPRINT1("Unaligned write of %lu bytes at offset %I64u\n", Length, Offset);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    return NtfsLibCheckTransfer(CheckContext, Offset, Buffer, Length, TRUE);
+}
+
+static
+ULONG
+NTAPI
+NtfsLibCheckThread(
+    IN PVOID Parameter)
+{
+    PNTFSLIB_CHECK_THREAD Thread = Parameter;
+
+    Thread->Worker(Thread->Parameter);
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+static
+NTSTATUS
+NtfsLibCheckRunWorkers(
+    IN PVOID Context,
+    IN PNTFS_CHECK_WORKER Worker,
+    IN PVOID *Parameters,
+    IN ULONG Count)
+{
+    PNTFSLIB_CHECK_THREAD Threads;
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG i, Started;
+
+    Threads = RtlAllocateHeap(RtlGetProcessHeap(), HEAP_ZERO_MEMORY, Count * sizeof(NTFSLIB_CHECK_THREAD));
+    if (Threads == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    for (Started = 0; Started < Count; Started++)
+    {
+        Threads[Started].Worker = Worker;
+        Threads[Started].Parameter = Parameters[Started];
+        Status = RtlCreateUserThread(NtCurrentProcess(),
+                                     NULL,
+                                     FALSE,
+                                     0,
+                                     0,
+                                     0,
+                                     NtfsLibCheckThread,
+                                     &Threads[Started],
+                                     &Threads[Started].Handle,
+                                     NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            DPRINT1("RtlCreateUserThread() failed with status 0x%08x\n", Status);
+            break;
+        }
+    }
+
+    /* The workers share the work out, those already running do it all */
+    if (Started != 0)
+        Status = STATUS_SUCCESS;
+
+    for (i = 0; i < Started; i++)
+    {
+        NtWaitForSingleObject(Threads[i].Handle, FALSE, NULL);
+        NtClose(Threads[i].Handle);
+    }
+
+    RtlFreeHeap(RtlGetProcessHeap(), 0, Threads);
+    return Status;
+}
+
+static
+VOID
+NtfsLibCheckMessage(
+    IN PVOID Context,
+    IN PCSTR Message)
+{
+    PNTFSLIB_CHECK_CONTEXT CheckContext = Context;
+    TEXTOUTPUT TextOut;
+
+    TextOut.Lines = 1;
+    TextOut.Output = (PCHAR)Message;
+
+    DPRINT("NtfsChkdsk -- %s", Message);
+
+    if (CheckContext->Callback != NULL)
+        CheckContext->Callback(OUTPUT, 0, &TextOut);
+}
+
+static
+VOID
+NtfsLibCheckProgress(
+    IN PVOID Context,
+    IN ULONG Percent)
+{
+    PNTFSLIB_CHECK_CONTEXT CheckContext = Context;
+
+    if (Percent > CheckContext->Percent)
+    {
+        CheckContext->Percent = Percent;
+        if (CheckContext->Callback != NULL)
+        {
+            CheckContext->Callback(PROGRESS, 0, &CheckContext->Percent);
+        }
+    }
+}
+
+/* The volume handle of the check is asynchronous */
+static
+NTSTATUS
+NtfsLibCheckControl(
+    IN HANDLE FileHandle,
+    IN BOOLEAN FsControl,
+    IN ULONG ControlCode,
+    OUT PVOID OutputBuffer,
+    IN ULONG OutputBufferLength)
+{
+    IO_STATUS_BLOCK Iosb;
+    NTSTATUS Status;
+
+    if (FsControl)
+    {
+        Status = NtFsControlFile(FileHandle,
+                                 NULL,
+                                 NULL,
+                                 NULL,
+                                 &Iosb,
+                                 ControlCode,
+                                 NULL,
+                                 0,
+                                 OutputBuffer,
+                                 OutputBufferLength);
+    }
+    else
+    {
+        Status = NtDeviceIoControlFile(FileHandle,
+                                       NULL,
+                                       NULL,
+                                       NULL,
+                                       &Iosb,
+                                       ControlCode,
+                                       NULL,
+                                       0,
+                                       OutputBuffer,
+                                       OutputBufferLength);
+    }
+
+    if (Status == STATUS_PENDING)
+    {
+        NtWaitForSingleObject(FileHandle, FALSE, NULL);
+        Status = Iosb.Status;
+    }
+
+    return Status;
 }
 
 BOOLEAN
@@ -43,7 +542,131 @@ NtfsChkdsk(
     IN PVOID pUnknown4,
     IN PULONG ExitStatus)
 {
-    UNIMPLEMENTED;
-    *ExitStatus = (ULONG)STATUS_SUCCESS;
-    return TRUE;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    DISK_GEOMETRY DiskGeometry;
+    SYSTEM_BASIC_INFORMATION BasicInformation;
+    IO_STATUS_BLOCK Iosb;
+    HANDLE FileHandle;
+    NTFSLIB_CHECK_CONTEXT Context;
+    NTFS_CHECK_PARAMETERS Parameters;
+    NTFS_CHECK_RESULTS Results;
+    NTSTATUS Status, LockStatus;
+
+    DPRINT("NtfsChkdsk(DriveRoot '%wZ')\n", DriveRoot);
+
+    UNREFERENCED_PARAMETER(pUnknown1);
+    UNREFERENCED_PARAMETER(pUnknown2);
+    UNREFERENCED_PARAMETER(pUnknown3);
+    UNREFERENCED_PARAMETER(pUnknown4);
+
+    if (ScanDrive)
+    {
+        DPRINT1("Scanning the free clusters for bad sectors isn't supported\n");
+    }
+
+    InitializeObjectAttributes(&ObjectAttributes,
+                               DriveRoot,
+                               0,
+                               NULL,
+                               NULL);
+
+    Status = NtOpenFile(&FileHandle,
+                        FILE_GENERIC_READ | (FixErrors ? FILE_GENERIC_WRITE : 0),
+                        &ObjectAttributes,
+                        &Iosb,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE,
+                        0);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("NtOpenFile() failed with status 0x%08x\n", Status);
+        *ExitStatus = (ULONG)Status;
+        return FALSE;
+    }
+
+    Context.FileHandle = FileHandle;
+    Context.Callback = Callback;
+    Context.Percent = 0;
+
+    Status = NtfsLibCheckControl(FileHandle,
+                                 FALSE,
+                                 IOCTL_DISK_GET_DRIVE_GEOMETRY,
+                                 &DiskGeometry,
+                                 sizeof(DISK_GEOMETRY));
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT("IOCTL_DISK_GET_DRIVE_GEOMETRY failed with status 0x%08x\n", Status);
+        NtClose(FileHandle);
+        *ExitStatus = (ULONG)Status;
+        return FALSE;
+    }
+
+    Context.BytesPerSector = DiskGeometry.BytesPerSector;
+
+    /* The volume is opened shared so that a busy volume can still be
+     * dismounted, but it's only checked locked: the mounted driver keeps
+     * changes in its log and memory that aren't on the disk yet, and it
+     * would write over the repairs. Locking empties the log. */
+    LockStatus = NtfsLibCheckControl(FileHandle, TRUE, FSCTL_LOCK_VOLUME, NULL, 0);
+    if (!NT_SUCCESS(LockStatus) && Callback != NULL && Callback(VOLUMEINUSE, 0, NULL))
+    {
+        /* The caller agrees to have the volume taken from its users */
+        LockStatus = NtfsLibCheckControl(FileHandle, TRUE, FSCTL_DISMOUNT_VOLUME, NULL, 0);
+        if (NT_SUCCESS(LockStatus))
+            LockStatus = NtfsLibCheckControl(FileHandle, TRUE, FSCTL_LOCK_VOLUME, NULL, 0);
+    }
+
+    if (!NT_SUCCESS(LockStatus))
+    {
+        DPRINT1("Failed to lock the volume, it won't be checked (Status: 0x%x)\n", LockStatus);
+        NtfsLibCheckMessage(&Context, "The volume is in use, it can't be checked now\n");
+        NtClose(FileHandle);
+        *ExitStatus = (ULONG)STATUS_DISK_CORRUPT_ERROR;
+        return FALSE;
+    }
+
+    Status = NtQuerySystemInformation(SystemBasicInformation,
+                                      &BasicInformation,
+                                      sizeof(BasicInformation),
+                                      NULL);
+    if (!NT_SUCCESS(Status))
+        BasicInformation.NumberOfProcessors = 1;
+
+    RtlZeroMemory(&Parameters, sizeof(Parameters));
+    Parameters.Verbose = Verbose;
+    Parameters.FixErrors = FixErrors;
+    Parameters.CheckOnlyIfDirty = CheckOnlyIfDirty;
+    Parameters.ThreadCount = min(max(BasicInformation.NumberOfProcessors, 1), NTFSLIB_CHECK_MAX_THREADS);
+    Parameters.ReadRoutine = NtfsLibCheckRead;
+    Parameters.WriteRoutine = FixErrors ? NtfsLibCheckWrite : NULL;
+    Parameters.RunWorkersRoutine = NtfsLibCheckRunWorkers;
+    Parameters.MessageRoutine = NtfsLibCheckMessage;
+    Parameters.ProgressRoutine = NtfsLibCheckProgress;
+    Parameters.Context = &Context;
+
+    Status = NtfsCheckVolume(&Parameters, &Results);
+    if (Results.LogNotEmpty)
+    {
+        /* Only the driver applies its log, nothing was checked nor repaired */
+        DPRINT1("The log of the NTFS driver isn't empty, the volume wasn't checked\n");
+    }
+
+    /* Have the volume mounted again, with the repaired metadata or to
+     * have the driver apply its log */
+    LockStatus = NtfsLibCheckControl(FileHandle, TRUE, FSCTL_DISMOUNT_VOLUME, NULL, 0);
+    if (!NT_SUCCESS(LockStatus))
+    {
+        DPRINT1("Failed to umount volume (Status: 0x%x)\n", LockStatus);
+    }
+
+    LockStatus = NtfsLibCheckControl(FileHandle, TRUE, FSCTL_UNLOCK_VOLUME, NULL, 0);
+    if (!NT_SUCCESS(LockStatus))
+    {
+        DPRINT1("Failed to unlock volume (Status: 0x%x)\n", LockStatus);
+    }
+
+    NtClose(FileHandle);
+
+    DPRINT("NtfsChkdsk() done. Status 0x%08x\n", Status);
+    *ExitStatus = (ULONG)Status;
+    return NT_SUCCESS(Status);
 }
@@ -0,0 +1,480 @@
+/*
+ * COPYRIGHT:   See COPYING in the top level directory
+ * PROJECT:     ReactOS NTFS FS library
+ * FILE:        lib/fslib/ntfslib/ntfslib.h
+ * PURPOSE:     NTFS lib internal definitions, shared with the mkntfs host tool
+ */
+
+#ifndef _NTFSLIB_H_
+#define _NTFSLIB_H_
+
+#ifdef NTFSLIB_HOST
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <typedefs.h>
+
+#define STATUS_SUCCESS                 ((NTSTATUS)0x00000000L)
+#define STATUS_UNSUCCESSFUL            ((NTSTATUS)0xC0000001L)
+#define STATUS_INVALID_PARAMETER       ((NTSTATUS)0xC000000DL)
+#define STATUS_DISK_CORRUPT_ERROR      ((NTSTATUS)0xC0000032L)
+#define STATUS_OBJECT_NAME_NOT_FOUND   ((NTSTATUS)0xC0000034L)
+#define STATUS_DISK_FULL               ((NTSTATUS)0xC000007FL)
+#define STATUS_INSUFFICIENT_RESOURCES  ((NTSTATUS)0xC000009AL)
+#define STATUS_UNRECOGNIZED_VOLUME     ((NTSTATUS)0xC000014FL)
+#define STATUS_IO_DEVICE_ERROR         ((NTSTATUS)0xC0000185L)
+#define STATUS_VOLUME_DIRTY            ((NTSTATUS)0xC0000806L)
+
+/* winioctl.h has it on the target */
+#define VOLUME_IS_DIRTY                0x00000001
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#define NtfsLibAllocate(Size) calloc(1, (Size))
+#define NtfsLibFree(Buffer) free(Buffer)
+
+#define RtlEqualMemory(Destination, Source, Length) (!memcmp((Destination), (Source), (Length)))
+
+#ifndef _WIN32
+#define _vsnprintf vsnprintf
+#endif
+
+#define InterlockedIncrement(Addend) __atomic_add_fetch((Addend), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd(Addend, Value) __atomic_fetch_add((Addend), (Value), __ATOMIC_SEQ_CST)
+#define InterlockedOr(Destination, Value) __atomic_fetch_or((Destination), (Value), __ATOMIC_SEQ_CST)
+
+/* Provided by the host tool, the target uses the NLS tables of ntdll */
+WCHAR
+NTAPI
+RtlUpcaseUnicodeChar(
+    IN WCHAR Source);
+
+#else
+
+#include <stdio.h>
+
+#define WIN32_NO_STATUS
+#define _INC_WINDOWS
+#define COM_NO_WINDOWS_H
+#include <windef.h>
+#include <winbase.h>
+#define NTOS_MODE_USER
+#include <ndk/exfuncs.h>
+#include <ndk/iofuncs.h>
+#include <ndk/kefuncs.h>
+#include <ndk/obfuncs.h>
+#include <ndk/rtlfuncs.h>
+#include <fmifs/fmifs.h>
+
+#define NtfsLibAllocate(Size) RtlAllocateHeap(RtlGetProcessHeap(), HEAP_ZERO_MEMORY, (Size))
+#define NtfsLibFree(Buffer) RtlFreeHeap(RtlGetProcessHeap(), 0, (Buffer))
+
+#endif /* NTFSLIB_HOST */
+
+/* On-disk structures, these mirror the definitions of the NTFS driver */
+
+#include <pshpack1.h>
+typedef struct _BIOS_PARAMETERS_BLOCK
+{
+    USHORT    BytesPerSector;           // 0x0B
+    UCHAR     SectorsPerCluster;        // 0x0D
+    UCHAR     Unused0[7];               // 0x0E, checked when volume is mounted
+    UCHAR     MediaId;                  // 0x15
+    UCHAR     Unused1[2];               // 0x16
+    USHORT    SectorsPerTrack;          // 0x18
+    USHORT    Heads;                    // 0x1A
+    ULONG     HiddenSectors;            // 0x1C
+    UCHAR     Unused3[4];               // 0x20, checked when volume is mounted
+} BIOS_PARAMETERS_BLOCK, *PBIOS_PARAMETERS_BLOCK;
+
+typedef struct _EXTENDED_BIOS_PARAMETERS_BLOCK
+{
+    USHORT    Unknown[2];               // 0x24, always 80 00 80 00
+    ULONGLONG SectorCount;              // 0x28
+    ULONGLONG MftLocation;              // 0x30
+    ULONGLONG MftMirrLocation;          // 0x38
+    CHAR      ClustersPerMftRecord;     // 0x40
+    UCHAR     Unused4[3];               // 0x41
+    CHAR      ClustersPerIndexRecord;   // 0x44
+    UCHAR     Unused5[3];               // 0x45
+    ULONGLONG SerialNumber;             // 0x48
+    UCHAR     Checksum[4];              // 0x50
+} EXTENDED_BIOS_PARAMETERS_BLOCK, *PEXTENDED_BIOS_PARAMETERS_BLOCK;
+
+typedef struct _BOOT_SECTOR
+{
+    UCHAR     Jump[3];                  // 0x00
+    UCHAR     OEMID[8];                 // 0x03
+    BIOS_PARAMETERS_BLOCK BPB;
+    EXTENDED_BIOS_PARAMETERS_BLOCK EBPB;
+    UCHAR     BootStrap[426];           // 0x54
+    USHORT    EndSector;                // 0x1FE
+} BOOT_SECTOR, *PBOOT_SECTOR;
+
+typedef struct
+{
+    ULONG Type;             /* Magic number 'FILE' or 'INDX' */
+    USHORT UsaOffset;       /* Offset to the update sequence */
+    USHORT UsaCount;        /* Size in words of Update Sequence Number & Array */
+    ULONGLONG Lsn;          /* $LogFile Sequence Number (LSN) */
+} NTFS_RECORD_HEADER, *PNTFS_RECORD_HEADER;
+
+typedef struct _FILE_RECORD_HEADER
+{
+    NTFS_RECORD_HEADER Ntfs;
+    USHORT SequenceNumber;
+    USHORT LinkCount;
+    USHORT AttributeOffset;
+    USHORT Flags;
+    ULONG BytesInUse;
+    ULONG BytesAllocated;
+    ULONGLONG BaseFileRecord;
+    USHORT NextAttributeNumber;
+    USHORT Padding;
+    ULONG MFTRecordNumber;
+} FILE_RECORD_HEADER, *PFILE_RECORD_HEADER;
+
+typedef struct
+{
+    ULONG Type;
+    ULONG Length;
+    UCHAR IsNonResident;
+    UCHAR NameLength;
+    USHORT NameOffset;
+    USHORT Flags;
+    USHORT Instance;
+    union
+    {
+        struct
+        {
+            ULONG ValueLength;
+            USHORT ValueOffset;
+            UCHAR Flags;
+            UCHAR Reserved;
+        } Resident;
+        struct
+        {
+            ULONGLONG LowestVCN;
+            ULONGLONG HighestVCN;
+            USHORT MappingPairsOffset;
+            USHORT CompressionUnit;
+            UCHAR Reserved[4];
+            LONGLONG AllocatedSize;
+            LONGLONG DataSize;
+            LONGLONG InitializedSize;
+        } NonResident;
+    };
+} NTFS_ATTR_RECORD, *PNTFS_ATTR_RECORD;
+
+typedef struct
+{
+    ULONGLONG CreationTime;
+    ULONGLONG ChangeTime;
+    ULONGLONG LastWriteTime;
+    ULONGLONG LastAccessTime;
+    ULONG FileAttribute;
+    ULONG MaximumVersions;
+    ULONG VersionNumber;
+    ULONG ClassId;
+    ULONG OwnerId;
+    ULONG SecurityId;
+    ULONGLONG QuotaCharged;
+    ULONGLONG Usn;
+} STANDARD_INFORMATION, *PSTANDARD_INFORMATION;
+
+typedef struct
+{
+    ULONGLONG DirectoryFileReferenceNumber;
+    ULONGLONG CreationTime;
+    ULONGLONG ChangeTime;
+    ULONGLONG LastWriteTime;
+    ULONGLONG LastAccessTime;
+    ULONGLONG AllocatedSize;
+    ULONGLONG DataSize;
+    ULONG FileAttributes;
+    ULONG ReparseTag;
+    UCHAR NameLength;
+    UCHAR NameType;
+    WCHAR Name[1];
+} FILENAME_ATTRIBUTE, *PFILENAME_ATTRIBUTE;
+
+typedef struct
+{
+    ULONG FirstEntryOffset;
+    ULONG TotalSizeOfEntries;
+    ULONG AllocatedSize;
+    UCHAR Flags;
+    UCHAR Padding[3];
+} INDEX_HEADER_ATTRIBUTE, *PINDEX_HEADER_ATTRIBUTE;
+
+typedef struct
+{
+    ULONG AttributeType;
+    ULONG CollationRule;
+    ULONG SizeOfEntry;
+    UCHAR ClustersPerIndexRecord;
+    UCHAR Padding[3];
+    INDEX_HEADER_ATTRIBUTE Header;
+} INDEX_ROOT_ATTRIBUTE, *PINDEX_ROOT_ATTRIBUTE;
+
+typedef struct
+{
+    NTFS_RECORD_HEADER Ntfs;
+    ULONGLONG VCN;
+    INDEX_HEADER_ATTRIBUTE Header;
+} INDEX_BUFFER, *PINDEX_BUFFER;
+
+/* The key, and for view indexes the data, follow the entry header */
+typedef struct
+{
+    union
+    {
+        struct
+        {
+            ULONGLONG IndexedFile;
+        } Directory;
+        struct
+        {
+            USHORT DataOffset;
+            USHORT DataLength;
+            ULONG Reserved;
+        } ViewIndex;
+    } Data;
+    USHORT Length;
+    USHORT KeyLength;
+    USHORT Flags;
+    USHORT Reserved;
+} INDEX_ENTRY_ATTRIBUTE, *PINDEX_ENTRY_ATTRIBUTE;
+
+typedef struct
+{
+    ULONG Type;
+    USHORT Length;
+    UCHAR NameLength;
+    UCHAR NameOffset;
+    ULONGLONG StartingVCN;
+    ULONGLONG MFTIndex;
+    USHORT Instance;
+} NTFS_ATTRIBUTE_LIST_ITEM, *PNTFS_ATTRIBUTE_LIST_ITEM;
+
+typedef struct
+{
+    ULONGLONG Unknown1;
+    UCHAR MajorVersion;
+    UCHAR MinorVersion;
+    USHORT Flags;
+} VOLINFO_ATTRIBUTE, *PVOLINFO_ATTRIBUTE;
+
+typedef struct
+{
+    WCHAR Name[64];
+    ULONG Type;
+    ULONG DisplayRule;
+    ULONG CollationRule;
+    ULONG Flags;
+    LONGLONG MinimumSize;
+    LONGLONG MaximumSize;
+} ATTRDEF_ENTRY, *PATTRDEF_ENTRY;
+
+/* $Secure:$SDS entry header, also the data of $SII and $SDH entries */
+typedef struct
+{
+    ULONG Hash;
+    ULONG SecurityId;
+    ULONGLONG Offset;
+    ULONG Length;
+} SECURITY_DESCRIPTOR_HEADER, *PSECURITY_DESCRIPTOR_HEADER;
+
+typedef struct
+{
+    ULONG Hash;
+    ULONG SecurityId;
+} SECURITY_HASH_KEY, *PSECURITY_HASH_KEY;
+
+typedef struct
+{
+    ULONG Version;
+    ULONG Flags;
+    ULONGLONG BytesUsed;
+    ULONGLONG ChangeTime;
+    LONGLONG Threshold;
+    LONGLONG Limit;
+    ULONGLONG ExceededTime;
+} QUOTA_CONTROL_ENTRY, *PQUOTA_CONTROL_ENTRY;
+#include <poppack.h>
+
+#define AttributeStandardInformation  0x10
+#define AttributeAttributeList        0x20
+#define AttributeFileName             0x30
+#define AttributeObjectId             0x40
+#define AttributeSecurityDescriptor   0x50
+#define AttributeVolumeName           0x60
+#define AttributeVolumeInformation    0x70
+#define AttributeData                 0x80
+#define AttributeIndexRoot            0x90
+#define AttributeIndexAllocation      0xA0
+#define AttributeBitmap               0xB0
+#define AttributeReparsePoint         0xC0
+#define AttributeEAInformation        0xD0
+#define AttributeEA                   0xE0
+#define AttributeLoggedUtilityStream  0x100
+#define AttributeEnd                  0xFFFFFFFF
+
+#define NRH_FILE_TYPE  0x454C4946  /* 'FILE' */
+#define NRH_INDX_TYPE  0x58444E49  /* 'INDX' */
+
+#define NTFS_FILE_MFT                0
+#define NTFS_FILE_MFTMIRR            1
+#define NTFS_FILE_LOGFILE            2
+#define NTFS_FILE_VOLUME             3
+#define NTFS_FILE_ATTRDEF            4
+#define NTFS_FILE_ROOT               5
+#define NTFS_FILE_BITMAP             6
+#define NTFS_FILE_BOOT               7
+#define NTFS_FILE_BADCLUS            8
+#define NTFS_FILE_SECURE             9
+#define NTFS_FILE_UPCASE             10
+#define NTFS_FILE_EXTEND             11
+#define NTFS_FILE_FIRST_USER_FILE    16
+
+#define NTFS_MFT_MASK 0x0000FFFFFFFFFFFFULL
+
+/* Update sequence arrays always protect 512 byte blocks */
+#define NTFS_BLOCK_SIZE 512
+
+#define FRH_IN_USE      0x0001
+#define FRH_DIRECTORY   0x0002
+#define FRH_VIEW_INDEX  0x0008
+
+#define RA_INDEXED      0x01
+
+#define ATTR_FLAG_COMPRESSED    0x0001
+#define ATTR_FLAG_SPARSE        0x8000
+
+#define COLLATION_BINARY              0x00
+#define COLLATION_FILE_NAME           0x01
+#define COLLATION_NTOFS_ULONG         0x10
+#define COLLATION_NTOFS_SID           0x11
+#define COLLATION_NTOFS_SECURITY_HASH 0x12
+#define COLLATION_NTOFS_ULONGS        0x13
+
+#define INDEX_ROOT_SMALL 0x0
+#define INDEX_ROOT_LARGE 0x1
+
+#define INDEX_NODE_SMALL 0x0
+#define INDEX_NODE_LARGE 0x1
+
+#define NTFS_INDEX_ENTRY_NODE  1
+#define NTFS_INDEX_ENTRY_END   2
+
+#define NTFS_FILE_NAME_WIN32_AND_DOS 3
+
+#define NTFS_FILE_TYPE_HIDDEN      0x2
+#define NTFS_FILE_TYPE_SYSTEM      0x4
+#define NTFS_FILE_TYPE_ARCHIVE     0x20
+#define NTFS_FILE_TYPE_DIRECTORY   0x10000000
+#define NTFS_FILE_TYPE_VIEW_INDEX  0x20000000
+
+/* Format engine, format.c */
+
+typedef NTSTATUS
+(*PNTFS_FORMAT_WRITE)(
+    IN PVOID Context,
+    IN ULONGLONG Offset,
+    IN PVOID Buffer,
+    IN ULONG Length);
+
+typedef VOID
+(*PNTFS_FORMAT_PROGRESS)(
+    IN PVOID Context,
+    IN ULONG Percent);
+
+typedef struct _NTFS_FORMAT_PARAMETERS
+{
+    ULONGLONG VolumeSize;           /* Bytes, including the backup boot sector */
+    ULONG BytesPerSector;
+    ULONG BytesPerCluster;          /* 0 selects the default for the volume size */
+    USHORT SectorsPerTrack;
+    USHORT Heads;
+    ULONG HiddenSectors;
+    BOOLEAN QuickFormat;            /* Don't zero the data clusters */
+    PUNICODE_STRING Label;          /* Optional */
+    ULONGLONG SerialNumber;
+    ULONGLONG Time;                 /* Timestamp of the system files, NT time */
+    PNTFS_FORMAT_WRITE WriteRoutine;
+    PNTFS_FORMAT_PROGRESS ProgressRoutine;  /* Optional */
+    PVOID Context;
+} NTFS_FORMAT_PARAMETERS, *PNTFS_FORMAT_PARAMETERS;
+
+NTSTATUS
+NtfsFormatVolume(
+    IN PNTFS_FORMAT_PARAMETERS Parameters);
+
+/* Consistency check, check.c */
+
+/* Called from the worker threads at the same time, the routine must be thread-safe */
+typedef NTSTATUS
+(*PNTFS_CHECK_READ)(
+    IN PVOID Context,
+    IN ULONGLONG Offset,
+    OUT PVOID Buffer,
+    IN ULONG Length);
+
+typedef VOID
+(*PNTFS_CHECK_WORKER)(
+    IN PVOID Parameter);
+
+/* Runs Worker once for each parameter, in parallel, and returns when all are done */
+typedef NTSTATUS
+(*PNTFS_CHECK_RUN_WORKERS)(
+    IN PVOID Context,
+    IN PNTFS_CHECK_WORKER Worker,
+    IN PVOID *Parameters,
+    IN ULONG Count);
+
+typedef VOID
+(*PNTFS_CHECK_MESSAGE)(
+    IN PVOID Context,
+    IN PCSTR Message);
+
+typedef struct _NTFS_CHECK_PARAMETERS
+{
+    BOOLEAN Verbose;
+    BOOLEAN FixErrors;              /* Rewrites $Bitmap and $MFTMirr, requires WriteRoutine */
+    BOOLEAN CheckOnlyIfDirty;
+    ULONG ThreadCount;
+    PNTFS_CHECK_READ ReadRoutine;
+    PNTFS_FORMAT_WRITE WriteRoutine;            /* Optional */
+    PNTFS_CHECK_RUN_WORKERS RunWorkersRoutine;  /* Optional, the scan is single-threaded without it */
+    PNTFS_CHECK_MESSAGE MessageRoutine;
+    PNTFS_FORMAT_PROGRESS ProgressRoutine;      /* Optional */
+    PVOID Context;
+} NTFS_CHECK_PARAMETERS, *PNTFS_CHECK_PARAMETERS;
+
+typedef struct _NTFS_CHECK_RESULTS
+{
+    ULONGLONG FileRecords;
+    ULONGLONG Directories;
+    ULONGLONG IndexEntries;
+    ULONGLONG ClusterCount;
+    ULONGLONG ClustersInUse;
+    ULONG BytesPerCluster;
+    ULONG Errors;
+    ULONG FixedErrors;
+    BOOLEAN Skipped;                /* Clean volume and CheckOnlyIfDirty */
+    BOOLEAN LogNotEmpty;            /* The journal of the driver must be applied first, nothing was checked */
+} NTFS_CHECK_RESULTS, *PNTFS_CHECK_RESULTS;
+
+NTSTATUS
+NtfsCheckVolume(
+    IN PNTFS_CHECK_PARAMETERS Parameters,
+    OUT PNTFS_CHECK_RESULTS Results);
+
+#endif /* _NTFSLIB_H_ */
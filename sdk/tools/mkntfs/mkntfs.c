@@ -0,0 +1,234 @@
+/*
+ * PROJECT:     ReactOS NTFS Image Creator
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Formats an image file as NTFS with the format code of ntfslib
+ * COPYRIGHT:   Copyright 2026 ReactOS Team
+ */
+
+#include <time.h>
+#include "ntfslib.h"
+
+/* Seconds between 1601 and 1970 */
+#define UNIX_EPOCH_AS_NT 11644473600ULL
+
+typedef struct
+{
+    FILE *Image;
+    ULONG Percent;
+} MKNTFS_CONTEXT, *PMKNTFS_CONTEXT;
+
+/* Upcase rules of the scripts with simple case pairs. Images made on the
+ * host only differ from a format done by ReactOS for the rarer scripts */
+WCHAR
+NTAPI
+RtlUpcaseUnicodeChar(IN WCHAR Source)
+{
+    /* ASCII and Latin-1 supplement */
+    if (Source >= 'a' && Source <= 'z')
+        return Source - ('a' - 'A');
+    if (Source >= 0xE0 && Source <= 0xFE && Source != 0xF7)
+        return Source - 0x20;
+    if (Source == 0xFF)
+        return 0x178;
+
+    /* Latin extended-A, pairs starting on even and odd code points */
+    if ((Source >= 0x100 && Source <= 0x137) || (Source >= 0x14A && Source <= 0x177))
+        return Source & ~1;
+    if ((Source >= 0x139 && Source <= 0x148) || (Source >= 0x179 && Source <= 0x17E))
+        return (Source & 1) ? Source : Source - 1;
+
+    /* Greek */
+    if (Source >= 0x3B1 && Source <= 0x3CB && Source != 0x3C2)
+        return Source - 0x20;
+    if (Source == 0x3C2)
+        return 0x3A3;
+
+    /* Cyrillic */
+    if (Source >= 0x430 && Source <= 0x44F)
+        return Source - 0x20;
+    if (Source >= 0x450 && Source <= 0x45F)
+        return Source - 0x50;
+    if ((Source >= 0x460 && Source <= 0x481) || (Source >= 0x48A && Source <= 0x4BF))
+        return Source & ~1;
+
+    /* Armenian */
+    if (Source >= 0x561 && Source <= 0x586)
+        return Source - 0x30;
+
+    /* Fullwidth Latin */
+    if (Source >= 0xFF41 && Source <= 0xFF5A)
+        return Source - 0x20;
+
+    return Source;
+}
+
+static
+NTSTATUS
+MkntfsWrite(IN PVOID Context,
+            IN ULONGLONG Offset,
+            IN PVOID Buffer,
+            IN ULONG Length)
+{
+    PMKNTFS_CONTEXT Mkntfs = Context;
+
+    if (fseeko(Mkntfs->Image, Offset, SEEK_SET) != 0 ||
+        fwrite(Buffer, 1, Length, Mkntfs->Image) != Length)
+    {
+        return STATUS_IO_DEVICE_ERROR;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static
+VOID
+MkntfsProgress(IN PVOID Context,
+               IN ULONG Percent)
+{
+    PMKNTFS_CONTEXT Mkntfs = Context;
+
+    /* Every 10% is enough for an image */
+    if (Percent / 10 != Mkntfs->Percent / 10)
+    {
+        printf("%lu%%\n", (unsigned long)Percent);
+        fflush(stdout);
+    }
+
+    Mkntfs->Percent = Percent;
+}
+
+static
+ULONGLONG
+MkntfsParseSize(const char *String)
+{
+    char *End;
+    ULONGLONG Size = strtoull(String, &End, 0);
+
+    switch (*End)
+    {
+        case 'T': case 't': Size <<= 10; /* Fall through */
+        case 'G': case 'g': Size <<= 10; /* Fall through */
+        case 'M': case 'm': Size <<= 10; /* Fall through */
+        case 'K': case 'k': Size <<= 10; break;
+        case 0: break;
+        default: return 0;
+    }
+
+    return Size;
+}
+
+static
+void
+MkntfsUsage(void)
+{
+    printf("Usage: mkntfs [-q] [-c cluster size] [-L label] [-s size] image\n"
+           "  -q  quick format, the data clusters aren't zeroed\n"
+           "  -c  cluster size in bytes, 512 to 64K\n"
+           "  -L  volume label\n"
+           "  -s  size of the image, with an optional K, M, G or T suffix;\n"
+           "      the image is created or resized. Default: the current size\n");
+}
+
+int main(int argc, char **argv)
+{
+    NTFS_FORMAT_PARAMETERS Parameters;
+    MKNTFS_CONTEXT Context;
+    UNICODE_STRING Label;
+    WCHAR LabelBuffer[32];
+    const char *ImageName = NULL, *LabelString = NULL;
+    ULONGLONG Size = 0;
+    NTSTATUS Status;
+    time_t Now;
+    int i;
+
+    memset(&Parameters, 0, sizeof(Parameters));
+    memset(&Context, 0, sizeof(Context));
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-q") == 0)
+            Parameters.QuickFormat = TRUE;
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            Parameters.BytesPerCluster = (ULONG)MkntfsParseSize(argv[++i]);
+        else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc)
+            LabelString = argv[++i];
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        {
+            Size = MkntfsParseSize(argv[++i]);
+            if (Size == 0)
+            {
+                MkntfsUsage();
+                return 1;
+            }
+        }
+        else if (argv[i][0] != '-' && ImageName == NULL)
+            ImageName = argv[i];
+        else
+        {
+            MkntfsUsage();
+            return 1;
+        }
+    }
+
+    if (ImageName == NULL)
+    {
+        MkntfsUsage();
+        return 1;
+    }
+
+    Context.Image = fopen(ImageName, Size != 0 ? "w+b" : "r+b");
+    if (Context.Image == NULL)
+    {
+        printf("Cannot open %s\n", ImageName);
+        return 1;
+    }
+
+    if (Size != 0)
+    {
+        /* Sets the size without writing the data clusters */
+        if (fseeko(Context.Image, Size - 1, SEEK_SET) != 0 || fputc(0, Context.Image) == EOF)
+        {
+            printf("Cannot resize %s\n", ImageName);
+            fclose(Context.Image);
+            return 1;
+        }
+    }
+    else
+    {
+        fseeko(Context.Image, 0, SEEK_END);
+        Size = ftello(Context.Image);
+    }
+
+    if (LabelString != NULL)
+    {
+        for (i = 0; LabelString[i] != 0 && i < 32; i++)
+            LabelBuffer[i] = (UCHAR)LabelString[i];
+
+        Label.Buffer = LabelBuffer;
+        Label.Length = Label.MaximumLength = (USHORT)(i * sizeof(WCHAR));
+        Parameters.Label = &Label;
+    }
+
+    time(&Now);
+    Parameters.VolumeSize = Size;
+    Parameters.BytesPerSector = 512;
+    Parameters.SectorsPerTrack = 63;
+    Parameters.Heads = 255;
+    Parameters.Time = ((ULONGLONG)Now + UNIX_EPOCH_AS_NT) * 10000000ULL;
+    Parameters.SerialNumber = Parameters.Time * 0x9E3779B97F4A7C15ULL;
+    Parameters.WriteRoutine = MkntfsWrite;
+    Parameters.ProgressRoutine = MkntfsProgress;
+    Parameters.Context = &Context;
+
+    Status = NtfsFormatVolume(&Parameters);
+    if (fclose(Context.Image) != 0 && NT_SUCCESS(Status))
+        Status = STATUS_IO_DEVICE_ERROR;
+
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Formatting %s failed, status 0x%08lx\n", ImageName, (unsigned long)Status);
+        return 1;
+    }
+
+    return 0;
+}
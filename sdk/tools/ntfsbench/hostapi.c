@@ -0,0 +1,1069 @@
+/*
+ * PROJECT:     ReactOS NTFS host library
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Executive, run time library and FsRtl routines used by the NTFS driver
+ * COPYRIGHT:   Copyright 2026 ReactOS Team
+ */
+
+#include <stdarg.h>
+#include <time.h>
+
+/* gcc defaults to cdecl */
+#if defined(__GNUC__)
+#undef __cdecl
+#define __cdecl
+#endif
+
+#include "ntfshost.h"
+#include <bitmap.c>
+#include <compress.c>
+
+BOOLEAN NtfsHostVerbose = FALSE;
+
+/* DEBUG OUTPUT **************************************************************/
+
+static
+VOID
+NtfsHostPrintWide(PCWSTR String,
+                  LONG Count)
+{
+    LONG i;
+
+    if (String == NULL)
+    {
+        fputs("(null)", stderr);
+        return;
+    }
+
+    for (i = 0; (Count < 0 || i < Count) && String[i] != 0; i++)
+    {
+        fputc(String[i] < 0x80 ? (char)String[i] : '?', stderr);
+    }
+}
+
+/*
+ * Minimal DbgPrint: understands the Microsoft size prefixes (I64, I, l, w)
+ * and the %S/%wZ string conversions the driver uses.
+ */
+ULONG
+NtfsHostDbgPrint(PCSTR Format, ...)
+{
+    va_list Args;
+    PCSTR p;
+    CHAR Spec[32];
+
+    if (!NtfsHostVerbose)
+        return 0;
+
+    va_start(Args, Format);
+    for (p = Format; *p != 0; p++)
+    {
+        ULONG SpecLength = 0;
+        BOOLEAN Wide = FALSE, Is64 = FALSE, IsPtr = FALSE;
+        LONG Precision = -1;
+
+        if (*p != '%')
+        {
+            fputc(*p, stderr);
+            continue;
+        }
+
+        Spec[SpecLength++] = *p++;
+        while (*p && strchr("-+ #0", *p))
+            Spec[SpecLength++] = *p++;
+        if (*p == '*')
+        {
+            SpecLength += snprintf(Spec + SpecLength, sizeof(Spec) - SpecLength, "%d", va_arg(Args, int));
+            p++;
+        }
+        while (*p >= '0' && *p <= '9')
+            Spec[SpecLength++] = *p++;
+        if (*p == '.')
+        {
+            Spec[SpecLength++] = *p++;
+            if (*p == '*')
+            {
+                Precision = va_arg(Args, int);
+                SpecLength += snprintf(Spec + SpecLength, sizeof(Spec) - SpecLength, "%d", (int)Precision);
+                p++;
+            }
+            else
+            {
+                Precision = atoi(p);
+                while (*p >= '0' && *p <= '9')
+                    Spec[SpecLength++] = *p++;
+            }
+        }
+
+        for (;; p++)
+        {
+            if (p[0] == 'I' && p[1] == '6' && p[2] == '4') { Is64 = TRUE; p += 2; }
+            else if (p[0] == 'I') { IsPtr = TRUE; }
+            else if (p[0] == 'l' && p[1] == 'l') { Is64 = TRUE; p++; }
+            else if (p[0] == 'l' || p[0] == 'w') { Wide = TRUE; }
+            else if (p[0] == 'h' || p[0] == 'z') { }
+            else break;
+        }
+
+        switch (*p)
+        {
+            case 'd':
+            case 'i':
+                if (Is64 || IsPtr)
+                {
+                    strcpy(Spec + SpecLength, "lld");
+                    fprintf(stderr, Spec, Is64 ? va_arg(Args, long long) : (long long)va_arg(Args, LONG_PTR));
+                }
+                else
+                {
+                    strcpy(Spec + SpecLength, "d");
+                    fprintf(stderr, Spec, va_arg(Args, int));
+                }
+                break;
+
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                if (Is64 || IsPtr)
+                {
+                    Spec[SpecLength++] = 'l';
+                    Spec[SpecLength++] = 'l';
+                    Spec[SpecLength++] = *p;
+                    Spec[SpecLength] = 0;
+                    fprintf(stderr, Spec, Is64 ? va_arg(Args, unsigned long long) : (unsigned long long)va_arg(Args, ULONG_PTR));
+                }
+                else
+                {
+                    Spec[SpecLength++] = *p;
+                    Spec[SpecLength] = 0;
+                    fprintf(stderr, Spec, va_arg(Args, unsigned int));
+                }
+                break;
+
+            case 'c':
+            case 'C':
+                fputc(va_arg(Args, int), stderr);
+                break;
+
+            case 'p':
+                fprintf(stderr, "%p", va_arg(Args, void *));
+                break;
+
+            case 's':
+                if (Wide)
+                    NtfsHostPrintWide(va_arg(Args, PCWSTR), Precision);
+                else
+                {
+                    strcpy(Spec + SpecLength, "s");
+                    fprintf(stderr, Spec, va_arg(Args, char *));
+                }
+                break;
+
+            case 'S':
+                NtfsHostPrintWide(va_arg(Args, PCWSTR), Precision);
+                break;
+
+            case 'Z':
+                if (Wide)
+                {
+                    PUNICODE_STRING String = va_arg(Args, PUNICODE_STRING);
+                    if (String)
+                        NtfsHostPrintWide(String->Buffer, String->Length / sizeof(WCHAR));
+                }
+                else
+                {
+                    PANSI_STRING String = va_arg(Args, PANSI_STRING);
+                    if (String)
+                        fprintf(stderr, "%.*s", String->Length, String->Buffer);
+                }
+                break;
+
+            case '%':
+                fputc('%', stderr);
+                break;
+
+            default:
+                if (*p == 0)
+                    p--;
+                break;
+        }
+    }
+    va_end(Args);
+
+    return 0;
+}
+
+/* EXECUTIVE *****************************************************************/
+
+PVOID
+NTAPI
+ExAllocatePoolWithTag(POOL_TYPE PoolType,
+                      SIZE_T NumberOfBytes,
+                      ULONG Tag)
+{
+    UNREFERENCED_PARAMETER(PoolType);
+    UNREFERENCED_PARAMETER(Tag);
+
+    return malloc(NumberOfBytes ? NumberOfBytes : 1);
+}
+
+VOID
+NTAPI
+ExFreePoolWithTag(PVOID P,
+                  ULONG Tag)
+{
+    UNREFERENCED_PARAMETER(Tag);
+
+    free(P);
+}
+
+VOID
+NTAPI
+ExInitializeNPagedLookasideList(PNPAGED_LOOKASIDE_LIST Lookaside,
+                                PVOID Allocate,
+                                PVOID Free,
+                                ULONG Flags,
+                                SIZE_T Size,
+                                ULONG Tag,
+                                USHORT Depth)
+{
+    UNREFERENCED_PARAMETER(Allocate);
+    UNREFERENCED_PARAMETER(Free);
+    UNREFERENCED_PARAMETER(Flags);
+    UNREFERENCED_PARAMETER(Depth);
+
+    Lookaside->Size = Size;
+    Lookaside->Tag = Tag;
+    Lookaside->TotalAllocates = 0;
+    Lookaside->TotalFrees = 0;
+}
+
+VOID
+NTAPI
+ExDeleteNPagedLookasideList(PNPAGED_LOOKASIDE_LIST Lookaside)
+{
+    if (Lookaside->TotalAllocates != Lookaside->TotalFrees)
+    {
+        DPRINT1("Lookaside list %.4s leaked %lu entries\n",
+                (PCSTR)&Lookaside->Tag,
+                Lookaside->TotalAllocates - Lookaside->TotalFrees);
+    }
+}
+
+PVOID
+NTAPI
+ExAllocateFromNPagedLookasideList(PNPAGED_LOOKASIDE_LIST Lookaside)
+{
+    Lookaside->TotalAllocates++;
+    return malloc(Lookaside->Size);
+}
+
+VOID
+NTAPI
+ExFreeToNPagedLookasideList(PNPAGED_LOOKASIDE_LIST Lookaside,
+                            PVOID Entry)
+{
+    Lookaside->TotalFrees++;
+    free(Entry);
+}
+
+NTSTATUS
+NTAPI
+ExInitializeResourceLite(PERESOURCE Resource)
+{
+    Resource->ActiveCount = 0;
+    Resource->Exclusive = FALSE;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NTAPI
+ExDeleteResourceLite(PERESOURCE Resource)
+{
+    ASSERT(Resource->ActiveCount == 0);
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN
+NTAPI
+ExAcquireResourceExclusiveLite(PERESOURCE Resource,
+                               BOOLEAN Wait)
+{
+    UNREFERENCED_PARAMETER(Wait);
+
+    Resource->ActiveCount++;
+    Resource->Exclusive = TRUE;
+    return TRUE;
+}
+
+BOOLEAN
+NTAPI
+ExAcquireResourceSharedLite(PERESOURCE Resource,
+                            BOOLEAN Wait)
+{
+    UNREFERENCED_PARAMETER(Wait);
+
+    Resource->ActiveCount++;
+    return TRUE;
+}
+
+VOID
+NTAPI
+ExReleaseResourceLite(PERESOURCE Resource)
+{
+    ASSERT(Resource->ActiveCount > 0);
+    if (--Resource->ActiveCount == 0)
+        Resource->Exclusive = FALSE;
+}
+
+BOOLEAN
+NTAPI
+ExAcquireSharedStarveExclusive(PERESOURCE Resource,
+                               BOOLEAN Wait)
+{
+    return ExAcquireResourceSharedLite(Resource, Wait);
+}
+
+BOOLEAN
+NTAPI
+ExIsResourceAcquiredExclusiveLite(PERESOURCE Resource)
+{
+    return Resource->Exclusive;
+}
+
+ULONG
+NTAPI
+ExIsResourceAcquiredSharedLite(PERESOURCE Resource)
+{
+    return Resource->ActiveCount;
+}
+
+/* There are no worker threads, the item runs right away */
+VOID
+NTAPI
+ExQueueWorkItem(PWORK_QUEUE_ITEM WorkItem,
+                WORK_QUEUE_TYPE QueueType)
+{
+    UNREFERENCED_PARAMETER(QueueType);
+
+    ((PWORKER_THREAD_ROUTINE)WorkItem->WorkerRoutine)(WorkItem->Parameter);
+}
+
+VOID
+NTAPI
+ExRaiseStatus(NTSTATUS Status)
+{
+    fprintf(stderr, "ExRaiseStatus(0x%08x) in host library\n", (unsigned int)Status);
+    abort();
+}
+
+/* KERNEL, MM AND CC *********************************************************/
+
+VOID
+NTAPI
+KeQuerySystemTime(PLARGE_INTEGER CurrentTime)
+{
+    /* 100ns intervals between 1601-01-01 and 1970-01-01 */
+    CurrentTime->QuadPart = (LONGLONG)time(NULL) * 10000000LL + 116444736000000000LL;
+}
+
+VOID
+NTAPI
+KeInitializeDpc(PKDPC Dpc,
+                PKDEFERRED_ROUTINE DeferredRoutine,
+                PVOID DeferredContext)
+{
+    Dpc->DeferredRoutine = DeferredRoutine;
+    Dpc->DeferredContext = DeferredContext;
+}
+
+VOID
+NTAPI
+KeInitializeTimer(PKTIMER Timer)
+{
+    Timer->DueTime.QuadPart = 0;
+    Timer->Dpc = NULL;
+}
+
+/* Nothing runs in the background: the timer is recorded, and never expires */
+BOOLEAN
+NTAPI
+KeSetTimer(PKTIMER Timer,
+           LARGE_INTEGER DueTime,
+           PKDPC Dpc)
+{
+    BOOLEAN WasSet = (Timer->Dpc != NULL);
+
+    Timer->DueTime = DueTime;
+    Timer->Dpc = Dpc;
+    return WasSet;
+}
+
+BOOLEAN
+NTAPI
+KeCancelTimer(PKTIMER Timer)
+{
+    BOOLEAN WasSet = (Timer->Dpc != NULL);
+
+    Timer->Dpc = NULL;
+    return WasSet;
+}
+
+BOOLEAN
+NTAPI
+MmCanFileBeTruncated(PSECTION_OBJECT_POINTERS SectionPointer,
+                     PLARGE_INTEGER NewFileSize)
+{
+    UNREFERENCED_PARAMETER(SectionPointer);
+    UNREFERENCED_PARAMETER(NewFileSize);
+
+    return TRUE;
+}
+
+VOID
+NTAPI
+CcSetFileSizes(PFILE_OBJECT FileObject,
+               PCC_FILE_SIZES FileSizes)
+{
+    UNREFERENCED_PARAMETER(FileObject);
+    UNREFERENCED_PARAMETER(FileSizes);
+}
+
+/* RUN TIME LIBRARY **********************************************************/
+
+unsigned char BitScanForward(ULONG *Index, ULONG Mask)
+{
+    if (Mask == 0)
+        return 0;
+
+    *Index = 0;
+    while ((Mask & 1) == 0)
+    {
+        Mask >>= 1;
+        ++(*Index);
+    }
+    return 1;
+}
+
+unsigned char BitScanReverse(ULONG *Index, ULONG Mask)
+{
+    if (Mask == 0)
+        return 0;
+
+    *Index = 31;
+    while ((Mask & 0x80000000) == 0)
+    {
+        Mask <<= 1;
+        --(*Index);
+    }
+    return 1;
+}
+
+VOID
+NTAPI
+RtlInitUnicodeString(PUNICODE_STRING DestinationString,
+                     PCWSTR SourceString)
+{
+    SIZE_T Length = 0;
+
+    if (SourceString)
+    {
+        while (SourceString[Length])
+            Length++;
+    }
+
+    DestinationString->Length = (USHORT)(Length * sizeof(WCHAR));
+    DestinationString->MaximumLength = SourceString ? DestinationString->Length + sizeof(WCHAR) : 0;
+    DestinationString->Buffer = (PWSTR)SourceString;
+}
+
+WCHAR
+NTAPI
+RtlUpcaseUnicodeChar(WCHAR Source)
+{
+    if (Source >= 'a' && Source <= 'z')
+        return Source - ('a' - 'A');
+
+    /* Latin-1 supplement */
+    if (Source >= 0xE0 && Source <= 0xFE && Source != 0xF7)
+        return Source - 0x20;
+    if (Source == 0xFF)
+        return 0x178;
+
+    return Source;
+}
+
+LONG
+NTAPI
+RtlCompareUnicodeString(PCUNICODE_STRING String1,
+                        PCUNICODE_STRING String2,
+                        BOOLEAN CaseInSensitive)
+{
+    USHORT Length1 = String1->Length / sizeof(WCHAR);
+    USHORT Length2 = String2->Length / sizeof(WCHAR);
+    USHORT i;
+
+    for (i = 0; i < Length1 && i < Length2; i++)
+    {
+        WCHAR c1 = String1->Buffer[i];
+        WCHAR c2 = String2->Buffer[i];
+
+        if (CaseInSensitive)
+        {
+            c1 = RtlUpcaseUnicodeChar(c1);
+            c2 = RtlUpcaseUnicodeChar(c2);
+        }
+
+        if (c1 != c2)
+            return (LONG)c1 - (LONG)c2;
+    }
+
+    return (LONG)Length1 - (LONG)Length2;
+}
+
+BOOLEAN
+NTAPI
+RtlEqualUnicodeString(PCUNICODE_STRING String1,
+                      PCUNICODE_STRING String2,
+                      BOOLEAN CaseInSensitive)
+{
+    if (String1->Length != String2->Length)
+        return FALSE;
+
+    return RtlCompareUnicodeString(String1, String2, CaseInSensitive) == 0;
+}
+
+NTSTATUS
+NTAPI
+RtlUpcaseUnicodeString(PUNICODE_STRING DestinationString,
+                       PCUNICODE_STRING SourceString,
+                       BOOLEAN AllocateDestinationString)
+{
+    USHORT i;
+
+    if (AllocateDestinationString)
+    {
+        DestinationString->MaximumLength = SourceString->Length;
+        DestinationString->Buffer = malloc(SourceString->Length ? SourceString->Length : 1);
+        if (DestinationString->Buffer == NULL)
+            return STATUS_NO_MEMORY;
+    }
+    else if (SourceString->Length > DestinationString->MaximumLength)
+    {
+        return STATUS_BUFFER_OVERFLOW;
+    }
+
+    for (i = 0; i < SourceString->Length / sizeof(WCHAR); i++)
+        DestinationString->Buffer[i] = RtlUpcaseUnicodeChar(SourceString->Buffer[i]);
+
+    DestinationString->Length = SourceString->Length;
+    return STATUS_SUCCESS;
+}
+
+VOID
+NTAPI
+RtlFreeUnicodeString(PUNICODE_STRING UnicodeString)
+{
+    free(UnicodeString->Buffer);
+    UnicodeString->Buffer = NULL;
+    UnicodeString->Length = UnicodeString->MaximumLength = 0;
+}
+
+SIZE_T
+NTAPI
+RtlCompareMemory(const VOID *Source1,
+                 const VOID *Source2,
+                 SIZE_T Length)
+{
+    const UCHAR *s1 = Source1, *s2 = Source2;
+    SIZE_T i;
+
+    for (i = 0; i < Length && s1[i] == s2[i]; i++);
+
+    return i;
+}
+
+BOOLEAN
+NTAPI
+RtlIsNameLegalDOS8Dot3(PCUNICODE_STRING Name,
+                       PANSI_STRING OemName,
+                       PBOOLEAN NameContainsSpaces)
+{
+    USHORT i, Length = Name->Length / sizeof(WCHAR);
+    LONG Dot = -1;
+
+    UNREFERENCED_PARAMETER(OemName);
+
+    if (NameContainsSpaces)
+        *NameContainsSpaces = FALSE;
+
+    if (Length == 0 || Length > 12)
+        return FALSE;
+
+    for (i = 0; i < Length; i++)
+    {
+        WCHAR c = Name->Buffer[i];
+
+        if (c == '.')
+        {
+            if (Dot != -1 || i == 0)
+                return FALSE;
+            Dot = i;
+        }
+        else if (c >= 0x80 || strchr("\"*+,/:;<=>?[\\]| ", (char)c) || (c >= 'a' && c <= 'z'))
+        {
+            return FALSE;
+        }
+    }
+
+    if (Dot == -1)
+        return Length <= 8;
+
+    return Dot <= 8 && (Length - Dot - 1) <= 3;
+}
+
+/* MAP CONTROL BLOCKS ********************************************************/
+
+static
+BOOLEAN
+NtfsHostMcbInsert(PLARGE_MCB Mcb,
+                  ULONG Index,
+                  LONGLONG StartVbn,
+                  LONGLONG EndVbn,
+                  LONGLONG Lbn)
+{
+    if (Mcb->PairCount == Mcb->MaximumPairCount)
+    {
+        ULONG NewCount = Mcb->MaximumPairCount ? Mcb->MaximumPairCount * 2 : 8;
+        PNTFS_HOST_MCB_RUN NewMapping = realloc(Mcb->Mapping, NewCount * sizeof(NTFS_HOST_MCB_RUN));
+
+        if (NewMapping == NULL)
+            return FALSE;
+
+        Mcb->Mapping = NewMapping;
+        Mcb->MaximumPairCount = NewCount;
+    }
+
+    memmove(&Mcb->Mapping[Index + 1], &Mcb->Mapping[Index], (Mcb->PairCount - Index) * sizeof(NTFS_HOST_MCB_RUN));
+    Mcb->Mapping[Index].RunStartVbn = StartVbn;
+    Mcb->Mapping[Index].RunEndVbn = EndVbn;
+    Mcb->Mapping[Index].StartingLbn = Lbn;
+    Mcb->PairCount++;
+
+    return TRUE;
+}
+
+static
+VOID
+NtfsHostMcbDelete(PLARGE_MCB Mcb,
+                  ULONG Index)
+{
+    memmove(&Mcb->Mapping[Index], &Mcb->Mapping[Index + 1], (Mcb->PairCount - Index - 1) * sizeof(NTFS_HOST_MCB_RUN));
+    Mcb->PairCount--;
+}
+
+VOID
+NTAPI
+FsRtlInitializeLargeMcb(PLARGE_MCB Mcb,
+                        POOL_TYPE PoolType)
+{
+    Mcb->MaximumPairCount = 0;
+    Mcb->PairCount = 0;
+    Mcb->PoolType = PoolType;
+    Mcb->Mapping = NULL;
+}
+
+VOID
+NTAPI
+FsRtlUninitializeLargeMcb(PLARGE_MCB Mcb)
+{
+    free(Mcb->Mapping);
+    Mcb->Mapping = NULL;
+    Mcb->PairCount = Mcb->MaximumPairCount = 0;
+}
+
+VOID
+NTAPI
+FsRtlResetLargeMcb(PLARGE_MCB Mcb,
+                   BOOLEAN SelfSynchronized)
+{
+    UNREFERENCED_PARAMETER(SelfSynchronized);
+
+    Mcb->PairCount = 0;
+}
+
+VOID
+NTAPI
+FsRtlRemoveLargeMcbEntry(PLARGE_MCB Mcb,
+                         LONGLONG Vbn,
+                         LONGLONG SectorCount)
+{
+    LONGLONG End = Vbn + SectorCount;
+    ULONG i = 0;
+
+    while (i < Mcb->PairCount)
+    {
+        PNTFS_HOST_MCB_RUN Run = &Mcb->Mapping[i];
+
+        if (Run->RunEndVbn <= Vbn || Run->RunStartVbn >= End)
+        {
+            i++;
+            continue;
+        }
+
+        if (Run->RunStartVbn < Vbn && Run->RunEndVbn > End)
+        {
+            /* Punch a hole in the middle of the run */
+            LONGLONG TailLbn = Run->StartingLbn + (End - Run->RunStartVbn);
+            LONGLONG TailEnd = Run->RunEndVbn;
+
+            Run->RunEndVbn = Vbn;
+            NtfsHostMcbInsert(Mcb, i + 1, End, TailEnd, TailLbn);
+            return;
+        }
+
+        if (Run->RunStartVbn < Vbn)
+        {
+            Run->RunEndVbn = Vbn;
+            i++;
+        }
+        else if (Run->RunEndVbn > End)
+        {
+            Run->StartingLbn += End - Run->RunStartVbn;
+            Run->RunStartVbn = End;
+            i++;
+        }
+        else
+        {
+            NtfsHostMcbDelete(Mcb, i);
+        }
+    }
+}
+
+BOOLEAN
+NTAPI
+FsRtlAddLargeMcbEntry(PLARGE_MCB Mcb,
+                      LONGLONG Vbn,
+                      LONGLONG Lbn,
+                      LONGLONG SectorCount)
+{
+    LONGLONG IntLbn, IntSectorCount;
+    ULONG Index;
+
+    if (Vbn < 0 || SectorCount <= 0)
+        return FALSE;
+
+    if (FsRtlLookupLargeMcbEntry(Mcb, Vbn, &IntLbn, &IntSectorCount, NULL, NULL, NULL))
+    {
+        if (IntLbn != -1 && IntLbn != Lbn)
+            return FALSE;
+
+        if (IntLbn != -1 && IntSectorCount >= SectorCount)
+            return TRUE;
+    }
+
+    FsRtlRemoveLargeMcbEntry(Mcb, Vbn, SectorCount);
+
+    for (Index = 0; Index < Mcb->PairCount && Mcb->Mapping[Index].RunStartVbn < Vbn; Index++);
+
+    /* Merge with the neighbours when both VBNs and LBNs are contiguous */
+    if (Index > 0 &&
+        Mcb->Mapping[Index - 1].RunEndVbn == Vbn &&
+        Mcb->Mapping[Index - 1].StartingLbn + (Vbn - Mcb->Mapping[Index - 1].RunStartVbn) == Lbn)
+    {
+        Index--;
+        Mcb->Mapping[Index].RunEndVbn = Vbn + SectorCount;
+    }
+    else if (!NtfsHostMcbInsert(Mcb, Index, Vbn, Vbn + SectorCount, Lbn))
+    {
+        return FALSE;
+    }
+
+    if (Index + 1 < Mcb->PairCount &&
+        Mcb->Mapping[Index + 1].RunStartVbn == Mcb->Mapping[Index].RunEndVbn &&
+        Mcb->Mapping[Index + 1].StartingLbn == Mcb->Mapping[Index].StartingLbn +
+                                               (Mcb->Mapping[Index].RunEndVbn - Mcb->Mapping[Index].RunStartVbn))
+    {
+        Mcb->Mapping[Index].RunEndVbn = Mcb->Mapping[Index + 1].RunEndVbn;
+        NtfsHostMcbDelete(Mcb, Index + 1);
+    }
+
+    return TRUE;
+}
+
+/* Run indexes count the holes between mapped runs, like the kernel implementation does */
+BOOLEAN
+NTAPI
+FsRtlGetNextLargeMcbEntry(PLARGE_MCB Mcb,
+                          ULONG RunIndex,
+                          PLONGLONG Vbn,
+                          PLONGLONG Lbn,
+                          PLONGLONG SectorCount)
+{
+    ULONG i, CurrentIndex = 0;
+    LONGLONG LastEnd = 0;
+
+    for (i = 0; i < Mcb->PairCount; i++)
+    {
+        PNTFS_HOST_MCB_RUN Run = &Mcb->Mapping[i];
+
+        if (Run->RunStartVbn > LastEnd)
+        {
+            if (CurrentIndex == RunIndex)
+            {
+                *Vbn = LastEnd;
+                *Lbn = -1;
+                *SectorCount = Run->RunStartVbn - LastEnd;
+                return TRUE;
+            }
+            CurrentIndex++;
+        }
+
+        if (CurrentIndex == RunIndex)
+        {
+            *Vbn = Run->RunStartVbn;
+            *Lbn = Run->StartingLbn;
+            *SectorCount = Run->RunEndVbn - Run->RunStartVbn;
+            return TRUE;
+        }
+
+        CurrentIndex++;
+        LastEnd = Run->RunEndVbn;
+    }
+
+    return FALSE;
+}
+
+BOOLEAN
+NTAPI
+FsRtlLookupLargeMcbEntry(PLARGE_MCB Mcb,
+                         LONGLONG Vbn,
+                         PLONGLONG Lbn,
+                         PLONGLONG SectorCountFromLbn,
+                         PLONGLONG StartingLbn,
+                         PLONGLONG SectorCountFromStartingLbn,
+                         PULONG Index)
+{
+    ULONG i, CurrentIndex = 0;
+    LONGLONG LastEnd = 0;
+
+    for (i = 0; i < Mcb->PairCount; i++)
+    {
+        PNTFS_HOST_MCB_RUN Run = &Mcb->Mapping[i];
+
+        if (Run->RunStartVbn > LastEnd)
+        {
+            if (Vbn < Run->RunStartVbn)
+            {
+                if (Lbn) *Lbn = -1;
+                if (SectorCountFromLbn) *SectorCountFromLbn = Run->RunStartVbn - Vbn;
+                if (StartingLbn) *StartingLbn = -1;
+                if (SectorCountFromStartingLbn) *SectorCountFromStartingLbn = Run->RunStartVbn - LastEnd;
+                if (Index) *Index = CurrentIndex;
+                return TRUE;
+            }
+            CurrentIndex++;
+        }
+
+        if (Vbn < Run->RunEndVbn)
+        {
+            if (Lbn) *Lbn = Run->StartingLbn + (Vbn - Run->RunStartVbn);
+            if (SectorCountFromLbn) *SectorCountFromLbn = Run->RunEndVbn - Vbn;
+            if (StartingLbn) *StartingLbn = Run->StartingLbn;
+            if (SectorCountFromStartingLbn) *SectorCountFromStartingLbn = Run->RunEndVbn - Run->RunStartVbn;
+            if (Index) *Index = CurrentIndex;
+            return TRUE;
+        }
+
+        CurrentIndex++;
+        LastEnd = Run->RunEndVbn;
+    }
+
+    return FALSE;
+}
+
+BOOLEAN
+NTAPI
+FsRtlLookupLastLargeMcbEntry(PLARGE_MCB Mcb,
+                             PLONGLONG Vbn,
+                             PLONGLONG Lbn)
+{
+    PNTFS_HOST_MCB_RUN Run;
+
+    if (Mcb->PairCount == 0)
+        return FALSE;
+
+    Run = &Mcb->Mapping[Mcb->PairCount - 1];
+    *Vbn = Run->RunEndVbn - 1;
+    *Lbn = Run->StartingLbn + (Run->RunEndVbn - Run->RunStartVbn) - 1;
+
+    return TRUE;
+}
+
+ULONG
+NTAPI
+FsRtlNumberOfRunsInLargeMcb(PLARGE_MCB Mcb)
+{
+    ULONG i, Count = 0;
+    LONGLONG LastEnd = 0;
+
+    for (i = 0; i < Mcb->PairCount; i++)
+    {
+        if (Mcb->Mapping[i].RunStartVbn > LastEnd)
+            Count++;
+        Count++;
+        LastEnd = Mcb->Mapping[i].RunEndVbn;
+    }
+
+    return Count;
+}
+
+VOID
+NTAPI
+FsRtlTruncateLargeMcb(PLARGE_MCB Mcb,
+                      LONGLONG Vbn)
+{
+    FsRtlRemoveLargeMcbEntry(Mcb, Vbn, MAXLONGLONG - Vbn);
+}
+
+/* NAME HELPERS **************************************************************/
+
+VOID
+NTAPI
+FsRtlDissectName(UNICODE_STRING Name,
+                 PUNICODE_STRING FirstPart,
+                 PUNICODE_STRING RemainingPart)
+{
+    USHORT FirstPosition, i;
+    USHORT SkipFirstSlash = 0;
+
+    FirstPart->Length = FirstPart->MaximumLength = 0;
+    FirstPart->Buffer = NULL;
+    RemainingPart->Length = RemainingPart->MaximumLength = 0;
+    RemainingPart->Buffer = NULL;
+
+    if (Name.Length == 0)
+        return;
+
+    if (Name.Buffer[0] == L'\\')
+        SkipFirstSlash = 1;
+
+    for (FirstPosition = SkipFirstSlash; FirstPosition < Name.Length / sizeof(WCHAR); FirstPosition++)
+    {
+        if (Name.Buffer[FirstPosition] == L'\\')
+            break;
+    }
+
+    FirstPart->Buffer = &Name.Buffer[SkipFirstSlash];
+    FirstPart->Length = FirstPart->MaximumLength = (FirstPosition - SkipFirstSlash) * sizeof(WCHAR);
+
+    i = FirstPosition + 1;
+    if (i < Name.Length / sizeof(WCHAR))
+    {
+        RemainingPart->Buffer = &Name.Buffer[i];
+        RemainingPart->Length = RemainingPart->MaximumLength = Name.Length - i * sizeof(WCHAR);
+    }
+}
+
+static
+BOOLEAN
+NtfsHostMatch(PCWSTR Expression,
+              USHORT ExpressionLength,
+              PCWSTR Name,
+              USHORT NameLength,
+              BOOLEAN IgnoreCase,
+              PWCHAR UpcaseTable)
+{
+    while (ExpressionLength > 0)
+    {
+        WCHAR e = *Expression;
+
+        if (e == L'*' || e == L'<')
+        {
+            USHORT i;
+
+            for (i = 0; i <= NameLength; i++)
+            {
+                if (NtfsHostMatch(Expression + 1, ExpressionLength - 1, Name + i, NameLength - i, IgnoreCase, UpcaseTable))
+                    return TRUE;
+            }
+            return FALSE;
+        }
+
+        if (e == L'>')
+        {
+            /* DOS_QM: any single character, or nothing before a dot or the end */
+            if (NameLength > 0 && *Name != L'.' &&
+                NtfsHostMatch(Expression + 1, ExpressionLength - 1, Name + 1, NameLength - 1, IgnoreCase, UpcaseTable))
+            {
+                return TRUE;
+            }
+            Expression++;
+            ExpressionLength--;
+            continue;
+        }
+
+        if (e == L'"')
+        {
+            /* DOS_DOT: a dot, or nothing at the end of the name */
+            if (NameLength == 0)
+            {
+                Expression++;
+                ExpressionLength--;
+                continue;
+            }
+            if (*Name != L'.')
+                return FALSE;
+        }
+        else if (NameLength == 0)
+        {
+            return FALSE;
+        }
+        else if (e != L'?')
+        {
+            WCHAR n = *Name;
+
+            if (IgnoreCase)
+            {
+                /* Like the kernel, the expression is expected to be upcased already when there's a table */
+                if (UpcaseTable)
+                {
+                    n = UpcaseTable[n];
+                }
+                else
+                {
+                    e = RtlUpcaseUnicodeChar(e);
+                    n = RtlUpcaseUnicodeChar(n);
+                }
+            }
+
+            if (e != n)
+                return FALSE;
+        }
+
+        Expression++;
+        ExpressionLength--;
+        Name++;
+        NameLength--;
+    }
+
+    return NameLength == 0;
+}
+
+BOOLEAN
+NTAPI
+FsRtlIsNameInExpression(PUNICODE_STRING Expression,
+                        PUNICODE_STRING Name,
+                        BOOLEAN IgnoreCase,
+                        PWCHAR UpcaseTable)
+{
+    return NtfsHostMatch(Expression->Buffer,
+                         Expression->Length / sizeof(WCHAR),
+                         Name->Buffer,
+                         Name->Length / sizeof(WCHAR),
+                         IgnoreCase,
+                         UpcaseTable);
+}
+
+/* EOF */
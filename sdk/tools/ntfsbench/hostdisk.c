@@ -0,0 +1,682 @@
+/*
+ * PROJECT:     ReactOS NTFS host library
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Image file backed replacement for blockdev.c, plus the parts of fsctl.c,
+ *              create.c, fcb.c and rw.c needed to mount a volume, create files and use them
+ * COPYRIGHT:   Copyright 2026 ReactOS Team
+ */
+
+#include "hostdisk.h"
+
+#ifdef _MSC_VER
+#define fseeko _fseeki64
+#define ftello _ftelli64
+#endif
+
+static NTFS_GLOBAL_DATA NtfsHostGlobalData;
+PNTFS_GLOBAL_DATA NtfsGlobalData = NULL;
+
+/* FUNCTIONS ****************************************************************/
+
+NTSTATUS
+NtfsHostInitialize(VOID)
+{
+    if (NtfsGlobalData != NULL)
+        return STATUS_SUCCESS;
+
+    NtfsGlobalData = &NtfsHostGlobalData;
+    RtlZeroMemory(NtfsGlobalData, sizeof(NTFS_GLOBAL_DATA));
+    NtfsGlobalData->Identifier.Type = NTFS_TYPE_GLOBAL_DATA;
+    NtfsGlobalData->Identifier.Size = sizeof(NTFS_GLOBAL_DATA);
+    ExInitializeResourceLite(&NtfsGlobalData->Resource);
+
+    /* The host library is meant to exercise the write paths */
+    NtfsGlobalData->EnableWriteSupport = TRUE;
+
+    ExInitializeNPagedLookasideList(&NtfsGlobalData->IrpContextLookasideList,
+                                    NULL, NULL, 0, sizeof(NTFS_IRP_CONTEXT), TAG_IRP_CTXT, 0);
+    ExInitializeNPagedLookasideList(&NtfsGlobalData->FcbLookasideList,
+                                    NULL, NULL, 0, sizeof(NTFS_FCB), TAG_FCB, 0);
+    ExInitializeNPagedLookasideList(&NtfsGlobalData->AttrCtxtLookasideList,
+                                    NULL, NULL, 0, sizeof(NTFS_ATTR_CONTEXT), TAG_ATT_CTXT, 0);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NtfsHostOpenImage(PCSTR ImagePath,
+                  BOOLEAN Writable,
+                  PDEVICE_OBJECT *DeviceObject)
+{
+    PDEVICE_OBJECT Device;
+    FILE *Image;
+
+    Image = fopen(ImagePath, Writable ? "r+b" : "rb");
+    if (Image == NULL)
+    {
+        DPRINT1("Unable to open image %s\n", ImagePath);
+        return STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+
+    Device = ExAllocatePoolWithTag(NonPagedPool, sizeof(DEVICE_OBJECT), TAG_NTFS);
+    if (Device == NULL)
+    {
+        fclose(Image);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(Device, sizeof(DEVICE_OBJECT));
+    Device->Context = Image;
+    Device->SectorSize = 512;
+    fseeko(Image, 0, SEEK_END);
+    Device->Length = ftello(Image);
+
+    *DeviceObject = Device;
+    return STATUS_SUCCESS;
+}
+
+VOID
+NtfsHostCloseImage(PDEVICE_OBJECT DeviceObject)
+{
+    fclose(DeviceObject->Context);
+    ExFreePoolWithTag(DeviceObject, TAG_NTFS);
+}
+
+NTSTATUS
+NtfsReadDisk(IN PDEVICE_OBJECT DeviceObject,
+             IN LONGLONG StartingOffset,
+             IN ULONG Length,
+             IN ULONG SectorSize,
+             IN OUT PUCHAR Buffer,
+             IN BOOLEAN Override)
+{
+    FILE *Image = DeviceObject->Context;
+
+    UNREFERENCED_PARAMETER(SectorSize);
+    UNREFERENCED_PARAMETER(Override);
+
+    DeviceObject->ReadRequests++;
+    DeviceObject->BytesRead += Length;
+
+    if (StartingOffset < 0 || (ULONGLONG)StartingOffset + Length > DeviceObject->Length)
+    {
+        DPRINT1("Read beyond the end of the image (%I64x, %lu)\n", StartingOffset, Length);
+        return STATUS_END_OF_FILE;
+    }
+
+    if (fseeko(Image, StartingOffset, SEEK_SET) != 0 ||
+        fread(Buffer, 1, Length, Image) != Length)
+    {
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+NtfsWriteDisk(IN PDEVICE_OBJECT DeviceObject,
+              IN LONGLONG StartingOffset,
+              IN ULONG Length,
+              IN ULONG SectorSize,
+              IN const PUCHAR Buffer)
+{
+    FILE *Image = DeviceObject->Context;
+
+    UNREFERENCED_PARAMETER(SectorSize);
+
+    DeviceObject->WriteRequests++;
+    DeviceObject->BytesWritten += Length;
+
+    if (StartingOffset < 0 || (ULONGLONG)StartingOffset + Length > DeviceObject->Length)
+    {
+        DPRINT1("Write beyond the end of the image (%I64x, %lu)\n", StartingOffset, Length);
+        return STATUS_END_OF_FILE;
+    }
+
+    if (fseeko(Image, StartingOffset, SEEK_SET) != 0 ||
+        fwrite(Buffer, 1, Length, Image) != Length)
+    {
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/* The image file has no queue to fill, the runs are transferred one after the other */
+NTSTATUS
+NtfsReadWriteRuns(IN PDEVICE_OBJECT DeviceObject,
+                  IN UCHAR MajorFunction,
+                  IN PNTFS_IO_RUN Runs,
+                  IN ULONG RunCount,
+                  IN ULONG SectorSize,
+                  IN OUT PUCHAR Buffer)
+{
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG i;
+
+    for (i = 0; i < RunCount && NT_SUCCESS(Status); i++)
+    {
+        if (MajorFunction == IRP_MJ_READ)
+            Status = NtfsReadDisk(DeviceObject, Runs[i].DiskOffset, Runs[i].Length, SectorSize, Buffer + Runs[i].BufferOffset, FALSE);
+        else
+            Status = NtfsWriteDisk(DeviceObject, Runs[i].DiskOffset, Runs[i].Length, SectorSize, Buffer + Runs[i].BufferOffset);
+    }
+
+    return Status;
+}
+
+NTSTATUS
+NtfsReadSectors(IN PDEVICE_OBJECT DeviceObject,
+                IN ULONG DiskSector,
+                IN ULONG SectorCount,
+                IN ULONG SectorSize,
+                IN OUT PUCHAR Buffer,
+                IN BOOLEAN Override)
+{
+    return NtfsReadDisk(DeviceObject,
+                        (LONGLONG)DiskSector * SectorSize,
+                        SectorCount * SectorSize,
+                        SectorSize,
+                        Buffer,
+                        Override);
+}
+
+/*
+ * Same as NtfsGetVolumeData() in fsctl.c, without the disk geometry query
+ * (the sector size comes from the boot sector) and without the volume FCB.
+ */
+NTSTATUS
+NtfsHostMountVolume(PDEVICE_OBJECT DeviceObject,
+                    PDEVICE_EXTENSION *Vcb)
+{
+    PDEVICE_EXTENSION DeviceExt;
+    PNTFS_INFO NtfsInfo;
+    PBOOT_SECTOR BootSector;
+    PFILE_RECORD_HEADER VolumeRecord;
+    PNTFS_ATTR_CONTEXT AttrCtxt;
+    NTSTATUS Status;
+
+    NtfsHostInitialize();
+
+    DeviceExt = ExAllocatePoolWithTag(NonPagedPool, sizeof(DEVICE_EXTENSION), TAG_NTFS);
+    if (DeviceExt == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    RtlZeroMemory(DeviceExt, sizeof(DEVICE_EXTENSION));
+    DeviceExt->Identifier.Type = NTFS_TYPE_VCB;
+    DeviceExt->Identifier.Size = sizeof(DEVICE_EXTENSION);
+    DeviceExt->StorageDevice = DeviceObject;
+    NtfsInfo = &DeviceExt->NtfsInfo;
+
+    BootSector = ExAllocatePoolWithTag(NonPagedPool, sizeof(BOOT_SECTOR), TAG_NTFS);
+    if (BootSector == NULL)
+    {
+        ExFreePoolWithTag(DeviceExt, TAG_NTFS);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Status = NtfsReadDisk(DeviceObject, 0, sizeof(BOOT_SECTOR), 512, (PUCHAR)BootSector, TRUE);
+    if (!NT_SUCCESS(Status) || RtlCompareMemory(BootSector->OEMID, "NTFS    ", 8) != 8)
+    {
+        DPRINT1("Image does not contain an NTFS volume\n");
+        ExFreePoolWithTag(BootSector, TAG_NTFS);
+        ExFreePoolWithTag(DeviceExt, TAG_NTFS);
+        return NT_SUCCESS(Status) ? STATUS_UNSUCCESSFUL : Status;
+    }
+
+    NtfsInfo->BytesPerSector = BootSector->BPB.BytesPerSector;
+    NtfsInfo->SectorsPerCluster = BootSector->BPB.SectorsPerCluster;
+    NtfsInfo->BytesPerCluster = BootSector->BPB.BytesPerSector * BootSector->BPB.SectorsPerCluster;
+    NtfsInfo->SectorCount = BootSector->EBPB.SectorCount;
+    NtfsInfo->ClusterCount = NtfsInfo->SectorCount / (ULONGLONG)NtfsInfo->SectorsPerCluster;
+    NtfsInfo->MftStart.QuadPart = BootSector->EBPB.MftLocation;
+    NtfsInfo->MftMirrStart.QuadPart = BootSector->EBPB.MftMirrLocation;
+    NtfsInfo->SerialNumber = BootSector->EBPB.SerialNumber;
+    if (BootSector->EBPB.ClustersPerMftRecord > 0)
+        NtfsInfo->BytesPerFileRecord = BootSector->EBPB.ClustersPerMftRecord * NtfsInfo->BytesPerCluster;
+    else
+        NtfsInfo->BytesPerFileRecord = 1 << (-BootSector->EBPB.ClustersPerMftRecord);
+    if (BootSector->EBPB.ClustersPerIndexRecord > 0)
+        NtfsInfo->BytesPerIndexRecord = BootSector->EBPB.ClustersPerIndexRecord * NtfsInfo->BytesPerCluster;
+    else
+        NtfsInfo->BytesPerIndexRecord = 1 << (-BootSector->EBPB.ClustersPerIndexRecord);
+    DeviceObject->SectorSize = NtfsInfo->BytesPerSector;
+
+    ExFreePoolWithTag(BootSector, TAG_NTFS);
+
+    ExInitializeResourceLite(&DeviceExt->DirResource);
+    KeInitializeSpinLock(&DeviceExt->FcbListLock);
+    InitializeListHead(&DeviceExt->FcbListHead);
+
+    ExInitializeNPagedLookasideList(&DeviceExt->FileRecLookasideList,
+                                    NULL, NULL, 0, NtfsInfo->BytesPerFileRecord, TAG_FILE_REC, 0);
+
+    DeviceExt->MasterFileTable = ExAllocateFromNPagedLookasideList(&DeviceExt->FileRecLookasideList);
+    if (DeviceExt->MasterFileTable == NULL)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Failure;
+    }
+
+    Status = NtfsReadSectors(DeviceObject,
+                             NtfsInfo->MftStart.u.LowPart * NtfsInfo->SectorsPerCluster,
+                             NtfsInfo->BytesPerFileRecord / NtfsInfo->BytesPerSector,
+                             NtfsInfo->BytesPerSector,
+                             (PVOID)DeviceExt->MasterFileTable,
+                             TRUE);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Failed reading MFT.\n");
+        goto Failure;
+    }
+
+    Status = FixupUpdateSequenceArray(DeviceExt, &DeviceExt->MasterFileTable->Ntfs);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Failed applying the fixups of the MFT record.\n");
+        goto Failure;
+    }
+
+    Status = FindAttribute(DeviceExt,
+                           DeviceExt->MasterFileTable,
+                           AttributeData,
+                           L"",
+                           0,
+                           &DeviceExt->MFTContext,
+                           &DeviceExt->MftDataOffset);
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Can't find data attribute for Master File Table.\n");
+        goto Failure;
+    }
+
+    NtfsInitializeMftCache(DeviceExt);
+    NtfsInitializeCompressionCache(DeviceExt);
+    NtfsInitializeVolumeBitmap(DeviceExt);
+    NtfsInitializeLog(DeviceExt);
+
+    VolumeRecord = ExAllocateFromNPagedLookasideList(&DeviceExt->FileRecLookasideList);
+    if (VolumeRecord == NULL)
+    {
+        NtfsUninitializeVolumeBitmap(DeviceExt);
+        NtfsUninitializeCompressionCache(DeviceExt);
+        NtfsUninitializeMftCache(DeviceExt);
+        NtfsUninitializeLog(DeviceExt);
+        ReleaseAttributeContext(DeviceExt->MFTContext);
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Failure;
+    }
+
+    Status = ReadFileRecord(DeviceExt, NTFS_FILE_VOLUME, VolumeRecord);
+    if (NT_SUCCESS(Status))
+    {
+        Status = FindAttribute(DeviceExt, VolumeRecord, AttributeVolumeInformation, L"", 0, &AttrCtxt, NULL);
+        if (NT_SUCCESS(Status))
+        {
+            PVOLINFO_ATTRIBUTE VolumeInfo;
+
+            VolumeInfo = (PVOID)((ULONG_PTR)AttrCtxt->pRecord + AttrCtxt->pRecord->Resident.ValueOffset);
+            NtfsInfo->MajorVersion = VolumeInfo->MajorVersion;
+            NtfsInfo->MinorVersion = VolumeInfo->MinorVersion;
+            NtfsInfo->Flags = VolumeInfo->Flags;
+            ReleaseAttributeContext(AttrCtxt);
+        }
+    }
+    ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, VolumeRecord);
+
+    if (!NT_SUCCESS(Status))
+    {
+        DPRINT1("Failed reading volume file\n");
+        NtfsUninitializeVolumeBitmap(DeviceExt);
+        NtfsUninitializeCompressionCache(DeviceExt);
+        NtfsUninitializeMftCache(DeviceExt);
+        NtfsUninitializeLog(DeviceExt);
+        ReleaseAttributeContext(DeviceExt->MFTContext);
+        goto Failure;
+    }
+
+    /* IncreaseMftSize() needs the volume FCB, nothing else of it is used on the host */
+    DeviceExt->VolumeFcb = ExAllocateFromNPagedLookasideList(&NtfsGlobalData->FcbLookasideList);
+    if (DeviceExt->VolumeFcb == NULL)
+    {
+        NtfsUninitializeVolumeBitmap(DeviceExt);
+        NtfsUninitializeCompressionCache(DeviceExt);
+        NtfsUninitializeMftCache(DeviceExt);
+        NtfsUninitializeLog(DeviceExt);
+        ReleaseAttributeContext(DeviceExt->MFTContext);
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Failure;
+    }
+    RtlZeroMemory(DeviceExt->VolumeFcb, sizeof(NTFS_FCB));
+    DeviceExt->VolumeFcb->Identifier.Type = NTFS_TYPE_FCB;
+    DeviceExt->VolumeFcb->Identifier.Size = sizeof(NTFS_FCB);
+    DeviceExt->VolumeFcb->Vcb = DeviceExt;
+    DeviceExt->VolumeFcb->Flags = FCB_IS_VOLUME;
+    DeviceExt->VolumeFcb->MFTIndex = NTFS_FILE_MFT;
+
+    NtfsInitializeUpcaseTable(DeviceExt);
+
+    /* 12.5% like the default of the kernel driver */
+    NtfsInfo->MftZoneReservation = 1;
+
+    *Vcb = DeviceExt;
+    return STATUS_SUCCESS;
+
+Failure:
+    if (DeviceExt->MasterFileTable != NULL)
+        ExFreeToNPagedLookasideList(&DeviceExt->FileRecLookasideList, DeviceExt->MasterFileTable);
+    ExDeleteNPagedLookasideList(&DeviceExt->FileRecLookasideList);
+    ExDeleteResourceLite(&DeviceExt->DirResource);
+    ExFreePoolWithTag(DeviceExt, TAG_NTFS);
+    return Status;
+}
+
+VOID
+NtfsHostDismountVolume(PDEVICE_EXTENSION Vcb)
+{
+    NtfsUninitializeUpcaseTable(Vcb);
+    NtfsUninitializeVolumeBitmap(Vcb);
+    NtfsUninitializeCompressionCache(Vcb);
+    NtfsUninitializeMftCache(Vcb);
+    NtfsUninitializeLog(Vcb);
+    ExFreeToNPagedLookasideList(&NtfsGlobalData->FcbLookasideList, Vcb->VolumeFcb);
+    ReleaseAttributeContext(Vcb->MFTContext);
+    ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, Vcb->MasterFileTable);
+    ExDeleteNPagedLookasideList(&Vcb->FileRecLookasideList);
+    ExDeleteResourceLite(&Vcb->DirResource);
+    fflush(Vcb->StorageDevice->Context);
+    ExFreePoolWithTag(Vcb, TAG_NTFS);
+}
+
+/* Replaces NtfsIncrementIndexGeneration() of fcb.c: no FCB, hence no directory cursor, exists on the host */
+VOID
+NtfsIncrementIndexGeneration(PNTFS_VCB Vcb,
+                             ULONGLONG DirectoryMftIndex)
+{
+    UNREFERENCED_PARAMETER(Vcb);
+    UNREFERENCED_PARAMETER(DirectoryMftIndex);
+}
+
+/* Same as NtfsCreateEmptyFileRecord() in create.c, which isn't built on the host */
+PFILE_RECORD_HEADER
+NtfsCreateEmptyFileRecord(PDEVICE_EXTENSION DeviceExt)
+{
+    PFILE_RECORD_HEADER FileRecord;
+    PNTFS_ATTR_RECORD NextAttribute;
+
+    FileRecord = ExAllocateFromNPagedLookasideList(&DeviceExt->FileRecLookasideList);
+    if (!FileRecord)
+        return NULL;
+
+    RtlZeroMemory(FileRecord, DeviceExt->NtfsInfo.BytesPerFileRecord);
+
+    FileRecord->Ntfs.Type = NRH_FILE_TYPE;
+    FileRecord->Ntfs.UsaOffset = FIELD_OFFSET(FILE_RECORD_HEADER, MFTRecordNumber) + sizeof(ULONG);
+    FileRecord->BytesAllocated = DeviceExt->NtfsInfo.BytesPerFileRecord;
+    FileRecord->Ntfs.UsaCount = (FileRecord->BytesAllocated / DeviceExt->NtfsInfo.BytesPerSector) + 1;
+    FileRecord->SequenceNumber = 1;
+    FileRecord->AttributeOffset = FileRecord->Ntfs.UsaOffset + (2 * FileRecord->Ntfs.UsaCount);
+    FileRecord->AttributeOffset = ALIGN_UP_BY(FileRecord->AttributeOffset, ATTR_RECORD_ALIGNMENT);
+    FileRecord->Flags = FRH_IN_USE;
+    FileRecord->BytesInUse = FileRecord->AttributeOffset + sizeof(ULONG) * 2;
+
+    NextAttribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)FileRecord + FileRecord->AttributeOffset);
+    NextAttribute->Type = AttributeEnd;
+    NextAttribute->Length = FILE_RECORD_END;
+
+    return FileRecord;
+}
+
+/*
+ * Same as NtfsCreateFileRecord() and NtfsCreateDirectory() in create.c,
+ * driven by a path name instead of a FILE_OBJECT coming from an IRP.
+ */
+static
+NTSTATUS
+NtfsHostCreateFileRecord(PDEVICE_EXTENSION Vcb,
+                         PFILE_OBJECT FileObject,
+                         BOOLEAN Directory,
+                         PULONGLONG MftIndex)
+{
+    NTSTATUS Status;
+    PFILE_RECORD_HEADER FileRecord;
+    PNTFS_ATTR_RECORD NextAttribute;
+    PFILENAME_ATTRIBUTE FilenameAttribute;
+    PINDEX_ROOT_ATTRIBUTE NewIndexRoot = NULL;
+    ULONGLONG ParentMftIndex;
+    ULONGLONG FileMftIndex;
+
+    FileRecord = NtfsCreateEmptyFileRecord(Vcb);
+    if (!FileRecord)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    if (Directory)
+        FileRecord->Flags |= FRH_DIRECTORY;
+
+    NextAttribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)FileRecord + FileRecord->AttributeOffset);
+    AddStandardInformation(FileRecord, NextAttribute);
+
+    NextAttribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)NextAttribute + (ULONG_PTR)NextAttribute->Length);
+    Status = AddFileName(FileRecord, NextAttribute, Vcb, FileObject, FALSE, &ParentMftIndex);
+    if (!NT_SUCCESS(Status) && Status != STATUS_OBJECT_PATH_NOT_FOUND)
+    {
+        ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+        return Status;
+    }
+
+    FilenameAttribute = (PFILENAME_ATTRIBUTE)((ULONG_PTR)NextAttribute + NextAttribute->Resident.ValueOffset);
+    NextAttribute = (PNTFS_ATTR_RECORD)((ULONG_PTR)NextAttribute + (ULONG_PTR)NextAttribute->Length);
+
+    if (Directory)
+    {
+        PB_TREE Tree;
+        ULONG MaxIndexRootSize;
+        ULONG RootLength;
+
+        Status = CreateEmptyBTree(&Tree);
+        if (!NT_SUCCESS(Status))
+        {
+            ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+            return Status;
+        }
+
+        MaxIndexRootSize = Vcb->NtfsInfo.BytesPerFileRecord
+                           - ((ULONG_PTR)NextAttribute - (ULONG_PTR)FileRecord)
+                           - sizeof(ULONG) * 2;
+
+        Status = CreateIndexRootFromBTree(Vcb, Tree, MaxIndexRootSize, &NewIndexRoot, &RootLength);
+        DestroyBTree(Tree);
+        if (NT_SUCCESS(Status))
+            Status = AddIndexRoot(Vcb, FileRecord, NextAttribute, NewIndexRoot, RootLength, L"$I30", 4);
+    }
+    else
+    {
+        Status = AddData(FileRecord, NextAttribute);
+    }
+
+    if (NT_SUCCESS(Status))
+        Status = AddNewMftEntry(FileRecord, Vcb, &FileMftIndex, TRUE);
+
+    if (NT_SUCCESS(Status))
+    {
+        if (MftIndex)
+            *MftIndex = FileMftIndex;
+
+        FileMftIndex = FileMftIndex + ((ULONGLONG)FileRecord->SequenceNumber << 48);
+        Status = NtfsAddFilenameToDirectory(Vcb,
+                                            ParentMftIndex,
+                                            FileMftIndex,
+                                            FilenameAttribute,
+                                            FALSE);
+    }
+
+    if (NewIndexRoot)
+        ExFreePoolWithTag(NewIndexRoot, TAG_NTFS);
+    ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+
+    return Status;
+}
+
+NTSTATUS
+NtfsHostCreateFile(PDEVICE_EXTENSION Vcb,
+                   PCWSTR PathName,
+                   BOOLEAN Directory,
+                   PULONGLONG MftIndex)
+{
+    NTSTATUS Status;
+    FILE_OBJECT FileObject;
+
+    RtlZeroMemory(&FileObject, sizeof(FileObject));
+    RtlInitUnicodeString(&FileObject.FileName, PathName);
+
+    /* Like NtfsDispatch() around the create request */
+    NtfsLogBeginOperation(Vcb, FALSE);
+
+    Status = NtfsHostCreateFileRecord(Vcb, &FileObject, Directory, MftIndex);
+
+    if (Vcb->VolumeBitmap.DirtyCount != 0)
+        NtfsFlushVolumeBitmap(Vcb);
+
+    if (Vcb->MftCache.DirtyCount != 0)
+        NtfsFlushMftCache(Vcb);
+
+    NtfsLogEndOperation(Vcb);
+
+    return Status;
+}
+
+/* Same as the non-cached path of NtfsWriteFile() in rw.c, for the unnamed stream of a file that isn't sparse */
+NTSTATUS
+NtfsHostWriteFile(PDEVICE_EXTENSION Vcb,
+                  ULONGLONG MftIndex,
+                  ULONGLONG WriteOffset,
+                  PVOID Buffer,
+                  ULONG Length)
+{
+    NTSTATUS Status;
+    PFILE_RECORD_HEADER FileRecord;
+    PNTFS_ATTR_CONTEXT DataContext;
+    PFILENAME_ATTRIBUTE FileNameAttribute;
+    UNICODE_STRING FileName;
+    LARGE_INTEGER DataSize;
+    ULONG AttributeOffset;
+    ULONG LengthWritten;
+    FILE_OBJECT FileObject;
+    NTFS_FCB Fcb;
+
+    FileRecord = ExAllocateFromNPagedLookasideList(&Vcb->FileRecLookasideList);
+    if (FileRecord == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    NtfsLogBeginOperation(Vcb, FALSE);
+
+    Status = ReadFileRecord(Vcb, MftIndex, FileRecord);
+    if (NT_SUCCESS(Status))
+        Status = FindAttribute(Vcb, FileRecord, AttributeData, L"", 0, &DataContext, &AttributeOffset);
+    if (!NT_SUCCESS(Status))
+        goto Done;
+
+    if (WriteOffset + Length > AttributeDataLength(DataContext->pRecord))
+    {
+        /* SetAttributeDataLength() only needs the sizes and the identity of the FCB */
+        RtlZeroMemory(&Fcb, sizeof(Fcb));
+        RtlZeroMemory(&FileObject, sizeof(FileObject));
+        Fcb.Vcb = Vcb;
+        Fcb.MFTIndex = MftIndex;
+        FileObject.FsContext = &Fcb;
+        FileObject.SectionObjectPointer = &Fcb.SectionObjectPointers;
+
+        DataSize.QuadPart = WriteOffset + Length;
+        Status = SetAttributeDataLength(&FileObject, &Fcb, DataContext, AttributeOffset, FileRecord, &DataSize);
+        if (!NT_SUCCESS(Status))
+        {
+            ReleaseAttributeContext(DataContext);
+            goto Done;
+        }
+
+        FileNameAttribute = GetBestFileNameFromRecord(Vcb, FileRecord);
+        FileName.Buffer = FileNameAttribute->Name;
+        FileName.Length = FileNameAttribute->NameLength * sizeof(WCHAR);
+        FileName.MaximumLength = FileName.Length;
+        UpdateFileNameRecord(Vcb,
+                             FileNameAttribute->DirectoryFileReferenceNumber & NTFS_MFT_MASK,
+                             &FileName,
+                             FALSE,
+                             DataSize.QuadPart,
+                             AttributeAllocatedLength(DataContext->pRecord),
+                             FALSE);
+    }
+
+    Status = WriteAttribute(Vcb, DataContext, WriteOffset, Buffer, Length, &LengthWritten, FileRecord);
+    if (NT_SUCCESS(Status) && LengthWritten != Length)
+        Status = STATUS_PARTIAL_COPY;
+
+    ReleaseAttributeContext(DataContext);
+
+Done:
+    ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+
+    /* Like NtfsDispatch() around the write request */
+    if (Vcb->VolumeBitmap.DirtyCount != 0)
+        NtfsFlushVolumeBitmap(Vcb);
+
+    if (Vcb->MftCache.DirtyCount != 0)
+        NtfsFlushMftCache(Vcb);
+
+    NtfsLogEndOperation(Vcb);
+
+    return Status;
+}
+
+/* Same as NtfsReadFile() in rw.c, for the unnamed stream of a file */
+NTSTATUS
+NtfsHostReadFile(PDEVICE_EXTENSION Vcb,
+                 ULONGLONG MftIndex,
+                 ULONGLONG ReadOffset,
+                 PVOID Buffer,
+                 ULONG Length,
+                 PULONG LengthRead)
+{
+    NTSTATUS Status;
+    PFILE_RECORD_HEADER FileRecord;
+    PNTFS_ATTR_CONTEXT DataContext;
+    ULONGLONG StreamSize;
+    ULONG ToRead;
+
+    *LengthRead = 0;
+
+    FileRecord = ExAllocateFromNPagedLookasideList(&Vcb->FileRecLookasideList);
+    if (FileRecord == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    Status = ReadFileRecord(Vcb, MftIndex, FileRecord);
+    if (NT_SUCCESS(Status))
+        Status = FindAttribute(Vcb, FileRecord, AttributeData, L"", 0, &DataContext, NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+        return Status;
+    }
+
+    StreamSize = AttributeDataLength(DataContext->pRecord);
+    if (ReadOffset >= StreamSize)
+    {
+        Status = STATUS_END_OF_FILE;
+    }
+    else
+    {
+        ToRead = (ULONG)min(Length, StreamSize - ReadOffset);
+        if (ReadAttribute(Vcb, DataContext, ReadOffset, Buffer, ToRead) == 0)
+            Status = STATUS_PARTIAL_COPY;
+        else
+            *LengthRead = ToRead;
+    }
+
+    ReleaseAttributeContext(DataContext);
+    ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+
+    return Status;
+}
+
+
+/* EOF */
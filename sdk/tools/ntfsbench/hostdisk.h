@@ -0,0 +1,49 @@
+/*
+ * PROJECT:     ReactOS NTFS host library
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Image file backed block device and volume mounting for the host library
+ * COPYRIGHT:   Copyright 2026 ReactOS Team
+ */
+
+#pragma once
+
+#include <ntfs.h>
+
+NTSTATUS
+NtfsHostInitialize(VOID);
+
+NTSTATUS
+NtfsHostOpenImage(PCSTR ImagePath,
+                  BOOLEAN Writable,
+                  PDEVICE_OBJECT *DeviceObject);
+
+VOID
+NtfsHostCloseImage(PDEVICE_OBJECT DeviceObject);
+
+NTSTATUS
+NtfsHostMountVolume(PDEVICE_OBJECT DeviceObject,
+                    PDEVICE_EXTENSION *Vcb);
+
+VOID
+NtfsHostDismountVolume(PDEVICE_EXTENSION Vcb);
+
+NTSTATUS
+NtfsHostCreateFile(PDEVICE_EXTENSION Vcb,
+                   PCWSTR PathName,
+                   BOOLEAN Directory,
+                   PULONGLONG MftIndex);
+
+NTSTATUS
+NtfsHostWriteFile(PDEVICE_EXTENSION Vcb,
+                  ULONGLONG MftIndex,
+                  ULONGLONG WriteOffset,
+                  PVOID Buffer,
+                  ULONG Length);
+
+NTSTATUS
+NtfsHostReadFile(PDEVICE_EXTENSION Vcb,
+                 ULONGLONG MftIndex,
+                 ULONGLONG ReadOffset,
+                 PVOID Buffer,
+                 ULONG Length,
+                 PULONG LengthRead);
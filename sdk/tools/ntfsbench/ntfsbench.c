@@ -0,0 +1,346 @@
+/*
+ * PROJECT:     ReactOS NTFS host library
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Benchmark of the NTFS driver code running against a volume image
+ * COPYRIGHT:   Copyright 2026 ReactOS Team
+ */
+
+#include "hostdisk.h"
+
+#ifdef _WIN32
+/* windows.h would clash with the host definitions of the NT types */
+__declspec(dllimport) int __stdcall QueryPerformanceCounter(LARGE_INTEGER *PerformanceCount);
+__declspec(dllimport) int __stdcall QueryPerformanceFrequency(LARGE_INTEGER *Frequency);
+#else
+#include <time.h>
+#endif
+
+#define BENCH_DIRECTORY "\\ntfsbench"
+#define BENCH_DATA_CHUNK (64 * 1024)
+#define BENCH_READ_SIZE 4096
+
+typedef struct _BENCH_COUNTERS
+{
+    double Start;
+    ULONGLONG ReadRequests;
+    ULONGLONG WriteRequests;
+    ULONGLONG BytesRead;
+    ULONGLONG BytesWritten;
+} BENCH_COUNTERS, *PBENCH_COUNTERS;
+
+static
+double
+BenchNow(VOID)
+{
+#ifdef _WIN32
+    LARGE_INTEGER Now, Frequency;
+
+    QueryPerformanceCounter(&Now);
+    QueryPerformanceFrequency(&Frequency);
+    return (double)Now.QuadPart / Frequency.QuadPart;
+#else
+    struct timespec Now;
+
+    clock_gettime(CLOCK_MONOTONIC, &Now);
+    return Now.tv_sec + Now.tv_nsec / 1e9;
+#endif
+}
+
+static
+VOID
+BenchStart(PDEVICE_OBJECT Device,
+           PBENCH_COUNTERS Counters)
+{
+    Counters->ReadRequests = Device->ReadRequests;
+    Counters->WriteRequests = Device->WriteRequests;
+    Counters->BytesRead = Device->BytesRead;
+    Counters->BytesWritten = Device->BytesWritten;
+    Counters->Start = BenchNow();
+}
+
+static
+VOID
+BenchReport(PDEVICE_OBJECT Device,
+            PBENCH_COUNTERS Counters,
+            PCSTR Name,
+            ULONG Operations)
+{
+    double Elapsed = BenchNow() - Counters->Start;
+
+    if (Elapsed <= 0)
+        Elapsed = 1e-9;
+
+    printf("%-12s %10lu ops %10.3f s %12.0f ops/s  disk: %llu reads (%llu KB), %llu writes (%llu KB)\n",
+           Name,
+           (unsigned long)Operations,
+           Elapsed,
+           Operations / Elapsed,
+           (unsigned long long)(Device->ReadRequests - Counters->ReadRequests),
+           (unsigned long long)(Device->BytesRead - Counters->BytesRead) / 1024,
+           (unsigned long long)(Device->WriteRequests - Counters->WriteRequests),
+           (unsigned long long)(Device->BytesWritten - Counters->BytesWritten) / 1024);
+}
+
+/*
+ * Builds "\ntfsbench.R\fNNNNNNNN", where R tells the runs on the same image apart
+ * (only the directory when Index is -1, and "data" instead of a number when it's -2)
+ */
+static
+VOID
+BenchFileName(PWCHAR Buffer,
+              ULONG Run,
+              ULONG Index)
+{
+    CHAR Name[64];
+    ULONG i;
+
+    if (Index == (ULONG)-1)
+        sprintf(Name, "%s.%lu", BENCH_DIRECTORY, (unsigned long)Run);
+    else if (Index == (ULONG)-2)
+        sprintf(Name, "%s.%lu\\data", BENCH_DIRECTORY, (unsigned long)Run);
+    else
+        sprintf(Name, "%s.%lu\\f%08lu", BENCH_DIRECTORY, (unsigned long)Run, (unsigned long)Index);
+
+    for (i = 0; Name[i]; i++)
+        Buffer[i] = (WCHAR)Name[i];
+    Buffer[i] = UNICODE_NULL;
+}
+
+static
+ULONG
+BenchRandom(PULONGLONG Seed)
+{
+    *Seed = *Seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (ULONG)(*Seed >> 33);
+}
+
+static
+VOID
+Usage(VOID)
+{
+    printf("Usage: ntfsbench [-v] [-n files] [-s size] [-r reads] image\n"
+           "  image     an NTFS volume image, it gets modified; every run works in\n"
+           "            a new " BENCH_DIRECTORY ".N directory\n"
+           "  -n files  number of files to create (default 1000)\n"
+           "  -s size   size of the data file in MB (default 64)\n"
+           "  -r reads  number of random reads in the data file (default 10000)\n"
+           "  -v        print the driver debug output\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    PCSTR ImagePath = NULL;
+    ULONG FileCount = 1000;
+    ULONG ReadCount = 10000;
+    ULONG DataSize = 64;
+    PDEVICE_OBJECT Device;
+    PDEVICE_EXTENSION Vcb;
+    BENCH_COUNTERS Counters;
+    WCHAR PathBuffer[64];
+    UNICODE_STRING PathName;
+    PFILE_RECORD_HEADER FileRecord;
+    NTFS_INDEX_CURSOR Cursor;
+    NTFS_MFT_SCAN Scan;
+    PINDEX_ENTRY_ATTRIBUTE IndexEntry;
+    ULONGLONG DirectoryIndex, DataIndex, MftIndex;
+    ULONGLONG DataLength, Offset, Seed = 1;
+    PCHAR Buffer;
+    ULONG Entry, Found, Run, Length, i;
+    NTSTATUS Status;
+    int arg;
+
+    for (arg = 1; arg < argc; arg++)
+    {
+        if (!strcmp(argv[arg], "-v"))
+            NtfsHostVerbose = TRUE;
+        else if (!strcmp(argv[arg], "-n") && arg + 1 < argc)
+            FileCount = strtoul(argv[++arg], NULL, 0);
+        else if (!strcmp(argv[arg], "-s") && arg + 1 < argc)
+            DataSize = strtoul(argv[++arg], NULL, 0);
+        else if (!strcmp(argv[arg], "-r") && arg + 1 < argc)
+            ReadCount = strtoul(argv[++arg], NULL, 0);
+        else if (argv[arg][0] != '-' && ImagePath == NULL)
+            ImagePath = argv[arg];
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    if (ImagePath == NULL || FileCount == 0 || DataSize == 0)
+    {
+        Usage();
+        return 1;
+    }
+
+    Status = NtfsHostOpenImage(ImagePath, TRUE, &Device);
+    if (!NT_SUCCESS(Status))
+    {
+        fprintf(stderr, "Cannot open %s\n", ImagePath);
+        return 1;
+    }
+
+    Status = NtfsHostMountVolume(Device, &Vcb);
+    if (!NT_SUCCESS(Status))
+    {
+        fprintf(stderr, "Cannot mount %s (0x%08lx)\n", ImagePath, (unsigned long)Status);
+        NtfsHostCloseImage(Device);
+        return 1;
+    }
+
+    printf("%s: %llu clusters of %lu bytes, %lu bytes per file record\n",
+           ImagePath,
+           (unsigned long long)Vcb->NtfsInfo.ClusterCount,
+           (unsigned long)Vcb->NtfsInfo.BytesPerCluster,
+           (unsigned long)Vcb->NtfsInfo.BytesPerFileRecord);
+
+    /* Skip the directories of the previous runs */
+    for (Run = 0; ; Run++)
+    {
+        BenchFileName(PathBuffer, Run, (ULONG)-1);
+        RtlInitUnicodeString(&PathName, PathBuffer);
+        Status = NtfsLookupFile(Vcb, &PathName, FALSE, &FileRecord, &MftIndex);
+        if (!NT_SUCCESS(Status))
+            break;
+        ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+    }
+
+    /* Create */
+    Status = NtfsHostCreateFile(Vcb, PathBuffer, TRUE, &DirectoryIndex);
+    if (!NT_SUCCESS(Status))
+    {
+        fprintf(stderr, "Cannot create " BENCH_DIRECTORY ".%lu (0x%08lx)\n", (unsigned long)Run, (unsigned long)Status);
+        goto Cleanup;
+    }
+
+    BenchStart(Device, &Counters);
+    for (i = 0; i < FileCount; i++)
+    {
+        BenchFileName(PathBuffer, Run, i);
+        Status = NtfsHostCreateFile(Vcb, PathBuffer, FALSE, NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            fprintf(stderr, "Creating file %lu failed (0x%08lx)\n", (unsigned long)i, (unsigned long)Status);
+            FileCount = i;
+            break;
+        }
+    }
+    BenchReport(Device, &Counters, "create", FileCount);
+
+    /* Lookup, in random order so that the directory index is not walked sequentially */
+    BenchStart(Device, &Counters);
+    for (i = 0, Found = 0; i < FileCount; i++)
+    {
+        BenchFileName(PathBuffer, Run, BenchRandom(&Seed) % FileCount);
+        RtlInitUnicodeString(&PathName, PathBuffer);
+        Status = NtfsLookupFile(Vcb, &PathName, FALSE, &FileRecord, &MftIndex);
+        if (NT_SUCCESS(Status))
+        {
+            ExFreeToNPagedLookasideList(&Vcb->FileRecLookasideList, FileRecord);
+            Found++;
+        }
+    }
+    BenchReport(Device, &Counters, "lookup", FileCount);
+    if (Found != FileCount)
+        fprintf(stderr, "lookup: only %lu of %lu files found\n", (unsigned long)Found, (unsigned long)FileCount);
+
+    /* Enumerate, the way NtfsQueryDirectory() does */
+    BenchStart(Device, &Counters);
+    RtlInitUnicodeString(&PathName, L"*");
+    RtlZeroMemory(&Cursor, sizeof(Cursor));
+    for (Entry = 0, Found = 0; ; Entry++, Found++)
+    {
+        Status = NtfsFindNextIndexEntry(Vcb, &Cursor, DirectoryIndex, 0, &PathName, &Entry, FALSE, &IndexEntry);
+        if (!NT_SUCCESS(Status))
+            break;
+    }
+    NtfsReleaseIndexCursor(&Cursor);
+    BenchReport(Device, &Counters, "enumerate", Found);
+    Status = STATUS_SUCCESS;
+    if (Found != FileCount)
+        fprintf(stderr, "enumerate: %lu entries for %lu files\n", (unsigned long)Found, (unsigned long)FileCount);
+
+    /* Write a data file sequentially, growing it with each write like an application copying a file does */
+    BenchFileName(PathBuffer, Run, (ULONG)-2);
+    Status = NtfsHostCreateFile(Vcb, PathBuffer, FALSE, &DataIndex);
+    if (!NT_SUCCESS(Status))
+    {
+        fprintf(stderr, "Cannot create " BENCH_DIRECTORY ".%lu\\data (0x%08lx)\n", (unsigned long)Run, (unsigned long)Status);
+        goto Cleanup;
+    }
+
+    Buffer = ExAllocatePoolWithTag(NonPagedPool, BENCH_DATA_CHUNK, TAG_NTFS);
+    if (Buffer == NULL)
+    {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+        goto Cleanup;
+    }
+
+    DataLength = (ULONGLONG)DataSize * 1024 * 1024;
+
+    BenchStart(Device, &Counters);
+    for (Offset = 0, i = 0; Offset < DataLength; Offset += BENCH_DATA_CHUNK, i++)
+    {
+        RtlFillMemory(Buffer, BENCH_DATA_CHUNK, (UCHAR)i);
+        Status = NtfsHostWriteFile(Vcb, DataIndex, Offset, Buffer, BENCH_DATA_CHUNK);
+        if (!NT_SUCCESS(Status))
+        {
+            fprintf(stderr, "Writing at %llu failed (0x%08lx)\n", (unsigned long long)Offset, (unsigned long)Status);
+            DataLength = Offset;
+            break;
+        }
+    }
+    BenchReport(Device, &Counters, "write", i);
+
+    BenchStart(Device, &Counters);
+    for (Offset = 0, i = 0; Offset < DataLength; Offset += Length, i++)
+    {
+        Status = NtfsHostReadFile(Vcb, DataIndex, Offset, Buffer, BENCH_DATA_CHUNK, &Length);
+        if (!NT_SUCCESS(Status) || Length == 0)
+            break;
+        if (Buffer[0] != (CHAR)i || Buffer[Length - 1] != (CHAR)i)
+        {
+            fprintf(stderr, "seq read: wrong data at %llu\n", (unsigned long long)Offset);
+            break;
+        }
+    }
+    BenchReport(Device, &Counters, "seq read", i);
+
+    BenchStart(Device, &Counters);
+    for (i = 0; i < ReadCount && DataLength != 0; i++)
+    {
+        Offset = ((ULONGLONG)BenchRandom(&Seed) << 16 | BenchRandom(&Seed)) % DataLength;
+        Offset = ALIGN_DOWN_BY(Offset, BENCH_READ_SIZE);
+        NtfsHostReadFile(Vcb, DataIndex, Offset, Buffer, BENCH_READ_SIZE, &Length);
+    }
+    BenchReport(Device, &Counters, "random read", i);
+
+    ExFreePoolWithTag(Buffer, TAG_NTFS);
+    Status = STATUS_SUCCESS;
+
+    /* Walk every file record in use, the way FSCTL_ENUM_USN_DATA does */
+    BenchStart(Device, &Counters);
+    Status = NtfsStartMftScan(Vcb, 0, &Scan);
+    if (!NT_SUCCESS(Status))
+        goto Cleanup;
+    for (Found = 0; NtfsReadNextMftRecord(Vcb, &Scan, &MftIndex, &FileRecord) == STATUS_SUCCESS; Found++);
+    NtfsEndMftScan(&Scan);
+    BenchReport(Device, &Counters, "mft scan", Found);
+    if (Found < FileCount)
+        fprintf(stderr, "mft scan: %lu records for %lu files\n", (unsigned long)Found, (unsigned long)FileCount);
+
+    printf("MFT cache: %llu hits, %llu misses, %llu write-backs, %llu prefetches\n",
+           (unsigned long long)Vcb->MftCache.Hits,
+           (unsigned long long)Vcb->MftCache.Misses,
+           (unsigned long long)Vcb->MftCache.WriteBacks,
+           (unsigned long long)Vcb->MftCache.Prefetches);
+
+Cleanup:
+    NtfsHostDismountVolume(Vcb);
+    NtfsHostCloseImage(Device);
+    return NT_SUCCESS(Status) ? 0 : 1;
+}
+
+/* EOF */
@@ -0,0 +1,620 @@
+/*
+ * PROJECT:     ReactOS NTFS host library
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Kernel environment replacement used to build the NTFS driver's
+ *              on-disk logic (attrib.c, btree.c, mft.c, volinfo.c) as a host library
+ * COPYRIGHT:   Copyright 2026 ReactOS Team
+ */
+
+#ifndef NTFSHOST_H
+#define NTFSHOST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _HAVE_RTL_BITMAP
+#include <typedefs.h>
+
+/* SAL annotations used by the shared rtl sources */
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _Inout_opt_
+#define _Must_inspect_result_
+#define __drv_aliasesMem
+#define _In_range_(l, h)
+
+#ifndef _countof
+#define _countof(_Array) (sizeof(_Array) / sizeof(_Array[0]))
+#endif
+
+#define CODE_SEG(...)
+#define FORCEINLINE static __inline
+#define UNREFERENCED_PARAMETER(P) ((void)(P))
+#define NT_ASSERT(x) ASSERT(x)
+#define NT_VERIFY(x) (x)
+
+#undef DPRINT
+#undef DPRINT1
+#define DPRINT(...) do { if (0) NtfsHostDbgPrint(__VA_ARGS__); } while (0)
+#define DPRINT1(...) NtfsHostDbgPrint(__VA_ARGS__)
+#define DbgPrint NtfsHostDbgPrint
+#undef UNIMPLEMENTED
+#define UNIMPLEMENTED NtfsHostDbgPrint("%s is UNIMPLEMENTED!\n", __FUNCTION__)
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#define ALIGN_DOWN_BY(size, align) \
+    ((ULONG_PTR)(size) & ~((ULONG_PTR)(align) - 1))
+#define ALIGN_UP_BY(size, align) \
+    (ALIGN_DOWN_BY(((ULONG_PTR)(size) + (align) - 1), align))
+#define ALIGN_DOWN(size, type) ALIGN_DOWN_BY(size, sizeof(type))
+#define ALIGN_UP(size, type) ALIGN_UP_BY(size, sizeof(type))
+
+#define FlagOn(_F, _SF) ((_F) & (_SF))
+#define BooleanFlagOn(F, SF) ((BOOLEAN)(((F) & (SF)) != 0))
+#define SetFlag(_F, _SF) ((_F) |= (_SF))
+#define ClearFlag(_F, _SF) ((_F) &= ~(_SF))
+
+#define PAGE_SIZE 0x1000
+#define MAXLONGLONG 0x7fffffffffffffffLL
+#define MAXIMUM_VOLUME_LABEL_LENGTH (32 * sizeof(WCHAR))
+#define UNICODE_NULL ((WCHAR)0)
+#define EXCEPTION_EXECUTE_HANDLER 1
+
+/* No structured exception handling on the host: the body simply runs */
+#define _SEH2_TRY {
+#define _SEH2_EXCEPT(...) } if (0) {
+#define _SEH2_FINALLY } {
+#define _SEH2_END }
+#define _SEH2_YIELD(__stmt) __stmt
+#define _SEH2_GetExceptionCode() STATUS_UNSUCCESSFUL
+#define _SEH2_LEAVE goto __seh2_leave
+
+typedef NTSTATUS *PNTSTATUS;
+
+/* Status codes used by the driver */
+#define STATUS_SUCCESS                   ((NTSTATUS)0x00000000)
+#define STATUS_PENDING                   ((NTSTATUS)0x00000103)
+#define STATUS_REPARSE                   ((NTSTATUS)0x00000104)
+#define STATUS_BUFFER_OVERFLOW           ((NTSTATUS)0x80000005)
+#define STATUS_NO_MORE_FILES             ((NTSTATUS)0x80000006)
+#define STATUS_NO_MORE_ENTRIES           ((NTSTATUS)0x8000001A)
+#define STATUS_UNSUCCESSFUL              ((NTSTATUS)0xC0000001)
+#define STATUS_NOT_IMPLEMENTED           ((NTSTATUS)0xC0000002)
+#define STATUS_INFO_LENGTH_MISMATCH      ((NTSTATUS)0xC0000004)
+#define STATUS_ACCESS_VIOLATION          ((NTSTATUS)0xC0000005)
+#define STATUS_INVALID_HANDLE            ((NTSTATUS)0xC0000008)
+#define STATUS_INVALID_PARAMETER         ((NTSTATUS)0xC000000D)
+#define STATUS_NO_SUCH_FILE              ((NTSTATUS)0xC000000F)
+#define STATUS_INVALID_DEVICE_REQUEST    ((NTSTATUS)0xC0000010)
+#define STATUS_END_OF_FILE               ((NTSTATUS)0xC0000011)
+#define STATUS_MORE_PROCESSING_REQUIRED  ((NTSTATUS)0xC0000016)
+#define STATUS_NO_MEMORY                 ((NTSTATUS)0xC0000017)
+#define STATUS_ACCESS_DENIED             ((NTSTATUS)0xC0000022)
+#define STATUS_BUFFER_TOO_SMALL          ((NTSTATUS)0xC0000023)
+#define STATUS_OBJECT_NAME_INVALID       ((NTSTATUS)0xC0000033)
+#define STATUS_OBJECT_NAME_NOT_FOUND     ((NTSTATUS)0xC0000034)
+#define STATUS_OBJECT_NAME_COLLISION     ((NTSTATUS)0xC0000035)
+#define STATUS_OBJECT_PATH_NOT_FOUND     ((NTSTATUS)0xC000003A)
+#define STATUS_DATA_ERROR                ((NTSTATUS)0xC000003E)
+#define STATUS_DISK_CORRUPT_ERROR        ((NTSTATUS)0xC0000032)
+#define STATUS_DISK_FULL                 ((NTSTATUS)0xC000007F)
+#define STATUS_INSUFFICIENT_RESOURCES    ((NTSTATUS)0xC000009A)
+#define STATUS_FILE_IS_A_DIRECTORY       ((NTSTATUS)0xC00000BA)
+#define STATUS_NOT_SUPPORTED             ((NTSTATUS)0xC00000BB)
+#define STATUS_INTERNAL_ERROR            ((NTSTATUS)0xC00000E5)
+#define STATUS_NOT_A_DIRECTORY           ((NTSTATUS)0xC0000103)
+#define STATUS_FILE_CORRUPT_ERROR        ((NTSTATUS)0xC0000102)
+#define STATUS_CANT_WAIT                 ((NTSTATUS)0xC00000D8)
+#define STATUS_USER_MAPPED_FILE          ((NTSTATUS)0xC0000243)
+#define STATUS_PARTIAL_COPY              ((NTSTATUS)0x8000000D)
+#define STATUS_INVALID_USER_BUFFER       ((NTSTATUS)0xC00000E8)
+#define STATUS_VOLUME_DIRTY              ((NTSTATUS)0xC0000806)
+#define STATUS_BAD_COMPRESSION_BUFFER    ((NTSTATUS)0xC0000242)
+#define STATUS_UNSUPPORTED_COMPRESSION   ((NTSTATUS)0xC000025F)
+
+/* Pool */
+#define NonPagedPool 0
+#define PagedPool 1
+
+/* Filesystem attributes and flags */
+#define FILE_CASE_SENSITIVE_SEARCH      0x00000001
+#define FILE_CASE_PRESERVED_NAMES       0x00000002
+#define FILE_UNICODE_ON_DISK            0x00000004
+#define FILE_SUPPORTS_SPARSE_FILES      0x00000040
+#define FILE_SUPPORTS_REPARSE_POINTS    0x00000080
+#define FILE_VOLUME_IS_COMPRESSED       0x00008000
+#define FILE_READ_ONLY_VOLUME           0x00080000
+#define FILE_DEVICE_DISK                0x00000007
+#define FILE_FLAG_POSIX_SEMANTICS       0x01000000
+#define VOLUME_IS_DIRTY                 0x00000001
+#define FILE_ATTRIBUTE_READONLY         0x00000001
+#define FILE_ATTRIBUTE_HIDDEN           0x00000002
+#define FILE_ATTRIBUTE_SYSTEM           0x00000004
+#define FILE_ATTRIBUTE_DIRECTORY        0x00000010
+#define FILE_ATTRIBUTE_ARCHIVE          0x00000020
+#define FILE_ATTRIBUTE_NORMAL           0x00000080
+#define FILE_ATTRIBUTE_TEMPORARY        0x00000100
+#define FILE_ATTRIBUTE_SPARSE_FILE      0x00000200
+#define FILE_ATTRIBUTE_REPARSE_POINT    0x00000400
+#define FILE_ATTRIBUTE_COMPRESSED       0x00000800
+#define FILE_ATTRIBUTE_OFFLINE          0x00001000
+#define FILE_ATTRIBUTE_ENCRYPTED        0x00004000
+
+/* Basic types not provided by the host typedefs */
+typedef LONGLONG *PLONGLONG;
+typedef ULONGLONG *PULONGLONG;
+typedef CHAR *PCCHAR;
+typedef ULONG_PTR KSPIN_LOCK, *PKSPIN_LOCK;
+typedef UCHAR KIRQL, *PKIRQL;
+typedef ULONG ACCESS_MASK;
+typedef ULONG LOGICAL;
+typedef LONGLONG USN;
+
+typedef union _ULARGE_INTEGER
+{
+    struct
+    {
+        ULONG LowPart;
+        ULONG HighPart;
+    };
+    struct
+    {
+        ULONG LowPart;
+        ULONG HighPart;
+    } u;
+    ULONGLONG QuadPart;
+} ULARGE_INTEGER, *PULARGE_INTEGER;
+
+typedef struct _RTL_BITMAP
+{
+    ULONG SizeOfBitMap;
+    PULONG Buffer;
+} RTL_BITMAP, *PRTL_BITMAP;
+
+typedef struct _RTL_BITMAP_RUN
+{
+    ULONG StartingIndex;
+    ULONG NumberOfBits;
+} RTL_BITMAP_RUN, *PRTL_BITMAP_RUN;
+
+typedef struct _IO_STATUS_BLOCK
+{
+    NTSTATUS Status;
+    ULONG_PTR Information;
+} IO_STATUS_BLOCK, *PIO_STATUS_BLOCK;
+
+/* Synchronization: the host library is single threaded, the resources only count owners */
+typedef struct _ERESOURCE
+{
+    LONG ActiveCount;
+    BOOLEAN Exclusive;
+} ERESOURCE, *PERESOURCE;
+
+typedef struct _KEVENT
+{
+    LONG State;
+} KEVENT, *PKEVENT;
+
+/* Timers never expire on the host, see KeSetTimer() */
+typedef struct _KDPC
+{
+    PVOID DeferredRoutine;
+    PVOID DeferredContext;
+} KDPC, *PKDPC;
+
+typedef struct _KTIMER
+{
+    LARGE_INTEGER DueTime;
+    PKDPC Dpc;
+} KTIMER, *PKTIMER;
+
+typedef VOID NTAPI KDEFERRED_ROUTINE(PKDPC Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2);
+typedef KDEFERRED_ROUTINE *PKDEFERRED_ROUTINE;
+
+typedef struct _NPAGED_LOOKASIDE_LIST
+{
+    SIZE_T Size;
+    ULONG Tag;
+    ULONG TotalAllocates;
+    ULONG TotalFrees;
+} NPAGED_LOOKASIDE_LIST, *PNPAGED_LOOKASIDE_LIST,
+  PAGED_LOOKASIDE_LIST, *PPAGED_LOOKASIDE_LIST;
+
+/* Map control block: a sorted array of [StartVbn, EndVbn) -> StartingLbn runs */
+typedef struct _NTFS_HOST_MCB_RUN
+{
+    LONGLONG RunStartVbn;
+    LONGLONG RunEndVbn;
+    LONGLONG StartingLbn;
+} NTFS_HOST_MCB_RUN, *PNTFS_HOST_MCB_RUN;
+
+typedef struct _LARGE_MCB
+{
+    ULONG MaximumPairCount;
+    ULONG PairCount;
+    POOL_TYPE PoolType;
+    PNTFS_HOST_MCB_RUN Mapping;
+} LARGE_MCB, *PLARGE_MCB, BASE_MCB, *PBASE_MCB;
+
+typedef struct _FSRTL_COMMON_FCB_HEADER
+{
+    SHORT NodeTypeCode;
+    SHORT NodeByteSize;
+    UCHAR Flags;
+    UCHAR IsFastIoPossible;
+    UCHAR Flags2;
+    UCHAR Reserved;
+    PERESOURCE Resource;
+    PERESOURCE PagingIoResource;
+    LARGE_INTEGER AllocationSize;
+    LARGE_INTEGER FileSize;
+    LARGE_INTEGER ValidDataLength;
+} FSRTL_COMMON_FCB_HEADER, *PFSRTL_COMMON_FCB_HEADER;
+
+typedef struct _CC_FILE_SIZES
+{
+    LARGE_INTEGER AllocationSize;
+    LARGE_INTEGER FileSize;
+    LARGE_INTEGER ValidDataLength;
+} CC_FILE_SIZES, *PCC_FILE_SIZES;
+
+typedef struct _SECTION_OBJECT_POINTERS
+{
+    PVOID DataSectionObject;
+    PVOID SharedCacheMap;
+    PVOID ImageSectionObject;
+} SECTION_OBJECT_POINTERS, *PSECTION_OBJECT_POINTERS;
+
+typedef struct _VPB
+{
+    USHORT Flags;
+    USHORT VolumeLabelLength;
+    struct _DEVICE_OBJECT *DeviceObject;
+    struct _DEVICE_OBJECT *RealDevice;
+    ULONG SerialNumber;
+    ULONG ReferenceCount;
+    WCHAR VolumeLabel[MAXIMUM_VOLUME_LABEL_LENGTH / sizeof(WCHAR)];
+} VPB, *PVPB;
+
+/* On the host a device object wraps an image file; Context is the stdio stream */
+typedef struct _DEVICE_OBJECT
+{
+    PVOID DeviceExtension;
+    PVPB Vpb;
+    ULONG Characteristics;
+    ULONG SectorSize;
+    ULONG Flags;
+    PVOID Context;
+    ULONGLONG Length;
+    ULONGLONG BytesRead;
+    ULONGLONG BytesWritten;
+    ULONG ReadRequests;
+    ULONG WriteRequests;
+} DEVICE_OBJECT, *PDEVICE_OBJECT;
+
+typedef struct _DRIVER_OBJECT
+{
+    PDEVICE_OBJECT DeviceObject;
+} DRIVER_OBJECT, *PDRIVER_OBJECT;
+
+typedef struct _FILE_OBJECT
+{
+    PDEVICE_OBJECT DeviceObject;
+    PVPB Vpb;
+    PVOID FsContext;
+    PVOID FsContext2;
+    PSECTION_OBJECT_POINTERS SectionObjectPointer;
+    PVOID PrivateCacheMap;
+    NTSTATUS FinalStatus;
+    struct _FILE_OBJECT *RelatedFileObject;
+    ULONG Flags;
+    UNICODE_STRING FileName;
+    LARGE_INTEGER CurrentByteOffset;
+} FILE_OBJECT, *PFILE_OBJECT;
+
+typedef struct _CACHE_MANAGER_CALLBACKS
+{
+    PVOID AcquireForLazyWrite;
+    PVOID ReleaseFromLazyWrite;
+    PVOID AcquireForReadAhead;
+    PVOID ReleaseFromReadAhead;
+} CACHE_MANAGER_CALLBACKS, *PCACHE_MANAGER_CALLBACKS;
+
+typedef struct _FAST_IO_DISPATCH
+{
+    ULONG SizeOfFastIoDispatch;
+} FAST_IO_DISPATCH, *PFAST_IO_DISPATCH;
+
+typedef struct _WORK_QUEUE_ITEM
+{
+    LIST_ENTRY List;
+    PVOID WorkerRoutine;
+    PVOID Parameter;
+} WORK_QUEUE_ITEM, *PWORK_QUEUE_ITEM;
+
+typedef VOID NTAPI WORKER_THREAD_ROUTINE(PVOID Parameter);
+typedef WORKER_THREAD_ROUTINE *PWORKER_THREAD_ROUTINE;
+
+typedef enum _WORK_QUEUE_TYPE
+{
+    CriticalWorkQueue,
+    DelayedWorkQueue
+} WORK_QUEUE_TYPE;
+
+typedef enum _FS_INFORMATION_CLASS
+{
+    FileFsVolumeInformation = 1,
+    FileFsLabelInformation,
+    FileFsSizeInformation,
+    FileFsDeviceInformation,
+    FileFsAttributeInformation,
+    FileFsControlInformation,
+    FileFsFullSizeInformation,
+    FileFsObjectIdInformation,
+    FileFsDriverPathInformation,
+    FileFsVolumeFlagsInformation,
+    FileFsMaximumInformation
+} FS_INFORMATION_CLASS, *PFS_INFORMATION_CLASS;
+
+typedef enum _LOCK_OPERATION
+{
+    IoReadAccess,
+    IoWriteAccess,
+    IoModifyAccess
+} LOCK_OPERATION;
+
+#define IRP_MJ_READ     0x03
+#define IRP_MJ_WRITE    0x04
+
+typedef struct _IO_STACK_LOCATION
+{
+    UCHAR MajorFunction;
+    UCHAR MinorFunction;
+    UCHAR Flags;
+    UCHAR Control;
+    union
+    {
+        struct
+        {
+            ULONG Length;
+            FS_INFORMATION_CLASS FsInformationClass;
+        } QueryVolume;
+        struct
+        {
+            ULONG Length;
+            ULONG Key;
+            LARGE_INTEGER ByteOffset;
+        } Read;
+        struct
+        {
+            ULONG Length;
+            ULONG Key;
+            LARGE_INTEGER ByteOffset;
+        } Write;
+    } Parameters;
+    PDEVICE_OBJECT DeviceObject;
+    PFILE_OBJECT FileObject;
+} IO_STACK_LOCATION, *PIO_STACK_LOCATION;
+
+typedef struct _IRP
+{
+    ULONG Flags;
+    union
+    {
+        PVOID SystemBuffer;
+    } AssociatedIrp;
+    IO_STATUS_BLOCK IoStatus;
+    PVOID UserBuffer;
+    PVOID MdlAddress;
+} IRP, *PIRP;
+
+typedef struct _FILE_FS_VOLUME_INFORMATION
+{
+    LARGE_INTEGER VolumeCreationTime;
+    ULONG VolumeSerialNumber;
+    ULONG VolumeLabelLength;
+    BOOLEAN SupportsObjects;
+    WCHAR VolumeLabel[1];
+} FILE_FS_VOLUME_INFORMATION, *PFILE_FS_VOLUME_INFORMATION;
+
+typedef struct _FILE_FS_SIZE_INFORMATION
+{
+    LARGE_INTEGER TotalAllocationUnits;
+    LARGE_INTEGER AvailableAllocationUnits;
+    ULONG SectorsPerAllocationUnit;
+    ULONG BytesPerSector;
+} FILE_FS_SIZE_INFORMATION, *PFILE_FS_SIZE_INFORMATION;
+
+typedef struct _FILE_FS_DEVICE_INFORMATION
+{
+    ULONG DeviceType;
+    ULONG Characteristics;
+} FILE_FS_DEVICE_INFORMATION, *PFILE_FS_DEVICE_INFORMATION;
+
+typedef struct _FILE_FS_ATTRIBUTE_INFORMATION
+{
+    ULONG FileSystemAttributes;
+    LONG MaximumComponentNameLength;
+    ULONG FileSystemNameLength;
+    WCHAR FileSystemName[1];
+} FILE_FS_ATTRIBUTE_INFORMATION, *PFILE_FS_ATTRIBUTE_INFORMATION;
+
+/* Dispatch prototypes; nothing of the IRP side is built on the host */
+typedef NTSTATUS NTAPI DRIVER_DISPATCH(PDEVICE_OBJECT DeviceObject, PIRP Irp);
+typedef NTSTATUS NTAPI DRIVER_INITIALIZE(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath);
+typedef BOOLEAN NTAPI FAST_IO_CHECK_IF_POSSIBLE(PFILE_OBJECT FileObject, PLARGE_INTEGER FileOffset,
+                                                ULONG Length, BOOLEAN Wait, ULONG LockKey,
+                                                BOOLEAN CheckForReadOperation,
+                                                PIO_STATUS_BLOCK IoStatus, PDEVICE_OBJECT DeviceObject);
+typedef BOOLEAN NTAPI FAST_IO_READ(PFILE_OBJECT FileObject, PLARGE_INTEGER FileOffset, ULONG Length,
+                                   BOOLEAN Wait, ULONG LockKey, PVOID Buffer,
+                                   PIO_STATUS_BLOCK IoStatus, PDEVICE_OBJECT DeviceObject);
+typedef BOOLEAN NTAPI FAST_IO_WRITE(PFILE_OBJECT FileObject, PLARGE_INTEGER FileOffset, ULONG Length,
+                                    BOOLEAN Wait, ULONG LockKey, PVOID Buffer,
+                                    PIO_STATUS_BLOCK IoStatus, PDEVICE_OBJECT DeviceObject);
+
+/* Debug output */
+extern BOOLEAN NtfsHostVerbose;
+
+ULONG
+NtfsHostDbgPrint(PCSTR Format, ...);
+
+/* Executive */
+PVOID NTAPI ExAllocatePoolWithTag(POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag);
+VOID NTAPI ExFreePoolWithTag(PVOID P, ULONG Tag);
+#define ExAllocatePool(t, n) ExAllocatePoolWithTag(t, n, 0)
+#define ExFreePool(p) ExFreePoolWithTag(p, 0)
+
+VOID NTAPI ExInitializeNPagedLookasideList(PNPAGED_LOOKASIDE_LIST Lookaside, PVOID Allocate, PVOID Free,
+                                           ULONG Flags, SIZE_T Size, ULONG Tag, USHORT Depth);
+VOID NTAPI ExDeleteNPagedLookasideList(PNPAGED_LOOKASIDE_LIST Lookaside);
+PVOID NTAPI ExAllocateFromNPagedLookasideList(PNPAGED_LOOKASIDE_LIST Lookaside);
+VOID NTAPI ExFreeToNPagedLookasideList(PNPAGED_LOOKASIDE_LIST Lookaside, PVOID Entry);
+
+NTSTATUS NTAPI ExInitializeResourceLite(PERESOURCE Resource);
+NTSTATUS NTAPI ExDeleteResourceLite(PERESOURCE Resource);
+BOOLEAN NTAPI ExAcquireResourceExclusiveLite(PERESOURCE Resource, BOOLEAN Wait);
+BOOLEAN NTAPI ExAcquireResourceSharedLite(PERESOURCE Resource, BOOLEAN Wait);
+BOOLEAN NTAPI ExAcquireSharedStarveExclusive(PERESOURCE Resource, BOOLEAN Wait);
+VOID NTAPI ExReleaseResourceLite(PERESOURCE Resource);
+BOOLEAN NTAPI ExIsResourceAcquiredExclusiveLite(PERESOURCE Resource);
+ULONG NTAPI ExIsResourceAcquiredSharedLite(PERESOURCE Resource);
+
+#define ExInitializeWorkItem(Item, Routine, Context) \
+    ((Item)->WorkerRoutine = (PVOID)(Routine), (Item)->Parameter = (Context))
+VOID NTAPI ExQueueWorkItem(PWORK_QUEUE_ITEM WorkItem, WORK_QUEUE_TYPE QueueType);
+
+VOID NTAPI ExRaiseStatus(NTSTATUS Status);
+
+/* Kernel */
+VOID NTAPI KeQuerySystemTime(PLARGE_INTEGER CurrentTime);
+#define KeInitializeSpinLock(l) (*(l) = 0)
+#define KeAcquireSpinLock(l, i) (*(i) = 0, *(l) = 1)
+#define KeReleaseSpinLock(l, i) ((void)(i), *(l) = 0)
+VOID NTAPI KeInitializeDpc(PKDPC Dpc, PKDEFERRED_ROUTINE DeferredRoutine, PVOID DeferredContext);
+VOID NTAPI KeInitializeTimer(PKTIMER Timer);
+BOOLEAN NTAPI KeSetTimer(PKTIMER Timer, LARGE_INTEGER DueTime, PKDPC Dpc);
+BOOLEAN NTAPI KeCancelTimer(PKTIMER Timer);
+
+/* The host library is single threaded */
+#define InterlockedIncrement(Addend) (++*(Addend))
+#define InterlockedDecrement(Addend) (--*(Addend))
+#define InterlockedIncrement64(Addend) (++*(Addend))
+#define InterlockedExchange(Target, Value) NtfsHostExchange(Target, Value)
+#define InterlockedCompareExchange(Destination, Exchange, Comperand) \
+    NtfsHostCompareExchange(Destination, Exchange, Comperand)
+
+static __inline LONG NtfsHostExchange(LONG *Target, LONG Value)
+{
+    LONG Old = *Target;
+    *Target = Value;
+    return Old;
+}
+
+static __inline LONG NtfsHostCompareExchange(LONG *Destination, LONG Exchange, LONG Comperand)
+{
+    LONG Old = *Destination;
+    if (Old == Comperand)
+        *Destination = Exchange;
+    return Old;
+}
+
+/* Memory manager and cache manager */
+BOOLEAN NTAPI MmCanFileBeTruncated(PSECTION_OBJECT_POINTERS SectionPointer, PLARGE_INTEGER NewFileSize);
+VOID NTAPI CcSetFileSizes(PFILE_OBJECT FileObject, PCC_FILE_SIZES FileSizes);
+
+/* Run time library */
+VOID NTAPI RtlInitUnicodeString(PUNICODE_STRING DestinationString, PCWSTR SourceString);
+LONG NTAPI RtlCompareUnicodeString(PCUNICODE_STRING String1, PCUNICODE_STRING String2, BOOLEAN CaseInSensitive);
+BOOLEAN NTAPI RtlEqualUnicodeString(PCUNICODE_STRING String1, PCUNICODE_STRING String2, BOOLEAN CaseInSensitive);
+WCHAR NTAPI RtlUpcaseUnicodeChar(WCHAR Source);
+NTSTATUS NTAPI RtlUpcaseUnicodeString(PUNICODE_STRING DestinationString, PCUNICODE_STRING SourceString,
+                                      BOOLEAN AllocateDestinationString);
+VOID NTAPI RtlFreeUnicodeString(PUNICODE_STRING UnicodeString);
+SIZE_T NTAPI RtlCompareMemory(const VOID *Source1, const VOID *Source2, SIZE_T Length);
+BOOLEAN NTAPI RtlIsNameLegalDOS8Dot3(PCUNICODE_STRING Name, PANSI_STRING OemName, PBOOLEAN NameContainsSpaces);
+#define RtlFillMemory(d, l, f) memset(d, f, l)
+#define RtlEqualMemory(d, s, l) (!memcmp(d, s, l))
+#define RtlSecureZeroMemory(d, l) memset(d, 0, l)
+
+unsigned char BitScanForward(ULONG *Index, ULONG Mask);
+unsigned char BitScanReverse(ULONG *Index, ULONG Mask);
+#define RtlFillMemoryUlong(dst, len, val) memset(dst, (UCHAR)(val), len)
+
+VOID NTAPI RtlInitializeBitMap(PRTL_BITMAP BitMapHeader, PULONG BitMapBuffer, ULONG SizeOfBitMap);
+VOID NTAPI RtlClearAllBits(PRTL_BITMAP BitMapHeader);
+VOID NTAPI RtlSetAllBits(PRTL_BITMAP BitMapHeader);
+VOID NTAPI RtlClearBit(PRTL_BITMAP BitMapHeader, ULONG BitNumber);
+VOID NTAPI RtlSetBit(PRTL_BITMAP BitMapHeader, ULONG BitNumber);
+VOID NTAPI RtlClearBits(PRTL_BITMAP BitMapHeader, ULONG StartingIndex, ULONG NumberToClear);
+VOID NTAPI RtlSetBits(PRTL_BITMAP BitMapHeader, ULONG StartingIndex, ULONG NumberToSet);
+BOOLEAN NTAPI RtlTestBit(PRTL_BITMAP BitMapHeader, ULONG BitNumber);
+BOOLEAN NTAPI RtlAreBitsClear(PRTL_BITMAP BitMapHeader, ULONG StartingIndex, ULONG Length);
+BOOLEAN NTAPI RtlAreBitsSet(PRTL_BITMAP BitMapHeader, ULONG StartingIndex, ULONG Length);
+ULONG NTAPI RtlNumberOfSetBits(PRTL_BITMAP BitMapHeader);
+ULONG NTAPI RtlNumberOfClearBits(PRTL_BITMAP BitMapHeader);
+ULONG NTAPI RtlFindClearBits(PRTL_BITMAP BitMapHeader, ULONG NumberToFind, ULONG HintIndex);
+ULONG NTAPI RtlFindSetBits(PRTL_BITMAP BitMapHeader, ULONG NumberToFind, ULONG HintIndex);
+ULONG NTAPI RtlFindClearBitsAndSet(PRTL_BITMAP BitMapHeader, ULONG NumberToFind, ULONG HintIndex);
+ULONG NTAPI RtlFindSetBitsAndClear(PRTL_BITMAP BitMapHeader, ULONG NumberToFind, ULONG HintIndex);
+ULONG NTAPI RtlFindNextForwardRunClear(PRTL_BITMAP BitMapHeader, ULONG FromIndex, PULONG StartingRunIndex);
+ULONG NTAPI RtlFindNextForwardRunSet(PRTL_BITMAP BitMapHeader, ULONG FromIndex, PULONG StartingRunIndex);
+ULONG NTAPI RtlFindLastBackwardRunClear(PRTL_BITMAP BitMapHeader, ULONG FromIndex, PULONG StartingRunIndex);
+ULONG NTAPI RtlFindFirstRunClear(PRTL_BITMAP BitMapHeader, PULONG StartingIndex);
+ULONG NTAPI RtlFindLongestRunClear(PRTL_BITMAP BitMapHeader, PULONG StartingIndex);
+ULONG NTAPI RtlFindClearRuns(PRTL_BITMAP BitMapHeader, PRTL_BITMAP_RUN RunArray,
+                             ULONG SizeOfRunArray, BOOLEAN LocateLongestRuns);
+#define COMPRESSION_FORMAT_NONE      0x0000
+#define COMPRESSION_FORMAT_DEFAULT   0x0001
+#define COMPRESSION_FORMAT_LZNT1     0x0002
+#define COMPRESSION_ENGINE_STANDARD  0x0000
+#define COMPRESSION_ENGINE_MAXIMUM   0x0100
+
+typedef struct _COMPRESSED_DATA_INFO
+{
+    USHORT CompressionFormatAndEngine;
+    UCHAR CompressionUnitShift;
+    UCHAR ChunkShift;
+    UCHAR ClusterShift;
+    UCHAR Reserved;
+    USHORT NumberOfChunks;
+    ULONG CompressedChunkSizes[1];
+} COMPRESSED_DATA_INFO, *PCOMPRESSED_DATA_INFO;
+
+NTSTATUS NTAPI RtlDecompressBuffer(USHORT CompressionFormat, PUCHAR UncompressedBuffer, ULONG UncompressedBufferSize,
+                                   PUCHAR CompressedBuffer, ULONG CompressedBufferSize, PULONG FinalUncompressedSize);
+
+#define RtlCheckBit(BMH, BP) (((((PLONG)(BMH)->Buffer)[(BP) / 32]) >> ((BP) % 32)) & 0x1)
+
+/* File system run time library */
+VOID NTAPI FsRtlInitializeLargeMcb(PLARGE_MCB Mcb, POOL_TYPE PoolType);
+VOID NTAPI FsRtlUninitializeLargeMcb(PLARGE_MCB Mcb);
+VOID NTAPI FsRtlResetLargeMcb(PLARGE_MCB Mcb, BOOLEAN SelfSynchronized);
+BOOLEAN NTAPI FsRtlAddLargeMcbEntry(PLARGE_MCB Mcb, LONGLONG Vbn, LONGLONG Lbn, LONGLONG SectorCount);
+VOID NTAPI FsRtlRemoveLargeMcbEntry(PLARGE_MCB Mcb, LONGLONG Vbn, LONGLONG SectorCount);
+BOOLEAN NTAPI FsRtlLookupLargeMcbEntry(PLARGE_MCB Mcb, LONGLONG Vbn, PLONGLONG Lbn,
+                                       PLONGLONG SectorCountFromLbn, PLONGLONG StartingLbn,
+                                       PLONGLONG SectorCountFromStartingLbn, PULONG Index);
+BOOLEAN NTAPI FsRtlLookupLastLargeMcbEntry(PLARGE_MCB Mcb, PLONGLONG Vbn, PLONGLONG Lbn);
+BOOLEAN NTAPI FsRtlGetNextLargeMcbEntry(PLARGE_MCB Mcb, ULONG RunIndex, PLONGLONG Vbn,
+                                        PLONGLONG Lbn, PLONGLONG SectorCount);
+ULONG NTAPI FsRtlNumberOfRunsInLargeMcb(PLARGE_MCB Mcb);
+VOID NTAPI FsRtlTruncateLargeMcb(PLARGE_MCB Mcb, LONGLONG Vbn);
+
+#define FsRtlEnterFileSystem()
+#define FsRtlExitFileSystem()
+VOID NTAPI FsRtlDissectName(UNICODE_STRING Name, PUNICODE_STRING FirstPart, PUNICODE_STRING RemainingPart);
+BOOLEAN NTAPI FsRtlIsNameInExpression(PUNICODE_STRING Expression, PUNICODE_STRING Name,
+                                      BOOLEAN IgnoreCase, PWCHAR UpcaseTable);
+
+#endif /* NTFSHOST_H */
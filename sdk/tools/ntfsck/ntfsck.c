@@ -0,0 +1,225 @@
+/*
+ * PROJECT:     ReactOS NTFS Image Checker
+ * LICENSE:     GPL-2.0+ (https://spdx.org/licenses/GPL-2.0+)
+ * PURPOSE:     Checks an NTFS image file with the check code of ntfslib
+ * COPYRIGHT:   Copyright 2026 ReactOS Team
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "ntfslib.h"
+
+typedef struct
+{
+    int Image;
+    ULONG Percent;
+} NTFSCK_CONTEXT, *PNTFSCK_CONTEXT;
+
+typedef struct
+{
+    pthread_t Thread;
+    PNTFS_CHECK_WORKER Worker;
+    PVOID Parameter;
+} NTFSCK_THREAD, *PNTFSCK_THREAD;
+
+static
+NTSTATUS
+NtfsckRead(IN PVOID Context,
+           IN ULONGLONG Offset,
+           OUT PVOID Buffer,
+           IN ULONG Length)
+{
+    PNTFSCK_CONTEXT Ntfsck = Context;
+    ssize_t Done;
+
+    /* pread doesn't move a shared file position, the workers can use it at the same time */
+    while (Length > 0)
+    {
+        Done = pread(Ntfsck->Image, Buffer, Length, (off_t)Offset);
+        if (Done <= 0)
+            return STATUS_IO_DEVICE_ERROR;
+
+        Buffer = (PUCHAR)Buffer + Done;
+        Offset += Done;
+        Length -= (ULONG)Done;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static
+NTSTATUS
+NtfsckWrite(IN PVOID Context,
+            IN ULONGLONG Offset,
+            IN PVOID Buffer,
+            IN ULONG Length)
+{
+    PNTFSCK_CONTEXT Ntfsck = Context;
+    ssize_t Done;
+
+    while (Length > 0)
+    {
+        Done = pwrite(Ntfsck->Image, Buffer, Length, (off_t)Offset);
+        if (Done <= 0)
+            return STATUS_IO_DEVICE_ERROR;
+
+        Buffer = (PUCHAR)Buffer + Done;
+        Offset += Done;
+        Length -= (ULONG)Done;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static
+void *
+NtfsckThread(void *Parameter)
+{
+    PNTFSCK_THREAD Thread = Parameter;
+
+    Thread->Worker(Thread->Parameter);
+    return NULL;
+}
+
+static
+NTSTATUS
+NtfsckRunWorkers(IN PVOID Context,
+                 IN PNTFS_CHECK_WORKER Worker,
+                 IN PVOID *Parameters,
+                 IN ULONG Count)
+{
+    PNTFSCK_THREAD Threads;
+    NTSTATUS Status = STATUS_SUCCESS;
+    ULONG i, Started;
+
+    Threads = calloc(Count, sizeof(NTFSCK_THREAD));
+    if (Threads == NULL)
+        return STATUS_INSUFFICIENT_RESOURCES;
+
+    for (Started = 0; Started < Count; Started++)
+    {
+        Threads[Started].Worker = Worker;
+        Threads[Started].Parameter = Parameters[Started];
+        if (pthread_create(&Threads[Started].Thread, NULL, NtfsckThread, &Threads[Started]) != 0)
+        {
+            /* The workers share the work out, those already running do it all */
+            if (Started == 0)
+                Status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+    }
+
+    for (i = 0; i < Started; i++)
+        pthread_join(Threads[i].Thread, NULL);
+
+    free(Threads);
+    return Status;
+}
+
+static
+VOID
+NtfsckMessage(IN PVOID Context,
+              IN PCSTR Message)
+{
+    fputs(Message, stdout);
+}
+
+static
+VOID
+NtfsckProgress(IN PVOID Context,
+               IN ULONG Percent)
+{
+    PNTFSCK_CONTEXT Ntfsck = Context;
+
+    if (Percent / 10 != Ntfsck->Percent / 10)
+    {
+        fprintf(stderr, "%lu%%\n", (unsigned long)Percent);
+        fflush(stderr);
+    }
+
+    Ntfsck->Percent = Percent;
+}
+
+static
+void
+NtfsckUsage(void)
+{
+    printf("Usage: ntfsck [-f] [-v] [-p] [-t threads] image\n"
+           "  -f  fix the errors which can be fixed, $Bitmap and $MFTMirr\n"
+           "  -v  verbose, also prints every error of a badly damaged volume\n"
+           "  -p  print the progress on stderr\n"
+           "  -t  number of threads. Default: the number of processors\n"
+           "Exit code: 0 if the volume is sound, 1 if errors remain, 2 if the check failed\n");
+}
+
+int main(int argc, char **argv)
+{
+    NTFS_CHECK_PARAMETERS Parameters;
+    NTFS_CHECK_RESULTS Results;
+    NTFSCK_CONTEXT Context;
+    const char *ImageName = NULL;
+    BOOLEAN Progress = FALSE;
+    long Threads;
+    NTSTATUS Status;
+    int i;
+
+    memset(&Parameters, 0, sizeof(Parameters));
+    memset(&Context, 0, sizeof(Context));
+
+    Threads = sysconf(_SC_NPROCESSORS_ONLN);
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-f") == 0)
+            Parameters.FixErrors = TRUE;
+        else if (strcmp(argv[i], "-v") == 0)
+            Parameters.Verbose = TRUE;
+        else if (strcmp(argv[i], "-p") == 0)
+            Progress = TRUE;
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            Threads = strtol(argv[++i], NULL, 0);
+        else if (argv[i][0] != '-' && ImageName == NULL)
+            ImageName = argv[i];
+        else
+        {
+            NtfsckUsage();
+            return 2;
+        }
+    }
+
+    if (ImageName == NULL || Threads < 1)
+    {
+        NtfsckUsage();
+        return 2;
+    }
+
+    Context.Image = open(ImageName, Parameters.FixErrors ? O_RDWR : O_RDONLY);
+    if (Context.Image < 0)
+    {
+        printf("Cannot open %s\n", ImageName);
+        return 2;
+    }
+
+    Parameters.ThreadCount = (ULONG)Threads;
+    Parameters.ReadRoutine = NtfsckRead;
+    Parameters.WriteRoutine = NtfsckWrite;
+    Parameters.RunWorkersRoutine = NtfsckRunWorkers;
+    Parameters.MessageRoutine = NtfsckMessage;
+    Parameters.ProgressRoutine = Progress ? NtfsckProgress : NULL;
+    Parameters.Context = &Context;
+
+    Status = NtfsCheckVolume(&Parameters, &Results);
+    if (close(Context.Image) != 0 && NT_SUCCESS(Status))
+        Status = STATUS_IO_DEVICE_ERROR;
+
+    if (Status == STATUS_DISK_CORRUPT_ERROR)
+        return 1;
+
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Checking %s failed, status 0x%08lx\n", ImageName, (unsigned long)(ULONG)Status);
+        return 2;
+    }
+
+    return 0;
+}
@@ -178,6 +178,9 @@ VOID CpuSimulate(VOID)
     CpuCallLevel++;
     DPRINT("CpuSimulate --> Level %d\n", CpuCallLevel);
 
+    /* The host may have changed the guest code since the CPU last ran */
+    Fast486InvalidateCache(&EmulatorContext);
+
     CpuRunning = TRUE;
     while (VdmRunning && CpuRunning)
     {
@@ -226,6 +229,7 @@ BOOLEAN CpuInitialize(VOID)
     Fast486Initialize(&EmulatorContext,
                       EmulatorReadMemory,
                       EmulatorWriteMemory,
+                      EmulatorMapMemory,
                       EmulatorReadIo,
                       EmulatorWriteIo,
                       EmulatorBiosOperation,
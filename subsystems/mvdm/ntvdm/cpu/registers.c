@@ -78,6 +78,8 @@ getIntelRegistersPointer(VOID)
 
     if (IntelRegPtr.ContextFlags & CONTEXT_CONTROL)
     {
+        Fast486SyncFlags(&EmulatorContext);
+
         IntelRegPtr.Ebp     = EmulatorContext.GeneralRegs[FAST486_REG_EBP].Long;
         IntelRegPtr.Eip     = EmulatorContext.InstPtr.Long;
         IntelRegPtr.SegCs   = EmulatorContext.SegmentRegs[FAST486_REG_CS].Selector;
@@ -565,6 +567,7 @@ ULONG
 WINAPI
 getCF(VOID)
 {
+    Fast486SyncFlags(&EmulatorContext);
     return EmulatorContext.Flags.Cf;
 }
 
@@ -572,6 +575,7 @@ VOID
 WINAPI
 setCF(ULONG Flag)
 {
+    Fast486SyncFlags(&EmulatorContext);
     EmulatorContext.Flags.Cf = !!(Flag & 1);
 }
 
@@ -579,6 +583,7 @@ ULONG
 WINAPI
 getPF(VOID)
 {
+    Fast486SyncFlags(&EmulatorContext);
     return EmulatorContext.Flags.Pf;
 }
 
@@ -586,6 +591,7 @@ VOID
 WINAPI
 setPF(ULONG Flag)
 {
+    Fast486SyncFlags(&EmulatorContext);
     EmulatorContext.Flags.Pf = !!(Flag & 1);
 }
 
@@ -593,6 +599,7 @@ ULONG
 WINAPI
 getAF(VOID)
 {
+    Fast486SyncFlags(&EmulatorContext);
     return EmulatorContext.Flags.Af;
 }
 
@@ -600,6 +607,7 @@ VOID
 WINAPI
 setAF(ULONG Flag)
 {
+    Fast486SyncFlags(&EmulatorContext);
     EmulatorContext.Flags.Af = !!(Flag & 1);
 }
 
@@ -607,6 +615,7 @@ ULONG
 WINAPI
 getZF(VOID)
 {
+    Fast486SyncFlags(&EmulatorContext);
     return EmulatorContext.Flags.Zf;
 }
 
@@ -614,6 +623,7 @@ VOID
 WINAPI
 setZF(ULONG Flag)
 {
+    Fast486SyncFlags(&EmulatorContext);
     EmulatorContext.Flags.Zf = !!(Flag & 1);
 }
 
@@ -621,6 +631,7 @@ ULONG
 WINAPI
 getSF(VOID)
 {
+    Fast486SyncFlags(&EmulatorContext);
     return EmulatorContext.Flags.Sf;
 }
 
@@ -628,6 +639,7 @@ VOID
 WINAPI
 setSF(ULONG Flag)
 {
+    Fast486SyncFlags(&EmulatorContext);
     EmulatorContext.Flags.Sf = !!(Flag & 1);
 }
 
@@ -663,6 +675,7 @@ ULONG
 WINAPI
 getOF(VOID)
 {
+    Fast486SyncFlags(&EmulatorContext);
     return EmulatorContext.Flags.Of;
 }
 
@@ -670,6 +683,7 @@ VOID
 WINAPI
 setOF(ULONG Flag)
 {
+    Fast486SyncFlags(&EmulatorContext);
     EmulatorContext.Flags.Of = !!(Flag & 1);
 }
 
@@ -679,6 +693,7 @@ ULONG
 WINAPI
 getEFLAGS(VOID)
 {
+    Fast486SyncFlags(&EmulatorContext);
     return EmulatorContext.Flags.Long;
 }
 
@@ -686,6 +701,7 @@ VOID
 WINAPI
 setEFLAGS(ULONG Flags)
 {
+    Fast486SyncFlags(&EmulatorContext);
     EmulatorContext.Flags.Long = Flags;
 }
 
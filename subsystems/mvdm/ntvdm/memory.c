@@ -272,9 +272,28 @@ VOID FASTCALL EmulatorCopyMemory(PFAST486_STATE State, ULONG DestAddress, ULONG
     // It is freed when NTVDM termiantes.
 }
 
+PVOID FASTCALL EmulatorMapMemory(PFAST486_STATE State, ULONG Address)
+{
+    UNREFERENCED_PARAMETER(State);
+
+    /* If the A20 line is disabled, mask bit 20 */
+    if (!A20Line) Address &= ~(1 << 20);
+
+    /* The pages above the limit (and the mirror of the BIOS entry point) aren't RAM */
+    if (Address >= MAX_ADDRESS) return NULL;
+
+    /* Hooked pages must go through EmulatorReadMemory and EmulatorWriteMemory */
+    if (PageTable[Address >> 12] != NULL) return NULL;
+
+    return REAL_TO_PHYS(Address);
+}
+
 VOID EmulatorSetA20(BOOLEAN Enabled)
 {
     A20Line = Enabled;
+
+    /* The pages mapped above 1 MB changed */
+    Fast486InvalidateCache(&EmulatorContext);
 }
 
 BOOLEAN EmulatorGetA20(VOID)
@@ -346,6 +365,9 @@ MemInstallFastMemoryHook(PVOID Address,
     /* Add the hook entry to the page table */
     for (i = FirstPage; i <= LastPage; i++) PageTable[i] = Hook;
 
+    /* The CPU may no longer access these pages directly */
+    Fast486InvalidateCache(&EmulatorContext);
+
     return TRUE;
 }
 
@@ -542,6 +564,9 @@ VDDInstallMemoryHook(IN HANDLE hVdd,
     /* Add the hook entry to the page table */
     for (i = FirstPage; i <= LastPage; i++) PageTable[i] = Hook;
 
+    /* The CPU may no longer access these pages directly */
+    Fast486InvalidateCache(&EmulatorContext);
+
     return TRUE;
 }
 
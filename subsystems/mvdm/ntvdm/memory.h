@@ -65,6 +65,14 @@ EmulatorCopyMemory
     ULONG Size
 );
 
+PVOID
+FASTCALL
+EmulatorMapMemory
+(
+    PFAST486_STATE State,
+    ULONG Address
+);
+
 VOID EmulatorSetA20(BOOLEAN Enabled);
 BOOLEAN EmulatorGetA20(VOID);
 